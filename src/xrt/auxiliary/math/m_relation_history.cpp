@@ -19,8 +19,8 @@
 #include "util/u_trace_marker.h"
 #include "xrt/xrt_defines.h"
 #include "os/os_threading.h"
-#include "util/u_template_historybuf.hpp"
 
+#include <atomic>
 #include <memory>
 #include <algorithm>
 #include <cstring>
@@ -29,8 +29,8 @@
 #include <stdint.h>
 #include <assert.h>
 #include <mutex>
+#include <thread>
 
-using namespace xrt::auxiliary::util;
 namespace os = xrt::auxiliary::os;
 
 struct relation_history_entry
@@ -41,12 +41,354 @@ struct relation_history_entry
 
 static constexpr size_t BufLen = 4096;
 
+/*!
+ * Number of relations interpolated together by @ref m_relation_history_get_batch.
+ */
+static constexpr uint32_t BatchLen = 32;
+
+/*!
+ * The history is a ring of entries guarded by a sequence lock, readers never
+ * take a lock and instead retry if the writer changed the history while they
+ * were reading it. Writers are serialized with a mutex.
+ */
 struct m_relation_history
 {
-	HistoryBuffer<struct relation_history_entry, BufLen> impl;
-	os::Mutex mutex;
+	//! Indexed with the number of pushed entries modulo BufLen.
+	struct relation_history_entry entries[BufLen];
+
+	//! Odd while the history is being changed.
+	std::atomic<uint64_t> seq{0};
+
+	//! Valid entries are [begin, end), counted from the first push.
+	std::atomic<uint64_t> begin{0};
+	std::atomic<uint64_t> end{0};
+
+	//! Only taken by writers.
+	os::Mutex write_mutex;
+};
+
+/*!
+ * The entries around a timestamp, copied out of the history.
+ */
+struct relation_history_span
+{
+	enum m_relation_history_result result;
+
+	//! The found entry, or the one before the timestamp if interpolating.
+	struct relation_history_entry before;
+
+	//! The entry after the timestamp, only set if interpolating.
+	struct relation_history_entry after;
+};
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static inline const relation_history_entry &
+entry_at(const struct m_relation_history *rh, uint64_t index)
+{
+	return rh->entries[index % BufLen];
+}
+
+static void
+write_begin(struct m_relation_history *rh)
+{
+	rh->seq.store(rh->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void
+write_end(struct m_relation_history *rh)
+{
+	rh->seq.store(rh->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/*!
+ * Calls @p func until it has read the history without it changing under it.
+ * What @p func reads may be torn, it must only copy things out and never
+ * index with what it reads without bounds checking.
+ */
+template <typename Func>
+static void
+read_consistent(const struct m_relation_history *rh, Func func)
+{
+	while (true) {
+		uint64_t seq = rh->seq.load(std::memory_order_acquire);
+		if ((seq & 1) != 0) {
+			// The writer only copies one entry, it is quickly done.
+			std::this_thread::yield();
+			continue;
+		}
+
+		func(rh->begin.load(std::memory_order_relaxed), rh->end.load(std::memory_order_relaxed));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (rh->seq.load(std::memory_order_relaxed) == seq) {
+			return;
+		}
+	}
+}
+
+static void
+find_span(const struct m_relation_history *rh, uint64_t at_timestamp_ns, struct relation_history_span *out_span)
+{
+	read_consistent(rh, [&](uint64_t begin, uint64_t end) {
+		if (begin >= end || at_timestamp_ns == 0) {
+			// Do nothing. You push nothing to the buffer you get nothing from the buffer.
+			out_span->result = M_RELATION_HISTORY_RESULT_INVALID;
+			return;
+		}
+
+		// Find the first entry *not less than* our timestamp.
+		uint64_t lo = begin;
+		uint64_t hi = end;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (entry_at(rh, mid).timestamp < at_timestamp_ns) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		if (lo == end) {
+			// The desired timestamp is after what our buffer contains.
+			out_span->result = M_RELATION_HISTORY_RESULT_PREDICTED;
+			out_span->before = entry_at(rh, end - 1);
+		} else if (entry_at(rh, lo).timestamp == at_timestamp_ns) {
+			out_span->result = M_RELATION_HISTORY_RESULT_EXACT;
+			out_span->before = entry_at(rh, lo);
+		} else if (lo == begin) {
+			// The desired timestamp is before what our buffer contains.
+			out_span->result = M_RELATION_HISTORY_RESULT_REVERSE_PREDICTED;
+			out_span->before = entry_at(rh, begin);
+		} else {
+			// We precede lo and follow lo - 1.
+			out_span->result = M_RELATION_HISTORY_RESULT_INTERPOLATED;
+			out_span->before = entry_at(rh, lo - 1);
+			out_span->after = entry_at(rh, lo);
+		}
+	});
+}
+
+static float
+amount_to_lerp(const struct relation_history_span *span, uint64_t at_timestamp_ns)
+{
+	int64_t diff_before = static_cast<int64_t>(at_timestamp_ns) - span->before.timestamp;
+	int64_t diff_after = static_cast<int64_t>(span->after.timestamp) - at_timestamp_ns;
+
+	return (float)diff_before / (float)(diff_before + diff_after);
+}
+
+static enum xrt_space_relation_flags
+interpolated_flags(const struct relation_history_span *span)
+{
+	return (enum xrt_space_relation_flags)(span->before.relation.relation_flags &
+	                                       span->after.relation.relation_flags);
+}
+
+/*!
+ * Everything but interpolation, which is done differently by the single and
+ * the batch paths. Returns false if the span needs to be interpolated.
+ */
+static bool
+resolve_not_interpolated(const struct relation_history_span *span,
+                         uint64_t at_timestamp_ns,
+                         struct xrt_space_relation *out_relation)
+{
+	switch (span->result) {
+	case M_RELATION_HISTORY_RESULT_INVALID: *out_relation = {}; return true;
+	case M_RELATION_HISTORY_RESULT_EXACT:
+		U_LOG_T("Exact match in the buffer!");
+		*out_relation = span->before.relation;
+		return true;
+	case M_RELATION_HISTORY_RESULT_PREDICTED:
+	case M_RELATION_HISTORY_RESULT_REVERSE_PREDICTED: {
+		int64_t diff_prediction_ns = static_cast<int64_t>(at_timestamp_ns) - span->before.timestamp;
+		double delta_s = time_ns_to_s(diff_prediction_ns);
+
+		U_LOG_T("Extrapolating %f s from the %s of the buffer!", delta_s,
+		        span->result == M_RELATION_HISTORY_RESULT_PREDICTED ? "back" : "front");
+
+		m_predict_relation(&span->before.relation, delta_s, out_relation);
+		return true;
+	}
+	case M_RELATION_HISTORY_RESULT_INTERPOLATED:
+	default: return false;
+	}
+}
+
+/*!
+ * Approximated slerp that only uses multiplications and additions, so that
+ * the compiler can vectorize it over the arrays. Accurate to a few float ulps
+ * for the small angles between neighbouring history entries. Plain loops
+ * rather than the SSSE3/AVX2/NEON paths of the WiVRn FEC encoder, as this file
+ * is built for every target without per-arch flags.
+ *
+ * From "A Fast and Accurate Algorithm for Computing SLERP" by David Eberly.
+ */
+static void
+slerp_n(const float *const q0[4], const float *const q1[4], const float *t, float *const out[4], uint32_t count)
+{
+	constexpr int Terms = 8;
+	constexpr float OnePlusMu = 1.90110745351730037f;
+
+	// u[i] = 1 / (i * (2i + 1)), v[i] = i / (2i + 1), for i = 1..Terms, last pair scaled by 1 + mu.
+	static const float u[Terms] = {
+	    1.f / (1 * 3),  1.f / (2 * 5),  1.f / (3 * 7),  1.f / (4 * 9),
+	    1.f / (5 * 11), 1.f / (6 * 13), 1.f / (7 * 15), OnePlusMu / (8 * 17),
+	};
+	static const float v[Terms] = {
+	    1.f / 3, 2.f / 5, 3.f / 7, 4.f / 9, 5.f / 11, 6.f / 13, 7.f / 15, OnePlusMu * 8 / 17,
+	};
+
+	for (uint32_t i = 0; i < count; i++) {
+		float dot = q0[0][i] * q1[0][i] + q0[1][i] * q1[1][i] + q0[2][i] * q1[2][i] + q0[3][i] * q1[3][i];
+
+		// Take the shortest path.
+		float sign = dot < 0.f ? -1.f : 1.f;
+		float xm1 = dot * sign - 1.f;
+
+		float t1 = t[i];
+		float t0 = 1.f - t1;
+		float sqr_t1 = t1 * t1;
+		float sqr_t0 = t0 * t0;
+
+		float c0 = 1.f;
+		float c1 = 1.f;
+		for (int k = Terms - 1; k >= 0; k--) {
+			c0 = 1.f + (u[k] * sqr_t0 - v[k]) * xm1 * c0;
+			c1 = 1.f + (u[k] * sqr_t1 - v[k]) * xm1 * c1;
+		}
+		c0 *= t0;
+		c1 *= t1 * sign;
+
+		for (int c = 0; c < 4; c++) {
+			out[c][i] = c0 * q0[c][i] + c1 * q1[c][i];
+		}
+	}
+}
+
+static void
+lerp_n(const float *a, const float *b, const float *t, float *out, uint32_t count)
+{
+	// Same as m_vec3_lerp.
+	for (uint32_t i = 0; i < count; i++) {
+		out[i] = a[i] * (1.0f - t[i]) + b[i] * t[i];
+	}
+}
+
+/*!
+ * Structure of arrays of the spans that are to be interpolated.
+ */
+struct relation_history_lerp_batch
+{
+	uint32_t count;
+
+	//! Which output the span belongs to.
+	uint32_t index[BatchLen];
+
+	//! Flags valid in both entries.
+	enum xrt_space_relation_flags flags[BatchLen];
+
+	//! Where between the entries.
+	float t[BatchLen];
+
+	//! Orientation x, y, z and w of the entries before and after.
+	float q0[4][BatchLen];
+	float q1[4][BatchLen];
+
+	//! Position, linear and angular velocity components of the entries before and after.
+	float v0[9][BatchLen];
+	float v1[9][BatchLen];
 };
 
+static void
+batch_add(struct relation_history_lerp_batch *batch,
+          uint32_t index,
+          const struct relation_history_span *span,
+          uint64_t at_timestamp_ns)
+{
+	uint32_t n = batch->count++;
+
+	batch->index[n] = index;
+	batch->flags[n] = interpolated_flags(span);
+	batch->t[n] = amount_to_lerp(span, at_timestamp_ns);
+
+	const struct xrt_space_relation *r[2] = {&span->before.relation, &span->after.relation};
+	float(*q[2])[BatchLen] = {batch->q0, batch->q1};
+	float(*v[2])[BatchLen] = {batch->v0, batch->v1};
+
+	for (int k = 0; k < 2; k++) {
+		q[k][0][n] = r[k]->pose.orientation.x;
+		q[k][1][n] = r[k]->pose.orientation.y;
+		q[k][2][n] = r[k]->pose.orientation.z;
+		q[k][3][n] = r[k]->pose.orientation.w;
+
+		const struct xrt_vec3 *vecs[3] = {&r[k]->pose.position, &r[k]->linear_velocity, &r[k]->angular_velocity};
+		for (int c = 0; c < 3; c++) {
+			v[k][c * 3 + 0][n] = vecs[c]->x;
+			v[k][c * 3 + 1][n] = vecs[c]->y;
+			v[k][c * 3 + 2][n] = vecs[c]->z;
+		}
+	}
+}
+
+static void
+batch_flush(struct relation_history_lerp_batch *batch, struct xrt_space_relation *out_relations)
+{
+	uint32_t count = batch->count;
+	if (count == 0) {
+		return;
+	}
+
+	float q[4][BatchLen];
+	float v[9][BatchLen];
+
+	const float *q0[4] = {batch->q0[0], batch->q0[1], batch->q0[2], batch->q0[3]};
+	const float *q1[4] = {batch->q1[0], batch->q1[1], batch->q1[2], batch->q1[3]};
+	float *qo[4] = {q[0], q[1], q[2], q[3]};
+	slerp_n(q0, q1, batch->t, qo, count);
+
+	for (int c = 0; c < 9; c++) {
+		lerp_n(batch->v0[c], batch->v1[c], batch->t, v[c], count);
+	}
+
+	for (uint32_t n = 0; n < count; n++) {
+		uint32_t i = batch->index[n];
+
+		xrt_space_relation result{};
+		result.relation_flags = batch->flags[n];
+
+		if (0 != (result.relation_flags & XRT_SPACE_RELATION_POSITION_VALID_BIT)) {
+			result.pose.position = {v[0][n], v[1][n], v[2][n]};
+		}
+		if (0 != (result.relation_flags & XRT_SPACE_RELATION_ORIENTATION_VALID_BIT)) {
+			result.pose.orientation = {q[0][n], q[1][n], q[2][n], q[3][n]};
+		}
+		if (0 != (result.relation_flags & XRT_SPACE_RELATION_LINEAR_VELOCITY_VALID_BIT)) {
+			result.linear_velocity = {v[3][n], v[4][n], v[5][n]};
+		}
+		if (0 != (result.relation_flags & XRT_SPACE_RELATION_ANGULAR_VELOCITY_VALID_BIT)) {
+			result.angular_velocity = {v[6][n], v[7][n], v[8][n]};
+		}
+
+		out_relations[i] = result;
+	}
+
+	batch->count = 0;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
 
 void
 m_relation_history_create(struct m_relation_history **rh_ptr)
@@ -62,116 +404,110 @@ m_relation_history_push(struct m_relation_history *rh, struct xrt_space_relation
 	struct relation_history_entry rhe;
 	rhe.relation = *in_relation;
 	rhe.timestamp = timestamp;
-	bool ret = false;
-	std::unique_lock<os::Mutex> lock(rh->mutex);
-	try {
-		// if we aren't empty, we can compare against the latest timestamp.
-		if (rh->impl.empty() || rhe.timestamp > rh->impl.back().timestamp) {
-			// Everything explodes if the timestamps in relation_history aren't monotonically increasing. If
-			// we get a timestamp that's before the most recent timestamp in the buffer, don't put it
-			// in the history.
-			rh->impl.push_back(rhe);
-			ret = true;
-		}
-	} catch (std::exception const &e) {
-		U_LOG_E("Caught exception: %s", e.what());
+
+	std::unique_lock<os::Mutex> lock(rh->write_mutex);
+
+	// Only we write these.
+	uint64_t begin = rh->begin.load(std::memory_order_relaxed);
+	uint64_t end = rh->end.load(std::memory_order_relaxed);
+
+	// Everything explodes if the timestamps in relation_history aren't monotonically increasing. If we get a
+	// timestamp that's before the most recent timestamp in the buffer, don't put it in the history.
+	if (begin != end && rhe.timestamp <= entry_at(rh, end - 1).timestamp) {
+		return false;
+	}
+
+	write_begin(rh);
+
+	rh->entries[end % BufLen] = rhe;
+	if (end - begin == BufLen) {
+		// Full, overwrote the oldest.
+		rh->begin.store(begin + 1, std::memory_order_relaxed);
 	}
-	return ret;
+	rh->end.store(end + 1, std::memory_order_relaxed);
+
+	write_end(rh);
+
+	return true;
 }
 
 enum m_relation_history_result
 m_relation_history_get(struct m_relation_history *rh, uint64_t at_timestamp_ns, struct xrt_space_relation *out_relation)
 {
 	XRT_TRACE_MARKER();
-	std::unique_lock<os::Mutex> lock(rh->mutex);
-	try {
-		if (rh->impl.empty() || at_timestamp_ns == 0) {
-			// Do nothing. You push nothing to the buffer you get nothing from the buffer.
-			*out_relation = {};
-			return M_RELATION_HISTORY_RESULT_INVALID;
-		}
-		const auto b = rh->impl.begin();
-		const auto e = rh->impl.end();
-
-		// find the first element *not less than* our value. the lambda we pass is the comparison
-		// function, to compare against timestamps.
-		const auto it =
-		    std::lower_bound(b, e, at_timestamp_ns, [](const relation_history_entry &rhe, uint64_t timestamp) {
-			    return rhe.timestamp < timestamp;
-		    });
-
-		if (it == e) {
-			// lower bound is at the end:
-			// The desired timestamp is after what our buffer contains.
-			// (pose-prediction)
-			int64_t diff_prediction_ns = static_cast<int64_t>(at_timestamp_ns) - rh->impl.back().timestamp;
-			double delta_s = time_ns_to_s(diff_prediction_ns);
 
-			U_LOG_T("Extrapolating %f s past the back of the buffer!", delta_s);
+	struct relation_history_span span;
+	find_span(rh, at_timestamp_ns, &span);
 
-			m_predict_relation(&rh->impl.back().relation, delta_s, out_relation);
-			return M_RELATION_HISTORY_RESULT_PREDICTED;
-		}
-		if (at_timestamp_ns == it->timestamp) {
-			// exact match
-			U_LOG_T("Exact match in the buffer!");
-			*out_relation = it->relation;
-			return M_RELATION_HISTORY_RESULT_EXACT;
-		}
-		if (it == b) {
-			// lower bound is at the beginning (and it's not an exact match):
-			// The desired timestamp is before what our buffer contains.
-			// (an edge case where somebody asks for a really old pose and we do our best)
-			int64_t diff_prediction_ns = static_cast<int64_t>(at_timestamp_ns) - rh->impl.front().timestamp;
-			double delta_s = time_ns_to_s(diff_prediction_ns);
-			U_LOG_T("Extrapolating %f s before the front of the buffer!", delta_s);
-			m_predict_relation(&rh->impl.front().relation, delta_s, out_relation);
-			return M_RELATION_HISTORY_RESULT_REVERSE_PREDICTED;
-		}
-		U_LOG_T("Interpolating within buffer!");
+	if (resolve_not_interpolated(&span, at_timestamp_ns, out_relation)) {
+		return span.result;
+	}
 
-		// We precede *it and follow *(it - 1) (which we know exists because we already handled
-		// the it = begin() case)
-		const auto &predecessor = *(it - 1);
-		const auto &successor = *it;
+	U_LOG_T("Interpolating within buffer!");
 
-		// Do the thing.
-		int64_t diff_before = static_cast<int64_t>(at_timestamp_ns) - predecessor.timestamp;
-		int64_t diff_after = static_cast<int64_t>(successor.timestamp) - at_timestamp_ns;
+	const auto &predecessor = span.before;
+	const auto &successor = span.after;
 
-		float amount_to_lerp = (float)diff_before / (float)(diff_before + diff_after);
+	// Do the thing.
+	float amount = amount_to_lerp(&span, at_timestamp_ns);
 
-		// Copy relation flags
-		xrt_space_relation result{};
-		result.relation_flags = (enum xrt_space_relation_flags)(predecessor.relation.relation_flags &
-		                                                        successor.relation.relation_flags);
-		// First-order implementation - lerp between the before and after
-		if (0 != (result.relation_flags & XRT_SPACE_RELATION_POSITION_VALID_BIT)) {
-			result.pose.position = m_vec3_lerp(predecessor.relation.pose.position,
-			                                   successor.relation.pose.position, amount_to_lerp);
-		}
-		if (0 != (result.relation_flags & XRT_SPACE_RELATION_ORIENTATION_VALID_BIT)) {
+	// Copy relation flags
+	xrt_space_relation result{};
+	result.relation_flags = interpolated_flags(&span);
 
-			math_quat_slerp(&predecessor.relation.pose.orientation, &successor.relation.pose.orientation,
-			                amount_to_lerp, &result.pose.orientation);
-		}
+	// First-order implementation - lerp between the before and after
+	if (0 != (result.relation_flags & XRT_SPACE_RELATION_POSITION_VALID_BIT)) {
+		result.pose.position =
+		    m_vec3_lerp(predecessor.relation.pose.position, successor.relation.pose.position, amount);
+	}
+	if (0 != (result.relation_flags & XRT_SPACE_RELATION_ORIENTATION_VALID_BIT)) {
 
-		//! @todo Does interpolating the velocities make any sense?
-		if (0 != (result.relation_flags & XRT_SPACE_RELATION_ANGULAR_VELOCITY_VALID_BIT)) {
-			result.angular_velocity = m_vec3_lerp(predecessor.relation.angular_velocity,
-			                                      successor.relation.angular_velocity, amount_to_lerp);
-		}
-		if (0 != (result.relation_flags & XRT_SPACE_RELATION_LINEAR_VELOCITY_VALID_BIT)) {
-			result.linear_velocity = m_vec3_lerp(predecessor.relation.linear_velocity,
-			                                     successor.relation.linear_velocity, amount_to_lerp);
+		math_quat_slerp(&predecessor.relation.pose.orientation, &successor.relation.pose.orientation, amount,
+		                &result.pose.orientation);
+	}
+
+	//! @todo Does interpolating the velocities make any sense?
+	if (0 != (result.relation_flags & XRT_SPACE_RELATION_ANGULAR_VELOCITY_VALID_BIT)) {
+		result.angular_velocity =
+		    m_vec3_lerp(predecessor.relation.angular_velocity, successor.relation.angular_velocity, amount);
+	}
+	if (0 != (result.relation_flags & XRT_SPACE_RELATION_LINEAR_VELOCITY_VALID_BIT)) {
+		result.linear_velocity =
+		    m_vec3_lerp(predecessor.relation.linear_velocity, successor.relation.linear_velocity, amount);
+	}
+	*out_relation = result;
+	return M_RELATION_HISTORY_RESULT_INTERPOLATED;
+}
+
+void
+m_relation_history_get_batch(struct m_relation_history *const *rhs,
+                             const uint64_t *at_timestamps_ns,
+                             uint32_t count,
+                             struct xrt_space_relation *out_relations,
+                             enum m_relation_history_result *out_results)
+{
+	XRT_TRACE_MARKER();
+
+	struct relation_history_lerp_batch batch;
+	batch.count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		struct relation_history_span span;
+		find_span(rhs[i], at_timestamps_ns[i], &span);
+		out_results[i] = span.result;
+
+		if (resolve_not_interpolated(&span, at_timestamps_ns[i], &out_relations[i])) {
+			continue;
 		}
-		*out_relation = result;
-		return M_RELATION_HISTORY_RESULT_INTERPOLATED;
 
-	} catch (std::exception const &e) {
-		U_LOG_E("Caught exception: %s", e.what());
-		return M_RELATION_HISTORY_RESULT_INVALID;
+		batch_add(&batch, i, &span, at_timestamps_ns[i]);
+
+		if (batch.count == BatchLen) {
+			batch_flush(&batch, out_relations);
+		}
 	}
+
+	batch_flush(&batch, out_relations);
 }
 
 bool
@@ -226,26 +562,42 @@ m_relation_history_get_latest(struct m_relation_history *rh,
                               uint64_t *out_time_ns,
                               struct xrt_space_relation *out_relation)
 {
-	std::unique_lock<os::Mutex> lock(rh->mutex);
-	if (rh->impl.empty()) {
+	bool valid = false;
+	struct relation_history_entry latest;
+
+	read_consistent(rh, [&](uint64_t begin, uint64_t end) {
+		valid = begin < end;
+		if (valid) {
+			latest = entry_at(rh, end - 1);
+		}
+	});
+
+	if (!valid) {
 		return false;
 	}
-	*out_relation = rh->impl.back().relation;
-	*out_time_ns = rh->impl.back().timestamp;
+	*out_relation = latest.relation;
+	*out_time_ns = latest.timestamp;
 	return true;
 }
 
 uint32_t
 m_relation_history_get_size(const struct m_relation_history *rh)
 {
-	return (uint32_t)rh->impl.size();
+	uint32_t size = 0;
+
+	read_consistent(rh, [&](uint64_t begin, uint64_t end) { size = begin < end ? (uint32_t)(end - begin) : 0; });
+
+	return size;
 }
 
 void
 m_relation_history_clear(struct m_relation_history *rh)
 {
-	std::unique_lock<os::Mutex> lock(rh->mutex);
-	rh->impl.clear();
+	std::unique_lock<os::Mutex> lock(rh->write_mutex);
+
+	write_begin(rh);
+	rh->begin.store(rh->end.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	write_end(rh);
 }
 
 void
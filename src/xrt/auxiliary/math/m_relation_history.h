@@ -62,7 +62,7 @@ m_relation_history_push(struct m_relation_history *rh,
  * Interpolates or extrapolates to the desired timestamp.
  *
  * Read-only operation - doesn't remove anything from the buffer or anything like that - you can call this as often as
- * you want.
+ * you want. Never blocks on a lock, only pushes are serialized with each other.
  *
  * @public @memberof m_relation_history
  */
@@ -71,6 +71,23 @@ m_relation_history_get(struct m_relation_history *rh,
                        uint64_t at_timestamp_ns,
                        struct xrt_space_relation *out_relation);
 
+/*!
+ * Interpolates or extrapolates many relations at once, the history of
+ * @p rhs[i] at @p at_timestamps_ns[i] is written to @p out_relations[i], so
+ * one call can resolve all views and controllers for a display time.
+ *
+ * Interpolation is done for many relations together, using an approximated
+ * slerp that differs from @ref m_relation_history_get by a few float ulps.
+ *
+ * @public @memberof m_relation_history
+ */
+void
+m_relation_history_get_batch(struct m_relation_history *const *rhs,
+                             const uint64_t *at_timestamps_ns,
+                             uint32_t count,
+                             struct xrt_space_relation *out_relations,
+                             enum m_relation_history_result *out_results);
+
 /*!
  * Estimates the movement (velocity and angular velocity) of a new relation based on
  * the latest relation found in the buffer (as returned by m_relation_history_get_latest).
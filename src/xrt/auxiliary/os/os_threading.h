@@ -570,14 +570,15 @@ os_semaphore_get_realtime_clock(struct timespec *ts, uint64_t timeout_ns)
 /*!
  * Wait, if @p timeout_ns is zero then waits forever.
  *
+ * @return true if a count was taken, false if it timed out.
+ *
  * @public @memberof os_semaphore
  */
-static inline void
+static inline bool
 os_semaphore_wait(struct os_semaphore *os, uint64_t timeout_ns)
 {
 	if (timeout_ns == 0) {
-		sem_wait(&os->sem);
-		return;
+		return sem_wait(&os->sem) == 0;
 	}
 
 	struct timespec abs_timeout;
@@ -585,7 +586,7 @@ os_semaphore_wait(struct os_semaphore *os, uint64_t timeout_ns)
 		assert(false);
 	}
 
-	sem_timedwait(&os->sem, &abs_timeout);
+	return sem_timedwait(&os->sem, &abs_timeout) == 0;
 }
 
 /*!
@@ -23,6 +23,7 @@
 #include "util/u_time.h"
 
 #ifdef XRT_OS_LINUX
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #define XRT_HAVE_TIMESPEC
@@ -131,6 +132,27 @@ os_precise_sleeper_deinit(struct os_precise_sleeper *ops);
 static inline void
 os_precise_sleeper_nanosleep(struct os_precise_sleeper *ops, int32_t nsec);
 
+/*!
+ * Sleep until the given @ref os_monotonic_get_ns time, trying harder to be
+ * precise. Where the platform supports it an absolute deadline is used, so
+ * being preempted before going to sleep doesn't make the sleep longer.
+ *
+ * Note that on all platforms, the system scheduler has the final say.
+ *
+ * @public @memberof os_precise_sleeper
+ */
+static inline void
+os_precise_sleeper_sleep_until(struct os_precise_sleeper *ops, uint64_t until_ns);
+
+/*!
+ * Tell the CPU that we are in a spin-wait loop, lowers power usage and frees
+ * up resources for the other hyper-thread of the core.
+ *
+ * @ingroup aux_os_time
+ */
+static inline void
+os_cpu_relax(void);
+
 #if defined(XRT_HAVE_TIMESPEC) || defined(XRT_DOXYGEN)
 /*!
  * Convert a timespec struct to nanoseconds.
@@ -263,6 +285,46 @@ os_precise_sleeper_nanosleep(struct os_precise_sleeper *ops, int32_t nsec)
 #endif
 }
 
+static inline void
+os_precise_sleeper_sleep_until(struct os_precise_sleeper *ops, uint64_t until_ns)
+{
+#if defined(XRT_OS_LINUX)
+	(void)ops;
+
+	struct timespec spec;
+	spec.tv_sec = (until_ns / U_1_000_000_000);
+	spec.tv_nsec = (until_ns % U_1_000_000_000);
+
+	// Same clock as os_monotonic_get_ns, restart if interrupted.
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL) == EINTR) {
+	}
+#else
+	uint64_t now_ns = os_monotonic_get_ns();
+	if (until_ns <= now_ns) {
+		return;
+	}
+
+	uint64_t nsec = until_ns - now_ns;
+	if (nsec > INT32_MAX) {
+		nsec = INT32_MAX;
+	}
+
+	os_precise_sleeper_nanosleep(ops, (int32_t)nsec);
+#endif
+}
+
+static inline void
+os_cpu_relax(void)
+{
+#if defined(_MSC_VER)
+	YieldProcessor();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_ia32_pause();
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+	__asm__ __volatile__("yield");
+#endif
+}
+
 #if defined(XRT_HAVE_TIMESPEC)
 static inline uint64_t
 os_timespec_to_ns(const struct timespec *spec)
@@ -1,4 +1,4 @@
-// Copyright 2019, Collabora, Ltd.
+// Copyright 2019-2023, Collabora, Ltd.
 // SPDX-License-Identifier: BSL-1.0
 /*!
  * @file
@@ -13,6 +13,7 @@
 #include "util/u_debug.h"
 #include "util/u_frame.h"
 #include "util/u_format.h"
+#include "util/u_worker_bands.h"
 #include "util/u_trace_marker.h"
 
 #include "tracking/t_tracking.h"
@@ -21,6 +22,9 @@
 #include <assert.h>
 
 
+DEBUG_GET_ONCE_BOOL_OPTION(hsv_simd, "T_HSV_FILTER_SIMD", true)
+DEBUG_GET_ONCE_NUM_OPTION(hsv_threads, "T_HSV_FILTER_THREADS", 4)
+
 #define MOD_180(v) ((uint32_t)(v) % 180)
 
 static inline bool
@@ -144,109 +148,67 @@ struct t_hsv_filter
 	struct u_sink_debug usds[NUM_CHANNELS];
 
 	struct t_hsv_filter_optimized_table table;
+
+	//! Classifiers for the best instruction set on this CPU.
+	struct t_hsv_filter_kernels kernels;
+
+	//! Splits big frames into bands, one per thread.
+	struct u_worker_bands bands;
 };
 
-static void
-process_sample(struct t_hsv_filter *f,
-               uint8_t y,
-               uint8_t cb,
-               uint8_t cr,
-               uint8_t *dst0,
-               uint8_t *dst1,
-               uint8_t *dst2,
-               uint8_t *dst3)
+/*!
+ * A frame to classify, split up in bands of rows.
+ */
+struct hsv_job
 {
-	uint8_t bits = t_hsv_filter_sample(&f->table, y, cb, cr);
-	uint8_t v0 = (bits & (1 << 0)) ? 0xff : 0x00;
-	uint8_t v1 = (bits & (1 << 1)) ? 0xff : 0x00;
-	uint8_t v2 = (bits & (1 << 2)) ? 0xff : 0x00;
-	uint8_t v3 = (bits & (1 << 3)) ? 0xff : 0x00;
-
-	*dst0 = v0;
-	*dst1 = v1;
-	*dst2 = v2;
-	*dst3 = v3;
-}
+	t_hsv_filter_kernel_func_t func;
+	const struct t_hsv_filter_optimized_table *table;
+	const uint8_t *src;
+	size_t src_stride;
+	uint8_t *dst[NUM_CHANNELS];
+	size_t dst_stride;
+	uint32_t w;
+};
 
-XRT_NO_INLINE static void
-hsv_process_frame_yuv(struct t_hsv_filter *f, struct xrt_frame *xf)
+static void
+hsv_process_band(void *ptr, uint32_t y, uint32_t h)
 {
 	SINK_TRACE_MARKER();
 
-	struct xrt_frame *f0 = f->frames[0];
-	struct xrt_frame *f1 = f->frames[1];
-	struct xrt_frame *f2 = f->frames[2];
-	struct xrt_frame *f3 = f->frames[3];
-
-	for (uint32_t y = 0; y < xf->height; y++) {
-		uint8_t *src = (uint8_t *)xf->data + y * xf->stride;
-		uint8_t *dst0 = f0->data + y * f0->stride;
-		uint8_t *dst1 = f1->data + y * f1->stride;
-		uint8_t *dst2 = f2->data + y * f2->stride;
-		uint8_t *dst3 = f3->data + y * f3->stride;
-
-		for (uint32_t x = 0; x < xf->width; x += 1) {
-			uint8_t y = src[0];
-			uint8_t cb = src[1];
-			uint8_t cr = src[2];
-			src += 3;
-
-			process_sample(f, y, cb, cr, dst0, dst1, dst2, dst3);
-			dst0 += 1;
-			dst1 += 1;
-			dst2 += 1;
-			dst3 += 1;
-		}
+	struct hsv_job *j = (struct hsv_job *)ptr;
+
+	uint8_t *dst[NUM_CHANNELS];
+	for (size_t k = 0; k < NUM_CHANNELS; k++) {
+		dst[k] = j->dst[k] + (size_t)y * j->dst_stride;
 	}
+
+	j->func(j->table, j->src + (size_t)y * j->src_stride, j->src_stride, dst, j->dst_stride, j->w, h);
 }
 
-XRT_NO_INLINE static void
-hsv_process_frame_yuyv(struct t_hsv_filter *f, struct xrt_frame *xf)
+static void
+hsv_process_frame(struct t_hsv_filter *f, t_hsv_filter_kernel_func_t func, struct xrt_frame *xf)
 {
 	SINK_TRACE_MARKER();
 
-	struct xrt_frame *f0 = f->frames[0];
-	struct xrt_frame *f1 = f->frames[1];
-	struct xrt_frame *f2 = f->frames[2];
-	struct xrt_frame *f3 = f->frames[3];
-
-	for (uint32_t y = 0; y < xf->height; y++) {
-		uint8_t *src = (uint8_t *)xf->data + y * xf->stride;
-		uint8_t *dst0 = f0->data + y * f0->stride;
-		uint8_t *dst1 = f1->data + y * f1->stride;
-		uint8_t *dst2 = f2->data + y * f2->stride;
-		uint8_t *dst3 = f3->data + y * f3->stride;
-
-		for (uint32_t x = 0; x < xf->width; x += 2) {
-			uint8_t y1 = src[0];
-			uint8_t cb = src[1];
-			uint8_t y2 = src[2];
-			uint8_t cr = src[3];
-			src += 4;
-
-			uint8_t bits0 = t_hsv_filter_sample(&f->table, y1, cb, cr);
-			uint8_t bits1 = t_hsv_filter_sample(&f->table, y2, cb, cr);
-
-			uint8_t v0 = (bits0 & (1 << 0)) ? 0xff : 0x00;
-			uint8_t v1 = (bits0 & (1 << 1)) ? 0xff : 0x00;
-			uint8_t v2 = (bits0 & (1 << 2)) ? 0xff : 0x00;
-			uint8_t v3 = (bits0 & (1 << 3)) ? 0xff : 0x00;
-			uint8_t v4 = (bits1 & (1 << 0)) ? 0xff : 0x00;
-			uint8_t v5 = (bits1 & (1 << 1)) ? 0xff : 0x00;
-			uint8_t v6 = (bits1 & (1 << 2)) ? 0xff : 0x00;
-			uint8_t v7 = (bits1 & (1 << 3)) ? 0xff : 0x00;
-
-			*(uint16_t *)dst0 = v0 | v4 << 8;
-			*(uint16_t *)dst1 = v1 | v5 << 8;
-			*(uint16_t *)dst2 = v2 | v6 << 8;
-			*(uint16_t *)dst3 = v3 | v7 << 8;
-
-			dst0 += 2;
-			dst1 += 2;
-			dst2 += 2;
-			dst3 += 2;
-		}
+	// The frames are all created the same way, so share the stride.
+	size_t dst_stride = f->frames[0]->stride;
+	for (size_t i = 1; i < NUM_CHANNELS; i++) {
+		assert(f->frames[i]->stride == dst_stride);
 	}
+
+	struct hsv_job job = {
+	    .func = func,
+	    .table = &f->table,
+	    .src = xf->data,
+	    .src_stride = xf->stride,
+	    .dst_stride = dst_stride,
+	    .w = xf->width,
+	};
+	for (size_t k = 0; k < NUM_CHANNELS; k++) {
+		job.dst[k] = f->frames[k]->data;
+	}
+
+	u_worker_bands_run(&f->bands, xf->height, hsv_process_band, &job);
 }
 
 static void
@@ -291,11 +253,11 @@ hsv_frame(struct xrt_frame_sink *xsink, struct xrt_frame *xf)
 	switch (xf->format) {
 	case XRT_FORMAT_YUV888:
 		ensure_buf_allocated(f, xf);
-		hsv_process_frame_yuv(f, xf);
+		hsv_process_frame(f, f->kernels.yuv888, xf);
 		break;
 	case XRT_FORMAT_YUYV422:
 		ensure_buf_allocated(f, xf);
-		hsv_process_frame_yuyv(f, xf);
+		hsv_process_frame(f, f->kernels.yuyv422, xf);
 		break;
 	default: U_LOG_E("Bad format '%s'", u_format_str(xf->format)); return;
 	}
@@ -321,6 +283,8 @@ hsv_destroy(struct xrt_frame_node *node)
 		u_sink_debug_destroy(&f->usds[i]);
 	}
 
+	u_worker_bands_fini(&f->bands);
+
 	free(f);
 }
 
@@ -341,6 +305,9 @@ t_hsv_filter_create(struct xrt_frame_context *xfctx,
 	f->sinks[3] = sinks[3];
 
 	t_hsv_build_optimized_table(&f->params, &f->table);
+	t_hsv_filter_get_kernels(debug_get_bool_option_hsv_simd(), &f->kernels);
+
+	u_worker_bands_init(&f->bands, debug_get_num_option_hsv_threads());
 
 	xrt_frame_context_add(xfctx, &f->node);
 
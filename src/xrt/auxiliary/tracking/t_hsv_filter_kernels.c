@@ -0,0 +1,413 @@
+// Copyright 2019-2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Classifier kernels for the HSV filter.
+ * @author Jakob Bornecrantz <jakob@collabora.com>
+ * @ingroup aux_tracking
+ */
+
+#include "tracking/t_tracking.h"
+
+#include <assert.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define T_HSV_FILTER_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__)
+#define T_HSV_FILTER_NEON
+#include <arm_neon.h>
+#endif
+
+
+/*
+ *
+ * Plain C.
+ *
+ */
+
+static void
+classify_yuv888_row(const struct t_hsv_filter_optimized_table *t,
+                    const uint8_t *src,
+                    uint8_t *dst0,
+                    uint8_t *dst1,
+                    uint8_t *dst2,
+                    uint8_t *dst3,
+                    uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x += 1) {
+		uint8_t y = src[0];
+		uint8_t cb = src[1];
+		uint8_t cr = src[2];
+		src += 3;
+
+		uint8_t bits = t_hsv_filter_sample(t, y, cb, cr);
+
+		*dst0++ = (bits & (1 << 0)) ? 0xff : 0x00;
+		*dst1++ = (bits & (1 << 1)) ? 0xff : 0x00;
+		*dst2++ = (bits & (1 << 2)) ? 0xff : 0x00;
+		*dst3++ = (bits & (1 << 3)) ? 0xff : 0x00;
+	}
+}
+
+static void
+classify_yuyv422_row(const struct t_hsv_filter_optimized_table *t,
+                     const uint8_t *src,
+                     uint8_t *dst0,
+                     uint8_t *dst1,
+                     uint8_t *dst2,
+                     uint8_t *dst3,
+                     uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x += 2) {
+		uint8_t y1 = src[0];
+		uint8_t cb = src[1];
+		uint8_t y2 = src[2];
+		uint8_t cr = src[3];
+		src += 4;
+
+		uint8_t bits0 = t_hsv_filter_sample(t, y1, cb, cr);
+		uint8_t bits1 = t_hsv_filter_sample(t, y2, cb, cr);
+
+		uint8_t v0 = (bits0 & (1 << 0)) ? 0xff : 0x00;
+		uint8_t v1 = (bits0 & (1 << 1)) ? 0xff : 0x00;
+		uint8_t v2 = (bits0 & (1 << 2)) ? 0xff : 0x00;
+		uint8_t v3 = (bits0 & (1 << 3)) ? 0xff : 0x00;
+		uint8_t v4 = (bits1 & (1 << 0)) ? 0xff : 0x00;
+		uint8_t v5 = (bits1 & (1 << 1)) ? 0xff : 0x00;
+		uint8_t v6 = (bits1 & (1 << 2)) ? 0xff : 0x00;
+		uint8_t v7 = (bits1 & (1 << 3)) ? 0xff : 0x00;
+
+		*(uint16_t *)dst0 = v0 | v4 << 8;
+		*(uint16_t *)dst1 = v1 | v5 << 8;
+		*(uint16_t *)dst2 = v2 | v6 << 8;
+		*(uint16_t *)dst3 = v3 | v7 << 8;
+
+		dst0 += 2;
+		dst1 += 2;
+		dst2 += 2;
+		dst3 += 2;
+	}
+}
+
+/*!
+ * Defines a kernel that walks the rows and calls @p ROW_FUNC for each one.
+ */
+#define DEFINE_KERNEL(ATTR, NAME, ROW_FUNC)                                                                         \
+	ATTR static void NAME(const struct t_hsv_filter_optimized_table *t, const uint8_t *src, size_t src_stride,    \
+	                      uint8_t *const dst[4], size_t dst_stride, uint32_t w, uint32_t h)                       \
+	{                                                                                                              \
+		for (uint32_t y = 0; y < h; y++) {                                                                     \
+			size_t offset = y * dst_stride;                                                                \
+			ROW_FUNC(t, src + y * src_stride, dst[0] + offset, dst[1] + offset, dst[2] + offset,           \
+			         dst[3] + offset, w);                                                                  \
+		}                                                                                                      \
+	}
+
+DEFINE_KERNEL(, classify_yuv888_none, classify_yuv888_row)
+DEFINE_KERNEL(, classify_yuyv422_none, classify_yuyv422_row)
+
+
+/*
+ *
+ * SIMD helpers.
+ *
+ * The table is indexed by data from the pixels, which SIMD can't do without
+ * gathers. So the kernels compute the table indices of a block of pixels with
+ * SIMD, do the lookups into the 32KiB table one by one, which stays in the L1
+ * cache, then expand the bits into the four masks with SIMD.
+ *
+ */
+
+//! Pixels done per block by the SIMD kernels.
+#define BLOCK_SIZE 32
+
+// The SIMD index math below shifts by the step.
+static_assert(T_HSV_STEP == 8 && T_HSV_SIZE == 32, "SIMD kernels assume a 32x32x32 table");
+
+static inline void
+lookup_block(const struct t_hsv_filter_optimized_table *t, const uint16_t *index, uint8_t *bits)
+{
+	const uint8_t *table = &t->v[0][0][0];
+
+	for (uint32_t i = 0; i < BLOCK_SIZE; i++) {
+		bits[i] = table[index[i]];
+	}
+}
+
+
+/*
+ *
+ * AVX2.
+ *
+ */
+
+#ifdef T_HSV_FILTER_X86
+
+/*!
+ * Table index from 16 bit Y, U and V lanes, the step is 8 so the index is
+ * (Y >> 3) << 10 | (U >> 3) << 5 | V >> 3.
+ */
+TARGET_AVX2 static inline __m256i
+index_x16_avx2(__m256i y, __m256i u, __m256i v)
+{
+	const __m256i top5 = _mm256_set1_epi16(0xf8);
+
+	__m256i iy = _mm256_slli_epi16(_mm256_and_si256(y, top5), 7);
+	__m256i iu = _mm256_slli_epi16(_mm256_and_si256(u, top5), 2);
+	__m256i iv = _mm256_srli_epi16(v, 3);
+
+	return _mm256_or_si256(_mm256_or_si256(iy, iu), iv);
+}
+
+TARGET_AVX2 static inline void
+index_yuyv422_x16_avx2(const uint8_t *src, uint16_t *index)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+	const __m256i u_mask = _mm256_setr_epi8(0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13, //
+	                                        0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13);
+	const __m256i v_mask = _mm256_setr_epi8(2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15, //
+	                                        2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15);
+
+	// Each 128 bit lane holds four whole Y U Y V groups.
+	__m256i in = _mm256_loadu_si256((const __m256i *)src);
+	__m256i y = _mm256_and_si256(in, low_bytes);
+	__m256i uv = _mm256_srli_epi16(in, 8);
+	__m256i u = _mm256_shuffle_epi8(uv, u_mask);
+	__m256i v = _mm256_shuffle_epi8(uv, v_mask);
+
+	_mm256_storeu_si256((__m256i *)index, index_x16_avx2(y, u, v));
+}
+
+TARGET_AVX2 static inline void
+index_yuv888_x8_avx2(const uint8_t *src, uint16_t *index)
+{
+	// Pixels 0 to 5 from the first load, 5 to 7 from the second.
+	const __m128i y_a = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+	const __m128i y_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 13, -1);
+	const __m128i u_a = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i u_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, -1, 11, -1, 14, -1);
+	const __m128i v_a = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i v_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 9, -1, 12, -1, 15, -1);
+	const __m128i top5 = _mm_set1_epi16(0xf8);
+
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 8));
+
+	__m128i y = _mm_or_si128(_mm_shuffle_epi8(a, y_a), _mm_shuffle_epi8(b, y_b));
+	__m128i u = _mm_or_si128(_mm_shuffle_epi8(a, u_a), _mm_shuffle_epi8(b, u_b));
+	__m128i v = _mm_or_si128(_mm_shuffle_epi8(a, v_a), _mm_shuffle_epi8(b, v_b));
+
+	__m128i iy = _mm_slli_epi16(_mm_and_si128(y, top5), 7);
+	__m128i iu = _mm_slli_epi16(_mm_and_si128(u, top5), 2);
+	__m128i iv = _mm_srli_epi16(v, 3);
+
+	_mm_storeu_si128((__m128i *)index, _mm_or_si128(_mm_or_si128(iy, iu), iv));
+}
+
+TARGET_AVX2 static inline void
+expand_block_avx2(const uint8_t *bits, uint8_t *dst0, uint8_t *dst1, uint8_t *dst2, uint8_t *dst3)
+{
+	__m256i b = _mm256_loadu_si256((const __m256i *)bits);
+
+	uint8_t *dst[4] = {dst0, dst1, dst2, dst3};
+	for (int i = 0; i < 4; i++) {
+		__m256i bit = _mm256_set1_epi8((char)(1 << i));
+		__m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(b, bit), bit);
+		_mm256_storeu_si256((__m256i *)dst[i], mask);
+	}
+}
+
+TARGET_AVX2 static void
+classify_yuv888_row_avx2(const struct t_hsv_filter_optimized_table *t,
+                         const uint8_t *src,
+                         uint8_t *dst0,
+                         uint8_t *dst1,
+                         uint8_t *dst2,
+                         uint8_t *dst3,
+                         uint32_t w)
+{
+	uint16_t index[BLOCK_SIZE];
+	uint8_t bits[BLOCK_SIZE];
+
+	uint32_t x = 0;
+	for (; x + BLOCK_SIZE <= w; x += BLOCK_SIZE) {
+		for (uint32_t i = 0; i < BLOCK_SIZE; i += 8) {
+			index_yuv888_x8_avx2(src + (x + i) * 3, index + i);
+		}
+		lookup_block(t, index, bits);
+		expand_block_avx2(bits, dst0 + x, dst1 + x, dst2 + x, dst3 + x);
+	}
+
+	classify_yuv888_row(t, src + x * 3, dst0 + x, dst1 + x, dst2 + x, dst3 + x, w - x);
+}
+
+TARGET_AVX2 static void
+classify_yuyv422_row_avx2(const struct t_hsv_filter_optimized_table *t,
+                          const uint8_t *src,
+                          uint8_t *dst0,
+                          uint8_t *dst1,
+                          uint8_t *dst2,
+                          uint8_t *dst3,
+                          uint32_t w)
+{
+	uint16_t index[BLOCK_SIZE];
+	uint8_t bits[BLOCK_SIZE];
+
+	uint32_t x = 0;
+	for (; x + BLOCK_SIZE <= w; x += BLOCK_SIZE) {
+		index_yuyv422_x16_avx2(src + x * 2, index);
+		index_yuyv422_x16_avx2(src + x * 2 + 32, index + 16);
+		lookup_block(t, index, bits);
+		expand_block_avx2(bits, dst0 + x, dst1 + x, dst2 + x, dst3 + x);
+	}
+
+	classify_yuyv422_row(t, src + x * 2, dst0 + x, dst1 + x, dst2 + x, dst3 + x, w - x);
+}
+
+DEFINE_KERNEL(TARGET_AVX2, classify_yuv888_avx2, classify_yuv888_row_avx2)
+DEFINE_KERNEL(TARGET_AVX2, classify_yuyv422_avx2, classify_yuyv422_row_avx2)
+
+#endif // T_HSV_FILTER_X86
+
+
+/*
+ *
+ * NEON.
+ *
+ */
+
+#ifdef T_HSV_FILTER_NEON
+
+static inline uint16x8_t
+index_x8_neon(uint8x8_t y, uint8x8_t u, uint8x8_t v)
+{
+	const uint8x8_t top5 = vdup_n_u8(0xf8);
+
+	uint16x8_t iy = vshlq_n_u16(vmovl_u8(vand_u8(y, top5)), 7);
+	uint16x8_t iu = vshlq_n_u16(vmovl_u8(vand_u8(u, top5)), 2);
+	uint16x8_t iv = vmovl_u8(vshr_n_u8(v, 3));
+
+	return vorrq_u16(vorrq_u16(iy, iu), iv);
+}
+
+static inline void
+index_yuyv422_x16_neon(const uint8_t *src, uint16_t *index)
+{
+	// Y0 U Y1 V, even and odd pixels share U and V.
+	uint8x8x4_t in = vld4_u8(src);
+
+	uint16x8x2_t even_odd;
+	even_odd.val[0] = index_x8_neon(in.val[0], in.val[1], in.val[3]);
+	even_odd.val[1] = index_x8_neon(in.val[2], in.val[1], in.val[3]);
+	vst2q_u16(index, even_odd);
+}
+
+static inline void
+index_yuv888_x8_neon(const uint8_t *src, uint16_t *index)
+{
+	uint8x8x3_t in = vld3_u8(src);
+	vst1q_u16(index, index_x8_neon(in.val[0], in.val[1], in.val[2]));
+}
+
+static inline void
+expand_block_neon(const uint8_t *bits, uint8_t *dst0, uint8_t *dst1, uint8_t *dst2, uint8_t *dst3)
+{
+	for (uint32_t i = 0; i < BLOCK_SIZE; i += 16) {
+		uint8x16_t b = vld1q_u8(bits + i);
+		vst1q_u8(dst0 + i, vtstq_u8(b, vdupq_n_u8(1 << 0)));
+		vst1q_u8(dst1 + i, vtstq_u8(b, vdupq_n_u8(1 << 1)));
+		vst1q_u8(dst2 + i, vtstq_u8(b, vdupq_n_u8(1 << 2)));
+		vst1q_u8(dst3 + i, vtstq_u8(b, vdupq_n_u8(1 << 3)));
+	}
+}
+
+static void
+classify_yuv888_row_neon(const struct t_hsv_filter_optimized_table *t,
+                         const uint8_t *src,
+                         uint8_t *dst0,
+                         uint8_t *dst1,
+                         uint8_t *dst2,
+                         uint8_t *dst3,
+                         uint32_t w)
+{
+	uint16_t index[BLOCK_SIZE];
+	uint8_t bits[BLOCK_SIZE];
+
+	uint32_t x = 0;
+	for (; x + BLOCK_SIZE <= w; x += BLOCK_SIZE) {
+		for (uint32_t i = 0; i < BLOCK_SIZE; i += 8) {
+			index_yuv888_x8_neon(src + (x + i) * 3, index + i);
+		}
+		lookup_block(t, index, bits);
+		expand_block_neon(bits, dst0 + x, dst1 + x, dst2 + x, dst3 + x);
+	}
+
+	classify_yuv888_row(t, src + x * 3, dst0 + x, dst1 + x, dst2 + x, dst3 + x, w - x);
+}
+
+static void
+classify_yuyv422_row_neon(const struct t_hsv_filter_optimized_table *t,
+                          const uint8_t *src,
+                          uint8_t *dst0,
+                          uint8_t *dst1,
+                          uint8_t *dst2,
+                          uint8_t *dst3,
+                          uint32_t w)
+{
+	uint16_t index[BLOCK_SIZE];
+	uint8_t bits[BLOCK_SIZE];
+
+	uint32_t x = 0;
+	for (; x + BLOCK_SIZE <= w; x += BLOCK_SIZE) {
+		index_yuyv422_x16_neon(src + x * 2, index);
+		index_yuyv422_x16_neon(src + x * 2 + 32, index + 16);
+		lookup_block(t, index, bits);
+		expand_block_neon(bits, dst0 + x, dst1 + x, dst2 + x, dst3 + x);
+	}
+
+	classify_yuyv422_row(t, src + x * 2, dst0 + x, dst1 + x, dst2 + x, dst3 + x, w - x);
+}
+
+DEFINE_KERNEL(, classify_yuv888_neon, classify_yuv888_row_neon)
+DEFINE_KERNEL(, classify_yuyv422_neon, classify_yuyv422_row_neon)
+
+#endif // T_HSV_FILTER_NEON
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+void
+t_hsv_filter_get_kernels(bool simd, struct t_hsv_filter_kernels *out_kernels)
+{
+	struct t_hsv_filter_kernels kernels = {
+	    .name = "none",
+	    .yuv888 = classify_yuv888_none,
+	    .yuyv422 = classify_yuyv422_none,
+	};
+
+#ifdef T_HSV_FILTER_X86
+	if (simd && __builtin_cpu_supports("avx2")) {
+		kernels.name = "avx2";
+		kernels.yuv888 = classify_yuv888_avx2;
+		kernels.yuyv422 = classify_yuyv422_avx2;
+	}
+#endif
+
+#ifdef T_HSV_FILTER_NEON
+	if (simd) {
+		kernels.name = "neon";
+		kernels.yuv888 = classify_yuv888_neon;
+		kernels.yuyv422 = classify_yuyv422_neon;
+	}
+#endif
+
+	*out_kernels = kernels;
+}
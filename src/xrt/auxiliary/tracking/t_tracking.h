@@ -529,11 +529,42 @@ void
 t_hsv_build_optimized_table(struct t_hsv_filter_params *params, struct t_hsv_filter_optimized_table *t);
 
 static inline uint8_t
-t_hsv_filter_sample(struct t_hsv_filter_optimized_table *t, uint32_t y, uint32_t u, uint32_t v)
+t_hsv_filter_sample(const struct t_hsv_filter_optimized_table *t, uint32_t y, uint32_t u, uint32_t v)
 {
 	return t->v[y / T_HSV_STEP][u / T_HSV_STEP][v / T_HSV_STEP];
 }
 
+/*!
+ * Classifies @p h rows of @p w pixels with the table, writing one L8 mask per
+ * bit of the table to @p dst, all of which have the stride @p dst_stride.
+ * Only touches the given rows so frames can be split into bands.
+ */
+typedef void (*t_hsv_filter_kernel_func_t)(const struct t_hsv_filter_optimized_table *t,
+                                           const uint8_t *src,
+                                           size_t src_stride,
+                                           uint8_t *const dst[4],
+                                           size_t dst_stride,
+                                           uint32_t w,
+                                           uint32_t h);
+
+/*!
+ * Classifier kernels for the formats the HSV filter takes, the SIMD ones
+ * give the exact same output as the plain C ones.
+ */
+struct t_hsv_filter_kernels
+{
+	const char *name;
+
+	t_hsv_filter_kernel_func_t yuv888;
+	t_hsv_filter_kernel_func_t yuyv422;
+};
+
+/*!
+ * Gets the plain C kernels, or if @p simd is true the best ones for this CPU.
+ */
+void
+t_hsv_filter_get_kernels(bool simd, struct t_hsv_filter_kernels *out_kernels);
+
 /*!
  * Construct an HSV filter sink.
  * @public @memberof t_hsv_filter
@@ -0,0 +1,697 @@
+// Copyright 2019-2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Image format conversion kernels, with SIMD versions.
+ * @ingroup aux_util
+ */
+
+#include "util/u_format_convert.h"
+
+#include <assert.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define U_FORMAT_CONVERT_X86
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__)
+#define U_FORMAT_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+
+/*
+ *
+ * Plain C.
+ *
+ */
+
+static inline int
+clamp_to_byte(int v)
+{
+	if (v < 0) {
+		return 0;
+	}
+	if (v >= 255) {
+		return 255;
+	}
+	return v;
+}
+
+/*!
+ * BT.601 studio swing in 8 bit fixed point, the SIMD versions do the exact
+ * same math in 16 and 32 bit lanes.
+ */
+static inline void
+YUV444_to_R8G8B8(int y, int u, int v, uint8_t *dst)
+{
+	int C = y - 16;
+	int D = u - 128;
+	int E = v - 128;
+
+	dst[0] = (uint8_t)clamp_to_byte((298 * C + 409 * E + 128) >> 8);
+	dst[1] = (uint8_t)clamp_to_byte((298 * C - 100 * D - 209 * E + 128) >> 8);
+	dst[2] = (uint8_t)clamp_to_byte((298 * C + 516 * D + 128) >> 8);
+}
+
+static void
+L8_to_R8G8B8_row(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x++) {
+		dst[x * 3 + 2] = dst[x * 3 + 1] = dst[x * 3 + 0] = src[x];
+	}
+}
+
+static void
+YUYV422_to_L8_row(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x++) {
+		dst[x] = src[x * 2];
+	}
+}
+
+static void
+YUYV422_to_R8G8B8_row(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x += 2) {
+		const uint8_t *in = src + x * 2;
+		YUV444_to_R8G8B8(in[0], in[1], in[3], dst + x * 3);
+		YUV444_to_R8G8B8(in[2], in[1], in[3], dst + x * 3 + 3);
+	}
+}
+
+static void
+UYVY422_to_R8G8B8_row(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x += 2) {
+		const uint8_t *in = src + x * 2;
+		YUV444_to_R8G8B8(in[1], in[0], in[2], dst + x * 3);
+		YUV444_to_R8G8B8(in[3], in[0], in[2], dst + x * 3 + 3);
+	}
+}
+
+static void
+YUV888_to_R8G8B8_row(const uint8_t *src, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x++) {
+		const uint8_t *in = src + x * 3;
+		YUV444_to_R8G8B8(in[0], in[1], in[2], dst + x * 3);
+	}
+}
+
+static void
+BAYER_GR8_to_R8G8B8_row(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, uint32_t w)
+{
+	for (uint32_t x = 0; x < w; x++) {
+		uint8_t g0 = src0[0];
+		uint8_t r = src0[1];
+		uint8_t b = src1[0];
+		uint8_t g1 = src1[1];
+
+		dst[0] = r;
+		dst[1] = (g0 + g1) / 2;
+		dst[2] = b;
+
+		src0 += 2;
+		src1 += 2;
+		dst += 3;
+	}
+}
+
+/*!
+ * Defines a kernel that converts @p BLOCK pixels at a time with @p VEC_FUNC
+ * and the rest of the row with the plain C row function.
+ */
+#define DEFINE_KERNEL(ATTR, NAME, ROW_FUNC, VEC_FUNC, BLOCK, SRC_BPP)                                              \
+	ATTR static void NAME(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w,     \
+	                      uint32_t h)                                                                            \
+	{                                                                                                              \
+		for (uint32_t y = 0; y < h; y++) {                                                                     \
+			const uint8_t *s = src + y * src_stride;                                                       \
+			uint8_t *d = dst + y * dst_stride;                                                             \
+			uint32_t x = 0;                                                                                \
+			for (; x + (BLOCK) <= w; x += (BLOCK)) {                                                       \
+				VEC_FUNC(s + x * (SRC_BPP), d + x * 3);                                                \
+			}                                                                                              \
+			if (x < w) {                                                                                   \
+				ROW_FUNC(s + x * (SRC_BPP), d + x * 3, w - x);                                         \
+			}                                                                                              \
+		}                                                                                                      \
+	}
+
+/*!
+ * The plain C versions of the kernels.
+ */
+#define DEFINE_PLAIN_KERNEL(NAME, ROW_FUNC)                                                                        \
+	static void NAME(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w,          \
+	                 uint32_t h)                                                                                 \
+	{                                                                                                              \
+		for (uint32_t y = 0; y < h; y++) {                                                                     \
+			ROW_FUNC(src + y * src_stride, dst + y * dst_stride, w);                                       \
+		}                                                                                                      \
+	}
+
+DEFINE_PLAIN_KERNEL(L8_to_R8G8B8_none, L8_to_R8G8B8_row)
+DEFINE_PLAIN_KERNEL(YUYV422_to_L8_none, YUYV422_to_L8_row)
+DEFINE_PLAIN_KERNEL(YUYV422_to_R8G8B8_none, YUYV422_to_R8G8B8_row)
+DEFINE_PLAIN_KERNEL(UYVY422_to_R8G8B8_none, UYVY422_to_R8G8B8_row)
+DEFINE_PLAIN_KERNEL(YUV888_to_R8G8B8_none, YUV888_to_R8G8B8_row)
+
+static void
+BAYER_GR8_to_R8G8B8_none(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *src0 = src + (y * 2) * src_stride;
+		const uint8_t *src1 = src + (y * 2 + 1) * src_stride;
+		BAYER_GR8_to_R8G8B8_row(src0, src1, dst + y * dst_stride, w);
+	}
+}
+
+
+/*
+ *
+ * SSSE3 and AVX2.
+ *
+ */
+
+#ifdef U_FORMAT_CONVERT_X86
+
+/*!
+ * Stores 8 pixels from 16 bit R, G and B lanes, saturated to [0, 255] like
+ * clamp_to_byte.
+ */
+TARGET_SSSE3 static inline void
+store_R8G8B8_x8_ssse3(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+	const __m128i rg_lo = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+	const __m128i b_lo = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	const __m128i rg_hi = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i b_hi = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	__m128i rg = _mm_packus_epi16(r, g);
+	__m128i bb = _mm_packus_epi16(b, b);
+
+	__m128i lo = _mm_or_si128(_mm_shuffle_epi8(rg, rg_lo), _mm_shuffle_epi8(bb, b_lo));
+	__m128i hi = _mm_or_si128(_mm_shuffle_epi8(rg, rg_hi), _mm_shuffle_epi8(bb, b_hi));
+
+	_mm_storeu_si128((__m128i *)dst, lo);
+	_mm_storel_epi64((__m128i *)(dst + 16), hi);
+}
+
+/*!
+ * 8 pixels of YUV in 16 bit lanes to 16 bit R, G and B lanes, same math as
+ * YUV444_to_R8G8B8 with the products summed in 32 bits.
+ */
+TARGET_SSSE3 static inline void
+YUV444_to_RGB_x8_ssse3(__m128i y, __m128i u, __m128i v, __m128i *out_r, __m128i *out_g, __m128i *out_b)
+{
+	const __m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	const __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	const __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi32(128);
+
+	const __m128i k_r = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+	const __m128i k_g_cd = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+	const __m128i k_g_e = _mm_setr_epi16(-209, 128, -209, 128, -209, 128, -209, 128);
+	const __m128i k_b = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+
+	__m128i ce_lo = _mm_unpacklo_epi16(c, e);
+	__m128i ce_hi = _mm_unpackhi_epi16(c, e);
+	__m128i cd_lo = _mm_unpacklo_epi16(c, d);
+	__m128i cd_hi = _mm_unpackhi_epi16(c, d);
+	__m128i e1_lo = _mm_unpacklo_epi16(e, one);
+	__m128i e1_hi = _mm_unpackhi_epi16(e, one);
+
+	__m128i r_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_lo, k_r), round), 8);
+	__m128i r_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_hi, k_r), round), 8);
+
+	// The rounding is folded into the (E, 1) pairs.
+	__m128i g_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_lo, k_g_cd), _mm_madd_epi16(e1_lo, k_g_e)), 8);
+	__m128i g_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_hi, k_g_cd), _mm_madd_epi16(e1_hi, k_g_e)), 8);
+
+	__m128i b_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_lo, k_b), round), 8);
+	__m128i b_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_hi, k_b), round), 8);
+
+	*out_r = _mm_packs_epi32(r_lo, r_hi);
+	*out_g = _mm_packs_epi32(g_lo, g_hi);
+	*out_b = _mm_packs_epi32(b_lo, b_hi);
+}
+
+TARGET_SSSE3 static inline void
+YUV422_to_R8G8B8_x8_ssse3(const uint8_t *src, uint8_t *dst, bool uyvy)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	const __m128i u_mask = _mm_setr_epi8(0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13);
+	const __m128i v_mask = _mm_setr_epi8(2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15);
+
+	__m128i in = _mm_loadu_si128((const __m128i *)src);
+	__m128i y = uyvy ? _mm_srli_epi16(in, 8) : _mm_and_si128(in, low_bytes);
+	__m128i uv = uyvy ? _mm_and_si128(in, low_bytes) : _mm_srli_epi16(in, 8);
+
+	__m128i r, g, b;
+	YUV444_to_RGB_x8_ssse3(y, _mm_shuffle_epi8(uv, u_mask), _mm_shuffle_epi8(uv, v_mask), &r, &g, &b);
+	store_R8G8B8_x8_ssse3(dst, r, g, b);
+}
+
+TARGET_SSSE3 static inline void
+YUYV422_to_R8G8B8_x8_ssse3(const uint8_t *src, uint8_t *dst)
+{
+	YUV422_to_R8G8B8_x8_ssse3(src, dst, false);
+}
+
+TARGET_SSSE3 static inline void
+UYVY422_to_R8G8B8_x8_ssse3(const uint8_t *src, uint8_t *dst)
+{
+	YUV422_to_R8G8B8_x8_ssse3(src, dst, true);
+}
+
+TARGET_SSSE3 static inline void
+YUV888_to_R8G8B8_x8_ssse3(const uint8_t *src, uint8_t *dst)
+{
+	// Pixels 0 to 5 from the first load, 5 to 7 from the second.
+	const __m128i y_a = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+	const __m128i y_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 13, -1);
+	const __m128i u_a = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i u_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, -1, 11, -1, 14, -1);
+	const __m128i v_a = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i v_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 9, -1, 12, -1, 15, -1);
+
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b8 = _mm_loadu_si128((const __m128i *)(src + 8));
+
+	__m128i y = _mm_or_si128(_mm_shuffle_epi8(a, y_a), _mm_shuffle_epi8(b8, y_b));
+	__m128i u = _mm_or_si128(_mm_shuffle_epi8(a, u_a), _mm_shuffle_epi8(b8, u_b));
+	__m128i v = _mm_or_si128(_mm_shuffle_epi8(a, v_a), _mm_shuffle_epi8(b8, v_b));
+
+	__m128i r, g, b;
+	YUV444_to_RGB_x8_ssse3(y, u, v, &r, &g, &b);
+	store_R8G8B8_x8_ssse3(dst, r, g, b);
+}
+
+TARGET_SSSE3 static inline void
+L8_to_R8G8B8_x16_ssse3(const uint8_t *src, uint8_t *dst)
+{
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+
+	__m128i l = _mm_loadu_si128((const __m128i *)src);
+
+	_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(l, m0));
+	_mm_storeu_si128((__m128i *)(dst + 16), _mm_shuffle_epi8(l, m1));
+	_mm_storeu_si128((__m128i *)(dst + 32), _mm_shuffle_epi8(l, m2));
+}
+
+DEFINE_KERNEL(TARGET_SSSE3, L8_to_R8G8B8_ssse3, L8_to_R8G8B8_row, L8_to_R8G8B8_x16_ssse3, 16, 1)
+DEFINE_KERNEL(TARGET_SSSE3, YUYV422_to_R8G8B8_ssse3, YUYV422_to_R8G8B8_row, YUYV422_to_R8G8B8_x8_ssse3, 8, 2)
+DEFINE_KERNEL(TARGET_SSSE3, UYVY422_to_R8G8B8_ssse3, UYVY422_to_R8G8B8_row, UYVY422_to_R8G8B8_x8_ssse3, 8, 2)
+DEFINE_KERNEL(TARGET_SSSE3, YUV888_to_R8G8B8_ssse3, YUV888_to_R8G8B8_row, YUV888_to_R8G8B8_x8_ssse3, 8, 3)
+
+TARGET_SSSE3 static void
+YUYV422_to_L8_ssse3(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *s = src + y * src_stride;
+		uint8_t *d = dst + y * dst_stride;
+
+		uint32_t x = 0;
+		for (; x + 16 <= w; x += 16) {
+			__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + x * 2)), low_bytes);
+			__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + x * 2 + 16)), low_bytes);
+			_mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(a, b));
+		}
+		YUYV422_to_L8_row(s + x * 2, d + x, w - x);
+	}
+}
+
+TARGET_SSSE3 static void
+BAYER_GR8_to_R8G8B8_ssse3(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *src0 = src + (y * 2) * src_stride;
+		const uint8_t *src1 = src + (y * 2 + 1) * src_stride;
+		uint8_t *d = dst + y * dst_stride;
+
+		uint32_t x = 0;
+		for (; x + 8 <= w; x += 8) {
+			__m128i s0 = _mm_loadu_si128((const __m128i *)(src0 + x * 2));
+			__m128i s1 = _mm_loadu_si128((const __m128i *)(src1 + x * 2));
+
+			__m128i r = _mm_srli_epi16(s0, 8);
+			__m128i g0 = _mm_and_si128(s0, low_bytes);
+			__m128i b = _mm_and_si128(s1, low_bytes);
+			__m128i g1 = _mm_srli_epi16(s1, 8);
+			__m128i g = _mm_srli_epi16(_mm_add_epi16(g0, g1), 1);
+
+			store_R8G8B8_x8_ssse3(d + x * 3, r, g, b);
+		}
+		BAYER_GR8_to_R8G8B8_row(src0 + x * 2, src1 + x * 2, d + x * 3, w - x);
+	}
+}
+
+/*!
+ * 16 pixels, each 128 bit lane does 8 of them like the SSSE3 version.
+ */
+TARGET_AVX2 static inline void
+YUV422_to_R8G8B8_x16_avx2(const uint8_t *src, uint8_t *dst, bool uyvy)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+	const __m256i u_mask = _mm256_setr_epi8(0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13, //
+	                                        0, 1, 0, 1, 4, 5, 4, 5, 8, 9, 8, 9, 12, 13, 12, 13);
+	const __m256i v_mask = _mm256_setr_epi8(2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15, //
+	                                        2, 3, 2, 3, 6, 7, 6, 7, 10, 11, 10, 11, 14, 15, 14, 15);
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i round = _mm256_set1_epi32(128);
+	const __m256i k_r = _mm256_set1_epi32((int32_t)((409u << 16) | 298u));
+	const __m256i k_g_cd = _mm256_set1_epi32((int32_t)(((uint32_t)(uint16_t)-100 << 16) | 298u));
+	const __m256i k_g_e = _mm256_set1_epi32((int32_t)((128u << 16) | (uint16_t)-209));
+	const __m256i k_b = _mm256_set1_epi32((int32_t)((516u << 16) | 298u));
+
+	__m256i in = _mm256_loadu_si256((const __m256i *)src);
+	__m256i y = uyvy ? _mm256_srli_epi16(in, 8) : _mm256_and_si256(in, low_bytes);
+	__m256i uv = uyvy ? _mm256_and_si256(in, low_bytes) : _mm256_srli_epi16(in, 8);
+
+	__m256i c = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+	__m256i d = _mm256_sub_epi16(_mm256_shuffle_epi8(uv, u_mask), _mm256_set1_epi16(128));
+	__m256i e = _mm256_sub_epi16(_mm256_shuffle_epi8(uv, v_mask), _mm256_set1_epi16(128));
+
+	__m256i ce_lo = _mm256_unpacklo_epi16(c, e);
+	__m256i ce_hi = _mm256_unpackhi_epi16(c, e);
+	__m256i cd_lo = _mm256_unpacklo_epi16(c, d);
+	__m256i cd_hi = _mm256_unpackhi_epi16(c, d);
+	__m256i e1_lo = _mm256_unpacklo_epi16(e, one);
+	__m256i e1_hi = _mm256_unpackhi_epi16(e, one);
+
+	__m256i r_lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ce_lo, k_r), round), 8);
+	__m256i r_hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ce_hi, k_r), round), 8);
+	__m256i g_lo = _mm256_srai_epi32(
+	    _mm256_add_epi32(_mm256_madd_epi16(cd_lo, k_g_cd), _mm256_madd_epi16(e1_lo, k_g_e)), 8);
+	__m256i g_hi = _mm256_srai_epi32(
+	    _mm256_add_epi32(_mm256_madd_epi16(cd_hi, k_g_cd), _mm256_madd_epi16(e1_hi, k_g_e)), 8);
+	__m256i b_lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_lo, k_b), round), 8);
+	__m256i b_hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd_hi, k_b), round), 8);
+
+	// Unpack and pack are both per lane, so each lane stays in pixel order.
+	__m256i r = _mm256_packs_epi32(r_lo, r_hi);
+	__m256i g = _mm256_packs_epi32(g_lo, g_hi);
+	__m256i b = _mm256_packs_epi32(b_lo, b_hi);
+
+	store_R8G8B8_x8_ssse3(dst, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+	store_R8G8B8_x8_ssse3(dst + 24, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+	                      _mm256_extracti128_si256(b, 1));
+}
+
+TARGET_AVX2 static inline void
+YUYV422_to_R8G8B8_x16_avx2(const uint8_t *src, uint8_t *dst)
+{
+	YUV422_to_R8G8B8_x16_avx2(src, dst, false);
+}
+
+TARGET_AVX2 static inline void
+UYVY422_to_R8G8B8_x16_avx2(const uint8_t *src, uint8_t *dst)
+{
+	YUV422_to_R8G8B8_x16_avx2(src, dst, true);
+}
+
+DEFINE_KERNEL(TARGET_AVX2, YUYV422_to_R8G8B8_avx2, YUYV422_to_R8G8B8_row, YUYV422_to_R8G8B8_x16_avx2, 16, 2)
+DEFINE_KERNEL(TARGET_AVX2, UYVY422_to_R8G8B8_avx2, UYVY422_to_R8G8B8_row, UYVY422_to_R8G8B8_x16_avx2, 16, 2)
+
+TARGET_AVX2 static void
+YUYV422_to_L8_avx2(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *s = src + y * src_stride;
+		uint8_t *d = dst + y * dst_stride;
+
+		uint32_t x = 0;
+		for (; x + 32 <= w; x += 32) {
+			__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + x * 2)), low_bytes);
+			__m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + x * 2 + 32)), low_bytes);
+
+			// Pack works per lane, put the 64 bit blocks back in order.
+			__m256i packed = _mm256_packus_epi16(a, b);
+			_mm256_storeu_si256((__m256i *)(d + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+		YUYV422_to_L8_row(s + x * 2, d + x, w - x);
+	}
+}
+
+#endif // U_FORMAT_CONVERT_X86
+
+
+/*
+ *
+ * NEON.
+ *
+ */
+
+#ifdef U_FORMAT_CONVERT_NEON
+
+/*!
+ * 8 pixels of YUV in 16 bit lanes to 8 bit R, G and B, same math as
+ * YUV444_to_R8G8B8 with the products summed in 32 bits.
+ */
+static inline void
+YUV444_to_RGB_x8_neon(int16x8_t y, int16x8_t u, int16x8_t v, uint8x8x3_t *out_rgb)
+{
+	int16x8_t c = vsubq_s16(y, vdupq_n_s16(16));
+	int16x8_t d = vsubq_s16(u, vdupq_n_s16(128));
+	int16x8_t e = vsubq_s16(v, vdupq_n_s16(128));
+	int32x4_t round = vdupq_n_s32(128);
+
+	int32x4_t r_lo = vmlal_n_s16(vmlal_n_s16(round, vget_low_s16(c), 298), vget_low_s16(e), 409);
+	int32x4_t r_hi = vmlal_n_s16(vmlal_n_s16(round, vget_high_s16(c), 298), vget_high_s16(e), 409);
+
+	int32x4_t g_lo = vmlal_n_s16(round, vget_low_s16(c), 298);
+	g_lo = vmlal_n_s16(g_lo, vget_low_s16(d), -100);
+	g_lo = vmlal_n_s16(g_lo, vget_low_s16(e), -209);
+	int32x4_t g_hi = vmlal_n_s16(round, vget_high_s16(c), 298);
+	g_hi = vmlal_n_s16(g_hi, vget_high_s16(d), -100);
+	g_hi = vmlal_n_s16(g_hi, vget_high_s16(e), -209);
+
+	int32x4_t b_lo = vmlal_n_s16(vmlal_n_s16(round, vget_low_s16(c), 298), vget_low_s16(d), 516);
+	int32x4_t b_hi = vmlal_n_s16(vmlal_n_s16(round, vget_high_s16(c), 298), vget_high_s16(d), 516);
+
+	// Arithmetic shift, then saturate to int16 and on to [0, 255].
+	out_rgb->val[0] = vqmovun_s16(vcombine_s16(vqshrn_n_s32(r_lo, 8), vqshrn_n_s32(r_hi, 8)));
+	out_rgb->val[1] = vqmovun_s16(vcombine_s16(vqshrn_n_s32(g_lo, 8), vqshrn_n_s32(g_hi, 8)));
+	out_rgb->val[2] = vqmovun_s16(vcombine_s16(vqshrn_n_s32(b_lo, 8), vqshrn_n_s32(b_hi, 8)));
+}
+
+static inline int16x8_t
+widen_neon(uint8x8_t v)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(v));
+}
+
+static inline void
+YUV422_to_R8G8B8_x16_neon(uint8x8_t y_even, uint8x8_t y_odd, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+	int16x8_t u16 = widen_neon(u);
+	int16x8_t v16 = widen_neon(v);
+
+	uint8x8x3_t even;
+	uint8x8x3_t odd;
+	YUV444_to_RGB_x8_neon(widen_neon(y_even), u16, v16, &even);
+	YUV444_to_RGB_x8_neon(widen_neon(y_odd), u16, v16, &odd);
+
+	uint8x8x2_t r = vzip_u8(even.val[0], odd.val[0]);
+	uint8x8x2_t g = vzip_u8(even.val[1], odd.val[1]);
+	uint8x8x2_t b = vzip_u8(even.val[2], odd.val[2]);
+
+	uint8x8x3_t first = {{r.val[0], g.val[0], b.val[0]}};
+	uint8x8x3_t second = {{r.val[1], g.val[1], b.val[1]}};
+	vst3_u8(dst, first);
+	vst3_u8(dst + 24, second);
+}
+
+static inline void
+YUYV422_to_R8G8B8_x16_neon(const uint8_t *src, uint8_t *dst)
+{
+	uint8x8x4_t in = vld4_u8(src);
+	YUV422_to_R8G8B8_x16_neon(in.val[0], in.val[2], in.val[1], in.val[3], dst);
+}
+
+static inline void
+UYVY422_to_R8G8B8_x16_neon(const uint8_t *src, uint8_t *dst)
+{
+	uint8x8x4_t in = vld4_u8(src);
+	YUV422_to_R8G8B8_x16_neon(in.val[1], in.val[3], in.val[0], in.val[2], dst);
+}
+
+static inline void
+YUV888_to_R8G8B8_x8_neon(const uint8_t *src, uint8_t *dst)
+{
+	uint8x8x3_t in = vld3_u8(src);
+	uint8x8x3_t rgb;
+	YUV444_to_RGB_x8_neon(widen_neon(in.val[0]), widen_neon(in.val[1]), widen_neon(in.val[2]), &rgb);
+	vst3_u8(dst, rgb);
+}
+
+static inline void
+L8_to_R8G8B8_x16_neon(const uint8_t *src, uint8_t *dst)
+{
+	uint8x16_t l = vld1q_u8(src);
+	uint8x16x3_t rgb = {{l, l, l}};
+	vst3q_u8(dst, rgb);
+}
+
+DEFINE_KERNEL(, L8_to_R8G8B8_neon, L8_to_R8G8B8_row, L8_to_R8G8B8_x16_neon, 16, 1)
+DEFINE_KERNEL(, YUYV422_to_R8G8B8_neon, YUYV422_to_R8G8B8_row, YUYV422_to_R8G8B8_x16_neon, 16, 2)
+DEFINE_KERNEL(, UYVY422_to_R8G8B8_neon, UYVY422_to_R8G8B8_row, UYVY422_to_R8G8B8_x16_neon, 16, 2)
+DEFINE_KERNEL(, YUV888_to_R8G8B8_neon, YUV888_to_R8G8B8_row, YUV888_to_R8G8B8_x8_neon, 8, 3)
+
+static void
+YUYV422_to_L8_neon(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *s = src + y * src_stride;
+		uint8_t *d = dst + y * dst_stride;
+
+		uint32_t x = 0;
+		for (; x + 16 <= w; x += 16) {
+			vst1q_u8(d + x, vld2q_u8(s + x * 2).val[0]);
+		}
+		YUYV422_to_L8_row(s + x * 2, d + x, w - x);
+	}
+}
+
+static void
+BAYER_GR8_to_R8G8B8_neon(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h)
+{
+	for (uint32_t y = 0; y < h; y++) {
+		const uint8_t *src0 = src + (y * 2) * src_stride;
+		const uint8_t *src1 = src + (y * 2 + 1) * src_stride;
+		uint8_t *d = dst + y * dst_stride;
+
+		uint32_t x = 0;
+		for (; x + 8 <= w; x += 8) {
+			uint8x8x2_t gr = vld2_u8(src0 + x * 2);
+			uint8x8x2_t bg = vld2_u8(src1 + x * 2);
+
+			uint8x8x3_t rgb;
+			rgb.val[0] = gr.val[1];
+			rgb.val[1] = vshrn_n_u16(vaddl_u8(gr.val[0], bg.val[1]), 1);
+			rgb.val[2] = bg.val[0];
+			vst3_u8(d + x * 3, rgb);
+		}
+		BAYER_GR8_to_R8G8B8_row(src0 + x * 2, src1 + x * 2, d + x * 3, w - x);
+	}
+}
+
+#endif // U_FORMAT_CONVERT_NEON
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+bool
+u_format_convert_simd_supported(enum u_format_convert_simd simd)
+{
+	switch (simd) {
+	case U_FORMAT_CONVERT_SIMD_NONE: return true;
+#ifdef U_FORMAT_CONVERT_X86
+	case U_FORMAT_CONVERT_SIMD_SSSE3: return __builtin_cpu_supports("ssse3");
+	case U_FORMAT_CONVERT_SIMD_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+#ifdef U_FORMAT_CONVERT_NEON
+	case U_FORMAT_CONVERT_SIMD_NEON: return true;
+#endif
+	default: return false;
+	}
+}
+
+enum u_format_convert_simd
+u_format_convert_simd_best(void)
+{
+	const enum u_format_convert_simd order[] = {
+	    U_FORMAT_CONVERT_SIMD_AVX2,
+	    U_FORMAT_CONVERT_SIMD_SSSE3,
+	    U_FORMAT_CONVERT_SIMD_NEON,
+	};
+
+	for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		if (u_format_convert_simd_supported(order[i])) {
+			return order[i];
+		}
+	}
+
+	return U_FORMAT_CONVERT_SIMD_NONE;
+}
+
+const char *
+u_format_convert_simd_str(enum u_format_convert_simd simd)
+{
+	switch (simd) {
+	case U_FORMAT_CONVERT_SIMD_NONE: return "none";
+	case U_FORMAT_CONVERT_SIMD_SSSE3: return "ssse3";
+	case U_FORMAT_CONVERT_SIMD_AVX2: return "avx2";
+	case U_FORMAT_CONVERT_SIMD_NEON: return "neon";
+	default: return "unknown";
+	}
+}
+
+void
+u_format_convert_get_funcs(enum u_format_convert_simd simd, struct u_format_convert_funcs *out_funcs)
+{
+	assert(u_format_convert_simd_supported(simd));
+
+	struct u_format_convert_funcs funcs = {
+	    .simd = U_FORMAT_CONVERT_SIMD_NONE,
+	    .L8_to_R8G8B8 = L8_to_R8G8B8_none,
+	    .YUYV422_to_L8 = YUYV422_to_L8_none,
+	    .YUYV422_to_R8G8B8 = YUYV422_to_R8G8B8_none,
+	    .UYVY422_to_R8G8B8 = UYVY422_to_R8G8B8_none,
+	    .YUV888_to_R8G8B8 = YUV888_to_R8G8B8_none,
+	    .BAYER_GR8_to_R8G8B8 = BAYER_GR8_to_R8G8B8_none,
+	};
+
+	switch (simd) {
+#ifdef U_FORMAT_CONVERT_X86
+	case U_FORMAT_CONVERT_SIMD_AVX2:
+	case U_FORMAT_CONVERT_SIMD_SSSE3:
+		funcs.simd = simd;
+		funcs.L8_to_R8G8B8 = L8_to_R8G8B8_ssse3;
+		funcs.YUYV422_to_L8 = YUYV422_to_L8_ssse3;
+		funcs.YUYV422_to_R8G8B8 = YUYV422_to_R8G8B8_ssse3;
+		funcs.UYVY422_to_R8G8B8 = UYVY422_to_R8G8B8_ssse3;
+		funcs.YUV888_to_R8G8B8 = YUV888_to_R8G8B8_ssse3;
+		funcs.BAYER_GR8_to_R8G8B8 = BAYER_GR8_to_R8G8B8_ssse3;
+
+		// Only the 4:2:2 ones have enough math per byte to gain from wider vectors.
+		if (simd == U_FORMAT_CONVERT_SIMD_AVX2) {
+			funcs.YUYV422_to_L8 = YUYV422_to_L8_avx2;
+			funcs.YUYV422_to_R8G8B8 = YUYV422_to_R8G8B8_avx2;
+			funcs.UYVY422_to_R8G8B8 = UYVY422_to_R8G8B8_avx2;
+		}
+		break;
+#endif
+#ifdef U_FORMAT_CONVERT_NEON
+	case U_FORMAT_CONVERT_SIMD_NEON:
+		funcs.simd = simd;
+		funcs.L8_to_R8G8B8 = L8_to_R8G8B8_neon;
+		funcs.YUYV422_to_L8 = YUYV422_to_L8_neon;
+		funcs.YUYV422_to_R8G8B8 = YUYV422_to_R8G8B8_neon;
+		funcs.UYVY422_to_R8G8B8 = UYVY422_to_R8G8B8_neon;
+		funcs.YUV888_to_R8G8B8 = YUV888_to_R8G8B8_neon;
+		funcs.BAYER_GR8_to_R8G8B8 = BAYER_GR8_to_R8G8B8_neon;
+		break;
+#endif
+	default: break;
+	}
+
+	*out_funcs = funcs;
+}
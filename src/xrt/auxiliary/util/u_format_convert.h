@@ -0,0 +1,96 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Image format conversion kernels, with SIMD versions.
+ * @ingroup aux_util
+ */
+
+#pragma once
+
+#include "xrt/xrt_compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * Instruction sets the conversion kernels can use.
+ *
+ * @ingroup aux_util
+ */
+enum u_format_convert_simd
+{
+	U_FORMAT_CONVERT_SIMD_NONE,
+	U_FORMAT_CONVERT_SIMD_SSSE3,
+	U_FORMAT_CONVERT_SIMD_AVX2,
+	U_FORMAT_CONVERT_SIMD_NEON,
+};
+
+/*!
+ * Converts @p h rows of @p w pixels, the sizes are of the destination. The
+ * rows can be converted in bands, each row only reads the source rows it
+ * corresponds to.
+ *
+ * @ingroup aux_util
+ */
+typedef void (*u_format_convert_func_t)(
+    const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, uint32_t w, uint32_t h);
+
+/*!
+ * The conversion kernels for one instruction set, all of them give the same
+ * results as the plain C ones.
+ *
+ * @ingroup aux_util
+ */
+struct u_format_convert_funcs
+{
+	enum u_format_convert_simd simd;
+
+	u_format_convert_func_t L8_to_R8G8B8;
+	u_format_convert_func_t YUYV422_to_L8;
+	u_format_convert_func_t YUYV422_to_R8G8B8;
+	u_format_convert_func_t UYVY422_to_R8G8B8;
+	u_format_convert_func_t YUV888_to_R8G8B8;
+
+	//! Half the size of the source, one pixel per 2x2 block.
+	u_format_convert_func_t BAYER_GR8_to_R8G8B8;
+};
+
+/*!
+ * Is the instruction set built in and supported by this CPU.
+ *
+ * @ingroup aux_util
+ */
+bool
+u_format_convert_simd_supported(enum u_format_convert_simd simd);
+
+/*!
+ * The best supported instruction set.
+ *
+ * @ingroup aux_util
+ */
+enum u_format_convert_simd
+u_format_convert_simd_best(void);
+
+/*!
+ * Name of the instruction set.
+ *
+ * @ingroup aux_util
+ */
+const char *
+u_format_convert_simd_str(enum u_format_convert_simd simd);
+
+/*!
+ * Gets the kernels for @p simd, which must be supported.
+ *
+ * @ingroup aux_util
+ */
+void
+u_format_convert_get_funcs(enum u_format_convert_simd simd, struct u_format_convert_funcs *out_funcs);
+
+
+#ifdef __cplusplus
+}
+#endif
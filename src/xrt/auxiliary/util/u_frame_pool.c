@@ -0,0 +1,387 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Pool of recycled @ref xrt_frame.
+ * @ingroup aux_util
+ */
+
+#include "xrt/xrt_config_os.h"
+
+#include "os/os_threading.h"
+
+#include "util/u_misc.h"
+#include "util/u_var.h"
+#include "util/u_format.h"
+#include "util/u_frame_pool.h"
+
+#include <stdio.h>
+#include <assert.h>
+
+#ifdef XRT_OS_WINDOWS
+#include <malloc.h>
+#endif
+
+
+/*
+ *
+ * Structs.
+ *
+ */
+
+struct pool_frame;
+
+/*!
+ * Free frames of one format and size.
+ */
+struct pool_bucket
+{
+	enum xrt_format format;
+	uint32_t width;
+	uint32_t height;
+
+	size_t stride;
+	size_t size;
+
+	struct pool_frame *free_list;
+	uint32_t free_count;
+
+	struct pool_bucket *next;
+};
+
+/*!
+ * A frame handed out by the pool, holds a reference to the pool.
+ *
+ * @implements xrt_frame
+ */
+struct pool_frame
+{
+	struct xrt_frame base;
+
+	struct u_frame_pool *pool;
+	struct pool_bucket *bucket;
+
+	//! Next frame on the free list.
+	struct pool_frame *next;
+};
+
+struct u_frame_pool
+{
+	//! The handle and each frame handed out.
+	struct xrt_reference reference;
+
+	//! Protects the buckets, free lists and stats.
+	struct os_mutex mutex;
+
+	char name[64];
+
+	uint32_t max_free;
+
+	//! The handle has been destroyed, frames are no longer put back.
+	bool destroyed;
+
+	struct pool_bucket *buckets;
+
+	struct u_frame_pool_stats stats;
+};
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static uint8_t *
+data_alloc(size_t size)
+{
+#ifdef XRT_OS_WINDOWS
+	return (uint8_t *)_aligned_malloc(size, U_FRAME_POOL_ALIGNMENT);
+#else
+	return (uint8_t *)aligned_alloc(U_FRAME_POOL_ALIGNMENT, size);
+#endif
+}
+
+static void
+data_free(uint8_t *data)
+{
+#ifdef XRT_OS_WINDOWS
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+static void
+frame_free(struct pool_frame *pf)
+{
+	data_free(pf->base.data);
+	free(pf);
+}
+
+static void
+free_list_free(struct pool_frame *pf)
+{
+	while (pf != NULL) {
+		struct pool_frame *next = pf->next;
+		frame_free(pf);
+		pf = next;
+	}
+}
+
+static void
+pool_unreference(struct u_frame_pool *pool)
+{
+	if (!xrt_reference_dec(&pool->reference)) {
+		return;
+	}
+
+	// Only the frames returned after destroy are left, and those are freed.
+	struct pool_bucket *bucket = pool->buckets;
+	while (bucket != NULL) {
+		struct pool_bucket *next = bucket->next;
+		assert(bucket->free_list == NULL);
+		free(bucket);
+		bucket = next;
+	}
+
+	os_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+//! Must be called with the mutex held.
+static struct pool_bucket *
+get_bucket_locked(struct u_frame_pool *pool, enum xrt_format f, uint32_t width, uint32_t height)
+{
+	struct pool_bucket **bucket_ptr = &pool->buckets;
+
+	while (*bucket_ptr != NULL) {
+		struct pool_bucket *bucket = *bucket_ptr;
+
+		if (bucket->format == f && bucket->width == width && bucket->height == height) {
+			// Keep the most recently used first, pipelines only use a few.
+			if (bucket_ptr != &pool->buckets) {
+				*bucket_ptr = bucket->next;
+				bucket->next = pool->buckets;
+				pool->buckets = bucket;
+			}
+			return bucket;
+		}
+
+		bucket_ptr = &bucket->next;
+	}
+
+	struct pool_bucket *bucket = U_TYPED_CALLOC(struct pool_bucket);
+	bucket->format = f;
+	bucket->width = width;
+	bucket->height = height;
+	u_format_size_for_dimensions(f, width, height, &bucket->stride, &bucket->size);
+
+	bucket->next = pool->buckets;
+	pool->buckets = bucket;
+
+	return bucket;
+}
+
+static void
+pool_frame_destroy(struct xrt_frame *xf)
+{
+	struct pool_frame *pf = (struct pool_frame *)xf;
+	struct u_frame_pool *pool = pf->pool;
+	struct pool_bucket *bucket = pf->bucket;
+	bool put_back = false;
+
+	assert(xf->reference.count == 0);
+
+	os_mutex_lock(&pool->mutex);
+
+	pool->stats.outstanding--;
+	if (!pool->destroyed && bucket->free_count < pool->max_free) {
+		pf->next = bucket->free_list;
+		bucket->free_list = pf;
+		bucket->free_count++;
+		pool->stats.free++;
+		put_back = true;
+	} else {
+		pool->stats.frees++;
+	}
+
+	os_mutex_unlock(&pool->mutex);
+
+	if (!put_back) {
+		frame_free(pf);
+	}
+
+	pool_unreference(pool);
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+struct u_frame_pool *
+u_frame_pool_create(const char *name, uint32_t max_free)
+{
+	struct u_frame_pool *pool = U_TYPED_CALLOC(struct u_frame_pool);
+
+	pool->reference.count = 1;
+	pool->max_free = max_free > 0 ? max_free : U_FRAME_POOL_DEFAULT_MAX_FREE;
+	snprintf(pool->name, sizeof(pool->name), "%s", name);
+
+	int ret = os_mutex_init(&pool->mutex);
+	if (ret != 0) {
+		free(pool);
+		return NULL;
+	}
+
+	u_var_add_root(pool, pool->name, false);
+	u_var_add_ro_u64(pool, &pool->stats.hits, "Hits");
+	u_var_add_ro_u64(pool, &pool->stats.misses, "Misses");
+	u_var_add_ro_u64(pool, &pool->stats.frees, "Frees");
+	u_var_add_ro_u64(pool, &pool->stats.outstanding, "Outstanding");
+	u_var_add_ro_u64(pool, &pool->stats.free, "Free");
+
+	return pool;
+}
+
+void
+u_frame_pool_destroy(struct u_frame_pool **pool_ptr)
+{
+	struct u_frame_pool *pool = *pool_ptr;
+	if (pool == NULL) {
+		return;
+	}
+
+	u_var_remove_root(pool);
+
+	os_mutex_lock(&pool->mutex);
+
+	pool->destroyed = true;
+
+	// Steal the free lists, free them outside of the lock.
+	struct pool_frame *to_free = NULL;
+	for (struct pool_bucket *bucket = pool->buckets; bucket != NULL; bucket = bucket->next) {
+		while (bucket->free_list != NULL) {
+			struct pool_frame *pf = bucket->free_list;
+			bucket->free_list = pf->next;
+			pf->next = to_free;
+			to_free = pf;
+			pool->stats.frees++;
+		}
+		bucket->free_count = 0;
+	}
+	pool->stats.free = 0;
+
+	os_mutex_unlock(&pool->mutex);
+
+	free_list_free(to_free);
+
+	pool_unreference(pool);
+	*pool_ptr = NULL;
+}
+
+void
+u_frame_pool_create_frame(struct u_frame_pool *pool,
+                          enum xrt_format f,
+                          uint32_t width,
+                          uint32_t height,
+                          struct xrt_frame **out_frame)
+{
+	assert(width > 0);
+	assert(height > 0);
+	assert(u_format_is_blocks(f));
+
+	os_mutex_lock(&pool->mutex);
+
+	struct pool_bucket *bucket = get_bucket_locked(pool, f, width, height);
+	struct pool_frame *pf = bucket->free_list;
+	if (pf != NULL) {
+		bucket->free_list = pf->next;
+		bucket->free_count--;
+		pool->stats.free--;
+		pool->stats.hits++;
+	} else {
+		pool->stats.misses++;
+	}
+	pool->stats.outstanding++;
+
+	os_mutex_unlock(&pool->mutex);
+
+	if (pf == NULL) {
+		// Rounded up so that all of the data is in whole pages.
+		size_t alloc_size = (bucket->size + U_FRAME_POOL_ALIGNMENT - 1) & ~(size_t)(U_FRAME_POOL_ALIGNMENT - 1);
+
+		uint8_t *data = data_alloc(alloc_size);
+		if (data == NULL) {
+			os_mutex_lock(&pool->mutex);
+			pool->stats.outstanding--;
+			os_mutex_unlock(&pool->mutex);
+
+			xrt_frame_reference(out_frame, NULL);
+			return;
+		}
+
+		pf = U_TYPED_CALLOC(struct pool_frame);
+		pf->pool = pool;
+		pf->bucket = bucket;
+		pf->base.data = data;
+	}
+
+	// Reset everything but the data, stale values must not leak through.
+	uint8_t *data = pf->base.data;
+	U_ZERO(&pf->base);
+	pf->base.destroy = pool_frame_destroy;
+	pf->base.format = f;
+	pf->base.width = width;
+	pf->base.height = height;
+	pf->base.stride = bucket->stride;
+	pf->base.size = bucket->size;
+	pf->base.data = data;
+	pf->next = NULL;
+
+	xrt_reference_inc(&pool->reference);
+
+	xrt_frame_reference(out_frame, &pf->base);
+}
+
+void
+u_frame_pool_clone(struct u_frame_pool *pool, struct xrt_frame *to_copy, struct xrt_frame **out_frame)
+{
+	struct xrt_frame *xf = NULL;
+	u_frame_pool_create_frame(pool, to_copy->format, to_copy->width, to_copy->height, &xf);
+	if (xf == NULL) {
+		xrt_frame_reference(out_frame, NULL);
+		return;
+	}
+
+	xf->stereo_format = to_copy->stereo_format;
+
+	xf->timestamp = to_copy->timestamp;
+	xf->source_timestamp = to_copy->source_timestamp;
+	xf->source_sequence = to_copy->source_sequence;
+	xf->source_id = to_copy->source_id;
+
+	if (to_copy->stride == xf->stride && to_copy->size == xf->size) {
+		memcpy(xf->data, to_copy->data, xf->size);
+	} else {
+		// Region of interest or padded rows, copy the rows one by one.
+		size_t rows = xf->size / xf->stride;
+		for (size_t r = 0; r < rows; r++) {
+			memcpy(xf->data + r * xf->stride, to_copy->data + r * to_copy->stride, xf->stride);
+		}
+	}
+
+	xrt_frame_reference(out_frame, xf);
+	xrt_frame_reference(&xf, NULL);
+}
+
+void
+u_frame_pool_get_stats(struct u_frame_pool *pool, struct u_frame_pool_stats *out_stats)
+{
+	os_mutex_lock(&pool->mutex);
+	*out_stats = pool->stats;
+	os_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,124 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Pool of recycled @ref xrt_frame.
+ * @ingroup aux_util
+ */
+
+#pragma once
+
+#include "xrt/xrt_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * Alignment of the data of frames from a @ref u_frame_pool, the size of the
+ * data is also rounded up to it.
+ *
+ * @ingroup aux_util
+ */
+#define U_FRAME_POOL_ALIGNMENT (4096)
+
+/*!
+ * Default number of free frames kept for each format and size.
+ *
+ * @ingroup aux_util
+ */
+#define U_FRAME_POOL_DEFAULT_MAX_FREE (16)
+
+/*!
+ * A pool of frames, frames handed out are put back on a free list for their
+ * format and size when their last reference is dropped, and reused for the
+ * next frame of that format and size. Frames can outlive the pool handle,
+ * each frame handed out keeps the pool alive.
+ *
+ * Safe to use from multiple threads.
+ *
+ * @ingroup aux_util
+ */
+struct u_frame_pool;
+
+/*!
+ * Counters of a @ref u_frame_pool.
+ *
+ * @ingroup aux_util
+ */
+struct u_frame_pool_stats
+{
+	//! Frames handed out from a free list.
+	uint64_t hits;
+
+	//! Frames that had to be allocated.
+	uint64_t misses;
+
+	//! Frames freed because their free list was full or the pool destroyed.
+	uint64_t frees;
+
+	//! Frames handed out that are still referenced.
+	uint64_t outstanding;
+
+	//! Frames on the free lists.
+	uint64_t free;
+};
+
+/*!
+ * Creates a frame pool, @p name is used for the variable tracking root.
+ *
+ * @param name     Name of the pool, used in the debug UI.
+ * @param max_free Free frames to keep for each format and size, zero for
+ *                 @ref U_FRAME_POOL_DEFAULT_MAX_FREE.
+ *
+ * @ingroup aux_util
+ */
+struct u_frame_pool *
+u_frame_pool_create(const char *name, uint32_t max_free);
+
+/*!
+ * Destroys the pool handle and frees all free frames, frames still
+ * referenced are freed when their last reference is dropped.
+ *
+ * @ingroup aux_util
+ */
+void
+u_frame_pool_destroy(struct u_frame_pool **pool_ptr);
+
+/*!
+ * Like @ref u_frame_create_one_off but from the pool, the data is not cleared
+ * and the timestamps are zero. @p out_frame is set to NULL if the data can't
+ * be allocated.
+ *
+ * @ingroup aux_util
+ */
+void
+u_frame_pool_create_frame(struct u_frame_pool *pool,
+                          enum xrt_format f,
+                          uint32_t width,
+                          uint32_t height,
+                          struct xrt_frame **out_frame);
+
+/*!
+ * Like @ref u_frame_clone but from the pool, the clone is tightly packed even
+ * if @p to_copy is not, like a region of interest. @p out_frame is set to NULL
+ * if the data can't be allocated.
+ *
+ * @ingroup aux_util
+ */
+void
+u_frame_pool_clone(struct u_frame_pool *pool, struct xrt_frame *to_copy, struct xrt_frame **out_frame);
+
+/*!
+ * Gets the counters of the pool.
+ *
+ * @ingroup aux_util
+ */
+void
+u_frame_pool_get_stats(struct u_frame_pool *pool, struct u_frame_pool_stats *out_stats);
+
+
+#ifdef __cplusplus
+}
+#endif
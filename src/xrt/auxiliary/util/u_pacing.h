@@ -701,6 +701,32 @@ struct u_pc_display_timing_config
  */
 extern const struct u_pc_display_timing_config U_PC_DISPLAY_TIMING_CONFIG_DEFAULT;
 
+/*!
+ * Configuration for the percentile based implementation of @ref u_pacing_compositor
+ *
+ * @see u_pc_percentile_create
+ */
+struct u_pc_percentile_config
+{
+	/*!
+	 * Same as for the display timing implementation, the compositor time
+	 * fraction is only used until there are measurements, the non miss
+	 * adjustment is how fast the budget shrinks.
+	 */
+	struct u_pc_display_timing_config base;
+	//! Which percentile of the measured frame times to budget for, in per mille, 990 is p99, at most 1000.
+	uint32_t percentile_per_mille;
+	//! How many frames to keep the budget after a missed frame before shrinking it again.
+	uint32_t hold_frames;
+};
+
+/*!
+ * Default configuration values for percentile based compositor pacing.
+ *
+ * @see u_pc_percentile_config, u_pc_percentile_create
+ */
+extern const struct u_pc_percentile_config U_PC_PERCENTILE_CONFIG_DEFAULT;
+
 
 /*
  *
@@ -721,6 +747,21 @@ u_pc_display_timing_create(uint64_t estimated_frame_period_ns,
                            const struct u_pc_display_timing_config *config,
                            struct u_pacing_compositor **out_upc);
 
+/*!
+ * Creates a new composition pacing helper that uses real display timing
+ * information, like @ref u_pc_display_timing_create. Instead of stepping the
+ * compositor time it keeps histograms of how long the last frames took and
+ * budgets for a percentile of them. A missed frame grows the budget straight
+ * away to cover it.
+ *
+ * @ingroup aux_pacing
+ * @see u_pacing_compositor
+ */
+xrt_result_t
+u_pc_percentile_create(uint64_t estimated_frame_period_ns,
+                       const struct u_pc_percentile_config *config,
+                       struct u_pacing_compositor **out_upc);
+
 /*!
  * Creates a new composition pacing helper that does not depend on display timing information.
  *
@@ -33,6 +33,15 @@ DEBUG_GET_ONCE_LOG_OPTION(log_level, "U_PACING_COMPOSITOR_LOG", U_LOGGING_WARN)
 
 #define PRESENT_SLOP_NS (U_TIME_HALF_MS_IN_NS)
 
+//! Width of a bin of @ref duration_histogram.
+#define HISTOGRAM_BIN_NS (50 * 1000)
+
+//! Number of bins, longer durations go into the last bin.
+#define HISTOGRAM_BIN_COUNT 512
+
+//! Number of frames the histograms are over.
+#define HISTOGRAM_WINDOW 256
+
 
 /*
  *
@@ -88,6 +97,21 @@ struct frame
 	enum frame_state state;
 };
 
+/*!
+ * Histogram of the durations of the last @ref HISTOGRAM_WINDOW frames.
+ */
+struct duration_histogram
+{
+	//! Number of samples in each bin.
+	uint16_t bins[HISTOGRAM_BIN_COUNT];
+
+	//! Bin of each sample, to remove it when it leaves the window.
+	uint16_t samples[HISTOGRAM_WINDOW];
+
+	uint32_t next;
+	uint32_t count;
+};
+
 struct pacing_compositor
 {
 	struct u_pacing_compositor base;
@@ -139,6 +163,30 @@ struct pacing_compositor
 	 * Frame store.
 	 */
 	struct frame frames[NUM_FRAMES];
+
+	/*!
+	 * When enabled the compositor time is set from a percentile of the
+	 * measured frame times instead of stepped, see @ref u_pc_percentile_create.
+	 */
+	struct
+	{
+		bool enabled;
+
+		//! Which percentile to budget for, in per mille.
+		uint32_t per_mille;
+
+		//! Frames to keep the budget after a missed frame.
+		uint32_t hold_frames;
+		uint32_t hold_left;
+
+		//! From the wake up time to the GPU being done, what the budget covers.
+		struct duration_histogram total;
+
+		//! Parts of total: oversleep, CPU until submit and GPU after submit.
+		struct duration_histogram wake;
+		struct duration_histogram cpu;
+		struct duration_histogram gpu;
+	} percentile;
 };
 
 
@@ -192,6 +240,67 @@ is_within_half_ms(uint64_t l, uint64_t r)
 	return is_within_of_each_other(l, r, U_TIME_HALF_MS_IN_NS);
 }
 
+static inline bool
+is_frame_missed(struct frame *f)
+{
+	return f->actual_present_time_ns > f->desired_present_time_ns &&
+	       !is_within_half_ms(f->actual_present_time_ns, f->desired_present_time_ns);
+}
+
+static inline uint64_t
+diff_or_zero(uint64_t end_ns, uint64_t start_ns)
+{
+	return end_ns > start_ns ? end_ns - start_ns : 0;
+}
+
+static void
+histogram_add(struct duration_histogram *h, uint64_t duration_ns)
+{
+	uint64_t bin = duration_ns / HISTOGRAM_BIN_NS;
+	if (bin >= HISTOGRAM_BIN_COUNT) {
+		bin = HISTOGRAM_BIN_COUNT - 1;
+	}
+
+	// Full, remove the oldest sample.
+	if (h->count == HISTOGRAM_WINDOW) {
+		h->bins[h->samples[h->next]]--;
+	} else {
+		h->count++;
+	}
+
+	h->bins[bin]++;
+	h->samples[h->next] = (uint16_t)bin;
+	h->next = (h->next + 1) % HISTOGRAM_WINDOW;
+}
+
+/*!
+ * Returns the end of the bin that the given percentile falls into, so it
+ * errs on the side of too long.
+ */
+static uint64_t
+histogram_percentile(const struct duration_histogram *h, uint32_t per_mille)
+{
+	if (h->count == 0) {
+		return 0;
+	}
+
+	// Round up, p99 of a few samples is the largest of them.
+	uint32_t wanted = (h->count * per_mille + 999) / 1000;
+	if (wanted == 0) {
+		wanted = 1;
+	}
+
+	uint32_t seen = 0;
+	for (uint32_t i = 0; i < HISTOGRAM_BIN_COUNT; i++) {
+		seen += h->bins[i];
+		if (seen >= wanted) {
+			return (uint64_t)(i + 1) * HISTOGRAM_BIN_NS;
+		}
+	}
+
+	return (uint64_t)HISTOGRAM_BIN_COUNT * HISTOGRAM_BIN_NS;
+}
+
 /*!
  * Gets a frame data structure based on the @p frame_id.
  *
@@ -359,8 +468,7 @@ adjust_comp_time(struct pacing_compositor *pc, struct frame *f)
 {
 	uint64_t comp_time_ns = pc->comp_time_ns;
 
-	if (f->actual_present_time_ns > f->desired_present_time_ns &&
-	    !is_within_half_ms(f->actual_present_time_ns, f->desired_present_time_ns)) {
+	if (is_frame_missed(f)) {
 		double missed_ms = ns_to_ms(f->actual_present_time_ns - f->desired_present_time_ns);
 		UPC_LOG_W("Frame %" PRIu64 " missed by %.2f!", f->frame_id, missed_ms);
 
@@ -393,6 +501,74 @@ adjust_comp_time(struct pacing_compositor *pc, struct frame *f)
 	}
 }
 
+static void
+adjust_comp_time_percentile(struct pacing_compositor *pc, struct frame *f)
+{
+	// The present margin is relative to the earliest possible present.
+	uint64_t gpu_end_ns = diff_or_zero(f->earliest_present_time_ns, f->present_margin_ns);
+
+	uint64_t total_ns = diff_or_zero(gpu_end_ns, f->wake_up_time_ns);
+	histogram_add(&pc->percentile.total, total_ns);
+	histogram_add(&pc->percentile.wake, diff_or_zero(f->when_woke_ns, f->wake_up_time_ns));
+	histogram_add(&pc->percentile.cpu, diff_or_zero(f->when_submitted_ns, f->when_woke_ns));
+	histogram_add(&pc->percentile.gpu, diff_or_zero(gpu_end_ns, f->when_submitted_ns));
+
+	uint64_t budget_ns = histogram_percentile(&pc->percentile.total, pc->percentile.per_mille);
+	uint64_t comp_time_ns = pc->comp_time_ns;
+
+	if (is_frame_missed(f)) {
+		double missed_ms = ns_to_ms(f->actual_present_time_ns - f->desired_present_time_ns);
+		UPC_LOG_W("Frame %" PRIu64 " missed by %.2f!", f->frame_id, missed_ms);
+
+		// A single spike is below the percentile, cover it straight away and hold on to it.
+		comp_time_ns += pc->adjust_missed_ns;
+		if (comp_time_ns < total_ns) {
+			comp_time_ns = total_ns;
+		}
+		pc->percentile.hold_left = pc->percentile.hold_frames;
+	} else if (budget_ns >= comp_time_ns) {
+		comp_time_ns = budget_ns;
+	} else if (pc->percentile.hold_left > 0) {
+		pc->percentile.hold_left--;
+	} else {
+		// Approach the budget slowly, so that we don't go back and forth.
+		uint64_t step_ns = comp_time_ns - budget_ns;
+		if (step_ns > pc->adjust_non_miss_ns) {
+			step_ns = pc->adjust_non_miss_ns;
+		}
+		comp_time_ns -= step_ns;
+	}
+
+	if (comp_time_ns > pc->comp_time_max_ns) {
+		comp_time_ns = pc->comp_time_max_ns;
+	}
+
+	pc->comp_time_ns = comp_time_ns;
+
+	if (debug_get_log_option_log_level() > U_LOGGING_TRACE) {
+		return;
+	}
+
+	uint64_t wake_ns = histogram_percentile(&pc->percentile.wake, pc->percentile.per_mille);
+	uint64_t cpu_ns = histogram_percentile(&pc->percentile.cpu, pc->percentile.per_mille);
+	uint64_t gpu_ns = histogram_percentile(&pc->percentile.gpu, pc->percentile.per_mille);
+
+	UPC_LOG_T(
+	    "Budget"
+	    "\n\tcomp_time_ms:  %.2fms"                         //
+	    "\n\tlast_total_ms: %.2fms"                         //
+	    "\n\ttotal_ms:      %.2fms"                         //
+	    "\n\twake_ms:       %.2fms"                         //
+	    "\n\tcpu_ms:        %.2fms"                         //
+	    "\n\tgpu_ms:        %.2fms",                        //
+	    ns_to_ms(comp_time_ns),                              //
+	    ns_to_ms(total_ns),                                  //
+	    ns_to_ms(budget_ns),                                 //
+	    ns_to_ms(wake_ns),                                   //
+	    ns_to_ms(cpu_ns),                                    //
+	    ns_to_ms(gpu_ns));                                   //
+}
+
 
 /*
  *
@@ -656,7 +832,11 @@ pc_info(struct u_pacing_compositor *upc,
 	}
 
 	// Adjust the frame timing.
-	adjust_comp_time(pc, f);
+	if (pc->percentile.enabled) {
+		adjust_comp_time_percentile(pc, f);
+	} else {
+		adjust_comp_time(pc, f);
+	}
 
 	double present_margin_ms = ns_to_ms(present_margin_ns);
 	double since_last_frame_ms = ns_to_ms(since_last_frame_ns);
@@ -747,10 +927,8 @@ const struct u_pc_display_timing_config U_PC_DISPLAY_TIMING_CONFIG_DEFAULT = {
     .adjust_non_miss_fraction = 2,
 };
 
-xrt_result_t
-u_pc_display_timing_create(uint64_t estimated_frame_period_ns,
-                           const struct u_pc_display_timing_config *config,
-                           struct u_pacing_compositor **out_upc)
+static struct pacing_compositor *
+create(uint64_t estimated_frame_period_ns, const struct u_pc_display_timing_config *config)
 {
 	struct pacing_compositor *pc = U_TYPED_CALLOC(struct pacing_compositor);
 	pc->base.predict = pc_predict;
@@ -777,6 +955,16 @@ u_pc_display_timing_create(uint64_t estimated_frame_period_ns,
 	// Extra margin that is added to compositor time.
 	pc->margin_ns = config->margin_ns;
 
+	return pc;
+}
+
+xrt_result_t
+u_pc_display_timing_create(uint64_t estimated_frame_period_ns,
+                           const struct u_pc_display_timing_config *config,
+                           struct u_pacing_compositor **out_upc)
+{
+	struct pacing_compositor *pc = create(estimated_frame_period_ns, config);
+
 	*out_upc = &pc->base;
 
 	double estimated_frame_period_ms = ns_to_ms(estimated_frame_period_ns);
@@ -784,3 +972,47 @@ u_pc_display_timing_create(uint64_t estimated_frame_period_ns,
 
 	return XRT_SUCCESS;
 }
+
+const struct u_pc_percentile_config U_PC_PERCENTILE_CONFIG_DEFAULT = {
+    .base =
+        {
+            // An arbitrary guess.
+            .present_to_display_offset_ns = U_TIME_1MS_IN_NS * 4,
+            .margin_ns = U_TIME_1MS_IN_NS,
+            // Start by assuming the compositor takes 10% of the frame.
+            .comp_time_fraction = 10,
+            // Don't allow the compositor to take more than 30% of the frame.
+            .comp_time_max_fraction = 30,
+            .adjust_missed_fraction = 4,
+            .adjust_non_miss_fraction = 2,
+        },
+    .percentile_per_mille = 990,
+    // About a second at 90Hz.
+    .hold_frames = 90,
+};
+
+xrt_result_t
+u_pc_percentile_create(uint64_t estimated_frame_period_ns,
+                       const struct u_pc_percentile_config *config,
+                       struct u_pacing_compositor **out_upc)
+{
+	struct pacing_compositor *pc = create(estimated_frame_period_ns, &config->base);
+
+	uint32_t per_mille = config->percentile_per_mille;
+	if (per_mille > 1000) {
+		UPC_LOG_W("Percentile %u per mille is above 1000, using 1000.", per_mille);
+		per_mille = 1000;
+	}
+
+	pc->percentile.enabled = true;
+	pc->percentile.per_mille = per_mille;
+	pc->percentile.hold_frames = config->hold_frames;
+
+	*out_upc = &pc->base;
+
+	double estimated_frame_period_ms = ns_to_ms(estimated_frame_period_ns);
+	UPC_LOG_I("Created percentile compositor pacing (%.2fms, p%.1f)", estimated_frame_period_ms,
+	          per_mille / 10.0);
+
+	return XRT_SUCCESS;
+}
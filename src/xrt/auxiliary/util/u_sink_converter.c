@@ -13,7 +13,11 @@
 #include "util/u_misc.h"
 #include "util/u_sink.h"
 #include "util/u_frame.h"
+#include "util/u_frame_pool.h"
 #include "util/u_format.h"
+#include "util/u_format_convert.h"
+#include "util/u_debug.h"
+#include "util/u_worker_bands.h"
 #include "util/u_trace_marker.h"
 
 #include <stdio.h>
@@ -23,6 +27,10 @@
 #endif
 
 
+DEBUG_GET_ONCE_BOOL_OPTION(converter_simd, "U_SINK_CONVERTER_SIMD", true)
+DEBUG_GET_ONCE_NUM_OPTION(converter_threads, "U_SINK_CONVERTER_THREADS", 4)
+
+
 /*
  *
  * Structs
@@ -41,244 +49,135 @@ struct u_sink_converter
 
 	struct xrt_frame_sink *downstream;
 
-	enum xrt_format format;
-};
+	//! Converted frames, recycled once downstream lets go of them.
+	struct u_frame_pool *pool;
 
+	//! Conversion kernels for the best instruction set on this CPU.
+	struct u_format_convert_funcs funcs;
 
-/*
- *
- * L8 functions.
- *
- */
-
-static void
-from_L8_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
-{
-	SINK_TRACE_MARKER();
+	//! Splits big frames into bands, one per thread.
+	struct u_worker_bands bands;
 
-	for (uint32_t y = 0; y < h; y++) {
-		for (uint32_t x = 0; x < w; x += 1) {
-			const uint8_t *src = data;
-			uint8_t *dst = dst_frame->data;
-
-			src = src + (y * stride) + x;
-			dst = dst + (y * dst_frame->stride) + (x * 3);
-			dst[2] = dst[1] = dst[0] = src[0];
-		}
-	}
-}
+	enum xrt_format format;
+};
 
 
 /*
  *
- * YUV functions.
+ * Banded conversion.
  *
  */
 
-static inline int
-clamp_to_byte(int v)
-{
-	if (v < 0) {
-		return 0;
-	}
-	if (v >= 255) {
-		return 255;
-	}
-	return v;
-}
-
-static inline uint32_t
-YUV444_to_RGBX8888(int y, int u, int v)
-{
-	int C = y - 16;
-	int D = u - 128;
-	int E = v - 128;
-
-	int R = clamp_to_byte((298 * C + 409 * E + 128) >> 8);
-	int G = clamp_to_byte((298 * C - 100 * D - 209 * E + 128) >> 8);
-	int B = clamp_to_byte((298 * C + 516 * D + 128) >> 8);
-
-	return B << 16 | G << 8 | R;
-}
-
-#undef USE_TABLE
-#ifdef USE_TABLE
-static uint32_t lookup_YUV_to_RGBX[256][256][256] = {0};
+/*!
+ * A conversion split up in bands of rows.
+ */
+struct convert_job
+{
+	u_format_convert_func_t func;
+	const uint8_t *src;
+	size_t src_stride;
+	uint32_t src_rows_per_row;
+	uint8_t *dst;
+	size_t dst_stride;
+	uint32_t w;
+};
 
 static void
-generate_lookup_YUV_to_RGBX()
+convert_band(void *ptr, uint32_t y, uint32_t h)
 {
-	if (lookup_YUV_to_RGBX[255][255][255] != 0) {
-		return;
-	}
+	struct convert_job *j = (struct convert_job *)ptr;
 
-	int y;
-	int u;
-	int v;
+	const uint8_t *src = j->src + (size_t)y * j->src_rows_per_row * j->src_stride;
+	uint8_t *dst = j->dst + (size_t)y * j->dst_stride;
 
-	for (y = 0; y < 256; y++) {
-		for (u = 0; u < 256; u++) {
-			for (v = 0; v < 256; v++) {
-				lookup_YUV_to_RGBX[y][u][v] = YUV444_to_RGBX8888(y, u, v);
-			}
-		}
-	}
+	j->func(src, j->src_stride, dst, j->dst_stride, j->w, h);
 }
-#endif
 
-XRT_MAYBE_UNUSED inline static void
-YUYV422_to_R8G8B8X8(const uint8_t *input, uint32_t *rgb1, uint32_t *rgb2)
+/*!
+ * Converts @p h rows of @p w pixels into @p dst_frame, splitting them up in
+ * bands over the worker threads if the frame is big enough. Each destination
+ * row reads @p src_rows_per_row rows of the source.
+ */
+static void
+convert_banded(struct u_sink_converter *s,
+               u_format_convert_func_t func,
+               struct xrt_frame *dst_frame,
+               uint32_t w,
+               uint32_t h,
+               size_t stride,
+               const uint8_t *data,
+               uint32_t src_rows_per_row)
 {
-	uint8_t y0 = input[0];
-	uint8_t u = input[1];
-	uint8_t y1 = input[2];
-	uint8_t v = input[3];
+	struct convert_job job = {
+	    .func = func,
+	    .src = data,
+	    .src_stride = stride,
+	    .src_rows_per_row = src_rows_per_row,
+	    .dst = dst_frame->data,
+	    .dst_stride = dst_frame->stride,
+	    .w = w,
+	};
 
-#ifdef USE_TABLE
-	*rgb1 = lookup_YUV_to_RGBX[y0][u][v];
-	*rgb2 = lookup_YUV_to_RGBX[y1][u][v];
-#else
-	*rgb1 = YUV444_to_RGBX8888(y0, u, v);
-	*rgb2 = YUV444_to_RGBX8888(y1, u, v);
-#endif
+	u_worker_bands_run(&s->bands, h, convert_band, &job);
 }
 
-inline static void
-YUYV422_to_R8G8B8(const uint8_t *input, uint8_t *dst)
-{
-	uint8_t y0 = input[0];
-	uint8_t u = input[1];
-	uint8_t y1 = input[2];
-	uint8_t v = input[3];
-
-#ifdef USE_TABLE
-	uint8_t *rgb1 = (uint8_t *)&lookup_YUV_to_RGBX[y0][u][v];
-	uint8_t *rgb2 = (uint8_t *)&lookup_YUV_to_RGBX[y1][u][v];
-#else
-	uint32_t rgb1v = YUV444_to_RGBX8888(y0, u, v);
-	uint32_t rgb2v = YUV444_to_RGBX8888(y1, u, v);
-	uint8_t *rgb1 = (uint8_t *)&rgb1v;
-	uint8_t *rgb2 = (uint8_t *)&rgb2v;
-#endif
 
-	dst[0] = rgb1[0];
-	dst[1] = rgb1[1];
-	dst[2] = rgb1[2];
-	dst[3] = rgb2[0];
-	dst[4] = rgb2[1];
-	dst[5] = rgb2[2];
-}
+/*
+ *
+ * L8 functions.
+ *
+ */
 
-inline static void
-UYVY422_to_R8G8B8(const uint8_t *input, uint8_t *dst)
-{
-	uint8_t u = input[0];
-	uint8_t y0 = input[1];
-	uint8_t v = input[2];
-	uint8_t y1 = input[3];
-
-#ifdef USE_TABLE
-	uint8_t *rgb1 = (uint8_t *)&lookup_YUV_to_RGBX[y0][u][v];
-	uint8_t *rgb2 = (uint8_t *)&lookup_YUV_to_RGBX[y1][u][v];
-#else
-	uint32_t rgb1v = YUV444_to_RGBX8888(y0, u, v);
-	uint32_t rgb2v = YUV444_to_RGBX8888(y1, u, v);
-	uint8_t *rgb1 = (uint8_t *)&rgb1v;
-	uint8_t *rgb2 = (uint8_t *)&rgb2v;
-#endif
+static void
+from_L8_to_R8G8B8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+{
+	SINK_TRACE_MARKER();
 
-	dst[0] = rgb1[0];
-	dst[1] = rgb1[1];
-	dst[2] = rgb1[2];
-	dst[3] = rgb2[0];
-	dst[4] = rgb2[1];
-	dst[5] = rgb2[2];
+	convert_banded(s, s->funcs.L8_to_R8G8B8, dst_frame, w, h, stride, data, 1);
 }
 
-inline static void
-YUV444_to_R8G8B8(const uint8_t *input, uint8_t *dst)
-{
-	uint8_t y = input[0];
-	uint8_t u = input[1];
-	uint8_t v = input[2];
-
-#ifdef USE_TABLE
-	uint8_t *rgb = (uint8_t *)&lookup_YUV_to_RGBX[y][u][v];
-#else
-	uint32_t rgbv = YUV444_to_RGBX8888(y, u, v);
-	uint8_t *rgb = (uint8_t *)&rgbv;
-#endif
 
-	dst[0] = rgb[0];
-	dst[1] = rgb[1];
-	dst[2] = rgb[2];
-}
+/*
+ *
+ * YUV functions.
+ *
+ */
 
 static void
-from_YUYV422_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+from_YUYV422_to_R8G8B8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
 {
 	SINK_TRACE_MARKER();
 
-	for (uint32_t y = 0; y < h; y++) {
-		for (uint32_t x = 0; x < w; x += 2) {
-			const uint8_t *src = data;
-			uint8_t *dst = dst_frame->data;
-
-			src = src + (y * stride) + (x * 2);
-			dst = dst + (y * dst_frame->stride) + (x * 3);
-			YUYV422_to_R8G8B8(src, dst);
-		}
-	}
+	convert_banded(s, s->funcs.YUYV422_to_R8G8B8, dst_frame, w, h, stride, data, 1);
 }
 
 static void
-from_YUYV422_to_L8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+from_YUYV422_to_L8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
 {
 	SINK_TRACE_MARKER();
 
-	for (uint32_t y = 0; y < h; y++) {
-		const uint8_t *src = data + (y * stride);
-		uint8_t *dst = dst_frame->data + (y * dst_frame->stride);
-
-		for (uint32_t x = 0; x < w; x++) {
-			dst[x] = src[x * 2];
-		}
-	}
+	convert_banded(s, s->funcs.YUYV422_to_L8, dst_frame, w, h, stride, data, 1);
 }
 
 static void
-from_UYVY422_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+from_UYVY422_to_R8G8B8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
 {
 	SINK_TRACE_MARKER();
 
-	for (uint32_t y = 0; y < h; y++) {
-		for (uint32_t x = 0; x < w; x += 2) {
-			const uint8_t *src = data;
-			uint8_t *dst = dst_frame->data;
-
-			src = src + (y * stride) + (x * 2);
-			dst = dst + (y * dst_frame->stride) + (x * 3);
-			UYVY422_to_R8G8B8(src, dst);
-		}
-	}
+	convert_banded(s, s->funcs.UYVY422_to_R8G8B8, dst_frame, w, h, stride, data, 1);
 }
 
-
 static void
-from_YUV888_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+from_YUV888_to_R8G8B8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
 {
 	SINK_TRACE_MARKER();
 
-	for (uint32_t y = 0; y < h; y++) {
-		for (uint32_t x = 0; x < w; x++) {
-			const uint8_t *src = data;
-			uint8_t *dst = dst_frame->data;
-
-			src = src + (y * stride) + (x * 3);
-			dst = dst + (y * dst_frame->stride) + (x * 3);
-			YUV444_to_R8G8B8(src, dst);
-		}
-	}
+	convert_banded(s, s->funcs.YUV888_to_R8G8B8, dst_frame, w, h, stride, data, 1);
 }
 
 
@@ -398,36 +297,13 @@ from_MJPEG_to_YUV888(struct xrt_frame *dst_frame, size_t size, const uint8_t *da
  */
 
 static void
-from_BAYER_GR8_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
+from_BAYER_GR8_to_R8G8B8(
+    struct u_sink_converter *s, struct xrt_frame *dst_frame, uint32_t w, uint32_t h, size_t stride, const uint8_t *data)
 {
 	SINK_TRACE_MARKER();
 
-	const uint8_t *src_data = data;
-	size_t src_stride = stride;
-
-	uint8_t *dst_data = dst_frame->data;
-	size_t dst_stride = dst_frame->stride;
-
-	for (uint32_t y = 0; y < h; y++) {
-		const uint8_t *src0 = src_data + (y * 2) * src_stride;
-		const uint8_t *src1 = src_data + (y * 2 + 1) * src_stride;
-		uint8_t *dst = dst_data + (y * dst_stride);
-
-		for (uint32_t x = 0; x < w; x++) {
-			uint8_t g0 = src0[0];
-			uint8_t r = src0[1];
-			uint8_t b = src1[0];
-			uint8_t g1 = src1[1];
-
-			dst[0] = r;
-			dst[1] = (g0 + g1) / 2;
-			dst[2] = b;
-
-			src0 += 2;
-			src1 += 2;
-			dst += 3;
-		}
-	}
+	// One pixel per 2x2 block, so two source rows per row.
+	convert_banded(s, s->funcs.BAYER_GR8_to_R8G8B8, dst_frame, w, h, stride, data, 2);
 }
 
 
@@ -440,15 +316,17 @@ from_BAYER_GR8_to_R8G8B8(struct xrt_frame *dst_frame, uint32_t w, uint32_t h, si
 
 /*!
  * Creates a frame that the conversion should happen to, allows to set the size.
- *
- * @todo Allocate from a pool of frames.
  */
 static bool
-create_frame_with_format_of_size(
-    struct xrt_frame *xf, uint32_t w, uint32_t h, enum xrt_format format, struct xrt_frame **out_frame)
+create_frame_with_format_of_size(struct u_sink_converter *s,
+                                 struct xrt_frame *xf,
+                                 uint32_t w,
+                                 uint32_t h,
+                                 enum xrt_format format,
+                                 struct xrt_frame **out_frame)
 {
 	struct xrt_frame *frame = NULL;
-	u_frame_create_one_off(format, w, h, &frame);
+	u_frame_pool_create_frame(s->pool, format, w, h, &frame);
 	if (frame == NULL) {
 		U_LOG_E("Failed to create target frame!");
 		*out_frame = NULL;
@@ -470,9 +348,12 @@ create_frame_with_format_of_size(
  * Creates a frame that the conversion should happen to.
  */
 static bool
-create_frame_with_format(struct xrt_frame *xf, enum xrt_format format, struct xrt_frame **out_frame)
+create_frame_with_format(struct u_sink_converter *s,
+                         struct xrt_frame *xf,
+                         enum xrt_format format,
+                         struct xrt_frame **out_frame)
 {
-	return create_frame_with_format_of_size(xf, xf->width, xf->height, format, out_frame);
+	return create_frame_with_format_of_size(s, xf, xf->width, xf->height, format, out_frame);
 }
 
 static void
@@ -487,10 +368,10 @@ convert_frame_l8(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	switch (xf->format) {
 	case XRT_FORMAT_L8: s->downstream->push_frame(s->downstream, xf); return;
 	case XRT_FORMAT_YUYV422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_L8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_L8, &converted)) {
 			return;
 		}
-		from_YUYV422_to_L8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUYV422_to_L8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	default: U_LOG_E("Cannot convert from '%s' to L8!", u_format_str(xf->format)); return;
 	}
@@ -516,32 +397,32 @@ convert_frame_r8g8b8_or_l8(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	case XRT_FORMAT_BAYER_GR8:;
 		uint32_t w = xf->width / 2;
 		uint32_t h = xf->height / 2;
-		if (!create_frame_with_format_of_size(xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format_of_size(s, xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_BAYER_GR8_to_R8G8B8(converted, w, h, xf->stride, xf->data);
+		from_BAYER_GR8_to_R8G8B8(s, converted, w, h, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_YUYV422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUYV422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUYV422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_UYVY422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_UYVY422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_UYVY422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_YUV888:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUV888_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUV888_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_R8G8B8(converted, xf->size, xf->data)) {
@@ -590,26 +471,26 @@ convert_frame_r8g8b8_bayer_or_l8(struct xrt_frame_sink *xs, struct xrt_frame *xf
 	case XRT_FORMAT_R8G8B8:
 	case XRT_FORMAT_BAYER_GR8:; s->downstream->push_frame(s->downstream, xf); return;
 	case XRT_FORMAT_YUYV422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUYV422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUYV422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_UYVY422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_UYVY422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_UYVY422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_YUV888:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUV888_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUV888_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_R8G8B8(converted, xf->size, xf->data)) {
@@ -640,40 +521,40 @@ convert_frame_r8g8b8(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	switch (xf->format) {
 	case XRT_FORMAT_R8G8B8: s->downstream->push_frame(s->downstream, xf); return;
 	case XRT_FORMAT_L8:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_L8_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_L8_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_BAYER_GR8:;
 		uint32_t w = xf->width / 2;
 		uint32_t h = xf->height / 2;
-		if (!create_frame_with_format_of_size(xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format_of_size(s, xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_BAYER_GR8_to_R8G8B8(converted, w, h, xf->stride, xf->data);
+		from_BAYER_GR8_to_R8G8B8(s, converted, w, h, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_YUYV422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUYV422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUYV422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_UYVY422:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_UYVY422_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_UYVY422_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 	case XRT_FORMAT_YUV888:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
-		from_YUV888_to_R8G8B8(converted, xf->width, xf->height, xf->stride, xf->data);
+		from_YUV888_to_R8G8B8(s, converted, xf->width, xf->height, xf->stride, xf->data);
 		break;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_R8G8B8, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_R8G8B8, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_R8G8B8(converted, xf->size, xf->data)) {
@@ -709,7 +590,7 @@ convert_frame_rgb_yuv_yuyv_uyvy_or_l8(struct xrt_frame_sink *xs, struct xrt_fram
 	case XRT_FORMAT_YUV888: s->downstream->push_frame(s->downstream, xf); return;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_YUV888, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_YUV888, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_YUV888(converted, xf->size, xf->data)) {
@@ -744,7 +625,7 @@ convert_frame_yuv_yuyv_uyvy_or_l8(struct xrt_frame_sink *xs, struct xrt_frame *x
 	case XRT_FORMAT_YUV888: s->downstream->push_frame(s->downstream, xf); return;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_YUV888, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_YUV888, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_YUV888(converted, xf->size, xf->data)) {
@@ -780,7 +661,7 @@ convert_frame_yuv_or_yuyv(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	case XRT_FORMAT_YUV888: s->downstream->push_frame(s->downstream, xf); return;
 #ifdef XRT_HAVE_JPEG
 	case XRT_FORMAT_MJPEG:
-		if (!create_frame_with_format(xf, XRT_FORMAT_YUV888, &converted)) {
+		if (!create_frame_with_format(s, xf, XRT_FORMAT_YUV888, &converted)) {
 			return;
 		}
 		if (!from_MJPEG_to_YUV888(converted, xf->size, xf->data)) {
@@ -808,11 +689,11 @@ convert_frame_bayer(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	uint32_t h = xf->height / 2;
 	struct xrt_frame *converted = NULL;
 
-	if (!create_frame_with_format_of_size(xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
+	if (!create_frame_with_format_of_size(s, xf, w, h, XRT_FORMAT_R8G8B8, &converted)) {
 		return;
 	}
 
-	from_BAYER_GR8_to_R8G8B8(converted, w, h, xf->stride, xf->data);
+	from_BAYER_GR8_to_R8G8B8(s, converted, w, h, xf->stride, xf->data);
 
 	s->downstream->push_frame(s->downstream, converted);
 
@@ -820,6 +701,18 @@ convert_frame_bayer(struct xrt_frame_sink *xs, struct xrt_frame *xf)
 	xrt_frame_reference(&converted, NULL);
 }
 
+static void
+init_common(struct u_sink_converter *s)
+{
+	s->pool = u_frame_pool_create("Format converter frames", 0);
+
+	enum u_format_convert_simd simd =
+	    debug_get_bool_option_converter_simd() ? u_format_convert_simd_best() : U_FORMAT_CONVERT_SIMD_NONE;
+	u_format_convert_get_funcs(simd, &s->funcs);
+
+	u_worker_bands_init(&s->bands, debug_get_num_option_converter_threads());
+}
+
 static void
 break_apart(struct xrt_frame_node *node)
 {}
@@ -829,6 +722,11 @@ destroy(struct xrt_frame_node *node)
 {
 	struct u_sink_converter *s = container_of(node, struct u_sink_converter, node);
 
+	// Frames still held downstream keep the pool alive.
+	u_frame_pool_destroy(&s->pool);
+
+	u_worker_bands_fini(&s->bands);
+
 	free(s);
 }
 
@@ -855,15 +753,12 @@ u_sink_create_format_converter(struct xrt_frame_context *xfctx,
 	default: U_LOG_E("Format '%s' not supported", u_format_str(format)); return;
 	}
 
-#ifdef USE_TABLE
-	generate_lookup_YUV_to_RGBX();
-#endif
-
 	struct u_sink_converter *s = U_TYPED_CALLOC(struct u_sink_converter);
 	s->base.push_frame = func;
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -882,10 +777,7 @@ u_sink_create_to_r8g8b8_or_l8(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
-
-#ifdef USE_TABLE
-	generate_lookup_YUV_to_RGBX();
-#endif
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -904,10 +796,7 @@ u_sink_create_to_r8g8b8_r8g8b8a8_r8g8b8x8_or_l8(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
-
-#ifdef USE_TABLE
-	generate_lookup_YUV_to_RGBX();
-#endif
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -926,6 +815,7 @@ u_sink_create_to_r8g8b8_bayer_or_l8(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -944,6 +834,7 @@ u_sink_create_to_rgb_yuv_yuyv_uyvy_or_l8(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -962,6 +853,7 @@ u_sink_create_to_yuv_yuyv_uyvy_or_l8(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
@@ -980,6 +872,7 @@ u_sink_create_to_yuv_or_yuyv(struct xrt_frame_context *xfctx,
 	s->node.break_apart = break_apart;
 	s->node.destroy = destroy;
 	s->downstream = downstream;
+	init_common(s);
 
 	xrt_frame_context_add(xfctx, &s->node);
 
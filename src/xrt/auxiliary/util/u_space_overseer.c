@@ -40,6 +40,18 @@ enum u_space_type
 	U_SPACE_TYPE_ROOT,
 };
 
+/*!
+ * A space resolved into the root space.
+ */
+struct u_space_in_root
+{
+	//! The space is the root space, or only has identity offsets to it.
+	bool identity;
+
+	//! The space in the root space, only valid if not @p identity.
+	struct xrt_space_relation relation;
+};
+
 /*!
  * Representing a single space, can be several ones. There should only be one
  * root space per overseer.
@@ -70,6 +82,48 @@ struct u_space
 			struct xrt_pose pose;
 		} offset;
 	};
+
+	/*!
+	 * Spaces never change after being created, so when there are no pose
+	 * spaces between this space and the root it is resolved once on
+	 * creation and then shared by all locate calls.
+	 */
+	bool in_root_static;
+	struct u_space_in_root in_root;
+};
+
+/*!
+ * A space resolved during a locate call.
+ */
+struct u_space_resolved
+{
+	struct u_space *space;
+
+	//! Has @p relation been queried from the device, only pose spaces.
+	bool has_relation;
+	struct xrt_space_relation relation;
+
+	bool has_in_root;
+	struct u_space_in_root in_root;
+};
+
+/*!
+ * Memoizes the spaces resolved during a single locate call, so ancestors
+ * shared by the located spaces are only resolved, and their devices only
+ * queried, once. Devices can get new poses at any time, so nothing is kept
+ * between calls.
+ */
+struct u_space_resolver
+{
+	uint64_t at_timestamp_ns;
+
+	//! Open addressing hash table, power of two sized.
+	struct u_space_resolved *entries;
+	uint32_t capacity;
+	uint32_t count;
+
+	//! Used for entries when few enough spaces are resolved.
+	struct u_space_resolved inline_entries[32];
 };
 
 /*!
@@ -157,6 +211,98 @@ find_xdev_space_read_locked(struct u_space_overseer *uso, struct xrt_device *xde
 }
 
 
+/*
+ *
+ * Resolver functions.
+ *
+ */
+
+static void
+resolver_init(struct u_space_resolver *r, uint64_t at_timestamp_ns)
+{
+	r->at_timestamp_ns = at_timestamp_ns;
+	r->entries = r->inline_entries;
+	r->capacity = ARRAY_SIZE(r->inline_entries);
+	r->count = 0;
+	U_ZERO_ARRAY(r->inline_entries);
+}
+
+static void
+resolver_fini(struct u_space_resolver *r)
+{
+	if (r->entries != r->inline_entries) {
+		free(r->entries);
+	}
+	r->entries = NULL;
+}
+
+static struct u_space_resolved *
+resolver_slot(struct u_space_resolved *entries, uint32_t capacity, struct u_space *space)
+{
+	// Fibonacci hashing, the low bits of pointers are all the same.
+	uint32_t index = (uint32_t)(((uint64_t)(uintptr_t)space * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+
+	while (entries[index].space != NULL && entries[index].space != space) {
+		index = (index + 1) & (capacity - 1);
+	}
+
+	return &entries[index];
+}
+
+static struct u_space_resolved *
+resolver_get(struct u_space_resolver *r, struct u_space *space)
+{
+	struct u_space_resolved *e = resolver_slot(r->entries, r->capacity, space);
+	if (e->space != NULL) {
+		return e;
+	}
+
+	// Keep the table at most half full, this invalidates returned entries.
+	if ((r->count + 1) * 2 > r->capacity) {
+		uint32_t capacity = r->capacity * 2;
+		struct u_space_resolved *entries = U_TYPED_ARRAY_CALLOC(struct u_space_resolved, capacity);
+
+		for (uint32_t i = 0; i < r->capacity; i++) {
+			if (r->entries[i].space != NULL) {
+				*resolver_slot(entries, capacity, r->entries[i].space) = r->entries[i];
+			}
+		}
+
+		if (r->entries != r->inline_entries) {
+			free(r->entries);
+		}
+		r->entries = entries;
+		r->capacity = capacity;
+
+		e = resolver_slot(r->entries, r->capacity, space);
+	}
+
+	e->space = space;
+	r->count++;
+
+	return e;
+}
+
+/*!
+ * Get the relation of a pose space to its parent, only asks the device once.
+ */
+static void
+resolver_get_pose_relation(struct u_space_resolver *r, struct u_space *space, struct xrt_space_relation *out_relation)
+{
+	assert(space->type == U_SPACE_TYPE_POSE);
+	assert(space->pose.xdev != NULL);
+	assert(space->pose.xname != 0);
+
+	struct u_space_resolved *e = resolver_get(r, space);
+	if (!e->has_relation) {
+		xrt_device_get_tracked_pose(space->pose.xdev, space->pose.xname, r->at_timestamp_ns, &e->relation);
+		e->has_relation = true;
+	}
+
+	*out_relation = e->relation;
+}
+
+
 /*
  *
  * Graph traversing functions.
@@ -164,94 +310,144 @@ find_xdev_space_read_locked(struct u_space_overseer *uso, struct xrt_device *xde
  */
 
 /*!
- * For each space, push the relation of that space and then traverse by calling
- * @p push_then_traverse again with the parent space. That means traverse goes
- * from a leaf space to a the root space, relations are pushed in the same
- * order.
+ * Resolve a relation of a space to its parent together with the parent in the
+ * root space, the relation is left out if it's the identity.
  */
 static void
-push_then_traverse(struct xrt_relation_chain *xrc, struct u_space *space, uint64_t at_timestamp_ns)
+in_root_from_parent(const struct xrt_space_relation *relation,
+                    const struct u_space_in_root *parent,
+                    struct u_space_in_root *out_in_root)
 {
-	switch (space->type) {
-	case U_SPACE_TYPE_NULL: break; // No-op
-	case U_SPACE_TYPE_POSE: {
-		assert(space->pose.xdev != NULL);
-		assert(space->pose.xname != 0);
+	struct xrt_relation_chain xrc = {0};
 
-		struct xrt_space_relation xsr;
-		xrt_device_get_tracked_pose(space->pose.xdev, space->pose.xname, at_timestamp_ns, &xsr);
-		m_relation_chain_push_relation(xrc, &xsr);
-	} break;
-	case U_SPACE_TYPE_OFFSET: m_relation_chain_push_pose_if_not_identity(xrc, &space->offset.pose); break;
-	case U_SPACE_TYPE_ROOT: return; // Stops the traversing.
+	if (relation != NULL) {
+		m_relation_chain_push_relation(&xrc, relation);
+	}
+	if (!parent->identity) {
+		m_relation_chain_push_relation(&xrc, &parent->relation);
 	}
 
-	// Please tail-call optimise this miss compiler.
-	assert(space->next != NULL);
-	push_then_traverse(xrc, space->next, at_timestamp_ns);
+	if (xrc.step_count == 0) {
+		out_in_root->identity = true;
+		return;
+	}
+
+	out_in_root->identity = false;
+	m_relation_chain_resolve(&xrc, &out_in_root->relation);
 }
 
 /*!
- * For each space, traverse by calling @p traverse_then_push_inverse again with
- * the parent space then push the inverse of the relation of that. That means
- * traverse goes from a leaf space to a the root space, relations are pushed in
- * the reversed order.
+ * Set the static in root of a newly created space, if there are no pose spaces
+ * between it and the root.
  */
 static void
-traverse_then_push_inverse(struct xrt_relation_chain *xrc, struct u_space *space, uint64_t at_timestamp_ns)
+space_set_in_root_static(struct u_space *us)
 {
-	// Done traversing.
-	switch (space->type) {
-	case U_SPACE_TYPE_NULL: break;
-	case U_SPACE_TYPE_POSE: break;
-	case U_SPACE_TYPE_OFFSET: break;
-	case U_SPACE_TYPE_ROOT: return; // Stops the traversing.
+	switch (us->type) {
+	case U_SPACE_TYPE_ROOT:
+		us->in_root_static = true;
+		us->in_root.identity = true;
+		break;
+	case U_SPACE_TYPE_POSE: us->in_root_static = false; break;
+	case U_SPACE_TYPE_NULL:
+		us->in_root_static = us->next->in_root_static;
+		us->in_root = us->next->in_root;
+		break;
+	case U_SPACE_TYPE_OFFSET: {
+		us->in_root_static = us->next->in_root_static;
+		if (!us->in_root_static) {
+			break;
+		}
+
+		struct xrt_space_relation relation;
+		m_space_relation_from_pose(&us->offset.pose, &relation);
+		in_root_from_parent(&relation, &us->next->in_root, &us->in_root);
+	} break;
 	}
+}
 
-	// Can't tail-call optimise this one :(
+/*!
+ * Resolve the space in the root space, going from the space towards the root
+ * until a space that has already been resolved is found.
+ *
+ * Unlike a @ref xrt_relation_chain this has no limit on the depth of the graph.
+ */
+static void
+resolve_in_root(struct u_space_resolver *r, struct u_space *space, struct u_space_in_root *out_in_root)
+{
+	if (space->in_root_static) {
+		*out_in_root = space->in_root;
+		return;
+	}
+
+	struct u_space_resolved *e = resolver_get(r, space);
+	if (e->has_in_root) {
+		*out_in_root = e->in_root;
+		return;
+	}
+
+	// Recursing may move the entries around, look it up again afterwards.
 	assert(space->next != NULL);
-	traverse_then_push_inverse(xrc, space->next, at_timestamp_ns);
+	struct u_space_in_root parent;
+	resolve_in_root(r, space->next, &parent);
 
+	struct u_space_in_root in_root;
 	switch (space->type) {
-	case U_SPACE_TYPE_NULL: break; // No-op
+	case U_SPACE_TYPE_NULL: in_root = parent; break;
 	case U_SPACE_TYPE_POSE: {
-		assert(space->pose.xdev != NULL);
-		assert(space->pose.xname != 0);
-
 		struct xrt_space_relation xsr;
-		xrt_device_get_tracked_pose(space->pose.xdev, space->pose.xname, at_timestamp_ns, &xsr);
-		m_relation_chain_push_inverted_relation(xrc, &xsr);
+		resolver_get_pose_relation(r, space, &xsr);
+		in_root_from_parent(&xsr, &parent, &in_root);
 	} break;
-	case U_SPACE_TYPE_OFFSET: m_relation_chain_push_inverted_pose_if_not_identity(xrc, &space->offset.pose); break;
-	case U_SPACE_TYPE_ROOT: assert(false); // Should not get here.
+	case U_SPACE_TYPE_OFFSET: {
+		struct xrt_space_relation xsr;
+		m_space_relation_from_pose(&space->offset.pose, &xsr);
+		in_root_from_parent(&xsr, &parent, &in_root);
+	} break;
+	case U_SPACE_TYPE_ROOT:
+	default: assert(false); return; // Always static.
 	}
+
+	e = resolver_get(r, space);
+	e->in_root = in_root;
+	e->has_in_root = true;
+
+	*out_in_root = in_root;
 }
 
+/*!
+ * Push the target space resolved into the root space.
+ */
 static void
-build_relation_chain_read_locked(struct u_space_overseer *uso,
-                                 struct xrt_relation_chain *xrc,
-                                 struct u_space *base,
-                                 struct u_space *target,
-                                 uint64_t at_timestamp_ns)
+push_target_read_locked(struct u_space_resolver *r, struct xrt_relation_chain *xrc, struct u_space *target)
 {
 	assert(xrc != NULL);
-	assert(base != NULL);
 	assert(target != NULL);
 
-	push_then_traverse(xrc, target, at_timestamp_ns);
-	traverse_then_push_inverse(xrc, base, at_timestamp_ns);
+	struct u_space_in_root in_root;
+	resolve_in_root(r, target, &in_root);
+
+	if (!in_root.identity) {
+		m_relation_chain_push_relation(xrc, &in_root.relation);
+	}
 }
 
+/*!
+ * Push the inverse of the base space resolved into the root space, taking the
+ * chain from the root space into the base space.
+ */
 static void
-build_relation_chain(struct u_space_overseer *uso,
-                     struct xrt_relation_chain *xrc,
-                     struct u_space *base,
-                     struct u_space *target,
-                     uint64_t at_timestamp_ns)
+push_inverted_base_read_locked(struct u_space_resolver *r, struct xrt_relation_chain *xrc, struct u_space *base)
 {
-	pthread_rwlock_rdlock(&uso->lock);
-	build_relation_chain_read_locked(uso, xrc, base, target, at_timestamp_ns);
-	pthread_rwlock_unlock(&uso->lock);
+	assert(xrc != NULL);
+	assert(base != NULL);
+
+	struct u_space_in_root in_root;
+	resolve_in_root(r, base, &in_root);
+
+	if (!in_root.identity) {
+		m_relation_chain_push_inverted_relation(xrc, &in_root.relation);
+	}
 }
 
 static inline void
@@ -304,6 +500,11 @@ create_space(enum u_space_type type, struct u_space *parent)
 
 	u_space_reference(&us->next, parent);
 
+	// Offset spaces need to set the pose first.
+	if (type != U_SPACE_TYPE_OFFSET) {
+		space_set_in_root_static(us);
+	}
+
 	return us;
 }
 
@@ -342,6 +543,7 @@ create_offset_space(struct xrt_space_overseer *xso,
 	} else {
 		us = create_space(U_SPACE_TYPE_OFFSET, uparent);
 		us->offset.pose = *offset;
+		space_set_in_root_static(us);
 	}
 
 	// Created with one references.
@@ -380,31 +582,57 @@ create_pose_space(struct xrt_space_overseer *xso,
 }
 
 static xrt_result_t
-locate_space(struct xrt_space_overseer *xso,
-             struct xrt_space *base_space,
-             const struct xrt_pose *base_offset,
-             uint64_t at_timestamp_ns,
-             struct xrt_space *space,
-             const struct xrt_pose *offset,
-             struct xrt_space_relation *out_relation)
+locate_spaces(struct xrt_space_overseer *xso,
+              struct xrt_space *base_space,
+              const struct xrt_pose *base_offset,
+              uint64_t at_timestamp_ns,
+              struct xrt_space **spaces,
+              const struct xrt_pose *offsets,
+              uint32_t space_count,
+              struct xrt_space_relation *out_relations)
 {
 	struct u_space_overseer *uso = u_space_overseer(xso);
 
 	struct u_space *ubase_space = u_space(base_space);
-	struct u_space *uspace = u_space(space);
 
-	struct xrt_relation_chain xrc = {0};
+	struct u_space_resolver r;
+	resolver_init(&r, at_timestamp_ns);
 
-	m_relation_chain_push_pose_if_not_identity(&xrc, offset);
-	build_relation_chain(uso, &xrc, ubase_space, uspace, at_timestamp_ns);
-	m_relation_chain_push_inverted_pose_if_not_identity(&xrc, base_offset);
+	// Only need the read lock.
+	pthread_rwlock_rdlock(&uso->lock);
 
-	// For base_space =~= space (approx equals).
-	special_resolve(&xrc, out_relation);
+	for (uint32_t i = 0; i < space_count; i++) {
+		struct xrt_relation_chain xrc = {0};
+
+		m_relation_chain_push_pose_if_not_identity(&xrc, &offsets[i]);
+		push_target_read_locked(&r, &xrc, u_space(spaces[i]));
+		push_inverted_base_read_locked(&r, &xrc, ubase_space);
+		m_relation_chain_push_inverted_pose_if_not_identity(&xrc, base_offset);
+
+		// For base_space =~= space (approx equals).
+		special_resolve(&xrc, &out_relations[i]);
+	}
+
+	// Safe to unlock now.
+	pthread_rwlock_unlock(&uso->lock);
+
+	resolver_fini(&r);
 
 	return XRT_SUCCESS;
 }
 
+static xrt_result_t
+locate_space(struct xrt_space_overseer *xso,
+             struct xrt_space *base_space,
+             const struct xrt_pose *base_offset,
+             uint64_t at_timestamp_ns,
+             struct xrt_space *space,
+             const struct xrt_pose *offset,
+             struct xrt_space_relation *out_relation)
+{
+	return locate_spaces(xso, base_space, base_offset, at_timestamp_ns, &space, offset, 1, out_relation);
+}
+
 static xrt_result_t
 locate_device(struct xrt_space_overseer *xso,
               struct xrt_space *base_space,
@@ -417,17 +645,23 @@ locate_device(struct xrt_space_overseer *xso,
 
 	struct u_space *ubase_space = u_space(base_space);
 
+	struct u_space_resolver r;
+	resolver_init(&r, at_timestamp_ns);
+
 	struct xrt_relation_chain xrc = {0};
 
 	// Only need the read lock.
 	pthread_rwlock_rdlock(&uso->lock);
 
 	struct u_space *uspace = find_xdev_space_read_locked(uso, xdev);
-	build_relation_chain_read_locked(uso, &xrc, ubase_space, uspace, at_timestamp_ns);
+	push_target_read_locked(&r, &xrc, uspace);
+	push_inverted_base_read_locked(&r, &xrc, ubase_space);
 
 	// Safe to unlock now.
 	pthread_rwlock_unlock(&uso->lock);
 
+	resolver_fini(&r);
+
 	// Do as much work outside of the lock.
 	m_relation_chain_push_inverted_pose_if_not_identity(&xrc, base_offset);
 	special_resolve(&xrc, out_relation);
@@ -469,6 +703,7 @@ u_space_overseer_create(void)
 	uso->base.create_offset_space = create_offset_space;
 	uso->base.create_pose_space = create_pose_space;
 	uso->base.locate_space = locate_space;
+	uso->base.locate_spaces = locate_spaces;
 	uso->base.locate_device = locate_device;
 	uso->base.destroy = destroy;
 
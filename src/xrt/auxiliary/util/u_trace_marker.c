@@ -41,6 +41,9 @@ PERCETTO_TRACK_DEFINE(pc_present, PERCETTO_TRACK_EVENTS);
 PERCETTO_TRACK_DEFINE(pa_cpu, PERCETTO_TRACK_EVENTS);
 PERCETTO_TRACK_DEFINE(pa_draw, PERCETTO_TRACK_EVENTS);
 PERCETTO_TRACK_DEFINE(pa_wait, PERCETTO_TRACK_EVENTS);
+PERCETTO_TRACK_DEFINE(ql_encode, PERCETTO_TRACK_EVENTS);
+PERCETTO_TRACK_DEFINE(ql_queue, PERCETTO_TRACK_EVENTS);
+PERCETTO_TRACK_DEFINE(ql_tx, PERCETTO_TRACK_EVENTS);
 
 #if defined(__GNUC__)
 #pragma GCC diagnostic pop
@@ -66,6 +69,10 @@ u_trace_marker_setup(enum u_trace_which which)
 	I_PERCETTO_TRACK_PTR(pa_cpu)->name = "PA 1 App";
 	I_PERCETTO_TRACK_PTR(pa_draw)->name = "PA 2 Draw";
 	I_PERCETTO_TRACK_PTR(pa_wait)->name = "PA 3 Wait";
+
+	I_PERCETTO_TRACK_PTR(ql_encode)->name = "QL 1 Encode";
+	I_PERCETTO_TRACK_PTR(ql_queue)->name = "QL 2 Queue";
+	I_PERCETTO_TRACK_PTR(ql_tx)->name = "QL 3 Transmit";
 }
 
 void
@@ -97,6 +104,10 @@ u_trace_marker_init(void)
 		PERCETTO_REGISTER_TRACK(pa_cpu);
 		PERCETTO_REGISTER_TRACK(pa_draw);
 		PERCETTO_REGISTER_TRACK(pa_wait);
+
+		PERCETTO_REGISTER_TRACK(ql_encode);
+		PERCETTO_REGISTER_TRACK(ql_queue);
+		PERCETTO_REGISTER_TRACK(ql_tx);
 	}
 }
 
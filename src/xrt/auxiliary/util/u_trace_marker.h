@@ -345,6 +345,9 @@ PERCETTO_TRACK_DECLARE(pc_present);
 PERCETTO_TRACK_DECLARE(pa_cpu);
 PERCETTO_TRACK_DECLARE(pa_draw);
 PERCETTO_TRACK_DECLARE(pa_wait);
+PERCETTO_TRACK_DECLARE(ql_encode);
+PERCETTO_TRACK_DECLARE(ql_queue);
+PERCETTO_TRACK_DECLARE(ql_tx);
 
 #define U_TRACE_FUNC(CATEGORY) TRACE_EVENT(CATEGORY, __func__)
 #define U_TRACE_IDENT(CATEGORY, IDENT) TRACE_EVENT(CATEGORY, #IDENT)
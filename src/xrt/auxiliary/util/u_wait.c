@@ -0,0 +1,221 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Hybrid sleep and spin waiting.
+ * @ingroup aux_util
+ */
+
+#include "util/u_misc.h"
+#include "util/u_wait.h"
+
+#ifdef XRT_OS_WINDOWS
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+
+/*!
+ * Margin to start with, before having been calibrated.
+ */
+#define INITIAL_MARGIN_NS (2 * U_WAIT_MEASURED_SCHEDULER_LATENCY_NS + 50 * 1000)
+
+/*!
+ * Hard limit on the margin, and so on how long a wait spins, whatever
+ * @ref u_wait_hybrid::max_margin_ns is set to.
+ */
+#define MAX_MARGIN_NS (200 * 1000)
+
+/*!
+ * Added to how late a sleep woke up to get the wanted margin.
+ */
+#define MARGIN_SLACK_NS (20 * 1000)
+
+/*!
+ * Grow the margin by 1 / 2^MARGIN_GROW_SHIFT of the difference when a sleep
+ * wakes up later than it covers, quickly but without one outlier pinning it.
+ */
+#define MARGIN_GROW_SHIFT 2
+
+/*!
+ * Shrink the margin by 1 / 2^MARGIN_DECAY_SHIFT of the difference each wait.
+ */
+#define MARGIN_DECAY_SHIFT 4
+
+/*!
+ * Give up the core this often while spinning.
+ */
+#define SPIN_YIELD_NS (20 * 1000)
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+/*!
+ * Lets other threads on this core run, a SCHED_FIFO or SCHED_RR thread that
+ * only spun would starve them, including whatever it is waiting for.
+ */
+static void
+spin_yield(void)
+{
+#ifdef XRT_OS_WINDOWS
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+static uint32_t
+error_to_bin(int64_t error_ns)
+{
+	uint64_t us = error_ns > 0 ? (uint64_t)error_ns / 1000 : 0;
+
+	uint32_t bin = 0;
+	while (us > 0 && bin < U_WAIT_HYBRID_BIN_COUNT - 1) {
+		us >>= 1;
+		bin++;
+	}
+
+	return bin;
+}
+
+static void
+record(struct u_wait_hybrid *uwh, int64_t error_ns)
+{
+	uint32_t bin = error_to_bin(error_ns);
+
+	uwh->stats.count++;
+	uwh->stats.last_error_ns = error_ns;
+	if (error_ns > uwh->stats.max_error_ns) {
+		uwh->stats.max_error_ns = error_ns;
+	}
+	uwh->stats.bins[bin]++;
+	uwh->stats.bins_f32[bin] = (float)uwh->stats.bins[bin];
+}
+
+static void
+calibrate(struct u_wait_hybrid *uwh, int64_t oversleep_ns)
+{
+	uint64_t wanted_ns = (oversleep_ns > 0 ? (uint64_t)oversleep_ns : 0) + MARGIN_SLACK_NS;
+
+	if (wanted_ns > uwh->margin_ns) {
+		uwh->margin_ns += (wanted_ns - uwh->margin_ns) >> MARGIN_GROW_SHIFT;
+	} else {
+		uwh->margin_ns -= (uwh->margin_ns - wanted_ns) >> MARGIN_DECAY_SHIFT;
+	}
+
+	uint64_t max_margin_ns = uwh->max_margin_ns < MAX_MARGIN_NS ? uwh->max_margin_ns : MAX_MARGIN_NS;
+	if (uwh->margin_ns > max_margin_ns) {
+		uwh->margin_ns = max_margin_ns;
+	}
+	if (uwh->margin_ns < uwh->min_margin_ns) {
+		uwh->margin_ns = uwh->min_margin_ns;
+	}
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+void
+u_wait_hybrid_init(struct u_wait_hybrid *uwh)
+{
+	U_ZERO(uwh);
+
+	os_precise_sleeper_init(&uwh->sleeper);
+
+	uwh->spin = false;
+	uwh->margin_ns = INITIAL_MARGIN_NS;
+	uwh->min_margin_ns = MARGIN_SLACK_NS;
+	uwh->max_margin_ns = MAX_MARGIN_NS;
+
+	uwh->stats.histogram.values = uwh->stats.bins_f32;
+	uwh->stats.histogram.count = U_WAIT_HYBRID_BIN_COUNT;
+}
+
+void
+u_wait_hybrid_fini(struct u_wait_hybrid *uwh)
+{
+	os_precise_sleeper_deinit(&uwh->sleeper);
+}
+
+void
+u_wait_hybrid_add_vars(struct u_wait_hybrid *uwh, void *root, const char *name)
+{
+	u_var_add_gui_header_begin(root, NULL, name);
+	u_var_add_bool(root, &uwh->spin, "Spin before deadline");
+	u_var_add_ro_u64(root, &uwh->margin_ns, "Spin margin (ns)");
+	u_var_add_u64(root, &uwh->max_margin_ns, "Max spin margin (ns)");
+	u_var_add_ro_u64(root, &uwh->stats.count, "Waits");
+	u_var_add_ro_u64(root, &uwh->stats.missed_count, "Skipped, less than 1ms away");
+	u_var_add_ro_i64(root, &uwh->stats.last_error_ns, "Woke up late (ns)");
+	u_var_add_ro_i64(root, &uwh->stats.max_error_ns, "Woke up latest (ns)");
+	u_var_add_ro_i64(root, &uwh->stats.last_oversleep_ns, "Sleep woke up late (ns)");
+	u_var_add_ro_i64(root, &uwh->stats.last_spin_ns, "Spun for (ns)");
+	u_var_add_histogram_f32(root, &uwh->stats.histogram, "Woke up late (log2 us)");
+	u_var_add_gui_header_end(root, NULL, name);
+}
+
+int64_t
+u_wait_hybrid_until(struct u_wait_hybrid *uwh, uint64_t until_ns)
+{
+	uint64_t now_ns = os_monotonic_get_ns();
+
+	// Like u_wait_until, not worth waiting for when this close or in the past.
+	if (time_is_less_then_or_within_range(until_ns, now_ns, U_TIME_1MS_IN_NS)) {
+		uwh->stats.missed_count++;
+		record(uwh, 0);
+		return 0;
+	}
+
+	// Like u_wait_until, wakes up a bit early rather than late.
+	if (!uwh->spin) {
+		os_precise_sleeper_sleep_until(&uwh->sleeper, until_ns - U_WAIT_MEASURED_SCHEDULER_LATENCY_NS);
+		now_ns = os_monotonic_get_ns();
+
+		int64_t error_ns = (int64_t)(now_ns - until_ns);
+		uwh->stats.last_oversleep_ns = error_ns;
+		uwh->stats.last_spin_ns = 0;
+		record(uwh, error_ns);
+		return error_ns;
+	}
+
+	// Far enough away to sleep first.
+	if (until_ns - now_ns > uwh->margin_ns) {
+		uint64_t sleep_until_ns = until_ns - uwh->margin_ns;
+
+		os_precise_sleeper_sleep_until(&uwh->sleeper, sleep_until_ns);
+		now_ns = os_monotonic_get_ns();
+
+		int64_t oversleep_ns = (int64_t)(now_ns - sleep_until_ns);
+		uwh->stats.last_oversleep_ns = oversleep_ns;
+		calibrate(uwh, oversleep_ns);
+	}
+
+	// At most the margin, so never longer than MAX_MARGIN_NS.
+	uint64_t spin_start_ns = now_ns;
+	uint64_t yield_ns = now_ns + SPIN_YIELD_NS;
+	while (now_ns < until_ns) {
+		os_cpu_relax();
+		now_ns = os_monotonic_get_ns();
+
+		if (now_ns >= yield_ns) {
+			spin_yield();
+			now_ns = os_monotonic_get_ns();
+			yield_ns = now_ns + SPIN_YIELD_NS;
+		}
+	}
+
+	int64_t error_ns = (int64_t)(now_ns - until_ns);
+	uwh->stats.last_spin_ns = (int64_t)(now_ns - spin_start_ns);
+	record(uwh, error_ns);
+
+	return error_ns;
+}
@@ -11,6 +11,11 @@
 
 #include "xrt/xrt_config_os.h"
 #include "os/os_time.h"
+#include "util/u_var.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #if defined(XRT_DOXYGEN)
 
@@ -53,3 +58,116 @@ u_wait_until(struct os_precise_sleeper *sleeper, uint64_t until_ns)
 	uint32_t delay = (uint32_t)(until_ns - now_ns - U_WAIT_MEASURED_SCHEDULER_LATENCY_NS);
 	os_precise_sleeper_nanosleep(sleeper, delay);
 }
+
+
+/*
+ *
+ * Hybrid waiter.
+ *
+ */
+
+/*!
+ * Number of bins in the wake up error histogram of @ref u_wait_hybrid, bin 0
+ * is less than 1us late, bin n is less than 2^n us late and the last bin has
+ * everything later than that.
+ *
+ * @ingroup aux_util
+ */
+#define U_WAIT_HYBRID_BIN_COUNT 16
+
+/*!
+ * Waits until a deadline by sleeping until a margin before it, then spinning
+ * the rest of the way. The margin is calibrated from how late the sleeps wake
+ * up, it grows straight away when they are late and slowly shrinks back.
+ *
+ * Spinning is off by default, the margin is at most 200us and the spin yields
+ * every 20us so it is safe on a realtime thread. Without it the wait sleeps
+ * until U_WAIT_MEASURED_SCHEDULER_LATENCY_NS before the deadline. Deadlines
+ * less than 1ms away are skipped like @ref u_wait_until does.
+ *
+ * Keeps statistics of how late the waits wake up, one of these should be used
+ * per call site so they can be told apart.
+ *
+ * @ingroup aux_util
+ */
+struct u_wait_hybrid
+{
+	struct os_precise_sleeper sleeper;
+
+	//! Spin the last part of the wait, else only sleep.
+	bool spin;
+
+	//! Current margin before the deadline to spin for.
+	uint64_t margin_ns;
+
+	//! Limits of the calibrated margin.
+	uint64_t min_margin_ns;
+	uint64_t max_margin_ns;
+
+	struct
+	{
+		//! Number of waits, including missed ones.
+		uint64_t count;
+
+		//! Waits skipped as the deadline was less than 1ms away or had passed.
+		uint64_t missed_count;
+
+		//! How late the last wait woke up.
+		int64_t last_error_ns;
+
+		//! How late the latest wait so far woke up.
+		int64_t max_error_ns;
+
+		//! How late the last sleep woke up, before spinning.
+		int64_t last_oversleep_ns;
+
+		//! How long the last wait spun for.
+		int64_t last_spin_ns;
+
+		uint64_t bins[U_WAIT_HYBRID_BIN_COUNT];
+
+		//! Copy of @p bins for the histogram widget.
+		float bins_f32[U_WAIT_HYBRID_BIN_COUNT];
+		struct u_var_histogram_f32 histogram;
+	} stats;
+};
+
+/*!
+ * Initialize members of @ref u_wait_hybrid.
+ *
+ * @public @memberof u_wait_hybrid
+ */
+void
+u_wait_hybrid_init(struct u_wait_hybrid *uwh);
+
+/*!
+ * De-initialize members of @ref u_wait_hybrid, does not free it.
+ *
+ * @public @memberof u_wait_hybrid
+ */
+void
+u_wait_hybrid_fini(struct u_wait_hybrid *uwh);
+
+/*!
+ * Add the controls and statistics to a @ref u_var root, the waiter must
+ * outlive the root.
+ *
+ * @public @memberof u_wait_hybrid
+ */
+void
+u_wait_hybrid_add_vars(struct u_wait_hybrid *uwh, void *root, const char *name);
+
+/*!
+ * Wait until the given @ref os_monotonic_get_ns time.
+ *
+ * @return How late it woke up in nanoseconds, negative if early when only
+ *         sleeping, zero if the wait was skipped.
+ * @public @memberof u_wait_hybrid
+ */
+int64_t
+u_wait_hybrid_until(struct u_wait_hybrid *uwh, uint64_t until_ns);
+
+
+#ifdef __cplusplus
+}
+#endif
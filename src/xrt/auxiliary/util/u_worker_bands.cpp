@@ -0,0 +1,167 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Splits the rows of a frame into bands run on a shared thread pool.
+ * @ingroup aux_util
+ */
+
+#include "util/u_worker.h"
+#include "util/u_worker_bands.h"
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+
+/*
+ *
+ * Structs and defines.
+ *
+ */
+
+namespace {
+
+/*!
+ * The pool shared by all @ref u_worker_bands, only exists while any of them
+ * have a group on it.
+ */
+struct shared_pool
+{
+	std::mutex mutex;
+
+	//! Protected by mutex.
+	struct u_worker_thread_pool *pool = nullptr;
+
+	//! Instances with a group on the pool, protected by mutex.
+	uint32_t users = 0;
+};
+
+/*!
+ * A band of rows, handed to a worker.
+ */
+struct band
+{
+	u_worker_bands_func_t func;
+	void *ptr;
+	uint32_t y;
+	uint32_t h;
+};
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+shared_pool &
+get_shared_pool()
+{
+	static shared_pool sp;
+	return sp;
+}
+
+void
+acquire_group(struct u_worker_bands *uwb)
+{
+	shared_pool &sp = get_shared_pool();
+	std::unique_lock<std::mutex> lock(sp.mutex);
+
+	if (sp.pool == nullptr) {
+		// One worker per core besides the calling thread, plus one for the thread waiting on a group.
+		uint32_t cores = std::max(2u, std::thread::hardware_concurrency());
+		uint32_t workers = std::min(cores - 1, (uint32_t)U_WORKER_BANDS_MAX - 1);
+		sp.pool = u_worker_thread_pool_create(workers, workers + 1, "Bands");
+		if (sp.pool == nullptr) {
+			return;
+		}
+	}
+
+	uwb->group = u_worker_group_create(sp.pool);
+	sp.users++;
+}
+
+void
+release_group(struct u_worker_bands *uwb)
+{
+	shared_pool &sp = get_shared_pool();
+	std::unique_lock<std::mutex> lock(sp.mutex);
+
+	u_worker_group_reference(&uwb->group, nullptr);
+
+	// The last one out stops the threads.
+	if (--sp.users == 0) {
+		u_worker_thread_pool_reference(&sp.pool, nullptr);
+	}
+}
+
+void
+run_band(void *ptr)
+{
+	struct band *b = (struct band *)ptr;
+
+	b->func(b->ptr, b->y, b->h);
+}
+
+} // namespace
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+extern "C" void
+u_worker_bands_init(struct u_worker_bands *uwb, long band_count)
+{
+	uwb->band_count = (uint32_t)std::clamp(band_count, 1l, (long)U_WORKER_BANDS_MAX);
+	uwb->group = nullptr;
+}
+
+extern "C" void
+u_worker_bands_fini(struct u_worker_bands *uwb)
+{
+	if (uwb->group != nullptr) {
+		release_group(uwb);
+	}
+}
+
+extern "C" void
+u_worker_bands_run(struct u_worker_bands *uwb, uint32_t h, u_worker_bands_func_t func, void *ptr)
+{
+	uint32_t band_count = std::min(uwb->band_count, h / U_WORKER_BANDS_MIN_ROWS);
+
+	// Only start the threads once there is a frame that needs them.
+	if (band_count > 1 && uwb->group == nullptr) {
+		acquire_group(uwb);
+	}
+
+	if (band_count <= 1 || uwb->group == nullptr) {
+		func(ptr, 0, h);
+		return;
+	}
+
+	struct band bands[U_WORKER_BANDS_MAX];
+	uint32_t rows_per_band = h / band_count;
+
+	for (uint32_t i = 0; i < band_count; i++) {
+		uint32_t y = i * rows_per_band;
+
+		bands[i].func = func;
+		bands[i].ptr = ptr;
+		bands[i].y = y;
+		// The last band picks up the left over rows.
+		bands[i].h = i + 1 == band_count ? h - y : rows_per_band;
+	}
+
+	for (uint32_t i = 1; i < band_count; i++) {
+		u_worker_group_push(uwb->group, run_band, &bands[i]);
+	}
+
+	// This thread does the first band while the workers do the rest.
+	run_band(&bands[0]);
+
+	u_worker_group_wait_all(uwb->group);
+}
@@ -0,0 +1,89 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Splits the rows of a frame into bands run on a shared thread pool.
+ * @ingroup aux_util
+ */
+
+#pragma once
+
+#include "xrt/xrt_defines.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct u_worker_group;
+
+/*!
+ * Bands smaller than this cost more to hand out than they save.
+ *
+ * @ingroup aux_util
+ */
+#define U_WORKER_BANDS_MIN_ROWS 64
+
+/*!
+ * Most bands a frame is split into.
+ *
+ * @ingroup aux_util
+ */
+#define U_WORKER_BANDS_MAX 16
+
+/*!
+ * Processes the @p h rows starting at row @p y, each band only touches its
+ * own rows.
+ *
+ * @ingroup aux_util
+ */
+typedef void (*u_worker_bands_func_t)(void *ptr, uint32_t y, uint32_t h);
+
+/*!
+ * Runs functions over the rows of frames split into bands, one per thread.
+ * All instances share one thread pool, created by the first frame that is big
+ * enough to be split and destroyed with the last instance using it.
+ *
+ * @ingroup aux_util
+ */
+struct u_worker_bands
+{
+	//! Number of bands big frames are split into.
+	uint32_t band_count;
+
+	//! On the shared pool, created on the first frame that needs it.
+	struct u_worker_group *group;
+};
+
+/*!
+ * Initialize members of @ref u_worker_bands, @p band_count is clamped to
+ * between one and @ref U_WORKER_BANDS_MAX, usually comes from an option.
+ *
+ * @public @memberof u_worker_bands
+ */
+void
+u_worker_bands_init(struct u_worker_bands *uwb, long band_count);
+
+/*!
+ * De-initialize members of @ref u_worker_bands, does not free it. Must not be
+ * called while @ref u_worker_bands_run is running.
+ *
+ * @public @memberof u_worker_bands
+ */
+void
+u_worker_bands_fini(struct u_worker_bands *uwb);
+
+/*!
+ * Calls @p func over @p h rows, split into bands of at least
+ * @ref U_WORKER_BANDS_MIN_ROWS rows. The calling thread does the first band
+ * while the pool does the rest, and it returns once all of them are done.
+ *
+ * @public @memberof u_worker_bands
+ */
+void
+u_worker_bands_run(struct u_worker_bands *uwb, uint32_t h, u_worker_bands_func_t func, void *ptr);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -28,6 +28,7 @@ DEBUG_GET_ONCE_BOOL_OPTION(xcb_fullscreen, "XRT_COMPOSITOR_XCB_FULLSCREEN", fals
 DEBUG_GET_ONCE_NUM_OPTION(xcb_display, "XRT_COMPOSITOR_XCB_DISPLAY", -1)
 DEBUG_GET_ONCE_NUM_OPTION(default_framerate, "XRT_COMPOSITOR_DEFAULT_FRAMERATE", 60)
 DEBUG_GET_ONCE_BOOL_OPTION(compute, "XRT_COMPOSITOR_COMPUTE", false)
+DEBUG_GET_ONCE_NUM_OPTION(pacing_percentile, "XRT_COMPOSITOR_PACING_PERCENTILE", 0)
 // clang-format on
 
 void
@@ -75,6 +76,7 @@ comp_settings_init(struct comp_settings *s, struct xrt_device *xdev)
 	s->preferred.width = xdev->hmd->screens[0].w_pixels;
 	s->preferred.height = xdev->hmd->screens[0].h_pixels;
 	s->nominal_frame_interval_ns = interval_ns;
+	s->pacing_percentile = (uint32_t)debug_get_num_option_pacing_percentile();
 	s->log_level = debug_get_log_option_log();
 	s->print_modes = debug_get_bool_option_print_modes();
 	s->selected_gpu_index = debug_get_num_option_force_gpu_index();
@@ -84,6 +84,9 @@ struct comp_settings
 	//! Nominal frame interval
 	uint64_t nominal_frame_interval_ns;
 
+	//! Budget for this percentile of frame times in per mille, zero for the stepping display timing pacing.
+	uint32_t pacing_percentile;
+
 	//! Vulkan physical device selected by comp_settings_check_vulkan_caps
 	//! may be forced by user
 	int selected_gpu_index;
@@ -632,7 +632,12 @@ comp_target_swapchain_create_images(struct comp_target *ct,
 	uint64_t now_ns = os_monotonic_get_ns();
 	// Some platforms really don't like the pacing_compositor code.
 	bool use_display_timing_if_available = cts->timing_usage == COMP_TARGET_USE_DISPLAY_IF_AVAILABLE;
-	if (cts->upc == NULL && use_display_timing_if_available && vk->has_GOOGLE_display_timing) {
+	if (cts->upc == NULL && use_display_timing_if_available && vk->has_GOOGLE_display_timing &&
+	    ct->c->settings.pacing_percentile > 0) {
+		struct u_pc_percentile_config config = U_PC_PERCENTILE_CONFIG_DEFAULT;
+		config.percentile_per_mille = ct->c->settings.pacing_percentile;
+		u_pc_percentile_create(ct->c->settings.nominal_frame_interval_ns, &config, &cts->upc);
+	} else if (cts->upc == NULL && use_display_timing_if_available && vk->has_GOOGLE_display_timing) {
 		u_pc_display_timing_create(ct->c->settings.nominal_frame_interval_ns,
 		                           &U_PC_DISPLAY_TIMING_CONFIG_DEFAULT, &cts->upc);
 	} else if (cts->upc == NULL) {
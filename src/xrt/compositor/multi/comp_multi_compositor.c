@@ -63,7 +63,8 @@ slot_clear_locked(struct multi_compositor *mc, struct multi_layer_slot *slot)
 }
 
 /*!
- * Clear a slot, need to have the list_and_timing_lock held.
+ * Move a slot into a cleared slot, doesn't touch the pacer so doesn't need the
+ * list_and_timing_lock held.
  */
 static void
 slot_move_into_cleared(struct multi_layer_slot *dst, struct multi_layer_slot *src)
@@ -259,6 +260,17 @@ wait_for_scheduled_free(struct multi_compositor *mc)
 		os_mutex_lock(&mc->slot_lock);
 	}
 
+	/*
+	 * Common case, the scheduled slot is free so there is no frame to
+	 * retire and the pacer isn't touched. Publish the frame without
+	 * contending with the main thread on the list_and_timing_lock.
+	 */
+	if (!v_mc->scheduled.active) {
+		slot_move_into_cleared(&mc->scheduled, &mc->progress);
+		os_mutex_unlock(&mc->slot_lock);
+		return;
+	}
+
 	os_mutex_unlock(&mc->slot_lock);
 
 	/*
@@ -1014,6 +1026,11 @@ multi_compositor_create(struct multi_system_compositor *msc,
 	os_mutex_init(&mc->slot_lock);
 	os_thread_helper_init(&mc->wait_thread.oth);
 
+	// Slots start out cleared.
+	mc->progress.data.frame_id = -1;
+	mc->scheduled.data.frame_id = -1;
+	mc->delivered.data.frame_id = -1;
+
 	// Passthrough our formats from the native compositor to the client.
 	mc->base.base.info = msc->xcn->base.info;
 
@@ -16,6 +16,8 @@
 #include "os/os_time.h"
 #include "os/os_threading.h"
 
+#include "util/u_var.h"
+#include "util/u_wait.h"
 #include "util/u_pacing.h"
 
 #ifdef __cplusplus
@@ -25,6 +27,7 @@ extern "C" {
 
 #define MULTI_MAX_CLIENTS 64
 #define MULTI_MAX_LAYERS 16
+#define MULTI_LOCK_HOLD_TIMES 50
 
 
 /*
@@ -343,6 +346,36 @@ struct multi_system_compositor
 	} last_timings;
 
 	struct multi_compositor *clients[MULTI_MAX_CLIENTS];
+
+	/*!
+	 * Layers of the latched frames copied out of the clients, holding a
+	 * reference to the swapchains. Only touched by the main thread, lets it
+	 * submit layers to the native compositor without any lock held.
+	 */
+	struct
+	{
+		uint32_t layer_count;
+		struct multi_layer_entry layers[MULTI_MAX_CLIENTS * MULTI_MAX_LAYERS];
+	} staged;
+
+	//! How long the main thread held list_and_timing_lock to latch frames.
+	struct
+	{
+		//! Current index for hold_ms.
+		int index;
+
+		//! Hold times of the last frames.
+		float hold_ms[MULTI_LOCK_HOLD_TIMES];
+
+		//! The last hold time and number of clients latched with it.
+		uint64_t last_hold_ns;
+		uint32_t last_latched_count;
+
+		struct u_var_timing timing;
+	} lock_metrics;
+
+	//! Used by the main thread to wait for the wake up time of frames.
+	struct u_wait_hybrid wake_waiter;
 };
 
 /*!
@@ -41,6 +41,9 @@
 #endif
 
 
+DEBUG_GET_ONCE_BOOL_OPTION(spin_wait, "XRT_COMPOSITOR_SPIN_WAIT", false)
+
+
 /*
  *
  * Render thread.
@@ -48,7 +51,7 @@
  */
 
 static void
-do_projection_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_projection_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = layer->xdev;
 	struct xrt_swapchain *l_xcs = layer->xscs[0];
@@ -71,10 +74,7 @@ do_projection_layer(struct xrt_compositor *xc, struct multi_compositor *mc, stru
 }
 
 static void
-do_projection_layer_depth(struct xrt_compositor *xc,
-                          struct multi_compositor *mc,
-                          struct multi_layer_entry *layer,
-                          uint32_t i)
+do_projection_layer_depth(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = layer->xdev;
 	struct xrt_swapchain *l_xcs = layer->xscs[0];
@@ -100,7 +100,6 @@ do_projection_layer_depth(struct xrt_compositor *xc,
 
 static bool
 do_single(struct xrt_compositor *xc,
-          struct multi_compositor *mc,
           struct multi_layer_entry *layer,
           uint32_t i,
           const char *name,
@@ -132,13 +131,13 @@ do_single(struct xrt_compositor *xc,
 }
 
 static void
-do_quad_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_quad_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = NULL;
 	struct xrt_swapchain *xcs = NULL;
 	struct xrt_layer_data *data = NULL;
 
-	if (!do_single(xc, mc, layer, i, "quad", &xdev, &xcs, &data)) {
+	if (!do_single(xc, layer, i, "quad", &xdev, &xcs, &data)) {
 		return;
 	}
 
@@ -146,13 +145,13 @@ do_quad_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct mul
 }
 
 static void
-do_cube_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_cube_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = NULL;
 	struct xrt_swapchain *xcs = NULL;
 	struct xrt_layer_data *data = NULL;
 
-	if (!do_single(xc, mc, layer, i, "cube", &xdev, &xcs, &data)) {
+	if (!do_single(xc, layer, i, "cube", &xdev, &xcs, &data)) {
 		return;
 	}
 
@@ -160,13 +159,13 @@ do_cube_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct mul
 }
 
 static void
-do_cylinder_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_cylinder_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = NULL;
 	struct xrt_swapchain *xcs = NULL;
 	struct xrt_layer_data *data = NULL;
 
-	if (!do_single(xc, mc, layer, i, "cylinder", &xdev, &xcs, &data)) {
+	if (!do_single(xc, layer, i, "cylinder", &xdev, &xcs, &data)) {
 		return;
 	}
 
@@ -174,13 +173,13 @@ do_cylinder_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct
 }
 
 static void
-do_equirect1_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_equirect1_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = NULL;
 	struct xrt_swapchain *xcs = NULL;
 	struct xrt_layer_data *data = NULL;
 
-	if (!do_single(xc, mc, layer, i, "equirect1", &xdev, &xcs, &data)) {
+	if (!do_single(xc, layer, i, "equirect1", &xdev, &xcs, &data)) {
 		return;
 	}
 
@@ -188,13 +187,13 @@ do_equirect1_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struc
 }
 
 static void
-do_equirect2_layer(struct xrt_compositor *xc, struct multi_compositor *mc, struct multi_layer_entry *layer, uint32_t i)
+do_equirect2_layer(struct xrt_compositor *xc, struct multi_layer_entry *layer, uint32_t i)
 {
 	struct xrt_device *xdev = NULL;
 	struct xrt_swapchain *xcs = NULL;
 	struct xrt_layer_data *data = NULL;
 
-	if (!do_single(xc, mc, layer, i, "equirect2", &xdev, &xcs, &data)) {
+	if (!do_single(xc, layer, i, "equirect2", &xdev, &xcs, &data)) {
 		return;
 	}
 
@@ -219,11 +218,31 @@ overlay_sort_func(const void *a, const void *b)
 }
 
 static void
-transfer_layers_locked(struct multi_system_compositor *msc, uint64_t display_time_ns, int64_t system_frame_id)
+stage_layers_locked(struct multi_system_compositor *msc, struct multi_compositor *mc)
 {
-	COMP_TRACE_MARKER();
+	for (uint32_t i = 0; i < mc->delivered.layer_count; i++) {
+		struct multi_layer_entry *src = &mc->delivered.layers[i];
+		struct multi_layer_entry *dst = &msc->staged.layers[msc->staged.layer_count++];
 
-	struct xrt_compositor *xc = &msc->xcn->base;
+		dst->xdev = src->xdev;
+		dst->data = src->data;
+
+		// Keep the swapchains alive even if the client goes away.
+		for (size_t k = 0; k < ARRAY_SIZE(dst->xscs); k++) {
+			xrt_swapchain_reference(&dst->xscs[k], src->xscs[k]);
+		}
+	}
+}
+
+/*!
+ * Latches the frames of all clients and copies their layers to
+ * multi_system_compositor::staged, this is all that is done with the
+ * list_and_timing_lock held, returns the number of latched clients.
+ */
+static uint32_t
+latch_and_stage_layers_locked(struct multi_system_compositor *msc, uint64_t display_time_ns, int64_t system_frame_id)
+{
+	COMP_TRACE_MARKER();
 
 	struct multi_compositor *array[MULTI_MAX_CLIENTS] = {0};
 
@@ -273,25 +292,67 @@ transfer_layers_locked(struct multi_system_compositor *msc, uint64_t display_tim
 	qsort(array, count, sizeof(struct multi_compositor *), overlay_sort_func);
 
 	// Copy all active layers.
+	assert(msc->staged.layer_count == 0);
 	for (size_t k = 0; k < count; k++) {
 		struct multi_compositor *mc = array[k];
 		assert(mc != NULL);
 
-		for (uint32_t i = 0; i < mc->delivered.layer_count; i++) {
-			struct multi_layer_entry *layer = &mc->delivered.layers[i];
-
-			switch (layer->data.type) {
-			case XRT_LAYER_STEREO_PROJECTION: do_projection_layer(xc, mc, layer, i); break;
-			case XRT_LAYER_STEREO_PROJECTION_DEPTH: do_projection_layer_depth(xc, mc, layer, i); break;
-			case XRT_LAYER_QUAD: do_quad_layer(xc, mc, layer, i); break;
-			case XRT_LAYER_CUBE: do_cube_layer(xc, mc, layer, i); break;
-			case XRT_LAYER_CYLINDER: do_cylinder_layer(xc, mc, layer, i); break;
-			case XRT_LAYER_EQUIRECT1: do_equirect1_layer(xc, mc, layer, i); break;
-			case XRT_LAYER_EQUIRECT2: do_equirect2_layer(xc, mc, layer, i); break;
-			default: U_LOG_E("Unhandled layer type '%i'!", layer->data.type); break;
-			}
+		stage_layers_locked(msc, mc);
+	}
+
+	return (uint32_t)count;
+}
+
+/*!
+ * Submits the staged layers to the native compositor, no lock needs to be held.
+ */
+static void
+submit_staged_layers(struct multi_system_compositor *msc)
+{
+	COMP_TRACE_MARKER();
+
+	struct xrt_compositor *xc = &msc->xcn->base;
+
+	for (uint32_t i = 0; i < msc->staged.layer_count; i++) {
+		struct multi_layer_entry *layer = &msc->staged.layers[i];
+
+		switch (layer->data.type) {
+		case XRT_LAYER_STEREO_PROJECTION: do_projection_layer(xc, layer, i); break;
+		case XRT_LAYER_STEREO_PROJECTION_DEPTH: do_projection_layer_depth(xc, layer, i); break;
+		case XRT_LAYER_QUAD: do_quad_layer(xc, layer, i); break;
+		case XRT_LAYER_CUBE: do_cube_layer(xc, layer, i); break;
+		case XRT_LAYER_CYLINDER: do_cylinder_layer(xc, layer, i); break;
+		case XRT_LAYER_EQUIRECT1: do_equirect1_layer(xc, layer, i); break;
+		case XRT_LAYER_EQUIRECT2: do_equirect2_layer(xc, layer, i); break;
+		default: U_LOG_E("Unhandled layer type '%i'!", layer->data.type); break;
+		}
+	}
+}
+
+static void
+release_staged_layers(struct multi_system_compositor *msc)
+{
+	for (uint32_t i = 0; i < msc->staged.layer_count; i++) {
+		struct multi_layer_entry *layer = &msc->staged.layers[i];
+
+		for (size_t k = 0; k < ARRAY_SIZE(layer->xscs); k++) {
+			xrt_swapchain_reference(&layer->xscs[k], NULL);
 		}
+		U_ZERO(layer);
 	}
+
+	msc->staged.layer_count = 0;
+}
+
+static void
+push_lock_hold_sample(struct multi_system_compositor *msc, uint64_t hold_ns, uint32_t latched_count)
+{
+	int index = (msc->lock_metrics.index + 1) % MULTI_LOCK_HOLD_TIMES;
+
+	msc->lock_metrics.hold_ms[index] = (float)time_ns_to_ms_f(hold_ns);
+	msc->lock_metrics.index = index;
+	msc->lock_metrics.last_hold_ns = hold_ns;
+	msc->lock_metrics.last_latched_count = latched_count;
 }
 
 static void
@@ -350,12 +411,12 @@ broadcast_timings_to_pacers(struct multi_system_compositor *msc,
 }
 
 static void
-wait_frame(struct os_precise_sleeper *sleeper, struct xrt_compositor *xc, int64_t frame_id, uint64_t wake_up_time_ns)
+wait_frame(struct u_wait_hybrid *waiter, struct xrt_compositor *xc, int64_t frame_id, uint64_t wake_up_time_ns)
 {
 	COMP_TRACE_MARKER();
 
-	// Wait until the given wake up time.
-	u_wait_until(sleeper, wake_up_time_ns);
+	// Wait until the given wake up time, spins the last bit of it if enabled.
+	u_wait_hybrid_until(waiter, wake_up_time_ns);
 
 	uint64_t now_ns = os_monotonic_get_ns();
 
@@ -438,10 +499,6 @@ multi_main_loop(struct multi_system_compositor *msc)
 
 	struct xrt_compositor *xc = &msc->xcn->base;
 
-	// For wait frame.
-	struct os_precise_sleeper sleeper = {0};
-	os_precise_sleeper_init(&sleeper);
-
 	// Protect the thread state and the sessions state.
 	os_thread_helper_lock(&msc->oth);
 
@@ -480,7 +537,7 @@ multi_main_loop(struct multi_system_compositor *msc)
 		broadcast_timings_to_clients(msc, predicted_display_time_ns);
 
 		// Now we can wait.
-		wait_frame(&sleeper, xc, frame_id, wake_up_time_ns);
+		wait_frame(&msc->wake_waiter, xc, frame_id, wake_up_time_ns);
 
 		uint64_t now_ns = os_monotonic_get_ns();
 		uint64_t diff_ns = predicted_display_time_ns - now_ns;
@@ -504,13 +561,26 @@ multi_main_loop(struct multi_system_compositor *msc)
 		};
 		xrt_comp_layer_begin(xc, &data);
 
-		// Make sure that the clients doesn't go away while we transfer layers.
+		/*
+		 * Make sure that the clients doesn't go away while we latch
+		 * frames, the layers are copied out so that the native
+		 * compositor isn't called with the lock held.
+		 */
 		os_mutex_lock(&msc->list_and_timing_lock);
-		transfer_layers_locked(msc, predicted_display_time_ns, frame_id);
+		uint64_t locked_ns = os_monotonic_get_ns();
+		uint32_t latched_count = latch_and_stage_layers_locked(msc, predicted_display_time_ns, frame_id);
+		uint64_t unlocked_ns = os_monotonic_get_ns();
 		os_mutex_unlock(&msc->list_and_timing_lock);
 
+		push_lock_hold_sample(msc, unlocked_ns - locked_ns, latched_count);
+
+		submit_staged_layers(msc);
+
 		xrt_comp_layer_commit(xc, XRT_GRAPHICS_SYNC_HANDLE_INVALID);
 
+		// The native compositor is done with the swapchains.
+		release_staged_layers(msc);
+
 		// Re-lock the thread for check in while statement.
 		os_thread_helper_lock(&msc->oth);
 	}
@@ -528,8 +598,6 @@ multi_main_loop(struct multi_system_compositor *msc)
 
 	os_thread_helper_unlock(&msc->oth);
 
-	os_precise_sleeper_deinit(&sleeper);
-
 	return 0;
 }
 
@@ -653,11 +721,16 @@ system_compositor_destroy(struct xrt_system_compositor *xsc)
 {
 	struct multi_system_compositor *msc = multi_system_compositor(xsc);
 
+	// Remove the variable tracking first.
+	u_var_remove_root(msc);
+
 	// Destroy the render thread first, destroy also stops the thread.
 	os_thread_helper_destroy(&msc->oth);
 
 	u_paf_destroy(&msc->upaf);
 
+	u_wait_hybrid_fini(&msc->wake_waiter);
+
 	xrt_comp_native_destroy(&msc->xcn);
 
 	os_mutex_destroy(&msc->list_and_timing_lock);
@@ -721,6 +794,23 @@ comp_multi_create_system_compositor(struct xrt_compositor_native *xcn,
 	msc->last_timings.predicted_display_period_ns = U_TIME_1MS_IN_NS * 16; // Just a wild guess.
 	msc->last_timings.diff_ns = U_TIME_1MS_IN_NS * 5;                      // Make sure it's not zero at least.
 
+	msc->lock_metrics.timing.values.data = msc->lock_metrics.hold_ms;
+	msc->lock_metrics.timing.values.length = MULTI_LOCK_HOLD_TIMES;
+	msc->lock_metrics.timing.values.index_ptr = &msc->lock_metrics.index;
+	msc->lock_metrics.timing.reference_timing = 0.1f;
+	msc->lock_metrics.timing.range = 0.5f;
+	msc->lock_metrics.timing.dynamic_rescale = true;
+	msc->lock_metrics.timing.unit = "ms";
+
+	u_wait_hybrid_init(&msc->wake_waiter);
+	msc->wake_waiter.spin = debug_get_bool_option_spin_wait();
+
+	u_var_add_root(msc, "Multi-client system compositor", true);
+	u_var_add_ro_u64(msc, &msc->lock_metrics.last_hold_ns, "Lock hold (ns)");
+	u_var_add_ro_u32(msc, &msc->lock_metrics.last_latched_count, "Latched clients");
+	u_var_add_f32_timing(msc, &msc->lock_metrics.timing, "Lock hold times");
+	u_wait_hybrid_add_vars(&msc->wake_waiter, msc, "Frame wake up");
+
 	int ret = os_thread_helper_init(&msc->oth);
 	if (ret < 0) {
 		return XRT_ERROR_THREADING_INIT_FAILURE;
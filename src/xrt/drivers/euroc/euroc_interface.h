@@ -40,13 +40,15 @@ struct euroc_player_playback_config
 	bool skip_perc;           //!< Whether @ref skip_first represents percentage or seconds
 	float skip_first;         //!< How much of the first dataset samples to skip, @see skip_perc
 	float scale;              //!< Scale of each frame; e.g., 0.5 (half), 1.0 (avoids resize)
-	bool max_speed;           //!< If true, push samples as fast as possible, other wise @see speed
+	bool max_speed;           //!< If true, push samples as fast as the sinks take them, other wise @see speed
 	double speed;             //!< Intended reproduction speed if @ref max_speed is false
 	bool send_all_imus_first; //!< If enabled all imu samples will be sent before img samples
 	bool paused;              //!< Whether to pause the playback
 	bool use_source_ts;       //!< If true, use the original timestamps from the dataset
 	bool play_from_start;     //!< If set, the euroc player does not wait for user input to start
 	bool print_progress;      //!< Whether to print progress to stdout (useful for CLI runs)
+	int decode_threads;       //!< Threads decoding frames ahead of the playback, 0 decodes when pushing
+	int decode_ahead;         //!< How many frames can be decoded ahead of the playback at most
 };
 
 /*!
@@ -12,24 +12,29 @@
 #include "xrt/xrt_frameserver.h"
 #include "os/os_threading.h"
 #include "util/u_debug.h"
+#include "util/u_frame_pool.h"
 #include "util/u_misc.h"
 #include "util/u_time.h"
 #include "util/u_var.h"
 #include "util/u_sink.h"
-#include "tracking/t_frame_cv_mat_wrapper.hpp"
 #include "math/m_api.h"
 #include "math/m_filter_fifo.h"
 
 #include "euroc_driver.h"
 #include "euroc_interface.h"
+#include "euroc_prefetch.h"
+
+#include <opencv2/opencv.hpp>
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <stdint.h>
 #include <stdio.h>
 #include <fstream>
 #include <future>
+#include <mutex>
 #include <thread>
 #include <inttypes.h>
 
@@ -48,12 +53,18 @@ DEBUG_GET_ONCE_BOOL_OPTION(send_all_imus_first, "EUROC_SEND_ALL_IMUS_FIRST", fal
 DEBUG_GET_ONCE_BOOL_OPTION(use_source_ts, "EUROC_USE_SOURCE_TS", false)
 DEBUG_GET_ONCE_BOOL_OPTION(play_from_start, "EUROC_PLAY_FROM_START", false)
 DEBUG_GET_ONCE_BOOL_OPTION(print_progress, "EUROC_PRINT_PROGRESS", false)
+DEBUG_GET_ONCE_NUM_OPTION(decode_threads, "EUROC_DECODE_THREADS", 2)
+DEBUG_GET_ONCE_NUM_OPTION(decode_ahead, "EUROC_DECODE_AHEAD", 8)
 
 #define EUROC_PLAYER_STR "Euroc Player"
 
 //! Match max cameras to slam sinks max camera count
 #define EUROC_MAX_CAMS XRT_TRACKING_MAX_SLAM_CAMS
 
+//! Upper limits of the decode_threads and decode_ahead playback options
+#define EUROC_MAX_DECODE_THREADS 16
+#define EUROC_MAX_DECODE_AHEAD 64
+
 using std::async;
 using std::find_if;
 using std::ifstream;
@@ -72,6 +83,26 @@ using imu_samples = vector<xrt_imu_sample>;
 using img_samples = vector<img_sample>;
 using gt_trajectory = vector<xrt_pose_sample>;
 
+//! Buffers a decode thread keeps between frames
+struct euroc_decode_scratch
+{
+	vector<uchar> file; //!< Contents of the image file
+	cv::Mat decoded;    //!< Image before scaling
+	cv::Mat scaled;     //!< Image after scaling
+};
+
+/*!
+ * Keeps the IMU and frame streams in dataset order when @ref
+ * euroc_player_playback_config::max_speed is set, as the clock doesn't.
+ */
+struct euroc_lockstep
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	timepoint_ns frame_ts; //!< Dataset timestamp of the next frame, IMU samples up to it can be pushed
+	timepoint_ns imu_ts;   //!< Dataset timestamp of the next IMU sample, frames before it can be pushed
+};
+
 enum euroc_player_ui_state
 {
 	UNINITIALIZED = 0,
@@ -115,6 +146,16 @@ struct euroc_player
 	vector<img_samples> *imgs; //!< List of all image names to read from the dataset per camera
 	gt_trajectory *gt;         //!< List of all groundtruth poses read from the dataset
 
+	// Frame decoding
+	struct u_frame_pool *frame_pool;            //!< Frames are decoded into these
+	struct euroc_prefetch *prefetch;            //!< Decodes frames ahead while streaming
+	vector<euroc_decode_scratch> *scratch;      //!< Buffers for each decode thread
+	struct euroc_prefetch_stats prefetch_stats; //!< Copied from `prefetch` after each frame for the UI
+	struct euroc_lockstep *lockstep;            //!< Paces the streams with each other in max speed mode
+	timepoint_ns replay_start_ts;               //!< When the first frame was pushed, moved forward by pauses
+	timepoint_ns replay_start_euroc_ts;         //!< Dataset timestamp of the first frame pushed
+	float replay_speed;                         //!< Sustained dataset time over wall time since the first frame
+
 	// Timestamp correction fields (can be disabled through `use_source_ts`)
 	timepoint_ns base_ts;   //!< First sample timestamp, stream timestamps are relative to this
 	timepoint_ns start_ts;  //!< When did the dataset started to be played
@@ -422,54 +463,132 @@ euroc_player_mapped_playback_ts(struct euroc_player *ep, timepoint_ns ts)
 	return euroc_player_mapped_ts(ep, ts);
 }
 
+//! Reads the whole file at `path` into `buf`, reusing its memory
+static bool
+euroc_player_read_file(const string &path, vector<uchar> &buf)
+{
+	ifstream fin{path, std::ios::binary | std::ios::ate};
+	if (!fin.is_open()) {
+		return false;
+	}
+
+	// Is -1 if the size can't be told, like for a directory.
+	std::streamsize size = fin.tellg();
+	if (size < 0) {
+		return false;
+	}
+
+	fin.seekg(0);
+	buf.resize(size);
+	return bool(fin.read(reinterpret_cast<char *>(buf.data()), size));
+}
+
+//! Decodes image `seq` of camera `cam_index` into a pooled frame, called from the decode threads.
+//! Only the image is filled in, the timestamps are set when the frame is pushed.
 static void
-euroc_player_load_next_frame(struct euroc_player *ep, int cam_index, struct xrt_frame *&xf)
+euroc_player_decode_frame(void *ptr, uint32_t worker, uint64_t seq, int cam_index, struct xrt_frame **out_xf)
 {
-	using xrt::auxiliary::tracking::FrameMat;
-	img_sample sample = ep->imgs->at(cam_index).at(ep->img_seq);
-	ep->playback.scale = CLAMP(ep->playback.scale, 1.0 / 16, 4);
+	struct euroc_player *ep = (struct euroc_player *)ptr;
+	euroc_decode_scratch &scratch = ep->scratch->at(worker);
+	const img_sample &sample = ep->imgs->at(cam_index).at(seq);
 
 	// Load will be influenced by these playback options
 	bool allow_color = ep->playback.color;
 	float scale = ep->playback.scale;
 
 	// Load image from disk
-	timepoint_ns timestamp = euroc_player_mapped_playback_ts(ep, sample.first);
-	string img_name = sample.second;
-	EUROC_TRACE(ep, "cam%d img t = %ld filename = %s", cam_index, timestamp, img_name.c_str());
+	const string &img_name = sample.second;
+	EUROC_TRACE(ep, "cam%d img seq = %" PRIu64 " filename = %s", cam_index, seq, img_name.c_str());
+	bool read = euroc_player_read_file(img_name, scratch.file);
+	EUROC_ASSERT(read, "Unable to read %s", img_name.c_str());
+
 	cv::ImreadModes read_mode = allow_color ? cv::IMREAD_ANYCOLOR : cv::IMREAD_GRAYSCALE;
-	cv::Mat img = cv::imread(img_name, read_mode); // If colored, reads in BGR order
+	bool is_colored = allow_color && ep->dataset.is_colored;
+	enum xrt_format format = is_colored ? XRT_FORMAT_R8G8B8 : XRT_FORMAT_L8;
+	struct xrt_frame *xf = NULL;
+
+	if (scale == 1.0) {
+		// Decode straight into the frame, OpenCV only reallocates if the image is not like the first one
+		u_frame_pool_create_frame(ep->frame_pool, format, ep->dataset.width, ep->dataset.height, &xf);
+		EUROC_ASSERT(xf != NULL, "Unable to allocate frame for %s", img_name.c_str());
+		cv::Mat dst(xf->height, xf->width, is_colored ? CV_8UC3 : CV_8UC1, xf->data, xf->stride);
+		cv::imdecode(scratch.file, read_mode, &dst); // If colored, decodes in BGR order
+		EUROC_ASSERT(!dst.empty(), "Unable to decode %s", img_name.c_str());
+
+		if (dst.data == xf->data) {
+			*out_xf = xf;
+			return;
+		}
 
+		xrt_frame_reference(&xf, NULL);
+		scratch.decoded = dst;
+	} else {
+		cv::imdecode(scratch.file, read_mode, &scratch.decoded);
+		EUROC_ASSERT(!scratch.decoded.empty(), "Unable to decode %s", img_name.c_str());
+	}
+
+	cv::Mat img = scratch.decoded;
 	if (scale != 1.0) {
-		cv::Mat tmp;
-		cv::resize(img, tmp, cv::Size(), scale, scale);
-		img = tmp;
+		cv::resize(scratch.decoded, scratch.scaled, cv::Size(), scale, scale);
+		img = scratch.scaled;
 	}
 
-	// Create xrt_frame, it will be freed by FrameMat destructor
-	EUROC_ASSERT(xf == NULL || xf->reference.count > 0, "Must be given a valid or NULL frame ptr");
+	format = img.channels() == 3 ? XRT_FORMAT_R8G8B8 : XRT_FORMAT_L8;
+	u_frame_pool_create_frame(ep->frame_pool, format, img.cols, img.rows, &xf);
+	EUROC_ASSERT(xf != NULL, "Unable to allocate frame for %s", img_name.c_str());
+	cv::Mat dst(xf->height, xf->width, img.type(), xf->data, xf->stride);
+	img.copyTo(dst);
+
+	*out_xf = xf;
+}
+
+//! Sets the timestamps of a decoded frame right before pushing it, as they depend on pauses.
+static void
+euroc_player_stamp_frame(struct euroc_player *ep, int cam_index, struct xrt_frame *xf)
+{
+	img_sample sample = ep->imgs->at(cam_index).at(ep->img_seq);
+	timepoint_ns timestamp = euroc_player_mapped_playback_ts(ep, sample.first);
+	EUROC_TRACE(ep, "cam%d img t = %ld filename = %s", cam_index, timestamp, sample.second.c_str());
 	EUROC_ASSERT(timestamp >= 0, "Unexpected negative timestamp");
+
 	//! @todo Not using xrt_stereo_format because we use two sinks. It would
 	//! probably be better to refactor everything to use stereo frames instead.
-	FrameMat::Params params{XRT_STEREO_FORMAT_NONE, static_cast<uint64_t>(timestamp)};
-	auto wrap = img.channels() == 3 ? FrameMat::wrapR8G8B8 : FrameMat::wrapL8;
-	wrap(img, &xf, params);
-
-	// Fields that aren't set by FrameMat
+	xf->stereo_format = XRT_STEREO_FORMAT_NONE;
+	xf->timestamp = static_cast<uint64_t>(timestamp);
 	xf->owner = ep;
 	xf->source_timestamp = sample.first;
 	xf->source_sequence = ep->img_seq;
 	xf->source_id = ep->base.source_id;
 }
 
+//! Updates @ref euroc_player::replay_speed, measured from the first frame pushed.
+static void
+euroc_player_update_replay_speed(struct euroc_player *ep, timepoint_ns euroc_ts)
+{
+	timepoint_ns now = os_monotonic_get_ts();
+	if (ep->replay_start_ts == 0) {
+		ep->replay_start_ts = now;
+		ep->replay_start_euroc_ts = euroc_ts;
+		return;
+	}
+
+	time_duration_ns wall_ns = now - ep->replay_start_ts;
+	if (wall_ns > 0) {
+		ep->replay_speed = float(double(euroc_ts - ep->replay_start_euroc_ts) / double(wall_ns));
+	}
+}
+
 static void
 euroc_player_push_next_frame(struct euroc_player *ep)
 {
 	int cam_count = ep->playback.cam_count;
 
-	vector<xrt_frame *> xfs(cam_count, nullptr);
+	xrt_frame *xfs[EUROC_MAX_CAMS] = {};
+	euroc_prefetch_get(ep->prefetch, ep->img_seq, xfs);
+	euroc_prefetch_get_stats(ep->prefetch, &ep->prefetch_stats);
+
 	for (int i = 0; i < cam_count; i++) {
-		euroc_player_load_next_frame(ep, i, xfs[i]);
+		euroc_player_stamp_frame(ep, i, xfs[i]);
 	}
 
 	// TODO: Some SLAM systems expect synced frames, but that's not an
@@ -478,6 +597,7 @@ euroc_player_push_next_frame(struct euroc_player *ep)
 		EUROC_ASSERT(xfs[i - 1]->timestamp == xfs[i]->timestamp, "Unsynced frames");
 	}
 
+	euroc_player_update_replay_speed(ep, xfs[0]->source_timestamp);
 	ep->img_seq++;
 
 	for (int i = 0; i < cam_count; i++) {
@@ -490,8 +610,9 @@ euroc_player_push_next_frame(struct euroc_player *ep)
 
 	size_t fcount = ep->imgs->at(0).size();
 	(void)snprintf(ep->progress_text, sizeof(ep->progress_text),
-	               "Playback %.2f%% - Frame %" PRId64 "/%" PRId64 " - IMU %" PRId64 "/%" PRId64,
-	               float(ep->img_seq) / float(fcount) * 100, ep->img_seq, fcount, ep->imu_seq, ep->imus->size());
+	               "Playback %.2f%% - Frame %" PRId64 "/%" PRId64 " - IMU %" PRId64 "/%" PRId64 " - Speed %.2fx",
+	               float(ep->img_seq) / float(fcount) * 100, ep->img_seq, fcount, ep->imu_seq, ep->imus->size(),
+	               ep->replay_speed);
 
 	if (ep->playback.print_progress) {
 		printf("%s\r", ep->progress_text);
@@ -557,6 +678,49 @@ euroc_player_sleep_until_next_sample(struct euroc_player *ep)
 #endif
 }
 
+//! Used instead of the sleep in max speed mode, waits until the other stream
+//! has pushed every sample that comes before the next one of this stream. As
+//! pushing a frame blocks until the sinks take it, the downstream sinks end up
+//! setting the pace of both streams.
+template <typename SamplesType>
+void
+euroc_player_wait_for_other_stream(struct euroc_player *ep)
+{
+	constexpr bool is_imu = is_same_v<SamplesType, imu_samples>;
+	constexpr auto POLL_INTERVAL = std::chrono::milliseconds(15); // For noticing stops
+	timepoint_ns ts = euroc_player_get_next_euroc_ts<SamplesType>(ep);
+	euroc_lockstep &ls = *ep->lockstep;
+
+	std::unique_lock<std::mutex> lock(ls.mutex);
+	if constexpr (is_imu) {
+		ls.imu_ts = ts;
+	} else {
+		ls.frame_ts = ts;
+	}
+	ls.cond.notify_all();
+
+	// IMU samples go up to and including the next frame timestamp
+	auto other_stream_caught_up = [&] { return is_imu ? ts <= ls.frame_ts : ts < ls.imu_ts; };
+	while (!other_stream_caught_up() && ep->is_running) {
+		ls.cond.wait_for(lock, POLL_INTERVAL);
+	}
+}
+
+//! Lets the other stream run freely once this one has ended.
+template <typename SamplesType>
+void
+euroc_player_end_lockstep(struct euroc_player *ep)
+{
+	euroc_lockstep &ls = *ep->lockstep;
+	std::lock_guard<std::mutex> lock(ls.mutex);
+	if constexpr (is_same_v<SamplesType, imu_samples>) {
+		ls.imu_ts = INT64_MAX;
+	} else {
+		ls.frame_ts = INT64_MAX;
+	}
+	ls.cond.notify_all();
+}
+
 //! Based on the SamplesType to stream, return a set of corresponding entities:
 //! the samples vector, sequence number, push and sleep functions.
 template <typename SamplesType>
@@ -592,10 +756,14 @@ euroc_player_stream_samples(struct euroc_player *ep)
 
 		if (!ep->playback.max_speed) {
 			sleep_until_next_sample(ep);
+		} else {
+			euroc_player_wait_for_other_stream<SamplesType>(ep);
 		}
 
 		push_next_sample(ep);
 	}
+
+	euroc_player_end_lockstep<SamplesType>(ep);
 }
 
 static void *
@@ -622,11 +790,27 @@ euroc_player_stream(void *ptr)
 		euroc_player_push_all_gt(ep);
 	}
 
+	// Start decoding frames ahead, the decode threads only read the playback options
+	ep->playback.scale = CLAMP(ep->playback.scale, 1.0 / 16, 4);
+	ep->playback.decode_threads = CLAMP(ep->playback.decode_threads, 0, EUROC_MAX_DECODE_THREADS);
+	ep->playback.decode_ahead = CLAMP(ep->playback.decode_ahead, 1, EUROC_MAX_DECODE_AHEAD);
+	uint32_t decode_threads = ep->playback.decode_threads;
+	ep->scratch->resize(MAX(decode_threads, 1u));
+	ep->prefetch_stats = {};
+	ep->prefetch = euroc_prefetch_create(ep->img_seq, ep->imgs->at(0).size(), ep->playback.cam_count,
+	                                     decode_threads, ep->playback.decode_ahead, euroc_player_decode_frame, ep);
+
+	// Neither stream has pushed anything yet
+	ep->lockstep->frame_ts = INT64_MIN;
+	ep->lockstep->imu_ts = INT64_MIN;
+	ep->replay_start_ts = 0;
+	ep->replay_speed = 0;
+
 	// Launch image and IMU producers
 	auto serve_imus = async(launch::async, [ep] { euroc_player_stream_samples<imu_samples>(ep); });
 	auto serve_imgs = async(launch::async, [ep] { euroc_player_stream_samples<img_samples>(ep); });
-	// Note that the only fields of `ep` being modified in the threads are: img_seq, imu_seq and
-	// progress_text in single locations, thus no race conditions should occur.
+	// Note that the only fields of `ep` being modified in the threads are: img_seq, imu_seq,
+	// progress_text and the replay stats in single locations, thus no race conditions should occur.
 
 	// Wait for the end of both streams
 	serve_imgs.get();
@@ -634,7 +818,11 @@ euroc_player_stream(void *ptr)
 
 	ep->is_running = false;
 
+	euroc_prefetch_destroy(&ep->prefetch);
+
 	EUROC_INFO(ep, "Euroc dataset playback finished");
+	EUROC_INFO(ep, "Replay speed %.2fx, waited for %" PRIu64 " of %" PRIu64 " frames to be decoded",
+	           ep->replay_speed, ep->prefetch_stats.waited, ep->prefetch_stats.ready + ep->prefetch_stats.waited);
 	euroc_player_set_ui_state(ep, STREAM_ENDED);
 
 	return NULL;
@@ -801,6 +989,9 @@ euroc_player_destroy(struct xrt_frame_node *node)
 	delete ep->gt;
 	delete ep->imus;
 	delete ep->imgs;
+	delete ep->scratch;
+	delete ep->lockstep;
+	u_frame_pool_destroy(&ep->frame_pool);
 
 	u_var_remove_root(ep);
 	for (int i = 0; i < ep->dataset.cam_count; i++) {
@@ -868,6 +1059,9 @@ euroc_player_pause_btn_cb(void *ptr)
 	} else {
 		time_duration_ns pause_length = os_monotonic_get_ts() - ep->last_pause_ts;
 		ep->offset_ts += pause_length;
+		if (ep->replay_start_ts != 0) {
+			ep->replay_start_ts += pause_length;
+		}
 	}
 
 	euroc_player_set_ui_state(ep, ep->playback.paused ? STREAM_PAUSED : STREAM_PLAYING);
@@ -910,6 +1104,15 @@ euroc_player_setup_gui(struct euroc_player *ep)
 	u_var_add_f64(ep, &ep->playback.speed, "Speed");
 	u_var_add_bool(ep, &ep->playback.send_all_imus_first, "Send all IMU samples first");
 	u_var_add_bool(ep, &ep->playback.use_source_ts, "Use original timestamps");
+	u_var_add_i32(ep, &ep->playback.decode_threads, "Decode threads");
+	u_var_add_i32(ep, &ep->playback.decode_ahead, "Decode up to N frames ahead");
+
+	u_var_add_gui_header(ep, NULL, "Decoding");
+	u_var_add_ro_f32(ep, &ep->replay_speed, "Replay speed");
+	u_var_add_ro_u64(ep, &ep->prefetch_stats.ready, "Frames decoded in time");
+	u_var_add_ro_u64(ep, &ep->prefetch_stats.waited, "Frames waited for");
+	u_var_add_ro_u64(ep, &ep->prefetch_stats.wait_ns, "Time waited (ns)");
+	u_var_add_ro_u64(ep, &ep->prefetch_stats.decode_ns, "Time decoding (ns)");
 
 	u_var_add_gui_header(ep, NULL, "Streams");
 	u_var_add_ro_ff_vec3_f32(ep, ep->gyro_ff, "Gyroscope");
@@ -946,6 +1149,8 @@ euroc_player_fill_default_config_for(struct euroc_player_config *config, const c
 	playback.use_source_ts = debug_get_bool_option_use_source_ts();
 	playback.play_from_start = debug_get_bool_option_play_from_start();
 	playback.print_progress = debug_get_bool_option_print_progress();
+	playback.decode_threads = (int)debug_get_num_option_decode_threads();
+	playback.decode_ahead = (int)debug_get_num_option_decode_ahead();
 
 	config->log_level = debug_get_log_option_euroc_log();
 	config->dataset = dataset;
@@ -990,6 +1195,12 @@ euroc_player_create(struct xrt_frame_context *xfctx, const char *path, struct eu
 	ep->gt = new gt_trajectory{};
 	ep->imus = new imu_samples{};
 	ep->imgs = new vector<img_samples>(ep->dataset.cam_count);
+	ep->scratch = new vector<euroc_decode_scratch>{};
+	ep->lockstep = new euroc_lockstep{};
+
+	// Enough free frames for all the frames decoded ahead, and the ones the sinks are holding on to
+	uint32_t max_free = (CLAMP(ep->playback.decode_ahead, 1, EUROC_MAX_DECODE_AHEAD) + 2) * ep->dataset.cam_count;
+	ep->frame_pool = u_frame_pool_create("Euroc Player frames", max_free);
 
 	euroc_player_setup_gui(ep);
 
@@ -0,0 +1,320 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Decodes the frames of a dataset ahead of the playback.
+ * @ingroup drv_euroc
+ */
+
+#include "os/os_threading.h"
+#include "os/os_time.h"
+#include "util/u_misc.h"
+
+#include "euroc_driver.h"
+#include "euroc_prefetch.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+
+//! Marks a slot that holds no set.
+#define NO_SEQ UINT64_MAX
+
+struct euroc_prefetch_worker
+{
+	struct euroc_prefetch *efp;
+	struct os_thread thread;
+	uint32_t index;
+};
+
+/*!
+ * A ring of @ref depth slots, set @p seq goes in slot `seq % depth`. The
+ * workers never decode more than @ref depth sets past the one the playback
+ * is waiting for, so a slot is always free by the time it is needed again.
+ */
+struct euroc_prefetch
+{
+	euroc_prefetch_decode_func_t decode;
+	void *ptr;
+
+	int cam_count;
+	uint32_t thread_count;
+	uint32_t depth;
+	uint64_t end_seq;
+
+	struct os_mutex mutex;
+
+	//! Signalled when there is more to decode, or when stopping.
+	struct os_cond work_cond;
+
+	//! Signalled when a set is fully decoded.
+	struct os_cond ready_cond;
+
+	//! Protected by mutex.
+	bool running;
+
+	//! Next set and camera to hand to a worker, protected by mutex.
+	uint64_t next_seq;
+	int next_cam;
+
+	//! Next set the playback will ask for, protected by mutex.
+	uint64_t get_seq;
+
+	//! Set each slot holds, or @ref NO_SEQ, protected by mutex.
+	uint64_t *slot_seqs;
+
+	//! Frames decoded so far for each slot, protected by mutex.
+	int *slot_decoded;
+
+	//! Frames of the slots, cam_count per slot, protected by mutex.
+	struct xrt_frame **frames;
+
+	//! Protected by mutex.
+	struct euroc_prefetch_stats stats;
+
+	struct euroc_prefetch_worker *workers;
+};
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static inline bool
+is_set_ready(struct euroc_prefetch *efp, uint32_t slot, uint64_t seq)
+{
+	return efp->slot_seqs[slot] == seq && efp->slot_decoded[slot] == efp->cam_count;
+}
+
+static inline bool
+has_work(struct euroc_prefetch *efp)
+{
+	return efp->next_seq < efp->end_seq && efp->next_seq < efp->get_seq + efp->depth;
+}
+
+static void
+wake_workers(struct euroc_prefetch *efp)
+{
+	for (uint32_t i = 0; i < efp->thread_count; i++) {
+		os_cond_signal(&efp->work_cond);
+	}
+}
+
+static void *
+run_worker(void *ptr)
+{
+	struct euroc_prefetch_worker *w = (struct euroc_prefetch_worker *)ptr;
+	struct euroc_prefetch *efp = w->efp;
+
+	char name[16];
+	(void)snprintf(name, sizeof(name), "EuRoC decode %u", w->index);
+	os_thread_name(&w->thread, name);
+
+	os_mutex_lock(&efp->mutex);
+
+	while (efp->running) {
+		if (!has_work(efp)) {
+			os_cond_wait(&efp->work_cond, &efp->mutex);
+			continue;
+		}
+
+		uint64_t seq = efp->next_seq;
+		int cam = efp->next_cam;
+		if (++efp->next_cam == efp->cam_count) {
+			efp->next_cam = 0;
+			efp->next_seq++;
+		}
+
+		// The set that used this slot has already been handed out.
+		uint32_t slot = (uint32_t)(seq % efp->depth);
+		if (cam == 0) {
+			efp->slot_seqs[slot] = seq;
+			efp->slot_decoded[slot] = 0;
+		}
+
+		os_mutex_unlock(&efp->mutex);
+
+		struct xrt_frame *xf = NULL;
+		uint64_t start_ns = os_monotonic_get_ns();
+		efp->decode(efp->ptr, w->index, seq, cam, &xf);
+		uint64_t decode_ns = os_monotonic_get_ns() - start_ns;
+
+		os_mutex_lock(&efp->mutex);
+
+		// Takes over the reference from decode.
+		efp->frames[slot * efp->cam_count + cam] = xf;
+		efp->stats.decoded++;
+		efp->stats.decode_ns += decode_ns;
+
+		if (++efp->slot_decoded[slot] == efp->cam_count) {
+			os_cond_signal(&efp->ready_cond);
+		}
+	}
+
+	os_mutex_unlock(&efp->mutex);
+
+	return NULL;
+}
+
+static void
+get_now(struct euroc_prefetch *efp, uint64_t seq, struct xrt_frame **out_xfs)
+{
+	for (int i = 0; i < efp->cam_count; i++) {
+		uint64_t start_ns = os_monotonic_get_ns();
+		efp->decode(efp->ptr, 0, seq, i, &out_xfs[i]);
+		efp->stats.decode_ns += os_monotonic_get_ns() - start_ns;
+		efp->stats.decoded++;
+	}
+
+	// Decoding on the playback thread always waits.
+	efp->stats.waited++;
+	efp->get_seq++;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+struct euroc_prefetch *
+euroc_prefetch_create(uint64_t first_seq,
+                      uint64_t end_seq,
+                      int cam_count,
+                      uint32_t thread_count,
+                      uint32_t depth,
+                      euroc_prefetch_decode_func_t decode,
+                      void *ptr)
+{
+	assert(cam_count > 0);
+
+	struct euroc_prefetch *efp = U_TYPED_CALLOC(struct euroc_prefetch);
+	efp->decode = decode;
+	efp->ptr = ptr;
+	efp->cam_count = cam_count;
+	efp->thread_count = thread_count;
+	efp->depth = depth < 1 ? 1 : depth;
+	efp->end_seq = end_seq;
+	efp->next_seq = first_seq;
+	efp->get_seq = first_seq;
+
+	efp->slot_seqs = U_TYPED_ARRAY_CALLOC(uint64_t, efp->depth);
+	efp->slot_decoded = U_TYPED_ARRAY_CALLOC(int, efp->depth);
+	efp->frames = U_TYPED_ARRAY_CALLOC(struct xrt_frame *, (size_t)efp->depth * cam_count);
+	for (uint32_t i = 0; i < efp->depth; i++) {
+		efp->slot_seqs[i] = NO_SEQ;
+	}
+
+	int ret = 0;
+	ret |= os_mutex_init(&efp->mutex);
+	ret |= os_cond_init(&efp->work_cond);
+	ret |= os_cond_init(&efp->ready_cond);
+	EUROC_ASSERT(ret == 0, "Failed to init prefetch threading primitives");
+
+	if (thread_count == 0) {
+		return efp;
+	}
+
+	efp->running = true;
+	efp->workers = U_TYPED_ARRAY_CALLOC(struct euroc_prefetch_worker, thread_count);
+	for (uint32_t i = 0; i < thread_count; i++) {
+		struct euroc_prefetch_worker *w = &efp->workers[i];
+		w->efp = efp;
+		w->index = i;
+		ret |= os_thread_init(&w->thread);
+		ret |= os_thread_start(&w->thread, run_worker, w);
+		EUROC_ASSERT(ret == 0, "Decode thread launch failure");
+	}
+
+	return efp;
+}
+
+void
+euroc_prefetch_destroy(struct euroc_prefetch **efp_ptr)
+{
+	struct euroc_prefetch *efp = *efp_ptr;
+	if (efp == NULL) {
+		return;
+	}
+
+	if (efp->workers != NULL) {
+		os_mutex_lock(&efp->mutex);
+		efp->running = false;
+		wake_workers(efp);
+		os_mutex_unlock(&efp->mutex);
+
+		for (uint32_t i = 0; i < efp->thread_count; i++) {
+			os_thread_join(&efp->workers[i].thread);
+			os_thread_destroy(&efp->workers[i].thread);
+		}
+		free(efp->workers);
+	}
+
+	for (size_t i = 0; i < (size_t)efp->depth * efp->cam_count; i++) {
+		xrt_frame_reference(&efp->frames[i], NULL);
+	}
+
+	os_cond_destroy(&efp->ready_cond);
+	os_cond_destroy(&efp->work_cond);
+	os_mutex_destroy(&efp->mutex);
+
+	free(efp->frames);
+	free(efp->slot_decoded);
+	free(efp->slot_seqs);
+	free(efp);
+
+	*efp_ptr = NULL;
+}
+
+void
+euroc_prefetch_get(struct euroc_prefetch *efp, uint64_t seq, struct xrt_frame **out_xfs)
+{
+	os_mutex_lock(&efp->mutex);
+
+	assert(seq == efp->get_seq);
+	assert(seq < efp->end_seq);
+
+	if (efp->thread_count == 0) {
+		get_now(efp, seq, out_xfs);
+		os_mutex_unlock(&efp->mutex);
+		return;
+	}
+
+	uint32_t slot = (uint32_t)(seq % efp->depth);
+
+	if (is_set_ready(efp, slot, seq)) {
+		efp->stats.ready++;
+	} else {
+		uint64_t start_ns = os_monotonic_get_ns();
+		while (!is_set_ready(efp, slot, seq)) {
+			os_cond_wait(&efp->ready_cond, &efp->mutex);
+		}
+		efp->stats.waited++;
+		efp->stats.wait_ns += os_monotonic_get_ns() - start_ns;
+	}
+
+	// Hand over the references and free up the slot.
+	struct xrt_frame **frames = &efp->frames[slot * efp->cam_count];
+	for (int i = 0; i < efp->cam_count; i++) {
+		out_xfs[i] = frames[i];
+		frames[i] = NULL;
+	}
+	efp->slot_seqs[slot] = NO_SEQ;
+	efp->slot_decoded[slot] = 0;
+	efp->get_seq++;
+
+	wake_workers(efp);
+
+	os_mutex_unlock(&efp->mutex);
+}
+
+void
+euroc_prefetch_get_stats(struct euroc_prefetch *efp, struct euroc_prefetch_stats *out_stats)
+{
+	os_mutex_lock(&efp->mutex);
+	*out_stats = efp->stats;
+	os_mutex_unlock(&efp->mutex);
+}
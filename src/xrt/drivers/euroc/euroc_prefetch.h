@@ -0,0 +1,99 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Decodes the frames of a dataset ahead of the playback.
+ * @ingroup drv_euroc
+ */
+
+#pragma once
+
+#include "xrt/xrt_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * @addtogroup drv_euroc
+ * @{
+ */
+
+/*!
+ * Decodes the image of camera @p cam_index at @p seq into a new frame. Called
+ * from the decode threads, @p worker is the index of the calling thread so
+ * that scratch memory can be kept per thread.
+ */
+typedef void (*euroc_prefetch_decode_func_t)(
+    void *ptr, uint32_t worker, uint64_t seq, int cam_index, struct xrt_frame **out_xf);
+
+/*!
+ * Counters of a @ref euroc_prefetch.
+ */
+struct euroc_prefetch_stats
+{
+	//! Frame sets that were already decoded when asked for.
+	uint64_t ready;
+
+	//! Frame sets the playback had to wait for.
+	uint64_t waited;
+
+	//! Total time the playback spent waiting for frames.
+	uint64_t wait_ns;
+
+	//! Frames decoded, one per camera in each set.
+	uint64_t decoded;
+
+	//! Total time spent decoding, summed over all threads.
+	uint64_t decode_ns;
+};
+
+/*!
+ * Keeps up to @p depth sets of frames, one frame per camera, decoded ahead of
+ * the playback. Sets are handed out in order from @p first_seq up to but not
+ * including @p end_seq.
+ *
+ * @param thread_count Decode threads, zero decodes on the calling thread in
+ *                     @ref euroc_prefetch_get instead.
+ * @param depth        Sets decoded ahead at most, bounds the memory used.
+ */
+struct euroc_prefetch *
+euroc_prefetch_create(uint64_t first_seq,
+                      uint64_t end_seq,
+                      int cam_count,
+                      uint32_t thread_count,
+                      uint32_t depth,
+                      euroc_prefetch_decode_func_t decode,
+                      void *ptr);
+
+/*!
+ * Stops the decode threads, waiting for any decode in progress, and drops the
+ * frames that were never asked for.
+ */
+void
+euroc_prefetch_destroy(struct euroc_prefetch **efp_ptr);
+
+/*!
+ * Gets the frames of set @p seq, waiting for them to be decoded if needed.
+ * Must be called once for every set in order, @p out_xfs takes a reference to
+ * one frame per camera.
+ */
+void
+euroc_prefetch_get(struct euroc_prefetch *efp, uint64_t seq, struct xrt_frame **out_xfs);
+
+/*!
+ * Gets the counters of the prefetcher.
+ */
+void
+euroc_prefetch_get_stats(struct euroc_prefetch *efp, struct euroc_prefetch_stats *out_stats);
+
+
+/*!
+ * @}
+ */
+
+
+#ifdef __cplusplus
+}
+#endif
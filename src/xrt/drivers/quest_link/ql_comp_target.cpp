@@ -20,20 +20,31 @@
 #include "ql_comp_target.h"
 #include "main/comp_compositor.h"
 #include "math/m_space.h"
+#include "os/os_time.h"
+#include "util/u_debug.h"
 #include "util/u_pacing.h"
+#include "util/u_worker.h"
 #include "video_encoder.h"
 #include "xrt/xrt_config_have.h"
 #include "xrt_cast.h"
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <list>
+#include <thread>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+#include "ql_slice_scheduler.h"
 #include "ql_types.h"
 #include "ql_xrsp.h"
 #include "ql_system.h"
 
+// Encoder threads split between slices, -1 for one per core. This overrides the
+// per slice QL_THREADS_PER_SLICE of the x264 encoder, which is only used as is
+// when this is 0 to leave the encoders alone.
+DEBUG_GET_ONCE_NUM_OPTION(encoder_threads, "QL_ENCODER_THREADS", -1)
+
 namespace xrt::drivers::quest_link
 {
 
@@ -96,6 +107,9 @@ struct ql_comp_target : public comp_target
 	};
 	std::list<encoder_thread> encoder_threads;
 	std::vector<std::shared_ptr<xrt::drivers::wivrn::VideoEncoder>> encoders;
+
+	// Slices of every encoder thread are encoded on this pool
+	u_worker_thread_pool * encode_pool = nullptr;
 };
 
 static void target_init_semaphores(struct ql_comp_target * cn);
@@ -116,6 +130,7 @@ static void destroy_images(struct ql_comp_target * cn)
 
 	cn->encoder_threads.clear();
 	cn->encoders.clear();
+	u_worker_thread_pool_reference(&cn->encode_pool, nullptr);
 
 	struct vk_bundle * vk = get_vk(cn);
 
@@ -144,6 +159,17 @@ struct encoder_thread_param
 	ql_comp_target * cn;
 	ql_comp_target::encoder_thread * thread;
 	std::vector<std::shared_ptr<xrt::drivers::wivrn::VideoEncoder>> encoders;
+	int thread_budget;
+};
+
+// One slice of a frame, run on the encode pool
+struct slice_task
+{
+	ql_comp_target * cn;
+	xrt::drivers::wivrn::VideoEncoder * encoder;
+	ql_slice_scheduler * scheduler;
+	int slice;
+	int presenting_index;
 };
 
 static void * comp_ql_present_thread(void * void_param);
@@ -194,9 +220,18 @@ static void create_encoders(ql_comp_target * cn, std::vector<xrt::drivers::wivrn
 		desc.items.push_back(settings);
 	}
 
+	// The waiting encoder thread lends itself to the pool, so one thread per slice.
+	uint32_t num_slices = std::min<size_t>(cn->encoders.size(), 16);
+	cn->encode_pool = u_worker_thread_pool_create(num_slices - 1, num_slices, "QL encode");
+
+	int thread_budget = debug_get_num_option_encoder_threads();
+	if (thread_budget < 0)
+		thread_budget = std::max<int>(1, std::thread::hardware_concurrency());
+
 	for (auto & [group, params]: thread_params)
 	{
 		auto params_ptr = new encoder_thread_param(params);
+		params_ptr->thread_budget = thread_budget / thread_params.size();
 		auto & thread = cn->encoder_threads.emplace_back();
 		thread.index = cn->encoder_threads.size() - 1;
 		params_ptr->thread = &thread;
@@ -507,6 +542,30 @@ static VkResult comp_ql_acquire(struct comp_target * ct, uint32_t * out_index)
 	return res;
 }
 
+static void encode_slice(void * void_task)
+{
+	auto * task = (slice_task *)void_task;
+	struct ql_comp_target * cn = task->cn;
+	const auto & psc_image = cn->psc.images[task->presenting_index];
+	uint64_t start = os_monotonic_get_ns();
+
+	try
+	{
+		bool idr_requested = false;
+
+#ifndef XRT_HAVE_VT // TODO: nvenc etc etc
+		cn->host->start_encode(cn->host, psc_image.view_info.display_time, task->presenting_index, task->encoder->slice_idx);
+#endif
+		task->encoder->Encode(nullptr, psc_image.view_info, psc_image.frame_index, task->presenting_index, idr_requested);
+	}
+	catch (...)
+	{
+		// Ignore errors
+	}
+
+	task->scheduler->push_slice(task->slice, os_monotonic_get_ns() - start);
+}
+
 static void * comp_ql_present_thread(void * void_param)
 {
 	std::unique_ptr<encoder_thread_param> param((encoder_thread_param *)void_param);
@@ -514,6 +573,24 @@ static void * comp_ql_present_thread(void * void_param)
 	struct vk_bundle * vk = get_vk(cn);
 	COMP_DEBUG(cn->c, "Starting encoder thread %d", param->thread->index);
 
+	ql_slice_scheduler scheduler(param->encoders.size(), param->thread_budget, cn->fps);
+	scheduler.add_vars();
+	for (size_t i = 0; i < param->encoders.size(); i++)
+	{
+		if (scheduler.threads()[i] > 0)
+			param->encoders[i]->SetThreads(scheduler.threads()[i]);
+	}
+
+	u_worker_group * group = u_worker_group_create(cn->encode_pool);
+	std::vector<slice_task> tasks(param->encoders.size());
+	for (size_t i = 0; i < tasks.size(); i++)
+	{
+		tasks[i].cn = cn;
+		tasks[i].encoder = param->encoders[i].get();
+		tasks[i].scheduler = &scheduler;
+		tasks[i].slice = i;
+	}
+
 	uint8_t status_bit = 1 << (param->thread->index + 1);
 
 	std::vector<VkFence> fences(cn->image_count);
@@ -573,28 +650,30 @@ static void * comp_ql_present_thread(void * void_param)
 		}
 		
 
-		const auto & psc_image = cn->psc.images[presenting_index];
+		// Deadlines of all slices count from here, whenever each one starts.
+		cn->host->encode_dispatched_ns[presenting_index] = xrsp_ts_ns(cn->host);
+
 #ifdef XRT_HAVE_VT // TODO: nvenc etc etc
+		const auto & psc_image = cn->psc.images[presenting_index];
 		for (int i = 0; i < QL_NUM_SLICES; i++) {
 			cn->host->start_encode(cn->host, psc_image.view_info.display_time, presenting_index, i);
 		}
 #endif
 
-		try
+		// Slices are independent, encode them all at once.
+		uint64_t frame_start = os_monotonic_get_ns();
+		for (int slice: scheduler.order())
 		{
-			for (auto & encoder: param->encoders)
-			{
-				bool idr_requested = false;
-
-#ifndef XRT_HAVE_VT // TODO: nvenc etc etc
-				cn->host->start_encode(cn->host, psc_image.view_info.display_time, presenting_index, encoder->slice_idx);
-#endif
-				encoder->Encode(nullptr, psc_image.view_info, psc_image.frame_index, presenting_index, idr_requested);
-			}
+			tasks[slice].presenting_index = presenting_index;
+			u_worker_group_push(group, encode_slice, &tasks[slice]);
 		}
-		catch (...)
+		u_worker_group_wait_all(group);
+		scheduler.push_frame(os_monotonic_get_ns() - frame_start);
+
+		if (auto threads = scheduler.rebalance())
 		{
-			// Ignore errors
+			for (size_t i = 0; i < param->encoders.size(); i++)
+				param->encoders[i]->SetThreads((*threads)[i]);
 		}
 #if 0
 		for (int i = 0; i < QL_NUM_SLICES; i++) {
@@ -609,6 +688,8 @@ static void * comp_ql_present_thread(void * void_param)
 		}
 	}
 
+	u_worker_group_reference(&group, NULL);
+
 	return NULL;
 }
 
@@ -0,0 +1,200 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link slice encode scheduling and timing.
+ * @ingroup drv_quest_link
+ */
+
+#include "ql_slice_scheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <string>
+
+
+/*
+ *
+ * Timing.
+ *
+ */
+
+void
+ql_slice_scheduler::timing::push(float ms)
+{
+	index = (index + 1) % QL_SLICE_TIMING_SAMPLES;
+	times_ms[index] = ms;
+	count = std::min<uint32_t>(count + 1, QL_SLICE_TIMING_SAMPLES);
+}
+
+float
+ql_slice_scheduler::timing::percentile(float p) const
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	// The ring is full after the first few seconds, which one is first does not matter.
+	std::array<float, QL_SLICE_TIMING_SAMPLES> sorted;
+	auto end = std::copy_n(count == QL_SLICE_TIMING_SAMPLES ? times_ms : times_ms + 1, count, sorted.begin());
+	size_t rank = std::min<size_t>(count - 1, p * count);
+	std::nth_element(sorted.begin(), sorted.begin() + rank, end);
+	return sorted[rank];
+}
+
+float
+ql_slice_scheduler::timing::mean() const
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	const float *begin = count == QL_SLICE_TIMING_SAMPLES ? times_ms : times_ms + 1;
+	return std::accumulate(begin, begin + count, 0.f) / count;
+}
+
+
+/*
+ *
+ * Scheduler.
+ *
+ */
+
+ql_slice_scheduler::ql_slice_scheduler(int num_slices, int thread_budget, float fps)
+    : thread_budget(thread_budget), rebalance_interval(std::max(1.f, 5 * fps))
+{
+	for (int i = 0; i < num_slices; i++) {
+		slice_times.push_back(std::make_unique<timing>());
+		dispatch_order.push_back(i);
+	}
+
+	if (thread_budget > 0) {
+		slice_threads = allocate(std::vector<double>(num_slices, 1), thread_budget);
+	} else {
+		slice_threads.assign(num_slices, 0);
+	}
+}
+
+ql_slice_scheduler::~ql_slice_scheduler()
+{
+	if (vars_added) {
+		u_var_remove_root(this);
+	}
+}
+
+void
+ql_slice_scheduler::push_slice(int slice, uint64_t duration_ns)
+{
+	slice_times[slice]->push(duration_ns / 1e6f);
+}
+
+void
+ql_slice_scheduler::push_frame(uint64_t duration_ns)
+{
+	frame_times.push(duration_ns / 1e6f);
+	frame_times.p50_ms = frame_times.percentile(0.5);
+	frame_times.p99_ms = frame_times.percentile(0.99);
+
+	for (auto &t : slice_times) {
+		t->p50_ms = t->percentile(0.5);
+		t->p99_ms = t->percentile(0.99);
+	}
+
+	// Longest first: with fewer pool threads than slices the slowest one
+	// should not be left for last.
+	std::stable_sort(dispatch_order.begin(), dispatch_order.end(),
+	                 [&](int a, int b) { return slice_times[a]->p50_ms > slice_times[b]->p50_ms; });
+
+	frames_since_rebalance++;
+}
+
+std::optional<std::vector<int32_t>>
+ql_slice_scheduler::rebalance()
+{
+	if (thread_budget <= 0 || frames_since_rebalance < rebalance_interval) {
+		return std::nullopt;
+	}
+	frames_since_rebalance = 0;
+
+	// Assume encoding scales with threads, to get the single threaded cost.
+	std::vector<double> cost;
+	double slowest = 0;
+	for (size_t i = 0; i < slice_times.size(); i++) {
+		double mean = slice_times[i]->mean();
+		cost.push_back(mean * slice_threads[i]);
+		slowest = std::max(slowest, mean);
+	}
+
+	std::vector<int32_t> threads = allocate(cost, thread_budget);
+	if (threads == slice_threads) {
+		return std::nullopt;
+	}
+
+	double predicted = 0;
+	for (size_t i = 0; i < cost.size(); i++) {
+		predicted = std::max(predicted, cost[i] / threads[i]);
+	}
+
+	// Reopening encoders costs an IDR, only do it when worth it.
+	if (predicted > 0.8 * slowest) {
+		return std::nullopt;
+	}
+
+	slice_threads = threads;
+	return threads;
+}
+
+std::vector<int32_t>
+ql_slice_scheduler::allocate(const std::vector<double> &cost, int budget)
+{
+	std::vector<int32_t> threads(cost.size(), 1);
+
+	for (int spare = budget - (int)cost.size(); spare > 0; spare--) {
+		size_t slowest = 0;
+		for (size_t i = 1; i < cost.size(); i++) {
+			if (cost[i] / threads[i] > cost[slowest] / threads[slowest]) {
+				slowest = i;
+			}
+		}
+		threads[slowest]++;
+	}
+
+	return threads;
+}
+
+void
+ql_slice_scheduler::add_vars()
+{
+	u_var_add_root(this, "Quest Link slice encoding", true);
+
+	auto setup = [](timing &t) {
+		t.ui.values.data = t.times_ms;
+		t.ui.values.length = QL_SLICE_TIMING_SAMPLES;
+		t.ui.values.index_ptr = &t.index;
+		t.ui.reference_timing = 5.f;
+		t.ui.range = 10.f;
+		t.ui.unit = "ms";
+		t.ui.dynamic_rescale = true;
+		t.ui.center_reference_timing = false;
+	};
+
+	setup(frame_times);
+	u_var_add_ro_f32(this, &frame_times.p50_ms, "Frame p50 (ms)");
+	u_var_add_ro_f32(this, &frame_times.p99_ms, "Frame p99 (ms)");
+	u_var_add_f32_timing(this, &frame_times.ui, "Frame encode times");
+
+	for (size_t i = 0; i < slice_times.size(); i++) {
+		timing &t = *slice_times[i];
+		setup(t);
+
+		std::string header = "Slice " + std::to_string(i);
+		u_var_add_gui_header(this, nullptr, header.c_str());
+		u_var_add_ro_i32(this, &slice_threads[i], "Threads");
+		u_var_add_ro_f32(this, &t.p50_ms, "p50 (ms)");
+		u_var_add_ro_f32(this, &t.p99_ms, "p99 (ms)");
+		u_var_add_f32_timing(this, &t.ui, "Encode times");
+	}
+
+	vars_added = true;
+}
@@ -0,0 +1,139 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link slice encode scheduling and timing.
+ * @ingroup drv_quest_link
+ *
+ * The slices of a frame are encoded as tasks on a shared worker pool. The
+ * scheduler keeps the encode time of every slice and of whole frames, hands
+ * out the dispatch order (slowest slice first, so it never starts last) and
+ * splits the encoder thread budget between slices by how long they take.
+ *
+ * Encoders can't change their thread count without being reopened, which
+ * costs an IDR, so the split is only revised every few seconds and only when
+ * it shortens the slowest slice noticeably.
+ */
+
+#pragma once
+
+#include "util/u_var.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+//! Encode times kept per slice, for percentiles and the timing graphs.
+#define QL_SLICE_TIMING_SAMPLES (256)
+
+class ql_slice_scheduler
+{
+public:
+	struct timing
+	{
+		//! Ring of the last encode times in ms, shown in the debug GUI.
+		float times_ms[QL_SLICE_TIMING_SAMPLES] = {};
+		int index = 0;
+		uint32_t count = 0;
+
+		//! Updated every frame from the ring.
+		float p50_ms = 0;
+		float p99_ms = 0;
+
+		struct u_var_timing ui = {};
+
+		void
+		push(float ms);
+
+		float
+		percentile(float p) const;
+
+		float
+		mean() const;
+	};
+
+private:
+	int thread_budget;
+	uint32_t rebalance_interval;
+	uint32_t frames_since_rebalance = 0;
+
+	std::vector<std::unique_ptr<timing>> slice_times;
+	timing frame_times;
+	std::vector<int32_t> slice_threads;
+	std::vector<int> dispatch_order;
+
+	bool vars_added = false;
+
+public:
+	/*!
+	 * @param num_slices    Slices encoded for every frame.
+	 * @param thread_budget Encoder threads to split between slices, 0 to leave
+	 *                      the thread counts alone.
+	 * @param fps           Frame rate, the thread split is revised every 5s.
+	 */
+	ql_slice_scheduler(int num_slices, int thread_budget, float fps);
+	~ql_slice_scheduler();
+
+	ql_slice_scheduler(const ql_slice_scheduler &) = delete;
+	ql_slice_scheduler &
+	operator=(const ql_slice_scheduler &) = delete;
+
+	//! Slice indices in the order they should be dispatched.
+	const std::vector<int> &
+	order() const
+	{
+		return dispatch_order;
+	}
+
+	//! Threads currently given to each slice.
+	const std::vector<int32_t> &
+	threads() const
+	{
+		return slice_threads;
+	}
+
+	/*!
+	 * Record the encode time of a slice, may be called from the slice's task,
+	 * but only once per slice and frame.
+	 */
+	void
+	push_slice(int slice, uint64_t duration_ns);
+
+	/*!
+	 * Record the encode time of a whole frame, once all its slice tasks are
+	 * done. Updates the percentiles and the dispatch order.
+	 */
+	void
+	push_frame(uint64_t duration_ns);
+
+	/*!
+	 * New thread count for each slice when the split should change, to be
+	 * applied before the next frame is dispatched.
+	 */
+	std::optional<std::vector<int32_t>>
+	rebalance();
+
+	const timing &
+	slice_timing(int slice) const
+	{
+		return *slice_times[slice];
+	}
+
+	const timing &
+	frame_timing() const
+	{
+		return frame_times;
+	}
+
+	//! Show the timings in the debug GUI.
+	void
+	add_vars();
+
+	/*!
+	 * Split @p budget threads between slices of the given single threaded
+	 * cost, minimising the slowest slice. Every slice gets at least one.
+	 */
+	static std::vector<int32_t>
+	allocate(const std::vector<double> &cost, int budget);
+};
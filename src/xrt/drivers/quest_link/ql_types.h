@@ -26,6 +26,9 @@ extern "C" {
 #include "xrt/xrt_tracking.h"
 #include "math/m_filter_one_euro.h"
 
+#include "ql_xrsp_tx_arena.h"
+#include "ql_xrsp_usb_engine.h"
+
 typedef struct libusb_context libusb_context;
 typedef struct libusb_device_handle libusb_device_handle;
 struct ql_hmd;
@@ -116,12 +119,30 @@ typedef struct ql_xrsp_topic_pkt
     uint8_t* payload;
     uint32_t payload_size;
     uint32_t payload_valid;
-    uint32_t remainder_offs;
-    int32_t missing_bytes;
 
     int64_t recv_ns;
 } ql_xrsp_topic_pkt;
 
+/*!
+ * Splits the IN byte stream into topic packets.
+ *
+ * Reads can be of any size and packets can straddle them. Packets that are
+ * wholly inside a read are handed out in place, only the bytes of a packet
+ * that straddles reads are gathered in the carry buffer.
+ */
+struct ql_xrsp_topic_stream
+{
+    uint8_t* carry;
+    uint32_t carry_len;
+    //! Size of the packet being gathered, zero until its header is complete.
+    uint32_t carry_need;
+
+    uint64_t num_pkts;
+    uint64_t num_bytes;
+    //! Invalid headers skipped over.
+    uint64_t num_resyncs;
+};
+
 typedef struct ql_xrsp_host ql_xrsp_host;
 
 #define MAX_TRACKED_DEVICES 2
@@ -133,6 +154,25 @@ typedef struct ql_xrsp_host ql_xrsp_host;
 #define QL_NUM_SLICES (1)
 #define QL_IDX_SLICE(_slice_idx, _frame_idx) ((_slice_idx*QL_SWAPCHAIN_DEPTH)+_frame_idx)
 
+// Payload capacity of the per-slice transmit buffers
+#define QL_CSD_STREAM_MAX (0x10000)
+#define QL_IDR_STREAM_MAX (0x1000000)
+#define QL_SLICE_HDR_MAX (0x400)
+#define QL_SLICE_PREAMBLE_MAX (0x40)
+
+// Control messages of a frame are gathered into one transfer, see xrsp_queue_to_topic
+#define QL_CTRL_BATCH_MAX (0x10000)
+
+// Per topic capnp scratch, one PayloadSlice or RIPC command fits comfortably
+#define QL_CAPNP_NUM_TOPICS (0x40)
+#define QL_CAPNP_SCRATCH_WORDS (0x100)
+
+struct ql_xrsp_capnp_arena
+{
+    struct os_mutex mutex;
+    uint64_t words[QL_CAPNP_SCRATCH_WORDS]; // capnp::word, kept zeroed between messages
+};
+
 typedef struct ql_xrsp_host
 {
     struct ql_system* sys;
@@ -153,14 +193,15 @@ typedef struct ql_xrsp_host
     uint8_t ep_out;
     uint8_t ep_in;
 
+    // All bulk transfers go through this, it also owns the sequence numbers.
+    struct ql_xrsp_usb_engine usb;
+
     uint32_t client_id;
     uint32_t session_idx;
 
     // Parsing state
-    bool have_working_pkt;
-    ql_xrsp_topic_pkt working_pkt;
+    struct ql_xrsp_topic_stream rx_stream;
 
-    uint16_t increment;
     int pairing_state;
     int64_t start_ns;
 
@@ -189,20 +230,43 @@ typedef struct ql_xrsp_host
     bool sent_first_frame;
     int frame_idx;
 
+    // Released by flush_stream, wakes the write thread to send the slice.
+    struct os_semaphore tx_sem;
+    // Per swapchain image, the next slice to send and the frame it belongs to.
+    int next_slice[QL_SWAPCHAIN_DEPTH];
+    int stream_frame_idx[QL_SWAPCHAIN_DEPTH];
+
     struct os_mutex stream_mutex[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     bool needs_flush[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     int stream_write_idx;
     int stream_read_idx;
 
-    uint8_t* csd_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
-    uint8_t* idr_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
+    // Encoded slices are written straight into these, see ql_xrsp_tx_arena.h
+    struct ql_xrsp_tx_arena tx_arena;
+    struct ql_xrsp_tx_buf csd_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
+    struct ql_xrsp_tx_buf idr_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
+    struct ql_xrsp_tx_buf preamble_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES]; // PayloadSlice preamble, sent as a packet of its own
+    struct ql_xrsp_tx_buf hdr_stream[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES]; // PayloadSlice, only touched by the write thread
+    struct ql_xrsp_tx_buf ctrl_stream; // protected by usb_mutex
+
+    // Small per-frame control messages, flushed by the write thread. Filled
+    // under ctrl_batch_mutex, sent under usb_mutex.
+    struct os_mutex ctrl_batch_mutex;
+    struct ql_xrsp_tx_buf ctrl_batch[2];
+    //! Highest priority of the topics in each batch, the batch is queued at it.
+    enum ql_xrsp_usb_prio ctrl_batch_prio[2];
+    int ctrl_batch_idx;
+
+    struct ql_xrsp_capnp_arena capnp_arenas[QL_CAPNP_NUM_TOPICS];
+    // Heap allocations on the control path, stays put once running.
+    uint64_t num_ctrl_allocs;
 
-    size_t csd_stream_len[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
-    size_t idr_stream_len[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     int64_t stream_started_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
+    int64_t deadline_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES]; // Timestamp0C in host time, slices are sent earliest first
     struct xrt_pose stream_poses[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     int64_t stream_pose_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
 
+    int64_t encode_dispatched_ns[QL_SWAPCHAIN_DEPTH]; // once per frame, before its slices are handed to the encoders
     int64_t encode_started_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     int64_t encode_done_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
     int64_t encode_duration_ns[QL_SWAPCHAIN_DEPTH*QL_NUM_SLICES];
@@ -223,6 +287,8 @@ typedef struct ql_xrsp_host
     void (*start_encode)(struct ql_xrsp_host* host,  int64_t target_ns, int index, int slice_idx);
     void (*send_csd)(struct ql_xrsp_host* host, const uint8_t* data, size_t len, int index, int slice_idx);
     void (*send_idr)(struct ql_xrsp_host* host, const uint8_t* data, size_t len, int index, int slice_idx);
+    uint8_t* (*reserve_idr)(struct ql_xrsp_host* host, size_t max_len, int index, int slice_idx);
+    void (*commit_idr)(struct ql_xrsp_host* host, size_t len, int index, int slice_idx);
     void (*flush_stream)(struct ql_xrsp_host* host, int64_t target_ns, int index, int slice_idx);
 } ql_xrsp_host;
 
@@ -39,11 +39,15 @@
 #include "protos/Haptic.capnp.h"
 #include "protos/RuntimeIPC.capnp.h"
 #include "protos/Mesh.capnp.h"
+#include "ql_xrsp_capnp.h"
 
 DEBUG_GET_ONCE_NUM_OPTION(force_fps, "QL_OVERRIDE_FPS", -1)
 DEBUG_GET_ONCE_NUM_OPTION(force_w, "QL_OVERRIDE_FB_W", -1)
 DEBUG_GET_ONCE_NUM_OPTION(force_h, "QL_OVERRIDE_FB_H", -1)
 DEBUG_GET_ONCE_FLOAT_OPTION(force_scale, "QL_OVERRIDE_SCALE", 0.0)
+DEBUG_GET_ONCE_NUM_OPTION(usb_in_xfers, "QL_USB_IN_XFERS", 8)
+DEBUG_GET_ONCE_NUM_OPTION(usb_in_size, "QL_USB_IN_SIZE", 0x400)
+DEBUG_GET_ONCE_NUM_OPTION(usb_out_xfers, "QL_USB_OUT_XFERS", 4)
 
 static void *
 ql_xrsp_read_thread(void *ptr);
@@ -51,15 +55,24 @@ static void *
 ql_xrsp_write_thread(void *ptr);
 static void xrsp_reset_echo(struct ql_xrsp_host *host);
 static bool xrsp_read_usb(struct ql_xrsp_host *host);
-static void xrsp_send_usb(struct ql_xrsp_host *host, const uint8_t* data, int32_t data_size);
-static void xrsp_send_to_topic_raw(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size);
+static void xrsp_usb_error(void *ptr, bool is_in, int status);
+static void xrsp_send_tx_buf(struct ql_xrsp_host *host, uint8_t topic, struct ql_xrsp_tx_buf *buf);
+static void xrsp_send_tx_bufs(struct ql_xrsp_host *host, uint8_t topic, struct ql_xrsp_tx_buf *const *bufs, uint32_t num_bufs);
+static void xrsp_send_to_topic_locked(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size);
+static void xrsp_flush_ctrl_batch_locked(struct ql_xrsp_host *host);
+static void xrsp_ctrl_batch_add_topic_locked(struct ql_xrsp_host *host, uint8_t topic);
+static void xrsp_flush_ctrl_batch(struct ql_xrsp_host *host);
+static int64_t xrsp_slice_pipeline_ns(struct ql_xrsp_host *host, int index, int slice_idx);
+static int64_t xrsp_slice_deadline_ns(struct ql_xrsp_host *host, int index, int slice_idx);
 
 static void xrsp_flush_stream(struct ql_xrsp_host *host, int64_t target_ns, int index, int slice_idx);
 static void xrsp_start_encode(struct ql_xrsp_host *host,  int64_t target_ns, int index, int slice_idx);
 static void xrsp_send_csd(struct ql_xrsp_host *host, const uint8_t* data, size_t data_len, int index, int slice_idx);
 static void xrsp_send_idr(struct ql_xrsp_host *host, const uint8_t* data, size_t data_len, int index, int slice_idx);
-static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx, int frame_idx, int64_t frame_started_ns, const uint8_t* csd_dat, size_t csd_len,
-                            const uint8_t* video_dat, size_t video_len, int blit_y_pos);
+static uint8_t* xrsp_reserve_idr(struct ql_xrsp_host *host, size_t max_len, int index, int slice_idx);
+static void xrsp_commit_idr(struct ql_xrsp_host *host, size_t len, int index, int slice_idx);
+static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx, int frame_idx, int64_t frame_started_ns, struct ql_xrsp_tx_buf* csd,
+                            struct ql_xrsp_tx_buf* video, int blit_y_pos);
 static void xrsp_init_session_bye(struct ql_xrsp_host *host);
 int ql_xrsp_usb_init(struct ql_xrsp_host* host, bool do_reset);
 static void xrsp_send_mesh(struct ql_xrsp_host *host);
@@ -81,16 +94,39 @@ int ql_xrsp_host_create(struct ql_xrsp_host* host, uint16_t vid, uint16_t pid, i
     host->sent_first_frame = false;
     host->stream_read_idx = 0;
     host->stream_write_idx = 0;
+
+    // All transmit buffers come out of one allocation made up front, nothing
+    // on the encode-to-wire path allocates after this.
+    ret = ql_xrsp_tx_arena_init(&host->tx_arena,
+                                QL_SWAPCHAIN_DEPTH * QL_NUM_SLICES * (ql_xrsp_tx_buf_size_for_payload(QL_CSD_STREAM_MAX) + ql_xrsp_tx_buf_size_for_payload(QL_IDR_STREAM_MAX)
+                                                                      + ql_xrsp_tx_buf_size_for_payload(QL_SLICE_PREAMBLE_MAX) + ql_xrsp_tx_buf_size_for_payload(QL_SLICE_HDR_MAX))
+                                + ql_xrsp_tx_buf_size_for_payload(QL_XRSP_TX_MAX_PAYLOAD)
+                                + 2 * ql_xrsp_tx_buf_size_for_payload(QL_CTRL_BATCH_MAX));
+    if (ret != 0) {
+        QUEST_LINK_ERROR("Failed to allocate transmit arena");
+        goto cleanup;
+    }
+    ql_xrsp_tx_arena_carve(&host->tx_arena, &host->ctrl_stream, QL_XRSP_TX_MAX_PAYLOAD);
+    ql_xrsp_tx_arena_carve(&host->tx_arena, &host->ctrl_batch[0], QL_CTRL_BATCH_MAX);
+    ql_xrsp_tx_arena_carve(&host->tx_arena, &host->ctrl_batch[1], QL_CTRL_BATCH_MAX);
+    host->ctrl_batch_prio[0] = QL_XRSP_USB_PRIO_LOW;
+    host->ctrl_batch_prio[1] = QL_XRSP_USB_PRIO_LOW;
+    host->ctrl_batch_idx = 0;
+    host->num_ctrl_allocs = 0;
+
     for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
     {
+        host->encode_dispatched_ns[i] = 0;
+
         for (int j = 0; j < QL_NUM_SLICES; j++)
         {
-            host->csd_stream[QL_IDX_SLICE(j, i)] = (uint8_t*)malloc(0x1000000);
-            host->idr_stream[QL_IDX_SLICE(j, i)] = (uint8_t*)malloc(0x1000000);
-            host->csd_stream_len[QL_IDX_SLICE(j, i)] = 0;
-            host->idr_stream_len[QL_IDX_SLICE(j, i)] = 0;
+            ql_xrsp_tx_arena_carve(&host->tx_arena, &host->csd_stream[QL_IDX_SLICE(j, i)], QL_CSD_STREAM_MAX);
+            ql_xrsp_tx_arena_carve(&host->tx_arena, &host->idr_stream[QL_IDX_SLICE(j, i)], QL_IDR_STREAM_MAX);
+            ql_xrsp_tx_arena_carve(&host->tx_arena, &host->preamble_stream[QL_IDX_SLICE(j, i)], QL_SLICE_PREAMBLE_MAX);
+            ql_xrsp_tx_arena_carve(&host->tx_arena, &host->hdr_stream[QL_IDX_SLICE(j, i)], QL_SLICE_HDR_MAX);
 
             host->stream_started_ns[QL_IDX_SLICE(j, i)] = 0;
+            host->deadline_ns[QL_IDX_SLICE(j, i)] = 0;
             host->encode_started_ns[QL_IDX_SLICE(j, i)] = 0;
             host->encode_done_ns[QL_IDX_SLICE(j, i)] = 0;
             host->encode_duration_ns[QL_IDX_SLICE(j, i)] = 0;
@@ -107,6 +143,18 @@ int ql_xrsp_host_create(struct ql_xrsp_host* host, uint16_t vid, uint16_t pid, i
     }
     
     host->frame_idx = 0;
+    for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
+    {
+        host->next_slice[i] = 0;
+        host->stream_frame_idx[i] = 0;
+    }
+
+    ret = os_semaphore_init(&host->tx_sem, 0);
+    if (ret != 0) {
+        QUEST_LINK_ERROR("Failed to init transmit semaphore");
+        goto cleanup;
+    }
+
     ret = os_mutex_init(&host->usb_mutex);
     if (ret != 0) {
         QUEST_LINK_ERROR("Failed to init usb mutex");
@@ -118,6 +166,27 @@ int ql_xrsp_host_create(struct ql_xrsp_host* host, uint16_t vid, uint16_t pid, i
         QUEST_LINK_ERROR("Failed to init pose mutex");
         goto cleanup;
     }
+
+    ret = os_mutex_init(&host->ctrl_batch_mutex);
+    if (ret != 0) {
+        QUEST_LINK_ERROR("Failed to init control batch mutex");
+        goto cleanup;
+    }
+
+    for (int i = 0; i < QL_CAPNP_NUM_TOPICS; i++)
+    {
+        ret = os_mutex_init(&host->capnp_arenas[i].mutex);
+        if (ret != 0) {
+            QUEST_LINK_ERROR("Failed to init capnp arena mutex");
+            goto cleanup;
+        }
+    }
+
+    ret = ql_xrsp_topic_stream_init(&host->rx_stream);
+    if (ret != 0) {
+        QUEST_LINK_ERROR("Failed to init packet stream");
+        goto cleanup;
+    }
     
 
     //
@@ -144,6 +213,19 @@ int ql_xrsp_host_create(struct ql_xrsp_host* host, uint16_t vid, uint16_t pid, i
         goto cleanup;
     }
 
+    {
+        struct ql_xrsp_usb_config usb_config;
+        usb_config.num_in = debug_get_num_option_usb_in_xfers();
+        usb_config.in_size = debug_get_num_option_usb_in_size();
+        usb_config.num_out = debug_get_num_option_usb_out_xfers();
+
+        struct ql_xrsp_usb_backend* backend = ql_xrsp_usb_libusb_create(host->ctx);
+        if (!backend || ql_xrsp_usb_engine_init(&host->usb, backend, &usb_config, xrsp_usb_error, host) != 0) {
+            QUEST_LINK_ERROR("Failed to init USB transfer engine");
+            goto cleanup;
+        }
+    }
+
     ret = ql_xrsp_usb_init(host, false);
     if (ret != 0) {
         goto cleanup;
@@ -160,6 +242,8 @@ int ql_xrsp_host_create(struct ql_xrsp_host* host, uint16_t vid, uint16_t pid, i
     host->start_encode = xrsp_start_encode;
     host->send_csd = xrsp_send_csd;
     host->send_idr = xrsp_send_idr;
+    host->reserve_idr = xrsp_reserve_idr;
+    host->commit_idr = xrsp_commit_idr;
     host->flush_stream = xrsp_flush_stream;
 
     host->client_id = 0x4a60dcca;
@@ -196,6 +280,10 @@ int ql_xrsp_usb_init(struct ql_xrsp_host* host, bool do_reset)
 
     QUEST_LINK_INFO("(Re)initializing Quest Link USB device...");
 
+    // Nothing may be in flight on the handle we are about to close.
+    ql_xrsp_usb_engine_stop(&host->usb);
+    ql_xrsp_usb_libusb_set_device(host->usb.backend, NULL, 0, 0);
+
     os_mutex_lock(&host->usb_mutex);
 
     if (host->dev) {
@@ -204,6 +292,7 @@ int ql_xrsp_usb_init(struct ql_xrsp_host* host, bool do_reset)
 
     host->usb_speed = LIBUSB_SPEED_LOW;
     host->usb_valid = false;
+    ql_xrsp_topic_stream_reset(&host->rx_stream);
     host->pairing_state = PAIRINGSTATE_WAIT_FIRST;
     host->ready_to_send_frames = false;
     host->sent_first_frame = false;
@@ -331,10 +420,13 @@ int ql_xrsp_usb_init(struct ql_xrsp_host* host, bool do_reset)
     libusb_clear_halt(host->dev, host->ep_in);
     libusb_clear_halt(host->dev, host->ep_out);
 
+    ql_xrsp_usb_libusb_set_device(host->usb.backend, host->dev, host->ep_in, host->ep_out);
     host->usb_valid = true;    
 
     os_mutex_unlock(&host->usb_mutex);
 
+    ql_xrsp_usb_engine_start(&host->usb);
+
     //xrsp_init_session_bye(host);
 
     return 0;
@@ -346,20 +438,32 @@ cleanup:
 
 void ql_xrsp_host_destroy(struct ql_xrsp_host* host)
 {
+    // The write thread waits on tx_sem and both threads use the engine.
+    os_thread_helper_destroy(&host->write_thread);
+    os_thread_helper_destroy(&host->read_thread);
+
+    ql_xrsp_usb_engine_destroy(&host->usb);
+
     libusb_release_interface(host->dev, host->if_num);
     libusb_close(host->dev);
 
+    ql_xrsp_topic_stream_destroy(&host->rx_stream);
+    os_semaphore_destroy(&host->tx_sem);
     os_mutex_destroy(&host->pose_mutex);
     os_mutex_destroy(&host->usb_mutex);
+    os_mutex_destroy(&host->ctrl_batch_mutex);
+    for (int i = 0; i < QL_CAPNP_NUM_TOPICS; i++)
+    {
+        os_mutex_destroy(&host->capnp_arenas[i].mutex);
+    }
     for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
     {
         for (int j = 0; j < QL_NUM_SLICES; j++)
         {
-            free(host->csd_stream[QL_IDX_SLICE(j, i)]);
-            free(host->idr_stream[QL_IDX_SLICE(j, i)]);
             os_mutex_destroy(&host->stream_mutex[QL_IDX_SLICE(j, i)]);
         }
     }
+    ql_xrsp_tx_arena_destroy(&host->tx_arena);
 }
 
 static void xrsp_flush_stream(struct ql_xrsp_host *host, int64_t target_ns, int index, int slice_idx)
@@ -372,7 +476,7 @@ static void xrsp_flush_stream(struct ql_xrsp_host *host, int64_t target_ns, int
     bool wait = false;
     os_mutex_lock(&host->stream_mutex[stream_write_idx]);
 
-    if (host->csd_stream_len[stream_write_idx] || host->idr_stream_len[stream_write_idx]) {
+    if (host->csd_stream[stream_write_idx].payload_len || host->idr_stream[stream_write_idx].payload_len) {
         //QUEST_LINK_INFO("Write idx %x slice %x", index, slice_idx);
         host->needs_flush[stream_write_idx] = true;
         wait = true;
@@ -383,19 +487,41 @@ static void xrsp_flush_stream(struct ql_xrsp_host *host, int64_t target_ns, int
         U_ZERO(&out_head_relation);
 
         host->encode_duration_ns[stream_write_idx] = host->encode_done_ns[stream_write_idx] - host->encode_started_ns[stream_write_idx];
+        host->deadline_ns[stream_write_idx] = xrsp_slice_deadline_ns(host, index, slice_idx);
 
-        static int64_t last_ns = 0;
-        int64_t delta = host->stream_started_ns[stream_write_idx] - last_ns;
-        //QUEST_LINK_INFO("%zx -> %ffps", delta, 1000000000.0 / (double)delta);
-
-        last_ns = target_ns;
         os_mutex_unlock(&host->stream_mutex[stream_write_idx]);
+
+        // Don't wait for the other slices, this one goes out while they encode.
+        os_semaphore_release(&host->tx_sem);
     }
     else {
         os_mutex_unlock(&host->stream_mutex[stream_write_idx]);
     }
 }
 
+// Time from the frame being dispatched until a slice of it was encoded. The
+// slices encode in parallel, so slice 0 may well start after another slice is
+// done, measure from the one start of the frame instead.
+static int64_t xrsp_slice_pipeline_ns(struct ql_xrsp_host *host, int index, int slice_idx)
+{
+    int64_t delta = host->encode_done_ns[QL_IDX_SLICE(slice_idx, index)] - host->encode_dispatched_ns[index];
+
+    return delta > 0 ? delta : 0;
+}
+
+// When the headset should have a slice by (Timestamp0C), in host time. Only
+// the pipeline delta differs between slices of a frame.
+static int64_t xrsp_slice_deadline_ns(struct ql_xrsp_host *host, int index, int slice_idx)
+{
+    struct ql_hmd* hmd = host->sys->hmd;
+
+    int64_t pipeline_pred_delta_ma = xrsp_slice_pipeline_ns(host, index, slice_idx);
+    int64_t duration_a = (int64_t)(1000000000.0/hmd->fps);
+    int64_t duration_b = duration_a+pipeline_pred_delta_ma;
+
+    return host->encode_dispatched_ns[index] + duration_a + duration_b;
+}
+
 static void xrsp_start_encode(struct ql_xrsp_host *host, int64_t target_ns, int index, int slice_idx)
 {
     int write_index = QL_IDX_SLICE(slice_idx, index);
@@ -427,12 +553,11 @@ static void xrsp_send_csd(struct ql_xrsp_host *host, const uint8_t* data, size_t
     os_mutex_lock(&host->stream_mutex[write_index]);
     //bool success = xrsp_read_usb(host); 
     
-    //QUEST_LINK_INFO("CSD: %x into %x", data_len, host->csd_stream_len[write_index]);
+    //QUEST_LINK_INFO("CSD: %x into %x", data_len, host->csd_stream[write_index].payload_len);
     //hex_dump(data, data_len);
 
-    if (host->csd_stream_len[write_index] + data_len < 0x1000000) {
-        memcpy(host->csd_stream[write_index] + host->csd_stream_len[write_index], data, data_len);
-        host->csd_stream_len[write_index] += data_len;
+    if (!ql_xrsp_tx_buf_append(&host->csd_stream[write_index], data, data_len)) {
+        QUEST_LINK_WARN("Dropping %zx bytes of CSD, stream is full", data_len);
     }
 
     os_mutex_unlock(&host->stream_mutex[write_index]);
@@ -447,36 +572,52 @@ static void xrsp_send_idr(struct ql_xrsp_host *host, const uint8_t* data, size_t
     }
     os_mutex_lock(&host->stream_mutex[write_index]);
 
-    //QUEST_LINK_INFO("IDR: %x into %x for slice %x, index %x", data_len, host->idr_stream_len[write_index], slice_idx, index);
+    //QUEST_LINK_INFO("IDR: %x into %x for slice %x, index %x", data_len, host->idr_stream[write_index].payload_len, slice_idx, index);
 
-    if (host->idr_stream_len[write_index] + data_len < 0x1000000) {
-        memcpy(host->idr_stream[write_index] + host->idr_stream_len[write_index], data, data_len);
-        host->idr_stream_len[write_index] += data_len;
+    if (!ql_xrsp_tx_buf_append(&host->idr_stream[write_index], data, data_len)) {
+        QUEST_LINK_WARN("Dropping %zx bytes of video, stream is full", data_len);
     }
     
     os_mutex_unlock(&host->stream_mutex[write_index]);
 }
 
-static void xrsp_send_usb(struct ql_xrsp_host *host, const uint8_t* data, int32_t data_size)
+// Lets the encoder write a NAL straight into the transmit arena, the stream
+// stays locked until the matching xrsp_commit_idr.
+static uint8_t* xrsp_reserve_idr(struct ql_xrsp_host *host, size_t max_len, int index, int slice_idx)
 {
-    //QUEST_LINK_INFO("Send to usb:");
-    //hex_dump(data, data_size);
-
-    if (!host->usb_valid) return;
+    int write_index = QL_IDX_SLICE(slice_idx, index);
 
-    int sent_len = 0;
-    int r = libusb_bulk_transfer(host->dev, host->ep_out, (uint8_t*)data, data_size, &sent_len, 1000);
-    if (r != 0 || !sent_len) {
-        QUEST_LINK_ERROR("Failed to send %x bytes (sent %x)", data_size, sent_len);
-        QUEST_LINK_ERROR("libusb error: %s", libusb_strerror((libusb_error)r));
+    while (host->needs_flush[write_index]) {
+        os_nanosleep(U_TIME_1MS_IN_NS / 10);
+    }
+    os_mutex_lock(&host->stream_mutex[write_index]);
 
-        if (r == LIBUSB_ERROR_NO_DEVICE || r == LIBUSB_ERROR_TIMEOUT) {
-           host->usb_valid = false;
-           host->pairing_state = PAIRINGSTATE_WAIT_FIRST;
-        }
+    uint8_t* dst = ql_xrsp_tx_buf_reserve(&host->idr_stream[write_index], max_len);
+    if (!dst) {
+        os_mutex_unlock(&host->stream_mutex[write_index]);
     }
-    else {
-        //QUEST_LINK_INFO("Sent %x bytes", sent_len);
+
+    return dst;
+}
+
+static void xrsp_commit_idr(struct ql_xrsp_host *host, size_t len, int index, int slice_idx)
+{
+    int write_index = QL_IDX_SLICE(slice_idx, index);
+
+    ql_xrsp_tx_buf_commit(&host->idr_stream[write_index], len);
+
+    os_mutex_unlock(&host->stream_mutex[write_index]);
+}
+
+static void xrsp_usb_error(void *ptr, bool is_in, int status)
+{
+    struct ql_xrsp_host *host = (struct ql_xrsp_host *)ptr;
+
+    QUEST_LINK_ERROR("USB %s transfer failed: %d", is_in ? "IN" : "OUT", status);
+
+    if (!is_in && (status == QL_XRSP_USB_NO_DEVICE || status == QL_XRSP_USB_TIMEOUT)) {
+       host->usb_valid = false;
+       host->pairing_state = PAIRINGSTATE_WAIT_FIRST;
     }
 }
 
@@ -489,26 +630,35 @@ void xrsp_send_to_topic_capnp_wrapped(struct ql_xrsp_host *host, uint8_t topic,
 
 void xrsp_send_to_topic_capnp_segments(struct ql_xrsp_host *host, uint8_t topic, uint32_t idx, kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>>& data)
 {
-    int num_segments = data.size();
+    if (!host) return;
+
+    os_mutex_lock(&host->usb_mutex);
 
-    uint32_t* preamble = (uint32_t*)malloc(sizeof(uint32_t) * (num_segments + 1));
-    preamble[0] = idx;
-    for (int i = 0; i < num_segments; i++)
+    // The preamble goes out as its own packet, built straight in the control stream.
+    ql_xrsp_tx_buf_reset(&host->ctrl_stream);
+    bool ok = ql_xrsp_tx_buf_append(&host->ctrl_stream, (const uint8_t*)&idx, sizeof(idx));
+    for (size_t i = 0; i < data.size(); i++)
     {
-        size_t packed_data_size = data[i].size()*sizeof(uint64_t);
+        uint32_t num_words = data[i].size();
+        ok = ok && ql_xrsp_tx_buf_append(&host->ctrl_stream, (const uint8_t*)&num_words, sizeof(num_words));
+    }
 
-        preamble[i+1] = static_cast<uint32_t>(packed_data_size) >> 3;
+    if (!ok) {
+        QUEST_LINK_ERROR("Too many segments for topic %s", xrsp_topic_str(topic));
+        os_mutex_unlock(&host->usb_mutex);
+        return;
     }
 
-    xrsp_send_to_topic(host, topic, (uint8_t*)preamble, sizeof(uint32_t) * (num_segments + 1));
+    // Anything batched for this topic has to go first.
+    xrsp_flush_ctrl_batch_locked(host);
+    xrsp_send_tx_buf(host, topic, &host->ctrl_stream);
 
-    for (int i = 0; i < num_segments; i++)
+    for (size_t i = 0; i < data.size(); i++)
     {
-        uint8_t* packed_data = (uint8_t*)data[i].begin();
-        size_t packed_data_size = data[i].size()*sizeof(uint64_t);
-
-        xrsp_send_to_topic(host, topic, packed_data, packed_data_size);
+        xrsp_send_to_topic_locked(host, topic, (const uint8_t*)data[i].begin(), data[i].size()*sizeof(capnp::word));
     }
+
+    os_mutex_unlock(&host->usb_mutex);
 }
 
 void xrsp_send_to_topic(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size)
@@ -516,105 +666,187 @@ void xrsp_send_to_topic(struct ql_xrsp_host *host, uint8_t topic, const uint8_t*
     //QUEST_LINK_INFO("Send to topic %s", xrsp_topic_str(topic));
     //hex_dump(data, data_size);
 
-    os_mutex_lock(&host->usb_mutex);
-
     if (!host) return;
     if (data_size <= 0) return;
 
+    os_mutex_lock(&host->usb_mutex);
+    xrsp_send_to_topic_locked(host, topic, data, data_size);
+    os_mutex_unlock(&host->usb_mutex);
+}
+
+static void xrsp_send_to_topic_locked(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size)
+{
+    // The control stream holds one topic packet, send one chunk at a time.
     int32_t idx = 0;
     int32_t to_send = data_size;
-    while (true)
+    while (idx < to_send)
     {
-        if (idx >= to_send) break;
-
-        int32_t amt = 0x3FFF8; // FFF8?
+        int32_t amt = QL_XRSP_TX_MAX_PAYLOAD;
         if (idx+amt >= to_send) {
             amt = to_send - idx;
         }
-        xrsp_send_to_topic_raw(host, topic, data + idx, amt);
+
+        ql_xrsp_tx_buf_reset(&host->ctrl_stream);
+        ql_xrsp_tx_buf_append(&host->ctrl_stream, data + idx, amt);
+        xrsp_send_tx_buf(host, topic, &host->ctrl_stream);
 
         idx += amt;
     }
-    os_mutex_unlock(&host->usb_mutex);
 }
 
-static void xrsp_send_to_topic_raw(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size)
+/*
+ * Small control messages don't get a transfer of their own, they are copied
+ * into the control batch as whole topic packets and the write thread sends
+ * everything queued in one go. Messages that don't fit are sent directly
+ * after whatever is already queued.
+ */
+void xrsp_queue_to_topic(struct ql_xrsp_host *host, uint8_t topic, const uint8_t* data, int32_t data_size)
 {
-    //QUEST_LINK_INFO("Send to topic raw %s", xrsp_topic_str(topic));
-    //hex_dump(data, data_size);
-
     if (!host) return;
-    //if (data_size <= 0) return;
+    if (data_size <= 0) return;
 
-    int32_t real_len = data_size;
-    int32_t align_up_bytes = (((4+data_size) >> 2) << 2) - data_size;
-    if (align_up_bytes == 4) {
-        align_up_bytes = 0;
+    os_mutex_lock(&host->ctrl_batch_mutex);
+    bool queued = ql_xrsp_tx_buf_append_packet(&host->ctrl_batch[host->ctrl_batch_idx], topic, data, data_size);
+    if (queued) {
+        xrsp_ctrl_batch_add_topic_locked(host, topic);
     }
+    os_mutex_unlock(&host->ctrl_batch_mutex);
 
-    //QUEST_LINK_INFO("align up %x, %x, %x", align_up_bytes, data_size, real_len);
+    if (queued) {
+        os_semaphore_release(&host->tx_sem);
+        return;
+    }
 
-    // TODO place this in a fixed buffer?
-    uint8_t* msg = (uint8_t*)malloc(data_size + align_up_bytes + sizeof(xrsp_topic_header) + 0x400);
-    uint8_t* msg_payload = msg + sizeof(xrsp_topic_header);
-    int32_t msg_size = data_size + align_up_bytes + sizeof(xrsp_topic_header);
+    os_mutex_lock(&host->usb_mutex);
+    xrsp_flush_ctrl_batch_locked(host);
+    xrsp_send_to_topic_locked(host, topic, data, data_size);
+    os_mutex_unlock(&host->usb_mutex);
+}
 
-    // Sometimes we can end up with 0x4 bytes leftover, so we have to pad a bit extra
-    int32_t to_fill_check = 0x400 - ((msg_size + 0x400) & 0x3FF);
-    if (to_fill_check >= 0 && to_fill_check < 8) {
-        align_up_bytes += to_fill_check;
+void xrsp_queue_to_topic_capnp_segments(struct ql_xrsp_host *host, uint8_t topic, uint32_t idx, kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> data)
+{
+    if (!host) return;
 
-        msg_size = data_size + align_up_bytes + sizeof(xrsp_topic_header);
+    // Preamble and segments as two packets like xrsp_send_to_topic_capnp_segments,
+    // the headset only picks up a preamble that is a packet of its own.
+    size_t preamble_len = sizeof(uint32_t) * (data.size() + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        len += data[i].size()*sizeof(capnp::word);
     }
 
-    xrsp_topic_header* header = (xrsp_topic_header*)msg;
-    header->version_maybe = 0;
-    header->has_alignment_padding = align_up_bytes ? 1 : 0;
-    header->packet_version_is_internal = 1;
-    header->packet_version_number = 0;
-    header->topic = topic;
-    header->unk_14_15 = 0;
+    os_mutex_lock(&host->ctrl_batch_mutex);
+    struct ql_xrsp_tx_buf* batch = &host->ctrl_batch[host->ctrl_batch_idx];
+    struct ql_xrsp_tx_buf saved = *batch;
 
-    header->num_words = ((data_size + align_up_bytes) >> 2) + 1;
-    header->sequence_num = host->increment;
-    header->pad = 0;
-
-    memcpy(msg_payload, data, data_size);
+    uint32_t* preamble = (uint32_t*)ql_xrsp_tx_buf_reserve_packet(batch, preamble_len);
+    if (preamble) {
+        preamble[0] = idx;
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            preamble[i+1] = data[i].size();
+        }
+        ql_xrsp_tx_buf_commit_packet(batch, topic, preamble_len);
+    }
 
-    if (align_up_bytes)
-    {
-        if (align_up_bytes > 1)
+    uint8_t* out = preamble ? ql_xrsp_tx_buf_reserve_packet(batch, len) : NULL;
+    if (out) {
+        for (size_t i = 0; i < data.size(); i++)
         {
-            memset(msg_payload+data_size, 0xDE, align_up_bytes-1);
+            memcpy(out, data[i].begin(), data[i].size()*sizeof(capnp::word));
+            out += data[i].size()*sizeof(capnp::word);
         }
-        msg_payload[data_size + align_up_bytes - 1] = align_up_bytes;
+        ql_xrsp_tx_buf_commit_packet(batch, topic, len);
+        xrsp_ctrl_batch_add_topic_locked(host, topic);
+    }
+    else if (preamble) {
+        // Only whole messages are batched, the direct send below has it all.
+        ql_xrsp_tx_buf_rewind(batch, &saved);
     }
+    os_mutex_unlock(&host->ctrl_batch_mutex);
+
+    if (out) {
+        os_semaphore_release(&host->tx_sem);
+        return;
+    }
+
+    xrsp_send_to_topic_capnp_segments(host, topic, idx, data);
+}
+
+// The batch goes out at the highest priority of its topics so a haptic pulse doesn't wait behind video, called with ctrl_batch_mutex held.
+static void xrsp_ctrl_batch_add_topic_locked(struct ql_xrsp_host *host, uint8_t topic)
+{
+    enum ql_xrsp_usb_prio prio = ql_xrsp_usb_topic_prio(topic);
+    if (prio < host->ctrl_batch_prio[host->ctrl_batch_idx]) {
+        host->ctrl_batch_prio[host->ctrl_batch_idx] = prio;
+    }
+}
+
+// Takes the batch being filled and swaps in the other one, called with usb_mutex held.
+static void xrsp_flush_ctrl_batch_locked(struct ql_xrsp_host *host)
+{
+    os_mutex_lock(&host->ctrl_batch_mutex);
+    int idx = host->ctrl_batch_idx;
+    struct ql_xrsp_tx_buf* batch = &host->ctrl_batch[idx];
+    host->ctrl_batch_idx ^= 1;
+    os_mutex_unlock(&host->ctrl_batch_mutex);
+
+    if (batch->payload_len && host->usb_valid) {
+        ql_xrsp_usb_engine_send_batch(&host->usb, host->ctrl_batch_prio[idx], batch);
+    }
+    ql_xrsp_tx_buf_reset(batch);
+    host->ctrl_batch_prio[idx] = QL_XRSP_USB_PRIO_LOW;
+}
+
+static void xrsp_flush_ctrl_batch(struct ql_xrsp_host *host)
+{
+    // Don't wait behind a large direct send for nothing.
+    os_mutex_lock(&host->ctrl_batch_mutex);
+    bool empty = !host->ctrl_batch[host->ctrl_batch_idx].payload_len;
+    os_mutex_unlock(&host->ctrl_batch_mutex);
+
+    if (empty) return;
 
-    uint8_t* msg_end = msg + msg_size;
-    memset(msg_end, 0, 0x400);
+    os_mutex_lock(&host->usb_mutex);
+    xrsp_flush_ctrl_batch_locked(host);
+    os_mutex_unlock(&host->usb_mutex);
+}
+
+// Blocks until @p buf is on the wire, the engine orders concurrent senders.
+static void xrsp_send_tx_buf(struct ql_xrsp_host *host, uint8_t topic, struct ql_xrsp_tx_buf *buf)
+{
+    if (!buf->payload_len) return;
+    if (!host->usb_valid) return;
+
+    ql_xrsp_usb_engine_send(&host->usb, topic, buf);
+}
 
-    int32_t to_fill = 0x400 - ((msg_size + 0x400) & 0x3FF) - 8;
-    int32_t final_size = (msg_size + 8 + to_fill);
-    //QUEST_LINK_INFO("final_size=%x, to_fill=%x, msg_size=%x", final_size, to_fill, msg_size);
-    if (to_fill < 0x3f8 && to_fill >= 0) { // && final_size <= 0x10000
-        xrsp_topic_header* fill_header = (xrsp_topic_header*)msg_end;
-        fill_header->version_maybe = 0;
-        fill_header->has_alignment_padding = 0;
-        fill_header->packet_version_is_internal = 1;
-        fill_header->packet_version_number = 0;
-        fill_header->topic = 0;
-        fill_header->unk_14_15 = 0;
+// Same, but all of @p bufs go out back to back as one submission.
+static void xrsp_send_tx_bufs(struct ql_xrsp_host *host, uint8_t topic, struct ql_xrsp_tx_buf *const *bufs, uint32_t num_bufs)
+{
+    if (!host->usb_valid) return;
+
+    ql_xrsp_usb_engine_send_bufs(&host->usb, topic, bufs, num_bufs);
+}
 
-        fill_header->num_words = (to_fill >> 2) + 1;
-        fill_header->sequence_num = host->increment;
-        fill_header->pad = 0;
-        msg_size += to_fill + sizeof(xrsp_topic_header);
+// Lays out a capnp message like xrsp_send_to_topic_capnp_segments does, the
+// headset only picks up the preamble as a packet of its own so it goes in @p preamble.
+static bool xrsp_tx_buf_append_capnp(struct ql_xrsp_tx_buf *preamble, struct ql_xrsp_tx_buf *buf, uint32_t idx, kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>>& data)
+{
+    bool ok = ql_xrsp_tx_buf_append(preamble, (const uint8_t*)&idx, sizeof(idx));
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        uint32_t num_words = data[i].size();
+        ok = ok && ql_xrsp_tx_buf_append(preamble, (const uint8_t*)&num_words, sizeof(num_words));
     }
 
-    xrsp_send_usb(host, msg, msg_size);
-    host->increment += 1;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        ok = ok && ql_xrsp_tx_buf_append(buf, (const uint8_t*)data[i].begin(), data[i].size()*sizeof(capnp::word));
+    }
 
-    free(msg);
+    return ok;
 }
 
 static void xrsp_reset_echo(struct ql_xrsp_host *host)
@@ -685,11 +917,10 @@ static void xrsp_send_ping(struct ql_xrsp_host *host)
 
     //QUEST_LINK_INFO("Ping sent: xmt=%zx offs=%zx", host->echo_req_sent_ns, host->ns_offset);
 
-    int32_t request_echo_ping_len = 0;
-    uint8_t* request_echo_ping = ql_xrsp_craft_echo(ECHO_PING, host->echo_idx, 0, 0, host->echo_req_sent_ns, host->ns_offset, &request_echo_ping_len);
+    uint8_t request_echo_ping[0x40];
+    int32_t request_echo_ping_len = ql_xrsp_craft_echo_into(request_echo_ping, sizeof(request_echo_ping), ECHO_PING, host->echo_idx, 0, 0, host->echo_req_sent_ns, host->ns_offset);
 
     xrsp_send_to_topic(host, TOPIC_HOSTINFO_ADV, request_echo_ping, request_echo_ping_len);
-    free(request_echo_ping);
 
     host->echo_idx += 1;
 }
@@ -779,7 +1010,6 @@ static void xrsp_finish_pairing_1(struct ql_xrsp_host *host, struct ql_xrsp_host
 static void xrsp_init_session_2(struct ql_xrsp_host *host, struct ql_xrsp_hostinfo_pkt* pkt)
 {
     xrsp_reset_echo(host);
-    xrsp_read_usb(host);
 
     struct ql_hmd* hmd = host->sys->hmd;
 
@@ -959,14 +1189,13 @@ static void xrsp_handle_echo(struct ql_xrsp_host *host, struct ql_xrsp_hostinfo_
 
         //QUEST_LINK_INFO("Ping get: org=%zx recv=%zx xmt=%zx offs=%zx", payload->org, payload->recv, payload->xmt, payload->offset);
 
-        int32_t request_echo_ping_len = 0;
+        uint8_t request_echo_ping[0x40];
         int64_t send_xmt = xrsp_ts_ns(host);
-        uint8_t* request_echo_ping = ql_xrsp_craft_echo(ECHO_PONG, pkt->unk_4, host->last_xmt, pkt->recv_ns, send_xmt, host->ns_offset, &request_echo_ping_len);
+        int32_t request_echo_ping_len = ql_xrsp_craft_echo_into(request_echo_ping, sizeof(request_echo_ping), ECHO_PONG, pkt->unk_4, host->last_xmt, pkt->recv_ns, send_xmt, host->ns_offset);
 
         //QUEST_LINK_INFO("Pong sent: org=%zx recv=%zx xmt=%zx offs=%zx", host->last_xmt, pkt->recv_ns, send_xmt, host->ns_offset);
 
         xrsp_send_to_topic(host, TOPIC_HOSTINFO_ADV, request_echo_ping, request_echo_ping_len);
-        free(request_echo_ping);
 
         if (host->pairing_state == PAIRINGSTATE_PAIRED) {
             xrsp_send_ping(host);
@@ -1068,10 +1297,9 @@ static void xrsp_handle_invite(struct ql_xrsp_host *host, struct ql_xrsp_hostinf
     }
 }
 
-static void xrsp_handle_hostinfo_adv(struct ql_xrsp_host *host)
+static void xrsp_handle_hostinfo_adv(struct ql_xrsp_host *host, struct ql_xrsp_topic_pkt* pkt)
 {
     int ret;
-    struct ql_xrsp_topic_pkt* pkt = &host->working_pkt;
 
     struct ql_xrsp_hostinfo_pkt hostinfo;
     ret = ql_xrsp_hostinfo_pkt_create(&hostinfo, pkt, host);
@@ -1128,15 +1356,14 @@ static void xrsp_handle_hostinfo_adv(struct ql_xrsp_host *host)
     }   
 }
 
-static void xrsp_handle_pkt(struct ql_xrsp_host *host)
+static void xrsp_handle_pkt(struct ql_xrsp_host *host, struct ql_xrsp_topic_pkt* pkt)
 {
-    struct ql_xrsp_topic_pkt* pkt = &host->working_pkt;
 
     ql_xrsp_topic_pkt_dump(pkt);
 
     if (pkt->topic == TOPIC_HOSTINFO_ADV)
     {
-        xrsp_handle_hostinfo_adv(host);
+        xrsp_handle_hostinfo_adv(host, pkt);
     }
     else if (pkt->topic == TOPIC_POSE)
     {
@@ -1174,111 +1401,43 @@ static void xrsp_handle_pkt(struct ql_xrsp_host *host)
     }
 }
 
-static bool xrsp_read_usb(struct ql_xrsp_host *host)
+static void xrsp_handle_pkt_cb(void *ptr, struct ql_xrsp_topic_pkt* pkt)
 {
-    int ret;
-
-    if (!host->usb_valid) return false;
-
-    while (true)
-    {
-        unsigned char data[0x400];
-        int32_t data_consumed = 0;
-
-        int amt_to_read = 0x400;
-        if (host->have_working_pkt) {
-            amt_to_read = 0x400;
-        }
-
-        int read_len = 0;
-        int r = libusb_bulk_transfer(host->dev, host->ep_in, data, amt_to_read, &read_len, 1);
-        if (r != 0 || !read_len) {
-            if (r != LIBUSB_ERROR_TIMEOUT) {
-                QUEST_LINK_ERROR("libusb error: %s", libusb_strerror((libusb_error)r));
-            }
-
-            if (r == LIBUSB_ERROR_NO_DEVICE) {
-                ql_xrsp_usb_init(host, true);
-            }
-            break;
-        }
-
-        if (read_len) {
-            host->last_read_ns = xrsp_ts_ns(host);
-        }
-
-        //QUEST_LINK_INFO("Read %x bytes", read_len);
-        //hex_dump(data, read_len);
+    struct ql_xrsp_host *host = (struct ql_xrsp_host *)ptr;
 
-        if (!host->have_working_pkt) {
-            ret = ql_xrsp_topic_pkt_create(&host->working_pkt, data, read_len, host->last_read_ns);
-            if (ret < 0) {
-                // TODO
-                data_consumed += 0x8;
-                host->have_working_pkt = false;
-            }
-            else {
-                data_consumed += ret;
-                host->have_working_pkt = true;
-            }
-        }
-        else if (host->working_pkt.missing_bytes == 0) {
-            try {
-                xrsp_handle_pkt(host);
-            }
-            catch(...) {
-                QUEST_LINK_ERROR("Exception while parsing packet...");
-            }
-            
+    try {
+        xrsp_handle_pkt(host, pkt);
+    }
+    catch(...) {
+        QUEST_LINK_ERROR("Exception while parsing packet...");
+    }
+}
 
-            QUEST_LINK_INFO("Is remaining data possible?");
+static void xrsp_parse_usb(void *ptr, const uint8_t* data, int32_t read_len)
+{
+    struct ql_xrsp_host *host = (struct ql_xrsp_host *)ptr;
 
-            int32_t remaining_data = read_len - data_consumed;
-        }
-        else {
-            ret = ql_xrsp_topic_pkt_append(&host->working_pkt, data, read_len);
-            if (ret < 0) {
-                // TODO
-                data_consumed += 0x8;
-                host->have_working_pkt = false;
-            }
-            else {
-                data_consumed += ret;
-            }
-        }
+    if (read_len) {
+        host->last_read_ns = xrsp_ts_ns(host);
+    }
 
-        while (host->have_working_pkt) {
-            if (host->working_pkt.missing_bytes == 0) {
-                xrsp_handle_pkt(host);
-                ql_xrsp_topic_pkt_destroy(&host->working_pkt);
-                host->have_working_pkt = false;
-            }
+    //QUEST_LINK_INFO("Read %x bytes", read_len);
+    //hex_dump(data, read_len);
 
-            int32_t remaining_data = read_len - data_consumed;
-            if (remaining_data <= 0) {
-                break;
-            }
+    ql_xrsp_topic_stream_feed(&host->rx_stream, data, read_len, host->last_read_ns, xrsp_handle_pkt_cb, host);
+}
 
-            if (remaining_data > 0 && remaining_data < 8) {
-                hex_dump(&data[data_consumed], read_len-data_consumed);
-                ql_xrsp_topic_pkt_destroy(&host->working_pkt);
-                host->have_working_pkt = false;
-            }
-            else if (remaining_data > 0) {
-                ret = ql_xrsp_topic_pkt_create(&host->working_pkt, &data[data_consumed], remaining_data, host->last_read_ns);
-                if (ret < 0) {
-                    // TODO
-                    data_consumed += 0x8;
-                    host->have_working_pkt = false;
-                }
-                else {
-                    data_consumed += ret;
-                    host->have_working_pkt = true;
-                }
-            }
+static bool xrsp_read_usb(struct ql_xrsp_host *host)
+{
+    // Wakes up as soon as an IN transfer completes, there is no polling.
+    int r = ql_xrsp_usb_engine_read(&host->usb, 100 * U_TIME_1MS_IN_NS, xrsp_parse_usb, host);
+    if (r < 0) {
+        if (r == QL_XRSP_USB_NO_DEVICE) {
+            ql_xrsp_usb_init(host, true);
         }
+        return false;
     }
-    
+
     return true;
 }
 
@@ -1325,8 +1484,8 @@ static void xrsp_send_mesh(struct ql_xrsp_host *host)
 // TODO: figure out the params
 static void xrsp_send_audio_control(struct ql_xrsp_host *host, uint16_t a, uint16_t b, uint32_t c, float d, float e)
 {
-    ::capnp::MallocMessageBuilder message;
-    PayloadAudioControl::Builder msg = message.initRoot<PayloadAudioControl>();
+    ql_xrsp_capnp_msg message(host, TOPIC_AUDIO_CONTROL);
+    PayloadAudioControl::Builder msg = message.builder().initRoot<PayloadAudioControl>();
 
     msg.setDataUnk0(a);
     msg.setDataUnk1(b);
@@ -1334,15 +1493,14 @@ static void xrsp_send_audio_control(struct ql_xrsp_host *host, uint16_t a, uint1
     msg.setDataUnk3(d);
     msg.setDataUnk4(e);
 
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
-    xrsp_send_to_topic_capnp_segments(host, TOPIC_AUDIO_CONTROL, 0, out);
+    xrsp_queue_to_topic_capnp_segments(host, TOPIC_AUDIO_CONTROL, 0, message.segments());
 }
 
 // TODO: figure out the params
 static void xrsp_send_input_control(struct ql_xrsp_host *host, uint16_t a, uint16_t b, uint32_t c, float d, float e)
 {
-    ::capnp::MallocMessageBuilder message;
-    PayloadAudioControl::Builder msg = message.initRoot<PayloadAudioControl>();
+    ql_xrsp_capnp_msg message(host, TOPIC_INPUT_CONTROL);
+    PayloadAudioControl::Builder msg = message.builder().initRoot<PayloadAudioControl>();
 
     msg.setDataUnk0(a);
     msg.setDataUnk1(b);
@@ -1350,8 +1508,7 @@ static void xrsp_send_input_control(struct ql_xrsp_host *host, uint16_t a, uint1
     msg.setDataUnk3(d);
     msg.setDataUnk4(e);
 
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
-    xrsp_send_to_topic_capnp_segments(host, TOPIC_INPUT_CONTROL, 0, out);
+    xrsp_queue_to_topic_capnp_segments(host, TOPIC_INPUT_CONTROL, 0, message.segments());
 }
 
 // TODO: get this to work lol (is it possible for it to work...?)
@@ -1360,8 +1517,8 @@ static void xrsp_send_buffered_haptic(struct ql_xrsp_host *host, int64_t ts, ovr
     if (host->pairing_state != PAIRINGSTATE_PAIRED || !host->ready_to_send_frames) {
         return;
     }
-    ::capnp::MallocMessageBuilder message;
-    PayloadHaptics::Builder msg = message.initRoot<PayloadHaptics>();
+    ql_xrsp_capnp_msg message(host, TOPIC_HAPTIC);
+    PayloadHaptics::Builder msg = message.builder().initRoot<PayloadHaptics>();
 
     msg.setTimestamp(ts); // TODO: idk what this timestamp is?
     msg.setInputType(controller_id);
@@ -1371,18 +1528,13 @@ static void xrsp_send_buffered_haptic(struct ql_xrsp_host *host, int64_t ts, ovr
     msg.setAmplitude(1.0); // TODO idk if this is set for buffered
     msg.setPoseTimestamp(ts); // Timestamp identical to poseTimestamp in Slice, sometimes 0 if hapticType is simple?
 
-    uint8_t* test_data = (uint8_t*)malloc(0x20);
-    memset(test_data, 0xFF, 0x20);
-    for (int i = 0; i < 0x20; i += 1) {
-        test_data[i] = 0xFF;
-    }
+    uint8_t test_data[0x20];
+    memset(test_data, 0xFF, sizeof(test_data));
     
     // TODO where is this maximum defined? It seems hardcoded in XRSP tho.
     msg.setData(kj::arrayPtr(test_data, 0x19));
 
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
-    xrsp_send_to_topic_capnp_segments(host, TOPIC_HAPTIC, 0, out);
-    free(test_data);
+    xrsp_queue_to_topic_capnp_segments(host, TOPIC_HAPTIC, 0, message.segments());
 }
 
 void xrsp_send_simple_haptic(struct ql_xrsp_host *host, int64_t ts, ovr_haptic_target_t controller_id, float amplitude)
@@ -1390,8 +1542,8 @@ void xrsp_send_simple_haptic(struct ql_xrsp_host *host, int64_t ts, ovr_haptic_t
     if (host->pairing_state != PAIRINGSTATE_PAIRED || !host->ready_to_send_frames) {
         return;
     }
-    ::capnp::MallocMessageBuilder message;
-    PayloadHaptics::Builder msg = message.initRoot<PayloadHaptics>();
+    ql_xrsp_capnp_msg message(host, TOPIC_HAPTIC);
+    PayloadHaptics::Builder msg = message.builder().initRoot<PayloadHaptics>();
 
     msg.setTimestamp(ts);
     msg.setInputType(controller_id);
@@ -1401,13 +1553,44 @@ void xrsp_send_simple_haptic(struct ql_xrsp_host *host, int64_t ts, ovr_haptic_t
     msg.setAmplitude(amplitude);
     msg.setPoseTimestamp(0);
     
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
-    xrsp_send_to_topic_capnp_segments(host, TOPIC_HAPTIC, 0, out);
+    xrsp_queue_to_topic_capnp_segments(host, TOPIC_HAPTIC, 0, message.segments());
+}
+
+// Per slice encode, queue and transmit times on the QL tracks, see u_trace_marker.h.
+static void xrsp_trace_slice(struct ql_xrsp_host *host, int read_index, int frame_idx)
+{
+#ifdef U_TRACE_PERCETTO // Uses Percetto specific things.
+    if (!U_TRACE_CATEGORY_IS_ENABLED(timing)) {
+        return;
+    }
+
+#define TE_BEG(TRACK, TIME, NAME) U_TRACE_EVENT_BEGIN_ON_TRACK_DATA(timing, TRACK, TIME, NAME, PERCETTO_I(frame_idx))
+#define TE_END(TRACK, TIME) U_TRACE_EVENT_END_ON_TRACK(timing, TRACK, TIME)
+
+    TE_BEG(ql_encode, host->encode_started_ns[read_index], "encode");
+    TE_END(ql_encode, host->encode_done_ns[read_index]);
+
+    TE_BEG(ql_queue, host->encode_done_ns[read_index], "queue");
+    TE_END(ql_queue, host->tx_started_ns[read_index]);
+
+    TE_BEG(ql_tx, host->tx_started_ns[read_index], "tx");
+    TE_END(ql_tx, host->tx_done_ns[read_index]);
+
+#undef TE_BEG
+#undef TE_END
+#else
+    (void)host;
+    (void)read_index;
+    (void)frame_idx;
+#endif
 }
 
-static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx, int frame_idx, int64_t frame_started_ns, const uint8_t* csd_dat, size_t csd_len,
-                            const uint8_t* video_dat, size_t video_len, int blit_y_pos)
+static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx, int frame_idx, int64_t frame_started_ns, struct ql_xrsp_tx_buf* csd,
+                            struct ql_xrsp_tx_buf* video, int blit_y_pos)
 {
+    size_t csd_len = csd->payload_len;
+    size_t video_len = video->payload_len;
+
     int64_t sending_pose_ns = host->stream_pose_ns[QL_IDX_SLICE(0, index)];
     int read_index = QL_IDX_SLICE(slice_idx, index);
 
@@ -1420,8 +1603,8 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
         return;
     }
 
-    ::capnp::MallocMessageBuilder message;
-    PayloadSlice::Builder msg = message.initRoot<PayloadSlice>();
+    ql_xrsp_capnp_msg message(host, TOPIC_SLICE_0+slice_idx);
+    PayloadSlice::Builder msg = message.builder().initRoot<PayloadSlice>();
 
     struct ql_hmd* hmd = host->sys->hmd;
 
@@ -1468,7 +1651,7 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
     msg.setPoseZ(sending_pose.position.z);
 
     // TODO this might include render time?
-    uint64_t pipeline_pred_delta_ma = host->encode_done_ns[QL_IDX_SLICE(slice_idx, index)] - host->encode_started_ns[QL_IDX_SLICE(0, index)];//2916100;
+    uint64_t pipeline_pred_delta_ma = xrsp_slice_pipeline_ns(host, index, slice_idx);//2916100;
     //uint64_t pipeline_pred_delta_ma = 0;
     //QUEST_LINK_INFO("%llu", pipeline_pred_delta_ma);
 
@@ -1476,7 +1659,7 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
     uint64_t duration_a = (uint64_t)(1000000000.0/hmd->fps) /*+ 9116997*/; // 9ms this might also include the slice 0 pipeline_pred_delta_ma, but we don't include render time yet?
     uint64_t duration_c = pipeline_pred_delta_ma; // 4ms
     uint64_t duration_b = duration_a+duration_c; // 14ms
-    uint64_t base_ts = xrsp_ts_ns_to_target(host, host->encode_started_ns[QL_IDX_SLICE(0, index)]);
+    uint64_t base_ts = xrsp_ts_ns_to_target(host, host->encode_dispatched_ns[index]);
     uint64_t tx_start_ts = host->tx_started_ns[QL_IDX_SLICE(0, index)];
 
     // all timestamps are all the same between different slices, only pipeline_pred_delta_ma changes
@@ -1540,7 +1723,7 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
     msg.setTimestamp09(xrsp_ts_ns_to_target(host, tx_start_ts)-pipeline_pred_delta_ma);// transmission start
     msg.setUnkA(pipeline_pred_delta_ma); // pipeline prediction delta MA?
     msg.setTimestamp0B(base_ts+duration_a+duration_b+duration_c); // unknown
-    msg.setTimestamp0C(base_ts+duration_a+duration_b); // deadline
+    msg.setTimestamp0C(xrsp_ts_ns_to_target(host, host->deadline_ns[read_index])); // deadline, base_ts+duration_a+duration_b
     msg.setTimestamp0D(base_ts+duration_a); // unknown
     //QUEST_LINK_INFO("%x", host->ns_offset);
 
@@ -1559,7 +1742,7 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
     msg.setCsdSize(csd_len);
     msg.setVideoSize(video_len);
 
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
+    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.segments();
 
     // The first frame of every session *must* be a keyframe with a CSD.
     int should_send = 1;
@@ -1568,14 +1751,21 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
         should_send = 0;
     }
 
+    struct ql_xrsp_tx_buf* preamble = &host->preamble_stream[read_index];
+    struct ql_xrsp_tx_buf* hdr = &host->hdr_stream[read_index];
+    ql_xrsp_tx_buf_reset(preamble);
+    ql_xrsp_tx_buf_reset(hdr);
+    if (!xrsp_tx_buf_append_capnp(preamble, hdr, 0, out)) {
+        QUEST_LINK_WARN("Dropping slice %x, header does not fit", slice_idx);
+        should_send = 0;
+    }
+
     if (should_send)
     {
-        xrsp_send_to_topic_capnp_segments(host, TOPIC_SLICE_0+slice_idx, 0, out);
-            
-        if (csd_len)
-            xrsp_send_to_topic(host, TOPIC_SLICE_0+slice_idx, csd_dat, csd_len);
-            
-        xrsp_send_to_topic(host, TOPIC_SLICE_0+slice_idx, video_dat, video_len);
+        // Preamble, header, CSD and video in one go, each buffer starts a
+        // new topic packet and an empty CSD is skipped.
+        struct ql_xrsp_tx_buf* bufs[4] = {preamble, hdr, csd, video};
+        xrsp_send_tx_bufs(host, TOPIC_SLICE_0+slice_idx, bufs, 4);
 
         host->sent_first_frame = true;
     }
@@ -1586,6 +1776,8 @@ static void xrsp_send_video(struct ql_xrsp_host *host, int index, int slice_idx,
     int64_t ts_diff = ts_after - ts_before;
     host->tx_duration_ns[read_index] = ts_diff;
 
+    xrsp_trace_slice(host, read_index, frame_idx);
+
     // TODO: ehhhhh    
     xrsp_ripc_void_bool_cmd(host, host->client_id, "EnableEyeTrackingForPCLink"); 
     //xrsp_ripc_void_bool_cmd(host, host->client_id, "EnableFaceTrackingForPCLink");
@@ -1613,9 +1805,6 @@ ql_xrsp_read_thread(void *ptr)
         xrsp_read_usb(host); 
         
         os_thread_helper_lock(&host->read_thread);
-        if (os_thread_helper_is_running_locked(&host->read_thread)) {
-            os_nanosleep(U_TIME_1MS_IN_NS / 10);
-        }
     }
     os_thread_helper_unlock(&host->read_thread);
 
@@ -1624,72 +1813,86 @@ ql_xrsp_read_thread(void *ptr)
     return NULL;
 }
 
+/*
+ * Send one encoded slice, returns false if none is ready.
+ *
+ * Slices of a swapchain image go out in order as soon as each is flushed, so
+ * slice k is on the wire while k+1 is still encoding. Between images the one
+ * with the earliest deadline goes first.
+ */
+static bool xrsp_send_next_slice(struct ql_xrsp_host *host)
+{
+    int64_t deadline_ns = 0x7FFFFFFFFFFFFFFF;
+    int to_send = -1;
+    for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
+    {
+        int full_idx = QL_IDX_SLICE(host->next_slice[i], i);
+        os_mutex_lock(&host->stream_mutex[full_idx]);
+        if (host->needs_flush[full_idx] && host->deadline_ns[full_idx] < deadline_ns) {
+            deadline_ns = host->deadline_ns[full_idx];
+            to_send = i;
+        }
+        os_mutex_unlock(&host->stream_mutex[full_idx]);
+    }
+
+    if (to_send < 0) {
+        return false;
+    }
+
+    int slice = host->next_slice[to_send];
+    int to_send_idx = QL_IDX_SLICE(slice, to_send);
+
+    // The frame index is taken when the first slice of an image goes out.
+    if (!slice) {
+        host->stream_frame_idx[to_send] = host->frame_idx++;
+    }
+
+    os_mutex_lock(&host->stream_mutex[to_send_idx]);
+    //QUEST_LINK_INFO("Flush: %x %x", slice, to_send);
+
+    if (host->csd_stream[to_send_idx].payload_len || host->idr_stream[to_send_idx].payload_len)
+        xrsp_send_video(host, to_send, slice, host->stream_frame_idx[to_send], host->stream_started_ns[QL_IDX_SLICE(0, to_send)], &host->csd_stream[to_send_idx], &host->idr_stream[to_send_idx], 0);
+
+    if (!slice)
+        host->frame_sent_ns = xrsp_ts_ns(host);
+
+    ql_xrsp_tx_buf_reset(&host->csd_stream[to_send_idx]);
+    ql_xrsp_tx_buf_reset(&host->idr_stream[to_send_idx]);
+    host->needs_flush[to_send_idx] = false;
+
+    os_mutex_unlock(&host->stream_mutex[to_send_idx]);
+
+    host->next_slice[to_send] = (slice + 1) % QL_NUM_SLICES;
+
+    return true;
+}
+
 static void *
 ql_xrsp_write_thread(void *ptr)
 {
     DRV_TRACE_MARKER();
 
     struct ql_xrsp_host *host = (struct ql_xrsp_host *)ptr;
+    uint64_t last_ctrl_allocs = 0;
 
     os_thread_helper_lock(&host->write_thread);
     while (os_thread_helper_is_running_locked(&host->write_thread)) {
         os_thread_helper_unlock(&host->write_thread);
 
-        
+        // Woken as soon as a slice is flushed, the timeout drives the checks below.
+        os_semaphore_wait(&host->tx_sem, U_TIME_1MS_IN_NS);
 
-        int64_t present_ns = 0x7FFFFFFFFFFFFFFF;
-        int to_present = -1;
-        for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
-        {
-            bool all_slices_present = true;
-            for (int j = 0; j < QL_NUM_SLICES; j++)
-            {
-                int full_idx = QL_IDX_SLICE(j, i);
-                os_mutex_lock(&host->stream_mutex[full_idx]);
-                //QUEST_LINK_INFO("%x %zx %zx", host->needs_flush[i], host->stream_started_ns[i], present_ns);
-                if (!host->needs_flush[full_idx]) {
-                    all_slices_present = false;
-                }
-                os_mutex_unlock(&host->stream_mutex[full_idx]);
-            }
-
-            int first_idx = QL_IDX_SLICE(0, i);
-            os_mutex_lock(&host->stream_mutex[first_idx]);
-            //QUEST_LINK_INFO("%x %zx %zx", host->needs_flush[i], host->stream_started_ns[i], present_ns);
-            if (all_slices_present && host->stream_started_ns[first_idx] < present_ns) {
-                present_ns = host->stream_started_ns[first_idx];
-                to_present = i;
-            }
-            os_mutex_unlock(&host->stream_mutex[first_idx]);
-        }
-
-        // TODO: merge frames together if needed
-        if (to_present >= 0) { //  && (xrsp_ts_ns(host) - host->frame_sent_ns) >= 13890000
-            
-            for (int slice = 0; slice < QL_NUM_SLICES; slice++)
-            {
-                int to_present_idx = QL_IDX_SLICE(slice, to_present);
-                os_mutex_lock(&host->stream_mutex[to_present_idx]);
-                //QUEST_LINK_INFO("Flush: %x %x", slice, to_present);
-                
-                if (host->csd_stream_len[to_present_idx] || host->idr_stream_len[to_present_idx])
-                    xrsp_send_video(host, to_present, slice, host->frame_idx, present_ns, (const uint8_t*)host->csd_stream[to_present_idx], host->csd_stream_len[to_present_idx], (const uint8_t*)host->idr_stream[to_present_idx], host->idr_stream_len[to_present_idx], 0);
-    
-                if (!slice)
-                    host->frame_sent_ns = xrsp_ts_ns(host);
+        while (xrsp_send_next_slice(host)) {}
 
-                host->csd_stream_len[to_present_idx] = 0;
-                host->idr_stream_len[to_present_idx] = 0;
-                host->needs_flush[to_present_idx] = false;
+        // Control messages queued while encoding, including the RIPC command of every slice.
+        xrsp_flush_ctrl_batch(host);
 
-                //QUEST_LINK_INFO("Flush: %x", host->stream_read_idx);
-                os_mutex_unlock(&host->stream_mutex[to_present_idx]);
-            }
-            host->frame_idx++;
+        uint64_t num_ctrl_allocs = __atomic_load_n(&host->num_ctrl_allocs, __ATOMIC_RELAXED);
+        if (num_ctrl_allocs != last_ctrl_allocs) {
+            QUEST_LINK_WARN("Control messages outgrew their scratch arenas, %llu allocations so far", (unsigned long long)num_ctrl_allocs);
+            last_ctrl_allocs = num_ctrl_allocs;
         }
 
-        
-
         //QUEST_LINK_INFO("%zx", xrsp_ts_ns(host) - host->paired_ns);
         if (xrsp_ts_ns(host) - host->paired_ns > 1000000000 && host->pairing_state == PAIRINGSTATE_PAIRED && !host->ready_to_send_frames) // && xrsp_ts_ns(host) - host->frame_sent_ns >= 16000000
         {
@@ -1698,10 +1901,14 @@ ql_xrsp_write_thread(void *ptr)
 
             for (int i = 0; i < QL_NUM_SLICES*QL_SWAPCHAIN_DEPTH; i++)
             {
-                host->csd_stream_len[i] = 0;
-                host->idr_stream_len[i] = 0;
+                ql_xrsp_tx_buf_reset(&host->csd_stream[i]);
+                ql_xrsp_tx_buf_reset(&host->idr_stream[i]);
                 host->needs_flush[i] = false;
             }
+            for (int i = 0; i < QL_SWAPCHAIN_DEPTH; i++)
+            {
+                host->next_slice[i] = 0;
+            }
         }
 
         //QUEST_LINK_INFO("%zx", xrsp_ts_ns(host) - host->last_read_ns);
@@ -1722,10 +1929,6 @@ ql_xrsp_write_thread(void *ptr)
         }
 
         os_thread_helper_lock(&host->write_thread);
-
-        if (os_thread_helper_is_running_locked(&host->write_thread)) {
-            os_nanosleep(U_TIME_1MS_IN_NS);
-        }
     }
     os_thread_helper_unlock(&host->write_thread);
 
@@ -0,0 +1,72 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link capnp messages built in per topic scratch arenas.
+ * @ingroup drv_quest_link
+ *
+ * A capnp::MallocMessageBuilder can't be reset, so each message constructs
+ * one in place over the zeroed scratch of its topic. Nothing is allocated as
+ * long as the message fits the scratch, the builder zeroes the used part of
+ * it again when it is destroyed so the next message can reuse it.
+ */
+
+#pragma once
+
+#include <optional>
+
+#include <capnp/message.h>
+
+#include "os/os_threading.h"
+
+#include "ql_types.h"
+
+/*!
+ * Holds the scratch arena of @p topic until it goes out of scope, so at most
+ * one message per topic is being built at a time.
+ */
+class ql_xrsp_capnp_msg
+{
+public:
+    ql_xrsp_capnp_msg(struct ql_xrsp_host *host, uint8_t topic)
+        : host(host), arena(&host->capnp_arenas[topic % QL_CAPNP_NUM_TOPICS])
+    {
+        os_mutex_lock(&arena->mutex);
+        message.emplace(kj::arrayPtr((capnp::word *)arena->words, QL_CAPNP_SCRATCH_WORDS),
+                        capnp::SUGGESTED_ALLOCATION_STRATEGY);
+    }
+
+    ~ql_xrsp_capnp_msg()
+    {
+        // Every segment but the scratch came from the heap, that is all of
+        // them when the first allocation was already too big for the scratch.
+        uint64_t num_allocs = 0;
+        for (auto segment : message->getSegmentsForOutput())
+        {
+            if (segment.begin() != (const capnp::word *)arena->words) {
+                num_allocs++;
+            }
+        }
+        if (num_allocs) {
+            __atomic_add_fetch(&host->num_ctrl_allocs, num_allocs, __ATOMIC_RELAXED);
+        }
+
+        message.reset();
+        os_mutex_unlock(&arena->mutex);
+    }
+
+    ql_xrsp_capnp_msg(const ql_xrsp_capnp_msg &) = delete;
+    ql_xrsp_capnp_msg &operator=(const ql_xrsp_capnp_msg &) = delete;
+
+    capnp::MessageBuilder &builder() { return *message; }
+
+    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments() { return message->getSegmentsForOutput(); }
+
+private:
+    struct ql_xrsp_host *host;
+    struct ql_xrsp_capnp_arena *arena;
+    std::optional<capnp::MallocMessageBuilder> message;
+};
+
+//! Queue a capnp message on the control batch, laid out like xrsp_send_to_topic_capnp_segments.
+void xrsp_queue_to_topic_capnp_segments(struct ql_xrsp_host *host, uint8_t topic, uint32_t idx, kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> data);
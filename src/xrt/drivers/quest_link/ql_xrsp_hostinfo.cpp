@@ -115,6 +115,27 @@ uint8_t* ql_xrsp_craft(uint8_t message_type, uint16_t result, uint32_t stream_si
 {
     int32_t total_size = sizeof(xrsp_hostinfo_header) + payload_size;
     uint8_t* out = (uint8_t*)malloc(total_size);
+
+    ql_xrsp_craft_into(out, total_size, message_type, result, stream_size, unk_4, payload, payload_size);
+    
+    if (out_len) {
+        *out_len = total_size;
+    }
+    return out;
+}
+
+int32_t ql_xrsp_craft_echo_into(uint8_t* out, size_t out_size, uint16_t result, uint32_t echo_id, int64_t org, int64_t recv, int64_t xmt, int64_t offset)
+{
+    ql_xrsp_echo_payload payload = {org, recv, xmt, offset};
+    return ql_xrsp_craft_into(out, out_size, BUILTIN_ECHO, result, sizeof(payload) + 8, echo_id, (const uint8_t*)&payload, sizeof(payload));
+}
+
+int32_t ql_xrsp_craft_into(uint8_t* out, size_t out_size, uint8_t message_type, uint16_t result, uint32_t stream_size, uint32_t unk_4, const uint8_t* payload, size_t payload_size)
+{
+    int32_t total_size = sizeof(xrsp_hostinfo_header) + payload_size;
+    if ((size_t)total_size > out_size) {
+        return -1;
+    }
     memset(out, 0, total_size);
 
     xrsp_hostinfo_header* header = (xrsp_hostinfo_header*)out;
@@ -126,9 +147,6 @@ uint8_t* ql_xrsp_craft(uint8_t message_type, uint16_t result, uint32_t stream_si
     if (payload) {
         memcpy(header+1, payload, payload_size);
     }
-    
-    if (out_len) {
-        *out_len = total_size;
-    }
-    return out;
-}
\ No newline at end of file
+
+    return total_size;
+}
@@ -29,6 +29,10 @@ uint8_t* ql_xrsp_craft_basic(uint8_t message_type, uint16_t result, uint32_t unk
 uint8_t* ql_xrsp_craft_capnp(uint8_t message_type, uint16_t result, uint32_t unk_4, const uint8_t* payload, size_t payload_size, int32_t* out_len);
 uint8_t* ql_xrsp_craft(uint8_t message_type, uint16_t result, uint32_t stream_size, uint32_t unk_4, const uint8_t* payload, size_t payload_size, int32_t* out_len);
 
+// Same as the above but written to @p out, returns the length or -1 if it doesn't fit.
+int32_t ql_xrsp_craft_echo_into(uint8_t* out, size_t out_size, uint16_t result, uint32_t echo_id, int64_t org, int64_t recv, int64_t xmt, int64_t offset);
+int32_t ql_xrsp_craft_into(uint8_t* out, size_t out_size, uint8_t message_type, uint16_t result, uint32_t stream_size, uint32_t unk_4, const uint8_t* payload, size_t payload_size);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include <capnp/message.h>
 #include <capnp/serialize-packed.h>
 #include "protos/RuntimeIPC.capnp.h"
+#include "ql_xrsp_capnp.h"
 
 extern "C"
 {
@@ -535,8 +536,8 @@ typedef struct ripc_capnp
 void xrsp_send_ripc_cmd(struct ql_xrsp_host* host, uint32_t cmd_idx, uint32_t client_id, uint32_t unk, const uint8_t* data, int32_t data_size, const uint8_t* extra_data, int32_t extra_data_size)
 {
 
-    ::capnp::MallocMessageBuilder message;
-    PayloadRuntimeIPC::Builder msg = message.initRoot<PayloadRuntimeIPC>();
+    ql_xrsp_capnp_msg message(host, TOPIC_RUNTIME_IPC);
+    PayloadRuntimeIPC::Builder msg = message.builder().initRoot<PayloadRuntimeIPC>();
 
     msg.setCmdId(cmd_idx);
     msg.setNextSize(data_size);
@@ -546,13 +547,9 @@ void xrsp_send_ripc_cmd(struct ql_xrsp_host* host, uint32_t cmd_idx, uint32_t cl
         msg.setData(kj::arrayPtr(extra_data, extra_data_size));
     }
 
-    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> out = message.getSegmentsForOutput();
-
-    uint8_t* packed_data = (uint8_t*)out[0].begin();
-    size_t packed_data_size = out[0].size()*sizeof(uint64_t);
-
-    xrsp_send_to_topic_capnp_wrapped(host, TOPIC_RUNTIME_IPC, 0, packed_data, packed_data_size);
-    xrsp_send_to_topic(host, TOPIC_RUNTIME_IPC, data, data_size);
+    // Sent once per slice, both parts go out with the next control batch.
+    xrsp_queue_to_topic_capnp_segments(host, TOPIC_RUNTIME_IPC, 0, message.segments());
+    xrsp_queue_to_topic(host, TOPIC_RUNTIME_IPC, data, data_size);
 }
 
 void xrsp_ripc_ensure_service_started(struct ql_xrsp_host* host, uint32_t client_id, const char* package_name, const char* service_component_name)
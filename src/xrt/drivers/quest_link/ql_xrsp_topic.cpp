@@ -10,84 +10,154 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "ql_xrsp_topic.h"
 #include "ql_xrsp_types.h"
 #include "ql_types.h"
 #include "ql_utils.h"
 
-int32_t ql_xrsp_topic_pkt_create(struct ql_xrsp_topic_pkt* pkt, uint8_t* p_initial, int32_t initial_size, int64_t recv_ns)
+// Returns the size of the packet @p p starts with, or 0 if the header is bogus.
+static uint32_t topic_pkt_size(const uint8_t* p)
 {
-    *pkt = (struct ql_xrsp_topic_pkt){0};
+    xrsp_topic_header header;
+    memcpy(&header, p, sizeof(header));
 
-    if (initial_size < sizeof(xrsp_topic_header)) {
-        return -1;
-    }
-
-    xrsp_topic_header* header = (xrsp_topic_header*)p_initial;
-
-    pkt->recv_ns = recv_ns;
-    pkt->has_alignment_padding = header->has_alignment_padding;
-    pkt->packet_version_is_internal = header->packet_version_is_internal;
-    pkt->packet_version_number = header->packet_version_number;
-    pkt->topic = header->topic;
-    pkt->num_words = header->num_words;
-    pkt->sequence_num = header->sequence_num;
-
-    if ((pkt->num_words == 0 && pkt->topic == 0 && pkt->sequence_num == 0)
-        || (pkt->topic > TOPIC_LOGGING)
-        || (pkt->topic == TOPIC_AUI4A_ADV && pkt->num_words == 0xFFFF))
+    if ((header.num_words == 0)
+        || (header.topic > TOPIC_LOGGING)
+        || (header.topic == TOPIC_AUI4A_ADV && header.num_words == 0xFFFF))
     {
-        pkt->payload_size = 0;
-        pkt->payload = NULL;
-        pkt->remainder_offs = 0;
-        pkt->payload_valid = 0;
+        return 0;
+    }
 
-        return -1;
+    return sizeof(xrsp_topic_header) + (header.num_words - 1) * sizeof(uint32_t);
+}
 
+static void topic_pkt_emit(struct ql_xrsp_topic_stream* stream, const uint8_t* p, uint32_t size, int64_t recv_ns,
+                           ql_xrsp_topic_pkt_cb_t cb, void* ptr)
+{
+    xrsp_topic_header header;
+    memcpy(&header, p, sizeof(header));
+
+    struct ql_xrsp_topic_pkt pkt = {0};
+    pkt.recv_ns = recv_ns;
+    pkt.has_alignment_padding = header.has_alignment_padding;
+    pkt.packet_version_is_internal = header.packet_version_is_internal;
+    pkt.packet_version_number = header.packet_version_number;
+    pkt.topic = header.topic;
+    pkt.num_words = header.num_words;
+    pkt.sequence_num = header.sequence_num;
+
+    pkt.payload = (uint8_t*)p + sizeof(xrsp_topic_header);
+    pkt.payload_size = size - sizeof(xrsp_topic_header);
+
+    // The last padding byte holds the amount of padding.
+    if (pkt.has_alignment_padding && pkt.payload_size) {
+        uint8_t pad = pkt.payload[pkt.payload_size - 1];
+        pkt.payload_size -= pad <= pkt.payload_size ? pad : pkt.payload_size;
     }
+    pkt.payload_valid = pkt.payload_size;
 
-    pkt->payload_size = (pkt->num_words - 1) * sizeof(uint32_t);
-    pkt->payload = (uint8_t*)malloc(pkt->payload_size);
-    pkt->remainder_offs = sizeof(xrsp_topic_header) + pkt->payload_size;
-
-    int32_t initial_size_no_header = initial_size - sizeof(xrsp_topic_header);
-    int32_t consumed = initial_size_no_header < pkt->payload_size ? initial_size_no_header : pkt->payload_size;
-    memcpy(pkt->payload, p_initial + sizeof(xrsp_topic_header), consumed);
-    pkt->payload_valid = consumed;
+    stream->num_pkts++;
+    cb(ptr, &pkt);
+}
 
-    // Adjust for alignment padding
-    if (pkt->has_alignment_padding && initial_size >= pkt->payload_size) {
-        pkt->payload_size -= p_initial[pkt->payload_size-1];
-    }
+int ql_xrsp_topic_stream_init(struct ql_xrsp_topic_stream* stream)
+{
+    *stream = (struct ql_xrsp_topic_stream){0};
 
-    pkt->missing_bytes = pkt->payload_size - initial_size_no_header;
-    if (pkt->missing_bytes < 0) {
-        pkt->missing_bytes = 0;
+    stream->carry = (uint8_t*)malloc(QL_XRSP_TOPIC_PKT_MAX);
+    if (!stream->carry) {
+        return -1;
     }
 
-    return consumed + sizeof(xrsp_topic_header);
+    return 0;
 }
 
-int32_t ql_xrsp_topic_pkt_append(struct ql_xrsp_topic_pkt* pkt, uint8_t* p_data, int32_t data_size)
+void ql_xrsp_topic_stream_destroy(struct ql_xrsp_topic_stream* stream)
 {
-    int32_t consumed = pkt->missing_bytes < data_size ? pkt->missing_bytes : data_size;
-    if (consumed) {
-        memcpy(pkt->payload + pkt->payload_valid, p_data, consumed);
-    }
-    pkt->missing_bytes -= consumed;
-    pkt->payload_valid += consumed;
+    free(stream->carry);
 
-    return consumed;
+    *stream = (struct ql_xrsp_topic_stream){0};
 }
 
-void ql_xrsp_topic_pkt_destroy(struct ql_xrsp_topic_pkt* pkt)
+void ql_xrsp_topic_stream_reset(struct ql_xrsp_topic_stream* stream)
 {
-    if (pkt->payload) {
-        free(pkt->payload);
-    }
+    stream->carry_len = 0;
+    stream->carry_need = 0;
+}
+
+void ql_xrsp_topic_stream_feed(struct ql_xrsp_topic_stream* stream, const uint8_t* data, size_t size, int64_t recv_ns,
+                               ql_xrsp_topic_pkt_cb_t cb, void* ptr)
+{
+    stream->num_bytes += size;
 
-    *pkt = (struct ql_xrsp_topic_pkt){0};
+    while (size)
+    {
+        // Finish the packet straddling the previous read first.
+        if (stream->carry_len) {
+            if (!stream->carry_need) {
+                size_t amt = sizeof(xrsp_topic_header) - stream->carry_len;
+                amt = amt < size ? amt : size;
+
+                memcpy(stream->carry + stream->carry_len, data, amt);
+                stream->carry_len += amt;
+                data += amt;
+                size -= amt;
+
+                if (stream->carry_len < sizeof(xrsp_topic_header)) {
+                    break;
+                }
+
+                stream->carry_need = topic_pkt_size(stream->carry);
+                if (!stream->carry_need) {
+                    stream->num_resyncs++;
+                    ql_xrsp_topic_stream_reset(stream);
+                    continue;
+                }
+            }
+
+            size_t amt = stream->carry_need - stream->carry_len;
+            amt = amt < size ? amt : size;
+
+            memcpy(stream->carry + stream->carry_len, data, amt);
+            stream->carry_len += amt;
+            data += amt;
+            size -= amt;
+
+            if (stream->carry_len == stream->carry_need) {
+                topic_pkt_emit(stream, stream->carry, stream->carry_need, recv_ns, cb, ptr);
+                ql_xrsp_topic_stream_reset(stream);
+            }
+            continue;
+        }
+
+        if (size < sizeof(xrsp_topic_header)) {
+            memcpy(stream->carry, data, size);
+            stream->carry_len = size;
+            break;
+        }
+
+        uint32_t pkt_size = topic_pkt_size(data);
+        if (!pkt_size) {
+            // Skip a header's worth and try again, like the old reader did.
+            stream->num_resyncs++;
+            data += sizeof(xrsp_topic_header);
+            size -= sizeof(xrsp_topic_header);
+            continue;
+        }
+
+        if (pkt_size > size) {
+            memcpy(stream->carry, data, size);
+            stream->carry_len = size;
+            stream->carry_need = pkt_size;
+            break;
+        }
+
+        topic_pkt_emit(stream, data, pkt_size, recv_ns, cb, ptr);
+        data += pkt_size;
+        size -= pkt_size;
+    }
 }
 
 void ql_xrsp_topic_pkt_dump(struct ql_xrsp_topic_pkt* pkt)
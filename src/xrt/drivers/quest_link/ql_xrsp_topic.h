@@ -32,9 +32,26 @@ typedef struct xrsp_topic_header
     uint16_t pad;
 } __attribute__((packed)) xrsp_topic_header;
 
-int32_t ql_xrsp_topic_pkt_create(struct ql_xrsp_topic_pkt* pkt, uint8_t* p_initial, int32_t initial_size, int64_t recv_ns);
-int32_t ql_xrsp_topic_pkt_append(struct ql_xrsp_topic_pkt* pkt, uint8_t* p_data, int32_t data_size);
-void ql_xrsp_topic_pkt_destroy(struct ql_xrsp_topic_pkt* pkt);
+//! Largest topic packet on the wire, header included.
+#define QL_XRSP_TOPIC_PKT_MAX (sizeof(xrsp_topic_header) + (0xFFFF - 1) * sizeof(uint32_t))
+
+/*!
+ * Receives one complete topic packet, the payload is only valid during the call.
+ */
+typedef void (*ql_xrsp_topic_pkt_cb_t)(void *ptr, struct ql_xrsp_topic_pkt* pkt);
+
+int ql_xrsp_topic_stream_init(struct ql_xrsp_topic_stream* stream);
+void ql_xrsp_topic_stream_destroy(struct ql_xrsp_topic_stream* stream);
+
+//! Drop any partially gathered packet, for when the device is reset.
+void ql_xrsp_topic_stream_reset(struct ql_xrsp_topic_stream* stream);
+
+/*!
+ * Feed the next @p size bytes read from the device, @p cb is called for each
+ * packet completed by them in stream order.
+ */
+void ql_xrsp_topic_stream_feed(struct ql_xrsp_topic_stream* stream, const uint8_t* data, size_t size, int64_t recv_ns,
+                               ql_xrsp_topic_pkt_cb_t cb, void* ptr);
 
 void ql_xrsp_topic_pkt_dump(struct ql_xrsp_topic_pkt* pkt);
 
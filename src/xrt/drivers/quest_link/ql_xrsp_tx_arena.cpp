@@ -0,0 +1,361 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link XRSP transmit arena, topic packets are framed in place.
+ * @ingroup drv_quest_link
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ql_xrsp_tx_arena.h"
+#include "ql_xrsp_topic.h"
+
+#define QL_XRSP_TX_ARENA_PAGE (0x1000)
+
+static size_t align_up(size_t v, size_t align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+// Offset of the record following the one at @p offs holding @p len bytes.
+static size_t next_record_offs(size_t offs, uint32_t len)
+{
+    return align_up(offs + QL_XRSP_TX_HEADER_SIZE + len + QL_XRSP_TX_TAIL_ROOM, QL_XRSP_TX_ALIGN);
+}
+
+// Until a record is framed its header slot holds the payload length.
+static void store_record_len(struct ql_xrsp_tx_buf *buf, size_t offs, uint32_t len)
+{
+    memcpy(buf->base + offs, &len, sizeof(len));
+}
+
+static uint32_t load_record_len(struct ql_xrsp_tx_buf *buf, size_t offs)
+{
+    uint32_t len;
+    memcpy(&len, buf->base + offs, sizeof(len));
+    return len;
+}
+
+size_t ql_xrsp_tx_buf_size_for_payload(size_t max_payload)
+{
+    size_t num_records = max_payload / QL_XRSP_TX_MAX_PAYLOAD + 2;
+    size_t per_record = QL_XRSP_TX_HEADER_SIZE + QL_XRSP_TX_TAIL_ROOM + QL_XRSP_TX_ALIGN;
+
+    return align_up(max_payload + num_records * per_record, QL_XRSP_TX_ALIGN);
+}
+
+int ql_xrsp_tx_arena_init(struct ql_xrsp_tx_arena *arena, size_t size)
+{
+    *arena = (struct ql_xrsp_tx_arena){0};
+
+    size = align_up(size, QL_XRSP_TX_ARENA_PAGE);
+
+    // Page aligned so the records can be handed to DMA as they are.
+    arena->mem = (uint8_t*)aligned_alloc(QL_XRSP_TX_ARENA_PAGE, size);
+    if (!arena->mem) {
+        return -1;
+    }
+
+    arena->size = size;
+    arena->num_allocs++;
+
+    return 0;
+}
+
+void ql_xrsp_tx_arena_destroy(struct ql_xrsp_tx_arena *arena)
+{
+    free(arena->mem);
+
+    *arena = (struct ql_xrsp_tx_arena){0};
+}
+
+int ql_xrsp_tx_arena_carve(struct ql_xrsp_tx_arena *arena, struct ql_xrsp_tx_buf *buf, size_t max_payload)
+{
+    size_t size = ql_xrsp_tx_buf_size_for_payload(max_payload);
+
+    *buf = (struct ql_xrsp_tx_buf){0};
+
+    if (arena->used + size > arena->size) {
+        return -1;
+    }
+
+    buf->base = arena->mem + arena->used;
+    buf->size = size;
+    arena->used += size;
+
+    return 0;
+}
+
+void ql_xrsp_tx_buf_reset(struct ql_xrsp_tx_buf *buf)
+{
+    buf->open_offs = 0;
+    buf->open_len = 0;
+    buf->num_records = 0;
+    buf->payload_len = 0;
+}
+
+uint8_t* ql_xrsp_tx_buf_reserve(struct ql_xrsp_tx_buf *buf, size_t max_len)
+{
+    if (max_len > QL_XRSP_TX_MAX_PAYLOAD) {
+        return NULL;
+    }
+
+    size_t offs = buf->open_offs;
+    uint32_t len = buf->open_len;
+
+    // Start a new record if there is none yet or the open one can't take it.
+    if (!buf->num_records || len + max_len > QL_XRSP_TX_MAX_PAYLOAD) {
+        if (buf->num_records && len) {
+            offs = next_record_offs(offs, len);
+        }
+        len = 0;
+    }
+
+    if (offs + QL_XRSP_TX_HEADER_SIZE + len + max_len + QL_XRSP_TX_TAIL_ROOM > buf->size) {
+        return NULL;
+    }
+
+    if (!buf->num_records || offs != buf->open_offs) {
+        buf->num_records++;
+        buf->open_offs = offs;
+        buf->open_len = 0;
+        store_record_len(buf, offs, 0);
+    }
+
+    return buf->base + offs + QL_XRSP_TX_HEADER_SIZE + len;
+}
+
+void ql_xrsp_tx_buf_commit(struct ql_xrsp_tx_buf *buf, size_t len)
+{
+    buf->open_len += len;
+    buf->payload_len += len;
+    store_record_len(buf, buf->open_offs, buf->open_len);
+}
+
+bool ql_xrsp_tx_buf_append(struct ql_xrsp_tx_buf *buf, const uint8_t *data, size_t len)
+{
+    struct ql_xrsp_tx_buf saved = *buf;
+
+    while (len) {
+        size_t room = QL_XRSP_TX_MAX_PAYLOAD;
+        if (buf->num_records && buf->open_len < QL_XRSP_TX_MAX_PAYLOAD) {
+            room = QL_XRSP_TX_MAX_PAYLOAD - buf->open_len;
+        }
+
+        size_t amt = len < room ? len : room;
+        uint8_t* dst = ql_xrsp_tx_buf_reserve(buf, amt);
+        if (!dst) {
+            // Roll back, a partial payload would desync the receiver.
+            ql_xrsp_tx_buf_rewind(buf, &saved);
+            return false;
+        }
+
+        memcpy(dst, data, amt);
+        ql_xrsp_tx_buf_commit(buf, amt);
+
+        data += amt;
+        len -= amt;
+    }
+
+    return true;
+}
+
+bool ql_xrsp_tx_buf_next_record(struct ql_xrsp_tx_buf *buf, struct ql_xrsp_tx_iter *it, uint8_t **out_slot, uint32_t *out_len)
+{
+    while (it->idx < buf->num_records)
+    {
+        size_t offs = it->offs;
+        uint32_t len = load_record_len(buf, offs);
+
+        it->offs = next_record_offs(offs, len);
+        it->idx++;
+
+        if (len) {
+            *out_slot = buf->base + offs;
+            *out_len = len;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint16_t ql_xrsp_tx_buf_flush(struct ql_xrsp_tx_buf *buf, uint8_t topic, uint16_t sequence_num, ql_xrsp_tx_sink_t sink, void *ptr)
+{
+    struct ql_xrsp_tx_iter it = {0};
+    uint8_t* slot;
+    uint32_t len;
+
+    while (ql_xrsp_tx_buf_next_record(buf, &it, &slot, &len))
+    {
+        int32_t size = ql_xrsp_tx_frame(slot, len, topic, sequence_num);
+        sink(ptr, slot, size);
+        sequence_num++;
+    }
+
+    return sequence_num;
+}
+
+// Write the header and alignment padding of one packet, returns its size. The
+// last packet of a transfer is padded so the fill packet after it fits.
+static int32_t frame_packet(uint8_t *slot, int32_t payload_size, uint8_t topic, uint16_t sequence_num, bool ends_transfer)
+{
+    uint8_t* payload = slot + QL_XRSP_TX_HEADER_SIZE;
+
+    int32_t align_up_bytes = (((4+payload_size) >> 2) << 2) - payload_size;
+    if (align_up_bytes == 4) {
+        align_up_bytes = 0;
+    }
+
+    int32_t msg_size = payload_size + align_up_bytes + QL_XRSP_TX_HEADER_SIZE;
+
+    // Sometimes we can end up with 0x4 bytes leftover, so we have to pad a bit extra
+    int32_t to_fill_check = 0x400 - ((msg_size + 0x400) & 0x3FF);
+    if (ends_transfer && to_fill_check >= 0 && to_fill_check < 8) {
+        align_up_bytes += to_fill_check;
+
+        msg_size = payload_size + align_up_bytes + QL_XRSP_TX_HEADER_SIZE;
+    }
+
+    xrsp_topic_header* header = (xrsp_topic_header*)slot;
+    header->version_maybe = 0;
+    header->has_alignment_padding = align_up_bytes ? 1 : 0;
+    header->packet_version_is_internal = 1;
+    header->packet_version_number = 0;
+    header->topic = topic;
+    header->unk_14_15 = 0;
+
+    header->num_words = ((payload_size + align_up_bytes) >> 2) + 1;
+    header->sequence_num = sequence_num;
+    header->pad = 0;
+
+    if (align_up_bytes)
+    {
+        if (align_up_bytes > 1)
+        {
+            memset(payload + payload_size, 0xDE, align_up_bytes - 1);
+        }
+        payload[payload_size + align_up_bytes - 1] = align_up_bytes;
+    }
+
+    return msg_size;
+}
+
+// Pad the transfer out to 0x400 with an empty topic 0 packet.
+static int32_t frame_fill(uint8_t *slot, int32_t msg_size, uint16_t sequence_num)
+{
+    int32_t to_fill = 0x400 - ((msg_size + 0x400) & 0x3FF) - 8;
+    if (to_fill < 0x3f8 && to_fill >= 0) {
+        xrsp_topic_header* fill_header = (xrsp_topic_header*)(slot + msg_size);
+        fill_header->version_maybe = 0;
+        fill_header->has_alignment_padding = 0;
+        fill_header->packet_version_is_internal = 1;
+        fill_header->packet_version_number = 0;
+        fill_header->topic = 0;
+        fill_header->unk_14_15 = 0;
+
+        fill_header->num_words = (to_fill >> 2) + 1;
+        fill_header->sequence_num = sequence_num;
+        fill_header->pad = 0;
+
+        memset(slot + msg_size + sizeof(xrsp_topic_header), 0, to_fill);
+        msg_size += to_fill + sizeof(xrsp_topic_header);
+    }
+
+    return msg_size;
+}
+
+int32_t ql_xrsp_tx_frame(uint8_t *slot, int32_t payload_size, uint8_t topic, uint16_t sequence_num)
+{
+    int32_t msg_size = frame_packet(slot, payload_size, topic, sequence_num, true);
+
+    return frame_fill(slot, msg_size, sequence_num);
+}
+
+/*
+ * Batched packets are stored as an 8 byte slot followed by the payload, 4 byte
+ * aligned. Until framed the slot holds the topic and the payload length.
+ */
+struct batch_slot
+{
+    uint32_t topic;
+    uint32_t len;
+};
+
+static uint32_t align_packet(uint32_t len)
+{
+    return (uint32_t)align_up(len, 4);
+}
+
+uint8_t* ql_xrsp_tx_buf_reserve_packet(struct ql_xrsp_tx_buf *buf, size_t max_len)
+{
+    if (max_len > QL_XRSP_TX_MAX_PAYLOAD - QL_XRSP_TX_HEADER_SIZE) {
+        return NULL;
+    }
+
+    uint8_t* slot = ql_xrsp_tx_buf_reserve(buf, QL_XRSP_TX_HEADER_SIZE + align_packet(max_len));
+    if (!slot) {
+        return NULL;
+    }
+
+    return slot + QL_XRSP_TX_HEADER_SIZE;
+}
+
+void ql_xrsp_tx_buf_commit_packet(struct ql_xrsp_tx_buf *buf, uint8_t topic, size_t len)
+{
+    struct batch_slot bs = {topic, (uint32_t)len};
+    memcpy(buf->base + buf->open_offs + QL_XRSP_TX_HEADER_SIZE + buf->open_len, &bs, sizeof(bs));
+
+    ql_xrsp_tx_buf_commit(buf, QL_XRSP_TX_HEADER_SIZE + align_packet(len));
+}
+
+bool ql_xrsp_tx_buf_append_packet(struct ql_xrsp_tx_buf *buf, uint8_t topic, const uint8_t *data, size_t len)
+{
+    uint8_t* dst = ql_xrsp_tx_buf_reserve_packet(buf, len);
+    if (!dst) {
+        return false;
+    }
+
+    memcpy(dst, data, len);
+    ql_xrsp_tx_buf_commit_packet(buf, topic, len);
+
+    return true;
+}
+
+void ql_xrsp_tx_buf_rewind(struct ql_xrsp_tx_buf *buf, const struct ql_xrsp_tx_buf *saved)
+{
+    // Records opened since are dropped with the counts, the one that was open
+    // gets its old length back.
+    if (saved->num_records) {
+        store_record_len(buf, saved->open_offs, saved->open_len);
+    }
+    *buf = *saved;
+}
+
+int32_t ql_xrsp_tx_frame_batch(uint8_t *slot, int32_t payload_size, uint16_t *sequence_num)
+{
+    // The batch is the payload of the record, framed packets start in the header slot.
+    uint8_t* pkt = slot + QL_XRSP_TX_HEADER_SIZE;
+    uint8_t* end = pkt + payload_size;
+    int32_t msg_size = 0;
+    uint16_t last_seq = *sequence_num;
+
+    while (pkt < end)
+    {
+        struct batch_slot bs;
+        memcpy(&bs, pkt, sizeof(bs));
+
+        uint8_t* next = pkt + QL_XRSP_TX_HEADER_SIZE + align_packet(bs.len);
+        last_seq = (*sequence_num)++;
+
+        // Packets are moved down over the record header, by 8 bytes.
+        memmove(slot + msg_size + QL_XRSP_TX_HEADER_SIZE, pkt + QL_XRSP_TX_HEADER_SIZE, bs.len);
+        msg_size += frame_packet(slot + msg_size, bs.len, bs.topic, last_seq, next >= end);
+
+        pkt = next;
+    }
+
+    return frame_fill(slot, msg_size, last_seq);
+}
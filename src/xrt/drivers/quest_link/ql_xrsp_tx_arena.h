@@ -0,0 +1,166 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link XRSP transmit arena, topic packets are framed in place.
+ * @ingroup drv_quest_link
+ *
+ * A transmit buffer is a run of records, each record is laid out as:
+ *
+ *   [ 8 byte header slot ][ payload, at most QL_XRSP_TX_MAX_PAYLOAD ][ tail room ]
+ *
+ * and starts on a QL_XRSP_TX_ALIGN boundary. Producers (the video encoder,
+ * control messages) write the payload straight into the record, the header,
+ * alignment padding and the 0x400 fill packet are then generated in place by
+ * @ref ql_xrsp_tx_buf_flush, so each record goes to the USB endpoint as one
+ * transfer without being copied or allocated again.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Alignment of records and USB transfers, every transfer is a multiple of this.
+#define QL_XRSP_TX_ALIGN (0x400)
+//! Largest payload a single topic packet can carry.
+#define QL_XRSP_TX_MAX_PAYLOAD (0x3FFF8)
+//! Size of the topic packet header that precedes every payload.
+#define QL_XRSP_TX_HEADER_SIZE (8)
+//! Room kept after every payload for alignment padding and the fill packet.
+#define QL_XRSP_TX_TAIL_ROOM (0x800)
+//! Pseudo topic of buffers filled with @ref ql_xrsp_tx_buf_append_packet.
+#define QL_XRSP_TX_TOPIC_BATCH (0xFF)
+
+/*!
+ * Receives framed topic packets, @p data is only valid during the call.
+ */
+typedef void (*ql_xrsp_tx_sink_t)(void *ptr, const uint8_t *data, int32_t size);
+
+/*!
+ * A single preallocated region all transmit buffers are carved from.
+ */
+struct ql_xrsp_tx_arena
+{
+    uint8_t *mem;
+    size_t size;
+    size_t used;
+
+    //! Heap allocations made for the arena, buffers never add to it.
+    uint64_t num_allocs;
+};
+
+/*!
+ * A transmit buffer holding the payload of one or more topic packets.
+ */
+struct ql_xrsp_tx_buf
+{
+    //! QL_XRSP_TX_ALIGN aligned start of this buffer.
+    uint8_t *base;
+    size_t size;
+
+    //! Offset of the header slot of the record currently written to.
+    size_t open_offs;
+    //! Payload bytes in the record currently written to.
+    uint32_t open_len;
+    //! Number of records, including the open one.
+    uint32_t num_records;
+    //! Total payload bytes across all records.
+    size_t payload_len;
+};
+
+/*!
+ * Position of a walk over the records of a buffer, zero initialise to start.
+ */
+struct ql_xrsp_tx_iter
+{
+    size_t offs;
+    uint32_t idx;
+};
+
+/*!
+ * Size a transmit buffer needs to hold @p max_payload bytes.
+ */
+size_t ql_xrsp_tx_buf_size_for_payload(size_t max_payload);
+
+int ql_xrsp_tx_arena_init(struct ql_xrsp_tx_arena *arena, size_t size);
+
+void ql_xrsp_tx_arena_destroy(struct ql_xrsp_tx_arena *arena);
+
+/*!
+ * Carve a buffer able to hold @p max_payload bytes out of the arena, returns
+ * negative if the arena is exhausted. Buffers live as long as the arena.
+ */
+int ql_xrsp_tx_arena_carve(struct ql_xrsp_tx_arena *arena, struct ql_xrsp_tx_buf *buf, size_t max_payload);
+
+void ql_xrsp_tx_buf_reset(struct ql_xrsp_tx_buf *buf);
+
+/*!
+ * Get a pointer where up to @p max_len contiguous payload bytes can be written,
+ * must be followed by @ref ql_xrsp_tx_buf_commit with the amount written.
+ * Returns NULL if @p max_len is larger than a topic packet or the buffer is full.
+ */
+uint8_t *ql_xrsp_tx_buf_reserve(struct ql_xrsp_tx_buf *buf, size_t max_len);
+
+void ql_xrsp_tx_buf_commit(struct ql_xrsp_tx_buf *buf, size_t len);
+
+/*!
+ * Copy @p data into the buffer, splitting it into as many records as needed.
+ * Either all of the data is added or, if the buffer is full, none of it.
+ */
+bool ql_xrsp_tx_buf_append(struct ql_xrsp_tx_buf *buf, const uint8_t *data, size_t len);
+
+/*!
+ * Get the header slot and payload length of the next non-empty record, returns
+ * false once all records have been walked. The buffer must not be framed yet.
+ */
+bool ql_xrsp_tx_buf_next_record(struct ql_xrsp_tx_buf *buf, struct ql_xrsp_tx_iter *it, uint8_t **out_slot, uint32_t *out_len);
+
+/*!
+ * Frame every record in place and hand it to @p sink, one call per record.
+ * Framing overwrites the bookkeeping in the records, so the buffer must be
+ * reset before it is written to again. Returns the next sequence number.
+ */
+uint16_t ql_xrsp_tx_buf_flush(struct ql_xrsp_tx_buf *buf, uint8_t topic, uint16_t sequence_num, ql_xrsp_tx_sink_t sink, void *ptr);
+
+/*!
+ * Like @ref ql_xrsp_tx_buf_reserve but for a whole topic packet that is never
+ * split across records, must be followed by @ref ql_xrsp_tx_buf_commit_packet.
+ * Don't mix with the non-packet functions on the same buffer.
+ */
+uint8_t *ql_xrsp_tx_buf_reserve_packet(struct ql_xrsp_tx_buf *buf, size_t max_len);
+
+void ql_xrsp_tx_buf_commit_packet(struct ql_xrsp_tx_buf *buf, uint8_t topic, size_t len);
+
+//! Copy a whole topic packet into the buffer, false if it doesn't fit.
+bool ql_xrsp_tx_buf_append_packet(struct ql_xrsp_tx_buf *buf, uint8_t topic, const uint8_t *data, size_t len);
+
+/*!
+ * Drop everything added to @p buf since @p saved was copied from it, so a
+ * message made up of several packets is queued either whole or not at all.
+ */
+void ql_xrsp_tx_buf_rewind(struct ql_xrsp_tx_buf *buf, const struct ql_xrsp_tx_buf *saved);
+
+/*!
+ * Write the topic header in front of and the padding/fill packet after a
+ * payload of @p payload_size bytes starting at `slot + QL_XRSP_TX_HEADER_SIZE`.
+ * There must be QL_XRSP_TX_TAIL_ROOM bytes after the payload. Returns the size
+ * of the framed packet, always a multiple of QL_XRSP_TX_ALIGN.
+ */
+int32_t ql_xrsp_tx_frame(uint8_t *slot, int32_t payload_size, uint8_t topic, uint16_t sequence_num);
+
+/*!
+ * Frame a record of a buffer filled with packets in place, every packet gets
+ * the next number from @p sequence_num and the transfer is padded out like
+ * @ref ql_xrsp_tx_frame does. Returns the size of the transfer.
+ */
+int32_t ql_xrsp_tx_frame_batch(uint8_t *slot, int32_t payload_size, uint16_t *sequence_num);
+
+#ifdef __cplusplus
+}
+#endif
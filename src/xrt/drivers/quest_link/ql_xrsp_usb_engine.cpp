@@ -0,0 +1,598 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link asynchronous USB transfer engine.
+ * @ingroup drv_quest_link
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "os/os_time.h"
+#include "util/u_time.h"
+
+#include "ql_xrsp_usb_engine.h"
+#include "ql_xrsp_types.h"
+
+#define QL_XRSP_USB_EVENT_TIMEOUT_NS (100 * U_TIME_1MS_IN_NS)
+#define QL_XRSP_USB_RETRY_NS (10 * U_TIME_1MS_IN_NS)
+
+/*!
+ * A transmit buffer being sent, lives on the stack of the sending thread.
+ */
+struct ql_xrsp_usb_send
+{
+    struct ql_xrsp_tx_buf *const *bufs;
+    uint32_t num_bufs;
+    uint8_t topic;
+    //! Queue it is on, see @ref ql_xrsp_usb_prio.
+    int prio;
+
+    //! Next record to hand to a transfer, in bufs[buf_idx].
+    uint32_t buf_idx;
+    struct ql_xrsp_tx_iter it;
+    //! Still in the queue, records left to dispatch.
+    bool queued;
+    //! Records in flight.
+    uint32_t pending;
+    bool done;
+    int status;
+
+    struct os_cond cond;
+    struct ql_xrsp_usb_send *next;
+};
+
+enum ql_xrsp_usb_prio ql_xrsp_usb_topic_prio(uint8_t topic)
+{
+    switch (topic)
+    {
+        case TOPIC_HOSTINFO_ADV:
+        case TOPIC_POSE:
+        case TOPIC_HAPTIC:
+            return QL_XRSP_USB_PRIO_HIGH;
+        default:
+            break;
+    }
+
+    if (topic >= TOPIC_SLICE_0 && topic <= TOPIC_SLICE_15) {
+        return QL_XRSP_USB_PRIO_LOW;
+    }
+
+    return QL_XRSP_USB_PRIO_NORMAL;
+}
+
+static void send_fail_locked(struct ql_xrsp_usb_send *s, int status)
+{
+    if (s->status == QL_XRSP_USB_OK) {
+        s->status = status;
+    }
+}
+
+static void send_check_done_locked(struct ql_xrsp_usb_send *s)
+{
+    if (!s->queued && !s->pending && !s->done) {
+        s->done = true;
+        os_cond_signal(&s->cond);
+    }
+}
+
+static void queue_pop_locked(struct ql_xrsp_usb_engine *e, int prio)
+{
+    struct ql_xrsp_usb_send *s = e->queue_head[prio];
+
+    e->queue_head[prio] = s->next;
+    if (!s->next) {
+        e->queue_tail[prio] = NULL;
+    }
+
+    s->next = NULL;
+    s->queued = false;
+}
+
+static struct ql_xrsp_usb_xfer* idle_out_xfer_locked(struct ql_xrsp_usb_engine *e)
+{
+    for (uint32_t i = 0; i < e->num_out; i++)
+    {
+        if (e->out_xfers[i].state == QL_XRSP_USB_XFER_IDLE) {
+            return &e->out_xfers[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int submit_locked(struct ql_xrsp_usb_engine *e, struct ql_xrsp_usb_xfer *xfer)
+{
+    xfer->state = QL_XRSP_USB_XFER_IN_FLIGHT;
+    xfer->actual_length = 0;
+    e->num_in_flight++;
+
+    int ret = e->backend->submit(e->backend, xfer);
+    if (ret < 0) {
+        xfer->state = QL_XRSP_USB_XFER_IDLE;
+        e->num_in_flight--;
+    }
+
+    return ret;
+}
+
+// Failed IN transfers are left idle by the completion, so an endpoint that keeps failing isn't resubmitted in a loop.
+static void retry_in_locked(struct ql_xrsp_usb_engine *e)
+{
+    if (!e->running || e->rx_gone || os_monotonic_get_ns() < e->rx_retry_ns) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < e->num_in; i++)
+    {
+        if (e->in_xfers[i].state == QL_XRSP_USB_XFER_IDLE) {
+            submit_locked(e, &e->in_xfers[i]);
+        }
+    }
+}
+
+// Hand queued records to free OUT transfers, highest priority first.
+static void dispatch_locked(struct ql_xrsp_usb_engine *e)
+{
+    while (e->running)
+    {
+        struct ql_xrsp_usb_xfer *xfer = idle_out_xfer_locked(e);
+        if (!xfer) {
+            break;
+        }
+
+        int prio = 0;
+        while (prio < QL_XRSP_USB_PRIO_COUNT && !e->queue_head[prio]) {
+            prio++;
+        }
+        if (prio == QL_XRSP_USB_PRIO_COUNT) {
+            break;
+        }
+
+        struct ql_xrsp_usb_send *s = e->queue_head[prio];
+
+        uint8_t* slot;
+        uint32_t len;
+        if (!ql_xrsp_tx_buf_next_record(s->bufs[s->buf_idx], &s->it, &slot, &len)) {
+            if (++s->buf_idx < s->num_bufs) {
+                s->it = (struct ql_xrsp_tx_iter){0};
+                continue;
+            }
+            queue_pop_locked(e, prio);
+            send_check_done_locked(s);
+            continue;
+        }
+
+        // Framed here and not when queued so sequence numbers follow the wire.
+        xfer->data = slot;
+        if (s->topic == QL_XRSP_TX_TOPIC_BATCH) {
+            xfer->length = ql_xrsp_tx_frame_batch(slot, len, &e->sequence_num);
+        }
+        else {
+            xfer->length = ql_xrsp_tx_frame(slot, len, s->topic, e->sequence_num++);
+        }
+        xfer->send = s;
+
+        s->pending++;
+        int ret = submit_locked(e, xfer);
+        if (ret < 0) {
+            // Sending the rest of a payload with a hole in it would desync the device.
+            s->pending--;
+            xfer->send = NULL;
+            send_fail_locked(s, ret);
+            queue_pop_locked(e, prio);
+            send_check_done_locked(s);
+            continue;
+        }
+
+        uint32_t in_flight = 0;
+        for (uint32_t i = 0; i < e->num_out; i++)
+        {
+            in_flight += e->out_xfers[i].state == QL_XRSP_USB_XFER_IN_FLIGHT;
+        }
+        if (in_flight > e->max_out_in_flight) {
+            e->max_out_in_flight = in_flight;
+        }
+    }
+}
+
+static void *
+ql_xrsp_usb_event_thread(void *ptr)
+{
+    struct ql_xrsp_usb_engine *e = (struct ql_xrsp_usb_engine *)ptr;
+
+    os_thread_helper_lock(&e->event_thread);
+    while (os_thread_helper_is_running_locked(&e->event_thread)) {
+        os_thread_helper_unlock(&e->event_thread);
+
+        // Blocks until something completes, no polling.
+        e->backend->handle_events(e->backend, QL_XRSP_USB_EVENT_TIMEOUT_NS);
+
+        os_thread_helper_lock(&e->event_thread);
+    }
+    os_thread_helper_unlock(&e->event_thread);
+
+    return NULL;
+}
+
+int ql_xrsp_usb_engine_init(struct ql_xrsp_usb_engine *e, struct ql_xrsp_usb_backend *backend, const struct ql_xrsp_usb_config *config,
+                            ql_xrsp_usb_error_cb_t error_cb, void *error_ptr)
+{
+    uint32_t num_in_init = 0;
+    uint32_t num_out_init = 0;
+
+    *e = (struct ql_xrsp_usb_engine){0};
+    e->backend = backend;
+    e->error_cb = error_cb;
+    e->error_ptr = error_ptr;
+
+    e->num_in = config->num_in ? config->num_in : 1;
+    e->num_out = config->num_out ? config->num_out : 1;
+    e->in_size = config->in_size > 0 ? config->in_size : QL_XRSP_TX_ALIGN;
+
+    e->in_xfers = (struct ql_xrsp_usb_xfer*)calloc(e->num_in, sizeof(*e->in_xfers));
+    e->out_xfers = (struct ql_xrsp_usb_xfer*)calloc(e->num_out, sizeof(*e->out_xfers));
+    e->rx_ring = (struct ql_xrsp_usb_xfer**)calloc(e->num_in, sizeof(*e->rx_ring));
+    e->in_mem = (uint8_t*)calloc(e->num_in, e->in_size);
+    if (!e->in_xfers || !e->out_xfers || !e->rx_ring || !e->in_mem) {
+        goto cleanup_xfers;
+    }
+
+    for (uint32_t i = 0; i < e->num_in; i++)
+    {
+        struct ql_xrsp_usb_xfer *xfer = &e->in_xfers[i];
+        xfer->engine = e;
+        xfer->is_in = true;
+        xfer->data = e->in_mem + (size_t)i * e->in_size;
+        xfer->length = e->in_size;
+
+        if (backend->xfer_init(backend, xfer) != 0) {
+            goto cleanup_xfers;
+        }
+        num_in_init++;
+    }
+
+    for (uint32_t i = 0; i < e->num_out; i++)
+    {
+        struct ql_xrsp_usb_xfer *xfer = &e->out_xfers[i];
+        xfer->engine = e;
+        xfer->is_in = false;
+
+        if (backend->xfer_init(backend, xfer) != 0) {
+            goto cleanup_xfers;
+        }
+        num_out_init++;
+    }
+
+    if (os_mutex_init(&e->mutex) != 0) {
+        goto cleanup_xfers;
+    }
+    if (os_cond_init(&e->idle_cond) != 0) {
+        goto cleanup_mutex;
+    }
+    if (os_semaphore_init(&e->rx_sem, 0) != 0) {
+        goto cleanup_cond;
+    }
+    if (os_thread_helper_init(&e->event_thread) != 0) {
+        goto cleanup_sem;
+    }
+    if (os_thread_helper_start(&e->event_thread, ql_xrsp_usb_event_thread, e) != 0) {
+        goto cleanup_thread;
+    }
+    os_thread_helper_name(&e->event_thread, "Quest Link USB");
+
+    return 0;
+
+    // Unwind in reverse order, the backend is ours even when init fails.
+cleanup_thread:
+    os_thread_helper_destroy(&e->event_thread);
+cleanup_sem:
+    os_semaphore_destroy(&e->rx_sem);
+cleanup_cond:
+    os_cond_destroy(&e->idle_cond);
+cleanup_mutex:
+    os_mutex_destroy(&e->mutex);
+cleanup_xfers:
+    for (uint32_t i = 0; i < num_out_init; i++)
+    {
+        backend->xfer_fini(backend, &e->out_xfers[i]);
+    }
+    for (uint32_t i = 0; i < num_in_init; i++)
+    {
+        backend->xfer_fini(backend, &e->in_xfers[i]);
+    }
+
+    free(e->in_xfers);
+    free(e->out_xfers);
+    free(e->rx_ring);
+    free(e->in_mem);
+
+    backend->destroy(backend);
+
+    *e = (struct ql_xrsp_usb_engine){0};
+
+    return -1;
+}
+
+void ql_xrsp_usb_engine_destroy(struct ql_xrsp_usb_engine *e)
+{
+    ql_xrsp_usb_engine_stop(e);
+
+    os_thread_helper_destroy(&e->event_thread);
+
+    for (uint32_t i = 0; i < e->num_in; i++)
+    {
+        e->backend->xfer_fini(e->backend, &e->in_xfers[i]);
+    }
+    for (uint32_t i = 0; i < e->num_out; i++)
+    {
+        e->backend->xfer_fini(e->backend, &e->out_xfers[i]);
+    }
+    e->backend->destroy(e->backend);
+
+    os_semaphore_destroy(&e->rx_sem);
+    os_cond_destroy(&e->idle_cond);
+    os_mutex_destroy(&e->mutex);
+
+    free(e->in_xfers);
+    free(e->out_xfers);
+    free(e->rx_ring);
+    free(e->in_mem);
+
+    *e = (struct ql_xrsp_usb_engine){0};
+}
+
+void ql_xrsp_usb_engine_start(struct ql_xrsp_usb_engine *e)
+{
+    os_mutex_lock(&e->mutex);
+
+    e->running = true;
+    e->rx_error = QL_XRSP_USB_OK;
+    e->rx_retry_ns = 0;
+    e->rx_gone = false;
+
+    for (uint32_t i = 0; i < e->num_in; i++)
+    {
+        if (e->in_xfers[i].state == QL_XRSP_USB_XFER_IDLE) {
+            submit_locked(e, &e->in_xfers[i]);
+        }
+    }
+
+    dispatch_locked(e);
+
+    os_mutex_unlock(&e->mutex);
+}
+
+void ql_xrsp_usb_engine_stop(struct ql_xrsp_usb_engine *e)
+{
+    os_mutex_lock(&e->mutex);
+
+    e->running = false;
+
+    for (int prio = 0; prio < QL_XRSP_USB_PRIO_COUNT; prio++)
+    {
+        while (e->queue_head[prio]) {
+            struct ql_xrsp_usb_send *s = e->queue_head[prio];
+            queue_pop_locked(e, prio);
+            send_fail_locked(s, QL_XRSP_USB_CANCELLED);
+            send_check_done_locked(s);
+        }
+    }
+
+    // Data that was read but not looked at yet belongs to the old session.
+    for (uint32_t i = 0; i < e->rx_count; i++)
+    {
+        e->rx_ring[(e->rx_head + i) % e->num_in]->state = QL_XRSP_USB_XFER_IDLE;
+    }
+    e->rx_head = 0;
+    e->rx_count = 0;
+
+    // Nothing is submitted while stopped, so the set in flight only shrinks.
+    for (uint32_t i = 0; i < e->num_in; i++)
+    {
+        if (e->in_xfers[i].state == QL_XRSP_USB_XFER_IN_FLIGHT) {
+            e->backend->cancel(e->backend, &e->in_xfers[i]);
+        }
+    }
+    for (uint32_t i = 0; i < e->num_out; i++)
+    {
+        if (e->out_xfers[i].state == QL_XRSP_USB_XFER_IN_FLIGHT) {
+            e->backend->cancel(e->backend, &e->out_xfers[i]);
+        }
+    }
+
+    while (e->num_in_flight) {
+        os_cond_wait(&e->idle_cond, &e->mutex);
+    }
+
+    os_mutex_unlock(&e->mutex);
+}
+
+int ql_xrsp_usb_engine_send(struct ql_xrsp_usb_engine *e, uint8_t topic, struct ql_xrsp_tx_buf *buf)
+{
+    return ql_xrsp_usb_engine_send_bufs(e, topic, &buf, 1);
+}
+
+static int send_bufs(struct ql_xrsp_usb_engine *e, uint8_t topic, int prio, struct ql_xrsp_tx_buf *const *bufs, uint32_t num_bufs)
+{
+    if (!num_bufs) {
+        return QL_XRSP_USB_OK;
+    }
+
+    struct ql_xrsp_usb_send s = {0};
+    s.bufs = bufs;
+    s.num_bufs = num_bufs;
+    s.topic = topic;
+    s.prio = prio;
+    s.queued = true;
+    os_cond_init(&s.cond);
+
+    os_mutex_lock(&e->mutex);
+
+    if (!e->running) {
+        os_mutex_unlock(&e->mutex);
+        os_cond_destroy(&s.cond);
+        return QL_XRSP_USB_NO_DEVICE;
+    }
+
+    if (e->queue_tail[prio]) {
+        e->queue_tail[prio]->next = &s;
+    }
+    else {
+        e->queue_head[prio] = &s;
+    }
+    e->queue_tail[prio] = &s;
+
+    dispatch_locked(e);
+
+    while (!s.done) {
+        os_cond_wait(&s.cond, &e->mutex);
+    }
+
+    os_mutex_unlock(&e->mutex);
+    os_cond_destroy(&s.cond);
+
+    return s.status;
+}
+
+int ql_xrsp_usb_engine_send_bufs(struct ql_xrsp_usb_engine *e, uint8_t topic, struct ql_xrsp_tx_buf *const *bufs, uint32_t num_bufs)
+{
+    return send_bufs(e, topic, ql_xrsp_usb_topic_prio(topic), bufs, num_bufs);
+}
+
+int ql_xrsp_usb_engine_send_batch(struct ql_xrsp_usb_engine *e, enum ql_xrsp_usb_prio prio, struct ql_xrsp_tx_buf *buf)
+{
+    return send_bufs(e, QL_XRSP_TX_TOPIC_BATCH, prio, &buf, 1);
+}
+
+int ql_xrsp_usb_engine_read(struct ql_xrsp_usb_engine *e, int64_t timeout_ns, ql_xrsp_usb_rx_cb_t cb, void *ptr)
+{
+    int num = 0;
+
+    bool signalled = os_semaphore_wait(&e->rx_sem, timeout_ns);
+
+    os_mutex_lock(&e->mutex);
+
+    retry_in_locked(e);
+
+    while (e->rx_count) {
+        struct ql_xrsp_usb_xfer *xfer = e->rx_ring[e->rx_head];
+        e->rx_head = (e->rx_head + 1) % e->num_in;
+        e->rx_count--;
+
+        xfer->state = QL_XRSP_USB_XFER_HELD;
+
+        os_mutex_unlock(&e->mutex);
+        cb(ptr, xfer->data, xfer->actual_length);
+        os_mutex_lock(&e->mutex);
+
+        xfer->state = QL_XRSP_USB_XFER_IDLE;
+        if (e->running && !e->rx_gone) {
+            submit_locked(e, xfer);
+        }
+
+        num++;
+    }
+
+    int ret = e->rx_error;
+    e->rx_error = QL_XRSP_USB_OK;
+
+    /*
+     * Everything released so far has been handled, take the counts left over
+     * so the next call waits. They are released under the mutex so none of
+     * these waits block.
+     */
+    if (signalled && e->rx_signals) {
+        e->rx_signals--;
+    }
+    while (e->rx_signals) {
+        os_semaphore_wait(&e->rx_sem, 0);
+        e->rx_signals--;
+    }
+
+    os_mutex_unlock(&e->mutex);
+
+    return ret < 0 ? ret : num;
+}
+
+void ql_xrsp_usb_engine_complete(struct ql_xrsp_usb_xfer *xfer, int status, int32_t actual_length)
+{
+    struct ql_xrsp_usb_engine *e = xfer->engine;
+    bool report = status != QL_XRSP_USB_OK && status != QL_XRSP_USB_CANCELLED;
+
+    os_mutex_lock(&e->mutex);
+
+    e->num_in_flight--;
+    xfer->actual_length = actual_length;
+    xfer->state = QL_XRSP_USB_XFER_IDLE;
+
+    if (xfer->is_in) {
+        if (status == QL_XRSP_USB_OK && e->running) {
+            e->bytes_in += actual_length;
+
+            xfer->state = QL_XRSP_USB_XFER_DONE;
+            e->rx_ring[(e->rx_head + e->rx_count) % e->num_in] = xfer;
+            e->rx_count++;
+            e->rx_signals++;
+            os_semaphore_release(&e->rx_sem);
+        }
+        else if (report) {
+            if (e->rx_error == QL_XRSP_USB_OK) {
+                e->rx_error = status;
+            }
+
+            // Left idle, the reader retries it later unless the device is gone.
+            if (status == QL_XRSP_USB_NO_DEVICE) {
+                e->rx_gone = true;
+            }
+            e->rx_retry_ns = os_monotonic_get_ns() + QL_XRSP_USB_RETRY_NS;
+
+            e->rx_signals++;
+            os_semaphore_release(&e->rx_sem);
+        }
+    }
+    else {
+        struct ql_xrsp_usb_send *s = xfer->send;
+        xfer->send = NULL;
+
+        if (status == QL_XRSP_USB_OK) {
+            e->bytes_out += actual_length;
+        }
+
+        s->pending--;
+        if (status != QL_XRSP_USB_OK) {
+            send_fail_locked(s, status);
+
+            // Drop the rest of this payload, see dispatch_locked.
+            if (s->queued) {
+                int prio = s->prio;
+                struct ql_xrsp_usb_send **it = &e->queue_head[prio];
+                struct ql_xrsp_usb_send *prev = NULL;
+                while (*it != s) {
+                    prev = *it;
+                    it = &(*it)->next;
+                }
+                *it = s->next;
+                if (e->queue_tail[prio] == s) {
+                    e->queue_tail[prio] = prev;
+                }
+                s->next = NULL;
+                s->queued = false;
+            }
+        }
+        send_check_done_locked(s);
+
+        dispatch_locked(e);
+    }
+
+    if (!e->num_in_flight) {
+        os_cond_signal(&e->idle_cond);
+    }
+
+    os_mutex_unlock(&e->mutex);
+
+    if (report && e->error_cb) {
+        e->error_cb(e->error_ptr, xfer->is_in, status);
+    }
+}
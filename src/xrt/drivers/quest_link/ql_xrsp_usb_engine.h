@@ -0,0 +1,243 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link asynchronous USB transfer engine.
+ * @ingroup drv_quest_link
+ *
+ * Keeps a configurable number of IN and OUT bulk transfers outstanding and
+ * handles all of their completions on a single event thread.
+ *
+ * Transmit buffers are queued per priority, records are framed with the next
+ * sequence number only when they are handed to a free OUT transfer, so a pose
+ * or hostinfo packet queued behind a large video slice goes out as soon as the
+ * slice record currently on the wire completes, and sequence numbers still
+ * appear in wire order.
+ *
+ * Completed IN transfers are handed to the reader in order by
+ * @ref ql_xrsp_usb_engine_read and resubmitted once it is done with them.
+ *
+ * The device side is behind @ref ql_xrsp_usb_backend so the engine can be
+ * driven by libusb or by a fake device in the tests.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "os/os_threading.h"
+
+#include "ql_xrsp_tx_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum ql_xrsp_usb_status
+{
+    QL_XRSP_USB_OK = 0,
+    QL_XRSP_USB_ERROR = -1,
+    QL_XRSP_USB_TIMEOUT = -2,
+    QL_XRSP_USB_NO_DEVICE = -3,
+    QL_XRSP_USB_CANCELLED = -4,
+};
+
+enum ql_xrsp_usb_prio
+{
+    //! Hostinfo, pose and echo traffic.
+    QL_XRSP_USB_PRIO_HIGH = 0,
+    QL_XRSP_USB_PRIO_NORMAL,
+    //! Video slices.
+    QL_XRSP_USB_PRIO_LOW,
+    QL_XRSP_USB_PRIO_COUNT,
+};
+
+enum ql_xrsp_usb_xfer_state
+{
+    QL_XRSP_USB_XFER_IDLE = 0,
+    QL_XRSP_USB_XFER_IN_FLIGHT,
+    //! IN only, completed and waiting for the reader.
+    QL_XRSP_USB_XFER_DONE,
+    //! IN only, being looked at by the reader.
+    QL_XRSP_USB_XFER_HELD,
+};
+
+struct ql_xrsp_usb_engine;
+struct ql_xrsp_usb_send;
+
+struct ql_xrsp_usb_xfer
+{
+    struct ql_xrsp_usb_engine *engine;
+    //! Owned by the backend, the libusb_transfer for example.
+    void *backend_data;
+
+    bool is_in;
+    enum ql_xrsp_usb_xfer_state state;
+
+    uint8_t *data;
+    int32_t length;
+    int32_t actual_length;
+
+    //! OUT only, the send the record in flight belongs to.
+    struct ql_xrsp_usb_send *send;
+};
+
+/*!
+ * The device end of the engine.
+ *
+ * Everything but @p handle_events is called with the engine lock held.
+ * @p handle_events is only called from the event thread and reports finished
+ * transfers with @ref ql_xrsp_usb_engine_complete.
+ */
+struct ql_xrsp_usb_backend
+{
+    int (*xfer_init)(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer);
+    void (*xfer_fini)(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer);
+    //! Returns a negative @ref ql_xrsp_usb_status if the transfer could not be started.
+    int (*submit)(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer);
+    void (*cancel)(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer);
+    void (*handle_events)(struct ql_xrsp_usb_backend *b, int64_t timeout_ns);
+    void (*destroy)(struct ql_xrsp_usb_backend *b);
+};
+
+struct ql_xrsp_usb_config
+{
+    uint32_t num_in;
+    int32_t in_size;
+    uint32_t num_out;
+};
+
+/*!
+ * Called on the event thread when a transfer fails with anything but
+ * QL_XRSP_USB_CANCELLED, must not send or stop the engine.
+ */
+typedef void (*ql_xrsp_usb_error_cb_t)(void *ptr, bool is_in, int status);
+
+/*!
+ * Receives the data of one completed IN transfer, only valid during the call.
+ */
+typedef void (*ql_xrsp_usb_rx_cb_t)(void *ptr, const uint8_t *data, int32_t size);
+
+struct ql_xrsp_usb_engine
+{
+    struct ql_xrsp_usb_backend *backend;
+
+    struct os_mutex mutex;
+    struct os_thread_helper event_thread;
+
+    //! Released once per completed or failed IN transfer.
+    struct os_semaphore rx_sem;
+    //! Releases of rx_sem not yet taken by a read.
+    uint32_t rx_signals;
+
+    //! Transfers are only submitted while running.
+    bool running;
+    uint32_t num_in_flight;
+    //! Signalled when num_in_flight drops to zero while stopping.
+    struct os_cond idle_cond;
+
+    //! Sequence number of the next topic packet put on the wire.
+    uint16_t sequence_num;
+
+    //! Queued sends, one FIFO per priority.
+    struct ql_xrsp_usb_send *queue_head[QL_XRSP_USB_PRIO_COUNT];
+    struct ql_xrsp_usb_send *queue_tail[QL_XRSP_USB_PRIO_COUNT];
+
+    struct ql_xrsp_usb_xfer *out_xfers;
+    uint32_t num_out;
+
+    struct ql_xrsp_usb_xfer *in_xfers;
+    uint32_t num_in;
+    int32_t in_size;
+    uint8_t *in_mem;
+
+    //! Completed IN transfers in completion order.
+    struct ql_xrsp_usb_xfer **rx_ring;
+    uint32_t rx_head;
+    uint32_t rx_count;
+    //! First IN error since the last read, reported by @ref ql_xrsp_usb_engine_read.
+    int rx_error;
+    //! Failed IN transfers are not resubmitted before this time.
+    uint64_t rx_retry_ns;
+    //! The device is gone, nothing is read until started again.
+    bool rx_gone;
+
+    ql_xrsp_usb_error_cb_t error_cb;
+    void *error_ptr;
+
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint32_t max_out_in_flight;
+};
+
+//! Queue a topic belongs to.
+enum ql_xrsp_usb_prio ql_xrsp_usb_topic_prio(uint8_t topic);
+
+/*!
+ * Takes ownership of @p backend and starts the event thread, no transfers are
+ * submitted until @ref ql_xrsp_usb_engine_start. On failure @p backend has
+ * already been destroyed.
+ */
+int ql_xrsp_usb_engine_init(struct ql_xrsp_usb_engine *e, struct ql_xrsp_usb_backend *backend, const struct ql_xrsp_usb_config *config,
+                            ql_xrsp_usb_error_cb_t error_cb, void *error_ptr);
+
+void ql_xrsp_usb_engine_destroy(struct ql_xrsp_usb_engine *e);
+
+//! Submit the IN transfers and anything queued, call once the device is open.
+void ql_xrsp_usb_engine_start(struct ql_xrsp_usb_engine *e);
+
+/*!
+ * Cancel everything in flight and fail queued sends, returns once no transfer
+ * is outstanding so the device can be closed. Must not be called from the
+ * event thread, calling it from a @ref ql_xrsp_usb_rx_cb_t is fine.
+ */
+void ql_xrsp_usb_engine_stop(struct ql_xrsp_usb_engine *e);
+
+/*!
+ * Frame and send every record of @p buf on @p topic, blocks until all of them
+ * have completed so the buffer can be reset. Must not be called from the event
+ * thread. Returns a @ref ql_xrsp_usb_status.
+ */
+int ql_xrsp_usb_engine_send(struct ql_xrsp_usb_engine *e, uint8_t topic, struct ql_xrsp_tx_buf *buf);
+
+/*!
+ * Like @ref ql_xrsp_usb_engine_send for a buffer of packets, queued at @p prio
+ * which should be the highest priority of the topics of its packets.
+ */
+int ql_xrsp_usb_engine_send_batch(struct ql_xrsp_usb_engine *e, enum ql_xrsp_usb_prio prio, struct ql_xrsp_tx_buf *buf);
+
+/*!
+ * Like @ref ql_xrsp_usb_engine_send but queues the records of all @p bufs as
+ * one send, so nothing else on a queue of the same priority gets in between.
+ */
+int ql_xrsp_usb_engine_send_bufs(struct ql_xrsp_usb_engine *e, uint8_t topic, struct ql_xrsp_tx_buf *const *bufs, uint32_t num_bufs);
+
+/*!
+ * Wait up to @p timeout_ns for IN data and hand every completed transfer to
+ * @p cb in order. Returns the number of transfers processed, or the first IN
+ * error seen since the last call. Failed IN transfers are resubmitted here, no
+ * sooner than QL_XRSP_USB_RETRY_NS after the last failure and never once the
+ * device is gone.
+ */
+int ql_xrsp_usb_engine_read(struct ql_xrsp_usb_engine *e, int64_t timeout_ns, ql_xrsp_usb_rx_cb_t cb, void *ptr);
+
+/*!
+ * Called by backends from @p handle_events when a transfer finishes.
+ */
+void ql_xrsp_usb_engine_complete(struct ql_xrsp_usb_xfer *xfer, int status, int32_t actual_length);
+
+/*!
+ * A libusb backend, the device is set with @ref ql_xrsp_usb_libusb_set_device.
+ */
+struct ql_xrsp_usb_backend *ql_xrsp_usb_libusb_create(libusb_context *ctx);
+
+//! Only call while the engine is stopped.
+void ql_xrsp_usb_libusb_set_device(struct ql_xrsp_usb_backend *b, libusb_device_handle *dev, uint8_t ep_in, uint8_t ep_out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,133 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  quest_link USB transfer engine backend using the libusb async API.
+ * @ingroup drv_quest_link
+ */
+
+#include <stdlib.h>
+
+#include <libusb.h>
+
+#include "ql_xrsp_usb_engine.h"
+
+// Same as the old blocking sends, reads stay outstanding until data arrives.
+#define QL_XRSP_USB_OUT_TIMEOUT_MS (1000)
+
+struct ql_xrsp_usb_libusb
+{
+    struct ql_xrsp_usb_backend base;
+
+    libusb_context *ctx;
+    libusb_device_handle *dev;
+    uint8_t ep_in;
+    uint8_t ep_out;
+};
+
+static int status_from_libusb_error(int r)
+{
+    switch (r)
+    {
+        case LIBUSB_SUCCESS: return QL_XRSP_USB_OK;
+        case LIBUSB_ERROR_TIMEOUT: return QL_XRSP_USB_TIMEOUT;
+        case LIBUSB_ERROR_NO_DEVICE: return QL_XRSP_USB_NO_DEVICE;
+        default: return QL_XRSP_USB_ERROR;
+    }
+}
+
+static void LIBUSB_CALL transfer_cb(struct libusb_transfer *t)
+{
+    struct ql_xrsp_usb_xfer *xfer = (struct ql_xrsp_usb_xfer *)t->user_data;
+    int status;
+
+    switch (t->status)
+    {
+        case LIBUSB_TRANSFER_COMPLETED: status = QL_XRSP_USB_OK; break;
+        case LIBUSB_TRANSFER_TIMED_OUT: status = QL_XRSP_USB_TIMEOUT; break;
+        case LIBUSB_TRANSFER_CANCELLED: status = QL_XRSP_USB_CANCELLED; break;
+        case LIBUSB_TRANSFER_NO_DEVICE: status = QL_XRSP_USB_NO_DEVICE; break;
+        default: status = QL_XRSP_USB_ERROR; break;
+    }
+
+    if (status == QL_XRSP_USB_OK && !xfer->is_in && !t->actual_length) {
+        status = QL_XRSP_USB_ERROR;
+    }
+
+    ql_xrsp_usb_engine_complete(xfer, status, t->actual_length);
+}
+
+static int backend_xfer_init(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer)
+{
+    xfer->backend_data = libusb_alloc_transfer(0);
+    return xfer->backend_data ? 0 : -1;
+}
+
+static void backend_xfer_fini(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer)
+{
+    libusb_free_transfer((struct libusb_transfer *)xfer->backend_data);
+    xfer->backend_data = NULL;
+}
+
+static int backend_submit(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer)
+{
+    struct ql_xrsp_usb_libusb *lb = (struct ql_xrsp_usb_libusb *)b;
+    struct libusb_transfer *t = (struct libusb_transfer *)xfer->backend_data;
+
+    if (!lb->dev) {
+        return QL_XRSP_USB_NO_DEVICE;
+    }
+
+    libusb_fill_bulk_transfer(t, lb->dev, xfer->is_in ? lb->ep_in : lb->ep_out, xfer->data, xfer->length, transfer_cb, xfer,
+                              xfer->is_in ? 0 : QL_XRSP_USB_OUT_TIMEOUT_MS);
+
+    return status_from_libusb_error(libusb_submit_transfer(t));
+}
+
+static void backend_cancel(struct ql_xrsp_usb_backend *b, struct ql_xrsp_usb_xfer *xfer)
+{
+    libusb_cancel_transfer((struct libusb_transfer *)xfer->backend_data);
+}
+
+static void backend_handle_events(struct ql_xrsp_usb_backend *b, int64_t timeout_ns)
+{
+    struct ql_xrsp_usb_libusb *lb = (struct ql_xrsp_usb_libusb *)b;
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ns / 1000000000;
+    tv.tv_usec = (timeout_ns % 1000000000) / 1000;
+
+    libusb_handle_events_timeout_completed(lb->ctx, &tv, NULL);
+}
+
+static void backend_destroy(struct ql_xrsp_usb_backend *b)
+{
+    free(b);
+}
+
+struct ql_xrsp_usb_backend *ql_xrsp_usb_libusb_create(libusb_context *ctx)
+{
+    struct ql_xrsp_usb_libusb *lb = (struct ql_xrsp_usb_libusb *)calloc(1, sizeof(*lb));
+    if (!lb) {
+        return NULL;
+    }
+
+    lb->base.xfer_init = backend_xfer_init;
+    lb->base.xfer_fini = backend_xfer_fini;
+    lb->base.submit = backend_submit;
+    lb->base.cancel = backend_cancel;
+    lb->base.handle_events = backend_handle_events;
+    lb->base.destroy = backend_destroy;
+    lb->ctx = ctx;
+
+    return &lb->base;
+}
+
+void ql_xrsp_usb_libusb_set_device(struct ql_xrsp_usb_backend *b, libusb_device_handle *dev, uint8_t ep_in, uint8_t ep_out)
+{
+    struct ql_xrsp_usb_libusb *lb = (struct ql_xrsp_usb_libusb *)b;
+
+    lb->dev = dev;
+    lb->ep_in = ep_in;
+    lb->ep_out = ep_out;
+}
@@ -86,6 +86,8 @@ configuration configuration::read_user_configuration()
 				SET_IF(offset_x);
 				SET_IF(offset_y);
 				SET_IF(bitrate);
+				SET_IF(min_bitrate);
+				SET_IF(fec_parity_ratio);
 				SET_IF(group);
 				SET_IF(codec);
 				if (e.codec == xrt::drivers::wivrn::video_codec(-1))
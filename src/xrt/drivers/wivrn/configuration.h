@@ -35,6 +35,8 @@ struct configuration
 		std::optional<double> offset_x;
 		std::optional<double> offset_y;
 		std::optional<int> bitrate;
+		std::optional<int> min_bitrate;
+		std::optional<double> fec_parity_ratio;
 		std::optional<int> group;
 		std::optional<xrt::drivers::wivrn::video_codec> codec;
 		std::map<std::string, std::string> options;
@@ -38,6 +38,9 @@ using namespace xrt::drivers::wivrn;
 
 // TODO: size independent bitrate
 DEBUG_GET_ONCE_NUM_OPTION(default_bitrate, "QL_OVERRIDE_BITRATE_KBPS", 130000)
+// set to the bitrate or more to disable adaptive bitrate
+DEBUG_GET_ONCE_NUM_OPTION(default_min_bitrate, "WIVRN_MIN_BITRATE_KBPS", 10000)
+DEBUG_GET_ONCE_FLOAT_OPTION(default_fec_parity_ratio, "WIVRN_FEC_PARITY_RATIO", 0.05)
 
 static bool is_nvidia(vk_bundle * vk)
 {
@@ -53,6 +56,8 @@ static std::vector<xrt::drivers::wivrn::encoder_settings> get_encoder_default_se
 	settings.height = height;
 	settings.codec = xrt::drivers::wivrn::h265;
 	settings.bitrate = debug_get_num_option_default_bitrate() * 1000;
+	settings.min_bitrate = debug_get_num_option_default_min_bitrate() * 1000;
+	settings.fec_parity_ratio = debug_get_float_option_default_fec_parity_ratio();
 
 	if (is_nvidia(vk))
 	{
@@ -110,6 +115,8 @@ std::vector<encoder_settings> xrt::drivers::wivrn::get_encoder_settings(vk_bundl
 			settings.offset_x = std::ceil(encoder.offset_x.value_or(0) * width);
 			settings.offset_y = std::ceil(encoder.offset_y.value_or(0) * height);
 			settings.bitrate = encoder.bitrate.value_or(debug_get_num_option_default_bitrate() * 1000);
+			settings.min_bitrate = encoder.min_bitrate.value_or(debug_get_num_option_default_min_bitrate() * 1000);
+			settings.fec_parity_ratio = encoder.fec_parity_ratio.value_or(debug_get_float_option_default_fec_parity_ratio());
 			settings.codec = encoder.codec.value_or(xrt::drivers::wivrn::h264);
 			settings.group = encoder.group.value_or(next_group);
 			settings.options = encoder.options;
@@ -33,6 +33,8 @@ struct encoder_settings : public to_headset::video_stream_description::item
 	// encoder identifier, such as nvenc, vaapi or x264
 	std::string encoder_name;
 	uint64_t bitrate;                           // bit/s
+	uint64_t min_bitrate;                       // bit/s, lower bound for adaptive bitrate
+	double fec_parity_ratio;                    // parity shards per data shard
 	std::map<std::string, std::string> options; // additional encoder-specific configuration
 	// encoders in the same group are executed in sequence
 	int group = 0;
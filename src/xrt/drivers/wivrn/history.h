@@ -0,0 +1,162 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Last MaxSamples samples of a tracked value, sorted by timestamp.
+//
+// Samples are added by a single thread (the session thread), get_at may be
+// called from any number of threads and never blocks the writer. The ring
+// is protected by a sequence lock: readers copy the two samples they need
+// and retry if a write happened meanwhile.
+//
+// Samples normally arrive in order and are appended in O(1), late samples
+// are moved into place.
+template <typename Data, size_t MaxSamples = 10>
+class history
+{
+	static_assert(std::is_trivially_copyable_v<Data>, "history samples are copied while they may be written");
+	static_assert(MaxSamples >= 2);
+
+	struct TimedData : public Data
+	{
+		TimedData() = default;
+		TimedData(const Data & d, uint64_t t) :
+		        Data(d), at_timestamp_ns(t) {}
+		uint64_t at_timestamp_ns;
+	};
+
+	// odd while add_sample is modifying the ring
+	std::atomic<uint32_t> sequence{0};
+	std::atomic<size_t> first{0};
+	std::atomic<size_t> count{0};
+	std::array<TimedData, MaxSamples> ring;
+
+	TimedData & at(size_t first, size_t i)
+	{
+		return ring[(first + i) % MaxSamples];
+	}
+
+protected:
+	// Only one thread may add samples.
+	void add_sample(uint64_t t, const Data & sample)
+	{
+		size_t first = this->first.load(std::memory_order_relaxed);
+		size_t count = this->count.load(std::memory_order_relaxed);
+
+		uint32_t seq = sequence.load(std::memory_order_relaxed);
+		sequence.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		if (count == 0 or at(first, count - 1).at_timestamp_ns < t)
+		{
+			if (count == MaxSamples)
+				first = (first + 1) % MaxSamples;
+			else
+				count++;
+			at(first, count - 1) = TimedData(sample, t);
+		}
+		else
+		{
+			size_t i = count;
+			while (i > 0 and at(first, i - 1).at_timestamp_ns > t)
+				i--;
+
+			if (i > 0 and at(first, i - 1).at_timestamp_ns == t)
+			{
+				at(first, i - 1) = TimedData(sample, t);
+			}
+			else if (i > 0 or count < MaxSamples)
+			{
+				// Older than everything when full: dropped.
+				if (count == MaxSamples)
+				{
+					first = (first + 1) % MaxSamples;
+					count--;
+					i--;
+				}
+				for (size_t j = count; j > i; j--)
+					at(first, j) = at(first, j - 1);
+				at(first, i) = TimedData(sample, t);
+				count++;
+			}
+		}
+
+		this->first.store(first, std::memory_order_relaxed);
+		this->count.store(count, std::memory_order_relaxed);
+		sequence.store(seq + 2, std::memory_order_release);
+	}
+
+public:
+	Data get_at(uint64_t at_timestamp_ns)
+	{
+		TimedData a{};
+		TimedData b{};
+		size_t count;
+
+		while (true)
+		{
+			uint32_t seq = sequence.load(std::memory_order_acquire);
+			if (seq & 1)
+				continue;
+
+			size_t first = this->first.load(std::memory_order_relaxed);
+			count = this->count.load(std::memory_order_relaxed);
+
+			if (count == 1)
+			{
+				a = at(first, 0);
+			}
+			else if (count > 1)
+			{
+				// Samples around at_timestamp_ns, or the two closest ones to extrapolate from.
+				size_t i = 1;
+				while (i < count - 1 and at(first, i).at_timestamp_ns <= at_timestamp_ns)
+					i++;
+				a = at(first, i - 1);
+				b = at(first, i);
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == seq)
+				break;
+		}
+
+		if (count == 0)
+			return {};
+
+		if (count == 1)
+			return a;
+
+		if (a.at_timestamp_ns <= at_timestamp_ns and b.at_timestamp_ns > at_timestamp_ns)
+		{
+			float t = float(b.at_timestamp_ns - at_timestamp_ns) /
+			          (b.at_timestamp_ns - a.at_timestamp_ns);
+			return interpolate(a, b, t);
+		}
+
+		return extrapolate(a, b, a.at_timestamp_ns, b.at_timestamp_ns, at_timestamp_ns);
+	}
+};
@@ -72,7 +72,7 @@ void pose_list::update_tracking(const from_headset::tracking & tracking, const c
 		if (pose.device != device)
 			continue;
 
-		add_sample(tracking.timestamp, convert_pose(pose), offset);
+		add_sample(offset.from_headset(tracking.timestamp), convert_pose(pose));
 		return;
 	}
 }
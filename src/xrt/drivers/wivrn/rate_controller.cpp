@@ -0,0 +1,161 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "rate_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace xrt::drivers::wivrn
+{
+
+namespace
+{
+// Link utilization above which the bitrate is cut, and below which it may grow.
+constexpr double max_utilization = 0.8;
+constexpr double target_utilization = 0.6;
+constexpr double low_utilization = 0.5;
+
+// Multiplicative decrease, bounded so a single bad window can't collapse the stream.
+constexpr double decrease = 0.85;
+constexpr double max_decrease = 0.5;
+// Additive increase per window, as a fraction of the maximum bitrate.
+constexpr double increase = 0.03;
+// Windows without increase after a decrease.
+constexpr int hold_windows = 3;
+
+// Parity shards per lost shard.
+constexpr double fec_margin = 3;
+} // namespace
+
+rate_controller::rate_controller(const settings & config) :
+        config(config),
+        bitrate(config.max_bitrate),
+        fec_parity_ratio(config.min_fec_parity_ratio),
+        current{config.max_bitrate, config.min_fec_parity_ratio}
+{
+}
+
+void rate_controller::feedback(const from_headset::feedback & feedback)
+{
+	const double interval = 1e9 / config.fps;
+
+	int sent = feedback.data_packets + feedback.parity_packets;
+	int received = feedback.received_data_packets + feedback.received_parity_packets;
+	shards_sent += sent;
+	shards_lost += std::max(0, sent - received);
+	if (received < feedback.data_packets)
+		unrecoverable++;
+
+	// The frame was sent as a burst, n shards arrive in n-1 shard times.
+	if (received >= 2 and feedback.received_first_packet and
+	    feedback.received_last_packet > feedback.received_first_packet)
+	{
+		double transfer = feedback.received_last_packet - feedback.received_first_packet;
+		utilization += transfer * received / (received - 1) / interval;
+		utilization_samples++;
+	}
+
+	if (feedback.sent_to_decoder and feedback.received_from_decoder > feedback.sent_to_decoder)
+		max_decode_time = std::max<double>(max_decode_time, feedback.received_from_decoder - feedback.sent_to_decoder);
+
+	// Frames leave every interval: any extra time between arrivals is queuing.
+	// Summed over the window this is the delay growth from its first frame to its last.
+	if (feedback.received_first_packet)
+	{
+		if (previous and feedback.frame_index > previous->first)
+		{
+			double expected = (feedback.frame_index - previous->first) * interval;
+			delay_trend += double(feedback.received_first_packet) - double(previous->second) - expected;
+		}
+		if (not previous or feedback.frame_index > previous->first)
+			previous = {feedback.frame_index, feedback.received_first_packet};
+	}
+
+	if (++frames >= config.update_interval)
+		update();
+}
+
+void rate_controller::update()
+{
+	const double interval = 1e9 / config.fps;
+
+	// React to loss immediately, forget it slowly.
+	double window_loss = shards_sent ? double(shards_lost) / shards_sent : 0;
+	loss = std::max(window_loss, 0.8 * loss + 0.2 * window_loss);
+	fec_parity_ratio = std::clamp(fec_margin * loss, config.min_fec_parity_ratio, config.max_fec_parity_ratio);
+
+	double mean_utilization = utilization_samples ? utilization / utilization_samples : 0;
+
+	bool overuse = unrecoverable > 0 or mean_utilization > max_utilization or delay_trend > 0.5 * interval or
+	               max_decode_time > interval;
+
+	if (overuse)
+	{
+		double factor = decrease;
+		if (mean_utilization > max_utilization)
+			factor = std::min(factor, target_utilization / mean_utilization);
+		bitrate = std::max<double>(config.min_bitrate, bitrate * std::max(factor, max_decrease));
+		hold = hold_windows;
+	}
+	else if (hold > 0)
+	{
+		hold--;
+	}
+	else if (mean_utilization < low_utilization)
+	{
+		bitrate = std::min<double>(config.max_bitrate, bitrate + increase * config.max_bitrate);
+	}
+
+	frames = 0;
+	shards_sent = 0;
+	shards_lost = 0;
+	unrecoverable = 0;
+	utilization = 0;
+	utilization_samples = 0;
+	max_decode_time = 0;
+	delay_trend = 0;
+
+	target t{uint64_t(bitrate), fec_parity_ratio};
+	std::lock_guard lock(mutex);
+	// Don't reconfigure the encoder for negligible parity changes.
+	if (t.bitrate != current.bitrate or std::abs(t.fec_parity_ratio - current.fec_parity_ratio) > 0.005)
+	{
+		current = t;
+		generation.fetch_add(1, std::memory_order_release);
+	}
+}
+
+std::optional<rate_controller::target> rate_controller::poll()
+{
+	uint32_t gen = generation.load(std::memory_order_acquire);
+	if (gen == applied_generation)
+		return std::nullopt;
+
+	applied_generation = gen;
+	return get_target();
+}
+
+rate_controller::target rate_controller::get_target()
+{
+	std::lock_guard lock(mutex);
+	return current;
+}
+
+} // namespace xrt::drivers::wivrn
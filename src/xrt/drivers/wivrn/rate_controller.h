@@ -0,0 +1,105 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "wivrn_packets.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace xrt::drivers::wivrn
+{
+
+// Bitrate and forward error correction for one video stream, driven by the
+// feedback the headset sends for each frame.
+//
+// Frames are sent in a burst, so the time between the first and the last
+// shard of a frame is the time the link needs to carry it: divided by the
+// frame interval it gives the link utilization. Every few frames:
+// - the parity ratio follows the measured shard loss,
+// - the bitrate is cut when frames could not be reconstructed, when the
+//   utilization is too high, when the arrival delay keeps growing or when
+//   the headset decoder can't keep up,
+// - otherwise it slowly grows back towards the configured bitrate.
+//
+// feedback is called by the session thread, poll by the encoder thread.
+class rate_controller
+{
+public:
+	struct settings
+	{
+		uint64_t min_bitrate; // bit/s
+		uint64_t max_bitrate; // bit/s, also the initial bitrate
+		double min_fec_parity_ratio;
+		double max_fec_parity_ratio = 0.5;
+		float fps;
+		// feedback messages between two updates
+		int update_interval = 10;
+	};
+
+	struct target
+	{
+		uint64_t bitrate;
+		double fec_parity_ratio;
+	};
+
+private:
+	const settings config;
+
+	// session thread only
+	int frames = 0;
+	int shards_sent = 0;
+	int shards_lost = 0;
+	int unrecoverable = 0;
+	double utilization = 0;
+	int utilization_samples = 0;
+	double max_decode_time = 0;
+	// growth of the one way delay over the window, ns
+	double delay_trend = 0;
+	std::optional<std::pair<uint64_t, uint64_t>> previous; // frame index, arrival time
+
+	double loss = 0;
+	double bitrate;
+	double fec_parity_ratio;
+	int hold = 0;
+
+	std::mutex mutex;
+	target current;
+	std::atomic<uint32_t> generation{0};
+
+	// encoder thread only
+	uint32_t applied_generation = 0;
+
+	void update();
+
+public:
+	explicit rate_controller(const settings &);
+
+	void feedback(const from_headset::feedback &);
+
+	// Returns the new target if it changed since the last call.
+	std::optional<target> poll();
+
+	target get_target();
+};
+
+} // namespace xrt::drivers::wivrn
@@ -18,7 +18,6 @@
  */
 
 #include "video_encoder.h"
-#include "external/rs.h"
 #include "util/u_logging.h"
 
 #include "../quest_link/ql_types.h"
@@ -98,6 +97,11 @@ std::unique_ptr<VideoEncoder> VideoEncoder::Create(
 		res->stream_idx = stream_idx;
 		res->slice_idx = slice_idx;
 		res->num_slices = num_slices;
+		res->fec.set_parity_ratio(settings.fec_parity_ratio);
+		// Until frames have been sent, guess the shard count from the bitrate.
+		size_t shards = settings.bitrate / std::max(fps, 1.f) / 8 / to_headset::video_stream_data_shard::max_payload_size;
+		res->fec_expected_shards[0] = std::max<size_t>(1, shards / num_slices);
+		res->fec_expected_shards[1] = std::max<size_t>(1, 4 * shards / num_slices);
 	}
 	else
 	{
@@ -118,79 +122,62 @@ void VideoEncoder::Encode(wivrn_session* cnx,
 	this->frame_idx = frame_index;
 	auto target_timestamp = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(view_info.display_time));
 
-	shards.clear();
+	if (rate)
+	{
+		if (auto target = rate->poll())
+		{
+			SetBitrate(target->bitrate);
+			fec.set_parity_ratio(target->fec_parity_ratio);
+		}
+	}
+
+	frame_data.clear();
+	batch.clear();
+	num_shards = 0;
+	pending_shard.reset();
+	if (cnx)
+	{
+		// Serialized shards carry a few bytes of header and the view info on top of the payload.
+		const size_t max_shard_size = to_headset::video_stream_data_shard::max_payload_size + 256;
+		fec.begin(fec_expected_shards[idr], max_shard_size);
+	}
 	Encode(index, idr, target_timestamp);
-	if (shards.empty())
+	if (not pending_shard)
 		return;
 	const size_t view_info_size = sizeof(to_headset::video_stream_data_shard::view_info_t);
-	if (shards.back().payload.size() + view_info_size > to_headset::video_stream_data_shard::max_payload_size)
+	if (pending_size + view_info_size > to_headset::video_stream_data_shard::max_payload_size)
 	{
 		// Push empty data so previous shard is sent and counters are set
-		PushShard({}, to_headset::video_stream_data_shard::start_of_slice | to_headset::video_stream_data_shard::end_of_slice);
+		PushShard(nullptr, 0, to_headset::video_stream_data_shard::start_of_slice | to_headset::video_stream_data_shard::end_of_slice);
 	}
-	shards.back().view_info = view_info;
-	shards.back().flags |= to_headset::video_stream_data_shard::end_of_frame;
+	pending_shard->view_info = view_info;
+	pending_shard->flags |= to_headset::video_stream_data_shard::end_of_frame;
 	//if (host)
 	//	host->flush_stream(host);
-	if (cnx)
-		cnx->send_stream(shards.back());
-
-	// forward error correction
-	std::vector<std::vector<uint8_t>> data_shards;
-	data_shards.reserve(shards.size());
-	size_t max_size = 0;
-	for (const auto & shard: shards)
-	{
-		serialization_packet packet;
-		packet.serialize(shard);
-		const auto & serialized = data_shards.emplace_back(std::move(packet));
-		max_size = std::max(max_size, serialized.size());
-	}
-
-	size_t parity = std::max<size_t>(1, shards.size() * 0.05);
-	std::vector<std::vector<uint8_t>> parity_shards(parity);
-
-	std::vector<unsigned char *> shard_pointers;
-
-	for (auto & shard: data_shards)
-	{
-		shard.resize(max_size, 0);
-		shard_pointers.push_back(shard.data());
-	}
+	if (not cnx)
+		return;
+	QueueShard();
 
-	for (auto & shard: parity_shards)
+	// forward error correction, only the last shard was left to add
+	fec_expected_shards[idr] = num_shards;
+	size_t parity = fec.end();
+	if (parity == 0)
 	{
-		shard.resize(max_size, 0);
-		shard_pointers.push_back(shard.data());
+		U_LOG_D("no forward error correction for %d data shards", num_shards);
 	}
-
-	static std::once_flag once;
-	std::call_once(once, reed_solomon_init);
-
-	std::unique_ptr<reed_solomon, void (*)(reed_solomon *)> rs(reed_solomon_new(shards.size(), parity),
-	                                                           reed_solomon_release);
-	if (rs)
+	else
 	{
-		reed_solomon_encode(rs.get(), shard_pointers.data(), shard_pointers.size(), max_size);
-
-		for (auto & shard: parity_shards)
+		parity_shard.stream_item_idx = stream_idx;
+		parity_shard.frame_idx = frame_idx;
+		parity_shard.data_shard_count = fec.data_count();
+		parity_shard.num_parity_elements = parity;
+		for (size_t i = 0; i < parity; i++)
 		{
-			to_headset::video_stream_parity_shard packet{};
-			packet.stream_item_idx = stream_idx;
-			packet.frame_idx = frame_idx;
-			packet.data_shard_count = data_shards.size();
-			packet.num_parity_elements = parity;
-			packet.payload = std::move(shard);
-			//hex_dump(packet.payload.data(), packet.payload.size());
-			//printf("Encoded data!\n");
-			if (cnx)
-				cnx->send_stream(packet);
+			parity_shard.parity_element = i;
+			batch.add(parity_shard, fec.parity(i), fec.shard_size());
 		}
 	}
-	else
-	{
-		U_LOG_W("failed to setup reed_solomon encoder with %ld data shards", data_shards.size());
-	}
+	cnx->send_stream(batch);
 }
 
 void VideoEncoder::FlushFrame(int64_t target_ns, int index)
@@ -209,29 +196,7 @@ void VideoEncoder::SendCSD(std::vector<uint8_t> && data, int index)
 		host->send_csd(host, data.data(), data.size(), index, slice_idx);
 		return;
 	}
-	auto & max_payload_size = to_headset::video_stream_data_shard::max_payload_size;
-	std::lock_guard lock(mutex);
-
-	//hex_dump(data.data(), data.size());
-
-	uint8_t flags = to_headset::video_stream_data_shard::start_of_slice;
-	if (data.size() <= max_payload_size)
-	{
-		PushShard(std::move(data), flags | to_headset::video_stream_data_shard::end_of_slice);
-	}
-	auto begin = data.begin();
-	auto end = data.end();
-	while (begin != end)
-	{
-		auto next = std::min(end, begin + max_payload_size);
-		if (next == end)
-		{
-			flags |= to_headset::video_stream_data_shard::end_of_slice;
-		}
-		PushShard({begin, next}, flags);
-		begin = next;
-		flags = 0;
-	}
+	SendData(std::move(data));
 }
 
 void VideoEncoder::SendIDR(std::vector<uint8_t> && data, int index)
@@ -241,45 +206,74 @@ void VideoEncoder::SendIDR(std::vector<uint8_t> && data, int index)
 		host->send_idr(host, data.data(), data.size(), index, slice_idx);
 		return;
 	}
+	SendData(std::move(data));
+}
+
+uint8_t * VideoEncoder::ReserveIDR(size_t max_len, int index)
+{
+	if (not host or not host->reserve_idr)
+		return nullptr;
+	return host->reserve_idr(host, max_len, index, slice_idx);
+}
+
+void VideoEncoder::CommitIDR(size_t len, int index)
+{
+	host->commit_idr(host, len, index, slice_idx);
+}
+
+void VideoEncoder::SendData(std::vector<uint8_t> && data)
+{
 	auto & max_payload_size = to_headset::video_stream_data_shard::max_payload_size;
 	std::lock_guard lock(mutex);
 
 	//hex_dump(data.data(), data.size());
 
+	// Moving the vector keeps its data where it is.
+	const auto & buffer = frame_data.emplace_back(std::move(data));
+
 	uint8_t flags = to_headset::video_stream_data_shard::start_of_slice;
-	if (data.size() <= max_payload_size)
-	{
-		PushShard(std::move(data), flags | to_headset::video_stream_data_shard::end_of_slice);
-	}
-	auto begin = data.begin();
-	auto end = data.end();
-	while (begin != end)
+	size_t begin = 0;
+	do
 	{
-		auto next = std::min(end, begin + max_payload_size);
-		if (next == end)
+		size_t next = std::min(buffer.size(), begin + max_payload_size);
+		if (next == buffer.size())
 		{
 			flags |= to_headset::video_stream_data_shard::end_of_slice;
 		}
-		PushShard({begin, next}, flags);
+		PushShard(buffer.data() + begin, next - begin, flags);
 		begin = next;
 		flags = 0;
-	}
+	} while (begin != buffer.size());
+
+	// Everything but the latest shard can go.
+	if (cnx)
+		cnx->send_stream(batch);
 }
 
-void VideoEncoder::PushShard(std::vector<uint8_t> && payload, uint8_t flags)
+void VideoEncoder::PushShard(const uint8_t * payload, size_t size, uint8_t flags)
 {
-	if (not shards.empty())
-	{
-		if (cnx)
-			cnx->send_stream(shards.back());
-	}
-	to_headset::video_stream_data_shard shard;
+	if (pending_shard)
+		QueueShard();
+
+	auto & shard = pending_shard.emplace();
 	shard.stream_item_idx = stream_idx;
 	shard.frame_idx = frame_idx;
-	shard.shard_idx = shards.size();
+	shard.shard_idx = num_shards++;
 	shard.flags = flags;
-	shard.payload = std::move(payload);
-	shards.emplace_back(std::move(shard));
+	pending_payload = payload;
+	pending_size = size;
+}
+
+void VideoEncoder::QueueShard()
+{
+	if (not cnx)
+		return;
+
+	batch.add(*pending_shard, pending_payload, pending_size);
+
+	size_t count;
+	const iovec * parts = batch.last_shard(count);
+	fec.add(parts, count);
 }
 
 } // namespace xrt::drivers::wivrn
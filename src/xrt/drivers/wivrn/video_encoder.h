@@ -23,11 +23,15 @@
 #include <chrono>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <vector>
 #include <vulkan/vulkan.h>
 
 #include "encoder_settings.h"
+#include "rate_controller.h"
+#include "video_fec.h"
 #include "wivrn_packets.h"
+#include "wivrn_stream_batch.h"
 #include "wivrn_session.h"
 
 typedef struct ql_xrsp_host ql_xrsp_host;
@@ -50,7 +54,26 @@ class VideoEncoder
 	wivrn_session * cnx;
 	ql_xrsp_host* host;
 
-	std::vector<to_headset::video_stream_data_shard> shards;
+	// Encoder output for the current frame, shards point into it until the
+	// frame has been sent.
+	std::vector<std::vector<uint8_t>> frame_data;
+	stream_batch batch;
+	uint16_t num_shards;
+
+	// Latest shard, it is queued when the next one is pushed or when the
+	// frame ends, as it then gets the view info.
+	std::optional<to_headset::video_stream_data_shard> pending_shard;
+	const uint8_t * pending_payload;
+	size_t pending_size;
+
+	// forward error correction, computed while the shards are queued
+	video_fec fec;
+	to_headset::video_stream_parity_shard parity_shard;
+	// number of data shards of the last P and IDR frames, sizes the parity
+	size_t fec_expected_shards[2] = {};
+
+	// adaptive bitrate, nullptr if the bitrate is fixed
+	std::shared_ptr<rate_controller> rate;
 
 public:
 	uint8_t slice_idx;
@@ -87,6 +110,15 @@ public:
 	            bool idr);
 	virtual void ModifyBitrate(int amount){}
 
+	// Threads the encoder may use for each frame, between two frames.
+	// Encoders that can't do it ignore it.
+	virtual void SetThreads(int threads) {}
+
+	void SetRateController(std::shared_ptr<rate_controller> rate)
+	{
+		this->rate = std::move(rate);
+	}
+
 	void SetXrspHost(struct ql_xrsp_host* host)
 	{
 		this->host = host;
@@ -96,14 +128,28 @@ protected:
 	// encode the image at provided index.
 	virtual void Encode(int index, bool idr, std::chrono::steady_clock::time_point target_timestamp) = 0;
 
+	// Change the bitrate without restarting the stream, called between two
+	// frames on the encoding thread. Encoders that can't do it keep their
+	// initial bitrate.
+	virtual void SetBitrate(uint64_t bitrate) {}
+
 	void SendCSD(std::vector<uint8_t> && data, int index);
 
 	void SendIDR(std::vector<uint8_t> && data, int index);
 
+	// Quest Link only: write encoded data straight into the transport's
+	// buffers. Returns nullptr if not possible, every non-null reservation
+	// must be followed by CommitIDR.
+	uint8_t * ReserveIDR(size_t max_len, int index);
+
+	void CommitIDR(size_t len, int index);
+
 	void FlushFrame(int64_t target_ns, int index);
 
 private:
-	void PushShard(std::vector<uint8_t> && payload, uint8_t flags);
+	void SendData(std::vector<uint8_t> && data);
+	void PushShard(const uint8_t * payload, size_t size, uint8_t flags);
+	void QueueShard();
 };
 
 } // namespace xrt::drivers::wivrn
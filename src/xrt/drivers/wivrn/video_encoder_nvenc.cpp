@@ -133,7 +133,8 @@ void VideoEncoderNvenc::SetImages(int full_width,
 	preset_config.presetCfg.version = NV_ENC_CONFIG_VER;
 	NVENC_CHECK(fn.nvEncGetEncodePresetConfig(session_handle, encodeGUID, presetGUID, &preset_config));
 
-	NV_ENC_CONFIG params = preset_config.presetCfg;
+	config = preset_config.presetCfg;
+	NV_ENC_CONFIG & params = config;
 
 	// Bitrate control
 	params.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
@@ -159,7 +160,8 @@ void VideoEncoderNvenc::SetImages(int full_width,
 			break;
 	}
 
-	NV_ENC_INITIALIZE_PARAMS params2{};
+	init_params = {};
+	NV_ENC_INITIALIZE_PARAMS & params2 = init_params;
 	params2.version = NV_ENC_INITIALIZE_PARAMS_VER;
 	params2.encodeGUID = encodeGUID;
 	params2.presetGUID = presetGUID;
@@ -241,6 +243,26 @@ void VideoEncoderNvenc::SetImages(int full_width,
 	CU_CHECK(cuCtxPopCurrent(NULL));
 }
 
+void VideoEncoderNvenc::SetBitrate(uint64_t bitrate)
+{
+	if (int(bitrate) == this->bitrate)
+		return;
+	this->bitrate = bitrate;
+
+	config.rcParams.averageBitRate = bitrate;
+	config.rcParams.maxBitRate = bitrate;
+	config.rcParams.vbvBufferSize = bitrate / fps;
+	config.rcParams.vbvInitialDelay = bitrate / fps;
+
+	NV_ENC_RECONFIGURE_PARAMS params{};
+	params.version = NV_ENC_RECONFIGURE_PARAMS_VER;
+	params.reInitEncodeParams = init_params;
+	params.reInitEncodeParams.encodeConfig = &config;
+	params.resetEncoder = 0;
+	params.forceIDR = 0;
+	NVENC_CHECK(fn.nvEncReconfigureEncoder(session_handle, &params));
+}
+
 void VideoEncoderNvenc::Encode(int index, bool idr, std::chrono::steady_clock::time_point pts)
 {
 	CU_CHECK(cuCtxPushCurrent(cuda));
@@ -53,6 +53,10 @@ class VideoEncoderNvenc : public VideoEncoder
 	float fps;
 	int bitrate;
 
+	// kept to change the bitrate with nvEncReconfigureEncoder
+	NV_ENC_CONFIG config;
+	NV_ENC_INITIALIZE_PARAMS init_params;
+
 	bool supports_frame_invalidation;
 
 public:
@@ -67,6 +71,8 @@ public:
 	               VkDeviceMemory * memory) override;
 
 	void Encode(int index, bool idr, std::chrono::steady_clock::time_point pts) override;
+
+	void SetBitrate(uint64_t bitrate) override;
 };
 
 } // namespace xrt::drivers::wivrn
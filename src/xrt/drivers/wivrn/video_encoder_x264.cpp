@@ -21,8 +21,11 @@
 
 #include "util/u_debug.h"
 
+#include <algorithm>
 #include <stdexcept>
 
+// Starting thread count, the Quest Link target replaces it with its own split
+// of QL_ENCODER_THREADS unless that is set to 0.
 DEBUG_GET_ONCE_NUM_OPTION(threads_per_slice, "QL_THREADS_PER_SLICE", 1)
 
 static void hex_dump(const uint8_t* b, size_t amt)
@@ -40,25 +43,43 @@ static void hex_dump(const uint8_t* b, size_t amt)
 namespace xrt::drivers::wivrn
 {
 
-void VideoEncoderX264::ProcessCb(x264_t * h, x264_nal_t * nal, void * opaque)
+static std::vector<uint8_t> encode_nal(x264_t * h, x264_nal_t * nal, size_t max_size)
 {
-	VideoEncoderX264 * self = (VideoEncoderX264 *)opaque;
-	std::vector<uint8_t> data(nal->i_payload * 3 / 2 + 5 + 64, 0);
+	std::vector<uint8_t> data(max_size, 0);
 	x264_nal_encode(h, data.data(), nal);
 	data.resize(nal->i_payload);
+	return data;
+}
+
+// x264 only changes the bitrate on reconfig when VBV is enabled, the buffer
+// holds a few frames so that IDR frames are not starved.
+static void set_rate_control(x264_param_t & param, uint64_t bitrate)
+{
+	param.rc.i_bitrate = std::max<int>(1, bitrate / 1000); // x264 uses kbit/s
+	param.rc.i_vbv_max_bitrate = param.rc.i_bitrate;
+	param.rc.i_vbv_buffer_size = std::max<int>(1, 4 * uint64_t(param.rc.i_bitrate) * param.i_fps_den / param.i_fps_num);
+}
+
+void VideoEncoderX264::ProcessCb(x264_t * h, x264_nal_t * nal, void * opaque)
+{
+	VideoEncoderX264 * self = (VideoEncoderX264 *)opaque;
+	// worst case size written by x264_nal_encode
+	const size_t max_size = nal->i_payload * 3 / 2 + 5 + 64;
 	//printf("%x/%x\n", self->current_index, nal->i_type);
 	switch (nal->i_type)
 	{
 		case NAL_SPS:
 		case NAL_PPS:
-			self->SendCSD(std::move(data), self->current_index);
+			self->SendCSD(encode_nal(h, nal, max_size), self->current_index);
 			break;
 		case NAL_SLICE:
 		case NAL_SLICE_DPA:
 		case NAL_SLICE_DPB:
 		case NAL_SLICE_DPC:
 		case NAL_SLICE_IDR:
-			self->ProcessNal({nal->i_first_mb, nal->i_last_mb, self->current_index, std::move(data)});
+			if (self->EncodeInPlace(h, nal, max_size))
+				break;
+			self->ProcessNal({nal->i_first_mb, nal->i_last_mb, self->current_index, encode_nal(h, nal, max_size)});
 			//self->SendData(std::move(data));
 			break;
 		case NAL_AUD:
@@ -67,6 +88,24 @@ void VideoEncoderX264::ProcessCb(x264_t * h, x264_nal_t * nal, void * opaque)
 	}
 }
 
+bool VideoEncoderX264::EncodeInPlace(x264_t * h, x264_nal_t * nal, size_t max_size)
+{
+	std::lock_guard lock(mutex);
+	// out of order slices still go through pending_nals
+	if (nal->i_first_mb != next_mb)
+		return false;
+
+	uint8_t * dst = ReserveIDR(max_size, current_index);
+	if (not dst)
+		return false;
+	x264_nal_encode(h, dst, nal);
+	CommitIDR(nal->i_payload, current_index);
+
+	next_mb = nal->i_last_mb + 1;
+	SendPendingNals();
+	return true;
+}
+
 void VideoEncoderX264::ProcessNal(pending_nal && nal)
 {
 	std::lock_guard lock(mutex);
@@ -80,9 +119,14 @@ void VideoEncoderX264::ProcessNal(pending_nal && nal)
 	{
 		InsertInPendingNal(std::move(nal));
 	}
+	SendPendingNals();
+}
+
+void VideoEncoderX264::SendPendingNals()
+{
 	while ((not pending_nals.empty()) and pending_nals.front().first_mb == next_mb)
 	{
-		SendIDR(std::move(pending_nals.front().data), nal.index);
+		SendIDR(std::move(pending_nals.front().data), pending_nals.front().index);
 		next_mb = pending_nals.front().last_mb + 1;
 		pending_nals.pop_front();
 		//printf("pop!\n");
@@ -162,8 +206,7 @@ VideoEncoderX264::VideoEncoderX264(
 	param.vui.i_sar_width = settings.width;
 	param.vui.i_sar_height = settings.height / num_slices;
 	param.rc.i_rc_method = X264_RC_ABR;
-	param.rc.i_bitrate = settings.bitrate / (num_slices*1000); // x264 uses kbit/s
-	//param.rc.i_vbv_max_bitrate = param.rc.i_bitrate;
+	set_rate_control(param, settings.bitrate / num_slices);
 	param.i_keyint_min = 1;
 	param.i_keyint_max = 72*5;
 
@@ -226,89 +269,45 @@ void VideoEncoderX264::Encode(int index, bool idr, std::chrono::steady_clock::ti
 
 void VideoEncoderX264::ModifyBitrate(int amount)
 {
-#if 0
-	x264_encoder_parameters(enc, &param);
-	uint64_t orig_desired_bitrate = desired_bitrate;
-	desired_bitrate += amount;
-	if (desired_bitrate <= 0 || (amount < 0 && -amount > orig_desired_bitrate)) {
-		desired_bitrate = this->num_slices*1000;
-	}
-	else if (desired_bitrate > original_bitrate * 2) {
-		desired_bitrate = original_bitrate * 2;
-	}
-	
+	// The encode time heuristic of the Quest Link target would starve the
+	// stream, the bitrate is only set from headset feedback in SetBitrate.
+}
 
-	if (orig_desired_bitrate != desired_bitrate) 
-	{
-		//x264_param_apply_profile(&param, "baseline");
-		//param.rc.i_bitrate = desired_bitrate;
-		//param.rc.i_vbv_max_bitrate = param.rc.i_bitrate;
-		//x264_encoder_reconfig(enc, &param);
-		
-
-		uint32_t orig_w = param.i_width;
-		uint32_t orig_h = param.i_height;
-		uint32_t orig_fps = param.i_fps_num;
-
-		x264_encoder_close(enc);
-
-		param = {};
-		x264_param_default_preset(&param, "ultrafast", "zerolatency");
-		param.nalu_process = &ProcessCb;
-		//param.i_slice_max_size = 0x3E000 / num_slices;
-		param.i_slice_count = 1; // host->num_slices, 5
-		param.i_width = orig_w;
-		param.i_height = orig_h;
-		param.i_log_level = X264_LOG_WARNING;
-		param.i_fps_num = orig_fps;
-		param.i_fps_den = 1'000'000;
-		param.b_repeat_headers = 1;
-		param.b_aud = 1;
-		param.b_annexb = 1;
-
-		// colour definitions, actually ignored by decoder
-		param.vui.i_vidformat = 5;
-		param.vui.b_fullrange = 1;
-		param.vui.i_colorprim = 1; // BT.709
-		param.vui.i_transfer = 1; // sRGB
-		param.vui.i_colmatrix = 1; // BT.709
-		param.vui.i_chroma_loc = 1;
-
-		param.analyse.i_chroma_qp_offset = -2;
-		
-		param.vui.i_sar_width = orig_w;
-		param.vui.i_sar_height = orig_h;
-		param.rc.i_rc_method = X264_RC_ABR;
-		param.rc.i_bitrate = desired_bitrate / (this->num_slices*1000);
-		//param.rc.i_vbv_max_bitrate = param.rc.i_bitrate;
-		param.i_keyint_min = 1;
-		param.i_keyint_max = 72*5;
-
-		x264_param_apply_profile(&param, "baseline");
-
-		enc = x264_encoder_open(&param);
-		if (not enc)
-		{
-			throw std::runtime_error("failed to create x264 encoder");
-		}
+void VideoEncoderX264::SetBitrate(uint64_t bitrate)
+{
+	if (bitrate == desired_bitrate)
+		return;
+	desired_bitrate = bitrate;
 
-		assert(x264_encoder_maximum_delayed_frames(enc) == 0);
+	// param is kept as given to x264_encoder_open, for SetThreads
+	set_rate_control(param, bitrate / num_slices);
 
-		auto & pic = pic_in;
-		x264_picture_init(&pic);
-		pic.opaque = this;
-		pic.img.i_csp = X264_CSP_NV12;
-		pic.img.i_plane = 2;
+	// Applies from the next frame, without an IDR
+	x264_param_t current;
+	x264_encoder_parameters(enc, &current);
+	set_rate_control(current, bitrate / num_slices);
+	if (x264_encoder_reconfig(enc, &current) < 0)
+		U_LOG_W("x264_encoder_reconfig failed, bitrate %zu kbits per second", (size_t)current.rc.i_bitrate);
+}
 
-		pic.img.i_stride[0] = converter->y.stride;
-		pic.img.plane[0] = (uint8_t *)converter->y.mapped_memory;
-		pic.img.i_stride[1] = converter->uv.stride;
-		pic.img.plane[1] = (uint8_t *)converter->uv.mapped_memory;
+void VideoEncoderX264::SetThreads(int threads)
+{
+	if (threads == param.i_threads)
+		return;
 
-		x264_encoder_parameters(enc, &param);
-		U_LOG_W("Bitrate changed to %zu kbits per second", (size_t)param.rc.i_bitrate);
+	// x264 can't change its thread count in place, the new encoder starts with an IDR
+	x264_param_t new_param = param;
+	new_param.i_threads = threads;
+	x264_t * new_enc = x264_encoder_open(&new_param);
+	if (not new_enc)
+	{
+		U_LOG_W("failed to reopen x264 encoder with %d threads", threads);
+		return;
 	}
-#endif
+
+	x264_encoder_close(enc);
+	enc = new_enc;
+	param = new_param;
 }
 
 VideoEncoderX264::~VideoEncoderX264()
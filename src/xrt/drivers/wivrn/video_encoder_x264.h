@@ -71,13 +71,21 @@ public:
 
 	void ModifyBitrate(int amount) override;
 
+	void SetBitrate(uint64_t bitrate) override;
+
+	void SetThreads(int threads) override;
+
 	~VideoEncoderX264();
 
 private:
 	static void ProcessCb(x264_t * h, x264_nal_t * nal, void * opaque);
 
+	bool EncodeInPlace(x264_t * h, x264_nal_t * nal, size_t max_size);
+
 	void ProcessNal(pending_nal && nal);
 
+	void SendPendingNals();
+
 	void InsertInPendingNal(pending_nal && nal);
 };
 
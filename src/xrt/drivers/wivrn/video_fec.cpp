@@ -0,0 +1,343 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "video_fec.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define WIVRN_FEC_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define WIVRN_FEC_NEON
+#include <arm_neon.h>
+#endif
+
+namespace xrt::drivers::wivrn
+{
+
+namespace
+{
+
+// Same field as external/rs.c, GF_PP "101110001"
+struct gf_tables
+{
+	uint8_t exp[510];
+	int log[256];
+	uint8_t inverse[256];
+
+	gf_tables()
+	{
+		int x = 1;
+		for (int i = 0; i < 255; i++)
+		{
+			exp[i] = exp[i + 255] = x;
+			log[x] = i;
+			x <<= 1;
+			if (x & 0x100)
+				x ^= 0x11d;
+		}
+		log[0] = 255;
+
+		inverse[0] = 0;
+		for (int i = 1; i < 256; i++)
+			inverse[i] = exp[(255 - log[i]) % 255];
+	}
+
+	uint8_t mul(uint8_t a, uint8_t b) const
+	{
+		if (a == 0 or b == 0)
+			return 0;
+		return exp[log[a] + log[b]];
+	}
+};
+
+const gf_tables & gf()
+{
+	static const gf_tables tables;
+	return tables;
+}
+
+// Products of one coefficient with every low and high nibble, the SIMD
+// kernels look them up with a byte shuffle.
+struct gf_coef
+{
+	alignas(16) uint8_t lo[16];
+	alignas(16) uint8_t hi[16];
+
+	explicit gf_coef(uint8_t c)
+	{
+		for (int x = 0; x < 16; x++)
+		{
+			lo[x] = gf().mul(c, x);
+			hi[x] = gf().mul(c, x << 4);
+		}
+	}
+};
+
+using addmul_fn = void (*)(uint8_t * dst, const uint8_t * src, size_t size, const gf_coef & k);
+
+// dst ^= c * src
+void addmul_none(uint8_t * dst, const uint8_t * src, size_t size, const gf_coef & k)
+{
+	for (size_t i = 0; i < size; i++)
+		dst[i] ^= k.lo[src[i] & 0x0f] ^ k.hi[src[i] >> 4];
+}
+
+#ifdef WIVRN_FEC_X86
+__attribute__((target("ssse3"))) void addmul_ssse3(uint8_t * dst, const uint8_t * src, size_t size, const gf_coef & k)
+{
+	const __m128i lo = _mm_load_si128((const __m128i *)k.lo);
+	const __m128i hi = _mm_load_si128((const __m128i *)k.hi);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+		                          _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+	}
+	addmul_none(dst + i, src + i, size - i, k);
+}
+
+__attribute__((target("avx2"))) void addmul_avx2(uint8_t * dst, const uint8_t * src, size_t size, const gf_coef & k)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)k.lo));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)k.hi));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+		                             _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+	}
+	addmul_none(dst + i, src + i, size - i, k);
+}
+#endif
+
+#ifdef WIVRN_FEC_NEON
+void addmul_neon(uint8_t * dst, const uint8_t * src, size_t size, const gf_coef & k)
+{
+	const uint8x16_t lo = vld1q_u8(k.lo);
+	const uint8x16_t hi = vld1q_u8(k.hi);
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		uint8x16_t s = vld1q_u8(src + i);
+		uint8x16_t p = veorq_u8(vqtbl1q_u8(lo, vandq_u8(s, mask)), vqtbl1q_u8(hi, vshrq_n_u8(s, 4)));
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+	}
+	addmul_none(dst + i, src + i, size - i, k);
+}
+#endif
+
+addmul_fn get_addmul(video_fec::simd kernel)
+{
+	switch (kernel)
+	{
+#ifdef WIVRN_FEC_X86
+		case video_fec::simd::ssse3:
+			return addmul_ssse3;
+		case video_fec::simd::avx2:
+			return addmul_avx2;
+#endif
+#ifdef WIVRN_FEC_NEON
+		case video_fec::simd::neon:
+			return addmul_neon;
+#endif
+		default:
+			return addmul_none;
+	}
+}
+
+} // namespace
+
+struct video_fec::codec
+{
+	size_t num_parity;
+	// Coefficient of data shard i in parity shard j at [i * num_parity + j],
+	// the rows reed_solomon_new builds: inverse[(parity_shards + i) ^ j]
+	std::vector<gf_coef> coefs;
+
+	explicit codec(size_t num_parity) :
+	        num_parity(num_parity)
+	{
+		size_t num_data = max_shards - num_parity;
+		coefs.reserve(num_data * num_parity);
+		for (size_t i = 0; i < num_data; i++)
+		{
+			for (size_t j = 0; j < num_parity; j++)
+				coefs.emplace_back(gf().inverse[(num_parity + i) ^ j]);
+		}
+	}
+
+	// Codecs are built once per parity count and shared by all encoders.
+	static const codec & get(size_t num_parity)
+	{
+		static std::mutex mutex;
+		static std::array<std::unique_ptr<codec>, max_shards> cache;
+
+		std::lock_guard lock(mutex);
+		auto & c = cache[num_parity];
+		if (not c)
+			c = std::make_unique<codec>(num_parity);
+		return *c;
+	}
+};
+
+video_fec::video_fec(double parity_ratio, simd kernel) :
+        kernel(kernel)
+{
+	set_parity_ratio(parity_ratio);
+}
+
+bool video_fec::supported(simd kernel)
+{
+	switch (kernel)
+	{
+		case simd::none:
+			return true;
+#ifdef WIVRN_FEC_X86
+		case simd::ssse3:
+			return __builtin_cpu_supports("ssse3");
+		case simd::avx2:
+			return __builtin_cpu_supports("avx2");
+#endif
+#ifdef WIVRN_FEC_NEON
+		case simd::neon:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+video_fec::simd video_fec::best_simd()
+{
+	for (simd kernel: {simd::avx2, simd::ssse3, simd::neon})
+	{
+		if (supported(kernel))
+			return kernel;
+	}
+	return simd::none;
+}
+
+const char * video_fec::simd_name(simd kernel)
+{
+	switch (kernel)
+	{
+		case simd::none:
+			return "none";
+		case simd::ssse3:
+			return "ssse3";
+		case simd::avx2:
+			return "avx2";
+		case simd::neon:
+			return "neon";
+	}
+	return "?";
+}
+
+size_t video_fec::parity_for(size_t data_shards, double parity_ratio)
+{
+	size_t parity = std::max<size_t>(1, size_t(data_shards * parity_ratio));
+
+	// Frames that don't fit a GF(2^8) code with this many go without parity,
+	// the count is only capped so there is a codec for it.
+	return std::min<size_t>(parity, max_shards - 1);
+}
+
+void video_fec::set_parity_ratio(double ratio)
+{
+	parity_ratio = std::clamp(ratio, 0.0, 1.0);
+}
+
+void video_fec::begin(size_t expected_data_shards, size_t max_shard_size)
+{
+	num_parity = parity_for(expected_data_shards, parity_ratio);
+	num_data = 0;
+	max_size = 0;
+	overflow = false;
+	current = &codec::get(num_parity);
+
+	// Keeps its capacity from one frame to the next.
+	stride = (max_shard_size + 31) & ~size_t(31);
+	parity_data.assign(num_parity * stride, 0);
+}
+
+void video_fec::add(const uint8_t * data, size_t size)
+{
+	iovec part{(void *)data, size};
+	add(&part, 1);
+}
+
+void video_fec::add(const iovec * parts, size_t count)
+{
+	if (not current or overflow)
+		return;
+
+	size_t size = 0;
+	for (size_t k = 0; k < count; k++)
+		size += parts[k].iov_len;
+
+	size_t i = num_data++;
+	if (i + num_parity >= max_shards or size > stride)
+	{
+		overflow = true;
+		return;
+	}
+	max_size = std::max(max_size, size);
+
+	// Shards are shorter than the parity, the zero padding adds nothing.
+	addmul_fn addmul = get_addmul(kernel);
+	const gf_coef * coefs = &current->coefs[i * num_parity];
+	for (size_t j = 0; j < num_parity; j++)
+	{
+		uint8_t * dst = parity_data.data() + j * stride;
+		for (size_t k = 0; k < count; k++)
+		{
+			addmul(dst, (const uint8_t *)parts[k].iov_base, parts[k].iov_len, coefs[j]);
+			dst += parts[k].iov_len;
+		}
+	}
+}
+
+size_t video_fec::end()
+{
+	if (not current or overflow or num_data == 0)
+		return 0;
+	current = nullptr;
+	return num_parity;
+}
+
+} // namespace xrt::drivers::wivrn
@@ -0,0 +1,115 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include <vector>
+
+namespace xrt::drivers::wivrn
+{
+
+// Reed-Solomon parity for the data shards of a frame, bit identical to
+// reed_solomon_encode from external/rs.c.
+//
+// The parity rows of rs.c are a Cauchy matrix that only depends on the
+// number of parity shards, so data shards are folded into the parity as
+// they are produced and the parity is complete as soon as the last one
+// has been added. The parity count is picked when the frame starts and
+// sent along with the parity, the headset does not derive it.
+class video_fec
+{
+public:
+	enum class simd
+	{
+		none,
+		ssse3,
+		avx2,
+		neon,
+	};
+
+	// GF(2^8) has no code for more data + parity shards than this.
+	static constexpr size_t max_shards = 256;
+
+	explicit video_fec(double parity_ratio = 0.05, simd kernel = best_simd());
+
+	video_fec(const video_fec &) = delete;
+	video_fec & operator=(const video_fec &) = delete;
+
+	static bool supported(simd kernel);
+	// Fastest kernel the CPU supports.
+	static simd best_simd();
+	static const char * simd_name(simd kernel);
+
+	// Parity shards for a frame of data_shards shards, at least 1.
+	static size_t parity_for(size_t data_shards, double parity_ratio);
+
+	void set_parity_ratio(double ratio);
+	double get_parity_ratio() const
+	{
+		return parity_ratio;
+	}
+
+	// Start a new frame, the parity count is sized for expected_data_shards.
+	// No shard may be bigger than max_shard_size.
+	void begin(size_t expected_data_shards, size_t max_shard_size);
+
+	// Fold the next data shard into the parity.
+	void add(const uint8_t * data, size_t size);
+	// Same, for a shard made of several contiguous parts.
+	void add(const iovec * parts, size_t count);
+
+	// Returns the number of parity shards of the frame, 0 if it can't be
+	// protected because it has too many shards.
+	size_t end();
+
+	size_t data_count() const
+	{
+		return num_data;
+	}
+	// Size of every parity shard, the size of the largest data shard.
+	size_t shard_size() const
+	{
+		return max_size;
+	}
+	const uint8_t * parity(size_t index) const
+	{
+		return parity_data.data() + index * stride;
+	}
+
+private:
+	struct codec;
+
+	double parity_ratio;
+	simd kernel;
+
+	const codec * current = nullptr;
+	size_t num_parity = 0;
+	size_t num_data = 0;
+	size_t max_size = 0;
+	size_t stride = 0;
+	bool overflow = false;
+
+	// num_parity blocks of stride bytes
+	std::vector<uint8_t> parity_data;
+};
+
+} // namespace xrt::drivers::wivrn
@@ -54,7 +54,7 @@ void view_list::update_tracking(const from_headset::tracking & tracking, const c
 			view.fovs[eye] = xrt_cast(tracking.views[eye].fov);
 		}
 
-		add_sample(tracking.timestamp, view, offset);
+		add_sample(offset.from_headset(tracking.timestamp), view);
 		return;
 	}
 }
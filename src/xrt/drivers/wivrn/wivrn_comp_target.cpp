@@ -104,6 +104,8 @@ static void destroy_images(struct wivrn_comp_target * cn)
 	}
 
 	cn->encoder_threads.clear();
+	for (size_t i = 0; i < cn->encoders.size(); i++)
+		cn->cnx->set_rate_controller(i, nullptr);
 	cn->encoders.clear();
 
 	struct vk_bundle * vk = get_vk(cn);
@@ -157,6 +159,18 @@ static void create_encoders(wivrn_comp_target * cn, std::vector<encoder_settings
 		        VideoEncoder::Create(vk, settings, stream_index, 0, 1, desc.width, desc.height, desc.fps));
 		desc.items.push_back(settings);
 
+		if (settings.min_bitrate < settings.bitrate)
+		{
+			rate_controller::settings rate_settings{};
+			rate_settings.min_bitrate = settings.min_bitrate;
+			rate_settings.max_bitrate = settings.bitrate;
+			rate_settings.min_fec_parity_ratio = settings.fec_parity_ratio;
+			rate_settings.fps = desc.fps;
+			auto rate = std::make_shared<rate_controller>(rate_settings);
+			encoder->SetRateController(rate);
+			cn->cnx->set_rate_controller(stream_index, rate);
+		}
+
 		std::vector<VkImage> images(cn->image_count);
 		std::vector<VkDeviceMemory> memory(cn->image_count);
 		std::vector<VkImageView> views(cn->image_count);
@@ -39,6 +39,11 @@ void wivrn_connection::send_stream(const to_headset::stream_packets & packet)
 	stream.send(packet);
 }
 
+void wivrn_connection::send_stream(stream_batch & batch)
+{
+	batch.flush(stream);
+}
+
 std::optional<from_headset::stream_packets> wivrn_connection::poll_stream(int timeout)
 {
 	pollfd fds{};
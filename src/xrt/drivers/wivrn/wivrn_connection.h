@@ -21,6 +21,7 @@
 
 #include "wivrn_packets.h"
 #include "wivrn_sockets.h"
+#include "wivrn_stream_batch.h"
 #include <optional>
 #include <poll.h>
 
@@ -38,6 +39,7 @@ public:
 
 	void send_control(const to_headset::control_packets & packet);
 	void send_stream(const to_headset::stream_packets & packet);
+	void send_stream(stream_batch & batch);
 
 	std::optional<from_headset::stream_packets> poll_stream(int timeout);
 	std::optional<from_headset::control_packets> poll_control(int timeout);
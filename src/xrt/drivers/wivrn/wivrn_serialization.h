@@ -117,6 +117,12 @@ public:
 		return buffer.size();
 	}
 
+	// Keeps the capacity so the packet can be reused.
+	void clear()
+	{
+		buffer.clear();
+	}
+
 	template <typename T>
 	void serialize(const T & value)
 	{
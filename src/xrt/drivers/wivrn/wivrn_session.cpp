@@ -87,6 +87,14 @@ clock_offset wivrn_session::get_offset()
 	return offset;
 }
 
+void wivrn_session::set_rate_controller(uint8_t stream_index, std::shared_ptr<rate_controller> rate)
+{
+	std::lock_guard lock(mutex);
+	if (rate_controllers.size() <= stream_index)
+		rate_controllers.resize(stream_index + 1);
+	rate_controllers[stream_index] = std::move(rate);
+}
+
 void wivrn_session::operator()(from_headset::headset_info_packet &&)
 {
 	U_LOG_W("unexpected headset info packet, ignoring");
@@ -116,6 +124,15 @@ void wivrn_session::operator()(from_headset::timesync_response && timesync)
 
 void wivrn_session::operator()(from_headset::feedback && feedback)
 {
+	std::shared_ptr<rate_controller> rate;
+	{
+		std::lock_guard lock(mutex);
+		if (feedback.stream_index < rate_controllers.size())
+			rate = rate_controllers[feedback.stream_index];
+	}
+	if (rate)
+		rate->feedback(feedback);
+
 	if (feedback_csv)
 	{
 		feedback_csv << feedback.frame_index << "," << feedback.received_first_packet << ","
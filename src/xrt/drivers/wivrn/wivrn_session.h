@@ -20,6 +20,7 @@
 #pragma once
 
 #include "wivrn_connection.h"
+#include "rate_controller.h"
 #include "wivrn_packets.h"
 #include "xrt/xrt_system.h"
 #include <atomic>
@@ -27,6 +28,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 class wivrn_hmd;
 class wivrn_controller;
@@ -59,6 +61,9 @@ class wivrn_session : public std::enable_shared_from_this<wivrn_session>
 	clock_offset offset;
 	std::chrono::steady_clock::time_point offset_age{};
 
+	// by stream index, protected by mutex
+	std::vector<std::shared_ptr<rate_controller>> rate_controllers;
+
 	std::ofstream feedback_csv;
 
 	wivrn_session(TCP && tcp, in6_addr & address);
@@ -70,6 +75,9 @@ public:
 	clock_offset
 	get_offset();
 
+	// Feedback for the stream goes to the controller, nullptr to stop.
+	void set_rate_controller(uint8_t stream_index, std::shared_ptr<rate_controller>);
+
 	void operator()(from_headset::headset_info_packet &&);
 	void operator()(from_headset::tracking &&);
 	void operator()(from_headset::inputs &&);
@@ -82,6 +90,11 @@ public:
 		connection.send_stream(packet);
 	}
 
+	void send_stream(stream_batch & batch)
+	{
+		connection.send_stream(batch);
+	}
+
 	template <typename T>
 	void send_control(const T & packet)
 	{
@@ -271,6 +271,15 @@ void xrt::drivers::wivrn::UDP::send_raw(const std::vector<uint8_t> & data)
 		throw std::system_error{errno, std::generic_category()};
 }
 
+size_t xrt::drivers::wivrn::UDP::send_many(mmsghdr * messages, size_t count)
+{
+	int sent = ::sendmmsg(fd, messages, count, 0);
+	if (sent < 0)
+		throw std::system_error{errno, std::generic_category()};
+
+	return sent;
+}
+
 xrt::drivers::wivrn::deserialization_packet xrt::drivers::wivrn::TCP::receive_raw()
 {
 	size_t expected_size;
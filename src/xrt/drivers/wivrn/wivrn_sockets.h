@@ -25,6 +25,7 @@
 #include <mutex>
 #include <netinet/ip.h>
 #include <stdexcept>
+#include <sys/socket.h>
 #include <utility>
 #include <vector>
 
@@ -83,6 +84,8 @@ public:
 
 	deserialization_packet receive_raw();
 	void send_raw(const std::vector<uint8_t> & data);
+	// Returns the number of messages sent, at least 1.
+	size_t send_many(mmsghdr * messages, size_t count);
 
 	void connect(in6_addr address, int port);
 	void connect(in_addr address, int port);
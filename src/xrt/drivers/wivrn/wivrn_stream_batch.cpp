@@ -0,0 +1,260 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "wivrn_stream_batch.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <system_error>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace xrt::drivers::wivrn
+{
+
+namespace
+{
+template <typename T, typename Variant>
+struct variant_index;
+
+template <typename T, typename... Ts>
+struct variant_index<T, std::variant<Ts...>> : index_of_type<T, Ts...>
+{};
+
+template <typename T>
+constexpr uint32_t stream_packet_index = variant_index<T, to_headset::stream_packets>::value;
+
+// The headers below are written field by field, they must follow the packets.
+static_assert(boost::pfr::tuple_size_v<to_headset::video_stream_data_shard> == 6);
+static_assert(boost::pfr::tuple_size_v<to_headset::video_stream_parity_shard> == 6);
+
+// Largest UDP payload over IPv4, segmented datagrams can't be bigger.
+constexpr size_t max_datagram_size = 65507;
+
+// Size of the variant index in front of each packet.
+constexpr size_t index_size = sizeof(uint32_t);
+} // namespace
+
+void stream_batch::add_arena(size_t offset)
+{
+	if (arena.size() > offset)
+		segments.push_back({nullptr, offset, arena.size() - offset});
+}
+
+void stream_batch::add_external(const uint8_t * data, size_t size)
+{
+	if (size > 0)
+		segments.push_back({data, 0, size});
+}
+
+void stream_batch::end_message(size_t first_segment)
+{
+	size_t size = 0;
+	for (size_t i = first_segment; i < segments.size(); i++)
+		size += segments[i].size;
+
+	messages.push_back({first_segment, segments.size() - first_segment, size});
+}
+
+void stream_batch::add(const to_headset::video_stream_data_shard & shard, const uint8_t * payload, size_t size)
+{
+	size_t first_segment = segments.size();
+
+	size_t offset = arena.size();
+	arena.serialize(stream_packet_index<to_headset::video_stream_data_shard>);
+	arena.serialize(shard.stream_item_idx);
+	arena.serialize(shard.frame_idx);
+	arena.serialize(shard.shard_idx);
+	arena.serialize(shard.flags);
+	arena.serialize<uint64_t>(size);
+	add_arena(offset);
+
+	add_external(payload, size);
+
+	offset = arena.size();
+	arena.serialize(shard.view_info);
+	add_arena(offset);
+
+	end_message(first_segment);
+}
+
+void stream_batch::add(const to_headset::video_stream_parity_shard & shard, const uint8_t * payload, size_t size)
+{
+	size_t first_segment = segments.size();
+
+	size_t offset = arena.size();
+	arena.serialize(stream_packet_index<to_headset::video_stream_parity_shard>);
+	arena.serialize(shard.stream_item_idx);
+	arena.serialize(shard.frame_idx);
+	arena.serialize(shard.data_shard_count);
+	arena.serialize(shard.num_parity_elements);
+	arena.serialize(shard.parity_element);
+	arena.serialize<uint64_t>(size);
+	add_arena(offset);
+
+	add_external(payload, size);
+
+	end_message(first_segment);
+}
+
+const iovec * stream_batch::last_shard(size_t & count)
+{
+	const message & m = messages.back();
+
+	iovecs.clear();
+	for (size_t i = m.first_segment; i < m.first_segment + m.num_segments; i++)
+	{
+		const segment & s = segments[i];
+		if (s.data)
+			iovecs.push_back({(void *)s.data, s.size});
+		else
+			iovecs.push_back({(void *)(arena.data() + s.offset), s.size});
+	}
+	iovecs[0].iov_base = (uint8_t *)iovecs[0].iov_base + index_size;
+	iovecs[0].iov_len -= index_size;
+
+	count = iovecs.size();
+	return iovecs.data();
+}
+
+void stream_batch::clear()
+{
+	arena.clear();
+	segments.clear();
+	messages.clear();
+}
+
+// Builds one mmsghdr per datagram for messages[first...], returns how many.
+// With segmentation, consecutive messages of the same size share a datagram
+// that the kernel splits again, only the last one of a run may be shorter.
+size_t stream_batch::prepare(size_t first, bool segmentation)
+{
+	iovecs.clear();
+	headers.clear();
+	groups.clear();
+
+	const size_t control_size = CMSG_SPACE(sizeof(uint16_t));
+	controls.assign((messages.size() - first) * control_size, 0);
+
+	// iovecs must not move once headers point to them
+	size_t num_iovecs = 0;
+	for (size_t i = first; i < messages.size(); i++)
+		num_iovecs += messages[i].num_segments;
+	iovecs.reserve(num_iovecs);
+
+	for (size_t i = first; i < messages.size();)
+	{
+		size_t segment_size = messages[i].size;
+		size_t end = i + 1;
+		size_t total = segment_size;
+		if (segmentation)
+		{
+			while (end < messages.size() and end - i < max_segments and
+			       total + messages[end].size <= max_datagram_size and
+			       messages[end].size <= segment_size and messages[end - 1].size == segment_size)
+			{
+				total += messages[end].size;
+				end++;
+			}
+		}
+
+		size_t first_iovec = iovecs.size();
+		for (size_t j = i; j < end; j++)
+		{
+			const message & m = messages[j];
+			for (size_t k = m.first_segment; k < m.first_segment + m.num_segments; k++)
+			{
+				const segment & s = segments[k];
+				if (s.data)
+					iovecs.push_back({(void *)s.data, s.size});
+				else
+					iovecs.push_back({(void *)(arena.data() + s.offset), s.size});
+			}
+		}
+
+		mmsghdr & header = headers.emplace_back();
+		header = {};
+		header.msg_hdr.msg_iov = iovecs.data() + first_iovec;
+		header.msg_hdr.msg_iovlen = iovecs.size() - first_iovec;
+
+		if (end - i > 1)
+		{
+			uint8_t * control = controls.data() + (headers.size() - 1) * control_size;
+			header.msg_hdr.msg_control = control;
+			header.msg_hdr.msg_controllen = control_size;
+
+			cmsghdr * cmsg = CMSG_FIRSTHDR(&header.msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t gso_size = segment_size;
+			memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+		}
+
+		groups.push_back(i);
+		i = end;
+	}
+
+	return headers.size();
+}
+
+void stream_batch::flush(UDP & socket)
+{
+	if (gso == gso_state::unknown)
+	{
+		int value;
+		socklen_t len = sizeof(value);
+		bool supported = getsockopt(socket.get_fd(), SOL_UDP, UDP_SEGMENT, &value, &len) == 0;
+		gso = supported ? gso_state::enabled : gso_state::disabled;
+	}
+
+	size_t first = 0;
+	while (first < messages.size())
+	{
+		size_t count = prepare(first, gso == gso_state::enabled);
+		size_t sent = 0;
+		try
+		{
+			while (sent < count)
+				sent += socket.send_many(headers.data() + sent, count - sent);
+		}
+		catch (std::system_error & e)
+		{
+			// Segmentation needs checksum offload on the outgoing interface.
+			if (gso == gso_state::enabled and e.code().value() == EIO)
+			{
+				gso = gso_state::disabled;
+				first = groups[sent];
+				continue;
+			}
+			clear();
+			throw;
+		}
+		first = messages.size();
+	}
+
+	clear();
+}
+
+} // namespace xrt::drivers::wivrn
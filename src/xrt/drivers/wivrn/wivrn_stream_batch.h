@@ -0,0 +1,115 @@
+/*
+ * WiVRn VR streaming
+ * Copyright (C) 2022  Guillaume Meunier <guillaume.meunier@centraliens.net>
+ * Copyright (C) 2022  Patrick Nicolas <patricknicolas@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "wivrn_packets.h"
+#include "wivrn_serialization.h"
+#include "wivrn_sockets.h"
+
+#include <sys/uio.h>
+#include <vector>
+
+namespace xrt::drivers::wivrn
+{
+
+// Video shards queued for the stream socket without copying their payload.
+//
+// Each shard is laid out exactly like typed_socket::send would serialize it
+// as a to_headset::stream_packets, but only the small fixed parts are
+// written, in a header arena. The payload is referenced where the encoder
+// left it and must stay valid until flush returns.
+//
+// flush sends every queued shard with sendmmsg, and when the kernel allows
+// it runs of same sized shards go out as a single UDP_SEGMENT datagram.
+class stream_batch
+{
+	struct segment
+	{
+		// nullptr when the data is in the header arena
+		const uint8_t * data;
+		size_t offset;
+		size_t size;
+	};
+
+	struct message
+	{
+		size_t first_segment;
+		size_t num_segments;
+		size_t size;
+	};
+
+	serialization_packet arena;
+	std::vector<segment> segments;
+	std::vector<message> messages;
+
+	// rebuilt by flush, kept for their capacity
+	std::vector<iovec> iovecs;
+	std::vector<mmsghdr> headers;
+	std::vector<uint8_t> controls;
+	// first message of each mmsghdr
+	std::vector<size_t> groups;
+
+	enum class gso_state
+	{
+		unknown,
+		enabled,
+		disabled,
+	} gso = gso_state::unknown;
+
+	void add_arena(size_t offset);
+	void add_external(const uint8_t * data, size_t size);
+	void end_message(size_t first_segment);
+
+	size_t prepare(size_t first, bool segmentation);
+
+public:
+	// Segmented datagrams are limited to this many segments by the kernel.
+	static constexpr size_t max_segments = 64;
+
+	stream_batch() = default;
+	stream_batch(const stream_batch &) = delete;
+	stream_batch & operator=(const stream_batch &) = delete;
+
+	// payload is referenced, shard.payload is ignored
+	void add(const to_headset::video_stream_data_shard & shard, const uint8_t * payload, size_t size);
+	void add(const to_headset::video_stream_parity_shard & shard, const uint8_t * payload, size_t size);
+
+	// Data shard bytes as fed to forward error correction: the serialized
+	// video_stream_data_shard, without the variant index.
+	const iovec * last_shard(size_t & count);
+
+	size_t size() const
+	{
+		return messages.size();
+	}
+
+	void clear();
+
+	// Send and clear everything that was queued.
+	void flush(UDP & socket);
+
+	// Force segmentation offload off, to compare with plain sendmmsg.
+	void disable_segmentation()
+	{
+		gso = gso_state::disabled;
+	}
+};
+
+} // namespace xrt::drivers::wivrn
@@ -23,11 +23,13 @@
 #include "util/u_var.h"
 #include "util/u_sink.h"
 #include "util/u_frame.h"
+#include "util/u_frame_pool.h"
 #include "util/u_trace_marker.h"
 
 #include "wmr_config.h"
 #include "wmr_protocol.h"
 #include "wmr_camera.h"
+#include "wmr_camera_xfer.h"
 
 //! Specifies whether the user wants to enable autoexposure from the start.
 DEBUG_GET_ONCE_BOOL_OPTION(wmr_autoexposure, "WMR_AUTOEXPOSURE", true)
@@ -35,6 +37,12 @@ DEBUG_GET_ONCE_BOOL_OPTION(wmr_autoexposure, "WMR_AUTOEXPOSURE", true)
 //! Specifies whether the user wants to use the same exp/gain values for all cameras
 DEBUG_GET_ONCE_BOOL_OPTION(wmr_unify_expgain, "WMR_UNIFY_EXPGAIN", false)
 
+//! Number of camera transfers to keep in flight.
+DEBUG_GET_ONCE_NUM_OPTION(wmr_camera_xfers, "WMR_CAMERA_XFERS", 8)
+
+//! File to record the raw camera transfers to, for replaying in tests.
+DEBUG_GET_ONCE_OPTION(wmr_camera_xfer_dump, "WMR_CAMERA_XFER_DUMP", NULL)
+
 static int
 update_expgain(struct wmr_camera *cam, struct xrt_frame **frames);
 
@@ -52,7 +60,8 @@ update_expgain(struct wmr_camera *cam, struct xrt_frame **frames);
 
 #define CAM_ENDPOINT 0x05
 
-#define NUM_XFERS 4
+//! Upper limit of transfers in flight.
+#define WMR_CAMERA_MAX_XFERS 16
 
 #define WMR_CAMERA_CMD_GAIN 0x80
 #define WMR_CAMERA_CMD_ON 0x81
@@ -99,15 +108,30 @@ struct wmr_camera
 	int tcam_count;                                       //!< Number of tracking cameras
 	int slam_cam_count;                                   //!< Number of tracking cameras used for SLAM
 
-	size_t xfer_size;
-	uint32_t frame_width, frame_height;
+	struct wmr_camera_xfer_layout layout;
 	uint8_t last_seq;
 	uint64_t last_frame_ts;
 
 	/* Unwrapped frame sequence number */
 	uint64_t frame_sequence;
 
-	struct libusb_transfer *xfers[NUM_XFERS];
+	//! Transfers in flight, more than a couple so a late callback doesn't drop frames.
+	struct libusb_transfer *xfers[WMR_CAMERA_MAX_XFERS];
+	int xfer_count;
+
+	struct
+	{
+		uint64_t completed;
+		uint64_t failed;
+		uint64_t short_count;
+		uint64_t malformed;
+	} xfer_stats;
+
+	//! Raw transfers are written here when recording a dump.
+	FILE *xfer_dump;
+
+	//! Frames the transfers are copied into, recycled when the trackers are done with them.
+	struct u_frame_pool *frame_pool;
 
 	struct wmr_camera_expgain
 	{
@@ -133,89 +157,6 @@ struct wmr_camera
  *
  */
 
-/* Some WMR headsets use 616538 byte transfers. HP G2 needs 1233018 (4 cameras)
- * As a general formula, it seems we have:
- *   0x6000 byte packets. Each has a 32 byte header.
- *     packet contains frame data for each camera in turn.
- *     Each frame has an extra (first) line with metadata
- *   Then, there's an extra 26 bytes on the end.
- *
- *   F = camera frames X * (Y+1) + 26
- *   n_packets = F/(0x6000-32)
- *   leftover = F - n_packets*(0x6000-32)
- *   size = n_packets * 0x6000 + 32 + leftover,
- *
- *   so for 2 x 640x480 cameras:
- *			F = 2 * 640 * 481 + 26 = 615706
- *      n_packets = 615706 / 24544 = 25
- *      leftover = 615706 - 25 * 24544 = 2106
- *      size = 25 * 0x6000 + 32 + 2106 = 616538
- *
- *  For HP G2 = 4 x 640 * 480 cameras:
- *			F = 4 * 640 * 481 + 26 = 1231386
- *      n_packets = 1231386 / 24544 = 50
- *      leftover = 1231386 - 50 * 24544 = 4186
- *      size = 50 * 0x6000 + 32 + 4186 = 1233018
- *
- *  It would be good to test these calculations on other headsets with
- *  different camera setups.
- */
-static bool
-compute_frame_size(struct wmr_camera *cam)
-{
-	int i;
-	int cams_found = 0;
-	int width;
-	int height;
-	size_t F;
-	size_t n_packets;
-	size_t leftover;
-
-	F = 26;
-
-	for (i = 0; i < cam->tcam_count; i++) {
-		const struct wmr_camera_config *config = &cam->tcam_confs[i];
-
-		WMR_CAM_DEBUG(cam, "Found head tracking camera index %d width %d height %d", i, config->roi.extent.w,
-		              config->roi.extent.h);
-
-		if (cams_found == 0) {
-			width = config->roi.extent.w;
-			height = config->roi.extent.h;
-		} else if (height != config->roi.extent.h) {
-			WMR_CAM_ERROR(cam, "Head tracking sensors have mismatched heights - %u != %u. Please report",
-			              height, config->roi.extent.h);
-			return false;
-		} else {
-			width += config->roi.extent.w;
-		}
-
-		cams_found++;
-		F += config->roi.extent.w * (config->roi.extent.h + 1);
-	}
-
-	if (cams_found == 0) {
-		return false;
-	}
-
-	if (width < 1280 || height < 480) {
-		return false;
-	}
-
-	n_packets = F / (0x6000 - 32);
-	leftover = F - n_packets * (0x6000 - 32);
-
-	cam->xfer_size = n_packets * 0x6000 + 32 + leftover;
-
-	cam->frame_width = width;
-	cam->frame_height = height;
-
-	WMR_CAM_INFO(cam, "WMR camera framebuffer %u x %u - %zu transfer size", cam->frame_width, cam->frame_height,
-	             cam->xfer_size);
-
-	return true;
-}
-
 static void *
 wmr_cam_usb_thread(void *ptr)
 {
@@ -286,76 +227,64 @@ img_xfer_cb(struct libusb_transfer *xfer)
 	if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
 		WMR_CAM_DEBUG(cam, "Camera transfer completed with status: %s (%u)", libusb_error_name(xfer->status),
 		              xfer->status);
+		cam->xfer_stats.failed++;
 		goto out;
 	}
 
 	if (xfer->actual_length < xfer->length) {
 		WMR_CAM_DEBUG(cam, "Camera transfer only delivered %d bytes", xfer->actual_length);
+		cam->xfer_stats.short_count++;
 		goto out;
 	}
 
 	WMR_CAM_TRACE(cam, "Camera transfer complete - %d bytes of %d", xfer->actual_length, xfer->length);
 
+	if (cam->xfer_dump != NULL) {
+		fwrite(xfer->buffer, 1, xfer->actual_length, cam->xfer_dump);
+	}
+
 	/* Convert the output into frames and send them off to debug / tracking */
 	struct xrt_frame *xf = NULL;
 
 	/* There's always one extra line of pixels with exposure info */
-	u_frame_create_one_off(XRT_FORMAT_L8, cam->frame_width, cam->frame_height + 1, &xf);
+	u_frame_pool_create_frame(cam->frame_pool, XRT_FORMAT_L8, cam->layout.frame_width, cam->layout.frame_height + 1,
+	                          &xf);
+	if (xf == NULL) {
+		WMR_CAM_ERROR(cam, "Failed to allocate camera frame");
+		goto out;
+	}
 
-	const uint8_t *src = xfer->buffer;
+	/* The packet headers are in the middle of lines, the image is copied out once into the frame, the
+	 * per camera frames are views into it. The transfer can then be resubmitted right away. */
+	struct wmr_camera_xfer_footer footer;
+	DRV_TRACE_BEGIN(copy_to_frame);
+	bool unpacked = wmr_camera_xfer_unpack(&cam->layout, xfer->buffer, xfer->actual_length, xf->data, &footer);
+	DRV_TRACE_END(copy_to_frame);
 
-	uint8_t *dst = xf->data;
-	size_t dst_remain = xf->size;
-	const size_t chunk_size = 0x6000 - 32;
+	/* Nothing below reads the transfer, give it back to the device before the exposure update and sinks */
+	int actual_length = xfer->actual_length;
+	libusb_submit_transfer(xfer);
 
-	DRV_TRACE_BEGIN(copy_to_frame);
-	while (dst_remain > 0) {
-		const size_t to_copy = dst_remain > chunk_size ? chunk_size : dst_remain;
-
-		/* 32 byte header seems to contain:
-		 *   __be32 magic = "Dlo+"
-		 *   __le32 frame_ctr;
-		 *   __le32 slice_ctr;
-		 *   __u8 unknown[20]; - binary block where all bytes are different each slice,
-		 *                       but repeat every 8 slices. They're different each boot
-		 *                       of the headset. Might just be uninitialised memory?
-		 */
-		src += 0x20;
-
-		memcpy(dst, src, to_copy);
-		src += to_copy;
-		dst += to_copy;
-		dst_remain -= to_copy;
+	if (!unpacked) {
+		WMR_CAM_DEBUG(cam, "Camera transfer doesn't match the layout, %d bytes", actual_length);
+		cam->xfer_stats.malformed++;
+		xrt_frame_reference(&xf, NULL);
+		return;
 	}
-	DRV_TRACE_END(copy_to_frame);
+	cam->xfer_stats.completed++;
 
-	/* There should be exactly a 26 byte footer left over */
-	assert(xfer->buffer + xfer->length - src == 26);
-
-	/* Footer contains:
-	 * __le64 start_ts; - 100ns unit timestamp, from same clock as video_timestamps on the IMU feed
-	 * __le64 end_ts;   - 100ns unit timestamp, always about 111000 * 100ns later than start_ts ~= 90Hz
-	 * __le16 ctr1;     - Counter that increments by 88, but sometimes by 96, and wraps at 16384
-	 * __le16 unknown0  - Unknown value, has only ever been 0
-	 * __be32 magic     - "Dlo+"
-	 * __le16 frametype?- either 0x00 or 0x02. Every 3rd frame is 0x0, others are 0x2. Might be SLAM vs controllers?
-	 */
-	uint64_t frame_start_ts = read64(&src) * WMR_MS_HOLOLENS_NS_PER_TICK;
-	uint64_t frame_end_ts = read64(&src) * WMR_MS_HOLOLENS_NS_PER_TICK;
+	uint64_t frame_start_ts = footer.start_ts;
+	uint64_t frame_end_ts = footer.end_ts;
 	int64_t delta = frame_end_ts - frame_start_ts;
 
-	uint16_t unknown16 = read16(&src);
-	uint16_t unknown16_2 = read16(&src);
-	src += 4; // Skip "Dlo+" magic bytes
-	uint16_t frametype = read16(&src);
 	/* frametype 0 is SLAM, frametype 2 is controller tracking */
-	bool slam_tracking_frame = (frametype == WMR_FRAMETYPE_SLAM);
+	bool slam_tracking_frame = (footer.frametype == WMR_FRAMETYPE_SLAM);
 
 	WMR_CAM_TRACE(cam,
 	              "Frame start TS %" PRIu64 " (%" PRIi64 " since last) end %" PRIu64 " dt %" PRIi64
 	              " unknown %u %u frame type %u",
-	              frame_start_ts, frame_start_ts - cam->last_frame_ts, frame_end_ts, delta, unknown16, unknown16_2,
-	              frametype);
+	              frame_start_ts, frame_start_ts - cam->last_frame_ts, frame_end_ts, delta, footer.ctr,
+	              footer.unknown, footer.frametype);
 
 	/* Read values from the pixel header */
 	uint16_t exposure = xf->data[6] << 8 | xf->data[7];
@@ -403,6 +332,7 @@ img_xfer_cb(struct libusb_transfer *xfer)
 	}
 
 	xrt_frame_reference(&xf, NULL);
+	return;
 
 out:
 	libusb_submit_transfer(xfer);
@@ -433,6 +363,16 @@ wmr_camera_open(struct wmr_camera_open_config *config)
 		cam->cam_sinks[i] = config->tcam_sinks[i];
 	}
 
+	cam->frame_pool = u_frame_pool_create("WMR Camera frames", 0);
+
+	long xfer_count = debug_get_num_option_wmr_camera_xfers();
+	if (xfer_count < 1) {
+		xfer_count = 1;
+	} else if (xfer_count > WMR_CAMERA_MAX_XFERS) {
+		xfer_count = WMR_CAMERA_MAX_XFERS;
+	}
+	cam->xfer_count = (int)xfer_count;
+
 	if (os_thread_helper_init(&cam->usb_thread) != 0) {
 		WMR_CAM_ERROR(cam, "Failed to initialise threading");
 		wmr_camera_free(cam);
@@ -461,7 +401,7 @@ wmr_camera_open(struct wmr_camera_open_config *config)
 		goto fail;
 	}
 
-	for (i = 0; i < NUM_XFERS; i++) {
+	for (i = 0; i < cam->xfer_count; i++) {
 		cam->xfers[i] = libusb_alloc_transfer(0);
 		if (cam->xfers[i] == NULL) {
 			res = LIBUSB_ERROR_NO_MEM;
@@ -497,6 +437,13 @@ wmr_camera_open(struct wmr_camera_open_config *config)
 	u_var_add_sink_debug(cam, &cam->debug_sinks[WMR_DEBUG_SINK_CONTROLLER], "Controller Tracking Streams");
 	u_var_add_gui_header_end(cam, NULL, NULL);
 
+	u_var_add_gui_header_begin(cam, NULL, "Transfers");
+	u_var_add_ro_u64(cam, &cam->xfer_stats.completed, "Completed");
+	u_var_add_ro_u64(cam, &cam->xfer_stats.failed, "Failed");
+	u_var_add_ro_u64(cam, &cam->xfer_stats.short_count, "Short");
+	u_var_add_ro_u64(cam, &cam->xfer_stats.malformed, "Malformed");
+	u_var_add_gui_header_end(cam, NULL, NULL);
+
 	u_var_add_gui_header_begin(cam, NULL, "Exposure and gain control");
 	u_var_add_bool(cam, &cam->unify_expgains, "Use same values");
 
@@ -553,7 +500,7 @@ wmr_camera_free(struct wmr_camera *cam)
 
 		os_thread_helper_destroy(&cam->usb_thread);
 
-		for (i = 0; i < NUM_XFERS; i++) {
+		for (i = 0; i < cam->xfer_count; i++) {
 			if (cam->xfers[i] == NULL) {
 				continue;
 			}
@@ -571,6 +518,14 @@ wmr_camera_free(struct wmr_camera *cam)
 	u_sink_debug_destroy(&cam->debug_sinks[WMR_DEBUG_SINK_SLAM]);
 	u_sink_debug_destroy(&cam->debug_sinks[WMR_DEBUG_SINK_CONTROLLER]);
 
+	// Frames still held by the trackers keep the pool alive.
+	u_frame_pool_destroy(&cam->frame_pool);
+
+	if (cam->xfer_dump != NULL) {
+		fclose(cam->xfer_dump);
+		cam->xfer_dump = NULL;
+	}
+
 	free(cam);
 }
 
@@ -581,11 +536,25 @@ wmr_camera_start(struct wmr_camera *cam)
 
 	int res = 0;
 
-	if (!compute_frame_size(cam)) {
+	if (!wmr_camera_xfer_layout_compute(cam->tcam_confs, cam->tcam_count, cam->log_level, &cam->layout)) {
 		WMR_CAM_WARN(cam, "Invalid config or no head tracking cameras found");
 		goto fail;
 	}
 
+	const char *dump_path = debug_get_option_wmr_camera_xfer_dump();
+	if (dump_path != NULL && cam->xfer_dump == NULL) {
+		FILE *file = fopen(dump_path, "wb");
+		if (file != NULL && wmr_camera_xfer_dump_write_header(file, &cam->layout)) {
+			WMR_CAM_INFO(cam, "Recording camera transfers to '%s'", dump_path);
+			cam->xfer_dump = file;
+		} else {
+			WMR_CAM_ERROR(cam, "Failed to open '%s' for recording camera transfers", dump_path);
+			if (file != NULL) {
+				fclose(file);
+			}
+		}
+	}
+
 	res = set_active(cam, false);
 	if (res < 0) {
 		goto fail;
@@ -601,11 +570,15 @@ wmr_camera_start(struct wmr_camera *cam)
 		goto fail;
 	}
 
-	for (int i = 0; i < NUM_XFERS; i++) {
-		uint8_t *recv_buf = malloc(cam->xfer_size);
+	for (int i = 0; i < cam->xfer_count; i++) {
+		// Restarting reuses the buffer, freed with the transfer.
+		uint8_t *recv_buf = cam->xfers[i]->buffer;
+		if (recv_buf == NULL) {
+			recv_buf = malloc(cam->layout.xfer_size);
+		}
 
-		libusb_fill_bulk_transfer(cam->xfers[i], cam->dev, LIBUSB_ENDPOINT_IN | 5, recv_buf, cam->xfer_size,
-		                          img_xfer_cb, cam, 0);
+		libusb_fill_bulk_transfer(cam->xfers[i], cam->dev, LIBUSB_ENDPOINT_IN | 5, recv_buf,
+		                          (int)cam->layout.xfer_size, img_xfer_cb, cam, 0);
 		cam->xfers[i]->flags |= LIBUSB_TRANSFER_FREE_BUFFER;
 
 		res = libusb_submit_transfer(cam->xfers[i]);
@@ -642,7 +615,7 @@ wmr_camera_stop(struct wmr_camera *cam)
 	}
 	cam->running = false;
 
-	for (i = 0; i < NUM_XFERS; i++) {
+	for (i = 0; i < cam->xfer_count; i++) {
 		if (cam->xfers[i] != NULL) {
 			libusb_cancel_transfer(cam->xfers[i]);
 		}
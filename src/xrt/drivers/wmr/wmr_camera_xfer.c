@@ -0,0 +1,207 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Layout and unpacking of WMR camera USB transfers.
+ * @ingroup drv_wmr
+ */
+
+#include "wmr_protocol.h"
+#include "wmr_camera_xfer.h"
+
+#include <string.h>
+
+
+#define WMR_CAM_DEBUG(ll, ...) U_LOG_IFL_D(ll, __VA_ARGS__)
+#define WMR_CAM_INFO(ll, ...) U_LOG_IFL_I(ll, __VA_ARGS__)
+#define WMR_CAM_ERROR(ll, ...) U_LOG_IFL_E(ll, __VA_ARGS__)
+
+//! "WMRX" in a file.
+#define DUMP_MAGIC 0x58524d57
+#define DUMP_VERSION 1
+
+struct dump_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frame_width;
+	uint32_t frame_height;
+	uint64_t xfer_size;
+};
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+/* Some WMR headsets use 616538 byte transfers. HP G2 needs 1233018 (4 cameras)
+ * As a general formula, it seems we have:
+ *   0x6000 byte packets. Each has a 32 byte header.
+ *     packet contains frame data for each camera in turn.
+ *     Each frame has an extra (first) line with metadata
+ *   Then, there's an extra 26 bytes on the end.
+ *
+ *   F = camera frames X * (Y+1) + 26
+ *   n_packets = F/(0x6000-32)
+ *   leftover = F - n_packets*(0x6000-32)
+ *   size = n_packets * 0x6000 + 32 + leftover,
+ *
+ *   so for 2 x 640x480 cameras:
+ *			F = 2 * 640 * 481 + 26 = 615706
+ *      n_packets = 615706 / 24544 = 25
+ *      leftover = 615706 - 25 * 24544 = 2106
+ *      size = 25 * 0x6000 + 32 + 2106 = 616538
+ *
+ *  For HP G2 = 4 x 640 * 480 cameras:
+ *			F = 4 * 640 * 481 + 26 = 1231386
+ *      n_packets = 1231386 / 24544 = 50
+ *      leftover = 1231386 - 50 * 24544 = 4186
+ *      size = 50 * 0x6000 + 32 + 4186 = 1233018
+ *
+ *  It would be good to test these calculations on other headsets with
+ *  different camera setups.
+ */
+bool
+wmr_camera_xfer_layout_compute(const struct wmr_camera_config *tcam_confs,
+                               int tcam_count,
+                               enum u_logging_level log_level,
+                               struct wmr_camera_xfer_layout *out_layout)
+{
+	int cams_found = 0;
+	int width = 0;
+	int height = 0;
+	size_t F = WMR_CAMERA_XFER_FOOTER_SIZE;
+
+	for (int i = 0; i < tcam_count; i++) {
+		const struct wmr_camera_config *config = &tcam_confs[i];
+
+		WMR_CAM_DEBUG(log_level, "Found head tracking camera index %d width %d height %d", i,
+		              config->roi.extent.w, config->roi.extent.h);
+
+		if (cams_found == 0) {
+			width = config->roi.extent.w;
+			height = config->roi.extent.h;
+		} else if (height != config->roi.extent.h) {
+			WMR_CAM_ERROR(log_level, "Head tracking sensors have mismatched heights - %u != %u. Please report",
+			              height, config->roi.extent.h);
+			return false;
+		} else {
+			width += config->roi.extent.w;
+		}
+
+		cams_found++;
+		F += config->roi.extent.w * (config->roi.extent.h + 1);
+	}
+
+	if (cams_found == 0) {
+		return false;
+	}
+
+	if (width < 1280 || height < 480) {
+		return false;
+	}
+
+	size_t n_packets = F / WMR_CAMERA_XFER_CHUNK_SIZE;
+	size_t leftover = F - n_packets * WMR_CAMERA_XFER_CHUNK_SIZE;
+
+	out_layout->frame_width = width;
+	out_layout->frame_height = height;
+	out_layout->image_size = (size_t)width * (height + 1);
+	out_layout->xfer_size = n_packets * WMR_CAMERA_XFER_PACKET_SIZE + WMR_CAMERA_XFER_HEADER_SIZE + leftover;
+
+	WMR_CAM_INFO(log_level, "WMR camera framebuffer %u x %u - %zu transfer size", out_layout->frame_width,
+	             out_layout->frame_height, out_layout->xfer_size);
+
+	return true;
+}
+
+bool
+wmr_camera_xfer_unpack(const struct wmr_camera_xfer_layout *layout,
+                       const uint8_t *xfer,
+                       size_t xfer_length,
+                       uint8_t *dst,
+                       struct wmr_camera_xfer_footer *out_footer)
+{
+	size_t chunk_count = (layout->image_size + WMR_CAMERA_XFER_CHUNK_SIZE - 1) / WMR_CAMERA_XFER_CHUNK_SIZE;
+	size_t expected = chunk_count * WMR_CAMERA_XFER_HEADER_SIZE + layout->image_size + WMR_CAMERA_XFER_FOOTER_SIZE;
+
+	// Short transfers, or a layout that doesn't add up, would read past the end.
+	if (xfer_length != layout->xfer_size || expected != layout->xfer_size) {
+		return false;
+	}
+
+	const uint8_t *src = xfer;
+	size_t dst_remain = layout->image_size;
+
+	/* 32 byte header seems to contain:
+	 *   __be32 magic = "Dlo+"
+	 *   __le32 frame_ctr;
+	 *   __le32 slice_ctr;
+	 *   __u8 unknown[20]; - binary block where all bytes are different each slice,
+	 *                       but repeat every 8 slices. They're different each boot
+	 *                       of the headset. Might just be uninitialised memory?
+	 */
+	while (dst_remain > 0) {
+		const size_t to_copy = dst_remain > WMR_CAMERA_XFER_CHUNK_SIZE ? WMR_CAMERA_XFER_CHUNK_SIZE : dst_remain;
+
+		src += WMR_CAMERA_XFER_HEADER_SIZE;
+
+		memcpy(dst, src, to_copy);
+		src += to_copy;
+		dst += to_copy;
+		dst_remain -= to_copy;
+	}
+
+	/* Footer contains:
+	 * __le64 start_ts; - 100ns unit timestamp, from same clock as video_timestamps on the IMU feed
+	 * __le64 end_ts;   - 100ns unit timestamp, always about 111000 * 100ns later than start_ts ~= 90Hz
+	 * __le16 ctr1;     - Counter that increments by 88, but sometimes by 96, and wraps at 16384
+	 * __le16 unknown0  - Unknown value, has only ever been 0
+	 * __be32 magic     - "Dlo+"
+	 * __le16 frametype?- either 0x00 or 0x02. Every 3rd frame is 0x0, others are 0x2. Might be SLAM vs controllers?
+	 */
+	out_footer->start_ts = read64(&src) * WMR_MS_HOLOLENS_NS_PER_TICK;
+	out_footer->end_ts = read64(&src) * WMR_MS_HOLOLENS_NS_PER_TICK;
+	out_footer->ctr = (uint16_t)read16(&src);
+	out_footer->unknown = (uint16_t)read16(&src);
+	src += 4; // Skip "Dlo+" magic bytes
+	out_footer->frametype = (uint16_t)read16(&src);
+
+	return true;
+}
+
+bool
+wmr_camera_xfer_dump_write_header(FILE *file, const struct wmr_camera_xfer_layout *layout)
+{
+	struct dump_header header = {
+	    .magic = DUMP_MAGIC,
+	    .version = DUMP_VERSION,
+	    .frame_width = layout->frame_width,
+	    .frame_height = layout->frame_height,
+	    .xfer_size = layout->xfer_size,
+	};
+
+	return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool
+wmr_camera_xfer_dump_read_header(FILE *file, struct wmr_camera_xfer_layout *out_layout)
+{
+	struct dump_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1) {
+		return false;
+	}
+
+	if (header.magic != DUMP_MAGIC || header.version != DUMP_VERSION) {
+		return false;
+	}
+
+	out_layout->frame_width = header.frame_width;
+	out_layout->frame_height = header.frame_height;
+	out_layout->image_size = (size_t)header.frame_width * (header.frame_height + 1);
+	out_layout->xfer_size = (size_t)header.xfer_size;
+
+	return true;
+}
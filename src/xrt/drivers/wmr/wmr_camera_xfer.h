@@ -0,0 +1,120 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Layout and unpacking of WMR camera USB transfers.
+ * @ingroup drv_wmr
+ */
+
+#pragma once
+
+#include "util/u_logging.h"
+
+#include "wmr_config.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * @addtogroup drv_wmr
+ * @{
+ */
+
+//! Size of the packets a camera transfer is made of.
+#define WMR_CAMERA_XFER_PACKET_SIZE 0x6000
+
+//! Size of the header at the start of each packet.
+#define WMR_CAMERA_XFER_HEADER_SIZE 32
+
+//! Image bytes in each packet.
+#define WMR_CAMERA_XFER_CHUNK_SIZE (WMR_CAMERA_XFER_PACKET_SIZE - WMR_CAMERA_XFER_HEADER_SIZE)
+
+//! Size of the footer after the image.
+#define WMR_CAMERA_XFER_FOOTER_SIZE 26
+
+/*!
+ * How the images of all tracking cameras are laid out in a transfer.
+ */
+struct wmr_camera_xfer_layout
+{
+	//! Width of all of the cameras side by side.
+	uint32_t frame_width;
+
+	//! Height of the cameras, the image has one extra line with exposure info.
+	uint32_t frame_height;
+
+	//! Bytes of image, frame_width * (frame_height + 1).
+	size_t image_size;
+
+	//! Bytes of a whole transfer, packet headers and footer included.
+	size_t xfer_size;
+};
+
+/*!
+ * The footer of a transfer, timestamps converted to nanoseconds.
+ */
+struct wmr_camera_xfer_footer
+{
+	uint64_t start_ts;
+	uint64_t end_ts;
+	uint16_t ctr;
+	uint16_t unknown;
+	uint16_t frametype;
+};
+
+/*!
+ * Computes the transfer layout for the given tracking cameras, they must all
+ * have the same height.
+ */
+bool
+wmr_camera_xfer_layout_compute(const struct wmr_camera_config *tcam_confs,
+                               int tcam_count,
+                               enum u_logging_level log_level,
+                               struct wmr_camera_xfer_layout *out_layout);
+
+/*!
+ * Copies the image out of the packets of a transfer into @p dst, which must
+ * hold @ref wmr_camera_xfer_layout::image_size bytes, and reads the footer.
+ *
+ * @return False if the transfer isn't as big as the layout says.
+ */
+bool
+wmr_camera_xfer_unpack(const struct wmr_camera_xfer_layout *layout,
+                       const uint8_t *xfer,
+                       size_t xfer_length,
+                       uint8_t *dst,
+                       struct wmr_camera_xfer_footer *out_footer);
+
+
+/*
+ *
+ * Transfer dumps.
+ *
+ */
+
+/*!
+ * Writes the header of a transfer dump, followed by the raw transfers.
+ */
+bool
+wmr_camera_xfer_dump_write_header(FILE *file, const struct wmr_camera_xfer_layout *layout);
+
+/*!
+ * Reads the header of a transfer dump, the raw transfers of
+ * @ref wmr_camera_xfer_layout::xfer_size bytes each follow it.
+ */
+bool
+wmr_camera_xfer_dump_read_header(FILE *file, struct wmr_camera_xfer_layout *out_layout);
+
+
+/*!
+ * @}
+ */
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -158,6 +158,32 @@ struct xrt_space_overseer
 	                             const struct xrt_pose *offset,
 	                             struct xrt_space_relation *out_relation);
 
+	/*!
+	 * Locate many spaces in the same base space at the same time, like
+	 * xrLocateSpaces does. Ancestors shared by the spaces are only
+	 * resolved once. Optional, may be NULL, in which case the helper calls
+	 * @ref xrt_space_overseer::locate_space once per space instead.
+	 *
+	 * @see xrt_space_overseer::locate_space.
+	 *
+	 * @param[in] xso             Owning space overseer.
+	 * @param[in] base_space      The space that we want the poses in.
+	 * @param[in] base_offset     Offset if any to the base space.
+	 * @param[in] at_timestamp_ns At which time.
+	 * @param[in] spaces          The spaces to be located.
+	 * @param[in] offsets         Offsets if any to the located spaces, one per space.
+	 * @param[in] space_count     Number of spaces.
+	 * @param[out] out_relations  Resulting poses, one per space.
+	 */
+	xrt_result_t (*locate_spaces)(struct xrt_space_overseer *xso,
+	                              struct xrt_space *base_space,
+	                              const struct xrt_pose *base_offset,
+	                              uint64_t at_timestamp_ns,
+	                              struct xrt_space **spaces,
+	                              const struct xrt_pose *offsets,
+	                              uint32_t space_count,
+	                              struct xrt_space_relation *out_relations);
+
 	/*!
 	 * Locate a the origin of the tracking space of a device, this is not
 	 * the same as the device position. In other words, what is the position
@@ -240,6 +266,39 @@ xrt_space_overseer_locate_space(struct xrt_space_overseer *xso,
 	return xso->locate_space(xso, base_space, base_offset, at_timestamp_ns, space, offset, out_relation);
 }
 
+/*!
+ * @copydoc xrt_space_overseer::locate_spaces
+ *
+ * Helper for calling through the function pointer.
+ *
+ * @public @memberof xrt_space_overseer
+ */
+static inline xrt_result_t
+xrt_space_overseer_locate_spaces(struct xrt_space_overseer *xso,
+                                 struct xrt_space *base_space,
+                                 const struct xrt_pose *base_offset,
+                                 uint64_t at_timestamp_ns,
+                                 struct xrt_space **spaces,
+                                 const struct xrt_pose *offsets,
+                                 uint32_t space_count,
+                                 struct xrt_space_relation *out_relations)
+{
+	if (xso->locate_spaces != NULL) {
+		return xso->locate_spaces(xso, base_space, base_offset, at_timestamp_ns, spaces, offsets, space_count,
+		                          out_relations);
+	}
+
+	for (uint32_t i = 0; i < space_count; i++) {
+		xrt_result_t xret = xso->locate_space(xso, base_space, base_offset, at_timestamp_ns, spaces[i],
+		                                      &offsets[i], &out_relations[i]);
+		if (xret != XRT_SUCCESS) {
+			return xret;
+		}
+	}
+
+	return XRT_SUCCESS;
+}
+
 /*!
  * @copydoc xrt_space_overseer::locate_device
  *
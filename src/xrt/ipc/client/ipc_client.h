@@ -21,6 +21,10 @@
 
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 /*
  *
@@ -43,6 +47,54 @@
 struct xrt_compositor_native;
 
 
+/*!
+ * Where to copy an out argument of a batched call from its reply.
+ *
+ * @ingroup ipc_client
+ */
+struct ipc_client_batch_out
+{
+	void *ptr;
+	uint32_t offset;
+	uint32_t size;
+};
+
+/*!
+ * A call queued in a @ref ipc_client_batch.
+ *
+ * @ingroup ipc_client
+ */
+struct ipc_client_batch_call
+{
+	//! Offset of the reply of this call in the reply to the batch.
+	uint32_t reply_offset;
+
+	//! Optional, gets the result of the call.
+	xrt_result_t *out_result;
+
+	uint32_t out_count;
+	struct ipc_client_batch_out outs[IPC_BATCH_MAX_OUT_ARGS];
+};
+
+/*!
+ * Calls queued by the ipc_batch_* functions, sent to the service as one
+ * message by @ref ipc_client_batch_flush or together with the next ipc_call_*.
+ *
+ * @ingroup ipc_client
+ */
+struct ipc_client_batch
+{
+	//! The batch message, a struct ipc_batch_msg followed by the calls.
+	uint8_t msg[IPC_BATCH_MAX_MSG_SIZE];
+	uint32_t msg_size;
+
+	//! Size of all of the replies.
+	uint32_t reply_size;
+
+	uint32_t call_count;
+	struct ipc_client_batch_call calls[IPC_BATCH_MAX_CALLS];
+};
+
 /*!
  * Connection.
  */
@@ -52,9 +104,21 @@ struct ipc_connection
 
 	struct ipc_shared_memory *ism;
 	xrt_shmem_handle_t ism_handle;
+	size_t ism_size;
+
+	//! Our layer slots, not shared with other clients.
+	struct ipc_shared_slots *slots;
+	xrt_shmem_handle_t slots_handle;
+	size_t slots_size;
 
 	struct os_mutex mutex;
 
+	//! Locate from the pose histories in the shared memory when possible.
+	bool use_pose_history;
+
+	//! Protected by the mutex.
+	struct ipc_client_batch batch;
+
 #ifdef XRT_OS_ANDROID
 	struct ipc_client_android *ica;
 #endif // XRT_OS_ANDROID
@@ -75,6 +139,9 @@ struct ipc_client_xdev
 	struct ipc_connection *ipc_c;
 
 	uint32_t device_id;
+
+	//! Of the inputs in our copy, see @ref ipc_input_state_read.
+	uint64_t input_generation;
 };
 
 
@@ -84,6 +151,62 @@ struct ipc_client_xdev
  *
  */
 
+/*!
+ * Queue a call, the batch is flushed first if the call doesn't fit. Used by
+ * the generated code with the mutex held.
+ *
+ * @param ipc_c      IPC connection.
+ * @param msg        The msg struct of the call.
+ * @param msg_size   Size of the msg struct.
+ * @param reply_size Size of the reply struct of the call.
+ * @param out_result Optional, gets the result of the call on flush.
+ * @param[out] out_call The queued call, to add the out arguments to.
+ *
+ * @ingroup ipc_client
+ */
+xrt_result_t
+ipc_client_batch_queue_locked(struct ipc_connection *ipc_c,
+                              const void *msg,
+                              size_t msg_size,
+                              size_t reply_size,
+                              xrt_result_t *out_result,
+                              struct ipc_client_batch_call **out_call);
+
+/*!
+ * Send the queued calls and write their out arguments and results, must be
+ * called with the mutex held. Failed calls without a result pointer are only
+ * logged.
+ *
+ * @return Only errors in talking to the service.
+ * @ingroup ipc_client
+ */
+xrt_result_t
+ipc_client_batch_flush_locked(struct ipc_connection *ipc_c);
+
+/*!
+ * Send the queued calls, the ipc_batch_* out arguments are written once this
+ * returns. Any ipc_call_* also sends the queued calls, before itself.
+ *
+ * @return Only errors in talking to the service.
+ * @ingroup ipc_client
+ */
+xrt_result_t
+ipc_client_batch_flush(struct ipc_connection *ipc_c);
+
+/*!
+ * Add an out argument to a queued call.
+ *
+ * @ingroup ipc_client
+ */
+static inline void
+ipc_client_batch_call_add_out(struct ipc_client_batch_call *call, void *ptr, size_t offset, size_t size)
+{
+	struct ipc_client_batch_out *out = &call->outs[call->out_count++];
+	out->ptr = ptr;
+	out->offset = (uint32_t)offset;
+	out->size = (uint32_t)size;
+}
+
 /*!
  * Convenience helper to go from a xdev to @ref ipc_client_xdev.
  *
@@ -118,3 +241,54 @@ ipc_client_device_create(struct ipc_connection *ipc_c, struct xrt_tracking_origi
 
 struct xrt_space_overseer *
 ipc_client_space_overseer_create(struct ipc_connection *ipc_c);
+
+/*!
+ * Locate from the history of a device pose input or semantic space in the
+ * shared memory, see @ref ipc_pose_history_find and @ref ipc_pose_history_locate.
+ *
+ * @return False if the service has to be asked instead.
+ * @ingroup ipc_client
+ */
+bool
+ipc_client_pose_history_locate(struct ipc_connection *ipc_c,
+                               enum ipc_pose_history_type type,
+                               uint32_t device_id,
+                               enum xrt_input_name name,
+                               uint64_t at_timestamp_ns,
+                               struct xrt_space_relation *out_relation,
+                               struct xrt_space_relation *out_origin);
+
+/*!
+ * Implements @ref xrt_device::get_tracked_pose from the pose histories, with
+ * the same handling of inactive inputs as the service.
+ *
+ * @return False if the service has to be asked instead.
+ * @ingroup ipc_client
+ */
+bool
+ipc_client_xdev_get_tracked_pose_from_history(struct ipc_client_xdev *icx,
+                                              enum xrt_input_name name,
+                                              uint64_t at_timestamp_ns,
+                                              struct xrt_space_relation *out_relation);
+
+
+/*!
+ * Give the device its own copy of the inputs from the shared memory.
+ *
+ * @ingroup ipc_client
+ */
+void
+ipc_client_xdev_init_inputs(struct ipc_client_xdev *icx);
+
+/*!
+ * Implements @ref xrt_device::update_inputs, asks the service to update the
+ * inputs and copies the ones that changed.
+ *
+ * @ingroup ipc_client
+ */
+void
+ipc_client_xdev_update_inputs(struct ipc_client_xdev *icx);
+
+#ifdef __cplusplus
+}
+#endif
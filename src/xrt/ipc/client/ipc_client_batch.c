@@ -0,0 +1,157 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Queuing of calls that are sent to the service as one message.
+ * @ingroup ipc_client
+ */
+
+#include "util/u_trace_marker.h"
+
+#include "client/ipc_client.h"
+#include "ipc_protocol_generated.h"
+
+#include <string.h>
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static struct ipc_batch_msg *
+get_header(struct ipc_client_batch *batch)
+{
+	return (struct ipc_batch_msg *)batch->msg;
+}
+
+static void
+reset(struct ipc_client_batch *batch)
+{
+	batch->msg_size = sizeof(struct ipc_batch_msg);
+	batch->reply_size = 0;
+	batch->call_count = 0;
+}
+
+static bool
+fits(struct ipc_client_batch *batch, size_t msg_size, size_t reply_size)
+{
+	return batch->call_count < IPC_BATCH_MAX_CALLS &&                   //
+	       batch->msg_size + msg_size <= IPC_BATCH_MAX_MSG_SIZE &&     //
+	       batch->reply_size + reply_size <= IPC_BATCH_MAX_REPLY_SIZE; //
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+xrt_result_t
+ipc_client_batch_queue_locked(struct ipc_connection *ipc_c,
+                              const void *msg,
+                              size_t msg_size,
+                              size_t reply_size,
+                              xrt_result_t *out_result,
+                              struct ipc_client_batch_call **out_call)
+{
+	struct ipc_client_batch *batch = &ipc_c->batch;
+
+	if (batch->call_count == 0) {
+		reset(batch);
+	}
+
+	if (!fits(batch, msg_size, reply_size)) {
+		xrt_result_t ret = ipc_client_batch_flush_locked(ipc_c);
+		if (ret != XRT_SUCCESS) {
+			return ret;
+		}
+		reset(batch);
+	}
+
+	// Can only happen if a single call is too large.
+	if (!fits(batch, msg_size, reply_size)) {
+		IPC_ERROR(ipc_c, "Call too large to batch!");
+		return XRT_ERROR_IPC_FAILURE;
+	}
+
+	struct ipc_client_batch_call *call = &batch->calls[batch->call_count++];
+	call->reply_offset = batch->reply_size;
+	call->out_result = out_result;
+	call->out_count = 0;
+
+	memcpy(batch->msg + batch->msg_size, msg, msg_size);
+	batch->msg_size += (uint32_t)msg_size;
+	batch->reply_size += (uint32_t)reply_size;
+
+	*out_call = call;
+
+	return XRT_SUCCESS;
+}
+
+xrt_result_t
+ipc_client_batch_flush_locked(struct ipc_connection *ipc_c)
+{
+	IPC_TRACE_MARKER();
+
+	struct ipc_client_batch *batch = &ipc_c->batch;
+	uint8_t reply[IPC_BATCH_MAX_REPLY_SIZE];
+
+	if (batch->call_count == 0) {
+		return XRT_SUCCESS;
+	}
+
+	struct ipc_batch_msg *header = get_header(batch);
+	header->cmd = IPC_BATCH;
+	header->call_count = batch->call_count;
+	header->size = batch->msg_size;
+
+	IPC_TRACE(ipc_c, "Sending batch of %u calls", batch->call_count);
+
+	// Nothing is written out if sending fails, drop the calls either way.
+	uint32_t call_count = batch->call_count;
+	batch->call_count = 0;
+
+	xrt_result_t ret = ipc_send(&ipc_c->imc, batch->msg, batch->msg_size);
+	if (ret != XRT_SUCCESS) {
+		return ret;
+	}
+
+	ret = ipc_receive(&ipc_c->imc, reply, batch->reply_size);
+	if (ret != XRT_SUCCESS) {
+		return ret;
+	}
+
+	for (uint32_t i = 0; i < call_count; i++) {
+		struct ipc_client_batch_call *call = &batch->calls[i];
+		const uint8_t *call_reply = reply + call->reply_offset;
+
+		xrt_result_t result;
+		memcpy(&result, call_reply, sizeof(result));
+
+		for (uint32_t k = 0; k < call->out_count; k++) {
+			struct ipc_client_batch_out *out = &call->outs[k];
+			memcpy(out->ptr, call_reply + out->offset, out->size);
+		}
+
+		if (call->out_result != NULL) {
+			*call->out_result = result;
+		} else if (result != XRT_SUCCESS) {
+			IPC_ERROR(ipc_c, "Batched call %u of %u failed: %i", i + 1, call_count, result);
+		}
+	}
+
+	return XRT_SUCCESS;
+}
+
+xrt_result_t
+ipc_client_batch_flush(struct ipc_connection *ipc_c)
+{
+	os_mutex_lock(&ipc_c->mutex);
+	xrt_result_t ret = ipc_client_batch_flush_locked(ipc_c);
+	os_mutex_unlock(&ipc_c->mutex);
+
+	return ret;
+}
@@ -219,7 +219,8 @@ ipc_compositor_swapchain_release_image(struct xrt_swapchain *xsc, uint32_t index
 	struct ipc_client_swapchain *ics = ipc_client_swapchain(xsc);
 	struct ipc_client_compositor *icc = ics->icc;
 
-	IPC_CALL_CHK(ipc_call_swapchain_release_image(icc->ipc_c, ics->id, index));
+	// Nothing to wait for, goes to the service together with the next call.
+	IPC_CALL_CHK(ipc_batch_swapchain_release_image(icc->ipc_c, ics->id, index, NULL));
 
 	return res;
 }
@@ -558,8 +559,7 @@ ipc_compositor_layer_begin(struct xrt_compositor *xc, const struct xrt_layer_fra
 {
 	struct ipc_client_compositor *icc = ipc_client_compositor(xc);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 
 	slot->data = *data;
 
@@ -577,8 +577,7 @@ ipc_compositor_layer_stereo_projection(struct xrt_compositor *xc,
 
 	assert(data->type == XRT_LAYER_STEREO_PROJECTION);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 	struct ipc_layer_entry *layer = &slot->layers[icc->layers.layer_count];
 	struct ipc_client_swapchain *l = ipc_client_swapchain(l_xsc);
 	struct ipc_client_swapchain *r = ipc_client_swapchain(r_xsc);
@@ -609,8 +608,7 @@ ipc_compositor_layer_stereo_projection_depth(struct xrt_compositor *xc,
 
 	assert(data->type == XRT_LAYER_STEREO_PROJECTION_DEPTH);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 	struct ipc_layer_entry *layer = &slot->layers[icc->layers.layer_count];
 	struct ipc_client_swapchain *l = ipc_client_swapchain(l_xsc);
 	struct ipc_client_swapchain *r = ipc_client_swapchain(r_xsc);
@@ -641,8 +639,7 @@ handle_layer(struct xrt_compositor *xc,
 
 	assert(data->type == type);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 	struct ipc_layer_entry *layer = &slot->layers[icc->layers.layer_count];
 	struct ipc_client_swapchain *ics = ipc_client_swapchain(xsc);
 
@@ -711,8 +708,7 @@ ipc_compositor_layer_commit(struct xrt_compositor *xc, xrt_graphics_sync_handle_
 
 	bool valid_sync = xrt_graphics_sync_handle_is_valid(sync_handle);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 
 	// Last bit of data to put in the shared memory area.
 	slot->layer_count = icc->layers.layer_count;
@@ -743,8 +739,7 @@ ipc_compositor_layer_commit_with_semaphore(struct xrt_compositor *xc,
 	struct ipc_client_compositor *icc = ipc_client_compositor(xc);
 	struct ipc_client_compositor_semaphore *iccs = ipc_client_compositor_semaphore(xcsem);
 
-	struct ipc_shared_memory *ism = icc->ipc_c->ism;
-	struct ipc_layer_slot *slot = &ism->slots[icc->layers.slot_id];
+	struct ipc_layer_slot *slot = ipc_shared_slots_get(icc->ipc_c->slots, icc->layers.slot_id);
 
 	// Last bit of data to put in the shared memory area.
 	slot->layer_count = icc->layers.layer_count;
@@ -27,6 +27,8 @@
 #include "util/u_system_helpers.h"
 
 #include "shared/ipc_protocol.h"
+#include "shared/ipc_shmem.h"
+#include "shared/ipc_shared_layout.h"
 #include "client/ipc_client_connection.h"
 
 #include "ipc_client_generated.h"
@@ -55,6 +57,7 @@
 #endif // XRT_OS_ANDROID
 
 DEBUG_GET_ONCE_BOOL_OPTION(ipc_ignore_version, "IPC_IGNORE_VERSION", false)
+DEBUG_GET_ONCE_BOOL_OPTION(ipc_pose_history, "IPC_POSE_HISTORY", true)
 
 #ifdef XRT_OS_ANDROID
 
@@ -250,6 +253,25 @@ ipc_client_socket_connect(struct ipc_connection *ipc_c)
 }
 #endif
 
+/*!
+ * Tears down a connection that failed part way, the shared memory has not been
+ * handed to an instance yet so it goes with the socket.
+ */
+static void
+ipc_client_connection_fail(struct ipc_connection *ipc_c)
+{
+	ipc_client_connection_fini(ipc_c);
+
+	if (ipc_c->ism != NULL) {
+		ipc_shmem_unmap((void **)&ipc_c->ism, ipc_c->ism_size);
+	}
+	if (ipc_c->slots != NULL) {
+		ipc_shmem_unmap((void **)&ipc_c->slots, ipc_c->slots_size);
+	}
+	ipc_shmem_destroy(&ipc_c->ism_handle, NULL, 0);
+	ipc_shmem_destroy(&ipc_c->slots_handle, NULL, 0);
+}
+
 
 xrt_result_t
 ipc_client_connection_init(struct ipc_connection *ipc_c,
@@ -259,10 +281,12 @@ ipc_client_connection_init(struct ipc_connection *ipc_c,
 	U_ZERO(ipc_c);
 	ipc_c->imc.ipc_handle = XRT_IPC_HANDLE_INVALID;
 	ipc_c->ism_handle = XRT_SHMEM_HANDLE_INVALID;
+	ipc_c->slots_handle = XRT_SHMEM_HANDLE_INVALID;
 
 	os_mutex_init(&ipc_c->mutex);
 
 	ipc_c->log_level = log_level;
+	ipc_c->use_pose_history = debug_get_bool_option_ipc_pose_history();
 
 	if (!ipc_client_socket_connect(ipc_c)) {
 		IPC_ERROR(ipc_c,
@@ -280,8 +304,11 @@ ipc_client_connection_init(struct ipc_connection *ipc_c,
 		return XRT_ERROR_IPC_FAILURE;
 	}
 
-	// get our xdev shm from the server and mmap it
-	xrt_result_t xret = ipc_call_instance_get_shm_fd(ipc_c, &ipc_c->ism_handle, 1);
+	// get our xdev shm and our slots shm from the server and mmap them
+	xrt_shmem_handle_t handles[2] = {XRT_SHMEM_HANDLE_INVALID, XRT_SHMEM_HANDLE_INVALID};
+	uint64_t ism_size = 0;
+	uint64_t slots_size = 0;
+	xrt_result_t xret = ipc_call_instance_get_shm_fd(ipc_c, &ism_size, &slots_size, handles, ARRAY_SIZE(handles));
 	if (xret != XRT_SUCCESS) {
 		IPC_ERROR(ipc_c, "Failed to retrieve shm fd!");
 		ipc_client_connection_fini(ipc_c);
@@ -289,6 +316,11 @@ ipc_client_connection_init(struct ipc_connection *ipc_c,
 		return xret;
 	}
 
+	ipc_c->ism_handle = handles[0];
+	ipc_c->ism_size = (size_t)ism_size;
+	ipc_c->slots_handle = handles[1];
+	ipc_c->slots_size = (size_t)slots_size;
+
 	struct ipc_client_description desc = {0};
 	desc.info = *i_info;
 	desc.pid = getpid(); // Extra info.
@@ -296,25 +328,23 @@ ipc_client_connection_init(struct ipc_connection *ipc_c,
 	xret = ipc_call_instance_describe_client(ipc_c, &desc);
 	if (xret != XRT_SUCCESS) {
 		IPC_ERROR(ipc_c, "Failed to set instance description!");
-		ipc_client_connection_fini(ipc_c);
+		ipc_client_connection_fail(ipc_c);
 
 
 		return xret;
 	}
 
-	const size_t size = sizeof(struct ipc_shared_memory);
-
-#ifdef XRT_OS_WINDOWS
-	ipc_c->ism = MapViewOfFile(ipc_c->ism_handle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size);
-#else
-	const int flags = MAP_SHARED;
-	const int access = PROT_READ | PROT_WRITE;
-
-	ipc_c->ism = mmap(NULL, size, access, flags, ipc_c->ism_handle, 0);
-#endif
-	if (ipc_c->ism == NULL) {
+	xret = ipc_shmem_map(ipc_c->ism_handle, ipc_c->ism_size, (void **)&ipc_c->ism);
+	if (xret != XRT_SUCCESS) {
 		IPC_ERROR(ipc_c, "Failed to mmap shm!");
-		ipc_client_connection_fini(ipc_c);
+		ipc_client_connection_fail(ipc_c);
+		return XRT_ERROR_IPC_FAILURE;
+	}
+
+	xret = ipc_shmem_map(ipc_c->slots_handle, ipc_c->slots_size, (void **)&ipc_c->slots);
+	if (xret != XRT_SUCCESS) {
+		IPC_ERROR(ipc_c, "Failed to mmap slots shm!");
+		ipc_client_connection_fail(ipc_c);
 		return XRT_ERROR_IPC_FAILURE;
 	}
 
@@ -323,10 +353,19 @@ ipc_client_connection_init(struct ipc_connection *ipc_c,
 		          ipc_c->ism->u_git_tag);
 		if (!debug_get_bool_option_ipc_ignore_version()) {
 			IPC_ERROR(ipc_c, "Set IPC_IGNORE_VERSION=1 to ignore this version conflict");
-
+			ipc_client_connection_fail(ipc_c);
 			return XRT_ERROR_IPC_FAILURE;
 		}
 	}
+
+	// Can't be ignored, we would read outside of the shared memory.
+	if (!ipc_shared_layout_validate(ipc_c->ism, ipc_c->ism_size) ||
+	    !ipc_shared_slots_validate(ipc_c->slots, ipc_c->slots_size)) {
+		IPC_ERROR(ipc_c, "Shared memory layout of the service is not compatible!");
+		ipc_client_connection_fail(ipc_c);
+		return XRT_ERROR_IPC_FAILURE;
+	}
+
 	return XRT_SUCCESS;
 }
 
@@ -64,8 +64,11 @@ ipc_client_device_destroy(struct xrt_device *xdev)
 	// Remove the variable tracking.
 	u_var_remove_root(icd);
 
-	// We do not own these, so don't free them.
+	// Our own copy.
+	free(icd->base.inputs);
 	icd->base.inputs = NULL;
+
+	// We do not own these, so don't free them.
 	icd->base.outputs = NULL;
 
 	// Free this device with the helper.
@@ -75,12 +78,7 @@ ipc_client_device_destroy(struct xrt_device *xdev)
 static void
 ipc_client_device_update_inputs(struct xrt_device *xdev)
 {
-	ipc_client_device_t *icd = ipc_client_device(xdev);
-
-	xrt_result_t r = ipc_call_device_update_input(icd->ipc_c, icd->device_id);
-	if (r != XRT_SUCCESS) {
-		IPC_ERROR(icd->ipc_c, "Error sending input update!");
-	}
+	ipc_client_xdev_update_inputs(ipc_client_device(xdev));
 }
 
 static void
@@ -91,6 +89,11 @@ ipc_client_device_get_tracked_pose(struct xrt_device *xdev,
 {
 	ipc_client_device_t *icd = ipc_client_device(xdev);
 
+	// Skip the round trip if the service keeps a history of this pose.
+	if (ipc_client_xdev_get_tracked_pose_from_history(icd, name, at_timestamp_ns, out_relation)) {
+		return;
+	}
+
 	xrt_result_t r =
 	    ipc_call_device_get_tracked_pose(icd->ipc_c, icd->device_id, name, at_timestamp_ns, out_relation);
 	if (r != XRT_SUCCESS) {
@@ -168,15 +171,14 @@ ipc_client_device_create(struct ipc_connection *ipc_c, struct xrt_tracking_origi
 	snprintf(icd->base.str, XRT_DEVICE_NAME_LEN, "%s", isdev->str);
 	snprintf(icd->base.serial, XRT_DEVICE_NAME_LEN, "%s", isdev->serial);
 
-	// Setup inputs, by pointing directly to the shared memory.
+	// Setup inputs, copied from the shared memory.
 	assert(isdev->input_count > 0);
-	icd->base.inputs = &ism->inputs[isdev->first_input_index];
-	icd->base.input_count = isdev->input_count;
+	ipc_client_xdev_init_inputs(icd);
 
 	// Setup outputs, if any point directly into the shared memory.
 	icd->base.output_count = isdev->output_count;
 	if (isdev->output_count > 0) {
-		icd->base.outputs = &ism->outputs[isdev->first_output_index];
+		icd->base.outputs = &ipc_shared_memory_outputs(ism)[isdev->first_output_index];
 	} else {
 		icd->base.outputs = NULL;
 	}
@@ -190,15 +192,15 @@ ipc_client_device_create(struct ipc_connection *ipc_c, struct xrt_tracking_origi
 	for (size_t i = 0; i < isdev->binding_profile_count; i++) {
 		struct xrt_binding_profile *xbp = &icd->base.binding_profiles[i];
 		struct ipc_shared_binding_profile *isbp =
-		    &ism->binding_profiles[isdev->first_binding_profile_index + i];
+		    &ipc_shared_memory_binding_profiles(ism)[isdev->first_binding_profile_index + i];
 
 		xbp->name = isbp->name;
 		if (isbp->input_count > 0) {
-			xbp->inputs = &ism->input_pairs[isbp->first_input_index];
+			xbp->inputs = &ipc_shared_memory_input_pairs(ism)[isbp->first_input_index];
 			xbp->input_count = isbp->input_count;
 		}
 		if (isbp->output_count > 0) {
-			xbp->outputs = &ism->output_pairs[isbp->first_output_index];
+			xbp->outputs = &ipc_shared_memory_output_pairs(ism)[isbp->first_output_index];
 			xbp->output_count = isbp->output_count;
 		}
 	}
@@ -66,8 +66,11 @@ ipc_client_hmd_destroy(struct xrt_device *xdev)
 	// Remove the variable tracking.
 	u_var_remove_root(ich);
 
-	// We do not own these, so don't free them.
+	// Our own copy.
+	free(ich->base.inputs);
 	ich->base.inputs = NULL;
+
+	// We do not own these, so don't free them.
 	ich->base.outputs = NULL;
 
 	// Free this device with the helper.
@@ -77,12 +80,7 @@ ipc_client_hmd_destroy(struct xrt_device *xdev)
 static void
 ipc_client_hmd_update_inputs(struct xrt_device *xdev)
 {
-	ipc_client_hmd_t *ich = ipc_client_hmd(xdev);
-
-	xrt_result_t r = ipc_call_device_update_input(ich->ipc_c, ich->device_id);
-	if (r != XRT_SUCCESS) {
-		IPC_ERROR(ich->ipc_c, "Error calling input update!");
-	}
+	ipc_client_xdev_update_inputs(ipc_client_hmd(xdev));
 }
 
 static void
@@ -93,6 +91,11 @@ ipc_client_hmd_get_tracked_pose(struct xrt_device *xdev,
 {
 	ipc_client_hmd_t *ich = ipc_client_hmd(xdev);
 
+	// Skip the round trip if the service keeps a history of this pose.
+	if (ipc_client_xdev_get_tracked_pose_from_history(ich, name, at_timestamp_ns, out_relation)) {
+		return;
+	}
+
 	xrt_result_t r =
 	    ipc_call_device_get_tracked_pose(ich->ipc_c, ich->device_id, name, at_timestamp_ns, out_relation);
 	if (r != XRT_SUCCESS) {
@@ -201,10 +204,9 @@ ipc_client_hmd_create(struct ipc_connection *ipc_c, struct xrt_tracking_origin *
 	snprintf(ich->base.str, XRT_DEVICE_NAME_LEN, "%s", isdev->str);
 	snprintf(ich->base.serial, XRT_DEVICE_NAME_LEN, "%s", isdev->serial);
 
-	// Setup inputs, by pointing directly to the shared memory.
+	// Setup inputs, copied from the shared memory.
 	assert(isdev->input_count > 0);
-	ich->base.inputs = &ism->inputs[isdev->first_input_index];
-	ich->base.input_count = isdev->input_count;
+	ipc_client_xdev_init_inputs(ich);
 
 #if 0
 	// Setup info.
@@ -0,0 +1,45 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Copying the inputs of the devices from the shared memory.
+ * @ingroup ipc_client
+ */
+
+#include "xrt/xrt_device.h"
+
+#include "util/u_misc.h"
+
+#include "shared/ipc_input_state.h"
+#include "client/ipc_client.h"
+#include "ipc_client_generated.h"
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+void
+ipc_client_xdev_init_inputs(struct ipc_client_xdev *icx)
+{
+	struct ipc_shared_memory *ism = icx->ipc_c->ism;
+	struct ipc_shared_device *isdev = &ism->isdevs[icx->device_id];
+
+	icx->base.inputs = U_TYPED_ARRAY_CALLOC(struct xrt_input, isdev->input_count);
+	icx->base.input_count = isdev->input_count;
+	icx->input_generation = ipc_input_state_read_all(ism, icx->device_id, icx->base.inputs);
+}
+
+void
+ipc_client_xdev_update_inputs(struct ipc_client_xdev *icx)
+{
+	xrt_result_t r = ipc_call_device_update_input(icx->ipc_c, icx->device_id);
+	if (r != XRT_SUCCESS) {
+		IPC_ERROR(icx->ipc_c, "Error calling input update!");
+		return;
+	}
+
+	ipc_input_state_read(icx->ipc_c->ism, icx->device_id, icx->base.inputs, &icx->input_generation);
+}
@@ -203,7 +203,8 @@ ipc_client_instance_destroy(struct xrt_instance *xinst)
 	}
 	ii->xtrack_count = 0;
 
-	ipc_shmem_destroy(&ii->ipc_c.ism_handle, (void **)&ii->ipc_c.ism, sizeof(struct ipc_shared_memory));
+	ipc_shmem_destroy(&ii->ipc_c.ism_handle, (void **)&ii->ipc_c.ism, ii->ipc_c.ism_size);
+	ipc_shmem_destroy(&ii->ipc_c.slots_handle, (void **)&ii->ipc_c.slots, ii->ipc_c.slots_size);
 
 	free(ii);
 }
@@ -0,0 +1,113 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Locating from the pose histories in the shared memory.
+ * @ingroup ipc_client
+ */
+
+#include "xrt/xrt_device.h"
+
+#include "os/os_time.h"
+#include "util/u_misc.h"
+
+#include "shared/ipc_pose_history.h"
+#include "client/ipc_client.h"
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static struct xrt_input *
+find_input(struct ipc_shared_memory *ism, uint32_t device_id, enum xrt_input_name name)
+{
+	struct ipc_shared_device *isdev = &ism->isdevs[device_id];
+	struct xrt_input *inputs = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
+
+	for (uint32_t i = 0; i < isdev->input_count; i++) {
+		if (inputs[i].name == name) {
+			return &inputs[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+bool
+ipc_client_pose_history_locate(struct ipc_connection *ipc_c,
+                               enum ipc_pose_history_type type,
+                               uint32_t device_id,
+                               enum xrt_input_name name,
+                               uint64_t at_timestamp_ns,
+                               struct xrt_space_relation *out_relation,
+                               struct xrt_space_relation *out_origin)
+{
+	struct ipc_shared_memory *ism = ipc_c->ism;
+	uint64_t interval_ns = ism->poses.interval_ns;
+
+	if (!ipc_c->use_pose_history || interval_ns == 0) {
+		return false;
+	}
+
+	struct ipc_shared_pose_history *iph = ipc_pose_history_find(ism, type, device_id, name);
+	if (iph == NULL) {
+		return false;
+	}
+
+	uint64_t max_age_ns = interval_ns * IPC_POSE_HISTORY_MAX_AGE_INTERVALS;
+	return ipc_pose_history_locate(iph, at_timestamp_ns, os_monotonic_get_ns(), max_age_ns, out_relation, out_origin);
+}
+
+bool
+ipc_client_xdev_get_tracked_pose_from_history(struct ipc_client_xdev *icx,
+                                              enum xrt_input_name name,
+                                              uint64_t at_timestamp_ns,
+                                              struct xrt_space_relation *out_relation)
+{
+	struct ipc_connection *ipc_c = icx->ipc_c;
+	struct ipc_shared_memory *ism = ipc_c->ism;
+
+	if (!ipc_c->use_pose_history || ism->poses.interval_ns == 0) {
+		return false;
+	}
+
+	struct ipc_shared_pose_history *iph =
+	    ipc_pose_history_find(ism, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, icx->device_id, name);
+	if (iph == NULL) {
+		return false;
+	}
+
+	// Let the service report unknown inputs.
+	struct xrt_input *input = find_input(ism, icx->device_id, name);
+	if (input == NULL) {
+		return false;
+	}
+
+	// Same as the service, the head pose is never disabled.
+	bool disabled = !iph->io_active && name != XRT_INPUT_GENERIC_HEAD_POSE;
+	bool active_on_client = input->active;
+
+	// We have been disabled but the client hasn't called update.
+	if (disabled && active_on_client) {
+		U_ZERO(out_relation);
+		return true;
+	}
+
+	// The service returns an error for these, let it.
+	if (disabled || !active_on_client) {
+		return false;
+	}
+
+	uint64_t max_age_ns = ism->poses.interval_ns * IPC_POSE_HISTORY_MAX_AGE_INTERVALS;
+	return ipc_pose_history_locate(iph, at_timestamp_ns, os_monotonic_get_ns(), max_age_ns, out_relation, NULL);
+}
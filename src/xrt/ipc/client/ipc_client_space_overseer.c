@@ -9,9 +9,26 @@
 
 #include "xrt/xrt_space.h"
 
+#include "math/m_space.h"
+
 #include "ipc_client_generated.h"
 
 
+/*!
+ * What the client knows about a space, enough to locate it from the pose
+ * histories in the shared memory.
+ */
+enum ipc_client_space_type
+{
+	//! Only the service can locate it.
+	IPC_CLIENT_SPACE_TYPE_UNKNOWN,
+	IPC_CLIENT_SPACE_TYPE_ROOT,
+	//! A semantic space with a pose history.
+	IPC_CLIENT_SPACE_TYPE_SEMANTIC,
+	IPC_CLIENT_SPACE_TYPE_OFFSET,
+	IPC_CLIENT_SPACE_TYPE_POSE,
+};
+
 struct ipc_client_space
 {
 	struct xrt_space base;
@@ -19,6 +36,28 @@ struct ipc_client_space
 	struct ipc_connection *ipc_c;
 
 	uint32_t id;
+
+	enum ipc_client_space_type type;
+
+	union {
+		struct
+		{
+			enum ipc_pose_history_type history_type;
+		} semantic;
+
+		struct
+		{
+			//! Holds a reference.
+			struct xrt_space *parent;
+			struct xrt_pose pose;
+		} offset;
+
+		struct
+		{
+			uint32_t xdev_id;
+			enum xrt_input_name name;
+		} pose;
+	};
 };
 
 struct ipc_client_space_overseer
@@ -61,10 +100,14 @@ space_destroy(struct xrt_space *xs)
 
 	ipc_call_space_destroy(icsp->ipc_c, icsp->id);
 
+	if (icsp->type == IPC_CLIENT_SPACE_TYPE_OFFSET) {
+		xrt_space_reference(&icsp->offset.parent, NULL);
+	}
+
 	free(xs);
 }
 
-static void
+static struct ipc_client_space *
 alloc_space_with_id(struct ipc_client_space_overseer *icspo, uint32_t id, struct xrt_space **out_space)
 {
 	struct ipc_client_space *icsp = U_TYPED_CALLOC(struct ipc_client_space);
@@ -74,6 +117,80 @@ alloc_space_with_id(struct ipc_client_space_overseer *icspo, uint32_t id, struct
 	icsp->id = id;
 
 	*out_space = &icsp->base;
+
+	return icsp;
+}
+
+
+/*
+ *
+ * Locating from the pose histories.
+ *
+ */
+
+static inline void
+special_resolve(struct xrt_relation_chain *xrc, struct xrt_space_relation *out_relation)
+{
+	// A space chain with zero step is always valid, same as the service.
+	if (xrc->step_count == 0) {
+		out_relation->pose = (struct xrt_pose)XRT_POSE_IDENTITY;
+		out_relation->relation_flags =                   //
+		    XRT_SPACE_RELATION_ORIENTATION_VALID_BIT |   //
+		    XRT_SPACE_RELATION_ORIENTATION_TRACKED_BIT | //
+		    XRT_SPACE_RELATION_POSITION_VALID_BIT |      //
+		    XRT_SPACE_RELATION_POSITION_TRACKED_BIT;
+	} else {
+		m_relation_chain_resolve(xrc, out_relation);
+	}
+}
+
+/*!
+ * Push the relations from @p icsp to the root space, false if any of them has
+ * to come from the service.
+ */
+static bool
+push_to_root(struct xrt_relation_chain *xrc, struct ipc_client_space *icsp, uint64_t at_timestamp_ns)
+{
+	struct xrt_space_relation relation;
+	struct xrt_space_relation origin;
+
+	switch (icsp->type) {
+	case IPC_CLIENT_SPACE_TYPE_UNKNOWN: return false;
+	case IPC_CLIENT_SPACE_TYPE_ROOT: return true;
+	case IPC_CLIENT_SPACE_TYPE_SEMANTIC:
+		if (!ipc_client_pose_history_locate(icsp->ipc_c, icsp->semantic.history_type, 0, 0, at_timestamp_ns,
+		                                    &relation, NULL)) {
+			return false;
+		}
+		m_relation_chain_push_relation(xrc, &relation);
+		return true;
+	case IPC_CLIENT_SPACE_TYPE_OFFSET:
+		m_relation_chain_push_pose_if_not_identity(xrc, &icsp->offset.pose);
+		return push_to_root(xrc, ipc_client_space(icsp->offset.parent), at_timestamp_ns);
+	case IPC_CLIENT_SPACE_TYPE_POSE:
+		if (!ipc_client_pose_history_locate(icsp->ipc_c, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, icsp->pose.xdev_id,
+		                                    icsp->pose.name, at_timestamp_ns, &relation, &origin)) {
+			return false;
+		}
+		m_relation_chain_push_relation(xrc, &relation);
+		m_relation_chain_push_relation(xrc, &origin);
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+locate_in_root(struct ipc_client_space *icsp, uint64_t at_timestamp_ns, struct xrt_space_relation *out_relation)
+{
+	struct xrt_relation_chain xrc = {0};
+	if (!push_to_root(&xrc, icsp, at_timestamp_ns)) {
+		return false;
+	}
+
+	special_resolve(&xrc, out_relation);
+
+	return true;
 }
 
 
@@ -99,7 +216,10 @@ create_offset_space(struct xrt_space_overseer *xso,
 		return xret;
 	}
 
-	alloc_space_with_id(icspo, id, out_space);
+	struct ipc_client_space *icsp = alloc_space_with_id(icspo, id, out_space);
+	icsp->type = IPC_CLIENT_SPACE_TYPE_OFFSET;
+	icsp->offset.pose = *offset;
+	xrt_space_reference(&icsp->offset.parent, parent);
 
 	return XRT_SUCCESS;
 }
@@ -120,7 +240,10 @@ create_pose_space(struct xrt_space_overseer *xso,
 		return xret;
 	}
 
-	alloc_space_with_id(icspo, id, out_space);
+	struct ipc_client_space *icsp = alloc_space_with_id(icspo, id, out_space);
+	icsp->type = IPC_CLIENT_SPACE_TYPE_POSE;
+	icsp->pose.xdev_id = xdev_id;
+	icsp->pose.name = name;
 
 	return XRT_SUCCESS;
 }
@@ -139,6 +262,21 @@ locate_space(struct xrt_space_overseer *xso,
 	struct ipc_client_space *icsp_base_space = ipc_client_space(base_space);
 	struct ipc_client_space *icsp_space = ipc_client_space(space);
 
+	// Both spaces in the root space from the pose histories, skips the round trip.
+	struct xrt_space_relation base_in_root;
+	struct xrt_space_relation space_in_root;
+	if (locate_in_root(icsp_base_space, at_timestamp_ns, &base_in_root) &&
+	    locate_in_root(icsp_space, at_timestamp_ns, &space_in_root)) {
+		struct xrt_relation_chain xrc = {0};
+		m_relation_chain_push_pose_if_not_identity(&xrc, offset);
+		m_relation_chain_push_relation(&xrc, &space_in_root);
+		m_relation_chain_push_inverted_relation(&xrc, &base_in_root);
+		m_relation_chain_push_inverted_pose_if_not_identity(&xrc, base_offset);
+		special_resolve(&xrc, out_relation);
+
+		return XRT_SUCCESS;
+	}
+
 	return ipc_call_space_locate_space( //
 	    icspo->ipc_c,                   //
 	    icsp_base_space->id,            //
@@ -162,6 +300,22 @@ locate_device(struct xrt_space_overseer *xso,
 	struct ipc_client_space *icsp_base_space = ipc_client_space(base_space);
 	uint32_t xdev_id = ipc_client_xdev(xdev)->device_id;
 
+	// The device's space from any of its pose histories, skips the round trip.
+	struct xrt_space_relation base_in_root;
+	struct xrt_space_relation pose;
+	struct xrt_space_relation origin;
+	if (locate_in_root(icsp_base_space, at_timestamp_ns, &base_in_root) &&
+	    ipc_client_pose_history_locate(icspo->ipc_c, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, xdev_id, 0, at_timestamp_ns,
+	                                   &pose, &origin)) {
+		struct xrt_relation_chain xrc = {0};
+		m_relation_chain_push_relation(&xrc, &origin);
+		m_relation_chain_push_inverted_relation(&xrc, &base_in_root);
+		m_relation_chain_push_inverted_pose_if_not_identity(&xrc, base_offset);
+		special_resolve(&xrc, out_relation);
+
+		return XRT_SUCCESS;
+	}
+
 	return ipc_call_space_locate_device( //
 	    icspo->ipc_c,                    //
 	    icsp_base_space->id,             //
@@ -211,21 +365,28 @@ ipc_client_space_overseer_create(struct ipc_connection *ipc_c)
 
 	ipc_call_space_create_semantic_ids(icspo->ipc_c, &root_id, &view_id, &local_id, &stage_id, &unbounded_id);
 
-#define CREATE(NAME)                                                                                                   \
+#define CREATE(NAME, TYPE)                                                                                             \
 	do {                                                                                                           \
 		if (NAME##_id == UINT32_MAX) {                                                                         \
 			break;                                                                                         \
 		}                                                                                                      \
-		alloc_space_with_id(icspo, NAME##_id, &icspo->base.semantic.NAME);                                     \
+		struct ipc_client_space *icsp = alloc_space_with_id(icspo, NAME##_id, &icspo->base.semantic.NAME);     \
+		icsp->type = IPC_CLIENT_SPACE_TYPE_SEMANTIC;                                                           \
+		icsp->semantic.history_type = TYPE;                                                                    \
 	} while (false)
 
-	CREATE(root);
-	CREATE(view);
-	CREATE(local);
-	CREATE(stage);
-	CREATE(unbounded);
+	CREATE(root, IPC_POSE_HISTORY_TYPE_NONE);
+	CREATE(view, IPC_POSE_HISTORY_TYPE_VIEW);
+	CREATE(local, IPC_POSE_HISTORY_TYPE_LOCAL);
+	CREATE(stage, IPC_POSE_HISTORY_TYPE_STAGE);
+	CREATE(unbounded, IPC_POSE_HISTORY_TYPE_UNBOUNDED);
 
 #undef CREATE
 
+	// The root space is the one everything is located in.
+	if (icspo->base.semantic.root != NULL) {
+		ipc_client_space(icspo->base.semantic.root)->type = IPC_CLIENT_SPACE_TYPE_ROOT;
+	}
+
 	return &icspo->base;
 }
@@ -20,6 +20,7 @@
 #include "os/os_threading.h"
 
 #include "shared/ipc_protocol.h"
+#include "shared/ipc_reactor.h"
 #include "shared/ipc_utils.h"
 
 #include <stdio.h>
@@ -121,6 +122,24 @@ struct ipc_client_state
 
 	struct ipc_app_state client_state;
 
+	//! Layer slots shared with this client only, created when it connects.
+	struct ipc_shared_slots *slots;
+	xrt_shmem_handle_t slots_handle;
+	size_t slots_size;
+
+	//! The slot the client fills in next.
+	uint32_t current_slot_index;
+
+	//! Watches the socket instead of a thread when the server has a reactor.
+	struct ipc_reactor_client reactor_client;
+
+	//! A wait image call parked on the reactor.
+	struct
+	{
+		uint32_t id;
+		uint32_t index;
+	} parked_wait;
+
 	int server_thread_index;
 };
 
@@ -150,6 +169,9 @@ struct ipc_device
 
 	//! Is the IO suppressed for this device.
 	bool io_active;
+
+	//! Clients update the inputs from their own threads, one publishes at a time.
+	struct os_mutex input_lock;
 };
 
 /*!
@@ -327,6 +349,7 @@ struct ipc_server
 
 	struct ipc_shared_memory *ism;
 	xrt_shmem_handle_t ism_handle;
+	size_t ism_size;
 
 	struct ipc_server_mainloop ml;
 
@@ -338,13 +361,28 @@ struct ipc_server
 
 	enum u_logging_level log_level;
 
-	struct ipc_thread threads[IPC_MAX_CLIENTS];
+	//! One per client that can be connected at the same time.
+	struct ipc_thread *threads;
+	uint32_t thread_count;
 
-	volatile uint32_t current_slot_index;
+	//! Number of layer slots each client gets.
+	uint32_t client_slot_count;
+
+	//! Dispatches all clients on a worker pool if set, else a thread each.
+	struct ipc_reactor *reactor;
 
 	//! Generator for IDs.
 	uint32_t id_generator;
 
+	//! Samples the pose histories in the shared memory.
+	struct
+	{
+		struct os_thread_helper oth;
+
+		//! How far ahead the device is asked to predict.
+		uint64_t horizon_ns;
+	} pose_history;
+
 	struct
 	{
 		int active_client_index;
@@ -436,6 +474,31 @@ ipc_server_update_state(struct ipc_server *s);
 void *
 ipc_server_client_thread(void *_ics);
 
+/*!
+ * Pick the device pose inputs and semantic spaces to keep pose histories of in
+ * the shared memory, called when setting up the shared memory.
+ *
+ * @ingroup ipc_server
+ */
+void
+ipc_server_pose_history_setup(struct ipc_server *s);
+
+/*!
+ * Start the thread sampling the pose histories, if enabled.
+ *
+ * @ingroup ipc_server
+ */
+int
+ipc_server_pose_history_start(struct ipc_server *s);
+
+/*!
+ * Stop the thread sampling the pose histories, safe to call if never started.
+ *
+ * @ingroup ipc_server
+ */
+void
+ipc_server_pose_history_stop(struct ipc_server *s);
+
 /*!
  * This destroys the native compositor for this client and any extra objects
  * created from it, like all of the swapchains.
@@ -443,6 +506,41 @@ ipc_server_client_thread(void *_ics);
 void
 ipc_server_client_destroy_compositor(volatile struct ipc_client_state *ics);
 
+/*!
+ * Releases everything a disconnected client held, called once the client has
+ * been removed from the list of clients.
+ *
+ * @ingroup ipc_server
+ */
+void
+ipc_server_client_release(volatile struct ipc_client_state *ics);
+
+/*!
+ * Create the reactor if enabled with `IPC_REACTOR`, only supported on desktop
+ * Linux. Clients connected after this are dispatched by it.
+ *
+ * @ingroup ipc_server
+ */
+int
+ipc_server_reactor_init(struct ipc_server *s);
+
+/*!
+ * Disconnect all clients still on the reactor and destroy it.
+ *
+ * @ingroup ipc_server
+ */
+void
+ipc_server_reactor_fini(struct ipc_server *s);
+
+/*!
+ * Hand a newly connected client to the reactor, called with the global state
+ * lock held.
+ *
+ * @ingroup ipc_server
+ */
+int
+ipc_server_reactor_add_client(volatile struct ipc_client_state *ics);
+
 /*!
  * @defgroup ipc_server_internals Server Internals
  * @brief These are only called by the platform-specific mainloop polling code.
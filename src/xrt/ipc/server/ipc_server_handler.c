@@ -13,6 +13,7 @@
 #include "util/u_handles.h"
 #include "util/u_trace_marker.h"
 
+#include "shared/ipc_input_state.h"
 #include "server/ipc_server.h"
 #include "ipc_server_generated.h"
 
@@ -149,16 +150,25 @@ track_space(volatile struct ipc_client_state *ics, struct xrt_space *xs, uint32_
 
 xrt_result_t
 ipc_handle_instance_get_shm_fd(volatile struct ipc_client_state *ics,
+                               uint64_t *out_size,
+                               uint64_t *out_slots_size,
                                uint32_t max_handle_capacity,
                                xrt_shmem_handle_t *out_handles,
                                uint32_t *out_handle_count)
 {
 	IPC_TRACE_MARKER();
 
-	assert(max_handle_capacity >= 1);
+	if (max_handle_capacity < 2) {
+		IPC_ERROR(ics->server, "Client can't take both shared memory handles!");
+		return XRT_ERROR_IPC_FAILURE;
+	}
 
+	// The shared memory of all clients and then that of this client's slots.
 	out_handles[0] = ics->server->ism_handle;
-	*out_handle_count = 1;
+	out_handles[1] = ics->slots_handle;
+	*out_handle_count = 2;
+	*out_size = ics->server->ism_size;
+	*out_slots_size = ics->slots_size;
 
 	return XRT_SUCCESS;
 }
@@ -760,6 +770,26 @@ _update_equirect2_layer(struct xrt_compositor *xc,
 	return true;
 }
 
+static xrt_result_t
+copy_client_slot(volatile struct ipc_client_state *ics, uint32_t slot_id, struct ipc_layer_slot *out_slot)
+{
+	// Don't trust the header in the shared memory, the client can write it.
+	if (ics->slots == NULL || slot_id >= ics->server->client_slot_count) {
+		IPC_ERROR(ics->server, "Invalid slot_id %u!", slot_id);
+		return XRT_ERROR_IPC_FAILURE;
+	}
+
+	// Copy so the client can't change it while we use it.
+	*out_slot = *ipc_shared_slots_get(ics->slots, slot_id);
+
+	if (out_slot->layer_count > IPC_MAX_LAYERS) {
+		IPC_ERROR(ics->server, "Invalid layer_count %u!", out_slot->layer_count);
+		return XRT_ERROR_IPC_FAILURE;
+	}
+
+	return XRT_SUCCESS;
+}
+
 static bool
 _update_layers(volatile struct ipc_client_state *ics, struct xrt_compositor *xc, struct ipc_layer_slot *slot)
 {
@@ -811,6 +841,16 @@ _update_layers(volatile struct ipc_client_state *ics, struct xrt_compositor *xc,
 	return true;
 }
 
+static void
+unref_sync_handles(const xrt_graphics_sync_handle_t *handles, uint32_t first, uint32_t handle_count)
+{
+	for (uint32_t i = first; i < handle_count; i++) {
+		// Checks for valid handle.
+		xrt_graphics_sync_handle_t tmp = handles[i];
+		u_graphics_sync_unref(&tmp);
+	}
+}
+
 xrt_result_t
 ipc_handle_compositor_layer_sync(volatile struct ipc_client_state *ics,
                                  uint32_t slot_id,
@@ -820,12 +860,20 @@ ipc_handle_compositor_layer_sync(volatile struct ipc_client_state *ics,
 {
 	IPC_TRACE_MARKER();
 
+	// The handles are ours, nothing else closes them on the error paths.
 	if (ics->xc == NULL) {
+		unref_sync_handles(handles, 0, handle_count);
 		return XRT_ERROR_IPC_SESSION_NOT_CREATED;
 	}
 
-	struct ipc_shared_memory *ism = ics->server->ism;
-	struct ipc_layer_slot *slot = &ism->slots[slot_id];
+	// Copy current slot data.
+	struct ipc_layer_slot copy;
+	xrt_result_t xret = copy_client_slot(ics, slot_id, &copy);
+	if (xret != XRT_SUCCESS) {
+		unref_sync_handles(handles, 0, handle_count);
+		return xret;
+	}
+
 	xrt_graphics_sync_handle_t sync_handle = XRT_GRAPHICS_SYNC_HANDLE_INVALID;
 
 	// If we have one or more save the first handle.
@@ -834,14 +882,7 @@ ipc_handle_compositor_layer_sync(volatile struct ipc_client_state *ics,
 	}
 
 	// Free all sync handles after the first one.
-	for (uint32_t i = 1; i < handle_count; i++) {
-		// Checks for valid handle.
-		xrt_graphics_sync_handle_t tmp = handles[i];
-		u_graphics_sync_unref(&tmp);
-	}
-
-	// Copy current slot data.
-	struct ipc_layer_slot copy = *slot;
+	unref_sync_handles(handles, 1, handle_count);
 
 
 	/*
@@ -856,15 +897,11 @@ ipc_handle_compositor_layer_sync(volatile struct ipc_client_state *ics,
 
 
 	/*
-	 * Manage shared state.
+	 * Manage shared state, the slots are only shared with this client.
 	 */
 
-	os_mutex_lock(&ics->server->global_state.lock);
-
-	*out_free_slot_id = (ics->server->current_slot_index + 1) % IPC_MAX_SLOTS;
-	ics->server->current_slot_index = *out_free_slot_id;
-
-	os_mutex_unlock(&ics->server->global_state.lock);
+	*out_free_slot_id = (ics->current_slot_index + 1) % ics->server->client_slot_count;
+	ics->current_slot_index = *out_free_slot_id;
 
 	return XRT_SUCCESS;
 }
@@ -892,12 +929,12 @@ ipc_handle_compositor_layer_sync_with_semaphore(volatile struct ipc_client_state
 
 	struct xrt_compositor_semaphore *xcsem = ics->xcsems[semaphore_id];
 
-	struct ipc_shared_memory *ism = ics->server->ism;
-	struct ipc_layer_slot *slot = &ism->slots[slot_id];
-
 	// Copy current slot data.
-	struct ipc_layer_slot copy = *slot;
-
+	struct ipc_layer_slot copy;
+	xrt_result_t xret = copy_client_slot(ics, slot_id, &copy);
+	if (xret != XRT_SUCCESS) {
+		return xret;
+	}
 
 
 	/*
@@ -912,15 +949,11 @@ ipc_handle_compositor_layer_sync_with_semaphore(volatile struct ipc_client_state
 
 
 	/*
-	 * Manage shared state.
+	 * Manage shared state, the slots are only shared with this client.
 	 */
 
-	os_mutex_lock(&ics->server->global_state.lock);
-
-	*out_free_slot_id = (ics->server->current_slot_index + 1) % IPC_MAX_SLOTS;
-	ics->server->current_slot_index = *out_free_slot_id;
-
-	os_mutex_unlock(&ics->server->global_state.lock);
+	*out_free_slot_id = (ics->current_slot_index + 1) % ics->server->client_slot_count;
+	ics->current_slot_index = *out_free_slot_id;
 
 	return XRT_SUCCESS;
 }
@@ -946,7 +979,7 @@ ipc_handle_system_get_clients(volatile struct ipc_client_state *_ics, struct ipc
 	os_mutex_lock(&s->global_state.lock);
 
 	uint32_t count = 0;
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < s->thread_count; i++) {
 
 		volatile struct ipc_client_state *ics = &s->threads[i].ics;
 
@@ -1301,31 +1334,15 @@ ipc_handle_device_update_input(volatile struct ipc_client_state *ics, uint32_t i
 	struct ipc_shared_memory *ism = ics->server->ism;
 	struct ipc_device *idev = get_idev(ics, device_id);
 	struct xrt_device *xdev = idev->xdev;
-	struct ipc_shared_device *isdev = &ism->isdevs[device_id];
 
 	// Update inputs.
 	xrt_device_update_inputs(xdev);
 
-	// Copy data into the shared memory.
-	struct xrt_input *src = xdev->inputs;
-	struct xrt_input *dst = &ism->inputs[isdev->first_input_index];
-	size_t size = sizeof(struct xrt_input) * isdev->input_count;
-
+	// Only the inputs that changed are written to the shared memory.
 	bool io_active = ics->io_active && idev->io_active;
-	if (io_active) {
-		memcpy(dst, src, size);
-	} else {
-		memset(dst, 0, size);
-
-		for (uint32_t i = 0; i < isdev->input_count; i++) {
-			dst[i].name = src[i].name;
-
-			// Special case the rotation of the head.
-			if (dst[i].name == XRT_INPUT_GENERIC_HEAD_POSE) {
-				dst[i].active = src[i].active;
-			}
-		}
-	}
+	os_mutex_lock(&idev->input_lock);
+	ipc_input_state_publish(ism, device_id, xdev->inputs, io_active);
+	os_mutex_unlock(&idev->input_lock);
 
 	// Reply.
 	return XRT_SUCCESS;
@@ -1336,7 +1353,7 @@ find_input(volatile struct ipc_client_state *ics, uint32_t device_id, enum xrt_i
 {
 	struct ipc_shared_memory *ism = ics->server->ism;
 	struct ipc_shared_device *isdev = &ism->isdevs[device_id];
-	struct xrt_input *io = &ism->inputs[isdev->first_input_index];
+	struct xrt_input *io = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
 
 	for (uint32_t i = 0; i < isdev->input_count; i++) {
 		if (io[i].name == name) {
@@ -11,6 +11,7 @@
 #include "util/u_misc.h"
 #include "util/u_trace_marker.h"
 
+#include "shared/ipc_shmem.h"
 #include "server/ipc_server.h"
 #include "ipc_server_generated.h"
 
@@ -137,20 +138,7 @@ client_loop(volatile struct ipc_client_state *ics)
 
 	os_mutex_unlock(&ics->server->global_state.lock);
 
-	ipc_server_client_destroy_compositor(ics);
-
-	// Make sure undestroyed spaces are unreferenced
-	for (uint32_t i = 0; i < IPC_MAX_CLIENT_SPACES; i++) {
-		// Cast away volatile.
-		xrt_space_reference((struct xrt_space **)&ics->xspcs[i], NULL);
-	}
-
-	// Should we stop the server when a client disconnects?
-	if (ics->server->exit_on_disconnect) {
-		ics->server->running = false;
-	}
-
-	ipc_server_deactivate_session(ics);
+	ipc_server_client_release(ics);
 }
 
 #elif defined(XRT_OS_APPLE)
@@ -269,14 +257,7 @@ client_loop(volatile struct ipc_client_state *ics)
 
 	os_mutex_unlock(&ics->server->global_state.lock);
 
-	ipc_server_client_destroy_compositor(ics);
-
-	// Should we stop the server when a client disconnects?
-	if (ics->server->exit_on_disconnect) {
-		ics->server->running = false;
-	}
-
-	ipc_server_deactivate_session(ics);
+	ipc_server_client_release(ics);
 }
 
 #elif defined(XRT_OS_WINDOWS)
@@ -330,20 +311,7 @@ client_loop(volatile struct ipc_client_state *ics)
 
 	os_mutex_unlock(&ics->server->global_state.lock);
 
-	ipc_server_client_destroy_compositor(ics);
-
-	// Make sure undestroyed spaces are unreferenced
-	for (uint32_t i = 0; i < IPC_MAX_CLIENT_SPACES; i++) {
-		// Cast away volatile.
-		xrt_space_reference((struct xrt_space **)&ics->xspcs[i], NULL);
-	}
-
-	// Should we stop the server when a client disconnects?
-	if (ics->server->exit_on_disconnect) {
-		ics->server->running = false;
-	}
-
-	ipc_server_deactivate_session(ics);
+	ipc_server_client_release(ics);
 }
 
 #else
@@ -384,6 +352,28 @@ ipc_server_client_destroy_compositor(volatile struct ipc_client_state *ics)
 	xrt_comp_destroy((struct xrt_compositor **)&ics->xc);
 }
 
+void
+ipc_server_client_release(volatile struct ipc_client_state *ics)
+{
+	ipc_server_client_destroy_compositor(ics);
+
+	// Make sure undestroyed spaces are unreferenced
+	for (uint32_t i = 0; i < IPC_MAX_CLIENT_SPACES; i++) {
+		// Cast away volatile.
+		xrt_space_reference((struct xrt_space **)&ics->xspcs[i], NULL);
+	}
+
+	// Should we stop the server when a client disconnects?
+	if (ics->server->exit_on_disconnect) {
+		ics->server->running = false;
+	}
+
+	ipc_server_deactivate_session(ics);
+
+	// Not looked at by other threads, the client state is only reused later.
+	ipc_shmem_destroy((xrt_shmem_handle_t *)&ics->slots_handle, (void **)&ics->slots, ics->slots_size);
+}
+
 void *
 ipc_server_client_thread(void *_ics)
 {
@@ -0,0 +1,226 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Samples poses into the shared memory pose histories.
+ * @ingroup ipc_server
+ */
+
+#include "xrt/xrt_device.h"
+#include "xrt/xrt_space.h"
+
+#include "os/os_time.h"
+#include "math/m_space.h"
+#include "util/u_debug.h"
+#include "util/u_trace_marker.h"
+
+#include "shared/ipc_pose_history.h"
+#include "server/ipc_server.h"
+
+
+/*
+ *
+ * Defines and helpers.
+ *
+ */
+
+DEBUG_GET_ONCE_NUM_OPTION(pose_history_rate, "IPC_POSE_HISTORY_RATE", 500)
+DEBUG_GET_ONCE_NUM_OPTION(pose_history_horizon_ms, "IPC_POSE_HISTORY_HORIZON_MS", 50)
+
+//! Histories not read for this long are not sampled.
+#define UNUSED_TIMEOUT_NS (U_TIME_1S_IN_NS)
+
+static bool
+is_pose_input(enum xrt_input_name name)
+{
+	return XRT_GET_INPUT_TYPE(name) == XRT_INPUT_TYPE_POSE;
+}
+
+static void
+add_history(struct ipc_shared_memory *ism, enum ipc_pose_history_type type, uint32_t device_id, enum xrt_input_name name)
+{
+	if (ism->poses.history_count >= IPC_SHARED_MAX_POSE_HISTORIES) {
+		U_LOG_W("Out of pose histories, clients will ask the service for the rest.");
+		return;
+	}
+
+	struct ipc_shared_pose_history *iph = &ism->poses.histories[ism->poses.history_count++];
+	iph->type = type;
+	iph->device_id = device_id;
+	iph->name = name;
+}
+
+static struct xrt_space *
+get_semantic_space(struct xrt_space_overseer *xso, enum ipc_pose_history_type type)
+{
+	switch (type) {
+	case IPC_POSE_HISTORY_TYPE_VIEW: return xso->semantic.view;
+	case IPC_POSE_HISTORY_TYPE_LOCAL: return xso->semantic.local;
+	case IPC_POSE_HISTORY_TYPE_STAGE: return xso->semantic.stage;
+	case IPC_POSE_HISTORY_TYPE_UNBOUNDED: return xso->semantic.unbounded;
+	default: return NULL;
+	}
+}
+
+static void
+sample(struct ipc_server *s,
+       struct ipc_shared_pose_history *iph,
+       uint64_t at_timestamp_ns,
+       struct ipc_shared_pose_sample *out_sample)
+{
+	struct xrt_space_overseer *xso = s->xso;
+	const struct xrt_pose identity = XRT_POSE_IDENTITY;
+
+	out_sample->timestamp_ns = at_timestamp_ns;
+
+	if (iph->type == IPC_POSE_HISTORY_TYPE_DEVICE_INPUT) {
+		struct xrt_device *xdev = s->idevs[iph->device_id].xdev;
+
+		xrt_device_get_tracked_pose(xdev, iph->name, at_timestamp_ns, &out_sample->relation);
+		xrt_space_overseer_locate_device( //
+		    xso,                          //
+		    xso->semantic.root,           //
+		    &identity,                    //
+		    at_timestamp_ns,              //
+		    xdev,                         //
+		    &out_sample->origin);         //
+	} else {
+		xrt_space_overseer_locate_space(        //
+		    xso,                                //
+		    xso->semantic.root,                 //
+		    &identity,                          //
+		    at_timestamp_ns,                    //
+		    get_semantic_space(xso, iph->type), //
+		    &identity,                          //
+		    &out_sample->relation);             //
+		m_space_relation_ident(&out_sample->origin);
+	}
+}
+
+static void
+sample_all(struct ipc_server *s, uint64_t now_ns)
+{
+	IPC_TRACE_MARKER();
+
+	struct ipc_shared_memory *ism = s->ism;
+
+	for (uint32_t i = 0; i < ism->poses.history_count; i++) {
+		struct ipc_shared_pose_history *iph = &ism->poses.histories[i];
+
+		uint64_t last_read_ns = iph->last_read_ns;
+		if (last_read_ns == 0 || now_ns > last_read_ns + UNUSED_TIMEOUT_NS) {
+			continue;
+		}
+
+		bool io_active = true;
+		if (iph->type == IPC_POSE_HISTORY_TYPE_DEVICE_INPUT) {
+			io_active = s->idevs[iph->device_id].io_active;
+		}
+
+		struct ipc_shared_pose_sample current;
+		struct ipc_shared_pose_sample predicted;
+		sample(s, iph, now_ns, &current);
+		sample(s, iph, now_ns + s->pose_history.horizon_ns, &predicted);
+
+		ipc_pose_history_push(iph, io_active, &current, &predicted);
+	}
+}
+
+static void *
+run_pose_history(void *ptr)
+{
+	U_TRACE_SET_THREAD_NAME("IPC Pose History");
+
+	struct ipc_server *s = (struct ipc_server *)ptr;
+	struct os_thread_helper *oth = &s->pose_history.oth;
+	uint64_t interval_ns = s->ism->poses.interval_ns;
+
+	uint64_t next_ns = os_monotonic_get_ns();
+
+	while (os_thread_helper_is_running(oth)) {
+		uint64_t now_ns = os_monotonic_get_ns();
+		if (now_ns < next_ns) {
+			os_nanosleep((int64_t)(next_ns - now_ns));
+			now_ns = os_monotonic_get_ns();
+		}
+
+		sample_all(s, now_ns);
+
+		// Don't try to catch up with a burst of samples after a stall.
+		next_ns += interval_ns;
+		if (next_ns < now_ns) {
+			next_ns = now_ns + interval_ns;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+void
+ipc_server_pose_history_setup(struct ipc_server *s)
+{
+	struct ipc_shared_memory *ism = s->ism;
+
+	int64_t rate = debug_get_num_option_pose_history_rate();
+	if (rate <= 0 || s->xso == NULL) {
+		IPC_INFO(s, "Not sampling pose histories, clients will ask for every pose.");
+		ism->poses.interval_ns = 0;
+		ism->poses.history_count = 0;
+		return;
+	}
+
+	ism->poses.interval_ns = U_TIME_1S_IN_NS / rate;
+	s->pose_history.horizon_ns = debug_get_num_option_pose_history_horizon_ms() * U_TIME_1MS_IN_NS;
+
+	for (uint32_t i = 0; i < ism->isdev_count; i++) {
+		struct xrt_device *xdev = s->idevs[i].xdev;
+		if (xdev == NULL) {
+			continue;
+		}
+
+		for (uint32_t k = 0; k < xdev->input_count; k++) {
+			if (is_pose_input(xdev->inputs[k].name)) {
+				add_history(ism, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, i, xdev->inputs[k].name);
+			}
+		}
+	}
+
+	for (enum ipc_pose_history_type type = IPC_POSE_HISTORY_TYPE_VIEW; type <= IPC_POSE_HISTORY_TYPE_UNBOUNDED;
+	     type++) {
+		if (get_semantic_space(s->xso, type) != NULL) {
+			add_history(ism, type, 0, 0);
+		}
+	}
+}
+
+int
+ipc_server_pose_history_start(struct ipc_server *s)
+{
+	int ret = os_thread_helper_init(&s->pose_history.oth);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (s->ism->poses.interval_ns == 0) {
+		return 0;
+	}
+
+	return os_thread_helper_start(&s->pose_history.oth, run_pose_history, s);
+}
+
+void
+ipc_server_pose_history_stop(struct ipc_server *s)
+{
+	if (!s->pose_history.oth.initialized) {
+		return;
+	}
+
+	os_thread_helper_destroy(&s->pose_history.oth);
+}
@@ -28,6 +28,7 @@
 #include "util/u_git_tag.h"
 
 #include "shared/ipc_shmem.h"
+#include "shared/ipc_shared_layout.h"
 #include "server/ipc_server.h"
 
 #include <stdlib.h>
@@ -50,6 +51,20 @@
 
 DEBUG_GET_ONCE_BOOL_OPTION(exit_on_disconnect, "IPC_EXIT_ON_DISCONNECT", false)
 DEBUG_GET_ONCE_LOG_OPTION(ipc_log, "IPC_LOG", U_LOGGING_WARN)
+DEBUG_GET_ONCE_NUM_OPTION(max_clients, "IPC_MAX_CLIENTS", 32)
+DEBUG_GET_ONCE_NUM_OPTION(client_slots, "IPC_CLIENT_SLOTS", 2)
+
+static uint32_t
+clamp_option(long value, uint32_t max)
+{
+	if (value < 1) {
+		return 1;
+	}
+	if (value > (long)max) {
+		return max;
+	}
+	return (uint32_t)value;
+}
 
 
 /*
@@ -82,6 +97,7 @@ init_idev(struct ipc_device *idev, struct xrt_device *xdev)
 	if (xdev != NULL) {
 		idev->io_active = true;
 		idev->xdev = xdev;
+		os_mutex_init(&idev->input_lock);
 	} else {
 		idev->io_active = false;
 	}
@@ -90,6 +106,9 @@ init_idev(struct ipc_device *idev, struct xrt_device *xdev)
 static void
 teardown_idev(struct ipc_device *idev)
 {
+	if (idev->xdev != NULL) {
+		os_mutex_destroy(&idev->input_lock);
+	}
 	idev->io_active = false;
 }
 
@@ -128,6 +147,11 @@ teardown_all(struct ipc_server *s)
 {
 	u_var_remove_root(s);
 
+	ipc_server_pose_history_stop(s);
+
+	// Clients on the reactor hold on to the compositor.
+	ipc_server_reactor_fini(s);
+
 	xrt_syscomp_destroy(&s->xsysc);
 
 	teardown_idevs(s);
@@ -143,7 +167,11 @@ teardown_all(struct ipc_server *s)
 
 	os_mutex_destroy(&s->global_state.lock);
 
-	ipc_shmem_destroy(&s->ism_handle, (void **)&s->ism, sizeof(struct ipc_shared_memory));
+	ipc_shmem_destroy(&s->ism_handle, (void **)&s->ism, s->ism_size);
+
+	free(s->threads);
+	s->threads = NULL;
+	s->thread_count = 0;
 }
 
 static int
@@ -188,7 +216,7 @@ handle_binding(struct ipc_shared_memory *ism,
 	// Copy the initial state and also count the number in input_pairs.
 	uint32_t input_pair_start = input_pair_index;
 	for (size_t k = 0; k < xbp->input_count; k++) {
-		ism->input_pairs[input_pair_index++] = xbp->inputs[k];
+		ipc_shared_memory_input_pairs(ism)[input_pair_index++] = xbp->inputs[k];
 	}
 
 	// Setup the 'offsets' and number of input_pairs.
@@ -200,7 +228,7 @@ handle_binding(struct ipc_shared_memory *ism,
 	// Copy the initial state and also count the number in outputs.
 	uint32_t output_pair_start = output_pair_index;
 	for (size_t k = 0; k < xbp->output_count; k++) {
-		ism->output_pairs[output_pair_index++] = xbp->outputs[k];
+		ipc_shared_memory_output_pairs(ism)[output_pair_index++] = xbp->outputs[k];
 	}
 
 	// Setup the 'offsets' and number of output_pairs.
@@ -213,10 +241,43 @@ handle_binding(struct ipc_shared_memory *ism,
 	*output_pair_index_ptr = output_pair_index;
 }
 
+static void
+count_shared(struct ipc_server *s, struct ipc_shared_counts *counts)
+{
+	U_ZERO(counts);
+
+	for (size_t i = 0; i < XRT_SYSTEM_MAX_DEVICES; i++) {
+		struct xrt_device *xdev = s->idevs[i].xdev;
+		if (xdev == NULL) {
+			continue;
+		}
+
+		counts->inputs += xdev->input_count;
+		counts->outputs += xdev->output_count;
+		counts->binding_profiles += (uint32_t)xdev->binding_profile_count;
+		counts->input_dirty_words += IPC_INPUT_DIRTY_WORD_COUNT(xdev->input_count);
+
+		for (size_t k = 0; k < xdev->binding_profile_count; k++) {
+			counts->input_pairs += (uint32_t)xdev->binding_profiles[k].input_count;
+			counts->output_pairs += (uint32_t)xdev->binding_profiles[k].output_count;
+		}
+	}
+}
+
 static int
 init_shm(struct ipc_server *s)
 {
-	const size_t size = sizeof(struct ipc_shared_memory);
+	// The arrays are sized after the devices we have.
+	struct ipc_shared_counts counts;
+	count_shared(s, &counts);
+
+	struct ipc_shared_layout layout = {0};
+	if (!ipc_shared_layout_init(&layout, &counts)) {
+		IPC_ERROR(s, "Shared memory arrays too large!");
+		return -1;
+	}
+
+	const size_t size = (size_t)layout.size;
 	xrt_shmem_handle_t handle;
 	xrt_result_t result = ipc_shmem_create(size, &handle, (void **)&s->ism);
 	if (result != XRT_SUCCESS) {
@@ -225,6 +286,10 @@ init_shm(struct ipc_server *s)
 
 	// we have a filehandle, we will pass this to our client
 	s->ism_handle = handle;
+	s->ism_size = size;
+
+	IPC_INFO(s, "Shared memory is %zu bytes, %u inputs, %u outputs, %u bindings.", size, counts.inputs,
+	         counts.outputs, counts.binding_profiles);
 
 
 	/*
@@ -236,6 +301,7 @@ init_shm(struct ipc_server *s)
 	uint32_t count = 0;
 	struct ipc_shared_memory *ism = s->ism;
 
+	ism->layout = layout;
 	ism->startup_timestamp = os_monotonic_get_ns();
 
 	// Setup the tracking origins.
@@ -260,6 +326,7 @@ init_shm(struct ipc_server *s)
 
 	count = 0;
 	uint32_t input_index = 0;
+	uint32_t input_dirty_index = 0;
 	uint32_t output_index = 0;
 	uint32_t binding_index = 0;
 	uint32_t input_pair_index = 0;
@@ -319,7 +386,8 @@ init_shm(struct ipc_server *s)
 		// Bindings
 		uint32_t binding_start = binding_index;
 		for (size_t k = 0; k < xdev->binding_profile_count; k++) {
-			handle_binding(ism, &xdev->binding_profiles[k], &ism->binding_profiles[binding_index++],
+			handle_binding(ism, &xdev->binding_profiles[k],
+			               &ipc_shared_memory_binding_profiles(ism)[binding_index++],
 			               &input_pair_index, &output_pair_index);
 		}
 
@@ -332,7 +400,7 @@ init_shm(struct ipc_server *s)
 		// Copy the initial state and also count the number in inputs.
 		uint32_t input_start = input_index;
 		for (size_t k = 0; k < xdev->input_count; k++) {
-			ism->inputs[input_index++] = xdev->inputs[k];
+			ipc_shared_memory_inputs(ism)[input_index++] = xdev->inputs[k];
 		}
 
 		// Setup the 'offsets' and number of inputs.
@@ -341,10 +409,14 @@ init_shm(struct ipc_server *s)
 			isdev->first_input_index = input_start;
 		}
 
+		// Bitmap of the inputs that changed in the last update.
+		isdev->first_input_dirty_index = input_dirty_index;
+		input_dirty_index += IPC_INPUT_DIRTY_WORD_COUNT(isdev->input_count);
+
 		// Copy the initial state and also count the number in outputs.
 		uint32_t output_start = output_index;
 		for (size_t k = 0; k < xdev->output_count; k++) {
-			ism->outputs[output_index++] = xdev->outputs[k];
+			ipc_shared_memory_outputs(ism)[output_index++] = xdev->outputs[k];
 		}
 
 		// Setup the 'offsets' and number of outputs.
@@ -366,12 +438,37 @@ init_shm(struct ipc_server *s)
 	ism->roles.hand_tracking.right = find_xdev_index(s, s->xsysd->roles.hand_tracking.right);
 	ism->roles.eyes = find_xdev_index(s, s->xsysd->roles.eyes);
 
+	// Pose histories for clients to locate from without asking us.
+	ipc_server_pose_history_setup(s);
+
 	// Fill out git version info.
 	snprintf(s->ism->u_git_tag, IPC_VERSION_NAME_LEN, "%s", u_git_tag);
 
 	return 0;
 }
 
+static bool
+create_client_slots(struct ipc_server *s, volatile struct ipc_client_state *ics)
+{
+	const size_t size = ipc_shared_slots_size(s->client_slot_count);
+
+	struct ipc_shared_slots *slots = NULL;
+	xrt_shmem_handle_t handle;
+	xrt_result_t result = ipc_shmem_create(size, &handle, (void **)&slots);
+	if (result != XRT_SUCCESS) {
+		return false;
+	}
+
+	ipc_shared_slots_init(slots, s->client_slot_count);
+
+	ics->slots = slots;
+	ics->slots_handle = handle;
+	ics->slots_size = size;
+	ics->current_slot_index = 0;
+
+	return true;
+}
+
 void
 ipc_server_handle_failure(struct ipc_server *vs)
 {
@@ -395,7 +492,7 @@ ipc_server_handle_client_connected(struct ipc_server *vs, xrt_ipc_handle_t ipc_h
 
 	// find the next free thread in our array (server_thread_index is -1)
 	// and have it handle this connection
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < vs->thread_count; i++) {
 		volatile struct ipc_client_state *_cs = &vs->threads[i].ics;
 		if (_cs->server_thread_index < 0) {
 			ics = _cs;
@@ -440,6 +537,17 @@ ipc_server_handle_client_connected(struct ipc_server *vs, xrt_ipc_handle_t ipc_h
 	// Reset everything.
 	U_ZERO((struct ipc_client_state *)ics);
 
+	if (!create_client_slots(vs, ics)) {
+		xrt_ipc_handle_close(ipc_handle);
+		it->state = IPC_THREAD_READY;
+
+		// Unlock when we are done.
+		os_mutex_unlock(&vs->global_state.lock);
+
+		U_LOG_E("Failed to create shared memory for client!");
+		return;
+	}
+
 	// Set state.
 	ics->client_state.id = id;
 	ics->imc.ipc_handle = ipc_handle;
@@ -447,6 +555,23 @@ ipc_server_handle_client_connected(struct ipc_server *vs, xrt_ipc_handle_t ipc_h
 	ics->server_thread_index = cs_index;
 	ics->io_active = true;
 
+	if (vs->reactor != NULL) {
+		if (ipc_server_reactor_add_client(ics) < 0) {
+			ipc_shmem_destroy((xrt_shmem_handle_t *)&ics->slots_handle, (void **)&ics->slots, ics->slots_size);
+			xrt_ipc_handle_close(ipc_handle);
+			ics->server_thread_index = -1;
+			it->state = IPC_THREAD_READY;
+
+			U_LOG_E("Failed to add client to the reactor!");
+		} else {
+			it->state = IPC_THREAD_RUNNING;
+		}
+
+		// Unlock when we are done.
+		os_mutex_unlock(&vs->global_state.lock);
+		return;
+	}
+
 	os_thread_start(&it->thread, ipc_server_client_thread, (void *)ics);
 
 	// Unlock when we are done.
@@ -478,6 +603,10 @@ init_all(struct ipc_server *s)
 	s->running = true;
 	s->exit_on_disconnect = debug_get_bool_option_exit_on_disconnect();
 	s->log_level = debug_get_log_option_ipc_log();
+	s->client_slot_count = clamp_option(debug_get_num_option_client_slots(), IPC_MAX_CLIENT_SLOTS);
+
+	s->thread_count = clamp_option(debug_get_num_option_max_clients(), IPC_MAX_CLIENTS);
+	s->threads = U_TYPED_ARRAY_CALLOC(struct ipc_thread, s->thread_count);
 
 	xret = xrt_instance_create(NULL, &s->xinst);
 	if (xret != XRT_SUCCESS) {
@@ -521,6 +650,20 @@ init_all(struct ipc_server *s)
 		return ret;
 	}
 
+	ret = ipc_server_reactor_init(s);
+	if (ret < 0) {
+		IPC_ERROR(s, "Failed to init reactor!");
+		teardown_all(s);
+		return ret;
+	}
+
+	ret = ipc_server_pose_history_start(s);
+	if (ret < 0) {
+		IPC_ERROR(s, "Failed to start pose history thread!");
+		teardown_all(s);
+		return ret;
+	}
+
 	u_var_add_root(s, "IPC Server", false);
 	u_var_add_log_level(s, &s->log_level, "Log level");
 	u_var_add_bool(s, &s->exit_on_disconnect, "exit_on_disconnect");
@@ -549,12 +692,12 @@ init_server_state(struct ipc_server *s)
 
 	s->global_state.active_client_index = -1; // we start off with no active client.
 	s->global_state.last_active_client_index = -1;
-	s->current_slot_index = 0;
 
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < s->thread_count; i++) {
 		volatile struct ipc_client_state *ics = &s->threads[i].ics;
 		ics->server = s;
 		ics->server_thread_index = -1;
+		ics->slots_handle = XRT_SHMEM_HANDLE_INVALID;
 	}
 }
 
@@ -632,7 +775,7 @@ handle_focused_client_events(volatile struct ipc_client_state *ics, int active_i
 static void
 flush_state_to_all_clients_locked(struct ipc_server *s)
 {
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < s->thread_count; i++) {
 		volatile struct ipc_client_state *ics = &s->threads[i].ics;
 
 		// Not running?
@@ -677,7 +820,7 @@ update_server_state_locked(struct ipc_server *s)
 	int fallback_active_application = -1;
 
 	// do we have a fallback application?
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < s->thread_count; i++) {
 		volatile struct ipc_client_state *ics = &s->threads[i].ics;
 		if (ics->client_state.session_overlay == false && ics->server_thread_index >= 0 &&
 		    ics->client_state.session_active) {
@@ -689,9 +832,9 @@ update_server_state_locked(struct ipc_server *s)
 	// if our currently-set active primary application is not
 	// actually active/displayable, use the fallback application
 	// instead.
-	volatile struct ipc_client_state *ics = &s->threads[s->global_state.active_client_index].ics;
-	if (!(ics->client_state.session_overlay == false && s->global_state.active_client_index >= 0 &&
-	      ics->client_state.session_active)) {
+	int active_index = s->global_state.active_client_index;
+	if (active_index < 0 || s->threads[active_index].ics.client_state.session_overlay ||
+	    !s->threads[active_index].ics.client_state.session_active) {
 		s->global_state.active_client_index = fallback_active_application;
 	}
 
@@ -716,7 +859,7 @@ find_client_locked(struct ipc_server *s, uint32_t client_id)
 		return NULL;
 	}
 
-	for (uint32_t i = 0; i < IPC_MAX_CLIENTS; i++) {
+	for (uint32_t i = 0; i < s->thread_count; i++) {
 		volatile struct ipc_client_state *ics = &s->threads[i].ics;
 
 		// Is this the client we are looking for?
@@ -0,0 +1,277 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Dispatching of all clients from a single reactor, instead of a thread
+ *         per client.
+ * @ingroup ipc_server
+ */
+
+#include "xrt/xrt_config_os.h"
+
+#include "os/os_time.h"
+#include "util/u_misc.h"
+#include "util/u_debug.h"
+#include "util/u_trace_marker.h"
+
+#include "server/ipc_server.h"
+#include "ipc_server_generated.h"
+
+#include <string.h>
+
+
+/*
+ *
+ * Defines and helpers.
+ *
+ */
+
+DEBUG_GET_ONCE_BOOL_OPTION(reactor, "IPC_REACTOR", false)
+
+#if defined(XRT_OS_LINUX) && !defined(XRT_OS_ANDROID)
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+DEBUG_GET_ONCE_NUM_OPTION(reactor_workers, "IPC_REACTOR_WORKERS", 4)
+
+//! Limited by the worker pool.
+#define MAX_WORKERS 15
+
+static volatile struct ipc_client_state *
+client_from_rc(struct ipc_reactor_client *rc)
+{
+	return container_of(rc, struct ipc_client_state, reactor_client);
+}
+
+static void
+release_client(volatile struct ipc_client_state *ics)
+{
+	struct ipc_server *s = ics->server;
+
+	// Before giving up the client state, it can be reused right after.
+	ipc_server_client_release(ics);
+
+	// Multiple threads might be looking at these fields.
+	os_mutex_lock(&s->global_state.lock);
+
+	ipc_message_channel_close((struct ipc_message_channel *)&ics->imc);
+
+	// No thread to join.
+	s->threads[ics->server_thread_index].state = IPC_THREAD_READY;
+	ics->server_thread_index = -1;
+	memset((void *)&ics->client_state, 0, sizeof(struct ipc_app_state));
+
+	os_mutex_unlock(&s->global_state.lock);
+}
+
+static void
+disconnect_client(volatile struct ipc_client_state *ics)
+{
+	// Cast away volatile.
+	ipc_reactor_remove((struct ipc_reactor_client *)&ics->reactor_client);
+
+	release_client(ics);
+}
+
+static void
+finish_call(volatile struct ipc_client_state *ics, xrt_result_t xret)
+{
+	struct ipc_result_reply reply = {xret};
+
+	xrt_result_t ret = ipc_send((struct ipc_message_channel *)&ics->imc, &reply, sizeof(reply));
+	if (ret != XRT_SUCCESS) {
+		IPC_ERROR(ics->server, "Failed to send reply, disconnecting client.");
+		disconnect_client(ics);
+		return;
+	}
+
+	// Cast away volatile.
+	if (ipc_reactor_rearm((struct ipc_reactor_client *)&ics->reactor_client) < 0) {
+		IPC_ERROR(ics->server, "Failed to rearm client '%i', disconnecting client.", errno);
+		disconnect_client(ics);
+	}
+}
+
+static bool
+parked_wait_image(struct ipc_reactor_client *rc, bool timed_out)
+{
+	volatile struct ipc_client_state *ics = client_from_rc(rc);
+	struct xrt_swapchain *xsc = ics->xscs[ics->parked_wait.id];
+
+	xrt_result_t xret = xrt_swapchain_wait_image(xsc, 0, ics->parked_wait.index);
+	if (xret == XRT_TIMEOUT && !timed_out) {
+		return false;
+	}
+
+	// Like the handler, the result of the wait isn't returned.
+	finish_call(ics, XRT_SUCCESS);
+
+	return true;
+}
+
+/*!
+ * Waiting on an image is the only call that blocks for long, instead of holding
+ * on to a worker it is parked and retried until the image is released.
+ */
+static bool
+try_park_wait_image(volatile struct ipc_client_state *ics, const uint8_t *buf, ssize_t len)
+{
+	const struct ipc_swapchain_wait_image_msg *msg = (const struct ipc_swapchain_wait_image_msg *)buf;
+
+	// Let the handler deal with any errors.
+	if (len < (ssize_t)sizeof(*msg) || ics->xc == NULL || msg->id >= IPC_MAX_CLIENT_SWAPCHAINS ||
+	    ics->xscs[msg->id] == NULL) {
+		return false;
+	}
+
+	struct xrt_swapchain *xsc = ics->xscs[msg->id];
+
+	xrt_result_t xret = xrt_swapchain_wait_image(xsc, 0, msg->index);
+	if (xret != XRT_TIMEOUT) {
+		finish_call(ics, XRT_SUCCESS);
+		return true;
+	}
+
+	uint64_t now_ns = os_monotonic_get_ns();
+	uint64_t deadline_ns = UINT64_MAX;
+
+	// Don't wrap on big or indefinite timeout.
+	if (now_ns <= UINT64_MAX - msg->timeout_ns) {
+		deadline_ns = now_ns + msg->timeout_ns;
+	}
+
+	ics->parked_wait.id = msg->id;
+	ics->parked_wait.index = msg->index;
+
+	// Cast away volatile.
+	ipc_reactor_park((struct ipc_reactor_client *)&ics->reactor_client, deadline_ns, parked_wait_image);
+
+	return true;
+}
+
+static void
+client_ready(struct ipc_reactor_client *rc)
+{
+	volatile struct ipc_client_state *ics = client_from_rc(rc);
+
+	if (rc->hangup) {
+		IPC_INFO(ics->server, "Client disconnected.");
+		disconnect_client(ics);
+		return;
+	}
+
+	uint8_t buf[IPC_BUF_SIZE] = {0};
+
+	ssize_t len = recv(rc->fd, &buf, IPC_BUF_SIZE, 0);
+	if (len < 4) {
+		IPC_ERROR(ics->server, "Invalid packet received, disconnecting client.");
+		disconnect_client(ics);
+		return;
+	}
+
+	// Check the first 4 bytes of the message and dispatch.
+	ipc_command_t *ipc_command = (ipc_command_t *)buf;
+
+	if (*ipc_command == IPC_SWAPCHAIN_WAIT_IMAGE && try_park_wait_image(ics, buf, len)) {
+		return;
+	}
+
+	IPC_TRACE_BEGIN(ipc_dispatch);
+	xrt_result_t result = ipc_dispatch(ics, ipc_command);
+	IPC_TRACE_END(ipc_dispatch);
+
+	if (result != XRT_SUCCESS) {
+		IPC_ERROR(ics->server, "During packet handling, disconnecting client.");
+		disconnect_client(ics);
+		return;
+	}
+
+	if (ipc_reactor_rearm(rc) < 0) {
+		IPC_ERROR(ics->server, "Failed to rearm client '%i', disconnecting client.", errno);
+		disconnect_client(ics);
+	}
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+int
+ipc_server_reactor_init(struct ipc_server *s)
+{
+	if (!debug_get_bool_option_reactor()) {
+		return 0;
+	}
+
+	long workers = debug_get_num_option_reactor_workers();
+	uint32_t worker_count = (uint32_t)(workers < 1 ? 1 : (workers > MAX_WORKERS ? MAX_WORKERS : workers));
+
+	int ret = ipc_reactor_create(worker_count, "IPC Worker", &s->reactor);
+	if (ret < 0) {
+		IPC_ERROR(s, "Failed to create reactor!");
+		return ret;
+	}
+
+	IPC_INFO(s, "Dispatching clients on %u workers.", worker_count);
+
+	return 0;
+}
+
+void
+ipc_server_reactor_fini(struct ipc_server *s)
+{
+	if (s->reactor == NULL) {
+		return;
+	}
+
+	// Waits for the workers, after this nothing else touches the clients.
+	ipc_reactor_destroy(&s->reactor);
+
+	for (uint32_t i = 0; i < s->thread_count; i++) {
+		volatile struct ipc_client_state *ics = &s->threads[i].ics;
+		if (ics->server_thread_index >= 0) {
+			release_client(ics);
+		}
+	}
+}
+
+int
+ipc_server_reactor_add_client(volatile struct ipc_client_state *ics)
+{
+	IPC_INFO(ics->server, "Client %u connected", ics->client_state.id);
+
+	// Cast away volatile.
+	return ipc_reactor_add(ics->server->reactor, (struct ipc_reactor_client *)&ics->reactor_client,
+	                       ics->imc.ipc_handle, client_ready);
+}
+
+#else
+
+int
+ipc_server_reactor_init(struct ipc_server *s)
+{
+	if (debug_get_bool_option_reactor()) {
+		IPC_WARN(s, "The reactor isn't supported on this platform, using a thread per client.");
+	}
+
+	return 0;
+}
+
+void
+ipc_server_reactor_fini(struct ipc_server *s)
+{
+	// Never created.
+}
+
+int
+ipc_server_reactor_add_client(volatile struct ipc_client_state *ics)
+{
+	return -1;
+}
+
+#endif
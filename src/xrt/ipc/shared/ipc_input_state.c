@@ -0,0 +1,241 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Publication of the device inputs in shared memory, only the inputs
+ *         that changed are written by the service and read by clients.
+ * @ingroup ipc_shared
+ */
+
+#include "util/u_misc.h"
+
+#include "shared/ipc_input_state.h"
+
+#include <string.h>
+
+
+//! A reader gives up after this many torn reads, the next read copies again.
+#define READ_ATTEMPTS 16
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static bool
+input_equal(const struct xrt_input *a, const struct xrt_input *b)
+{
+	// Field by field, the padding isn't always copied.
+	return a->active == b->active &&       //
+	       a->timestamp == b->timestamp && //
+	       a->name == b->name &&           //
+	       memcmp(&a->value, &b->value, sizeof(a->value)) == 0;
+}
+
+static inline void
+read_barrier(void)
+{
+#if defined(__GNUC__)
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+	MemoryBarrier();
+#else
+#error "compiler not supported"
+#endif
+}
+
+static inline void
+write_barrier(void)
+{
+#if defined(__GNUC__)
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+	MemoryBarrier();
+#else
+#error "compiler not supported"
+#endif
+}
+
+static uint64_t
+load_generation(const uint64_t *generation)
+{
+	uint64_t value = *(const volatile uint64_t *)generation;
+	read_barrier();
+	return value;
+}
+
+static uint32_t
+copy_newer(struct ipc_shared_memory *ism, uint32_t device_id, struct xrt_input *dst, uint64_t *inout_generation)
+{
+	const struct ipc_shared_device *isdev = &ism->isdevs[device_id];
+	const struct xrt_input *src = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
+	const uint64_t *generations = &ipc_shared_memory_input_generations(ism)[isdev->first_input_index];
+
+	uint64_t since = *inout_generation;
+	uint32_t count = 0;
+
+	for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		uint64_t generation = load_generation(&isdev->input_generation);
+		if ((generation & 1) != 0) {
+			continue;
+		}
+
+		count = 0;
+		for (uint32_t i = 0; i < isdev->input_count; i++) {
+			if (((const volatile uint64_t *)generations)[i] > since) {
+				dst[i] = src[i];
+				count++;
+			}
+		}
+
+		read_barrier();
+		if (load_generation(&isdev->input_generation) == generation) {
+			*inout_generation = generation;
+			return count;
+		}
+	}
+
+	// Torn every time, leaving the generation as is has the next read redo it.
+	return count;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+uint32_t
+ipc_input_state_publish(struct ipc_shared_memory *ism,
+                        uint32_t device_id,
+                        const struct xrt_input *src,
+                        bool io_active)
+{
+	struct ipc_shared_device *isdev = &ism->isdevs[device_id];
+	struct xrt_input *dst = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
+	uint64_t *generations = &ipc_shared_memory_input_generations(ism)[isdev->first_input_index];
+	uint64_t *dirty = &ipc_shared_memory_input_dirty(ism)[isdev->first_input_dirty_index];
+
+	// Only we write it.
+	uint64_t generation = isdev->input_generation;
+	bool writing = false;
+	uint32_t changed = 0;
+
+	// Common case of nothing changed, the changed inputs are copied whole.
+	if (io_active && memcmp(dst, src, sizeof(struct xrt_input) * isdev->input_count) == 0) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < isdev->input_count; i++) {
+		struct xrt_input value;
+		if (io_active) {
+			value = src[i];
+		} else {
+			U_ZERO(&value);
+			value.name = src[i].name;
+
+			// Special case the rotation of the head.
+			if (value.name == XRT_INPUT_GENERIC_HEAD_POSE) {
+				value.active = src[i].active;
+			}
+		}
+
+		if (input_equal(&dst[i], &value)) {
+			continue;
+		}
+
+		// Tell readers the bitmap is about to change.
+		if (!writing) {
+			isdev->input_generation = generation + 1;
+			write_barrier();
+			writing = true;
+		}
+
+		// Padding and all, so the check above works next time.
+		memcpy(&dst[i], io_active ? &src[i] : &value, sizeof(value));
+		generations[i] = generation + 2;
+		changed++;
+	}
+
+	if (!writing) {
+		return 0;
+	}
+
+	// The bitmap describes the last update only.
+	uint32_t word_count = IPC_INPUT_DIRTY_WORD_COUNT(isdev->input_count);
+	for (uint32_t w = 0; w < word_count; w++) {
+		uint64_t bits = 0;
+		for (uint32_t b = 0; b < 64 && w * 64 + b < isdev->input_count; b++) {
+			if (generations[w * 64 + b] == generation + 2) {
+				bits |= 1ull << b;
+			}
+		}
+		dirty[w] = bits;
+	}
+
+	write_barrier();
+	isdev->input_generation = generation + 2;
+
+	return changed;
+}
+
+uint64_t
+ipc_input_state_read_all(struct ipc_shared_memory *ism, uint32_t device_id, struct xrt_input *dst)
+{
+	const struct ipc_shared_device *isdev = &ism->isdevs[device_id];
+	const struct xrt_input *src = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
+
+	// Read before copying, anything written during the copy is newer.
+	uint64_t generation = load_generation(&isdev->input_generation) & ~1ull;
+
+	memcpy(dst, src, sizeof(struct xrt_input) * isdev->input_count);
+
+	return generation;
+}
+
+uint32_t
+ipc_input_state_read(struct ipc_shared_memory *ism,
+                     uint32_t device_id,
+                     struct xrt_input *dst,
+                     uint64_t *inout_generation)
+{
+	const struct ipc_shared_device *isdev = &ism->isdevs[device_id];
+	const struct xrt_input *src = &ipc_shared_memory_inputs(ism)[isdev->first_input_index];
+	const uint64_t *dirty = &ipc_shared_memory_input_dirty(ism)[isdev->first_input_dirty_index];
+
+	uint64_t since = *inout_generation;
+	uint64_t generation = load_generation(&isdev->input_generation);
+
+	if (generation == since) {
+		return 0;
+	}
+
+	// Missed more than the last update, or it's being written.
+	if (generation != since + 2) {
+		return copy_newer(ism, device_id, dst, inout_generation);
+	}
+
+	uint32_t count = 0;
+	uint32_t word_count = IPC_INPUT_DIRTY_WORD_COUNT(isdev->input_count);
+	for (uint32_t w = 0; w < word_count; w++) {
+		uint64_t bits = dirty[w];
+		for (uint32_t b = 0; bits != 0; b++, bits >>= 1) {
+			if ((bits & 1) != 0) {
+				dst[w * 64 + b] = src[w * 64 + b];
+				count++;
+			}
+		}
+	}
+
+	// The bitmap changed under us, fall back to the generations.
+	read_barrier();
+	if (load_generation(&isdev->input_generation) != generation) {
+		return copy_newer(ism, device_id, dst, inout_generation);
+	}
+
+	*inout_generation = generation;
+
+	return count;
+}
@@ -0,0 +1,60 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Publication of the device inputs in shared memory, only the inputs
+ *         that changed are written by the service and read by clients.
+ * @ingroup ipc_shared
+ */
+
+#pragma once
+
+#include "shared/ipc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * Service side, write the inputs of a device that differ from what is in the
+ * shared memory. With @p io_active false the inputs are published as inactive
+ * and zeroed, except for the head pose. Only one thread at a time may publish
+ * the inputs of a device.
+ *
+ * @return Number of inputs that changed.
+ * @ingroup ipc_shared
+ */
+uint32_t
+ipc_input_state_publish(struct ipc_shared_memory *ism,
+                        uint32_t device_id,
+                        const struct xrt_input *src,
+                        bool io_active);
+
+/*!
+ * Client side, copy all of the inputs of a device.
+ *
+ * @return The generation to pass to @ref ipc_input_state_read.
+ * @ingroup ipc_shared
+ */
+uint64_t
+ipc_input_state_read_all(struct ipc_shared_memory *ism, uint32_t device_id, struct xrt_input *dst);
+
+/*!
+ * Client side, copy the inputs of a device that changed since
+ * @p inout_generation, which is updated. Uses the dirty bitmap when only the
+ * last update was missed, else the generations of the inputs.
+ *
+ * @return Number of inputs copied.
+ * @ingroup ipc_shared
+ */
+uint32_t
+ipc_input_state_read(struct ipc_shared_memory *ism,
+                     uint32_t device_id,
+                     struct xrt_input *dst,
+                     uint64_t *inout_generation);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,182 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Pose histories in shared memory, written by the service and read by
+ *         clients to locate poses without a round trip.
+ * @ingroup ipc_shared
+ */
+
+#include "math/m_space.h"
+#include "util/u_time.h"
+
+#include "shared/ipc_pose_history.h"
+
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+//! A reader gives up after this many torn reads and asks the service.
+#define READ_ATTEMPTS 16
+
+static inline void
+read_barrier(void)
+{
+#if defined(__GNUC__)
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+	MemoryBarrier();
+#else
+#error "compiler not supported"
+#endif
+}
+
+static bool
+read_samples(struct ipc_shared_pose_history *iph,
+             uint64_t at_timestamp_ns,
+             uint64_t now_ns,
+             uint64_t max_age_ns,
+             struct ipc_shared_pose_sample *out_a,
+             struct ipc_shared_pose_sample *out_b)
+{
+	for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		int32_t seq = iph->seq;
+		read_barrier();
+		if ((seq & 1) != 0) {
+			continue;
+		}
+
+		bool found = false;
+		uint32_t count = iph->sample_count;
+		uint32_t newest = iph->newest;
+
+		if (count > 0 && count <= IPC_SHARED_POSE_HISTORY_SIZE && newest < IPC_SHARED_POSE_HISTORY_SIZE) {
+			uint64_t newest_ns = iph->samples[newest].timestamp_ns;
+
+			if (newest_ns + max_age_ns < now_ns) {
+				// Stale, but only trust that if the read wasn't torn.
+			} else if (at_timestamp_ns >= newest_ns) {
+				*out_a = iph->samples[newest];
+				*out_b = iph->predicted;
+				found = at_timestamp_ns <= out_b->timestamp_ns;
+			} else {
+				// Walk back from the newest sample.
+				uint32_t later = newest;
+				for (uint32_t i = 1; i < count; i++) {
+					uint32_t index = (newest + IPC_SHARED_POSE_HISTORY_SIZE - i) % IPC_SHARED_POSE_HISTORY_SIZE;
+					if (iph->samples[index].timestamp_ns <= at_timestamp_ns) {
+						*out_a = iph->samples[index];
+						*out_b = iph->samples[later];
+						found = true;
+						break;
+					}
+					later = index;
+				}
+			}
+		}
+
+		read_barrier();
+		if (seq == iph->seq) {
+			return found;
+		}
+	}
+
+	return false;
+}
+
+static void
+interpolate(struct xrt_space_relation *a,
+            struct xrt_space_relation *b,
+            float t,
+            struct xrt_space_relation *out_relation)
+{
+	enum xrt_space_relation_flags flags = a->relation_flags & b->relation_flags;
+	m_space_relation_interpolate(a, b, t, flags, out_relation);
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+struct ipc_shared_pose_history *
+ipc_pose_history_find(struct ipc_shared_memory *ism,
+                      enum ipc_pose_history_type type,
+                      uint32_t device_id,
+                      enum xrt_input_name name)
+{
+	for (uint32_t i = 0; i < ism->poses.history_count; i++) {
+		struct ipc_shared_pose_history *iph = &ism->poses.histories[i];
+		if (iph->type != type) {
+			continue;
+		}
+		if (type == IPC_POSE_HISTORY_TYPE_DEVICE_INPUT &&
+		    (iph->device_id != device_id || (name != 0 && iph->name != name))) {
+			continue;
+		}
+		return iph;
+	}
+
+	return NULL;
+}
+
+void
+ipc_pose_history_push(struct ipc_shared_pose_history *iph,
+                      bool io_active,
+                      const struct ipc_shared_pose_sample *sample,
+                      const struct ipc_shared_pose_sample *predicted)
+{
+	// Odd, readers retry.
+	xrt_atomic_s32_inc_return(&iph->seq);
+
+	uint32_t newest = iph->sample_count == 0 ? 0 : (iph->newest + 1) % IPC_SHARED_POSE_HISTORY_SIZE;
+	iph->samples[newest] = *sample;
+	iph->predicted = *predicted;
+	iph->newest = newest;
+	if (iph->sample_count < IPC_SHARED_POSE_HISTORY_SIZE) {
+		iph->sample_count++;
+	}
+	iph->io_active = io_active;
+
+	// Even again, both increments are full barriers.
+	xrt_atomic_s32_inc_return(&iph->seq);
+}
+
+bool
+ipc_pose_history_locate(struct ipc_shared_pose_history *iph,
+                        uint64_t at_timestamp_ns,
+                        uint64_t now_ns,
+                        uint64_t max_age_ns,
+                        struct xrt_space_relation *out_relation,
+                        struct xrt_space_relation *out_origin)
+{
+	// Lets the service know someone is reading, racy writes are fine. Not
+	// every time, to keep the cache line from bouncing between processes.
+	if (now_ns > iph->last_read_ns + U_TIME_1MS_IN_NS * 100) {
+		iph->last_read_ns = now_ns;
+	}
+
+	struct ipc_shared_pose_sample a;
+	struct ipc_shared_pose_sample b;
+	if (!read_samples(iph, at_timestamp_ns, now_ns, max_age_ns, &a, &b)) {
+		return false;
+	}
+
+	float t = 0.0f;
+	if (b.timestamp_ns > a.timestamp_ns) {
+		t = (float)((double)(at_timestamp_ns - a.timestamp_ns) / (double)(b.timestamp_ns - a.timestamp_ns));
+	}
+
+	interpolate(&a.relation, &b.relation, t, out_relation);
+	if (out_origin != NULL) {
+		interpolate(&a.origin, &b.origin, t, out_origin);
+	}
+
+	return true;
+}
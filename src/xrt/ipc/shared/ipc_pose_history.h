@@ -0,0 +1,85 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Pose histories in shared memory, written by the service and read by
+ *         clients to locate poses without a round trip.
+ * @ingroup ipc_shared
+ */
+
+#pragma once
+
+#include "shared/ipc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * A sample older than this many sampling intervals means the service isn't
+ * sampling the history, clients should ask the service instead.
+ */
+#define IPC_POSE_HISTORY_MAX_AGE_INTERVALS 5
+
+/*!
+ * Find the history of a device pose input or a semantic space, @p device_id
+ * and @p name are only used for @ref IPC_POSE_HISTORY_TYPE_DEVICE_INPUT. A
+ * @p name of zero finds any pose input of the device, for its origin.
+ *
+ * @return NULL if the service doesn't keep such a history.
+ * @ingroup ipc_shared
+ */
+struct ipc_shared_pose_history *
+ipc_pose_history_find(struct ipc_shared_memory *ism,
+                      enum ipc_pose_history_type type,
+                      uint32_t device_id,
+                      enum xrt_input_name name);
+
+/*!
+ * Service side, add a sample and replace the prediction. Only one thread may
+ * write to a history.
+ *
+ * @param iph       History to write to.
+ * @param io_active Is IO of the device active.
+ * @param sample    New newest sample, newer than the previous one.
+ * @param predicted Prediction made at the time of @p sample.
+ *
+ * @ingroup ipc_shared
+ */
+void
+ipc_pose_history_push(struct ipc_shared_pose_history *iph,
+                      bool io_active,
+                      const struct ipc_shared_pose_sample *sample,
+                      const struct ipc_shared_pose_sample *predicted);
+
+/*!
+ * Client side, locate from the history, interpolating between the samples or
+ * between the newest sample and the prediction.
+ *
+ * @param iph             History to read from.
+ * @param at_timestamp_ns Time to locate at.
+ * @param now_ns          Current time, to detect a history that isn't sampled.
+ * @param max_age_ns      How old the newest sample may be.
+ * @param[out] out_relation The pose input in the device's space, or the
+ *                          semantic space in the root space.
+ * @param[out] out_origin   Optional, the device's space in the root space.
+ *
+ * @return False if the history can't answer: it is stale or @p at_timestamp_ns
+ *         is outside of the samples and the prediction. The caller should ask
+ *         the service.
+ *
+ * @ingroup ipc_shared
+ */
+bool
+ipc_pose_history_locate(struct ipc_shared_pose_history *iph,
+                        uint64_t at_timestamp_ns,
+                        uint64_t now_ns,
+                        uint64_t max_age_ns,
+                        struct xrt_space_relation *out_relation,
+                        struct xrt_space_relation *out_origin);
+
+
+#ifdef __cplusplus
+}
+#endif
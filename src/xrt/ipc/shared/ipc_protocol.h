@@ -30,14 +30,20 @@
 #define IPC_MAX_VIEWS 8    // max views we will return configs for
 #define IPC_MAX_FORMATS 32 // max formats our server-side compositor supports
 #define IPC_MAX_DEVICES 8  // max number of devices we will map using shared mem
-#define IPC_MAX_LAYERS 16
-#define IPC_MAX_SLOTS 128
-#define IPC_MAX_CLIENTS 8
+#define IPC_MAX_LAYERS 16 // limited by the multi compositor
+#define IPC_MAX_CLIENT_SLOTS 16
+#define IPC_MAX_CLIENTS 128 // upper bound of the service's IPC_MAX_CLIENTS option
 #define IPC_EVENT_QUEUE_SIZE 32
 
-#define IPC_SHARED_MAX_INPUTS 1024
-#define IPC_SHARED_MAX_OUTPUTS 128
-#define IPC_SHARED_MAX_BINDINGS 64
+#define IPC_BATCH_MAX_MSG_SIZE IPC_BUF_SIZE // the whole batch is one message
+#define IPC_BATCH_MAX_REPLY_SIZE 4096
+#define IPC_BATCH_MAX_CALLS 32
+#define IPC_BATCH_MAX_OUT_ARGS 4 // keep synchronized with ipcproto/common.py
+
+#define IPC_SHARED_LAYOUT_VERSION 2
+#define IPC_SHARED_ARRAY_ALIGNMENT 64
+#define IPC_SHARED_MAX_POSE_HISTORIES 64
+#define IPC_SHARED_POSE_HISTORY_SIZE 16
 
 // example: v21.0.0-560-g586d33b5
 #define IPC_VERSION_NAME_LEN 64
@@ -124,6 +130,19 @@ struct ipc_shared_device
 	//! 'Offset' into the array of outputs where the outputs starts.
 	uint32_t first_output_index;
 
+	/*!
+	 * 'Offset' into the array of dirty bitmap words where the bitmap of the
+	 * inputs starts, @ref IPC_INPUT_DIRTY_WORD_COUNT words long.
+	 */
+	uint32_t first_input_dirty_index;
+
+	/*!
+	 * Odd while the service writes changed inputs, then bumped to the next
+	 * even value. The inputs that changed get that as their generation and
+	 * are set in the dirty bitmap.
+	 */
+	uint64_t input_generation;
+
 	bool orientation_tracking_supported;
 	bool position_tracking_supported;
 	bool hand_tracking_supported;
@@ -132,6 +151,13 @@ struct ipc_shared_device
 	bool form_factor_check_supported;
 };
 
+/*!
+ * Number of 64 bit words in the dirty bitmap of @p input_count inputs.
+ *
+ * @ingroup ipc
+ */
+#define IPC_INPUT_DIRTY_WORD_COUNT(input_count) (((input_count) + 63) / 64)
+
 /*!
  * Data for a single composition layer.
  *
@@ -171,15 +197,128 @@ struct ipc_layer_slot
 };
 
 /*!
- * A big struct that contains all data that is shared to a client, no pointers
- * allowed in this. To get the inputs of a device you go:
+ * What a @ref ipc_shared_pose_history follows.
+ *
+ * @ingroup ipc
+ */
+enum ipc_pose_history_type
+{
+	IPC_POSE_HISTORY_TYPE_NONE,
+	//! A pose input of a device, relation is in the device's space.
+	IPC_POSE_HISTORY_TYPE_DEVICE_INPUT,
+	//! Semantic spaces, relation is in the root space.
+	IPC_POSE_HISTORY_TYPE_VIEW,
+	IPC_POSE_HISTORY_TYPE_LOCAL,
+	IPC_POSE_HISTORY_TYPE_STAGE,
+	IPC_POSE_HISTORY_TYPE_UNBOUNDED,
+};
+
+/*!
+ * A single sample in a @ref ipc_shared_pose_history.
+ *
+ * @ingroup ipc
+ */
+struct ipc_shared_pose_sample
+{
+	uint64_t timestamp_ns;
+
+	//! The pose input in the device's space, or the semantic space in the root space.
+	struct xrt_space_relation relation;
+
+	//! The device's space in the root space, identity for semantic spaces.
+	struct xrt_space_relation origin;
+};
+
+/*!
+ * Recent poses of a device pose input or of a semantic space, sampled by the
+ * service so clients can locate them without a round trip.
+ *
+ * Guarded by a sequence lock: @ref seq is odd while the service writes, a
+ * reader retries if it was odd or has changed once the reader is done.
+ *
+ * @ingroup ipc
+ */
+struct ipc_shared_pose_history
+{
+	enum ipc_pose_history_type type;
+
+	//! For @ref IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, the device and pose input.
+	uint32_t device_id;
+	enum xrt_input_name name;
+
+	/*!
+	 * Written by clients when they read the history, the service only
+	 * samples histories that have been read recently.
+	 */
+	volatile uint64_t last_read_ns;
+
+	xrt_atomic_s32_t seq;
+
+	//! Mirrors ipc_device::io_active of the device.
+	bool io_active;
+
+	//! Index of the newest of @ref sample_count valid samples.
+	uint32_t newest;
+	uint32_t sample_count;
+	struct ipc_shared_pose_sample samples[IPC_SHARED_POSE_HISTORY_SIZE];
+
+	//! Predicted by the device at the time the newest sample was taken.
+	struct ipc_shared_pose_sample predicted;
+};
+
+/*!
+ * Where an array lives in the shared memory, see @ref ipc_shared_layout.
+ *
+ * @ingroup ipc
+ */
+struct ipc_shared_array
+{
+	//! In bytes from the start of the shared memory.
+	uint32_t offset;
+
+	//! Number of elements.
+	uint32_t count;
+};
+
+/*!
+ * The arrays that are sized by the service at startup, from the devices it
+ * has, live after the @ref ipc_shared_memory struct. Clients find them with
+ * this table, use the @ref ipc_shared_memory_inputs and friends accessors.
+ *
+ * @ingroup ipc
+ */
+struct ipc_shared_layout
+{
+	//! @ref IPC_SHARED_LAYOUT_VERSION of the service.
+	uint32_t version;
+
+	//! Size of the whole shared memory, this struct and the arrays.
+	uint64_t size;
+
+	struct ipc_shared_array inputs;
+	struct ipc_shared_array outputs;
+	struct ipc_shared_array binding_profiles;
+	struct ipc_shared_array input_pairs;
+	struct ipc_shared_array output_pairs;
+
+	//! One uint64_t per input, same indices as the inputs.
+	struct ipc_shared_array input_generations;
+
+	//! Dirty bitmap words of the inputs, uint64_t.
+	struct ipc_shared_array input_dirty;
+};
+
+/*!
+ * A big struct that contains all data that is shared to all clients, no
+ * pointers allowed in this. The arrays sized at startup follow it, see
+ * @ref ipc_shared_layout. To get the inputs of a device you go:
  *
  * ```C++
  * struct xrt_input *
  * helper(struct ipc_shared_memory *ism, uint32_t device_id, uint32_t input)
  * {
  * 	uint32_t index = ism->isdevs[device_id]->first_input_index + input;
- * 	return &ism->inputs[index];
+ * 	return &ipc_shared_memory_inputs(ism)[index];
  * }
  * ```
  *
@@ -192,6 +331,11 @@ struct ipc_shared_memory
 	 */
 	char u_git_tag[IPC_VERSION_NAME_LEN];
 
+	/*!
+	 * Where the arrays are, only valid if the version matches.
+	 */
+	struct ipc_shared_layout layout;
+
 	/*!
 	 * Number of elements in @ref itracks that are populated/valid.
 	 */
@@ -261,19 +405,95 @@ struct ipc_shared_memory
 		uint32_t blend_mode_count;
 	} hmd;
 
-	struct xrt_input inputs[IPC_SHARED_MAX_INPUTS];
+	uint64_t startup_timestamp;
+
+	/*!
+	 * Pose histories of devices and semantic spaces, used by clients to
+	 * locate without asking the service.
+	 */
+	struct
+	{
+		//! Time between samples, zero if the service doesn't sample.
+		uint64_t interval_ns;
+
+		uint32_t history_count;
+		struct ipc_shared_pose_history histories[IPC_SHARED_MAX_POSE_HISTORIES];
+	} poses;
+};
+
+/*!
+ * Accessors for the arrays after the @ref ipc_shared_memory struct.
+ *
+ * @ingroup ipc
+ * @{
+ */
+static inline struct xrt_input *
+ipc_shared_memory_inputs(struct ipc_shared_memory *ism)
+{
+	return (struct xrt_input *)((uint8_t *)ism + ism->layout.inputs.offset);
+}
 
-	struct xrt_output outputs[IPC_SHARED_MAX_OUTPUTS];
+static inline struct xrt_output *
+ipc_shared_memory_outputs(struct ipc_shared_memory *ism)
+{
+	return (struct xrt_output *)((uint8_t *)ism + ism->layout.outputs.offset);
+}
 
-	struct ipc_shared_binding_profile binding_profiles[IPC_SHARED_MAX_BINDINGS];
-	struct xrt_binding_input_pair input_pairs[IPC_SHARED_MAX_INPUTS];
-	struct xrt_binding_output_pair output_pairs[IPC_SHARED_MAX_OUTPUTS];
+static inline struct ipc_shared_binding_profile *
+ipc_shared_memory_binding_profiles(struct ipc_shared_memory *ism)
+{
+	return (struct ipc_shared_binding_profile *)((uint8_t *)ism + ism->layout.binding_profiles.offset);
+}
 
-	struct ipc_layer_slot slots[IPC_MAX_SLOTS];
+static inline struct xrt_binding_input_pair *
+ipc_shared_memory_input_pairs(struct ipc_shared_memory *ism)
+{
+	return (struct xrt_binding_input_pair *)((uint8_t *)ism + ism->layout.input_pairs.offset);
+}
 
-	uint64_t startup_timestamp;
+static inline struct xrt_binding_output_pair *
+ipc_shared_memory_output_pairs(struct ipc_shared_memory *ism)
+{
+	return (struct xrt_binding_output_pair *)((uint8_t *)ism + ism->layout.output_pairs.offset);
+}
+
+static inline uint64_t *
+ipc_shared_memory_input_generations(struct ipc_shared_memory *ism)
+{
+	return (uint64_t *)((uint8_t *)ism + ism->layout.input_generations.offset);
+}
+
+static inline uint64_t *
+ipc_shared_memory_input_dirty(struct ipc_shared_memory *ism)
+{
+	return (uint64_t *)((uint8_t *)ism + ism->layout.input_dirty.offset);
+}
+//! @}
+
+/*!
+ * The layer slots of a single client, in shared memory that only it and the
+ * service map. Sized when the client connects, the slots follow this struct.
+ *
+ * @ingroup ipc
+ */
+struct ipc_shared_slots
+{
+	//! @ref IPC_SHARED_LAYOUT_VERSION of the service.
+	uint32_t version;
+
+	//! Number of slots, slot ids go from zero to this.
+	uint32_t slot_count;
+
+	//! Size of the whole shared memory, this struct and the slots.
+	uint64_t size;
 };
 
+static inline struct ipc_layer_slot *
+ipc_shared_slots_get(struct ipc_shared_slots *iss, uint32_t slot_id)
+{
+	return (struct ipc_layer_slot *)(iss + 1) + slot_id;
+}
+
 /*!
  * Initial info from a client when it connects.
  */
@@ -0,0 +1,405 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  A single epoll loop that runs the handling of ready sockets on a
+ *         worker pool, instead of a thread per client.
+ * @ingroup ipc_shared
+ */
+
+#include "os/os_time.h"
+#include "os/os_threading.h"
+#include "util/u_misc.h"
+#include "util/u_worker.h"
+#include "util/u_logging.h"
+#include "util/u_trace_marker.h"
+
+#include "shared/ipc_reactor.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+/*
+ *
+ * Structs and defines.
+ *
+ */
+
+#define MAX_EVENTS 32
+
+//! How long the reactor sleeps with nothing parked, only to check for stop.
+#define IDLE_TIMEOUT_MS 100
+
+//! How often parked calls are retried.
+#define PARKED_TIMEOUT_MS 1
+
+/*!
+ * Tasks pushed to the pool and not yet finished, kept below the task array of
+ * the worker pool so that pushing never waits on the reactor thread.
+ */
+#define MAX_TASKS_IN_FLIGHT 48
+
+struct ipc_reactor
+{
+	int epoll_fd;
+
+	//! Wakes the reactor thread when a call is parked or a task slot frees up.
+	int event_fd;
+
+	struct os_thread_helper oth;
+
+	struct u_worker_thread_pool *pool;
+	struct u_worker_group *group;
+
+	struct
+	{
+		struct os_mutex mutex;
+		struct ipc_reactor_client *first;
+	} parked;
+
+	struct
+	{
+		struct os_mutex mutex;
+
+		//! Pushed to the pool and not yet finished.
+		uint32_t in_flight;
+
+		//! The reactor thread has clients queued for a free slot.
+		bool waiting;
+	} tasks;
+
+	//! Ready clients not yet pushed to the pool, only used by the reactor thread.
+	struct
+	{
+		struct ipc_reactor_client *first;
+		struct ipc_reactor_client *last;
+	} ready;
+};
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static void
+add_parked(struct ipc_reactor *r, struct ipc_reactor_client *rc)
+{
+	os_mutex_lock(&r->parked.mutex);
+	rc->next_parked = r->parked.first;
+	r->parked.first = rc;
+	os_mutex_unlock(&r->parked.mutex);
+}
+
+static void
+wake(struct ipc_reactor *r)
+{
+	uint64_t value = 1;
+	(void)!write(r->event_fd, &value, sizeof(value));
+}
+
+static bool
+try_reserve_task(struct ipc_reactor *r)
+{
+	os_mutex_lock(&r->tasks.mutex);
+	bool reserved = r->tasks.in_flight < MAX_TASKS_IN_FLIGHT;
+	if (reserved) {
+		r->tasks.in_flight++;
+	} else {
+		r->tasks.waiting = true;
+	}
+	os_mutex_unlock(&r->tasks.mutex);
+
+	return reserved;
+}
+
+static void
+release_task(struct ipc_reactor *r)
+{
+	os_mutex_lock(&r->tasks.mutex);
+	r->tasks.in_flight--;
+	bool waiting = r->tasks.waiting;
+	r->tasks.waiting = false;
+	os_mutex_unlock(&r->tasks.mutex);
+
+	if (waiting) {
+		wake(r);
+	}
+}
+
+static void
+ready_task(void *ptr)
+{
+	struct ipc_reactor_client *rc = (struct ipc_reactor_client *)ptr;
+	struct ipc_reactor *r = rc->reactor;
+
+	// The client may be gone once this returns.
+	rc->ready_func(rc);
+
+	release_task(r);
+}
+
+static void
+parked_task(void *ptr)
+{
+	struct ipc_reactor_client *rc = (struct ipc_reactor_client *)ptr;
+	struct ipc_reactor *r = rc->reactor;
+
+	ipc_reactor_parked_func_t func = rc->parked_func;
+	bool timed_out = os_monotonic_get_ns() >= rc->parked_deadline_ns;
+
+	if (!func(rc, timed_out)) {
+		// Retried by the reactor timeout, don't wake it up for this.
+		add_parked(r, rc);
+	}
+
+	release_task(r);
+}
+
+static void
+queue_ready(struct ipc_reactor *r, struct ipc_reactor_client *rc)
+{
+	rc->next_ready = NULL;
+	if (r->ready.last != NULL) {
+		r->ready.last->next_ready = rc;
+	} else {
+		r->ready.first = rc;
+	}
+	r->ready.last = rc;
+}
+
+static void
+push_ready(struct ipc_reactor *r)
+{
+	while (r->ready.first != NULL && try_reserve_task(r)) {
+		struct ipc_reactor_client *rc = r->ready.first;
+		r->ready.first = rc->next_ready;
+		if (r->ready.first == NULL) {
+			r->ready.last = NULL;
+		}
+		rc->next_ready = NULL;
+
+		u_worker_group_push(r->group, ready_task, rc);
+	}
+}
+
+static bool
+push_parked(struct ipc_reactor *r)
+{
+	os_mutex_lock(&r->parked.mutex);
+	struct ipc_reactor_client *rc = r->parked.first;
+	r->parked.first = NULL;
+	os_mutex_unlock(&r->parked.mutex);
+
+	bool any = rc != NULL;
+
+	while (rc != NULL) {
+		struct ipc_reactor_client *next = rc->next_parked;
+		rc->next_parked = NULL;
+
+		// No free slot, stays parked until the next retry.
+		if (try_reserve_task(r)) {
+			u_worker_group_push(r->group, parked_task, rc);
+		} else {
+			add_parked(r, rc);
+		}
+
+		rc = next;
+	}
+
+	return any;
+}
+
+static void *
+run_reactor(void *ptr)
+{
+	U_TRACE_SET_THREAD_NAME("IPC Reactor");
+
+	struct ipc_reactor *r = (struct ipc_reactor *)ptr;
+	struct epoll_event events[MAX_EVENTS];
+
+	while (os_thread_helper_is_running(&r->oth)) {
+		// Anything left queued is pushed once a finished task wakes us.
+		push_ready(r);
+		bool any_parked = push_parked(r);
+
+		int timeout_ms = any_parked ? PARKED_TIMEOUT_MS : IDLE_TIMEOUT_MS;
+		int count = epoll_wait(r->epoll_fd, events, MAX_EVENTS, timeout_ms);
+		if (count < 0 && errno != EINTR) {
+			U_LOG_E("epoll_wait failed with '%i'.", errno);
+			break;
+		}
+
+		uint64_t now_ns = os_monotonic_get_ns();
+
+		for (int i = 0; i < count; i++) {
+			struct ipc_reactor_client *rc = (struct ipc_reactor_client *)events[i].data.ptr;
+
+			// Somebody parked a call or a task slot freed up.
+			if (rc == NULL) {
+				uint64_t value;
+				(void)!read(r->event_fd, &value, sizeof(value));
+				continue;
+			}
+
+			rc->hangup = (events[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+			rc->ready_ns = now_ns;
+
+			// Pushed at the top of the loop, never waits here on a full pool.
+			queue_ready(r, rc);
+		}
+	}
+
+	return NULL;
+}
+
+static int
+ctl(struct ipc_reactor_client *rc, int op)
+{
+	struct epoll_event ev = {0};
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = rc;
+
+	return epoll_ctl(rc->reactor->epoll_fd, op, rc->fd, &ev);
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+int
+ipc_reactor_create(uint32_t worker_count, const char *prefix, struct ipc_reactor **out_r)
+{
+	struct ipc_reactor *r = U_TYPED_CALLOC(struct ipc_reactor);
+	r->epoll_fd = -1;
+	r->event_fd = -1;
+
+	int ret = os_mutex_init(&r->parked.mutex);
+	if (ret < 0) {
+		free(r);
+		return ret;
+	}
+
+	ret = os_mutex_init(&r->tasks.mutex);
+	if (ret < 0) {
+		os_mutex_destroy(&r->parked.mutex);
+		free(r);
+		return ret;
+	}
+
+	ret = os_thread_helper_init(&r->oth);
+	if (ret < 0) {
+		os_mutex_destroy(&r->tasks.mutex);
+		os_mutex_destroy(&r->parked.mutex);
+		free(r);
+		return ret;
+	}
+
+	r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	r->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (r->epoll_fd < 0 || r->event_fd < 0) {
+		ipc_reactor_destroy(&r);
+		return -1;
+	}
+
+	struct epoll_event ev = {0};
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	ret = epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->event_fd, &ev);
+	if (ret < 0) {
+		ipc_reactor_destroy(&r);
+		return ret;
+	}
+
+	// One extra for the thread waiting on the group when destroying.
+	r->pool = u_worker_thread_pool_create(worker_count, worker_count + 1, prefix);
+	if (r->pool == NULL) {
+		ipc_reactor_destroy(&r);
+		return -1;
+	}
+	r->group = u_worker_group_create(r->pool);
+
+	ret = os_thread_helper_start(&r->oth, run_reactor, r);
+	if (ret < 0) {
+		ipc_reactor_destroy(&r);
+		return ret;
+	}
+
+	*out_r = r;
+
+	return 0;
+}
+
+void
+ipc_reactor_destroy(struct ipc_reactor **r_ptr)
+{
+	struct ipc_reactor *r = *r_ptr;
+	if (r == NULL) {
+		return;
+	}
+
+	// Stops the thread within the idle timeout, then nothing new is pushed.
+	os_thread_helper_destroy(&r->oth);
+
+	if (r->group != NULL) {
+		u_worker_group_wait_all(r->group);
+	}
+	u_worker_group_reference(&r->group, NULL);
+	u_worker_thread_pool_reference(&r->pool, NULL);
+
+	if (r->event_fd >= 0) {
+		close(r->event_fd);
+	}
+	if (r->epoll_fd >= 0) {
+		close(r->epoll_fd);
+	}
+
+	os_mutex_destroy(&r->tasks.mutex);
+	os_mutex_destroy(&r->parked.mutex);
+
+	free(r);
+	*r_ptr = NULL;
+}
+
+int
+ipc_reactor_add(struct ipc_reactor *r, struct ipc_reactor_client *rc, int fd, ipc_reactor_ready_func_t ready_func)
+{
+	U_ZERO(rc);
+	rc->reactor = r;
+	rc->fd = fd;
+	rc->ready_func = ready_func;
+
+	return ctl(rc, EPOLL_CTL_ADD);
+}
+
+int
+ipc_reactor_rearm(struct ipc_reactor_client *rc)
+{
+	return ctl(rc, EPOLL_CTL_MOD);
+}
+
+void
+ipc_reactor_remove(struct ipc_reactor_client *rc)
+{
+	epoll_ctl(rc->reactor->epoll_fd, EPOLL_CTL_DEL, rc->fd, NULL);
+}
+
+void
+ipc_reactor_park(struct ipc_reactor_client *rc, uint64_t deadline_ns, ipc_reactor_parked_func_t func)
+{
+	struct ipc_reactor *r = rc->reactor;
+
+	rc->parked_func = func;
+	rc->parked_deadline_ns = deadline_ns;
+	add_parked(r, rc);
+
+	// The reactor may be sleeping for longer than the retry interval.
+	wake(r);
+}
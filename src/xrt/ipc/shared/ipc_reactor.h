@@ -0,0 +1,128 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  A single epoll loop that runs the handling of ready sockets on a
+ *         worker pool, instead of a thread per client.
+ * @ingroup ipc_shared
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ipc_reactor;
+struct ipc_reactor_client;
+
+/*!
+ * Called on a worker when the socket of @p rc is readable or has hung up. The
+ * socket isn't polled again until @ref ipc_reactor_rearm is called, so only one
+ * worker at a time handles a client.
+ *
+ * @ingroup ipc_shared
+ */
+typedef void (*ipc_reactor_ready_func_t)(struct ipc_reactor_client *rc);
+
+/*!
+ * Called on a worker to try to finish a call that was parked with
+ * @ref ipc_reactor_park. Returns false to stay parked, which it must not do
+ * once @p timed_out is set.
+ *
+ * @ingroup ipc_shared
+ */
+typedef bool (*ipc_reactor_parked_func_t)(struct ipc_reactor_client *rc, bool timed_out);
+
+/*!
+ * A socket watched by the reactor, embedded by the user of the reactor.
+ *
+ * @ingroup ipc_shared
+ */
+struct ipc_reactor_client
+{
+	struct ipc_reactor *reactor;
+	int fd;
+
+	ipc_reactor_ready_func_t ready_func;
+
+	//! The socket has hung up or errored, set before the ready function is called.
+	bool hangup;
+
+	//! When the reactor saw the socket become ready.
+	uint64_t ready_ns;
+
+	//! Set while parked.
+	ipc_reactor_parked_func_t parked_func;
+	uint64_t parked_deadline_ns;
+	struct ipc_reactor_client *next_parked;
+
+	//! Set while queued on the reactor thread for a free worker slot.
+	struct ipc_reactor_client *next_ready;
+};
+
+/*!
+ * Create the reactor and start its thread.
+ *
+ * @param worker_count Number of threads that run the ready functions, at most
+ *                     15 as limited by the worker pool.
+ * @param prefix       For naming the threads.
+ * @param[out] out_r   The created reactor.
+ *
+ * @ingroup ipc_shared
+ */
+int
+ipc_reactor_create(uint32_t worker_count, const char *prefix, struct ipc_reactor **out_r);
+
+/*!
+ * Stop the reactor thread and wait for all running functions, sockets still
+ * added are left open.
+ *
+ * @ingroup ipc_shared
+ */
+void
+ipc_reactor_destroy(struct ipc_reactor **r_ptr);
+
+/*!
+ * Start watching @p fd, the ready function is called when it's readable.
+ *
+ * @ingroup ipc_shared
+ */
+int
+ipc_reactor_add(struct ipc_reactor *r, struct ipc_reactor_client *rc, int fd, ipc_reactor_ready_func_t ready_func);
+
+/*!
+ * Watch the socket again, called once the ready function has handled it.
+ *
+ * @ingroup ipc_shared
+ */
+int
+ipc_reactor_rearm(struct ipc_reactor_client *rc);
+
+/*!
+ * Stop watching the socket, called before it is closed.
+ *
+ * @ingroup ipc_shared
+ */
+void
+ipc_reactor_remove(struct ipc_reactor_client *rc);
+
+/*!
+ * From a ready function, finish a call that would block later instead of
+ * holding on to the worker. @p func is called on a worker until it returns
+ * true, which it must do once @p deadline_ns has passed. It should then reply
+ * and call @ref ipc_reactor_rearm.
+ *
+ * @ingroup ipc_shared
+ */
+void
+ipc_reactor_park(struct ipc_reactor_client *rc, uint64_t deadline_ns, ipc_reactor_parked_func_t func);
+
+
+#ifdef __cplusplus
+}
+#endif
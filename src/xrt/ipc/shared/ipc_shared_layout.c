@@ -0,0 +1,159 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Layout of the shared memory, the arrays sized by the service at
+ *         startup and the per client layer slots.
+ * @ingroup ipc_shared
+ */
+
+#include "shared/ipc_shared_layout.h"
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static uint64_t
+align(uint64_t value)
+{
+	return (value + IPC_SHARED_ARRAY_ALIGNMENT - 1) & ~(uint64_t)(IPC_SHARED_ARRAY_ALIGNMENT - 1);
+}
+
+static uint64_t
+place(struct ipc_shared_array *array, uint64_t offset, uint32_t count, size_t element_size)
+{
+	offset = align(offset);
+	array->offset = (uint32_t)offset;
+	array->count = count;
+
+	return offset + (uint64_t)count * element_size;
+}
+
+static bool
+array_valid(const struct ipc_shared_array *array, size_t element_size, size_t size)
+{
+	if (array->offset < sizeof(struct ipc_shared_memory) || array->offset % IPC_SHARED_ARRAY_ALIGNMENT != 0) {
+		return false;
+	}
+
+	return (uint64_t)array->offset + (uint64_t)array->count * element_size <= size;
+}
+
+static bool
+range_valid(uint32_t first, uint32_t count, const struct ipc_shared_array *array)
+{
+	return count == 0 || ((uint64_t)first + count <= array->count);
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+bool
+ipc_shared_layout_init(struct ipc_shared_layout *layout, const struct ipc_shared_counts *counts)
+{
+	uint64_t offset = sizeof(struct ipc_shared_memory);
+	offset = place(&layout->inputs, offset, counts->inputs, sizeof(struct xrt_input));
+	offset = place(&layout->outputs, offset, counts->outputs, sizeof(struct xrt_output));
+	offset = place(&layout->binding_profiles, offset, counts->binding_profiles,
+	               sizeof(struct ipc_shared_binding_profile));
+	offset = place(&layout->input_pairs, offset, counts->input_pairs, sizeof(struct xrt_binding_input_pair));
+	offset = place(&layout->output_pairs, offset, counts->output_pairs, sizeof(struct xrt_binding_output_pair));
+	offset = place(&layout->input_generations, offset, counts->inputs, sizeof(uint64_t));
+	offset = place(&layout->input_dirty, offset, counts->input_dirty_words, sizeof(uint64_t));
+
+	layout->version = IPC_SHARED_LAYOUT_VERSION;
+	layout->size = align(offset);
+
+	return layout->size <= UINT32_MAX;
+}
+
+bool
+ipc_shared_layout_validate(const struct ipc_shared_memory *ism, size_t size)
+{
+	if (size < sizeof(struct ipc_shared_memory)) {
+		return false;
+	}
+
+	const struct ipc_shared_layout *layout = &ism->layout;
+	if (layout->version != IPC_SHARED_LAYOUT_VERSION || layout->size != size) {
+		return false;
+	}
+
+	if (!array_valid(&layout->inputs, sizeof(struct xrt_input), size) ||
+	    !array_valid(&layout->outputs, sizeof(struct xrt_output), size) ||
+	    !array_valid(&layout->binding_profiles, sizeof(struct ipc_shared_binding_profile), size) ||
+	    !array_valid(&layout->input_pairs, sizeof(struct xrt_binding_input_pair), size) ||
+	    !array_valid(&layout->output_pairs, sizeof(struct xrt_binding_output_pair), size) ||
+	    !array_valid(&layout->input_generations, sizeof(uint64_t), size) ||
+	    !array_valid(&layout->input_dirty, sizeof(uint64_t), size)) {
+		return false;
+	}
+
+	if (layout->input_generations.count != layout->inputs.count) {
+		return false;
+	}
+
+	if (ism->isdev_count > XRT_SYSTEM_MAX_DEVICES) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < ism->isdev_count; i++) {
+		const struct ipc_shared_device *isdev = &ism->isdevs[i];
+		if (!range_valid(isdev->first_input_index, isdev->input_count, &layout->inputs) ||
+		    !range_valid(isdev->first_output_index, isdev->output_count, &layout->outputs) ||
+		    !range_valid(isdev->first_binding_profile_index, isdev->binding_profile_count,
+		                 &layout->binding_profiles) ||
+		    !range_valid(isdev->first_input_dirty_index, IPC_INPUT_DIRTY_WORD_COUNT(isdev->input_count),
+		                 &layout->input_dirty)) {
+			return false;
+		}
+	}
+
+	const struct ipc_shared_binding_profile *isbps =
+	    (const struct ipc_shared_binding_profile *)((const uint8_t *)ism + layout->binding_profiles.offset);
+
+	for (uint32_t i = 0; i < layout->binding_profiles.count; i++) {
+		const struct ipc_shared_binding_profile *isbp = &isbps[i];
+		if (!range_valid(isbp->first_input_index, isbp->input_count, &layout->input_pairs) ||
+		    !range_valid(isbp->first_output_index, isbp->output_count, &layout->output_pairs)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t
+ipc_shared_slots_size(uint32_t slot_count)
+{
+	return sizeof(struct ipc_shared_slots) + (size_t)slot_count * sizeof(struct ipc_layer_slot);
+}
+
+void
+ipc_shared_slots_init(struct ipc_shared_slots *iss, uint32_t slot_count)
+{
+	iss->version = IPC_SHARED_LAYOUT_VERSION;
+	iss->slot_count = slot_count;
+	iss->size = ipc_shared_slots_size(slot_count);
+}
+
+bool
+ipc_shared_slots_validate(const struct ipc_shared_slots *iss, size_t size)
+{
+	if (size < sizeof(struct ipc_shared_slots)) {
+		return false;
+	}
+
+	return iss->version == IPC_SHARED_LAYOUT_VERSION && //
+	       iss->slot_count > 0 &&                        //
+	       iss->slot_count <= IPC_MAX_CLIENT_SLOTS &&    //
+	       iss->size == size &&                          //
+	       ipc_shared_slots_size(iss->slot_count) == size;
+}
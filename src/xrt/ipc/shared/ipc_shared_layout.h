@@ -0,0 +1,84 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Layout of the shared memory, the arrays sized by the service at
+ *         startup and the per client layer slots.
+ * @ingroup ipc_shared
+ */
+
+#pragma once
+
+#include "shared/ipc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!
+ * Number of elements of the arrays after the @ref ipc_shared_memory struct.
+ *
+ * @ingroup ipc_shared
+ */
+struct ipc_shared_counts
+{
+	uint32_t inputs;
+	uint32_t outputs;
+	uint32_t binding_profiles;
+	uint32_t input_pairs;
+	uint32_t output_pairs;
+
+	//! Words of all of the devices' dirty input bitmaps.
+	uint32_t input_dirty_words;
+};
+
+/*!
+ * Service side, place the arrays after the @ref ipc_shared_memory struct.
+ *
+ * @return False if the arrays don't fit the offsets.
+ * @ingroup ipc_shared
+ */
+bool
+ipc_shared_layout_init(struct ipc_shared_layout *layout, const struct ipc_shared_counts *counts);
+
+/*!
+ * Client side, check the layout and that all devices and bindings index
+ * within the arrays, before anything is read from them.
+ *
+ * @param ism  Shared memory as mapped.
+ * @param size Size of the mapping.
+ *
+ * @ingroup ipc_shared
+ */
+bool
+ipc_shared_layout_validate(const struct ipc_shared_memory *ism, size_t size);
+
+/*!
+ * Size of the shared memory of a client's @p slot_count layer slots.
+ *
+ * @ingroup ipc_shared
+ */
+size_t
+ipc_shared_slots_size(uint32_t slot_count);
+
+/*!
+ * Service side, set up the header of a freshly created slots region.
+ *
+ * @ingroup ipc_shared
+ */
+void
+ipc_shared_slots_init(struct ipc_shared_slots *iss, uint32_t slot_count);
+
+/*!
+ * Client side, check the header against the size of the mapping.
+ *
+ * @ingroup ipc_shared
+ */
+bool
+ipc_shared_slots_validate(const struct ipc_shared_slots *iss, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,6 +10,7 @@
  */
 
 #include <xrt/xrt_config_os.h>
+#include <xrt/xrt_compiler.h>
 
 #include "shared/ipc_shmem.h"
 
@@ -24,6 +25,8 @@
 // non-android unix
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
 #endif
 
 #if defined(XRT_OS_ANDROID)
@@ -52,16 +55,44 @@ ipc_shmem_create(size_t size, xrt_shmem_handle_t *out_handle, void **out_map)
 #elif defined(XRT_OS_UNIX)
 
 #define MONADO_SHMEM_NAME "/monado_shm"
+#define MONADO_SHMEM_NAME_ATTEMPTS 16
+
+/*!
+ * The service creates one region per client, so the names need to be unique,
+ * they only live until the region is created and unlinked.
+ */
+static int
+open_unique(char *name, size_t name_size)
+{
+	static xrt_atomic_s32_t counter;
+
+	for (int i = 0; i < MONADO_SHMEM_NAME_ATTEMPTS; i++) {
+		snprintf(name, name_size, "%s_%i_%i", MONADO_SHMEM_NAME, (int)getpid(),
+		         (int)xrt_atomic_s32_inc_return(&counter));
+
+		int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd >= 0 || errno != EEXIST) {
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
 // Impl for non-Android Unix.
 xrt_result_t
 ipc_shmem_create(size_t size, xrt_shmem_handle_t *out_handle, void **out_map)
 {
 	*out_handle = -1;
-	int fd = shm_open(MONADO_SHMEM_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	char name[64];
+	int fd = open_unique(name, sizeof(name));
 	if (fd < 0) {
 		return XRT_ERROR_IPC_FAILURE;
 	}
 
+	// Don't need the name entry anymore, we can share the FD.
+	shm_unlink(name);
+
 	if (ftruncate(fd, size) < 0) {
 		close(fd);
 		return XRT_ERROR_IPC_FAILURE;
@@ -72,8 +103,6 @@ ipc_shmem_create(size_t size, xrt_shmem_handle_t *out_handle, void **out_map)
 		return result;
 	}
 
-	// Don't need the name entry anymore, we can share the FD.
-	shm_unlink(MONADO_SHMEM_NAME);
 	*out_handle = fd;
 	return XRT_SUCCESS;
 }
@@ -130,7 +159,7 @@ ipc_shmem_map(xrt_shmem_handle_t handle, size_t size, void **out_map)
 	const int access = PROT_READ | PROT_WRITE;
 	const int flags = MAP_SHARED;
 	void *ptr = mmap(NULL, size, access, flags, handle, 0);
-	if (ptr == NULL) {
+	if (ptr == MAP_FAILED) {
 		return XRT_ERROR_IPC_FAILURE;
 	}
 	*out_map = ptr;
@@ -190,6 +190,9 @@ class HandleType:
 class Call:
     """A single IPC call."""
 
+    # Keep synchronized with IPC_BATCH_MAX_OUT_ARGS in ipc_protocol.h.
+    BATCH_MAX_OUT_ARGS = 4
+
     def dump(self):
         """Dump human-readable output to standard out."""
         print("Call " + self.name)
@@ -213,6 +216,14 @@ class Call:
             args.extend(self.out_handles.arg_decls)
         write_decl(f, 'xrt_result_t', 'ipc_call_' + self.name, args)
 
+    def write_batch_decl(self, f):
+        """Write declaration of ipc_batch_CALLNAME."""
+        args = ["struct ipc_connection *ipc_c"]
+        args.extend(arg.get_func_argument_in() for arg in self.in_args)
+        args.extend(arg.get_func_argument_out() for arg in self.out_args)
+        args.append("xrt_result_t *out_result")
+        write_decl(f, 'xrt_result_t', 'ipc_batch_' + self.name, args)
+
     def write_handler_decl(self, f):
         """Write declaration of ipc_handle_CALLNAME."""
         args = ["volatile struct ipc_client_state *ics"]
@@ -229,6 +240,20 @@ class Call:
         """Decide whether this call needs a msg struct."""
         return self.in_args or self.in_handles
 
+    @property
+    def msg_struct(self):
+        """Get the type of the msg struct of this call."""
+        if self.needs_msg_struct:
+            return "struct ipc_" + self.name + "_msg"
+        return "struct ipc_command_msg"
+
+    @property
+    def reply_struct(self):
+        """Get the type of the reply struct of this call."""
+        if self.out_args:
+            return "struct ipc_" + self.name + "_reply"
+        return "struct ipc_result_reply"
+
     def __init__(self, name, data):
         """Construct a call from call name and call data dictionary."""
         self.id = None
@@ -237,6 +262,7 @@ class Call:
         self.out_args = []
         self.in_handles = None
         self.out_handles = None
+        self.batchable = False
         for key, val in data.items():
             if key == 'id':
                 self.id = val
@@ -248,10 +274,16 @@ class Call:
                 self.out_handles = HandleType(val)
             elif key == 'in_handles':
                 self.in_handles = HandleType(val)
+            elif key == 'batchable':
+                self.batchable = val
             else:
                 raise RuntimeError("Unrecognized key")
         if not self.id:
             self.id = "IPC_" + name.upper()
+        if self.batchable and (self.in_handles or self.out_handles):
+            raise RuntimeError("Calls with handles can't be batched: " + name)
+        if self.batchable and len(self.out_args) > self.BATCH_MAX_OUT_ARGS:
+            raise RuntimeError("Too many out args to batch: " + name)
 
 
 class Proto:
@@ -278,3 +310,8 @@ class Proto:
         self.calls = [Call(name, call) for name, call
                       in data.items()
                       if not name.startswith("$")]
+
+    @property
+    def batchable_calls(self):
+        """Get the calls that may be sent in a batch."""
+        return [call for call in self.calls if call.batchable]
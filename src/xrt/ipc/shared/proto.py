@@ -6,7 +6,8 @@
 import argparse
 
 from ipcproto.common import (Proto, write_decl, write_invocation,
-                             write_result_handler, write_cpp_header_guard_start,
+                             write_with_wrapped_args, write_result_handler,
+                             write_cpp_header_guard_start,
                              write_cpp_header_guard_end)
 
 header = '''// Copyright 2020, Collabora, Ltd.
@@ -38,7 +39,8 @@ struct ipc_connection;
     f.write('''
 typedef enum ipc_command
 {
-\tIPC_ERR = 0,''')
+\tIPC_ERR = 0,
+\tIPC_BATCH,''')
     for call in p.calls:
         f.write("\n\t" + call.id + ",")
     f.write("\n} ipc_command_t;\n")
@@ -54,6 +56,18 @@ struct ipc_result_reply
 \txrt_result_t result;
 };
 
+/*!
+ * Header of a batch of calls, followed by the msg structs of the calls. The
+ * service replies with the reply structs of all of the calls, in order.
+ */
+struct ipc_batch_msg
+{
+\tenum ipc_command cmd;
+\tuint32_t call_count;
+\t//! Size of the whole message, including this header.
+\tuint32_t size;
+};
+
 ''')
 
     f.write('''
@@ -61,7 +75,8 @@ static inline const char *
 ipc_cmd_to_str(ipc_command_t id)
 {
 \tswitch (id) {
-\tcase IPC_ERR: return "IPC_ERR";''')
+\tcase IPC_ERR: return "IPC_ERR";
+\tcase IPC_BATCH: return "IPC_BATCH";''')
     for call in p.calls:
         f.write("\n\tcase " + call.id + ": return \"" + call.id + "\";")
     f.write("\n\tdefault: return \"IPC_UNKNOWN\";")
@@ -92,9 +107,79 @@ ipc_cmd_to_str(ipc_command_t id)
 
     f.write("#pragma pack (pop)\n")
 
+    f.write('''
+/*!
+ * Size of the msg struct of a call that may be batched, zero for other calls.
+ */
+static inline size_t
+ipc_batch_msg_size(ipc_command_t id)
+{
+\tswitch (id) {''')
+    for call in p.batchable_calls:
+        f.write("\n\tcase %s: return sizeof(%s);" % (call.id, call.msg_struct))
+    f.write("\n\tdefault: return 0;")
+    f.write("\n\t}\n}\n")
+
+    f.write('''
+/*!
+ * Size of the reply struct of a call that may be batched, zero for other calls.
+ */
+static inline size_t
+ipc_batch_reply_size(ipc_command_t id)
+{
+\tswitch (id) {''')
+    for call in p.batchable_calls:
+        f.write("\n\tcase %s: return sizeof(%s);" % (call.id, call.reply_struct))
+    f.write("\n\tdefault: return 0;")
+    f.write("\n\t}\n}\n")
+
     f.close()
 
 
+def write_msg_init(f, call):
+    """Write the msg struct of a call filled in from the arguments."""
+    f.write("\t" + call.msg_struct + " _msg = {\n")
+    f.write("\t    .cmd = " + str(call.id) + ",\n")
+    for arg in call.in_args:
+        if arg.is_aggregate:
+            f.write("\t    ." + arg.name + " = *" + arg.name + ",\n")
+        else:
+            f.write("\t    ." + arg.name + " = " + arg.name + ",\n")
+    if call.in_handles:
+        f.write("\t    ." + call.in_handles.count_arg_name +
+                " = " + call.in_handles.count_arg_name + ",\n")
+    f.write("\t};\n")
+
+
+def write_batch_queue_func(f, call):
+    """Write the helper that queues a call on the batch of the connection."""
+    args = ["struct ipc_connection *ipc_c",
+            "const " + call.msg_struct + " *msg"]
+    args.extend(arg.get_func_argument_out() for arg in call.out_args)
+    args.append("xrt_result_t *out_result")
+    write_decl(f, 'static xrt_result_t',
+               'batch_queue_' + call.name + '_locked', args)
+    f.write("\n{\n")
+    f.write("\tstruct ipc_client_batch_call *call = NULL;\n")
+    write_invocation(f, 'xrt_result_t ret',
+                     'ipc_client_batch_queue_locked',
+                     ['ipc_c', 'msg', 'sizeof(*msg)',
+                      'sizeof(%s)' % call.reply_struct, 'out_result',
+                      '&call'],
+                     indent="\t")
+    f.write(';')
+    write_result_handler(f, 'ret', indent="\t")
+    for arg in call.out_args:
+        write_with_wrapped_args(
+            f, 'ipc_client_batch_call_add_out(',
+            ['call', 'out_' + arg.name,
+             'offsetof(%s, %s)' % (call.reply_struct, arg.name),
+             'sizeof(*out_' + arg.name + ')'],
+            indent="\t")
+        f.write(';\n')
+    f.write("\n\treturn XRT_SUCCESS;\n}\n")
+
+
 def generate_client_c(file, p):
     """Generate IPC client proxy source."""
     f = open(file, "w")
@@ -106,6 +191,9 @@ def generate_client_c(file, p):
 
 \n''')
 
+    for call in p.batchable_calls:
+        write_batch_queue_func(f, call)
+
     # Loop over all of the calls.
     for call in p.calls:
         call.write_call_decl(f)
@@ -114,20 +202,7 @@ def generate_client_c(file, p):
         f.write("\tIPC_TRACE(ipc_c, \"Calling " + call.name + "\");\n\n")
 
         # Message struct
-        if call.needs_msg_struct:
-            f.write("\tstruct ipc_" + call.name + "_msg _msg = {\n")
-        else:
-            f.write("\tstruct ipc_command_msg _msg = {\n")
-        f.write("\t    .cmd = " + str(call.id) + ",\n")
-        for arg in call.in_args:
-            if arg.is_aggregate:
-                f.write("\t    ." + arg.name + " = *" + arg.name + ",\n")
-            else:
-                f.write("\t    ." + arg.name + " = " + arg.name + ",\n")
-        if call.in_handles:
-            f.write("\t    ." + call.in_handles.count_arg_name +
-                    " = " + call.in_handles.count_arg_name + ",\n")
-        f.write("\t};\n")
+        write_msg_init(f, call)
 
         # Reply struct
         if call.out_args:
@@ -143,6 +218,35 @@ def generate_client_c(file, p):
 """)
         cleanup = "os_mutex_unlock(&ipc_c->mutex);"
 
+        if call.batchable:
+            f.write("""
+\t// Send any queued calls together with this one, in order.
+\tif (ipc_c->batch.call_count > 0) {
+\t\txrt_result_t _result = XRT_SUCCESS;
+""")
+            args = ['ipc_c', '&_msg']
+            args.extend('out_' + arg.name for arg in call.out_args)
+            args.append('&_result')
+            write_invocation(f, 'xrt_result_t ret',
+                             'batch_queue_' + call.name + '_locked', args,
+                             indent="\t\t")
+            f.write(""";
+\t\tif (ret == XRT_SUCCESS) {
+\t\t\tret = ipc_client_batch_flush_locked(ipc_c);
+\t\t}
+
+\t\tos_mutex_unlock(&ipc_c->mutex);
+\t\treturn ret != XRT_SUCCESS ? ret : _result;
+\t}
+""")
+        else:
+            f.write("""
+\t// Queued calls must reach the service before this one.
+\tif (ipc_c->batch.call_count > 0) {
+\t\txrt_result_t ret = ipc_client_batch_flush_locked(ipc_c);""")
+            write_result_handler(f, 'ret', cleanup, indent="\t\t")
+            f.write("\t}\n")
+
         # Prepare initial sending
         func = 'ipc_send'
         args = ['&ipc_c->imc', '&_msg', 'sizeof(_msg)']
@@ -205,6 +309,22 @@ def generate_client_c(file, p):
             f.write("\t*out_" + arg.name + " = _reply." + arg.name + ";\n")
         f.write("\n\t" + cleanup)
         f.write("\n\treturn _reply.result;\n}\n")
+
+    # The batched versions of the calls.
+    for call in p.batchable_calls:
+        call.write_batch_decl(f)
+        f.write("\n{\n")
+        f.write("\tIPC_TRACE(ipc_c, \"Batching " + call.name + "\");\n\n")
+        write_msg_init(f, call)
+        f.write("\n\tos_mutex_lock(&ipc_c->mutex);")
+        args = ['ipc_c', '&_msg']
+        args.extend('out_' + arg.name for arg in call.out_args)
+        args.append('out_result')
+        write_invocation(f, 'xrt_result_t ret',
+                         'batch_queue_' + call.name + '_locked', args,
+                         indent="\t")
+        f.write(";\n\tos_mutex_unlock(&ipc_c->mutex);\n")
+        f.write("\n\treturn ret;\n}\n")
     f.close()
 
 
@@ -230,11 +350,113 @@ def generate_client_h(file, p):
         call.write_call_decl(f)
         f.write(";\n")
 
+    for call in p.batchable_calls:
+        call.write_batch_decl(f)
+        f.write(";\n")
+
     write_cpp_header_guard_end(f)
 
     f.close()
 
 
+def write_handler_invocation(f, call, reply):
+    """Write call to ipc_handle_CALLNAME, reply is the reply struct access."""
+    args = ["ics"]
+    for arg in call.in_args:
+        args.append(("&msg->" + arg.name)
+                    if arg.is_aggregate
+                    else ("msg->" + arg.name))
+    args.extend("&" + reply + arg.name for arg in call.out_args)
+    if call.out_handles:
+        args.extend(("XRT_MAX_IPC_HANDLES",
+                     call.out_handles.arg_name,
+                     "&" + call.out_handles.count_arg_name))
+
+    if call.in_handles:
+        args.extend(("&in_%s[0]" % call.in_handles.arg_name,
+                     "msg->"+call.in_handles.count_arg_name))
+    write_invocation(f, reply + 'result', 'ipc_handle_' +
+                     call.name, args, indent="\t\t")
+    f.write(";\n")
+
+
+def write_batch_dispatch(f, p):
+    """Write the dispatch of a batch of calls, replies are packed together."""
+    f.write('''
+static xrt_result_t
+dispatch_batched_call(volatile struct ipc_client_state *ics, uint8_t *msg_data, uint8_t *reply_data)
+{
+\tipc_command_t cmd;
+\tmemcpy(&cmd, msg_data, sizeof(cmd));
+
+\tswitch (cmd) {
+''')
+    for call in p.batchable_calls:
+        f.write("\tcase " + call.id + ": {\n")
+        f.write("\t\tIPC_TRACE(ics->server, \"Dispatching batched " +
+                call.name + "\");\n\n")
+        if call.needs_msg_struct:
+            f.write("\t\t{0} *msg = ({0} *)msg_data;\n".format(
+                call.msg_struct))
+        f.write("\t\t{0} *reply = ({0} *)reply_data;\n".format(
+            call.reply_struct))
+        write_handler_invocation(f, call, "reply->")
+        f.write("\t\treturn XRT_SUCCESS;\n")
+        f.write("\t}\n")
+    f.write('''\tdefault:
+\t\tU_LOG_E("Can't batch IPC message %d!", cmd);
+\t\treturn XRT_ERROR_IPC_FAILURE;
+\t}
+}
+
+static xrt_result_t
+dispatch_batch(volatile struct ipc_client_state *ics, struct ipc_batch_msg *msg)
+{
+\tuint8_t reply[IPC_BATCH_MAX_REPLY_SIZE];
+\tuint8_t *data = (uint8_t *)msg;
+\tsize_t msg_offset = sizeof(*msg);
+\tsize_t reply_offset = 0;
+
+\tif (msg->size > IPC_BATCH_MAX_MSG_SIZE || msg->call_count > IPC_BATCH_MAX_CALLS) {
+\t\tU_LOG_E("Invalid IPC batch, size %u with %u calls!", msg->size, msg->call_count);
+\t\treturn XRT_ERROR_IPC_FAILURE;
+\t}
+
+\tfor (uint32_t i = 0; i < msg->call_count; i++) {
+\t\tipc_command_t cmd = IPC_ERR;
+\t\tif (msg_offset + sizeof(cmd) <= msg->size) {
+\t\t\tmemcpy(&cmd, data + msg_offset, sizeof(cmd));
+\t\t}
+
+\t\tsize_t msg_size = ipc_batch_msg_size(cmd);
+\t\tsize_t reply_size = ipc_batch_reply_size(cmd);
+\t\tif (msg_size == 0 || msg_offset + msg_size > msg->size ||
+\t\t    reply_offset + reply_size > IPC_BATCH_MAX_REPLY_SIZE) {
+\t\t\tU_LOG_E("Invalid call %u in IPC batch!", i);
+\t\t\treturn XRT_ERROR_IPC_FAILURE;
+\t\t}
+
+\t\tmemset(reply + reply_offset, 0, reply_size);
+\t\txrt_result_t ret = dispatch_batched_call(ics, data + msg_offset, reply + reply_offset);
+\t\tif (ret != XRT_SUCCESS) {
+\t\t\treturn ret;
+\t\t}
+
+\t\tmsg_offset += msg_size;
+\t\treply_offset += reply_size;
+\t}
+
+\tif (msg_offset != msg->size) {
+\t\tU_LOG_E("Trailing data in IPC batch!");
+\t\treturn XRT_ERROR_IPC_FAILURE;
+\t}
+
+\treturn ipc_send((struct ipc_message_channel *)&ics->imc, reply, reply_offset);
+}
+
+''')
+
+
 def generate_server_c(file, p):
     """Generate IPC server stub/dispatch source."""
     f = open(file, "w")
@@ -249,13 +471,22 @@ def generate_server_c(file, p):
 
 #include "ipc_server_generated.h"
 
+#include <string.h>
+
 ''')
 
+    write_batch_dispatch(f, p)
+
     f.write('''
 xrt_result_t
 ipc_dispatch(volatile struct ipc_client_state *ics, ipc_command_t *ipc_command)
 {
 \tswitch (*ipc_command) {
+\tcase IPC_BATCH: {
+\t\tIPC_TRACE(ics->server, "Dispatching batch");
+
+\t\treturn dispatch_batch(ics, (struct ipc_batch_msg *)ipc_command);
+\t}
 ''')
 
     for call in p.calls:
@@ -328,23 +559,7 @@ ipc_dispatch(volatile struct ipc_client_state *ics, ipc_command_t *ipc_command)
             f.write("\t\t}\n")
 
         # Write call to ipc_handle_CALLNAME
-        args = ["ics"]
-        for arg in call.in_args:
-            args.append(("&msg->" + arg.name)
-                        if arg.is_aggregate
-                        else ("msg->" + arg.name))
-        args.extend("&reply." + arg.name for arg in call.out_args)
-        if call.out_handles:
-            args.extend(("XRT_MAX_IPC_HANDLES",
-                         call.out_handles.arg_name,
-                         "&" + call.out_handles.count_arg_name))
-
-        if call.in_handles:
-            args.extend(("&in_%s[0]" % call.in_handles.arg_name,
-                         "msg->"+call.in_handles.count_arg_name))
-        write_invocation(f, 'reply.result', 'ipc_handle_' +
-                         call.name, args, indent="\t\t")
-        f.write(";\n")
+        write_handler_invocation(f, call, "reply.")
 
         # TODO do we check reply.result and
         # error out before replying if it's not success?
@@ -0,0 +1,184 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief EuRoC decode ahead tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_frame.h"
+#include "util/u_frame_pool.h"
+#include "util/u_time.h"
+
+#include "euroc/euroc_prefetch.h"
+
+#include "catch/catch.hpp"
+
+#include <atomic>
+#include <iostream>
+
+
+namespace {
+
+/*!
+ * Stands in for the image decode, tags each frame with what it was decoded
+ * for and optionally takes some time like a PNG decode would.
+ */
+struct fake_decoder
+{
+	u_frame_pool *pool = u_frame_pool_create("EuRoC prefetch test", 0);
+	uint64_t decode_ns = 0;
+	std::atomic<uint32_t> max_worker{0};
+	std::atomic<uint64_t> decoded{0};
+
+	~fake_decoder()
+	{
+		u_frame_pool_destroy(&pool);
+	}
+
+	static void
+	decode(void *ptr, uint32_t worker, uint64_t seq, int cam_index, xrt_frame **out_xf)
+	{
+		fake_decoder *d = static_cast<fake_decoder *>(ptr);
+
+		u_frame_pool_create_frame(d->pool, XRT_FORMAT_L8, 752, 480, out_xf);
+		(*out_xf)->source_sequence = seq;
+		(*out_xf)->source_id = cam_index;
+
+		if (d->decode_ns > 0) {
+			os_nanosleep((int64_t)d->decode_ns);
+		}
+
+		uint32_t prev = d->max_worker;
+		while (worker > prev && !d->max_worker.compare_exchange_weak(prev, worker)) {
+		}
+		d->decoded++;
+	}
+};
+
+void
+check_in_order(uint32_t thread_count, uint32_t depth, int cam_count)
+{
+	fake_decoder d;
+	const uint64_t first = 3;
+	const uint64_t end = 40;
+
+	euroc_prefetch *efp =
+	    euroc_prefetch_create(first, end, cam_count, thread_count, depth, fake_decoder::decode, &d);
+	REQUIRE(efp != nullptr);
+
+	for (uint64_t seq = first; seq < end; seq++) {
+		xrt_frame *xfs[4] = {};
+		euroc_prefetch_get(efp, seq, xfs);
+
+		for (int i = 0; i < cam_count; i++) {
+			REQUIRE(xfs[i] != nullptr);
+			CHECK(xfs[i]->source_sequence == seq);
+			CHECK(xfs[i]->source_id == (uint64_t)i);
+			xrt_frame_reference(&xfs[i], nullptr);
+		}
+	}
+
+	euroc_prefetch_stats stats = {};
+	euroc_prefetch_get_stats(efp, &stats);
+	CHECK(stats.ready + stats.waited == end - first);
+	CHECK(stats.decoded == (end - first) * cam_count);
+
+	euroc_prefetch_destroy(&efp);
+	CHECK(efp == nullptr);
+	CHECK(d.max_worker < (thread_count > 0 ? thread_count : 1));
+}
+
+} // namespace
+
+
+TEST_CASE("euroc_prefetch")
+{
+	SECTION("decode on the playback thread")
+	{
+		check_in_order(0, 4, 2);
+	}
+
+	SECTION("one thread, one slot")
+	{
+		check_in_order(1, 1, 2);
+	}
+
+	SECTION("more threads than slots")
+	{
+		check_in_order(4, 2, 3);
+	}
+
+	SECTION("threads and slots")
+	{
+		check_in_order(3, 8, 1);
+	}
+
+	SECTION("never decodes more than depth ahead")
+	{
+		fake_decoder d;
+		const uint32_t depth = 5;
+		const int cam_count = 2;
+
+		euroc_prefetch *efp = euroc_prefetch_create(0, 100, cam_count, 3, depth, fake_decoder::decode, &d);
+
+		xrt_frame *xfs[2] = {};
+		euroc_prefetch_get(efp, 0, xfs);
+		xrt_frame_reference(&xfs[0], nullptr);
+		xrt_frame_reference(&xfs[1], nullptr);
+
+		// Give the threads time to fill the ring, then they must stop.
+		uint64_t start = os_monotonic_get_ns();
+		while (d.decoded < (1 + depth) * cam_count && os_monotonic_get_ns() - start < U_TIME_1S_IN_NS) {
+			os_nanosleep(U_TIME_1MS_IN_NS);
+		}
+		os_nanosleep(20 * U_TIME_1MS_IN_NS);
+		CHECK(d.decoded == (1 + depth) * cam_count);
+
+		u_frame_pool_stats pool_stats = {};
+		u_frame_pool_get_stats(d.pool, &pool_stats);
+		CHECK(pool_stats.outstanding == depth * cam_count);
+
+		// Frames never asked for are dropped.
+		euroc_prefetch_destroy(&efp);
+		u_frame_pool_get_stats(d.pool, &pool_stats);
+		CHECK(pool_stats.outstanding == 0);
+	}
+}
+
+TEST_CASE("euroc_prefetch_benchmark", "[.][benchmark]")
+{
+	// A stereo dataset at 20 Hz, 5 ms to decode each PNG and 5 ms for the
+	// tracker to take each frame set, replayed as fast as the tracker goes.
+	const int cam_count = 2;
+	const int64_t push_ns = 5 * U_TIME_1MS_IN_NS;
+	const uint64_t frame_count = 200;
+	const double dataset_s = frame_count / 20.0;
+
+	for (uint32_t thread_count : {0u, 1u, 2u, 4u}) {
+		fake_decoder d;
+		d.decode_ns = 5 * U_TIME_1MS_IN_NS;
+
+		uint64_t start = os_monotonic_get_ns();
+
+		euroc_prefetch *efp =
+		    euroc_prefetch_create(0, frame_count, cam_count, thread_count, 8, fake_decoder::decode, &d);
+		for (uint64_t seq = 0; seq < frame_count; seq++) {
+			xrt_frame *xfs[cam_count] = {};
+			euroc_prefetch_get(efp, seq, xfs);
+			os_nanosleep(push_ns);
+			for (xrt_frame *&xf : xfs) {
+				xrt_frame_reference(&xf, nullptr);
+			}
+		}
+
+		euroc_prefetch_stats stats = {};
+		euroc_prefetch_get_stats(efp, &stats);
+		euroc_prefetch_destroy(&efp);
+
+		double wall_s = (double)(os_monotonic_get_ns() - start) / U_TIME_1S_IN_NS;
+		std::cout << thread_count << " decode thread(s): " << frame_count / wall_s << " frames/s, "
+		          << dataset_s / wall_s << "x replay speed, waited for " << stats.waited << "/" << frame_count
+		          << " frames" << std::endl;
+	}
+}
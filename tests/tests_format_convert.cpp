@@ -0,0 +1,291 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Format conversion kernel tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_format_convert.h"
+#include "util/u_frame.h"
+#include "util/u_sink.h"
+
+#include "catch/catch.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+struct pair
+{
+	const char *name;
+	u_format_convert_func_t u_format_convert_funcs::*func;
+	uint32_t src_bytes_per_pixel;
+	uint32_t dst_bytes_per_pixel;
+	uint32_t src_rows_per_row;
+};
+
+const pair kPairs[] = {
+    {"L8_to_R8G8B8", &u_format_convert_funcs::L8_to_R8G8B8, 1, 3, 1},
+    {"YUYV422_to_L8", &u_format_convert_funcs::YUYV422_to_L8, 2, 1, 1},
+    {"YUYV422_to_R8G8B8", &u_format_convert_funcs::YUYV422_to_R8G8B8, 2, 3, 1},
+    {"UYVY422_to_R8G8B8", &u_format_convert_funcs::UYVY422_to_R8G8B8, 2, 3, 1},
+    {"YUV888_to_R8G8B8", &u_format_convert_funcs::YUV888_to_R8G8B8, 3, 3, 1},
+    {"BAYER_GR8_to_R8G8B8", &u_format_convert_funcs::BAYER_GR8_to_R8G8B8, 2, 3, 2},
+};
+
+const u_format_convert_simd kSimds[] = {
+    U_FORMAT_CONVERT_SIMD_SSSE3,
+    U_FORMAT_CONVERT_SIMD_AVX2,
+    U_FORMAT_CONVERT_SIMD_NEON,
+};
+
+u_format_convert_funcs
+get_funcs(u_format_convert_simd simd)
+{
+	u_format_convert_funcs funcs = {};
+	u_format_convert_get_funcs(simd, &funcs);
+	return funcs;
+}
+
+/*!
+ * Source and destination images with padding at the end of the rows, the
+ * destination is filled with a pattern so that stray writes show up.
+ */
+struct images
+{
+	uint32_t w, h;
+	size_t src_stride, dst_stride;
+	std::vector<uint8_t> src, dst;
+
+	images(const pair &p, uint32_t w_, uint32_t h_, std::mt19937 &rng) : w(w_), h(h_)
+	{
+		// The 4:2:2 kernels write pixels in pairs, leave room for that.
+		src_stride = (w + 1) * p.src_bytes_per_pixel + 13;
+		dst_stride = (w + 1) * p.dst_bytes_per_pixel + 7;
+
+		src.resize(src_stride * h * p.src_rows_per_row);
+		dst.assign(dst_stride * h, 0x5a);
+
+		std::uniform_int_distribution<int> dist(0, 255);
+		for (uint8_t &v : src) {
+			v = (uint8_t)dist(rng);
+		}
+	}
+
+	void
+	run(u_format_convert_func_t func)
+	{
+		func(src.data(), src_stride, dst.data(), dst_stride, w, h);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("format_convert")
+{
+	std::mt19937 rng(1234);
+
+	SECTION("names and best")
+	{
+		CHECK(u_format_convert_simd_supported(U_FORMAT_CONVERT_SIMD_NONE));
+		CHECK(u_format_convert_simd_supported(u_format_convert_simd_best()));
+		CHECK(std::string(u_format_convert_simd_str(U_FORMAT_CONVERT_SIMD_NONE)) == "none");
+		CHECK(get_funcs(U_FORMAT_CONVERT_SIMD_NONE).simd == U_FORMAT_CONVERT_SIMD_NONE);
+	}
+
+	SECTION("plain C matches the formula")
+	{
+		u_format_convert_funcs funcs = get_funcs(U_FORMAT_CONVERT_SIMD_NONE);
+
+		// Y U Y V, white and black with no colour.
+		const uint8_t yuyv[] = {235, 128, 16, 128};
+		uint8_t rgb[6] = {};
+		funcs.YUYV422_to_R8G8B8(yuyv, sizeof(yuyv), rgb, sizeof(rgb), 2, 1);
+		CHECK(rgb[0] == 255);
+		CHECK(rgb[1] == 255);
+		CHECK(rgb[2] == 255);
+		CHECK(rgb[3] == 0);
+		CHECK(rgb[4] == 0);
+		CHECK(rgb[5] == 0);
+
+		// Saturated red.
+		const uint8_t yuv[] = {81, 90, 240};
+		funcs.YUV888_to_R8G8B8(yuv, sizeof(yuv), rgb, sizeof(rgb), 1, 1);
+		CHECK(rgb[0] == 255);
+		CHECK(rgb[1] == 0);
+		CHECK(rgb[2] == 0);
+
+		// G R / B G block.
+		const uint8_t bayer[] = {10, 200, 50, 21};
+		funcs.BAYER_GR8_to_R8G8B8(bayer, 2, rgb, sizeof(rgb), 1, 1);
+		CHECK(rgb[0] == 200);
+		CHECK(rgb[1] == 15);
+		CHECK(rgb[2] == 50);
+	}
+
+	SECTION("SIMD matches plain C exactly")
+	{
+		u_format_convert_funcs plain = get_funcs(U_FORMAT_CONVERT_SIMD_NONE);
+
+		for (u_format_convert_simd simd : kSimds) {
+			if (!u_format_convert_simd_supported(simd)) {
+				continue;
+			}
+			u_format_convert_funcs funcs = get_funcs(simd);
+			CHECK(funcs.simd == simd);
+
+			for (const pair &p : kPairs) {
+				// Odd sizes to cover the tails of the vector loops.
+				for (uint32_t w : {1u, 2u, 7u, 16u, 33u, 64u, 101u, 640u}) {
+					INFO(u_format_convert_simd_str(simd) << " " << p.name << " width " << w);
+
+					images expected(p, w, 5, rng);
+					images got = expected;
+
+					expected.run(plain.*p.func);
+					got.run(funcs.*p.func);
+
+					CHECK(got.dst == expected.dst);
+				}
+			}
+		}
+	}
+
+	SECTION("all YUV values")
+	{
+		// Every Y, U and V combination through the YUV888 kernels, a row per Y.
+		u_format_convert_funcs plain = get_funcs(U_FORMAT_CONVERT_SIMD_NONE);
+
+		for (u_format_convert_simd simd : kSimds) {
+			if (!u_format_convert_simd_supported(simd)) {
+				continue;
+			}
+			u_format_convert_funcs funcs = get_funcs(simd);
+
+			bool same = true;
+			images expected(kPairs[4], 256 * 256, 1, rng);
+			for (uint32_t y = 0; y < 256; y++) {
+				for (uint32_t uv = 0; uv < 256 * 256; uv++) {
+					uint8_t *px = &expected.src[uv * 3];
+					px[0] = (uint8_t)y;
+					px[1] = (uint8_t)(uv >> 8);
+					px[2] = (uint8_t)uv;
+				}
+
+				images got = expected;
+				expected.run(plain.YUV888_to_R8G8B8);
+				got.run(funcs.YUV888_to_R8G8B8);
+				same = same && got.dst == expected.dst;
+			}
+
+			INFO(u_format_convert_simd_str(simd));
+			CHECK(same);
+		}
+	}
+}
+
+
+namespace {
+
+//! Keeps the last frame pushed to it.
+struct capture_sink
+{
+	xrt_frame_sink base = {};
+	xrt_frame *frame = nullptr;
+
+	capture_sink()
+	{
+		base.push_frame = [](xrt_frame_sink *xs, xrt_frame *xf) {
+			xrt_frame_reference(&reinterpret_cast<capture_sink *>(xs)->frame, xf);
+		};
+	}
+
+	~capture_sink()
+	{
+		xrt_frame_reference(&frame, nullptr);
+	}
+};
+
+} // namespace
+
+TEST_CASE("format_convert_sink")
+{
+	// Big enough to be split in bands.
+	const uint32_t w = 1280;
+	const uint32_t h = 720;
+
+	xrt_frame *yuyv = nullptr;
+	u_frame_create_one_off(XRT_FORMAT_YUYV422, w, h, &yuyv);
+	REQUIRE(yuyv != nullptr);
+
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<int> dist(0, 255);
+	for (size_t i = 0; i < yuyv->size; i++) {
+		yuyv->data[i] = (uint8_t)dist(rng);
+	}
+
+	std::vector<uint8_t> expected(w * 3 * h);
+	get_funcs(U_FORMAT_CONVERT_SIMD_NONE).YUYV422_to_R8G8B8(yuyv->data, yuyv->stride, expected.data(), w * 3, w, h);
+
+	xrt_frame_context xfctx = {};
+	capture_sink capture;
+	xrt_frame_sink *xfs = nullptr;
+	u_sink_create_to_r8g8b8_or_l8(&xfctx, &capture.base, &xfs);
+	REQUIRE(xfs != nullptr);
+
+	xrt_sink_push_frame(xfs, yuyv);
+	REQUIRE(capture.frame != nullptr);
+	REQUIRE(capture.frame->format == XRT_FORMAT_R8G8B8);
+
+	bool same = true;
+	for (uint32_t y = 0; y < h; y++) {
+		same = same && memcmp(capture.frame->data + y * capture.frame->stride, &expected[y * w * 3], w * 3) == 0;
+	}
+	CHECK(same);
+
+	xrt_frame_reference(&yuyv, nullptr);
+	xrt_frame_reference(&capture.frame, nullptr);
+	xrt_frame_context_destroy_nodes(&xfctx);
+}
+
+TEST_CASE("format_convert_benchmark", "[.][benchmark]")
+{
+	std::mt19937 rng(1);
+	const int rounds = 50;
+
+	for (const pair &p : kPairs) {
+		for (uint32_t size : {480u, 720u}) {
+			uint32_t w = size == 480 ? 640 : 1280;
+			images img(p, w, size / p.src_rows_per_row, rng);
+
+			double plain_ns = 0;
+			for (u_format_convert_simd simd :
+			     {U_FORMAT_CONVERT_SIMD_NONE, U_FORMAT_CONVERT_SIMD_SSSE3, U_FORMAT_CONVERT_SIMD_AVX2,
+			      U_FORMAT_CONVERT_SIMD_NEON}) {
+				if (!u_format_convert_simd_supported(simd)) {
+					continue;
+				}
+				u_format_convert_func_t func = get_funcs(simd).*p.func;
+
+				uint64_t start = os_monotonic_get_ns();
+				for (int r = 0; r < rounds; r++) {
+					img.run(func);
+				}
+				double ns = (double)(os_monotonic_get_ns() - start) / rounds;
+				if (simd == U_FORMAT_CONVERT_SIMD_NONE) {
+					plain_ns = ns;
+				}
+
+				std::cout << p.name << " " << w << "x" << size << " " << u_format_convert_simd_str(simd)
+				          << ": " << ns / 1000.0 << "us, " << plain_ns / ns << "x" << std::endl;
+			}
+		}
+	}
+}
@@ -0,0 +1,270 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Frame pool tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_format.h"
+#include "util/u_frame.h"
+#include "util/u_frame_pool.h"
+
+#include "catch/catch.hpp"
+
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+
+namespace {
+
+u_frame_pool_stats
+get_stats(u_frame_pool *pool)
+{
+	u_frame_pool_stats stats;
+	u_frame_pool_get_stats(pool, &stats);
+	return stats;
+}
+
+/*!
+ * Four cameras producing frames with an exposure line like WMR, copied into
+ * an RGB frame, with a tracker downstream holding on to the last few frames.
+ * Little work per frame, so that the cost of getting frames shows.
+ */
+struct camera_pipeline
+{
+	static constexpr int kCameraCount = 4;
+	static constexpr uint32_t kWidth = 640;
+	static constexpr uint32_t kHeight = 480;
+	static constexpr size_t kHeld = 3;
+
+	u_frame_pool *pool = nullptr;
+	std::deque<xrt_frame *> held[kCameraCount];
+
+	explicit camera_pipeline(u_frame_pool *p) : pool(p) {}
+
+	~camera_pipeline()
+	{
+		for (auto &queue : held) {
+			for (xrt_frame *&xf : queue) {
+				xrt_frame_reference(&xf, nullptr);
+			}
+		}
+	}
+
+	void
+	create(enum xrt_format f, uint32_t w, uint32_t h, xrt_frame **out_frame)
+	{
+		if (pool != nullptr) {
+			u_frame_pool_create_frame(pool, f, w, h, out_frame);
+		} else {
+			u_frame_create_one_off(f, w, h, out_frame);
+		}
+	}
+
+	void
+	push(int camera, uint64_t sequence)
+	{
+		xrt_frame *raw = nullptr;
+		create(XRT_FORMAT_L8, kWidth, kHeight + 1, &raw);
+		memset(raw->data, (int)(sequence & 0xff), raw->size);
+		raw->source_sequence = sequence;
+
+		xrt_frame *rgb = nullptr;
+		create(XRT_FORMAT_R8G8B8, kWidth, kHeight, &rgb);
+		for (uint32_t y = 0; y < kHeight; y++) {
+			memcpy(rgb->data + y * rgb->stride, raw->data + y * raw->stride, kWidth);
+		}
+		rgb->source_sequence = sequence;
+		xrt_frame_reference(&raw, nullptr);
+
+		held[camera].push_back(rgb);
+		if (held[camera].size() > kHeld) {
+			xrt_frame_reference(&held[camera].front(), nullptr);
+			held[camera].pop_front();
+		}
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("u_frame_pool")
+{
+	u_frame_pool *pool = u_frame_pool_create("Test pool", 2);
+	REQUIRE(pool != nullptr);
+
+	SECTION("reuses frames")
+	{
+		xrt_frame *xf = nullptr;
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 640, 481, &xf);
+		REQUIRE(xf != nullptr);
+		CHECK(xf->reference.count == 1);
+		uint8_t *data = xf->data;
+		xf->timestamp = 42;
+		xf->stereo_format = XRT_STEREO_FORMAT_SBS;
+		xrt_frame_reference(&xf, nullptr);
+
+		CHECK(get_stats(pool).free == 1);
+
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 640, 481, &xf);
+		CHECK(xf->data == data);
+		CHECK(xf->timestamp == 0);
+		CHECK(xf->stereo_format == XRT_STEREO_FORMAT_NONE);
+
+		u_frame_pool_stats stats = get_stats(pool);
+		CHECK(stats.hits == 1);
+		CHECK(stats.misses == 1);
+		CHECK(stats.outstanding == 1);
+		CHECK(stats.free == 0);
+
+		// Other sizes and formats don't share.
+		xrt_frame *other = nullptr;
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 640, 480, &other);
+		xrt_frame_reference(&other, nullptr);
+		u_frame_pool_create_frame(pool, XRT_FORMAT_R8G8B8, 640, 481, &other);
+		CHECK(get_stats(pool).misses == 3);
+		xrt_frame_reference(&other, nullptr);
+
+		xrt_frame_reference(&xf, nullptr);
+	}
+
+	SECTION("page aligned")
+	{
+		const enum xrt_format formats[] = {XRT_FORMAT_L8, XRT_FORMAT_R8G8B8, XRT_FORMAT_YUYV422};
+		for (enum xrt_format f : formats) {
+			xrt_frame *xf = nullptr;
+			u_frame_pool_create_frame(pool, f, 322, 241, &xf);
+
+			size_t stride = 0;
+			size_t size = 0;
+			u_format_size_for_dimensions(f, 322, 241, &stride, &size);
+			CHECK(xf->stride == stride);
+			CHECK(xf->size == size);
+			CHECK(((uintptr_t)xf->data % U_FRAME_POOL_ALIGNMENT) == 0);
+
+			// All of the data can be written.
+			memset(xf->data, 0xff, xf->size);
+			xrt_frame_reference(&xf, nullptr);
+		}
+	}
+
+	SECTION("free lists are capped")
+	{
+		xrt_frame *frames[5] = {};
+		for (xrt_frame *&xf : frames) {
+			u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 64, 64, &xf);
+		}
+		for (xrt_frame *&xf : frames) {
+			xrt_frame_reference(&xf, nullptr);
+		}
+
+		u_frame_pool_stats stats = get_stats(pool);
+		CHECK(stats.outstanding == 0);
+		CHECK(stats.free == 2);
+		CHECK(stats.frees == 3);
+	}
+
+	SECTION("clone of a region of interest")
+	{
+		xrt_frame *xf = nullptr;
+		u_frame_create_one_off(XRT_FORMAT_L8, 16, 8, &xf);
+		for (size_t i = 0; i < xf->size; i++) {
+			xf->data[i] = (uint8_t)i;
+		}
+		xf->source_sequence = 7;
+
+		xrt_frame *roi = nullptr;
+		u_frame_create_roi(xf, xrt_rect{{4, 2}, {8, 4}}, &roi);
+
+		xrt_frame *clone = nullptr;
+		u_frame_pool_clone(pool, roi, &clone);
+		CHECK(clone->reference.count == 1);
+		CHECK(clone->width == 8);
+		CHECK(clone->height == 4);
+		CHECK(clone->stride == 8);
+		CHECK(clone->source_sequence == 7);
+		for (uint32_t y = 0; y < 4; y++) {
+			for (uint32_t x = 0; x < 8; x++) {
+				CHECK(clone->data[y * 8 + x] == xf->data[(y + 2) * xf->stride + x + 4]);
+			}
+		}
+
+		xrt_frame_reference(&clone, nullptr);
+		xrt_frame_reference(&roi, nullptr);
+		xrt_frame_reference(&xf, nullptr);
+	}
+
+	SECTION("data that can't be allocated")
+	{
+		// Far more than any address space.
+		xrt_frame *xf = nullptr;
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 1u << 31, 1u << 31, &xf);
+		CHECK(xf == nullptr);
+
+		u_frame_pool_stats stats = get_stats(pool);
+		CHECK(stats.outstanding == 0);
+		CHECK(stats.free == 0);
+	}
+
+	SECTION("frames outlive the pool")
+	{
+		xrt_frame *held = nullptr;
+		xrt_frame *dropped = nullptr;
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 64, 64, &held);
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, 64, 64, &dropped);
+		xrt_frame_reference(&dropped, nullptr);
+
+		u_frame_pool_destroy(&pool);
+		CHECK(pool == nullptr);
+
+		memset(held->data, 0, held->size);
+		xrt_frame_reference(&held, nullptr);
+	}
+
+	u_frame_pool_destroy(&pool);
+}
+
+TEST_CASE("u_frame_pool_benchmark", "[.][benchmark]")
+{
+	// Ten seconds of four cameras at 60Hz.
+	const uint64_t frame_count = 600;
+
+	uint64_t start = os_monotonic_get_ns();
+	{
+		camera_pipeline pipeline(nullptr);
+		for (uint64_t i = 0; i < frame_count; i++) {
+			for (int c = 0; c < camera_pipeline::kCameraCount; c++) {
+				pipeline.push(c, i);
+			}
+		}
+	}
+	uint64_t one_off_ns = os_monotonic_get_ns() - start;
+
+	u_frame_pool *pool = u_frame_pool_create("Benchmark pool", 0);
+
+	start = os_monotonic_get_ns();
+	{
+		camera_pipeline pipeline(pool);
+		for (uint64_t i = 0; i < frame_count; i++) {
+			for (int c = 0; c < camera_pipeline::kCameraCount; c++) {
+				pipeline.push(c, i);
+			}
+		}
+	}
+	uint64_t pool_ns = os_monotonic_get_ns() - start;
+
+	u_frame_pool_stats stats = get_stats(pool);
+	uint64_t pushed = frame_count * camera_pipeline::kCameraCount;
+
+	std::cout << "one off: " << one_off_ns / pushed << "ns per camera frame, " << pushed * 2 << " allocations"
+	          << std::endl;
+	std::cout << "pool: " << pool_ns / pushed << "ns per camera frame, " << stats.misses << " allocations, "
+	          << stats.hits << " hits" << std::endl;
+
+	CHECK(stats.outstanding == 0);
+	CHECK(stats.misses < 32);
+
+	u_frame_pool_destroy(&pool);
+}
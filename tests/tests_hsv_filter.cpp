@@ -0,0 +1,261 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief HSV filter classifier tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_worker.h"
+
+#include "tracking/t_tracking.h"
+
+#include "catch/catch.hpp"
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+constexpr int kChannels = 4;
+
+//! Random bits in every entry, so that every mask gets exercised.
+std::unique_ptr<t_hsv_filter_optimized_table>
+make_table(uint32_t seed)
+{
+	std::unique_ptr<t_hsv_filter_optimized_table> t(new t_hsv_filter_optimized_table);
+	std::mt19937 rng(seed);
+	uint8_t *v = &t->v[0][0][0];
+	for (size_t i = 0; i < sizeof(t->v); i++) {
+		v[i] = (uint8_t)(rng() & 0xf);
+	}
+	return t;
+}
+
+/*!
+ * A source image and the four masks, the masks have padding at the end of
+ * the rows filled with a pattern so that stray writes show up.
+ */
+struct images
+{
+	uint32_t w, h;
+	size_t src_stride, dst_stride;
+	std::vector<uint8_t> src;
+	std::vector<uint8_t> dst[kChannels];
+
+	images(uint32_t w_, uint32_t h_, uint32_t bytes_per_pixel, std::mt19937 &rng) : w(w_), h(h_)
+	{
+		// YUYV writes pixels in pairs, leave room for that.
+		src_stride = (w + 1) * bytes_per_pixel + 5;
+		dst_stride = w + 1 + 11;
+
+		src.resize(src_stride * h);
+		for (uint8_t &v : src) {
+			v = (uint8_t)rng();
+		}
+		for (std::vector<uint8_t> &d : dst) {
+			d.assign(dst_stride * h, 0x5a);
+		}
+	}
+
+	void
+	run(t_hsv_filter_kernel_func_t func, const t_hsv_filter_optimized_table *t)
+	{
+		uint8_t *const d[kChannels] = {dst[0].data(), dst[1].data(), dst[2].data(), dst[3].data()};
+		func(t, src.data(), src_stride, d, dst_stride, w, h);
+	}
+
+	bool
+	same_masks(const images &other) const
+	{
+		for (int i = 0; i < kChannels; i++) {
+			if (dst[i] != other.dst[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("hsv_filter_kernels")
+{
+	std::mt19937 rng(1234);
+	std::unique_ptr<t_hsv_filter_optimized_table> table = make_table(1);
+
+	t_hsv_filter_kernels plain = {};
+	t_hsv_filter_kernels simd = {};
+	t_hsv_filter_get_kernels(false, &plain);
+	t_hsv_filter_get_kernels(true, &simd);
+	CHECK(std::string(plain.name) == "none");
+
+	SECTION("plain C matches the table")
+	{
+		images yuv(37, 3, 3, rng);
+		yuv.run(plain.yuv888, table.get());
+
+		for (uint32_t y = 0; y < yuv.h; y++) {
+			for (uint32_t x = 0; x < yuv.w; x++) {
+				const uint8_t *px = &yuv.src[y * yuv.src_stride + x * 3];
+				uint8_t bits = t_hsv_filter_sample(table.get(), px[0], px[1], px[2]);
+				for (int i = 0; i < kChannels; i++) {
+					CHECK(yuv.dst[i][y * yuv.dst_stride + x] == ((bits & (1 << i)) ? 0xff : 0x00));
+				}
+			}
+		}
+
+		images yuyv(36, 3, 2, rng);
+		yuyv.run(plain.yuyv422, table.get());
+
+		for (uint32_t y = 0; y < yuyv.h; y++) {
+			for (uint32_t x = 0; x < yuyv.w; x++) {
+				const uint8_t *px = &yuyv.src[y * yuyv.src_stride + (x & ~1u) * 2];
+				uint8_t bits = t_hsv_filter_sample(table.get(), px[(x & 1) * 2], px[1], px[3]);
+				for (int i = 0; i < kChannels; i++) {
+					CHECK(yuyv.dst[i][y * yuyv.dst_stride + x] == ((bits & (1 << i)) ? 0xff : 0x00));
+				}
+			}
+		}
+	}
+
+	SECTION("SIMD matches plain C exactly")
+	{
+		INFO("SIMD kernels: " << simd.name);
+
+		// Odd sizes to cover the tails of the vector loops.
+		for (uint32_t w : {1u, 2u, 31u, 32u, 33u, 64u, 100u, 641u}) {
+			INFO("width " << w);
+
+			images yuv_expected(w, 5, 3, rng);
+			images yuv_got = yuv_expected;
+			yuv_expected.run(plain.yuv888, table.get());
+			yuv_got.run(simd.yuv888, table.get());
+			CHECK(yuv_got.same_masks(yuv_expected));
+
+			images yuyv_expected(w, 5, 2, rng);
+			images yuyv_got = yuyv_expected;
+			yuyv_expected.run(plain.yuyv422, table.get());
+			yuyv_got.run(simd.yuyv422, table.get());
+			CHECK(yuyv_got.same_masks(yuyv_expected));
+		}
+	}
+
+	SECTION("every table entry")
+	{
+		// One pixel per table entry, at every offset within the steps.
+		std::unique_ptr<t_hsv_filter_optimized_table> other = make_table(2);
+
+		for (uint32_t offset = 0; offset < T_HSV_STEP; offset++) {
+			images expected(T_HSV_SIZE * T_HSV_SIZE, T_HSV_SIZE, 3, rng);
+			for (uint32_t y = 0; y < T_HSV_SIZE; y++) {
+				for (uint32_t uv = 0; uv < T_HSV_SIZE * T_HSV_SIZE; uv++) {
+					uint8_t *px = &expected.src[y * expected.src_stride + uv * 3];
+					px[0] = (uint8_t)(y * T_HSV_STEP + offset);
+					px[1] = (uint8_t)((uv / T_HSV_SIZE) * T_HSV_STEP + offset);
+					px[2] = (uint8_t)((uv % T_HSV_SIZE) * T_HSV_STEP + (T_HSV_STEP - 1 - offset));
+				}
+			}
+
+			images got = expected;
+			expected.run(plain.yuv888, other.get());
+			got.run(simd.yuv888, other.get());
+			CHECK(got.same_masks(expected));
+		}
+	}
+}
+
+
+namespace {
+
+struct band
+{
+	t_hsv_filter_kernel_func_t func;
+	const t_hsv_filter_optimized_table *table;
+	images *img;
+	uint32_t y, h;
+};
+
+void
+run_band(void *ptr)
+{
+	band *b = static_cast<band *>(ptr);
+	images &img = *b->img;
+	uint8_t *const d[kChannels] = {
+	    img.dst[0].data() + b->y * img.dst_stride,
+	    img.dst[1].data() + b->y * img.dst_stride,
+	    img.dst[2].data() + b->y * img.dst_stride,
+	    img.dst[3].data() + b->y * img.dst_stride,
+	};
+	b->func(b->table, img.src.data() + b->y * img.src_stride, img.src_stride, d, img.dst_stride, img.w, b->h);
+}
+
+} // namespace
+
+TEST_CASE("hsv_filter_benchmark", "[.][benchmark]")
+{
+	// PS4 camera sized frames.
+	const uint32_t w = 1920;
+	const uint32_t h = 1080;
+	const int rounds = 20;
+	const uint32_t band_count = 4;
+
+	std::mt19937 rng(1);
+	std::unique_ptr<t_hsv_filter_optimized_table> table = make_table(1);
+
+	t_hsv_filter_kernels plain = {};
+	t_hsv_filter_kernels simd = {};
+	t_hsv_filter_get_kernels(false, &plain);
+	t_hsv_filter_get_kernels(true, &simd);
+
+	u_worker_thread_pool *pool = u_worker_thread_pool_create(band_count - 1, band_count, "HSV bench");
+	u_worker_group *group = u_worker_group_create(pool);
+
+	for (bool is_yuyv : {false, true}) {
+		images img(w, h, is_yuyv ? 2 : 3, rng);
+		images reference = img;
+		reference.run(is_yuyv ? plain.yuyv422 : plain.yuv888, table.get());
+
+		struct
+		{
+			const char *name;
+			t_hsv_filter_kernel_func_t func;
+			uint32_t bands;
+		} runs[] = {
+		    {"none", is_yuyv ? plain.yuyv422 : plain.yuv888, 1},
+		    {simd.name, is_yuyv ? simd.yuyv422 : simd.yuv888, 1},
+		    {simd.name, is_yuyv ? simd.yuyv422 : simd.yuv888, band_count},
+		};
+
+		for (const auto &r : runs) {
+			band bands[band_count];
+			uint32_t rows = h / r.bands;
+			for (uint32_t i = 0; i < r.bands; i++) {
+				bands[i] = {r.func, table.get(), &img, i * rows, i + 1 == r.bands ? h - i * rows : rows};
+			}
+
+			uint64_t start = os_monotonic_get_ns();
+			for (int k = 0; k < rounds; k++) {
+				for (uint32_t i = 1; i < r.bands; i++) {
+					u_worker_group_push(group, run_band, &bands[i]);
+				}
+				run_band(&bands[0]);
+				u_worker_group_wait_all(group);
+			}
+			double ns = (double)(os_monotonic_get_ns() - start) / rounds;
+
+			CHECK(img.same_masks(reference));
+
+			std::cout << (is_yuyv ? "YUYV422 " : "YUV888 ") << w << "x" << h << " " << r.name << " " << r.bands
+			          << " band(s): " << (double)w * h / ns * 1000.0 << " Mpix/s" << std::endl;
+		}
+	}
+
+	u_worker_group_reference(&group, NULL);
+	u_worker_thread_pool_reference(&pool, NULL);
+}
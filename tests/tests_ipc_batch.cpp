@@ -0,0 +1,354 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief IPC call batching tests, against a mock service.
+ */
+
+#include "os/os_time.h"
+#include "util/u_misc.h"
+
+#include "client/ipc_client.h"
+#include "ipc_client_generated.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace {
+
+// Replies like the service would, without doing anything. Counts messages.
+struct MockService
+{
+	int fd = -1;
+	std::thread thread;
+
+	std::vector<ipc_command_t> cmds;
+	int round_trips = 0;
+	int64_t frame_id = 0;
+
+	void
+	reply_to(const uint8_t *msg, uint8_t *reply)
+	{
+		ipc_command_t cmd;
+		memcpy(&cmd, msg, sizeof(cmd));
+		cmds.push_back(cmd);
+
+		ipc_result_reply result = {XRT_SUCCESS};
+		memcpy(reply, &result, sizeof(result));
+
+		switch (cmd) {
+		case IPC_COMPOSITOR_PREDICT_FRAME: {
+			auto *r = (ipc_compositor_predict_frame_reply *)reply;
+			r->frame_id = ++frame_id;
+			break;
+		}
+		case IPC_SWAPCHAIN_ACQUIRE_IMAGE: {
+			auto *m = (const ipc_swapchain_acquire_image_msg *)msg;
+			auto *r = (ipc_swapchain_acquire_image_reply *)reply;
+			r->index = m->id + 1;
+			break;
+		}
+		case IPC_SWAPCHAIN_RELEASE_IMAGE: {
+			auto *m = (const ipc_swapchain_release_image_msg *)msg;
+			if (m->id == 99) {
+				set_failed(reply);
+			}
+			break;
+		}
+		case IPC_DEVICE_GET_TRACKED_POSE: {
+			auto *m = (const ipc_device_get_tracked_pose_msg *)msg;
+			auto *r = (ipc_device_get_tracked_pose_reply *)reply;
+			r->relation.pose.position.x = (float)m->at_timestamp;
+			r->relation.pose.position.y = (float)m->id;
+			break;
+		}
+		default: break;
+		}
+	}
+
+	static void
+	set_failed(uint8_t *reply)
+	{
+		ipc_result_reply result = {XRT_ERROR_NO_IMAGE_AVAILABLE};
+		memcpy(reply, &result, sizeof(result));
+	}
+
+	void
+	run()
+	{
+		uint8_t buf[IPC_BUF_SIZE];
+		uint8_t reply[IPC_BATCH_MAX_REPLY_SIZE];
+
+		while (true) {
+			ssize_t len = recv(fd, buf, sizeof(buf), 0);
+			if (len < (ssize_t)sizeof(ipc_command_t)) {
+				return;
+			}
+			round_trips++;
+
+			ipc_command_t cmd;
+			memcpy(&cmd, buf, sizeof(cmd));
+
+			size_t reply_size = 0;
+			if (cmd == IPC_BATCH) {
+				ipc_batch_msg header;
+				memcpy(&header, buf, sizeof(header));
+				// Catch isn't thread safe, the client sees the service go away.
+				if (header.size != (uint32_t)len) {
+					return;
+				}
+
+				size_t offset = sizeof(header);
+				for (uint32_t i = 0; i < header.call_count; i++) {
+					ipc_command_t call_cmd;
+					memcpy(&call_cmd, buf + offset, sizeof(call_cmd));
+					reply_to(buf + offset, reply + reply_size);
+					offset += ipc_batch_msg_size(call_cmd);
+					reply_size += ipc_batch_reply_size(call_cmd);
+				}
+				if (offset != (size_t)len) {
+					return;
+				}
+			} else {
+				reply_to(buf, reply);
+				reply_size = cmd == IPC_SESSION_BEGIN ? sizeof(ipc_result_reply) : ipc_batch_reply_size(cmd);
+			}
+
+			if (send(fd, reply, reply_size, MSG_NOSIGNAL) != (ssize_t)reply_size) {
+				return;
+			}
+		}
+	}
+};
+
+struct Fixture
+{
+	std::unique_ptr<ipc_connection> ipc_c{new ipc_connection()};
+	MockService service;
+
+	Fixture()
+	{
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+		U_ZERO(ipc_c.get());
+		ipc_c->imc.ipc_handle = fds[0];
+		ipc_c->imc.log_level = U_LOGGING_WARN;
+		ipc_c->log_level = U_LOGGING_WARN;
+		os_mutex_init(&ipc_c->mutex);
+
+		service.fd = fds[1];
+		service.thread = std::thread([this] { service.run(); });
+	}
+
+	~Fixture()
+	{
+		shutdown(ipc_c->imc.ipc_handle, SHUT_RDWR);
+		service.thread.join();
+		close(ipc_c->imc.ipc_handle);
+		close(service.fd);
+		os_mutex_destroy(&ipc_c->mutex);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("ipc_batch")
+{
+	Fixture f;
+	ipc_connection *ipc_c = f.ipc_c.get();
+
+	SECTION("flush")
+	{
+		xrt_space_relation relations[3] = {};
+		xrt_result_t results[3] = {XRT_ERROR_IPC_FAILURE, XRT_ERROR_IPC_FAILURE, XRT_ERROR_IPC_FAILURE};
+
+		for (uint32_t i = 0; i < 3; i++) {
+			CHECK(ipc_batch_device_get_tracked_pose(ipc_c, i, XRT_INPUT_GENERIC_HEAD_POSE, 1000 + i,
+			                                        &relations[i], &results[i]) == XRT_SUCCESS);
+		}
+		CHECK(ipc_batch_device_update_input(ipc_c, 1, NULL) == XRT_SUCCESS);
+
+		// Nothing sent yet.
+		CHECK(relations[2].pose.position.x == 0);
+
+		REQUIRE(ipc_client_batch_flush(ipc_c) == XRT_SUCCESS);
+		CHECK(f.service.round_trips == 1);
+		CHECK(f.service.cmds.size() == 4);
+		CHECK(f.service.cmds.back() == IPC_DEVICE_UPDATE_INPUT);
+
+		for (uint32_t i = 0; i < 3; i++) {
+			CHECK(results[i] == XRT_SUCCESS);
+			CHECK(relations[i].pose.position.x == 1000 + i);
+			CHECK(relations[i].pose.position.y == i);
+		}
+
+		// Empty flush doesn't talk to the service.
+		CHECK(ipc_client_batch_flush(ipc_c) == XRT_SUCCESS);
+		CHECK(f.service.round_trips == 1);
+	}
+
+	SECTION("sent together with the next call")
+	{
+		CHECK(ipc_batch_swapchain_release_image(ipc_c, 3, 0, NULL) == XRT_SUCCESS);
+
+		uint32_t index = 0;
+		CHECK(ipc_call_swapchain_acquire_image(ipc_c, 4, &index) == XRT_SUCCESS);
+		CHECK(index == 5);
+		CHECK(f.service.round_trips == 1);
+		REQUIRE(f.service.cmds.size() == 2);
+		CHECK(f.service.cmds[0] == IPC_SWAPCHAIN_RELEASE_IMAGE);
+		CHECK(f.service.cmds[1] == IPC_SWAPCHAIN_ACQUIRE_IMAGE);
+	}
+
+	SECTION("sent before calls that can't be batched")
+	{
+		CHECK(ipc_batch_swapchain_release_image(ipc_c, 3, 0, NULL) == XRT_SUCCESS);
+		CHECK(ipc_call_session_begin(ipc_c) == XRT_SUCCESS);
+		CHECK(f.service.round_trips == 2);
+		REQUIRE(f.service.cmds.size() == 2);
+		CHECK(f.service.cmds[0] == IPC_SWAPCHAIN_RELEASE_IMAGE);
+		CHECK(f.service.cmds[1] == IPC_SESSION_BEGIN);
+	}
+
+	SECTION("results")
+	{
+		xrt_result_t result = XRT_SUCCESS;
+		CHECK(ipc_batch_swapchain_release_image(ipc_c, 99, 0, &result) == XRT_SUCCESS);
+		// Failures of calls without a result are only logged.
+		CHECK(ipc_batch_swapchain_release_image(ipc_c, 99, 0, NULL) == XRT_SUCCESS);
+
+		uint32_t index = 0;
+		CHECK(ipc_call_swapchain_acquire_image(ipc_c, 4, &index) == XRT_SUCCESS);
+		CHECK(result == XRT_ERROR_NO_IMAGE_AVAILABLE);
+	}
+
+	SECTION("full batches are sent")
+	{
+		const uint32_t count = IPC_BATCH_MAX_CALLS + 8;
+		std::vector<xrt_space_relation> relations(count);
+
+		for (uint32_t i = 0; i < count; i++) {
+			CHECK(ipc_batch_device_get_tracked_pose(ipc_c, i, XRT_INPUT_GENERIC_HEAD_POSE, i, &relations[i],
+			                                        NULL) == XRT_SUCCESS);
+		}
+		REQUIRE(ipc_client_batch_flush(ipc_c) == XRT_SUCCESS);
+
+		CHECK(f.service.round_trips > 1);
+		CHECK(f.service.cmds.size() == count);
+		for (uint32_t i = 0; i < count; i++) {
+			CHECK(relations[i].pose.position.y == i);
+		}
+	}
+}
+
+TEST_CASE("ipc_batch_benchmark", "[.][benchmark]")
+{
+	// The calls of a frame of a client with two swapchains and four poses.
+	const uint32_t swapchain_count = 2;
+	const uint32_t pose_count = 4;
+	const int frame_count = 5000;
+
+	auto report = [&](const char *name, std::vector<uint64_t> &times, int round_trips) {
+		std::sort(times.begin(), times.end());
+		std::cout << name << ": " << (double)round_trips / frame_count << " round trips per frame, p50 "
+		          << times[times.size() / 2] << "ns, p99 " << times[times.size() * 99 / 100] << "ns" << std::endl;
+	};
+
+	{
+		Fixture f;
+		ipc_connection *ipc_c = f.ipc_c.get();
+		std::vector<uint64_t> times;
+
+		for (int frame = 0; frame < frame_count; frame++) {
+			uint64_t start = os_monotonic_get_ns();
+
+			int64_t frame_id;
+			uint64_t wake_up, display_time, display_period;
+			ipc_call_compositor_predict_frame(ipc_c, &frame_id, &wake_up, &display_time, &display_period);
+			ipc_call_compositor_wait_woke(ipc_c, frame_id);
+			ipc_call_compositor_begin_frame(ipc_c, frame_id);
+
+			ipc_call_device_update_input(ipc_c, 0);
+			ipc_call_device_update_input(ipc_c, 1);
+			for (uint32_t i = 0; i < pose_count; i++) {
+				xrt_space_relation relation;
+				ipc_call_device_get_tracked_pose(ipc_c, i, XRT_INPUT_GENERIC_HEAD_POSE, display_time,
+				                                 &relation);
+			}
+
+			for (uint32_t i = 0; i < swapchain_count; i++) {
+				uint32_t index;
+				ipc_call_swapchain_acquire_image(ipc_c, i, &index);
+				ipc_call_swapchain_wait_image(ipc_c, i, UINT64_MAX, index);
+				ipc_call_swapchain_release_image(ipc_c, i, index);
+			}
+
+			uint32_t free_slot_id;
+			ipc_call_compositor_layer_sync_with_semaphore(ipc_c, 0, 0, frame, &free_slot_id);
+
+			times.push_back(os_monotonic_get_ns() - start);
+		}
+
+		report("unbatched", times, f.service.round_trips);
+	}
+
+	{
+		Fixture f;
+		ipc_connection *ipc_c = f.ipc_c.get();
+		std::vector<uint64_t> times;
+
+		for (int frame = 0; frame < frame_count; frame++) {
+			uint64_t start = os_monotonic_get_ns();
+
+			int64_t frame_id;
+			uint64_t wake_up, display_time, display_period;
+			ipc_call_compositor_predict_frame(ipc_c, &frame_id, &wake_up, &display_time, &display_period);
+
+			// Everything up to rendering only depends on the frame id.
+			ipc_batch_compositor_wait_woke(ipc_c, frame_id, NULL);
+			ipc_batch_compositor_begin_frame(ipc_c, frame_id, NULL);
+			ipc_batch_device_update_input(ipc_c, 0, NULL);
+			ipc_batch_device_update_input(ipc_c, 1, NULL);
+			xrt_space_relation relations[pose_count];
+			for (uint32_t i = 0; i < pose_count; i++) {
+				ipc_batch_device_get_tracked_pose(ipc_c, i, XRT_INPUT_GENERIC_HEAD_POSE, display_time,
+				                                  &relations[i], NULL);
+			}
+
+			uint32_t indices[swapchain_count];
+			for (uint32_t i = 0; i < swapchain_count; i++) {
+				ipc_batch_swapchain_acquire_image(ipc_c, i, &indices[i], NULL);
+			}
+			ipc_client_batch_flush(ipc_c);
+
+			for (uint32_t i = 0; i < swapchain_count; i++) {
+				ipc_batch_swapchain_wait_image(ipc_c, i, UINT64_MAX, indices[i], NULL);
+			}
+			ipc_client_batch_flush(ipc_c);
+
+			// Releases go with the layer sync.
+			for (uint32_t i = 0; i < swapchain_count; i++) {
+				ipc_batch_swapchain_release_image(ipc_c, i, indices[i], NULL);
+			}
+
+			uint32_t free_slot_id;
+			ipc_call_compositor_layer_sync_with_semaphore(ipc_c, 0, 0, frame, &free_slot_id);
+
+			times.push_back(os_monotonic_get_ns() - start);
+		}
+
+		report("batched", times, f.service.round_trips);
+	}
+}
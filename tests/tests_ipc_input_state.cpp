@@ -0,0 +1,290 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief IPC shared memory input publication tests.
+ */
+
+#include "os/os_time.h"
+
+#include "shared/ipc_input_state.h"
+#include "shared/ipc_shared_layout.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+// Laid out like the service does it, devices one after the other.
+struct shm
+{
+	ipc_shared_memory *ism = nullptr;
+
+	shm(uint32_t device_count, uint32_t input_count)
+	{
+		ipc_shared_counts counts = {};
+		counts.inputs = device_count * input_count;
+		counts.input_dirty_words = device_count * IPC_INPUT_DIRTY_WORD_COUNT(input_count);
+
+		ipc_shared_layout layout = {};
+		REQUIRE(ipc_shared_layout_init(&layout, &counts));
+		ism = (ipc_shared_memory *)aligned_alloc(IPC_SHARED_ARRAY_ALIGNMENT, (size_t)layout.size);
+		memset((void *)ism, 0, (size_t)layout.size);
+		ism->layout = layout;
+
+		ism->isdev_count = device_count;
+		for (uint32_t d = 0; d < device_count; d++) {
+			ism->isdevs[d].input_count = input_count;
+			ism->isdevs[d].first_input_index = d * input_count;
+			ism->isdevs[d].first_input_dirty_index = d * IPC_INPUT_DIRTY_WORD_COUNT(input_count);
+		}
+	}
+
+	~shm()
+	{
+		free(ism);
+	}
+};
+
+std::vector<xrt_input>
+make_inputs(uint32_t count)
+{
+	std::vector<xrt_input> inputs(count);
+	for (uint32_t i = 0; i < count; i++) {
+		inputs[i] = {};
+		inputs[i].active = true;
+		inputs[i].name = (xrt_input_name)((i + 1) << XRT_INPUT_TYPE_BITWIDTH);
+	}
+	inputs[0].name = XRT_INPUT_GENERIC_HEAD_POSE;
+	return inputs;
+}
+
+bool
+same(const xrt_input &a, const xrt_input &b)
+{
+	return a.active == b.active && a.timestamp == b.timestamp && a.name == b.name &&
+	       memcmp(&a.value, &b.value, sizeof(a.value)) == 0;
+}
+
+bool
+same(const std::vector<xrt_input> &a, const std::vector<xrt_input> &b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), [](const xrt_input &x, const xrt_input &y) { return same(x, y); });
+}
+
+} // namespace
+
+
+TEST_CASE("ipc_input_state")
+{
+	const uint32_t input_count = 70; // More than one bitmap word.
+	shm s(2, input_count);
+	ipc_shared_memory *ism = s.ism;
+
+	std::vector<xrt_input> src = make_inputs(input_count);
+	std::vector<xrt_input> dst(input_count);
+
+	CHECK(ipc_input_state_publish(ism, 1, src.data(), true) == input_count);
+	uint64_t generation = ipc_input_state_read_all(ism, 1, dst.data());
+	CHECK(generation == 2);
+	CHECK(same(src, dst));
+
+	// The other device is left alone.
+	CHECK(ism->isdevs[0].input_generation == 0);
+
+	SECTION("nothing changed")
+	{
+		CHECK(ipc_input_state_publish(ism, 1, src.data(), true) == 0);
+		CHECK(ism->isdevs[1].input_generation == 2);
+		CHECK(ipc_input_state_read(ism, 1, dst.data(), &generation) == 0);
+	}
+
+	SECTION("only changed inputs are copied")
+	{
+		src[3].value.vec1.x = 1.0f;
+		src[66].timestamp = 10;
+		CHECK(ipc_input_state_publish(ism, 1, src.data(), true) == 2);
+
+		const uint64_t *dirty = &ipc_shared_memory_input_dirty(ism)[ism->isdevs[1].first_input_dirty_index];
+		CHECK(dirty[0] == (1ull << 3));
+		CHECK(dirty[1] == (1ull << 2));
+
+		CHECK(ipc_input_state_read(ism, 1, dst.data(), &generation) == 2);
+		CHECK(generation == 4);
+		CHECK(same(src, dst));
+	}
+
+	SECTION("missed updates")
+	{
+		src[3].value.vec1.x = 1.0f;
+		ipc_input_state_publish(ism, 1, src.data(), true);
+		src[5].value.boolean = true;
+		ipc_input_state_publish(ism, 1, src.data(), true);
+
+		// The bitmap only has the last one, the generations have both.
+		CHECK(ipc_input_state_read(ism, 1, dst.data(), &generation) == 2);
+		CHECK(generation == 6);
+		CHECK(same(src, dst));
+	}
+
+	SECTION("update being written")
+	{
+		// The service stopped halfway through an update, nothing is taken from it.
+		ism->isdevs[1].input_generation = 3;
+		CHECK(ipc_input_state_read(ism, 1, dst.data(), &generation) == 0);
+		CHECK(generation == 2);
+
+		ism->isdevs[1].input_generation = 2;
+		src[3].value.vec1.x = 1.0f;
+		ipc_input_state_publish(ism, 1, src.data(), true);
+		CHECK(ipc_input_state_read(ism, 1, dst.data(), &generation) == 1);
+		CHECK(generation == 4);
+		CHECK(same(src, dst));
+	}
+
+	SECTION("io inactive")
+	{
+		src[0].active = true;
+		src[2].value.boolean = true;
+		CHECK(ipc_input_state_publish(ism, 1, src.data(), false) == input_count - 1);
+		ipc_input_state_read(ism, 1, dst.data(), &generation);
+
+		CHECK(dst[0].active);
+		CHECK(dst[0].name == XRT_INPUT_GENERIC_HEAD_POSE);
+		CHECK_FALSE(dst[2].active);
+		CHECK_FALSE(dst[2].value.boolean);
+		CHECK(dst[2].name == src[2].name);
+
+		// Back on.
+		ipc_input_state_publish(ism, 1, src.data(), true);
+		ipc_input_state_read(ism, 1, dst.data(), &generation);
+		CHECK(same(src, dst));
+	}
+}
+
+TEST_CASE("ipc_input_state_concurrent")
+{
+	// Readers racing the service must end up with the same inputs once it stops.
+	const uint32_t input_count = 40;
+	shm s(1, input_count);
+	ipc_shared_memory *ism = s.ism;
+
+	std::vector<xrt_input> src = make_inputs(input_count);
+	ipc_input_state_publish(ism, 0, src.data(), true);
+
+	std::atomic<bool> running{true};
+	std::thread writer([&] {
+		for (int64_t k = 1; k < 20000; k++) {
+			// A few inputs change each update, like buttons and a pose.
+			for (uint32_t i = 0; i < 3; i++) {
+				src[(k * 7 + i * 13) % input_count].timestamp = k;
+			}
+			ipc_input_state_publish(ism, 0, src.data(), true);
+		}
+		running = false;
+	});
+
+	std::vector<std::thread> readers;
+	std::atomic<int> mismatches{0};
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&] {
+			std::vector<xrt_input> dst(input_count);
+			uint64_t generation = ipc_input_state_read_all(ism, 0, dst.data());
+			while (running) {
+				ipc_input_state_read(ism, 0, dst.data(), &generation);
+			}
+			ipc_input_state_read(ism, 0, dst.data(), &generation);
+
+			const xrt_input *shared = &ipc_shared_memory_inputs(ism)[0];
+			for (uint32_t i = 0; i < input_count; i++) {
+				if (!same(dst[i], shared[i])) {
+					mismatches++;
+				}
+			}
+		});
+	}
+
+	writer.join();
+	for (auto &reader : readers) {
+		reader.join();
+	}
+
+	CHECK(mismatches == 0);
+}
+
+TEST_CASE("ipc_input_state_benchmark", "[.][benchmark]")
+{
+	// Eight clients syncing six devices each frame, a few inputs change per
+	// device and frame. Against the full copy into the shared memory that the
+	// service did before, clients then read all of the inputs.
+	const uint32_t client_count = 8;
+	const uint32_t device_count = 6;
+	const uint32_t input_count = 48;
+	const uint32_t frame_count = 2000;
+
+	shm s(device_count, input_count);
+	ipc_shared_memory *ism = s.ism;
+
+	std::vector<std::vector<xrt_input>> devices(device_count, make_inputs(input_count));
+	std::vector<std::vector<std::vector<xrt_input>>> clients(
+	    client_count, std::vector<std::vector<xrt_input>>(device_count, std::vector<xrt_input>(input_count)));
+	std::vector<std::vector<uint64_t>> generations(client_count, std::vector<uint64_t>(device_count));
+
+	auto change = [&](uint32_t frame) {
+		for (uint32_t d = 0; d < device_count; d++) {
+			for (uint32_t i = 0; i < 3; i++) {
+				devices[d][(frame * 5 + i * 11 + d) % input_count].timestamp = frame;
+			}
+		}
+	};
+
+	uint64_t full_written = 0;
+	uint64_t start = os_monotonic_get_ns();
+	for (uint32_t f = 0; f < frame_count; f++) {
+		change(f);
+		for (uint32_t c = 0; c < client_count; c++) {
+			for (uint32_t d = 0; d < device_count; d++) {
+				xrt_input *shared = &ipc_shared_memory_inputs(ism)[ism->isdevs[d].first_input_index];
+				memcpy(shared, devices[d].data(), sizeof(xrt_input) * input_count);
+				memcpy(clients[c][d].data(), shared, sizeof(xrt_input) * input_count);
+				full_written += sizeof(xrt_input) * input_count;
+			}
+		}
+	}
+	uint64_t full_ns = os_monotonic_get_ns() - start;
+
+	uint64_t delta_written = 0;
+	uint64_t copied = 0;
+	start = os_monotonic_get_ns();
+	for (uint32_t f = 0; f < frame_count; f++) {
+		change(f + frame_count);
+		for (uint32_t c = 0; c < client_count; c++) {
+			for (uint32_t d = 0; d < device_count; d++) {
+				uint32_t changed = ipc_input_state_publish(ism, d, devices[d].data(), true);
+				delta_written += changed * (sizeof(xrt_input) + sizeof(uint64_t));
+				copied += ipc_input_state_read(ism, d, clients[c][d].data(), &generations[c][d]);
+			}
+		}
+	}
+	uint64_t delta_ns = os_monotonic_get_ns() - start;
+
+	for (uint32_t c = 0; c < client_count; c++) {
+		for (uint32_t d = 0; d < device_count; d++) {
+			CHECK(same(clients[c][d], devices[d]));
+		}
+	}
+
+	const uint64_t syncs = (uint64_t)frame_count * client_count;
+	std::cout << "full copy: " << full_ns / syncs << "ns per sync, " << full_written / frame_count
+	          << " bytes written per frame" << std::endl;
+	std::cout << "changed only: " << delta_ns / syncs << "ns per sync, " << delta_written / frame_count
+	          << " bytes written per frame, " << copied / syncs << " inputs read per sync" << std::endl;
+}
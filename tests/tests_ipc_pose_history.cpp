@@ -0,0 +1,269 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief IPC shared memory pose history tests.
+ */
+
+#include "xrt/xrt_config_os.h"
+
+#include "os/os_time.h"
+#include "util/u_time.h"
+
+#include "shared/ipc_pose_history.h"
+#include "shared/ipc_utils.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifndef XRT_OS_WINDOWS
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+constexpr uint64_t interval_ns = 2 * U_TIME_1MS_IN_NS;
+constexpr uint64_t horizon_ns = 50 * U_TIME_1MS_IN_NS;
+constexpr uint64_t max_age_ns = interval_ns * IPC_POSE_HISTORY_MAX_AGE_INTERVALS;
+
+constexpr xrt_space_relation_flags all_flags = (xrt_space_relation_flags)( //
+    XRT_SPACE_RELATION_ORIENTATION_VALID_BIT |                             //
+    XRT_SPACE_RELATION_POSITION_VALID_BIT |                                //
+    XRT_SPACE_RELATION_ORIENTATION_TRACKED_BIT |                           //
+    XRT_SPACE_RELATION_POSITION_TRACKED_BIT);                              //
+
+// Moves along x at 1 m/s, so the position tells the time it was sampled at.
+ipc_shared_pose_sample
+make_sample(uint64_t timestamp_ns)
+{
+	ipc_shared_pose_sample sample = {};
+	sample.timestamp_ns = timestamp_ns;
+	sample.relation.relation_flags = all_flags;
+	sample.relation.pose.orientation.w = 1;
+	sample.relation.pose.position.x = (float)time_ns_to_s(timestamp_ns % U_TIME_1S_IN_NS);
+	sample.origin.relation_flags = all_flags;
+	sample.origin.pose.orientation.w = 1;
+	sample.origin.pose.position.y = 1;
+	return sample;
+}
+
+void
+push(ipc_shared_pose_history &iph, uint64_t timestamp_ns)
+{
+	ipc_shared_pose_sample sample = make_sample(timestamp_ns);
+	ipc_shared_pose_sample predicted = make_sample(timestamp_ns + horizon_ns);
+	ipc_pose_history_push(&iph, true, &sample, &predicted);
+}
+
+} // namespace
+
+
+TEST_CASE("ipc_pose_history")
+{
+	auto iph = std::make_unique<ipc_shared_pose_history>();
+	iph->type = IPC_POSE_HISTORY_TYPE_DEVICE_INPUT;
+	xrt_space_relation relation = {};
+	xrt_space_relation origin = {};
+
+	const uint64_t start = 10ull * U_TIME_1S_IN_NS;
+
+	// Nothing sampled yet.
+	CHECK_FALSE(ipc_pose_history_locate(iph.get(), start, start, max_age_ns, &relation, nullptr));
+	// Reading asks the service to sample it.
+	CHECK(iph->last_read_ns == start);
+
+	for (int i = 0; i < 100; i++) {
+		push(*iph, start + i * interval_ns);
+	}
+	CHECK(iph->sample_count == IPC_SHARED_POSE_HISTORY_SIZE);
+	CHECK(iph->seq % 2 == 0);
+
+	const uint64_t newest = start + 99 * interval_ns;
+	const uint64_t now = newest + interval_ns / 2;
+
+	SECTION("interpolates between samples")
+	{
+		uint64_t at = newest - 3 * interval_ns - interval_ns / 4;
+		REQUIRE(ipc_pose_history_locate(iph.get(), at, now, max_age_ns, &relation, &origin));
+		CHECK(relation.pose.position.x == Approx(time_ns_to_s(at % U_TIME_1S_IN_NS)));
+		CHECK(relation.relation_flags == all_flags);
+		CHECK(origin.pose.position.y == Approx(1));
+	}
+
+	SECTION("interpolates towards the prediction")
+	{
+		uint64_t at = newest + 20 * U_TIME_1MS_IN_NS;
+		REQUIRE(ipc_pose_history_locate(iph.get(), at, now, max_age_ns, &relation, nullptr));
+		CHECK(relation.pose.position.x == Approx(time_ns_to_s(at % U_TIME_1S_IN_NS)));
+	}
+
+	SECTION("outside of the history")
+	{
+		uint64_t oldest = newest - (IPC_SHARED_POSE_HISTORY_SIZE - 1) * interval_ns;
+		CHECK(ipc_pose_history_locate(iph.get(), oldest, now, max_age_ns, &relation, nullptr));
+		CHECK_FALSE(ipc_pose_history_locate(iph.get(), oldest - 1, now, max_age_ns, &relation, nullptr));
+		CHECK_FALSE(
+		    ipc_pose_history_locate(iph.get(), newest + horizon_ns + 1, now, max_age_ns, &relation, nullptr));
+	}
+
+	SECTION("stale")
+	{
+		uint64_t later = newest + max_age_ns + 1;
+		CHECK_FALSE(ipc_pose_history_locate(iph.get(), later, later, max_age_ns, &relation, nullptr));
+	}
+}
+
+TEST_CASE("ipc_pose_history_find")
+{
+	auto ism = std::make_unique<ipc_shared_memory>();
+	ism->poses.history_count = 3;
+	ism->poses.histories[0].type = IPC_POSE_HISTORY_TYPE_DEVICE_INPUT;
+	ism->poses.histories[0].device_id = 1;
+	ism->poses.histories[0].name = XRT_INPUT_GENERIC_HEAD_POSE;
+	ism->poses.histories[1].type = IPC_POSE_HISTORY_TYPE_DEVICE_INPUT;
+	ism->poses.histories[1].device_id = 2;
+	ism->poses.histories[1].name = XRT_INPUT_SIMPLE_GRIP_POSE;
+	ism->poses.histories[2].type = IPC_POSE_HISTORY_TYPE_LOCAL;
+
+	ipc_shared_memory *p = ism.get();
+	CHECK(ipc_pose_history_find(p, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, 2, XRT_INPUT_SIMPLE_GRIP_POSE) ==
+	      &p->poses.histories[1]);
+	CHECK(ipc_pose_history_find(p, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, 2, XRT_INPUT_SIMPLE_AIM_POSE) == nullptr);
+	CHECK(ipc_pose_history_find(p, IPC_POSE_HISTORY_TYPE_DEVICE_INPUT, 1, (xrt_input_name)0) ==
+	      &p->poses.histories[0]);
+	CHECK(ipc_pose_history_find(p, IPC_POSE_HISTORY_TYPE_LOCAL, 0, (xrt_input_name)0) == &p->poses.histories[2]);
+	CHECK(ipc_pose_history_find(p, IPC_POSE_HISTORY_TYPE_STAGE, 0, (xrt_input_name)0) == nullptr);
+}
+
+TEST_CASE("ipc_pose_history_concurrent")
+{
+	// A writer at a much higher rate than the service, readers must never see
+	// a sample that doesn't match its timestamp.
+	auto iph = std::make_unique<ipc_shared_pose_history>();
+	std::atomic<bool> running{true};
+	std::atomic<uint64_t> clock{U_TIME_1S_IN_NS};
+
+	push(*iph, clock);
+
+	std::thread writer([&] {
+		while (running) {
+			push(*iph, clock += interval_ns);
+		}
+	});
+
+	std::vector<std::thread> readers;
+	std::atomic<int> located{0};
+	std::atomic<int> mismatches{0};
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&] {
+			for (int i = 0; i < 20000; i++) {
+				uint64_t now = clock;
+				uint64_t at = now - interval_ns * 3;
+				xrt_space_relation relation = {};
+				if (!ipc_pose_history_locate(iph.get(), at, now, UINT64_MAX / 2, &relation, nullptr)) {
+					continue;
+				}
+				located++;
+				float expected = (float)time_ns_to_s(at % U_TIME_1S_IN_NS);
+				if (std::abs(relation.pose.position.x - expected) > 1e-4) {
+					mismatches++;
+				}
+			}
+		});
+	}
+
+	for (auto &reader : readers) {
+		reader.join();
+	}
+	running = false;
+	writer.join();
+
+	CAPTURE(located);
+	CHECK(located > 0);
+	CHECK(mismatches == 0);
+}
+
+#ifndef XRT_OS_WINDOWS
+
+TEST_CASE("ipc_pose_history_benchmark", "[.][benchmark]")
+{
+	// Shared memory against a round trip to a thread standing in for the
+	// service's per client thread, same message sizes as the device call.
+	struct request
+	{
+		uint32_t cmd;
+		uint32_t id;
+		xrt_input_name name;
+		uint64_t at_timestamp_ns;
+	};
+	struct reply
+	{
+		xrt_result_t result;
+		xrt_space_relation relation;
+	};
+
+	auto iph = std::make_unique<ipc_shared_pose_history>();
+	uint64_t now = os_monotonic_get_ns();
+	for (int i = IPC_SHARED_POSE_HISTORY_SIZE; i >= 0; i--) {
+		push(*iph, now - i * interval_ns);
+	}
+
+	int fds[2];
+	REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	ipc_message_channel client = {fds[0], U_LOGGING_WARN};
+	ipc_message_channel service = {fds[1], U_LOGGING_WARN};
+
+	std::thread service_thread([&] {
+		request req;
+		while (ipc_receive(&service, &req, sizeof(req)) == XRT_SUCCESS) {
+			reply rep = {};
+			rep.result = XRT_SUCCESS;
+			ipc_pose_history_locate(iph.get(), req.at_timestamp_ns, os_monotonic_get_ns(), UINT64_MAX / 2,
+			                        &rep.relation, nullptr);
+			ipc_send(&service, &rep, sizeof(rep));
+		}
+	});
+
+	const int count = 20000;
+	auto report = [&](const char *name, std::vector<uint64_t> &times) {
+		std::sort(times.begin(), times.end());
+		std::cout << name << ": p50 " << times[times.size() / 2] << "ns, p99 " << times[times.size() * 99 / 100]
+		          << "ns" << std::endl;
+	};
+
+	std::vector<uint64_t> round_trip;
+	for (int i = 0; i < count; i++) {
+		uint64_t start = os_monotonic_get_ns();
+		request req = {1, 0, XRT_INPUT_GENERIC_HEAD_POSE, now + 10 * U_TIME_1MS_IN_NS};
+		reply rep;
+		ipc_send(&client, &req, sizeof(req));
+		ipc_receive(&client, &rep, sizeof(rep));
+		round_trip.push_back(os_monotonic_get_ns() - start);
+	}
+	report("round trip", round_trip);
+
+	std::vector<uint64_t> shared;
+	for (int i = 0; i < count; i++) {
+		uint64_t start = os_monotonic_get_ns();
+		xrt_space_relation relation;
+		CHECK(ipc_pose_history_locate(iph.get(), now + 10 * U_TIME_1MS_IN_NS, now, UINT64_MAX / 2, &relation,
+		                              nullptr));
+		shared.push_back(os_monotonic_get_ns() - start);
+	}
+	report("shared memory", shared);
+
+	shutdown(fds[0], SHUT_RDWR);
+	service_thread.join();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+#endif // !XRT_OS_WINDOWS
@@ -0,0 +1,343 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief IPC reactor tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_time.h"
+
+#include "shared/ipc_reactor.h"
+#include "shared/ipc_utils.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+namespace {
+
+enum mock_cmd : uint32_t
+{
+	MOCK_ECHO = 1,
+	//! Parked until released or timed out.
+	MOCK_WAIT = 2,
+};
+
+struct mock_request
+{
+	uint32_t cmd;
+	uint32_t value;
+	uint64_t timeout_ns;
+};
+
+struct mock_reply
+{
+	uint32_t value;
+};
+
+struct mock_service
+{
+	std::atomic<bool> released{false};
+	std::atomic<int> disconnected{0};
+	std::atomic<int> failures{0};
+};
+
+// The reactor client comes first, so the callbacks can get back to it.
+struct mock_client
+{
+	ipc_reactor_client rc;
+	mock_service *service;
+	ipc_message_channel imc;
+};
+
+void
+finish(mock_client *mc, uint32_t value)
+{
+	mock_reply reply = {value};
+	if (ipc_send(&mc->imc, &reply, sizeof(reply)) != XRT_SUCCESS || ipc_reactor_rearm(&mc->rc) < 0) {
+		mc->service->failures++;
+	}
+}
+
+bool
+parked(ipc_reactor_client *rc, bool timed_out)
+{
+	mock_client *mc = reinterpret_cast<mock_client *>(rc);
+	if (mc->service->released) {
+		finish(mc, 1);
+		return true;
+	}
+	if (timed_out) {
+		finish(mc, 0);
+		return true;
+	}
+	return false;
+}
+
+void
+ready(ipc_reactor_client *rc)
+{
+	mock_client *mc = reinterpret_cast<mock_client *>(rc);
+
+	mock_request req;
+	if (rc->hangup || recv(rc->fd, &req, sizeof(req), 0) != (ssize_t)sizeof(req)) {
+		ipc_reactor_remove(rc);
+		mc->service->disconnected++;
+		return;
+	}
+
+	if (req.cmd == MOCK_WAIT) {
+		ipc_reactor_park(rc, os_monotonic_get_ns() + req.timeout_ns, parked);
+		return;
+	}
+
+	finish(mc, req.value + 1);
+}
+
+// One connection, the service end is added to the reactor.
+struct connection
+{
+	int fds[2] = {-1, -1};
+	ipc_message_channel client = {-1, U_LOGGING_WARN};
+	mock_client mc = {};
+
+	connection(ipc_reactor *r, mock_service *service)
+	{
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		client.ipc_handle = fds[0];
+		mc.service = service;
+		mc.imc = {fds[1], U_LOGGING_WARN};
+		if (r != nullptr) {
+			REQUIRE(ipc_reactor_add(r, &mc.rc, fds[1], ready) == 0);
+		}
+	}
+
+	~connection()
+	{
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	void
+	hang_up()
+	{
+		shutdown(fds[0], SHUT_RDWR);
+	}
+
+	uint32_t
+	call(uint32_t cmd, uint32_t value, uint64_t timeout_ns = 0)
+	{
+		mock_request req = {cmd, value, timeout_ns};
+		mock_reply reply = {UINT32_MAX};
+		if (ipc_send(&client, &req, sizeof(req)) != XRT_SUCCESS ||
+		    ipc_receive(&client, &reply, sizeof(reply)) != XRT_SUCCESS) {
+			return UINT32_MAX;
+		}
+		return reply.value;
+	}
+};
+
+bool
+wait_for(const std::atomic<int> &counter, int value)
+{
+	uint64_t deadline = os_monotonic_get_ns() + U_TIME_1S_IN_NS;
+	while (counter < value && os_monotonic_get_ns() < deadline) {
+		os_nanosleep(U_TIME_1MS_IN_NS);
+	}
+	return counter >= value;
+}
+
+} // namespace
+
+
+TEST_CASE("ipc_reactor")
+{
+	mock_service service;
+	ipc_reactor *r = nullptr;
+
+	SECTION("calls from many clients")
+	{
+		REQUIRE(ipc_reactor_create(2, "Test", &r) == 0);
+		std::vector<std::unique_ptr<connection>> conns;
+		for (int i = 0; i < 16; i++) {
+			conns.emplace_back(std::make_unique<connection>(r, &service));
+		}
+
+		for (uint32_t k = 0; k < 10; k++) {
+			for (auto &c : conns) {
+				CHECK(c->call(MOCK_ECHO, k) == k + 1);
+			}
+		}
+
+		ipc_reactor_destroy(&r);
+		CHECK(r == nullptr);
+	}
+
+	SECTION("more ready clients than the pool holds tasks")
+	{
+		REQUIRE(ipc_reactor_create(1, "Test", &r) == 0);
+		std::vector<std::unique_ptr<connection>> conns;
+		for (int i = 0; i < 100; i++) {
+			conns.emplace_back(std::make_unique<connection>(r, &service));
+		}
+
+		// All ready at once, the ones past the limit wait on the reactor.
+		for (uint32_t k = 0; k < conns.size(); k++) {
+			mock_request req = {MOCK_ECHO, k, 0};
+			REQUIRE(ipc_send(&conns[k]->client, &req, sizeof(req)) == XRT_SUCCESS);
+		}
+		for (uint32_t k = 0; k < conns.size(); k++) {
+			mock_reply reply = {UINT32_MAX};
+			REQUIRE(ipc_receive(&conns[k]->client, &reply, sizeof(reply)) == XRT_SUCCESS);
+			CHECK(reply.value == k + 1);
+		}
+
+		ipc_reactor_destroy(&r);
+	}
+
+	SECTION("parked call doesn't hold on to the only worker")
+	{
+		REQUIRE(ipc_reactor_create(1, "Test", &r) == 0);
+		connection waiter(r, &service);
+		connection other(r, &service);
+
+		std::atomic<uint32_t> waited{UINT32_MAX};
+		std::thread t([&] { waited = waiter.call(MOCK_WAIT, 0, 10ull * U_TIME_1S_IN_NS); });
+
+		for (uint32_t k = 0; k < 100; k++) {
+			CHECK(other.call(MOCK_ECHO, k) == k + 1);
+		}
+		CHECK(waited == UINT32_MAX);
+
+		service.released = true;
+		t.join();
+		CHECK(waited == 1);
+
+		// Back to normal calls after being parked.
+		CHECK(waiter.call(MOCK_ECHO, 7) == 8);
+
+		ipc_reactor_destroy(&r);
+	}
+
+	SECTION("parked call times out")
+	{
+		REQUIRE(ipc_reactor_create(1, "Test", &r) == 0);
+		connection c(r, &service);
+
+		uint64_t start = os_monotonic_get_ns();
+		CHECK(c.call(MOCK_WAIT, 0, 20 * U_TIME_1MS_IN_NS) == 0);
+		CHECK(os_monotonic_get_ns() - start >= 20 * U_TIME_1MS_IN_NS);
+
+		ipc_reactor_destroy(&r);
+	}
+
+	SECTION("hang up")
+	{
+		REQUIRE(ipc_reactor_create(2, "Test", &r) == 0);
+		connection a(r, &service);
+		connection b(r, &service);
+
+		CHECK(a.call(MOCK_ECHO, 1) == 2);
+		a.hang_up();
+		CHECK(wait_for(service.disconnected, 1));
+		CHECK(b.call(MOCK_ECHO, 2) == 3);
+
+		ipc_reactor_destroy(&r);
+	}
+
+	CHECK(service.failures == 0);
+}
+
+TEST_CASE("ipc_reactor_benchmark", "[.][benchmark]")
+{
+	// Hundreds of connected clients making calls from a few threads, against
+	// a thread per connection like the service does without the reactor.
+	const int connection_count = 256;
+	const int driver_count = 8;
+	const int rounds = 50;
+
+	auto run = [&](const char *name, bool use_reactor) {
+		mock_service service;
+		ipc_reactor *r = nullptr;
+		if (use_reactor) {
+			REQUIRE(ipc_reactor_create(4, "Bench", &r) == 0);
+		}
+
+		std::vector<std::unique_ptr<connection>> conns;
+		for (int i = 0; i < connection_count; i++) {
+			conns.emplace_back(std::make_unique<connection>(r, &service));
+		}
+
+		std::vector<std::thread> servers;
+		if (!use_reactor) {
+			for (auto &c : conns) {
+				mock_client *mc = &c->mc;
+				servers.emplace_back([mc] {
+					// Plain recv, the hang up at the end isn't an error.
+					mock_request req;
+					while (recv(mc->imc.ipc_handle, &req, sizeof(req), 0) == (ssize_t)sizeof(req)) {
+						mock_reply reply = {req.value + 1};
+						ipc_send(&mc->imc, &reply, sizeof(reply));
+					}
+				});
+			}
+		}
+
+		std::vector<std::vector<uint64_t>> times(driver_count);
+		std::atomic<int> wrong{0};
+		std::vector<std::thread> drivers;
+
+		uint64_t start = os_monotonic_get_ns();
+		for (int d = 0; d < driver_count; d++) {
+			drivers.emplace_back([&, d] {
+				for (int k = 0; k < rounds; k++) {
+					for (int i = d; i < connection_count; i += driver_count) {
+						uint64_t before = os_monotonic_get_ns();
+						if (conns[i]->call(MOCK_ECHO, k) != (uint32_t)k + 1) {
+							wrong++;
+						}
+						times[d].push_back(os_monotonic_get_ns() - before);
+					}
+				}
+			});
+		}
+		for (auto &t : drivers) {
+			t.join();
+		}
+		uint64_t total = os_monotonic_get_ns() - start;
+
+		for (auto &c : conns) {
+			c->hang_up();
+		}
+		for (auto &t : servers) {
+			t.join();
+		}
+		ipc_reactor_destroy(&r);
+
+		std::vector<uint64_t> all;
+		for (auto &v : times) {
+			all.insert(all.end(), v.begin(), v.end());
+		}
+		std::sort(all.begin(), all.end());
+
+		std::cout << name << ": " << connection_count << " clients, p50 " << all[all.size() / 2] << "ns, p99 "
+		          << all[all.size() * 99 / 100] << "ns, " << all.size() * U_TIME_1S_IN_NS / total
+		          << " calls/s" << std::endl;
+
+		CHECK(wrong == 0);
+		CHECK(service.failures == 0);
+	};
+
+	run("thread per client", false);
+	run("reactor", true);
+}
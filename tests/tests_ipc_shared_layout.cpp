@@ -0,0 +1,263 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief IPC shared memory layout tests.
+ */
+
+#include "shared/ipc_shared_layout.h"
+#include "shared/ipc_shmem.h"
+
+#include "catch/catch.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+constexpr uint32_t client_count = 40;
+constexpr uint32_t slot_count = 2;
+constexpr uint32_t frame_count = 200;
+
+// A HMD and two controllers with a few bindings each.
+ipc_shared_counts
+typical_counts()
+{
+	ipc_shared_counts counts = {};
+	counts.inputs = 2 + 2 * 12;
+	counts.outputs = 2;
+	counts.binding_profiles = 2 * 4;
+	counts.input_pairs = 2 * 4 * 10;
+	counts.output_pairs = 2 * 4;
+	counts.input_dirty_words = 3;
+	return counts;
+}
+
+bool
+overlaps(const ipc_shared_array &a, const ipc_shared_array &b, size_t size_a, size_t size_b)
+{
+	return a.offset < b.offset + b.count * size_b && b.offset < a.offset + a.count * size_a;
+}
+
+struct service_shm
+{
+	xrt_shmem_handle_t handle = XRT_SHMEM_HANDLE_INVALID;
+	ipc_shared_memory *ism = nullptr;
+	size_t size = 0;
+
+	service_shm(const ipc_shared_counts &counts)
+	{
+		ipc_shared_layout layout = {};
+		REQUIRE(ipc_shared_layout_init(&layout, &counts));
+		size = (size_t)layout.size;
+		REQUIRE(ipc_shmem_create(size, &handle, (void **)&ism) == XRT_SUCCESS);
+		ism->layout = layout;
+
+		// One device with all of the inputs.
+		ism->isdev_count = 1;
+		ism->isdevs[0].input_count = counts.inputs;
+		ism->isdevs[0].first_input_index = 0;
+		for (uint32_t i = 0; i < counts.inputs; i++) {
+			ipc_shared_memory_inputs(ism)[i].name = (xrt_input_name)(i + 1);
+		}
+	}
+
+	~service_shm()
+	{
+		ipc_shmem_destroy(&handle, (void **)&ism, size);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("ipc_shared_layout")
+{
+	ipc_shared_counts counts = typical_counts();
+	ipc_shared_layout layout = {};
+	REQUIRE(ipc_shared_layout_init(&layout, &counts));
+
+	CHECK(layout.version == IPC_SHARED_LAYOUT_VERSION);
+	CHECK(layout.inputs.count == counts.inputs);
+	CHECK(layout.output_pairs.count == counts.output_pairs);
+	CHECK(layout.inputs.offset >= sizeof(ipc_shared_memory));
+	CHECK(layout.size % IPC_SHARED_ARRAY_ALIGNMENT == 0);
+
+	const ipc_shared_array *arrays[] = {
+	    &layout.inputs,
+	    &layout.outputs,
+	    &layout.binding_profiles,
+	    &layout.input_pairs,
+	    &layout.output_pairs,
+	    &layout.input_generations,
+	    &layout.input_dirty,
+	};
+	const size_t sizes[] = {
+	    sizeof(xrt_input),
+	    sizeof(xrt_output),
+	    sizeof(ipc_shared_binding_profile),
+	    sizeof(xrt_binding_input_pair),
+	    sizeof(xrt_binding_output_pair),
+	    sizeof(uint64_t),
+	    sizeof(uint64_t),
+	};
+	const size_t array_count = sizeof(sizes) / sizeof(sizes[0]);
+	CHECK(layout.input_generations.count == counts.inputs);
+	for (size_t i = 0; i < array_count; i++) {
+		CAPTURE(i);
+		CHECK(arrays[i]->offset % IPC_SHARED_ARRAY_ALIGNMENT == 0);
+		CHECK(arrays[i]->offset + arrays[i]->count * sizes[i] <= layout.size);
+		for (size_t k = i + 1; k < array_count; k++) {
+			CHECK_FALSE(overlaps(*arrays[i], *arrays[k], sizes[i], sizes[k]));
+		}
+	}
+
+	service_shm shm(counts);
+	ipc_shared_memory *ism = shm.ism;
+	CHECK(ipc_shared_layout_validate(ism, shm.size));
+	CHECK(ipc_shared_memory_inputs(ism)[3].name == (xrt_input_name)4);
+
+	SECTION("size must match")
+	{
+		CHECK_FALSE(ipc_shared_layout_validate(ism, shm.size - IPC_SHARED_ARRAY_ALIGNMENT));
+		CHECK_FALSE(ipc_shared_layout_validate(ism, sizeof(ipc_shared_memory) - 1));
+	}
+
+	SECTION("version must match")
+	{
+		ism->layout.version++;
+		CHECK_FALSE(ipc_shared_layout_validate(ism, shm.size));
+	}
+
+	SECTION("arrays must be within the shared memory")
+	{
+		ism->layout.outputs.count = UINT32_MAX;
+		CHECK_FALSE(ipc_shared_layout_validate(ism, shm.size));
+	}
+
+	SECTION("devices must index within the arrays")
+	{
+		ism->isdevs[0].first_input_index = 1;
+		CHECK_FALSE(ipc_shared_layout_validate(ism, shm.size));
+	}
+
+	SECTION("bindings must index within the arrays")
+	{
+		ipc_shared_binding_profile *isbp = &ipc_shared_memory_binding_profiles(ism)[1];
+		isbp->first_input_index = counts.input_pairs - 1;
+		isbp->input_count = 2;
+		CHECK_FALSE(ipc_shared_layout_validate(ism, shm.size));
+	}
+}
+
+TEST_CASE("ipc_shared_slots")
+{
+	size_t size = ipc_shared_slots_size(slot_count);
+	CHECK(size == sizeof(ipc_shared_slots) + slot_count * sizeof(ipc_layer_slot));
+
+	std::vector<uint64_t> storage(size / sizeof(uint64_t) + 1);
+	ipc_shared_slots *iss = (ipc_shared_slots *)storage.data();
+	ipc_shared_slots_init(iss, slot_count);
+
+	CHECK(ipc_shared_slots_validate(iss, size));
+	CHECK_FALSE(ipc_shared_slots_validate(iss, size + 1));
+	CHECK((uint8_t *)ipc_shared_slots_get(iss, 1) == (uint8_t *)iss + size - sizeof(ipc_layer_slot));
+
+	iss->slot_count = slot_count + 1;
+	CHECK_FALSE(ipc_shared_slots_validate(iss, size));
+}
+
+TEST_CASE("ipc_shared_layout_clients")
+{
+	// Many clients connected at the same time, each with its own slots that
+	// the service reads frames from while every client reads the inputs.
+	service_shm shm(typical_counts());
+
+	std::atomic<uint32_t> failures{0};
+	std::atomic<uint32_t> frames{0};
+	std::vector<std::thread> clients;
+
+	for (uint32_t id = 0; id < client_count; id++) {
+		clients.emplace_back([&, id] {
+			// Service side, done when the client connects.
+			size_t slots_size = ipc_shared_slots_size(slot_count);
+			xrt_shmem_handle_t slots_handle = XRT_SHMEM_HANDLE_INVALID;
+			ipc_shared_slots *service_slots = nullptr;
+			if (ipc_shmem_create(slots_size, &slots_handle, (void **)&service_slots) != XRT_SUCCESS) {
+				failures++;
+				return;
+			}
+			ipc_shared_slots_init(service_slots, slot_count);
+
+			// Client side, map what it got from instance_get_shm_fd.
+			ipc_shared_memory *ism = nullptr;
+			ipc_shared_slots *slots = nullptr;
+			if (ipc_shmem_map(shm.handle, shm.size, (void **)&ism) != XRT_SUCCESS ||
+			    ipc_shmem_map(slots_handle, slots_size, (void **)&slots) != XRT_SUCCESS ||
+			    !ipc_shared_layout_validate(ism, shm.size) || !ipc_shared_slots_validate(slots, slots_size)) {
+				failures++;
+				return;
+			}
+
+			uint32_t slot_id = 0;
+			for (uint32_t frame = 0; frame < frame_count; frame++) {
+				uint32_t input = frame % ism->isdevs[0].input_count;
+				if (ipc_shared_memory_inputs(ism)[input].name != (xrt_input_name)(input + 1)) {
+					failures++;
+				}
+
+				ipc_layer_slot *slot = ipc_shared_slots_get(slots, slot_id);
+				slot->layer_count = 1;
+				slot->layers[0].xdev_id = id;
+				slot->layers[0].swapchain_ids[0] = frame;
+
+				// The service only ever sees this client's frames.
+				ipc_layer_slot copy = *ipc_shared_slots_get(service_slots, slot_id);
+				if (copy.layers[0].xdev_id != id || copy.layers[0].swapchain_ids[0] != frame) {
+					failures++;
+				}
+				frames++;
+
+				slot_id = (slot_id + 1) % service_slots->slot_count;
+			}
+
+			ipc_shmem_unmap((void **)&slots, slots_size);
+			ipc_shmem_unmap((void **)&ism, shm.size);
+			ipc_shmem_destroy(&slots_handle, (void **)&service_slots, slots_size);
+		});
+	}
+
+	for (auto &client : clients) {
+		client.join();
+	}
+
+	CHECK(failures == 0);
+	CHECK(frames == client_count * frame_count);
+}
+
+TEST_CASE("ipc_shared_layout_size", "[.][benchmark]")
+{
+	// What each client maps, against the fixed arrays and global slots.
+	ipc_shared_counts fixed = {};
+	fixed.inputs = 1024;
+	fixed.outputs = 128;
+	fixed.binding_profiles = 64;
+	fixed.input_pairs = 1024;
+	fixed.output_pairs = 128;
+
+	ipc_shared_layout before = {};
+	ipc_shared_layout after = {};
+	ipc_shared_counts counts = typical_counts();
+	REQUIRE(ipc_shared_layout_init(&before, &fixed));
+	REQUIRE(ipc_shared_layout_init(&after, &counts));
+
+	size_t before_size = (size_t)before.size + 128 * sizeof(ipc_layer_slot);
+	size_t after_size = (size_t)after.size + ipc_shared_slots_size(slot_count);
+
+	std::cout << "fixed: " << before_size << " bytes, sized: " << after_size << " bytes ("
+	          << (size_t)after.size << " shared + " << ipc_shared_slots_size(slot_count) << " slots)"
+	          << std::endl;
+}
@@ -14,6 +14,8 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <queue>
@@ -386,3 +388,255 @@ TEST_CASE("u_pacing_compositor_fake")
 	}
 	u_pc_destroy(&upc);
 }
+
+TEST_CASE("u_pacing_compositor_percentile")
+{
+	u_pacing_compositor *upc = nullptr;
+	MockClock clock;
+	REQUIRE(XRT_SUCCESS == u_pc_percentile_create(frame_interval_ns.count(), &U_PC_PERCENTILE_CONFIG_DEFAULT, &upc));
+	REQUIRE(upc != nullptr);
+
+	clock.advance(1ms);
+	SimulatedDisplayTimingQueue queue;
+
+	auto predict = [&] {
+		CompositorPredictions predictions;
+		u_pc_predict(upc, clock.now(), &predictions.frame_id, &predictions.wake_up_time_ns,
+		             &predictions.desired_present_time_ns, &predictions.present_slop_ns,
+		             &predictions.predicted_display_time_ns, &predictions.predicted_display_period_ns,
+		             &predictions.min_display_period_ns);
+		INFO(predictions.frame_id);
+		INFO(clock.now());
+		basicPredictionConsistencyChecks(clock.now(), predictions);
+		return predictions;
+	};
+
+	auto budget = [](CompositorPredictions const &predictions) {
+		return unanoseconds(predictions.desired_present_time_ns - predictions.wake_up_time_ns);
+	};
+
+	CompositorPredictions first = predict();
+	doFrame(queue, upc, clock, first.wake_up_time_ns, first.desired_present_time_ns, first.frame_id, wakeDelay,
+	        shortBeginDelay, shortSubmitDelay, shortGpuTime);
+
+	for (int i = 0; i < 30; ++i) {
+		CompositorPredictions predictions = predict();
+		doFrame(queue, upc, clock, predictions.wake_up_time_ns, predictions.desired_present_time_ns,
+		        predictions.frame_id, wakeDelay, shortBeginDelay, shortSubmitDelay, shortGpuTime);
+	}
+
+	// Budgets for what the frames take, not much more.
+	CompositorPredictions steady = predict();
+	CHECK(budget(steady) < budget(first));
+	CHECK(budget(steady) > unanoseconds(shortSubmitDelay + shortGpuTime));
+	CHECK(budget(steady) < unanoseconds(shortSubmitDelay + shortGpuTime + 2ms));
+
+	SECTION("missed frame")
+	{
+		// A GPU spike that misses the present.
+		doFrame(queue, upc, clock, steady.wake_up_time_ns, steady.desired_present_time_ns, steady.frame_id,
+		        wakeDelay, shortBeginDelay, shortSubmitDelay, longGpuTime + 1ms);
+		drainDisplayTimingQueue(queue, clock.now(), upc);
+
+		// The very next frame covers it.
+		CompositorPredictions next = predict();
+		CHECK(budget(next) > unanoseconds(shortSubmitDelay + longGpuTime + 1ms));
+	}
+
+	u_pc_destroy(&upc);
+}
+
+TEST_CASE("u_pacing_compositor_percentile_out_of_range")
+{
+	// Clamped to p100, which budgets for the longest frame and no more.
+	u_pc_percentile_config config = U_PC_PERCENTILE_CONFIG_DEFAULT;
+	config.percentile_per_mille = 5000;
+
+	u_pacing_compositor *upc = nullptr;
+	MockClock clock;
+	REQUIRE(XRT_SUCCESS == u_pc_percentile_create(frame_interval_ns.count(), &config, &upc));
+
+	clock.advance(1ms);
+	SimulatedDisplayTimingQueue queue;
+
+	CompositorPredictions predictions;
+	for (int i = 0; i < 31; ++i) {
+		u_pc_predict(upc, clock.now(), &predictions.frame_id, &predictions.wake_up_time_ns,
+		             &predictions.desired_present_time_ns, &predictions.present_slop_ns,
+		             &predictions.predicted_display_time_ns, &predictions.predicted_display_period_ns,
+		             &predictions.min_display_period_ns);
+		basicPredictionConsistencyChecks(clock.now(), predictions);
+		doFrame(queue, upc, clock, predictions.wake_up_time_ns, predictions.desired_present_time_ns,
+		        predictions.frame_id, wakeDelay, shortBeginDelay, shortSubmitDelay, shortGpuTime);
+	}
+
+	unanoseconds budget(predictions.desired_present_time_ns - predictions.wake_up_time_ns);
+	CHECK(budget < unanoseconds(shortSubmitDelay + shortGpuTime + 2ms));
+
+	u_pc_destroy(&upc);
+}
+
+
+/*
+ *
+ * Offline replay of timing traces, to compare pacing implementations.
+ *
+ */
+
+namespace {
+
+struct PacingTraceFrame
+{
+	unanoseconds cpu_time;
+	unanoseconds gpu_time;
+};
+
+struct PacingReplayResult
+{
+	int frame_count{0};
+	int missed_count{0};
+	unanoseconds total_budget{0};
+};
+
+//! Steady frames with jitter and a GPU spike every 37th frame.
+std::vector<PacingTraceFrame>
+makeSpikyTrace(int frame_count)
+{
+	std::vector<PacingTraceFrame> trace;
+	for (int i = 0; i < frame_count; ++i) {
+		PacingTraceFrame frame;
+		frame.cpu_time = unanoseconds(300us) + unanoseconds(20us) * (i * 7 % 5);
+		frame.gpu_time = unanoseconds(1500us) + unanoseconds(50us) * (i * 13 % 11);
+		if (i % 37 == 36) {
+			frame.gpu_time = unanoseconds(3500us);
+		}
+		trace.push_back(frame);
+	}
+	return trace;
+}
+
+//! Lines of "cpu_ns,gpu_ns".
+std::vector<PacingTraceFrame>
+loadTrace(const char *path)
+{
+	std::vector<PacingTraceFrame> trace;
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream iss(line);
+		uint64_t cpu_ns = 0;
+		uint64_t gpu_ns = 0;
+		char comma = 0;
+		if (iss >> cpu_ns >> comma >> gpu_ns) {
+			trace.push_back({unanoseconds(cpu_ns), unanoseconds(gpu_ns)});
+		}
+	}
+	return trace;
+}
+
+void
+deliverInfo(SimulatedDisplayTimingQueue &queue, uint64_t now_ns, u_pacing_compositor *upc)
+{
+	while (!queue.empty() && queue.top().now_ns <= now_ns) {
+		SimulatedDisplayTimingData const &d = queue.top();
+		u_pc_info(upc, d.frame_id, d.desired_present_time_ns, d.actual_present_time_ns,
+		          d.earliest_present_time_ns, d.present_margin_ns, d.now_ns);
+		queue.pop();
+	}
+}
+
+PacingReplayResult
+replayTrace(u_pacing_compositor *upc, std::vector<PacingTraceFrame> const &trace)
+{
+	MockClock clock;
+	SimulatedDisplayTimingQueue queue;
+	PacingReplayResult result;
+
+	clock.advance(1ms);
+
+	for (PacingTraceFrame const &frame : trace) {
+		CompositorPredictions p;
+		u_pc_predict(upc, clock.now(), &p.frame_id, &p.wake_up_time_ns, &p.desired_present_time_ns,
+		             &p.present_slop_ns, &p.predicted_display_time_ns, &p.predicted_display_period_ns,
+		             &p.min_display_period_ns);
+
+		clock.advance_to(p.wake_up_time_ns);
+		clock.advance(wakeDelay);
+		deliverInfo(queue, clock.now(), upc);
+		u_pc_mark_point(upc, U_TIMING_POINT_WAKE_UP, p.frame_id, clock.now());
+
+		clock.advance(shortBeginDelay);
+		u_pc_mark_point(upc, U_TIMING_POINT_BEGIN, p.frame_id, clock.now());
+
+		clock.advance(frame.cpu_time);
+		u_pc_mark_point(upc, U_TIMING_POINT_SUBMIT, p.frame_id, clock.now());
+
+		clock.advance(frame.gpu_time);
+		uint64_t gpu_finish_ns = clock.now();
+
+		result.frame_count++;
+		result.total_budget += unanoseconds(p.desired_present_time_ns - p.wake_up_time_ns);
+		if (gpu_finish_ns > p.desired_present_time_ns) {
+			result.missed_count++;
+		}
+
+		uint64_t scanout_ns = getNextPresentAfterTimestampAndKnownPresent(gpu_finish_ns, p.desired_present_time_ns);
+		queue.push({p.frame_id, p.desired_present_time_ns, gpu_finish_ns, scanout_ns + 1'000'000});
+	}
+
+	deliverInfo(queue, UINT64_MAX, upc);
+
+	return result;
+}
+
+PacingReplayResult
+replayDisplayTiming(std::vector<PacingTraceFrame> const &trace)
+{
+	u_pacing_compositor *upc = nullptr;
+	u_pc_display_timing_create(frame_interval_ns.count(), &U_PC_DISPLAY_TIMING_CONFIG_DEFAULT, &upc);
+	PacingReplayResult result = replayTrace(upc, trace);
+	u_pc_destroy(&upc);
+	return result;
+}
+
+PacingReplayResult
+replayPercentile(std::vector<PacingTraceFrame> const &trace)
+{
+	u_pacing_compositor *upc = nullptr;
+	u_pc_percentile_create(frame_interval_ns.count(), &U_PC_PERCENTILE_CONFIG_DEFAULT, &upc);
+	PacingReplayResult result = replayTrace(upc, trace);
+	u_pc_destroy(&upc);
+	return result;
+}
+
+void
+printReplay(const char *name, PacingReplayResult const &result)
+{
+	std::cout << name << ": " << result.missed_count << " of " << result.frame_count << " frames missed, "
+	          << stringifyNanos(result.total_budget / result.frame_count) << " average budget" << std::endl;
+}
+
+} // namespace
+
+TEST_CASE("u_pacing_compositor_replay")
+{
+	std::vector<PacingTraceFrame> trace = makeSpikyTrace(1000);
+
+	PacingReplayResult display_timing = replayDisplayTiming(trace);
+	PacingReplayResult percentile = replayPercentile(trace);
+
+	// The spikes are more than 1% of the frames, so p99 covers them.
+	CHECK(percentile.missed_count < display_timing.missed_count);
+	CHECK(percentile.missed_count < 5);
+}
+
+TEST_CASE("u_pacing_compositor_replay_trace", "[.][benchmark]")
+{
+	// Set U_PACING_REPLAY_TRACE to a file of "cpu_ns,gpu_ns" lines to replay a recorded trace.
+	const char *path = std::getenv("U_PACING_REPLAY_TRACE");
+	std::vector<PacingTraceFrame> trace = path != nullptr ? loadTrace(path) : makeSpikyTrace(10000);
+	REQUIRE(!trace.empty());
+
+	printReplay("display timing", replayDisplayTiming(trace));
+	printReplay("percentile p99", replayPercentile(trace));
+}
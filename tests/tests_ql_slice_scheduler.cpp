@@ -0,0 +1,192 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Quest Link slice encode scheduling tests.
+ */
+
+#include "quest_link/ql_slice_scheduler.h"
+
+#include "os/os_time.h"
+#include "util/u_worker.h"
+
+#include "catch/catch.hpp"
+
+#include <iostream>
+#include <optional>
+#include <vector>
+
+
+TEST_CASE("ql_slice_scheduler_allocate")
+{
+	using threads = std::vector<int32_t>;
+
+	CHECK(ql_slice_scheduler::allocate({1, 1, 1, 1}, 8) == threads{2, 2, 2, 2});
+	CHECK(ql_slice_scheduler::allocate({3, 1}, 4) == threads{3, 1});
+	CHECK(ql_slice_scheduler::allocate({1, 2, 1, 4, 1}, 16) == threads{2, 4, 2, 6, 2});
+
+	// Not enough threads: still one each.
+	CHECK(ql_slice_scheduler::allocate({1, 5, 1}, 2) == threads{1, 1, 1});
+}
+
+TEST_CASE("ql_slice_scheduler_timing")
+{
+	ql_slice_scheduler::timing t;
+	CHECK(t.percentile(0.5) == 0);
+
+	for (int i = 1; i <= 100; i++) {
+		t.push(i);
+	}
+	CHECK(t.percentile(0.5) == 51);
+	CHECK(t.percentile(0.99) == 100);
+	CHECK(t.mean() == Approx(50.5));
+
+	// Only the last samples are kept.
+	for (int i = 0; i < QL_SLICE_TIMING_SAMPLES; i++) {
+		t.push(1000);
+	}
+	CHECK(t.percentile(0.01) == 1000);
+	CHECK(t.mean() == Approx(1000));
+}
+
+namespace {
+
+constexpr float fps = 72;
+
+// Five seconds of frames with a fixed single threaded cost per slice, in ms.
+std::optional<std::vector<int32_t>>
+run(ql_slice_scheduler &scheduler, const std::vector<double> &cost)
+{
+	for (int frame = 0; frame < 5 * fps; frame++) {
+		for (size_t i = 0; i < cost.size(); i++) {
+			scheduler.push_slice(i, cost[i] / scheduler.threads()[i] * 1e6);
+		}
+		scheduler.push_frame(1e6);
+		if (frame + 1 < 5 * fps) {
+			REQUIRE_FALSE(scheduler.rebalance());
+		}
+	}
+	return scheduler.rebalance();
+}
+
+} // namespace
+
+TEST_CASE("ql_slice_scheduler_rebalance")
+{
+	ql_slice_scheduler scheduler(3, 6, fps);
+	CHECK(scheduler.threads() == std::vector<int32_t>{2, 2, 2});
+	CHECK(scheduler.order() == std::vector<int>{0, 1, 2});
+
+	SECTION("balanced")
+	{
+		CHECK_FALSE(run(scheduler, {4, 4, 4}));
+	}
+
+	SECTION("one slice is heavier")
+	{
+		auto threads = run(scheduler, {2, 8, 2});
+		REQUIRE(threads);
+		CHECK(*threads == std::vector<int32_t>{1, 4, 1});
+		CHECK(scheduler.threads() == *threads);
+		CHECK(scheduler.order().front() == 1);
+
+		// Now balanced, nothing more to gain.
+		CHECK_FALSE(run(scheduler, {2, 8, 2}));
+	}
+}
+
+TEST_CASE("ql_slice_scheduler_small_gain")
+{
+	ql_slice_scheduler scheduler(2, 3, fps);
+	CHECK(scheduler.threads() == std::vector<int32_t>{2, 1});
+
+	// Moving the thread to the second slice would shorten the slowest slice
+	// from 2.2ms to 2ms, not worth an IDR.
+	CHECK_FALSE(run(scheduler, {2, 2.2}));
+	CHECK(scheduler.threads() == std::vector<int32_t>{2, 1});
+}
+
+TEST_CASE("ql_slice_scheduler_disabled")
+{
+	ql_slice_scheduler scheduler(2, 0, 72);
+	CHECK(scheduler.threads() == std::vector<int32_t>{0, 0});
+
+	for (int frame = 0; frame < 1000; frame++) {
+		scheduler.push_slice(0, 1'000'000);
+		scheduler.push_slice(1, 9'000'000);
+		scheduler.push_frame(10'000'000);
+	}
+	CHECK_FALSE(scheduler.rebalance());
+	CHECK(scheduler.order() == std::vector<int>{1, 0});
+	CHECK(scheduler.frame_timing().p99_ms == Approx(10));
+}
+
+namespace {
+
+struct busy_task
+{
+	ql_slice_scheduler *scheduler;
+	int slice;
+	uint64_t duration_ns;
+};
+
+void
+busy(void *ptr)
+{
+	auto *task = (busy_task *)ptr;
+	uint64_t start = os_monotonic_get_ns();
+	while (os_monotonic_get_ns() - start < task->duration_ns) {
+	}
+	task->scheduler->push_slice(task->slice, os_monotonic_get_ns() - start);
+}
+
+} // namespace
+
+TEST_CASE("ql_slice_scheduler_benchmark", "[.][benchmark]")
+{
+	// Five slices of uneven cost, busy loops stand in for the encoder.
+	const std::vector<uint64_t> cost_ns{1'000'000, 1'500'000, 3'000'000, 1'500'000, 1'000'000};
+	const int frames = 500;
+
+	auto report = [&](const char *name, ql_slice_scheduler &scheduler) {
+		std::cout << name << ": frame p50 " << scheduler.frame_timing().p50_ms << "ms, p99 "
+		          << scheduler.frame_timing().p99_ms << "ms" << std::endl;
+	};
+
+	{
+		ql_slice_scheduler scheduler(cost_ns.size(), 0, 72);
+		for (int frame = 0; frame < frames; frame++) {
+			uint64_t start = os_monotonic_get_ns();
+			for (size_t i = 0; i < cost_ns.size(); i++) {
+				busy_task task{&scheduler, (int)i, cost_ns[i]};
+				busy(&task);
+			}
+			scheduler.push_frame(os_monotonic_get_ns() - start);
+		}
+		report("in sequence", scheduler);
+	}
+
+	{
+		ql_slice_scheduler scheduler(cost_ns.size(), 0, 72);
+		u_worker_thread_pool *pool = u_worker_thread_pool_create(cost_ns.size() - 1, cost_ns.size(), "bench");
+		u_worker_group *group = u_worker_group_create(pool);
+
+		std::vector<busy_task> tasks;
+		for (size_t i = 0; i < cost_ns.size(); i++) {
+			tasks.push_back({&scheduler, (int)i, cost_ns[i]});
+		}
+
+		for (int frame = 0; frame < frames; frame++) {
+			uint64_t start = os_monotonic_get_ns();
+			for (int slice : scheduler.order()) {
+				u_worker_group_push(group, busy, &tasks[slice]);
+			}
+			u_worker_group_wait_all(group);
+			scheduler.push_frame(os_monotonic_get_ns() - start);
+		}
+		report("worker pool", scheduler);
+
+		u_worker_group_reference(&group, nullptr);
+		u_worker_thread_pool_reference(&pool, nullptr);
+	}
+}
@@ -0,0 +1,298 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Quest Link XRSP topic stream parser tests.
+ *
+ * Set QL_XRSP_REPLAY_DUMP to a raw dump of the IN endpoint to also replay a
+ * recorded session through the parser.
+ */
+
+#include "quest_link/ql_xrsp_topic.h"
+#include "quest_link/ql_xrsp_types.h"
+
+#include "catch/catch.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+
+namespace {
+
+struct parsed_pkt
+{
+	uint8_t topic;
+	uint16_t sequence_num;
+	std::vector<uint8_t> payload;
+
+	bool
+	operator==(const parsed_pkt &o) const
+	{
+		return topic == o.topic && sequence_num == o.sequence_num && payload == o.payload;
+	}
+};
+
+struct collector
+{
+	std::vector<parsed_pkt> pkts;
+	bool keep_fill = false;
+
+	static void
+	cb(void *ptr, ql_xrsp_topic_pkt *pkt)
+	{
+		collector *c = (collector *)ptr;
+		if (pkt->topic == TOPIC_AUI4A_ADV && !c->keep_fill) {
+			return;
+		}
+		c->pkts.push_back({pkt->topic, pkt->sequence_num, {pkt->payload, pkt->payload + pkt->payload_valid}});
+	}
+};
+
+struct stream_fixture
+{
+	ql_xrsp_topic_stream stream;
+
+	stream_fixture()
+	{
+		REQUIRE(ql_xrsp_topic_stream_init(&stream) == 0);
+	}
+
+	~stream_fixture()
+	{
+		ql_xrsp_topic_stream_destroy(&stream);
+	}
+
+	template <typename F>
+	void
+	feed_chunked(const std::vector<uint8_t> &data, F next_chunk, collector &c)
+	{
+		size_t offs = 0;
+		while (offs < data.size()) {
+			size_t amt = std::min(next_chunk(), data.size() - offs);
+			ql_xrsp_topic_stream_feed(&stream, data.data() + offs, amt, 0, collector::cb, &c);
+			offs += amt;
+		}
+	}
+};
+
+/*!
+ * A synthetic capture: topic packets framed like the headset does, each
+ * transfer padded out to 0x400 with a fill packet.
+ */
+struct capture
+{
+	std::vector<uint8_t> bytes;
+	std::vector<parsed_pkt> pkts;
+
+	explicit capture(int num_pkts, uint32_t seed)
+	{
+		std::mt19937 rng(seed);
+		const uint8_t topics[] = {TOPIC_POSE, TOPIC_HOSTINFO_ADV, TOPIC_HANDS, TOPIC_LOGGING, TOPIC_RUNTIME_IPC};
+
+		ql_xrsp_tx_arena arena;
+		ql_xrsp_tx_buf buf;
+		REQUIRE(ql_xrsp_tx_arena_init(&arena, ql_xrsp_tx_buf_size_for_payload(QL_XRSP_TX_MAX_PAYLOAD)) == 0);
+		REQUIRE(ql_xrsp_tx_arena_carve(&arena, &buf, QL_XRSP_TX_MAX_PAYLOAD) == 0);
+
+		for (int i = 0; i < num_pkts; i++) {
+			// Mostly small pose sized packets with the odd large one.
+			size_t size = rng() % 16 == 0 ? 1 + rng() % 0x30000 : 1 + rng() % 0x200;
+			std::vector<uint8_t> payload(size);
+			for (auto &b : payload) {
+				b = (uint8_t)rng();
+			}
+
+			uint8_t topic = topics[rng() % 5];
+			uint16_t seq = (uint16_t)i;
+
+			ql_xrsp_tx_buf_reset(&buf);
+			REQUIRE(ql_xrsp_tx_buf_append(&buf, payload.data(), payload.size()));
+
+			ql_xrsp_tx_iter it = {};
+			uint8_t *slot;
+			uint32_t len;
+			REQUIRE(ql_xrsp_tx_buf_next_record(&buf, &it, &slot, &len));
+			int32_t framed = ql_xrsp_tx_frame(slot, len, topic, seq);
+
+			bytes.insert(bytes.end(), slot, slot + framed);
+			pkts.push_back({topic, seq, payload});
+		}
+
+		ql_xrsp_tx_arena_destroy(&arena);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("ql_xrsp_topic_stream")
+{
+	stream_fixture f;
+	capture cap(300, 1234);
+
+	SECTION("one large read")
+	{
+		collector c;
+		ql_xrsp_topic_stream_feed(&f.stream, cap.bytes.data(), cap.bytes.size(), 0, collector::cb, &c);
+		CHECK(c.pkts == cap.pkts);
+		CHECK(f.stream.num_resyncs == 0);
+		CHECK(f.stream.carry_len == 0);
+	}
+
+	SECTION("fixed read sizes")
+	{
+		for (size_t chunk : {(size_t)1, (size_t)7, (size_t)0x400, (size_t)0x4000, (size_t)0x10000}) {
+			CAPTURE(chunk);
+			collector c;
+			f.feed_chunked(cap.bytes, [&] { return chunk; }, c);
+			CHECK(c.pkts == cap.pkts);
+			CHECK(f.stream.carry_len == 0);
+		}
+	}
+
+	SECTION("random read sizes")
+	{
+		std::mt19937 rng(99);
+		collector c;
+		f.feed_chunked(cap.bytes, [&] { return (size_t)(1 + rng() % 0x10000); }, c);
+		CHECK(c.pkts == cap.pkts);
+	}
+
+	SECTION("fill packets are passed through")
+	{
+		collector c;
+		c.keep_fill = true;
+		ql_xrsp_topic_stream_feed(&f.stream, cap.bytes.data(), cap.bytes.size(), 0, collector::cb, &c);
+		CHECK(c.pkts.size() > cap.pkts.size());
+		CHECK(f.stream.num_pkts == c.pkts.size());
+	}
+
+	SECTION("zeroed gaps are skipped")
+	{
+		// A zero header is invalid, the parser skips it and picks up again.
+		std::vector<uint8_t> gappy(cap.bytes.begin(), cap.bytes.begin() + 0x400);
+		gappy.insert(gappy.end(), 0x40, 0);
+		gappy.insert(gappy.end(), cap.bytes.begin() + 0x400, cap.bytes.end());
+
+		collector c;
+		f.feed_chunked(gappy, [] { return (size_t)0x3FF; }, c);
+		CHECK(c.pkts == cap.pkts);
+		CHECK(f.stream.num_resyncs == 0x40 / 8);
+	}
+
+	SECTION("reset drops a straddling packet")
+	{
+		collector c;
+		size_t first = cap.bytes.size() / 2 + 3;
+		ql_xrsp_topic_stream_feed(&f.stream, cap.bytes.data(), first, 0, collector::cb, &c);
+		ql_xrsp_topic_stream_reset(&f.stream);
+		CHECK(f.stream.carry_len == 0);
+
+		collector again;
+		ql_xrsp_topic_stream_feed(&f.stream, cap.bytes.data(), cap.bytes.size(), 0, collector::cb, &again);
+		CHECK(again.pkts == cap.pkts);
+	}
+}
+
+TEST_CASE("ql_xrsp_topic_stream_fuzz")
+{
+	stream_fixture f;
+	capture cap(100, 42);
+	std::mt19937 rng(7);
+
+	for (int iter = 0; iter < 200; iter++) {
+		std::vector<uint8_t> data = cap.bytes;
+		int num_flips = 1 + rng() % 16;
+		for (int i = 0; i < num_flips; i++) {
+			data[rng() % data.size()] ^= (uint8_t)(1 + rng() % 255);
+		}
+
+		// Everything handed out must stay within what was fed in.
+		size_t total = 0;
+		auto cb = [](void *ptr, ql_xrsp_topic_pkt *pkt) {
+			size_t *total = (size_t *)ptr;
+			REQUIRE(pkt->payload_valid <= QL_XRSP_TOPIC_PKT_MAX);
+			if (pkt->payload_valid) {
+				volatile uint8_t last = pkt->payload[pkt->payload_valid - 1];
+				(void)last;
+			}
+			*total += pkt->payload_valid;
+		};
+
+		size_t offs = 0;
+		while (offs < data.size()) {
+			size_t amt = std::min((size_t)(1 + rng() % 0x8000), data.size() - offs);
+			ql_xrsp_topic_stream_feed(&f.stream, data.data() + offs, amt, 0, cb, &total);
+			offs += amt;
+		}
+
+		CHECK(total <= data.size() + QL_XRSP_TOPIC_PKT_MAX);
+		ql_xrsp_topic_stream_reset(&f.stream);
+	}
+}
+
+TEST_CASE("ql_xrsp_topic_stream_replay")
+{
+	const char *path = getenv("QL_XRSP_REPLAY_DUMP");
+	if (!path) {
+		SUCCEED("QL_XRSP_REPLAY_DUMP not set, nothing to replay");
+		return;
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	REQUIRE(file.good());
+	std::vector<uint8_t> dump((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	// Whatever the read sizes, the recorded session must parse the same.
+	collector whole;
+	{
+		stream_fixture f;
+		ql_xrsp_topic_stream_feed(&f.stream, dump.data(), dump.size(), 0, collector::cb, &whole);
+		std::cout << path << ": " << whole.pkts.size() << " packets, " << f.stream.num_resyncs << " resyncs"
+		          << std::endl;
+	}
+
+	std::mt19937 rng(5);
+	for (size_t chunk : {(size_t)0x400, (size_t)0x4000, (size_t)0x10000, (size_t)0}) {
+		CAPTURE(chunk);
+		stream_fixture f;
+		collector c;
+		f.feed_chunked(dump, [&] { return chunk ? chunk : (size_t)(1 + rng() % 0x10000); }, c);
+		CHECK(c.pkts == whole.pkts);
+	}
+}
+
+TEST_CASE("ql_xrsp_topic_stream_benchmark", "[.][benchmark]")
+{
+	stream_fixture f;
+	capture cap(20000, 77);
+	const int rounds = 20;
+
+	for (size_t chunk : {(size_t)0x400, (size_t)0x4000, (size_t)0x10000}) {
+		uint64_t pkts_before = f.stream.num_pkts;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			size_t offs = 0;
+			while (offs < cap.bytes.size()) {
+				size_t amt = std::min(chunk, cap.bytes.size() - offs);
+				ql_xrsp_topic_stream_feed(
+				    &f.stream, cap.bytes.data() + offs, amt, 0, [](void *, ql_xrsp_topic_pkt *) {}, nullptr);
+				offs += amt;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		double secs = std::chrono::duration<double>(end - start).count();
+		double pkts = (double)(f.stream.num_pkts - pkts_before);
+		std::cout << "reads of 0x" << std::hex << chunk << std::dec << ": " << (uint64_t)(pkts / secs)
+		          << " packets/s, " << (uint64_t)(cap.bytes.size() * rounds / secs / (1024 * 1024)) << " MiB/s"
+		          << std::endl;
+	}
+}
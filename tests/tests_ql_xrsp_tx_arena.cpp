@@ -0,0 +1,457 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Quest Link XRSP transmit arena tests.
+ */
+
+#include "quest_link/ql_xrsp_tx_arena.h"
+
+#include "catch/catch.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+
+namespace {
+
+//! Heap allocations made by the legacy framing code below.
+uint64_t legacy_allocs = 0;
+
+void *
+legacy_malloc(size_t size)
+{
+	legacy_allocs++;
+	return malloc(size);
+}
+
+/*!
+ * The framing code as it was before the arena, one malloc and copy per packet.
+ */
+std::vector<uint8_t>
+legacy_frame(const uint8_t *data, int32_t data_size, uint8_t topic, uint16_t sequence_num)
+{
+	int32_t align_up_bytes = (((4 + data_size) >> 2) << 2) - data_size;
+	if (align_up_bytes == 4) {
+		align_up_bytes = 0;
+	}
+
+	uint8_t *msg = (uint8_t *)legacy_malloc(data_size + align_up_bytes + 8 + 0x400);
+	uint8_t *msg_payload = msg + 8;
+	int32_t msg_size = data_size + align_up_bytes + 8;
+
+	int32_t to_fill_check = 0x400 - ((msg_size + 0x400) & 0x3FF);
+	if (to_fill_check >= 0 && to_fill_check < 8) {
+		align_up_bytes += to_fill_check;
+		msg_size = data_size + align_up_bytes + 8;
+	}
+
+	uint16_t bits = (align_up_bytes ? 1 << 3 : 0) | 1 << 4 | (topic & 0x3F) << 8;
+	uint16_t num_words = ((data_size + align_up_bytes) >> 2) + 1;
+	uint16_t zero = 0;
+	memcpy(msg + 0, &bits, 2);
+	memcpy(msg + 2, &num_words, 2);
+	memcpy(msg + 4, &sequence_num, 2);
+	memcpy(msg + 6, &zero, 2);
+
+	memcpy(msg_payload, data, data_size);
+
+	if (align_up_bytes) {
+		if (align_up_bytes > 1) {
+			memset(msg_payload + data_size, 0xDE, align_up_bytes - 1);
+		}
+		msg_payload[data_size + align_up_bytes - 1] = align_up_bytes;
+	}
+
+	uint8_t *msg_end = msg + msg_size;
+	memset(msg_end, 0, 0x400);
+
+	int32_t to_fill = 0x400 - ((msg_size + 0x400) & 0x3FF) - 8;
+	if (to_fill < 0x3f8 && to_fill >= 0) {
+		uint16_t fill_bits = 1 << 4;
+		uint16_t fill_words = (to_fill >> 2) + 1;
+		memcpy(msg_end + 0, &fill_bits, 2);
+		memcpy(msg_end + 2, &fill_words, 2);
+		memcpy(msg_end + 4, &sequence_num, 2);
+		msg_size += to_fill + 8;
+	}
+
+	legacy_allocs++;
+	std::vector<uint8_t> ret(msg, msg + msg_size);
+	free(msg);
+	return ret;
+}
+
+std::vector<uint8_t>
+make_payload(size_t size, uint8_t seed)
+{
+	std::vector<uint8_t> ret(size);
+	for (size_t i = 0; i < size; i++) {
+		ret[i] = (uint8_t)(i * 31 + seed);
+	}
+	return ret;
+}
+
+//! Records everything sent to it, like the USB endpoint would see it.
+struct fake_usb
+{
+	std::vector<std::vector<uint8_t>> transfers;
+	size_t bytes = 0;
+	bool keep = true;
+
+	static void
+	sink(void *ptr, const uint8_t *data, int32_t size)
+	{
+		fake_usb *usb = (fake_usb *)ptr;
+		usb->bytes += size;
+		if (usb->keep) {
+			usb->transfers.emplace_back(data, data + size);
+		}
+	}
+
+	//! Pull the payloads back out of the topic packets, skipping fill packets.
+	std::vector<uint8_t>
+	payload(uint8_t topic) const
+	{
+		std::vector<uint8_t> ret;
+		for (const auto &transfer : transfers) {
+			size_t offs = 0;
+			while (offs + 8 <= transfer.size()) {
+				uint16_t bits;
+				uint16_t num_words;
+				memcpy(&bits, &transfer[offs], 2);
+				memcpy(&num_words, &transfer[offs + 2], 2);
+
+				size_t size = (num_words - 1) * 4;
+				const uint8_t *p = &transfer[offs + 8];
+				if (((bits >> 8) & 0x3F) == topic) {
+					if (bits & (1 << 3)) {
+						size -= p[size - 1];
+					}
+					ret.insert(ret.end(), p, p + size);
+				}
+				offs += 8 + (num_words - 1) * 4;
+			}
+		}
+		return ret;
+	}
+};
+
+struct arena_fixture
+{
+	ql_xrsp_tx_arena arena;
+	ql_xrsp_tx_buf buf;
+
+	explicit arena_fixture(size_t max_payload)
+	{
+		REQUIRE(ql_xrsp_tx_arena_init(&arena, ql_xrsp_tx_buf_size_for_payload(max_payload)) == 0);
+		REQUIRE(ql_xrsp_tx_arena_carve(&arena, &buf, max_payload) == 0);
+	}
+
+	~arena_fixture()
+	{
+		ql_xrsp_tx_arena_destroy(&arena);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("ql_xrsp_tx_frame")
+{
+	arena_fixture f(QL_XRSP_TX_MAX_PAYLOAD);
+
+	int32_t sizes[] = {1, 2, 3, 4, 5, 0x3EC, 0x3F0, 0x3F4, 0x3F5, 0x3F8, 0x3FC, 0x400,
+	                   0x401, 0x7F8, 0x1234, 0x10000, QL_XRSP_TX_MAX_PAYLOAD - 1, QL_XRSP_TX_MAX_PAYLOAD};
+
+	for (int32_t size : sizes) {
+		CAPTURE(size);
+		auto payload = make_payload(size, (uint8_t)size);
+		auto expected = legacy_frame(payload.data(), size, 0x13, 0x1234);
+
+		ql_xrsp_tx_buf_reset(&f.buf);
+		REQUIRE(ql_xrsp_tx_buf_append(&f.buf, payload.data(), size));
+
+		fake_usb usb;
+		uint16_t next = ql_xrsp_tx_buf_flush(&f.buf, 0x13, 0x1234, fake_usb::sink, &usb);
+
+		CHECK(next == 0x1235);
+		REQUIRE(usb.transfers.size() == 1);
+		CHECK(usb.transfers[0].size() % QL_XRSP_TX_ALIGN == 0);
+		CHECK(usb.transfers[0] == expected);
+	}
+}
+
+TEST_CASE("ql_xrsp_tx_buf")
+{
+	const size_t max_payload = 0x200000;
+	arena_fixture f(max_payload);
+
+	CHECK(((uintptr_t)f.buf.base % QL_XRSP_TX_ALIGN) == 0);
+
+	SECTION("large appends are split into topic packets")
+	{
+		auto payload = make_payload(0x100003, 7);
+		REQUIRE(ql_xrsp_tx_buf_append(&f.buf, payload.data(), payload.size()));
+		CHECK(f.buf.payload_len == payload.size());
+
+		fake_usb usb;
+		uint16_t next = ql_xrsp_tx_buf_flush(&f.buf, 0x20, 0, fake_usb::sink, &usb);
+
+		CHECK(usb.transfers.size() == 5);
+		CHECK(next == usb.transfers.size());
+		for (const auto &transfer : usb.transfers) {
+			CHECK(transfer.size() % QL_XRSP_TX_ALIGN == 0);
+		}
+		CHECK(usb.payload(0x20) == payload);
+	}
+
+	SECTION("reserved writes and appends can be mixed")
+	{
+		std::vector<uint8_t> expected;
+		for (int i = 0; i < 40; i++) {
+			auto nal = make_payload(0x400 * (i + 1) + i, (uint8_t)i);
+			expected.insert(expected.end(), nal.begin(), nal.end());
+
+			if (i % 2) {
+				REQUIRE(ql_xrsp_tx_buf_append(&f.buf, nal.data(), nal.size()));
+				continue;
+			}
+
+			// Reserve more than needed, like the encoder does.
+			uint8_t *dst = ql_xrsp_tx_buf_reserve(&f.buf, nal.size() * 3 / 2);
+			REQUIRE(dst != nullptr);
+			memcpy(dst, nal.data(), nal.size());
+			ql_xrsp_tx_buf_commit(&f.buf, nal.size());
+		}
+		CHECK(f.buf.payload_len == expected.size());
+
+		fake_usb usb;
+		ql_xrsp_tx_buf_flush(&f.buf, 0x21, 0, fake_usb::sink, &usb);
+		CHECK(usb.payload(0x21) == expected);
+	}
+
+	SECTION("reservations larger than a topic packet fail")
+	{
+		CHECK(ql_xrsp_tx_buf_reserve(&f.buf, QL_XRSP_TX_MAX_PAYLOAD + 1) == nullptr);
+		CHECK(ql_xrsp_tx_buf_reserve(&f.buf, QL_XRSP_TX_MAX_PAYLOAD) != nullptr);
+	}
+
+	SECTION("a full buffer rejects the whole append")
+	{
+		auto payload = make_payload(max_payload - 0x100, 1);
+		REQUIRE(ql_xrsp_tx_buf_append(&f.buf, payload.data(), payload.size()));
+
+		auto extra = make_payload(f.buf.size, 2);
+		CHECK_FALSE(ql_xrsp_tx_buf_append(&f.buf, extra.data(), extra.size()));
+		CHECK(f.buf.payload_len == payload.size());
+
+		fake_usb usb;
+		ql_xrsp_tx_buf_flush(&f.buf, 0x22, 0, fake_usb::sink, &usb);
+		CHECK(usb.payload(0x22) == payload);
+	}
+
+	SECTION("reset makes the buffer reusable")
+	{
+		for (int i = 0; i < 3; i++) {
+			auto payload = make_payload(0x50000 + i, (uint8_t)i);
+			ql_xrsp_tx_buf_reset(&f.buf);
+			REQUIRE(ql_xrsp_tx_buf_append(&f.buf, payload.data(), payload.size()));
+
+			fake_usb usb;
+			ql_xrsp_tx_buf_flush(&f.buf, 0x23, 0, fake_usb::sink, &usb);
+			CHECK(usb.payload(0x23) == payload);
+		}
+	}
+}
+
+TEST_CASE("ql_xrsp_tx_batch")
+{
+	const size_t max_payload = 0x80000;
+	arena_fixture f(max_payload);
+
+	// Frame every record like the USB engine does for QL_XRSP_TX_TOPIC_BATCH.
+	auto flush_batch = [&](uint16_t *seq) {
+		fake_usb usb;
+		ql_xrsp_tx_iter it = {};
+		uint8_t *slot;
+		uint32_t len;
+		while (ql_xrsp_tx_buf_next_record(&f.buf, &it, &slot, &len)) {
+			int32_t size = ql_xrsp_tx_frame_batch(slot, len, seq);
+			fake_usb::sink(&usb, slot, size);
+		}
+		return usb;
+	};
+
+	SECTION("a single packet is framed like a plain record")
+	{
+		int32_t sizes[] = {1, 3, 4, 0x3EC, 0x3F0, 0x3F4, 0x3F5, 0x3F8, 0x400, 0x1234, QL_XRSP_TX_MAX_PAYLOAD - 8};
+
+		for (int32_t size : sizes) {
+			CAPTURE(size);
+			auto payload = make_payload(size, (uint8_t)size);
+			auto expected = legacy_frame(payload.data(), size, 0x13, 0x1234);
+
+			ql_xrsp_tx_buf_reset(&f.buf);
+			REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x13, payload.data(), size));
+
+			uint16_t seq = 0x1234;
+			fake_usb usb = flush_batch(&seq);
+
+			CHECK(seq == 0x1235);
+			REQUIRE(usb.transfers.size() == 1);
+			CHECK(usb.transfers[0] == expected);
+		}
+	}
+
+	SECTION("small packets of several topics share transfers")
+	{
+		const uint8_t topics[] = {0x05, 0x0A, 0x1B};
+		std::vector<uint8_t> expected[3];
+		const int num_pkts = 300;
+
+		for (int i = 0; i < num_pkts; i++) {
+			auto payload = make_payload(1 + (i * 97) % 0x900, (uint8_t)i);
+			expected[i % 3].insert(expected[i % 3].end(), payload.begin(), payload.end());
+			REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, topics[i % 3], payload.data(), payload.size()));
+		}
+
+		uint16_t seq = 0;
+		fake_usb usb = flush_batch(&seq);
+
+		CHECK(seq == num_pkts);
+		CHECK(usb.transfers.size() == f.buf.num_records);
+		CHECK(usb.transfers.size() < 10);
+		for (int t = 0; t < 3; t++) {
+			CHECK(usb.payload(topics[t]) == expected[t]);
+		}
+
+		// Every packet has its own sequence number, the fill shares the last one.
+		uint16_t want = 0;
+		for (const auto &transfer : usb.transfers) {
+			CHECK(transfer.size() % QL_XRSP_TX_ALIGN == 0);
+			size_t offs = 0;
+			while (offs + 8 <= transfer.size()) {
+				uint16_t bits;
+				uint16_t num_words;
+				uint16_t pkt_seq;
+				memcpy(&bits, &transfer[offs], 2);
+				memcpy(&num_words, &transfer[offs + 2], 2);
+				memcpy(&pkt_seq, &transfer[offs + 4], 2);
+				if ((bits >> 8) & 0x3F) {
+					CHECK(pkt_seq == want++);
+				}
+				offs += 8 + (num_words - 1) * 4;
+			}
+		}
+	}
+
+	SECTION("packets are never split")
+	{
+		CHECK(ql_xrsp_tx_buf_reserve_packet(&f.buf, QL_XRSP_TX_MAX_PAYLOAD - 7) == nullptr);
+
+		auto big = make_payload(QL_XRSP_TX_MAX_PAYLOAD - 0x100, 1);
+		auto small = make_payload(0x200, 2);
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x07, small.data(), small.size()));
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x08, big.data(), big.size()));
+		CHECK(f.buf.num_records == 2);
+
+		uint16_t seq = 0;
+		fake_usb usb = flush_batch(&seq);
+		CHECK(usb.payload(0x07) == small);
+		CHECK(usb.payload(0x08) == big);
+	}
+
+	SECTION("rewind drops a partly queued message")
+	{
+		auto first = make_payload(0x300, 1);
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x07, first.data(), first.size()));
+
+		// Preamble fits in the open record, the body needs a new one.
+		ql_xrsp_tx_buf saved = f.buf;
+		auto preamble = make_payload(8, 2);
+		auto body = make_payload(QL_XRSP_TX_MAX_PAYLOAD - 0x100, 3);
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x08, preamble.data(), preamble.size()));
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x08, body.data(), body.size()));
+		CHECK(f.buf.num_records == 2);
+
+		ql_xrsp_tx_buf_rewind(&f.buf, &saved);
+		CHECK(f.buf.num_records == 1);
+		CHECK(f.buf.payload_len == saved.payload_len);
+
+		auto last = make_payload(0x40, 4);
+		REQUIRE(ql_xrsp_tx_buf_append_packet(&f.buf, 0x09, last.data(), last.size()));
+
+		uint16_t seq = 0;
+		fake_usb usb = flush_batch(&seq);
+		CHECK(seq == 2);
+		CHECK(usb.transfers.size() == 1);
+		CHECK(usb.payload(0x07) == first);
+		CHECK(usb.payload(0x08).empty());
+		CHECK(usb.payload(0x09) == last);
+	}
+}
+
+TEST_CASE("ql_xrsp_tx_benchmark", "[.][benchmark]")
+{
+	using clock = std::chrono::steady_clock;
+
+	// A five slice IDR frame, a few hundred KiB in total.
+	const int num_frames = 500;
+	const int num_slices = 5;
+	const size_t slice_size = 0x14000;
+
+	arena_fixture f(slice_size);
+	auto slice = make_payload(slice_size, 3);
+
+	fake_usb usb;
+	usb.keep = false;
+
+	// Nothing is carved or allocated once the buffers are set up.
+	uint64_t arena_allocs_before = f.arena.num_allocs;
+	size_t arena_used_before = f.arena.used;
+	auto start = clock::now();
+	uint16_t seq = 0;
+	for (int frame = 0; frame < num_frames; frame++) {
+		for (int s = 0; s < num_slices; s++) {
+			ql_xrsp_tx_buf_reset(&f.buf);
+			// Stands in for x264_nal_encode writing into the reservation.
+			uint8_t *dst = ql_xrsp_tx_buf_reserve(&f.buf, slice_size);
+			memcpy(dst, slice.data(), slice_size);
+			ql_xrsp_tx_buf_commit(&f.buf, slice_size);
+			seq = ql_xrsp_tx_buf_flush(&f.buf, 0x1A + s, seq, fake_usb::sink, &usb);
+		}
+	}
+	std::chrono::duration<double> arena_time = clock::now() - start;
+	uint64_t arena_allocs = f.arena.num_allocs - arena_allocs_before;
+	size_t arena_bytes = usb.bytes;
+	CHECK(f.arena.used == arena_used_before);
+
+	legacy_allocs = 0;
+	usb.bytes = 0;
+	start = clock::now();
+	for (int frame = 0; frame < num_frames; frame++) {
+		for (int s = 0; s < num_slices; s++) {
+			// The old path copied the slice into the stream buffer first.
+			legacy_allocs++;
+			std::vector<uint8_t> stream(slice.begin(), slice.end());
+			for (size_t offs = 0; offs < stream.size(); offs += QL_XRSP_TX_MAX_PAYLOAD) {
+				size_t amt = std::min<size_t>(QL_XRSP_TX_MAX_PAYLOAD, stream.size() - offs);
+				auto msg = legacy_frame(stream.data() + offs, amt, 0x1A + s, seq++);
+				fake_usb::sink(&usb, msg.data(), msg.size());
+			}
+		}
+	}
+	std::chrono::duration<double> legacy_time = clock::now() - start;
+
+	std::cout << "arena:  " << arena_bytes / arena_time.count() / (1024 * 1024) << " MiB/s, "
+	          << (double)arena_allocs / num_frames << " allocations per frame" << std::endl;
+	std::cout << "legacy: " << usb.bytes / legacy_time.count() / (1024 * 1024) << " MiB/s, "
+	          << (double)legacy_allocs / num_frames << " allocations per frame" << std::endl;
+
+	CHECK(arena_allocs == 0);
+	CHECK(arena_bytes == usb.bytes);
+}
@@ -0,0 +1,695 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Quest Link USB transfer engine tests, against a loopback fake device.
+ */
+
+#include "quest_link/ql_xrsp_usb_engine.h"
+#include "quest_link/ql_xrsp_types.h"
+
+#include "util/u_time.h"
+
+#include "catch/catch.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+std::vector<uint8_t>
+make_payload(size_t size, uint8_t seed)
+{
+	std::vector<uint8_t> ret(size);
+	for (size_t i = 0; i < size; i++) {
+		ret[i] = (uint8_t)(i * 31 + seed);
+	}
+	return ret;
+}
+
+struct packet_info
+{
+	uint8_t topic;
+	uint16_t sequence_num;
+};
+
+//! Header of the topic packet a transfer starts with.
+packet_info
+first_packet(const std::vector<uint8_t> &transfer)
+{
+	uint16_t bits;
+	uint16_t seq;
+	memcpy(&bits, &transfer[0], 2);
+	memcpy(&seq, &transfer[4], 2);
+	return {(uint8_t)((bits >> 8) & 0x3F), seq};
+}
+
+/*!
+ * A device that replays captured headset traffic on IN and logs every OUT
+ * transfer, completions are delivered from the engine's event thread.
+ */
+struct fake_device
+{
+	ql_xrsp_usb_backend base = {};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	std::deque<ql_xrsp_usb_xfer *> in_pending;
+	std::deque<ql_xrsp_usb_xfer *> out_pending;
+	std::set<ql_xrsp_usb_xfer *> cancelled;
+
+	//! Device to host transfers still to be replayed.
+	std::deque<std::vector<uint8_t>> replay;
+	//! Host to device transfers in wire order.
+	std::vector<std::vector<uint8_t>> wire;
+
+	//! Keep OUT transfers in flight until released.
+	bool hold_out = false;
+	bool gone = false;
+	//! Fail IN transfers with this status when not zero.
+	int in_status = 0;
+	int num_in_submits = 0;
+
+	fake_device()
+	{
+		base.xfer_init = [](ql_xrsp_usb_backend *, ql_xrsp_usb_xfer *) { return 0; };
+		base.xfer_fini = [](ql_xrsp_usb_backend *, ql_xrsp_usb_xfer *) {};
+		base.submit = submit;
+		base.cancel = cancel;
+		base.handle_events = handle_events;
+		base.destroy = [](ql_xrsp_usb_backend *) {};
+	}
+
+	static fake_device *
+	from(ql_xrsp_usb_backend *b)
+	{
+		return (fake_device *)b;
+	}
+
+	static int
+	submit(ql_xrsp_usb_backend *b, ql_xrsp_usb_xfer *xfer)
+	{
+		fake_device *d = from(b);
+		std::unique_lock<std::mutex> lock(d->mutex);
+		if (d->gone) {
+			return QL_XRSP_USB_NO_DEVICE;
+		}
+		(xfer->is_in ? d->in_pending : d->out_pending).push_back(xfer);
+		d->num_in_submits += xfer->is_in;
+		d->cond.notify_all();
+		return 0;
+	}
+
+	static void
+	cancel(ql_xrsp_usb_backend *b, ql_xrsp_usb_xfer *xfer)
+	{
+		fake_device *d = from(b);
+		std::unique_lock<std::mutex> lock(d->mutex);
+		d->cancelled.insert(xfer);
+		d->cond.notify_all();
+	}
+
+	bool
+	has_work_locked()
+	{
+		return !cancelled.empty() || (!in_pending.empty() && (!replay.empty() || in_status != 0)) ||
+		       (!out_pending.empty() && !hold_out);
+	}
+
+	static void
+	handle_events(ql_xrsp_usb_backend *b, int64_t timeout_ns)
+	{
+		fake_device *d = from(b);
+		struct completion
+		{
+			ql_xrsp_usb_xfer *xfer;
+			int status;
+			int32_t length;
+		};
+		std::vector<completion> done;
+
+		{
+			std::unique_lock<std::mutex> lock(d->mutex);
+			d->cond.wait_for(lock, std::chrono::nanoseconds(timeout_ns), [d] { return d->has_work_locked(); });
+
+			for (auto *xfer : d->cancelled) {
+				auto &q = xfer->is_in ? d->in_pending : d->out_pending;
+				for (auto it = q.begin(); it != q.end(); ++it) {
+					if (*it == xfer) {
+						q.erase(it);
+						done.push_back({xfer, QL_XRSP_USB_CANCELLED, 0});
+						break;
+					}
+				}
+			}
+			d->cancelled.clear();
+
+			while (!d->out_pending.empty() && !d->hold_out) {
+				ql_xrsp_usb_xfer *xfer = d->out_pending.front();
+				d->out_pending.pop_front();
+				d->wire.emplace_back(xfer->data, xfer->data + xfer->length);
+				done.push_back({xfer, QL_XRSP_USB_OK, xfer->length});
+			}
+
+			while (!d->in_pending.empty() && d->in_status != 0) {
+				done.push_back({d->in_pending.front(), d->in_status, 0});
+				d->in_pending.pop_front();
+			}
+
+			while (!d->in_pending.empty() && !d->replay.empty()) {
+				ql_xrsp_usb_xfer *xfer = d->in_pending.front();
+				d->in_pending.pop_front();
+
+				std::vector<uint8_t> &next = d->replay.front();
+				int32_t amt = std::min<int32_t>(xfer->length, (int32_t)next.size());
+				memcpy(xfer->data, next.data(), amt);
+				next.erase(next.begin(), next.begin() + amt);
+				if (next.empty()) {
+					d->replay.pop_front();
+				}
+				done.push_back({xfer, QL_XRSP_USB_OK, amt});
+			}
+		}
+
+		// Like libusb, the device lock is not held while the engine runs.
+		for (auto &c : done) {
+			ql_xrsp_usb_engine_complete(c.xfer, c.status, c.length);
+		}
+	}
+
+	void
+	set_in_status(int status)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		in_status = status;
+		cond.notify_all();
+	}
+
+	int
+	in_submits()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return num_in_submits;
+	}
+
+	void
+	set_hold_out(bool hold)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		hold_out = hold;
+		cond.notify_all();
+	}
+
+	size_t
+	num_out_pending()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return out_pending.size();
+	}
+
+	std::vector<std::vector<uint8_t>>
+	wire_log()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return wire;
+	}
+};
+
+struct engine_fixture
+{
+	fake_device dev;
+	ql_xrsp_usb_engine engine;
+	ql_xrsp_tx_arena arena;
+	int num_errors = 0;
+
+	engine_fixture(uint32_t num_in, int32_t in_size, uint32_t num_out)
+	{
+		ql_xrsp_usb_config config = {num_in, in_size, num_out};
+		REQUIRE(ql_xrsp_usb_engine_init(&engine, &dev.base, &config, on_error, this) == 0);
+		REQUIRE(ql_xrsp_tx_arena_init(&arena, 0x1000000) == 0);
+	}
+
+	~engine_fixture()
+	{
+		ql_xrsp_usb_engine_destroy(&engine);
+		ql_xrsp_tx_arena_destroy(&arena);
+	}
+
+	static void
+	on_error(void *ptr, bool is_in, int status)
+	{
+		((engine_fixture *)ptr)->num_errors++;
+	}
+
+	ql_xrsp_tx_buf
+	make_buf(const std::vector<uint8_t> &payload)
+	{
+		ql_xrsp_tx_buf buf;
+		REQUIRE(ql_xrsp_tx_arena_carve(&arena, &buf, payload.size()) == 0);
+		REQUIRE(ql_xrsp_tx_buf_append(&buf, payload.data(), payload.size()));
+		return buf;
+	}
+
+	bool
+	queued(int prio)
+	{
+		os_mutex_lock(&engine.mutex);
+		bool ret = engine.queue_head[prio] != NULL;
+		os_mutex_unlock(&engine.mutex);
+		return ret;
+	}
+};
+
+template <typename F>
+bool
+wait_until(F f)
+{
+	for (int i = 0; i < 2000; i++) {
+		if (f()) {
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+/*!
+ * Headset traffic as it comes off the IN endpoint: topic packets packed into
+ * transfers that are padded to 0x400 with fill packets.
+ */
+std::deque<std::vector<uint8_t>>
+make_capture(ql_xrsp_tx_arena *arena, int num_transfers)
+{
+	std::deque<std::vector<uint8_t>> capture;
+
+	ql_xrsp_tx_buf buf;
+	REQUIRE(ql_xrsp_tx_arena_carve(arena, &buf, QL_XRSP_TX_MAX_PAYLOAD) == 0);
+
+	const uint8_t topics[] = {TOPIC_POSE, TOPIC_HOSTINFO_ADV, TOPIC_LOGGING, TOPIC_RUNTIME_IPC};
+	for (int i = 0; i < num_transfers; i++) {
+		size_t size = (i % 7 == 0) ? 0x1800 + i : 0x90 + (i % 5) * 0x21;
+		auto payload = make_payload(size, (uint8_t)i);
+
+		ql_xrsp_tx_buf_reset(&buf);
+		REQUIRE(ql_xrsp_tx_buf_append(&buf, payload.data(), payload.size()));
+
+		ql_xrsp_tx_iter it = {};
+		uint8_t *slot;
+		uint32_t len;
+		REQUIRE(ql_xrsp_tx_buf_next_record(&buf, &it, &slot, &len));
+		int32_t framed = ql_xrsp_tx_frame(slot, len, topics[i % 4], (uint16_t)i);
+		capture.emplace_back(slot, slot + framed);
+	}
+
+	return capture;
+}
+
+} // namespace
+
+
+TEST_CASE("ql_xrsp_usb_topic_prio")
+{
+	CHECK(ql_xrsp_usb_topic_prio(TOPIC_POSE) == QL_XRSP_USB_PRIO_HIGH);
+	CHECK(ql_xrsp_usb_topic_prio(TOPIC_HOSTINFO_ADV) == QL_XRSP_USB_PRIO_HIGH);
+	CHECK(ql_xrsp_usb_topic_prio(TOPIC_RUNTIME_IPC) == QL_XRSP_USB_PRIO_NORMAL);
+	CHECK(ql_xrsp_usb_topic_prio(TOPIC_SLICE_0) == QL_XRSP_USB_PRIO_LOW);
+	CHECK(ql_xrsp_usb_topic_prio(TOPIC_SLICE_15) == QL_XRSP_USB_PRIO_LOW);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_replay")
+{
+	engine_fixture f(4, 0x400, 2);
+
+	auto capture = make_capture(&f.arena, 200);
+	std::vector<uint8_t> expected;
+	for (const auto &transfer : capture) {
+		expected.insert(expected.end(), transfer.begin(), transfer.end());
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(f.dev.mutex);
+		f.dev.replay = capture;
+	}
+
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	std::vector<uint8_t> received;
+	auto rx = [](void *ptr, const uint8_t *data, int32_t size) {
+		auto *out = (std::vector<uint8_t> *)ptr;
+		out->insert(out->end(), data, data + size);
+	};
+
+	for (int i = 0; i < 1000 && received.size() < expected.size(); i++) {
+		REQUIRE(ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS * 10, rx, &received) >= 0);
+	}
+
+	// Several transfers are in flight but data must come out in order.
+	CHECK(received == expected);
+	CHECK(f.engine.bytes_in == expected.size());
+	CHECK(f.num_errors == 0);
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_read_errors")
+{
+	engine_fixture f(4, 0x400, 2);
+	size_t received = 0;
+	auto rx = [](void *ptr, const uint8_t *, int32_t size) { *(size_t *)ptr += size; };
+
+	// Fills the replay, returns how many bytes the reads should see.
+	auto replay = [&](int num_transfers) {
+		size_t size = 0;
+		std::unique_lock<std::mutex> lock(f.dev.mutex);
+		for (auto &transfer : make_capture(&f.arena, num_transfers)) {
+			size += transfer.size();
+			f.dev.replay.push_back(transfer);
+		}
+		return size;
+	};
+
+	SECTION("nothing left to wake the next read")
+	{
+		size_t expected = replay(8);
+		ql_xrsp_usb_engine_start(&f.engine);
+
+		for (int i = 0; i < 100 && received < expected; i++) {
+			REQUIRE(ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS * 10, rx, &received) >= 0);
+		}
+		REQUIRE(received == expected);
+
+		auto start = std::chrono::steady_clock::now();
+		CHECK(ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS * 20, rx, &received) == 0);
+		CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+	}
+
+	SECTION("failing transfers are retried at a limited rate")
+	{
+		f.dev.set_in_status(QL_XRSP_USB_ERROR);
+		ql_xrsp_usb_engine_start(&f.engine);
+
+		auto start = std::chrono::steady_clock::now();
+		int errors = 0;
+		while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50)) {
+			errors += ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS, rx, &received) < 0;
+		}
+
+		// About one round of resubmits per retry period, not one per read.
+		CHECK(errors > 0);
+		CHECK(f.dev.in_submits() <= 4 * 10);
+
+		// Picks up again once the endpoint works.
+		size_t expected = replay(2);
+		f.dev.set_in_status(0);
+		for (int i = 0; i < 100 && received < expected; i++) {
+			ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS * 10, rx, &received);
+		}
+		CHECK(received == expected);
+	}
+
+	SECTION("a vanished device is not read from again")
+	{
+		f.dev.set_in_status(QL_XRSP_USB_NO_DEVICE);
+		ql_xrsp_usb_engine_start(&f.engine);
+
+		CHECK(ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS * 10, rx, &received) == QL_XRSP_USB_NO_DEVICE);
+		REQUIRE(wait_until([&] { return f.engine.num_in_flight == 0; }));
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		for (int i = 0; i < 5; i++) {
+			ql_xrsp_usb_engine_read(&f.engine, U_TIME_1MS_IN_NS, rx, &received);
+		}
+		CHECK(f.dev.in_submits() == 4);
+	}
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_loopback")
+{
+	engine_fixture f(2, 0x400, 4);
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	const int num_threads = 4;
+	const int num_sends = 25;
+	std::vector<std::vector<uint8_t>> payloads;
+	for (int t = 0; t < num_threads; t++) {
+		payloads.push_back(make_payload(0x48000 + t * 0x123, (uint8_t)t));
+	}
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		ql_xrsp_tx_buf buf;
+		REQUIRE(ql_xrsp_tx_arena_carve(&f.arena, &buf, payloads[t].size()) == 0);
+		threads.emplace_back([&f, &payloads, t, buf]() mutable {
+			uint8_t topic = t % 2 ? TOPIC_SLICE_0 + t : TOPIC_POSE;
+			for (int i = 0; i < num_sends; i++) {
+				ql_xrsp_tx_buf_reset(&buf);
+				ql_xrsp_tx_buf_append(&buf, payloads[t].data(), payloads[t].size());
+				ql_xrsp_usb_engine_send(&f.engine, topic, &buf);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto wire = f.dev.wire_log();
+	REQUIRE(wire.size() == num_threads * num_sends * 2);
+
+	// Sequence numbers are handed out as records go on the wire.
+	for (size_t i = 0; i < wire.size(); i++) {
+		CHECK(first_packet(wire[i]).sequence_num == (uint16_t)i);
+		CHECK(wire[i].size() % QL_XRSP_TX_ALIGN == 0);
+	}
+
+	CHECK(f.engine.max_out_in_flight > 1);
+	CHECK(f.engine.max_out_in_flight <= 4);
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_priority")
+{
+	engine_fixture f(1, 0x400, 1);
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	// A slice made of four topic packets, with the first one stuck on the wire.
+	auto video = make_payload(QL_XRSP_TX_MAX_PAYLOAD * 4, 1);
+	auto pose = make_payload(0x40, 2);
+	ql_xrsp_tx_buf video_buf = f.make_buf(video);
+	ql_xrsp_tx_buf pose_buf = f.make_buf(pose);
+
+	f.dev.set_hold_out(true);
+
+	int video_ret = -1;
+	std::thread video_thread([&] { video_ret = ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_0, &video_buf); });
+	REQUIRE(wait_until([&] { return f.dev.num_out_pending() == 1; }));
+
+	int pose_ret = -1;
+	std::thread pose_thread([&] { pose_ret = ql_xrsp_usb_engine_send(&f.engine, TOPIC_POSE, &pose_buf); });
+	REQUIRE(wait_until([&] { return f.queued(QL_XRSP_USB_PRIO_HIGH); }));
+
+	f.dev.set_hold_out(false);
+	video_thread.join();
+	pose_thread.join();
+
+	CHECK(video_ret == QL_XRSP_USB_OK);
+	CHECK(pose_ret == QL_XRSP_USB_OK);
+
+	auto wire = f.dev.wire_log();
+	REQUIRE(wire.size() == 5);
+
+	// The pose only waits for the record already in flight.
+	CHECK(first_packet(wire[0]).topic == TOPIC_SLICE_0);
+	CHECK(first_packet(wire[1]).topic == TOPIC_POSE);
+	for (size_t i = 2; i < wire.size(); i++) {
+		CHECK(first_packet(wire[i]).topic == TOPIC_SLICE_0);
+	}
+	for (size_t i = 0; i < wire.size(); i++) {
+		CHECK(first_packet(wire[i]).sequence_num == (uint16_t)i);
+	}
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_batch_priority")
+{
+	engine_fixture f(1, 0x400, 1);
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	auto video = make_payload(QL_XRSP_TX_MAX_PAYLOAD * 2, 1);
+	auto haptic = make_payload(0x30, 2);
+	auto ipc = make_payload(0x50, 3);
+	ql_xrsp_tx_buf video_buf = f.make_buf(video);
+
+	// A control batch with a haptic pulse in it goes out at its priority.
+	ql_xrsp_tx_buf batch;
+	REQUIRE(ql_xrsp_tx_arena_carve(&f.arena, &batch, 0x1000) == 0);
+	REQUIRE(ql_xrsp_tx_buf_append_packet(&batch, TOPIC_HAPTIC, haptic.data(), haptic.size()));
+	REQUIRE(ql_xrsp_tx_buf_append_packet(&batch, TOPIC_RUNTIME_IPC, ipc.data(), ipc.size()));
+
+	f.dev.set_hold_out(true);
+
+	std::thread video_thread([&] { ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_0, &video_buf); });
+	REQUIRE(wait_until([&] { return f.dev.num_out_pending() == 1; }));
+
+	int batch_ret = -1;
+	std::thread batch_thread(
+	    [&] { batch_ret = ql_xrsp_usb_engine_send_batch(&f.engine, QL_XRSP_USB_PRIO_HIGH, &batch); });
+	REQUIRE(wait_until([&] { return f.queued(QL_XRSP_USB_PRIO_HIGH); }));
+
+	f.dev.set_hold_out(false);
+	video_thread.join();
+	batch_thread.join();
+
+	CHECK(batch_ret == QL_XRSP_USB_OK);
+
+	auto wire = f.dev.wire_log();
+	REQUIRE(wire.size() == 3);
+	CHECK(first_packet(wire[0]).topic == TOPIC_SLICE_0);
+	CHECK(first_packet(wire[1]).topic == TOPIC_HAPTIC);
+	CHECK(first_packet(wire[2]).topic == TOPIC_SLICE_0);
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_send_bufs")
+{
+	engine_fixture f(1, 0x400, 1);
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	// Header, CSD and video of two slices, the first without CSD.
+	auto hdr = make_payload(0x80, 4);
+	auto csd = make_payload(0x20, 5);
+	auto video = make_payload(QL_XRSP_TX_MAX_PAYLOAD + 0x100, 6);
+	ql_xrsp_tx_buf hdr_a = f.make_buf(hdr);
+	ql_xrsp_tx_buf csd_a;
+	REQUIRE(ql_xrsp_tx_arena_carve(&f.arena, &csd_a, csd.size()) == 0);
+	ql_xrsp_tx_buf video_a = f.make_buf(video);
+	ql_xrsp_tx_buf hdr_b = f.make_buf(hdr);
+	ql_xrsp_tx_buf csd_b = f.make_buf(csd);
+	ql_xrsp_tx_buf video_b = f.make_buf(video);
+
+	ql_xrsp_tx_buf *bufs_a[] = {&hdr_a, &csd_a, &video_a};
+	ql_xrsp_tx_buf *bufs_b[] = {&hdr_b, &csd_b, &video_b};
+
+	f.dev.set_hold_out(true);
+
+	int ret_a = -1;
+	std::thread thread_a([&] { ret_a = ql_xrsp_usb_engine_send_bufs(&f.engine, TOPIC_SLICE_0, bufs_a, 3); });
+	REQUIRE(wait_until([&] { return f.dev.num_out_pending() == 1; }));
+
+	int ret_b = -1;
+	std::thread thread_b([&] { ret_b = ql_xrsp_usb_engine_send_bufs(&f.engine, TOPIC_SLICE_1, bufs_b, 3); });
+	REQUIRE(wait_until([&] {
+		os_mutex_lock(&f.engine.mutex);
+		bool ret = f.engine.queue_tail[QL_XRSP_USB_PRIO_LOW] != f.engine.queue_head[QL_XRSP_USB_PRIO_LOW];
+		os_mutex_unlock(&f.engine.mutex);
+		return ret;
+	}));
+
+	f.dev.set_hold_out(false);
+	thread_a.join();
+	thread_b.join();
+
+	CHECK(ret_a == QL_XRSP_USB_OK);
+	CHECK(ret_b == QL_XRSP_USB_OK);
+
+	// Each slice goes out whole, the empty CSD is skipped.
+	auto wire = f.dev.wire_log();
+	REQUIRE(wire.size() == 7);
+	for (size_t i = 0; i < 3; i++) {
+		CHECK(first_packet(wire[i]).topic == TOPIC_SLICE_0);
+	}
+	for (size_t i = 3; i < wire.size(); i++) {
+		CHECK(first_packet(wire[i]).topic == TOPIC_SLICE_1);
+	}
+	for (size_t i = 0; i < wire.size(); i++) {
+		CHECK(first_packet(wire[i]).sequence_num == (uint16_t)i);
+	}
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_stop")
+{
+	engine_fixture f(4, 0x400, 2);
+	ql_xrsp_usb_engine_start(&f.engine);
+
+	auto video = make_payload(QL_XRSP_TX_MAX_PAYLOAD * 3, 3);
+	ql_xrsp_tx_buf video_buf = f.make_buf(video);
+
+	SECTION("stopping fails sends in flight and queued")
+	{
+		f.dev.set_hold_out(true);
+
+		int ret = 0;
+		std::thread sender([&] { ret = ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_1, &video_buf); });
+		REQUIRE(wait_until([&] { return f.dev.num_out_pending() == 2; }));
+
+		ql_xrsp_usb_engine_stop(&f.engine);
+		sender.join();
+
+		CHECK(ret == QL_XRSP_USB_CANCELLED);
+		CHECK(f.engine.num_in_flight == 0);
+		CHECK(f.num_errors == 0);
+
+		// Sends while stopped fail straight away, a restart brings it back.
+		ql_xrsp_tx_buf_reset(&video_buf);
+		ql_xrsp_tx_buf_append(&video_buf, video.data(), video.size());
+		CHECK(ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_1, &video_buf) == QL_XRSP_USB_NO_DEVICE);
+
+		f.dev.set_hold_out(false);
+		ql_xrsp_usb_engine_start(&f.engine);
+		CHECK(ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_1, &video_buf) == QL_XRSP_USB_OK);
+	}
+
+	SECTION("a vanished device fails the send")
+	{
+		{
+			std::unique_lock<std::mutex> lock(f.dev.mutex);
+			f.dev.gone = true;
+		}
+		CHECK(ql_xrsp_usb_engine_send(&f.engine, TOPIC_SLICE_1, &video_buf) == QL_XRSP_USB_NO_DEVICE);
+	}
+
+	ql_xrsp_usb_engine_stop(&f.engine);
+}
+
+TEST_CASE("ql_xrsp_usb_engine_init_failure")
+{
+	// Fails the Nth transfer init and counts what gets torn down.
+	static int fail_at;
+	static int num_init;
+	static int num_fini;
+	static int num_destroy;
+
+	ql_xrsp_usb_backend backend = {};
+	backend.xfer_init = [](ql_xrsp_usb_backend *, ql_xrsp_usb_xfer *) { return num_init++ == fail_at ? -1 : 0; };
+	backend.xfer_fini = [](ql_xrsp_usb_backend *, ql_xrsp_usb_xfer *) { num_fini++; };
+	backend.destroy = [](ql_xrsp_usb_backend *) { num_destroy++; };
+
+	// 4 IN and 2 OUT, fail one IN, the first OUT and the last OUT.
+	for (int i : {2, 4, 5}) {
+		fail_at = i;
+		num_init = num_fini = num_destroy = 0;
+
+		ql_xrsp_usb_engine engine;
+		ql_xrsp_usb_config config = {4, 0x400, 2};
+		CHECK(ql_xrsp_usb_engine_init(&engine, &backend, &config, nullptr, nullptr) != 0);
+
+		CHECK(num_fini == fail_at);
+		CHECK(num_destroy == 1);
+		CHECK(engine.in_xfers == nullptr);
+		CHECK(engine.backend == nullptr);
+	}
+}
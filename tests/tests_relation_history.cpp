@@ -0,0 +1,327 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Relation history batch and concurrency tests.
+ */
+
+#include "math/m_api.h"
+#include "math/m_relation_history.h"
+#include "math/m_vec3.h"
+#include "os/os_threading.h"
+#include "os/os_time.h"
+#include "util/u_template_historybuf.hpp"
+#include "util/u_time.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+constexpr uint64_t T0 = 20 * (uint64_t)U_TIME_1S_IN_NS;
+constexpr uint64_t Step = U_TIME_1MS_IN_NS;
+
+constexpr xrt_space_relation_flags AllFlags = (xrt_space_relation_flags)( //
+    XRT_SPACE_RELATION_POSITION_TRACKED_BIT |                             //
+    XRT_SPACE_RELATION_POSITION_VALID_BIT |                               //
+    XRT_SPACE_RELATION_ORIENTATION_TRACKED_BIT |                          //
+    XRT_SPACE_RELATION_ORIENTATION_VALID_BIT |                            //
+    XRT_SPACE_RELATION_LINEAR_VELOCITY_VALID_BIT |                        //
+    XRT_SPACE_RELATION_ANGULAR_VELOCITY_VALID_BIT);                       //
+
+// A device spinning around an axis and moving along x, one sample per step.
+xrt_space_relation
+make_relation(uint64_t k, float radians_per_step = 0.01f)
+{
+	xrt_space_relation relation = XRT_SPACE_RELATION_ZERO;
+	relation.relation_flags = AllFlags;
+
+	xrt_vec3 axis = {0.f, 0.6f, 0.8f};
+	math_quat_from_angle_vector(radians_per_step * (float)k, &axis, &relation.pose.orientation);
+	relation.pose.position = {(float)k * 0.001f, 1.6f, 0.f};
+	relation.linear_velocity = {1.f, 0.f, (float)k};
+	relation.angular_velocity = {0.f, (float)k, 0.f};
+	return relation;
+}
+
+void
+check_same(const xrt_space_relation &a, const xrt_space_relation &b)
+{
+	const double eps = 1e-5;
+	CHECK(a.relation_flags == b.relation_flags);
+	CHECK(a.pose.position.x == Approx(b.pose.position.x).epsilon(eps));
+	CHECK(a.pose.position.y == Approx(b.pose.position.y).epsilon(eps));
+	CHECK(a.pose.position.z == Approx(b.pose.position.z).margin(eps));
+	CHECK(a.linear_velocity.z == Approx(b.linear_velocity.z).epsilon(eps));
+	CHECK(a.angular_velocity.y == Approx(b.angular_velocity.y).epsilon(eps));
+
+	if ((a.relation_flags & XRT_SPACE_RELATION_ORIENTATION_VALID_BIT) == 0) {
+		return;
+	}
+
+	// Either sign is the same rotation.
+	float dot = a.pose.orientation.x * b.pose.orientation.x + a.pose.orientation.y * b.pose.orientation.y +
+	            a.pose.orientation.z * b.pose.orientation.z + a.pose.orientation.w * b.pose.orientation.w;
+	CHECK(std::abs(dot) == Approx(1.f).margin(1e-6));
+}
+
+// What m_relation_history did before, a mutex around a history buffer.
+struct MutexHistory
+{
+	struct Entry
+	{
+		xrt_space_relation relation;
+		uint64_t timestamp;
+	};
+
+	xrt::auxiliary::util::HistoryBuffer<Entry, 4096> impl;
+	xrt::auxiliary::os::Mutex mutex;
+
+	void
+	push(const xrt_space_relation &relation, uint64_t timestamp)
+	{
+		std::unique_lock<xrt::auxiliary::os::Mutex> lock(mutex);
+		impl.push_back({relation, timestamp});
+	}
+
+	void
+	get(uint64_t at, xrt_space_relation *out)
+	{
+		std::unique_lock<xrt::auxiliary::os::Mutex> lock(mutex);
+		auto it = std::lower_bound(impl.begin(), impl.end(), at,
+		                           [](const Entry &e, uint64_t timestamp) { return e.timestamp < timestamp; });
+		if (it == impl.end() || it == impl.begin()) {
+			*out = impl.back().relation;
+			return;
+		}
+		const Entry &before = *(it - 1);
+		float t = (float)(at - before.timestamp) / (float)(it->timestamp - before.timestamp);
+		math_quat_slerp(&before.relation.pose.orientation, &it->relation.pose.orientation, t,
+		                &out->pose.orientation);
+		out->pose.position = m_vec3_lerp(before.relation.pose.position, it->relation.pose.position, t);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("m_relation_history_get_batch")
+{
+	m_relation_history *a = nullptr;
+	m_relation_history *b = nullptr;
+	m_relation_history_create(&a);
+	m_relation_history_create(&b);
+
+	for (uint64_t k = 0; k < 100; k++) {
+		xrt_space_relation relation = make_relation(k);
+		CHECK(m_relation_history_push(a, &relation, T0 + k * Step));
+		// Big steps, make the approximated slerp work for it.
+		relation = make_relation(k, 0.4f);
+		CHECK(m_relation_history_push(b, &relation, T0 + k * Step));
+	}
+
+	std::vector<m_relation_history *> rhs;
+	std::vector<uint64_t> timestamps;
+	for (uint64_t k = 0; k < 99; k++) {
+		for (m_relation_history *rh : {a, b}) {
+			// More than one batch worth of interpolation.
+			rhs.push_back(rh);
+			timestamps.push_back(T0 + k * Step + Step / 3);
+		}
+	}
+	rhs.insert(rhs.end(), {a, a, a, b});
+	timestamps.insert(timestamps.end(), {T0 + 5 * Step, T0 - Step, T0 + 200 * Step, 0});
+
+	std::vector<xrt_space_relation> batch(rhs.size());
+	std::vector<m_relation_history_result> results(rhs.size());
+	m_relation_history_get_batch(rhs.data(), timestamps.data(), (uint32_t)rhs.size(), batch.data(), results.data());
+
+	for (size_t i = 0; i < rhs.size(); i++) {
+		xrt_space_relation single = XRT_SPACE_RELATION_ZERO;
+		CHECK(results[i] == m_relation_history_get(rhs[i], timestamps[i], &single));
+		check_same(batch[i], single);
+	}
+
+	CHECK(results[results.size() - 4] == M_RELATION_HISTORY_RESULT_EXACT);
+	CHECK(results[results.size() - 3] == M_RELATION_HISTORY_RESULT_REVERSE_PREDICTED);
+	CHECK(results[results.size() - 2] == M_RELATION_HISTORY_RESULT_PREDICTED);
+	CHECK(results[results.size() - 1] == M_RELATION_HISTORY_RESULT_INVALID);
+
+	m_relation_history_destroy(&a);
+	m_relation_history_destroy(&b);
+}
+
+TEST_CASE("m_relation_history_concurrent")
+{
+	// Readers racing a writer must never see a relation that wasn't pushed.
+	m_relation_history *rh = nullptr;
+	m_relation_history_create(&rh);
+
+	xrt_space_relation first = make_relation(0);
+	m_relation_history_push(rh, &first, T0);
+
+	const uint64_t count = 20000; // Wraps the buffer a few times.
+	std::atomic<bool> running{true};
+	std::thread writer([&] {
+		for (uint64_t k = 1; k < count; k++) {
+			xrt_space_relation relation = make_relation(k);
+			m_relation_history_push(rh, &relation, T0 + k * Step);
+		}
+		running = false;
+	});
+
+	std::atomic<int> torn{0};
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&] {
+			while (running) {
+				uint64_t time_ns = 0;
+				xrt_space_relation latest;
+				if (!m_relation_history_get_latest(rh, &time_ns, &latest)) {
+					torn++;
+					continue;
+				}
+
+				// Every field comes from the same push.
+				uint64_t k = (time_ns - T0) / Step;
+				if (latest.linear_velocity.z != (float)k || latest.angular_velocity.y != (float)k) {
+					torn++;
+				}
+
+				xrt_space_relation exact;
+				if (m_relation_history_get(rh, time_ns, &exact) == M_RELATION_HISTORY_RESULT_EXACT &&
+				    exact.linear_velocity.z != (float)k) {
+					torn++;
+				}
+			}
+		});
+	}
+
+	writer.join();
+	for (auto &t : readers) {
+		t.join();
+	}
+
+	CHECK(torn == 0);
+	CHECK(m_relation_history_get_size(rh) == 4096);
+
+	m_relation_history_clear(rh);
+	CHECK(m_relation_history_get_size(rh) == 0);
+
+	m_relation_history_destroy(&rh);
+}
+
+TEST_CASE("m_relation_history_benchmark", "[.][benchmark]")
+{
+	// A driver pushing at 1kHz while the compositor, IPC and space overseer
+	// threads query, against the mutex protected history that was used before.
+	const int reader_count = 4;
+	const int query_count = 200000;
+
+	auto run = [&](const char *name, auto push, auto get) {
+		for (uint64_t k = 0; k < 4096; k++) {
+			push(make_relation(k), T0 + k * Step);
+		}
+
+		std::atomic<bool> running{true};
+		std::atomic<uint64_t> latest{T0 + 4095 * Step};
+		std::thread writer([&] {
+			uint64_t k = 4096;
+			while (running) {
+				push(make_relation(k), T0 + k * Step);
+				latest = T0 + k * Step;
+				k++;
+				os_nanosleep(U_TIME_1MS_IN_NS);
+			}
+		});
+
+		std::vector<std::thread> readers;
+		std::vector<uint64_t> ns(reader_count);
+		uint64_t start = os_monotonic_get_ns();
+		for (int r = 0; r < reader_count; r++) {
+			readers.emplace_back([&, r] {
+				uint64_t before = os_monotonic_get_ns();
+				for (int q = 0; q < query_count; q++) {
+					xrt_space_relation out;
+					get(latest - (uint64_t)(q % 20) * Step - Step / 2, &out);
+				}
+				ns[r] = os_monotonic_get_ns() - before;
+			});
+		}
+		for (auto &t : readers) {
+			t.join();
+		}
+		uint64_t total = os_monotonic_get_ns() - start;
+		running = false;
+		writer.join();
+
+		uint64_t sum = 0;
+		for (uint64_t v : ns) {
+			sum += v;
+		}
+		std::cout << name << ": " << sum / (reader_count * (uint64_t)query_count) << "ns per query, "
+		          << reader_count * (uint64_t)query_count * U_TIME_1S_IN_NS / total << " queries/s" << std::endl;
+	};
+
+	{
+		MutexHistory history;
+		run(
+		    "mutex", [&](const xrt_space_relation &r, uint64_t t) { history.push(r, t); },
+		    [&](uint64_t t, xrt_space_relation *out) { history.get(t, out); });
+	}
+	{
+		m_relation_history *rh = nullptr;
+		m_relation_history_create(&rh);
+		run(
+		    "seqlock", [&](const xrt_space_relation &r, uint64_t t) { m_relation_history_push(rh, &r, t); },
+		    [&](uint64_t t, xrt_space_relation *out) { m_relation_history_get(rh, t, out); });
+		m_relation_history_destroy(&rh);
+	}
+
+	// Two views and two controllers, one by one and batched.
+	m_relation_history *rhs[4] = {};
+	for (auto &rh : rhs) {
+		m_relation_history_create(&rh);
+		for (uint64_t k = 0; k < 4096; k++) {
+			xrt_space_relation relation = make_relation(k);
+			m_relation_history_push(rh, &relation, T0 + k * Step);
+		}
+	}
+	m_relation_history *batch_rhs[4] = {rhs[0], rhs[1], rhs[2], rhs[3]};
+	uint64_t timestamps[4];
+	xrt_space_relation out[4];
+	m_relation_history_result results[4];
+	const int frame_count = 200000;
+
+	uint64_t start = os_monotonic_get_ns();
+	for (int f = 0; f < frame_count; f++) {
+		uint64_t at = T0 + (uint64_t)(f % 4000) * Step + Step / 2;
+		for (int i = 0; i < 4; i++) {
+			m_relation_history_get(batch_rhs[i], at, &out[i]);
+		}
+	}
+	uint64_t single_ns = os_monotonic_get_ns() - start;
+
+	start = os_monotonic_get_ns();
+	for (int f = 0; f < frame_count; f++) {
+		uint64_t at = T0 + (uint64_t)(f % 4000) * Step + Step / 2;
+		std::fill(timestamps, timestamps + 4, at);
+		m_relation_history_get_batch(batch_rhs, timestamps, 4, out, results);
+	}
+	uint64_t batch_ns = os_monotonic_get_ns() - start;
+
+	std::cout << "one by one: " << single_ns / frame_count << "ns per frame, batch: " << batch_ns / frame_count
+	          << "ns per frame" << std::endl;
+
+	for (auto &rh : rhs) {
+		m_relation_history_destroy(&rh);
+	}
+}
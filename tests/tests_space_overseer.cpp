@@ -0,0 +1,289 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Test the space overseer graph resolution.
+ */
+
+#include "xrt/xrt_device.h"
+
+#include "math/m_api.h"
+#include "os/os_time.h"
+#include "util/u_space_overseer.h"
+
+#include "catch/catch.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+
+namespace {
+
+constexpr xrt_space_relation_flags kFlagsValidTracked = (xrt_space_relation_flags)( //
+    XRT_SPACE_RELATION_ORIENTATION_VALID_BIT |                                      //
+    XRT_SPACE_RELATION_POSITION_VALID_BIT |                                         //
+    XRT_SPACE_RELATION_ORIENTATION_TRACKED_BIT |                                    //
+    XRT_SPACE_RELATION_POSITION_TRACKED_BIT);                                       //
+
+// Only what the overseer uses, counts the queries.
+struct counting_device
+{
+	xrt_device base = {};
+	xrt_pose pose = XRT_POSE_IDENTITY;
+	uint32_t call_count = 0;
+
+	explicit counting_device(const xrt_pose &p) : pose(p)
+	{
+		snprintf(base.str, sizeof(base.str), "Counting device");
+		base.get_tracked_pose = get_tracked_pose;
+	}
+
+	static void
+	get_tracked_pose(xrt_device *xdev, xrt_input_name name, uint64_t at_timestamp_ns, xrt_space_relation *out_relation)
+	{
+		counting_device *cd = (counting_device *)xdev;
+		cd->call_count++;
+
+		*out_relation = {};
+		out_relation->relation_flags = kFlagsValidTracked;
+		out_relation->pose = cd->pose;
+	}
+};
+
+xrt_pose
+make_pose(int i)
+{
+	xrt_pose p = XRT_POSE_IDENTITY;
+	xrt_vec3 axis = {0.3f, 1.0f, 0.2f * (float)(i % 3)};
+	math_vec3_normalize(&axis);
+	math_quat_from_angle_vector(0.1f + 0.05f * (float)i, &axis, &p.orientation);
+	p.position = {0.1f * (float)i, 0.02f, -0.05f * (float)(i % 4)};
+	return p;
+}
+
+xrt_pose
+compose(const xrt_pose &parent, const xrt_pose &child)
+{
+	xrt_pose out;
+	math_pose_transform(&parent, &child, &out);
+	return out;
+}
+
+xrt_pose
+invert(const xrt_pose &p)
+{
+	xrt_pose out;
+	math_pose_invert(&p, &out);
+	return out;
+}
+
+void
+check_pose(const xrt_space_relation &rel, const xrt_pose &expected)
+{
+	CHECK((rel.relation_flags & XRT_SPACE_RELATION_POSITION_VALID_BIT) != 0);
+	CHECK(rel.pose.position.x == Approx(expected.position.x).margin(0.0005));
+	CHECK(rel.pose.position.y == Approx(expected.position.y).margin(0.0005));
+	CHECK(rel.pose.position.z == Approx(expected.position.z).margin(0.0005));
+
+	// Either sign of the quaternion is the same rotation.
+	float dot = rel.pose.orientation.x * expected.orientation.x + rel.pose.orientation.y * expected.orientation.y +
+	            rel.pose.orientation.z * expected.orientation.z + rel.pose.orientation.w * expected.orientation.w;
+	CHECK(std::abs(dot) == Approx(1.0f).margin(0.0005));
+}
+
+/*!
+ * A chain of offset spaces deeper than a relation chain can hold, with a
+ * controller at the end of it. A tracker is mounted on the controller, its
+ * tracking origin is the controller grip pose.
+ */
+struct deep_graph
+{
+	static constexpr int kDepth = 12;
+	static constexpr int kSpaceCount = 50;
+
+	u_space_overseer *uso = nullptr;
+	xrt_space_overseer *xso = nullptr;
+
+	counting_device controller{make_pose(20)};
+	counting_device tracker{make_pose(21)};
+
+	std::vector<xrt_space *> chain;
+	xrt_space *grip = nullptr;
+	xrt_space *mount = nullptr;
+	xrt_space *tracker_pose = nullptr;
+
+	//! The located spaces, with what they are in the root space.
+	std::vector<xrt_space *> spaces;
+	std::vector<xrt_pose> expected_in_root;
+
+	xrt_pose controller_origin_in_root = XRT_POSE_IDENTITY;
+
+	deep_graph()
+	{
+		uso = u_space_overseer_create();
+		xso = (xrt_space_overseer *)uso;
+
+		xrt_space *parent = xso->semantic.root;
+		for (int i = 0; i < kDepth; i++) {
+			xrt_pose offset = make_pose(i);
+			xrt_space *xs = nullptr;
+			u_space_overseer_create_offset_space(uso, parent, &offset, &xs);
+			controller_origin_in_root = compose(controller_origin_in_root, offset);
+			chain.push_back(xs);
+			parent = xs;
+		}
+		u_space_overseer_link_space_to_device(uso, parent, &controller.base);
+		u_space_overseer_create_pose_space(uso, &controller.base, XRT_INPUT_GENERIC_HAND_TRACKING_LEFT, &grip);
+		xrt_pose grip_in_root = compose(controller_origin_in_root, controller.pose);
+
+		xrt_pose mount_offset = make_pose(30);
+		u_space_overseer_create_offset_space(uso, grip, &mount_offset, &mount);
+		u_space_overseer_link_space_to_device(uso, mount, &tracker.base);
+		u_space_overseer_create_pose_space(uso, &tracker.base, XRT_INPUT_GENERIC_TRACKER_POSE, &tracker_pose);
+		xrt_pose tracker_in_root = compose(compose(grip_in_root, mount_offset), tracker.pose);
+
+		// Children of all of them, like action spaces with poses.
+		for (int i = 0; i < kSpaceCount; i++) {
+			xrt_pose offset = make_pose(i + 40);
+			xrt_space *xs = nullptr;
+			switch (i % 3) {
+			case 0:
+				u_space_overseer_create_offset_space(uso, grip, &offset, &xs);
+				expected_in_root.push_back(compose(grip_in_root, offset));
+				break;
+			case 1:
+				u_space_overseer_create_offset_space(uso, tracker_pose, &offset, &xs);
+				expected_in_root.push_back(compose(tracker_in_root, offset));
+				break;
+			default: {
+				int depth = i % kDepth;
+				u_space_overseer_create_offset_space(uso, chain[depth], &offset, &xs);
+				xrt_pose in_root = XRT_POSE_IDENTITY;
+				for (int d = 0; d <= depth; d++) {
+					in_root = compose(in_root, make_pose(d));
+				}
+				expected_in_root.push_back(compose(in_root, offset));
+			} break;
+			}
+			spaces.push_back(xs);
+		}
+	}
+
+	~deep_graph()
+	{
+		for (xrt_space *&xs : spaces) {
+			xrt_space_reference(&xs, nullptr);
+		}
+		for (xrt_space *&xs : chain) {
+			xrt_space_reference(&xs, nullptr);
+		}
+		xrt_space_reference(&grip, nullptr);
+		xrt_space_reference(&mount, nullptr);
+		xrt_space_reference(&tracker_pose, nullptr);
+		xrt_space_overseer_destroy(&xso);
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("space_overseer_deep_graph")
+{
+	deep_graph g;
+	const xrt_pose identity = XRT_POSE_IDENTITY;
+
+	SECTION("single in root")
+	{
+		for (size_t i = 0; i < g.spaces.size(); i++) {
+			xrt_space_relation rel = {};
+			xrt_space_overseer_locate_space(g.xso, g.xso->semantic.root, &identity, 0, g.spaces[i], &identity,
+			                                &rel);
+			check_pose(rel, g.expected_in_root[i]);
+		}
+	}
+
+	SECTION("bulk in pose space")
+	{
+		// The base is the grip with an offset, also deeper than a chain.
+		xrt_pose base_offset = make_pose(60);
+		xrt_pose base_in_root = compose(compose(g.controller_origin_in_root, g.controller.pose), base_offset);
+
+		std::vector<xrt_pose> offsets(g.spaces.size());
+		for (size_t i = 0; i < offsets.size(); i++) {
+			offsets[i] = i % 2 == 0 ? identity : make_pose((int)i);
+		}
+
+		std::vector<xrt_space_relation> rels(g.spaces.size());
+		xrt_space_overseer_locate_spaces(g.xso, g.grip, &base_offset, 0, g.spaces.data(), offsets.data(),
+		                                 (uint32_t)g.spaces.size(), rels.data());
+
+		for (size_t i = 0; i < g.spaces.size(); i++) {
+			xrt_pose expected = compose(invert(base_in_root), compose(g.expected_in_root[i], offsets[i]));
+			check_pose(rels[i], expected);
+
+			// Same as locating them one by one.
+			xrt_space_relation single = {};
+			xrt_space_overseer_locate_space(g.xso, g.grip, &base_offset, 0, g.spaces[i], &offsets[i],
+			                                &single);
+			CHECK(single.relation_flags == rels[i].relation_flags);
+			check_pose(single, rels[i].pose);
+		}
+	}
+
+	SECTION("devices are only queried once per call")
+	{
+		std::vector<xrt_space_relation> rels(g.spaces.size());
+		std::vector<xrt_pose> offsets(g.spaces.size(), identity);
+		xrt_space_overseer_locate_spaces(g.xso, g.grip, &identity, 0, g.spaces.data(), offsets.data(),
+		                                 (uint32_t)g.spaces.size(), rels.data());
+
+		CHECK(g.controller.call_count == 1);
+		CHECK(g.tracker.call_count == 1);
+
+		// Device poses can change between calls.
+		g.tracker.pose = make_pose(22);
+		xrt_space_relation rel = {};
+		xrt_space_overseer_locate_space(g.xso, g.xso->semantic.root, &identity, 0, g.spaces[1], &identity, &rel);
+		xrt_pose grip_in_root = compose(g.controller_origin_in_root, g.controller.pose);
+		xrt_pose expected = compose(compose(compose(grip_in_root, make_pose(30)), g.tracker.pose), make_pose(41));
+		check_pose(rel, expected);
+		CHECK(g.tracker.call_count == 2);
+	}
+}
+
+TEST_CASE("space_overseer_benchmark", "[.][benchmark]")
+{
+	// Fifty spaces located each frame, like an application with many
+	// action spaces, one by one and all at once.
+	deep_graph g;
+	const xrt_pose identity = XRT_POSE_IDENTITY;
+	const uint32_t frame_count = 2000;
+	const uint32_t space_count = (uint32_t)g.spaces.size();
+
+	std::vector<xrt_pose> offsets(space_count, identity);
+	std::vector<xrt_space_relation> rels(space_count);
+
+	uint64_t start = os_monotonic_get_ns();
+	for (uint32_t f = 0; f < frame_count; f++) {
+		for (uint32_t i = 0; i < space_count; i++) {
+			xrt_space_overseer_locate_space(g.xso, g.xso->semantic.root, &identity, f, g.spaces[i], &identity,
+			                                &rels[i]);
+		}
+	}
+	uint64_t single_ns = os_monotonic_get_ns() - start;
+	uint32_t single_calls = g.controller.call_count + g.tracker.call_count;
+
+	start = os_monotonic_get_ns();
+	for (uint32_t f = 0; f < frame_count; f++) {
+		xrt_space_overseer_locate_spaces(g.xso, g.xso->semantic.root, &identity, f, g.spaces.data(),
+		                                 offsets.data(), space_count, rels.data());
+	}
+	uint64_t bulk_ns = os_monotonic_get_ns() - start;
+	uint32_t bulk_calls = g.controller.call_count + g.tracker.call_count - single_calls;
+
+	std::cout << "one by one: " << single_ns / frame_count << "ns per frame, " << single_calls / frame_count
+	          << " device queries per frame" << std::endl;
+	std::cout << "all at once: " << bulk_ns / frame_count << "ns per frame, " << bulk_calls / frame_count
+	          << " device queries per frame" << std::endl;
+}
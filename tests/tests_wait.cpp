@@ -0,0 +1,168 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Hybrid waiter tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_wait.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+
+namespace {
+
+uint64_t
+bin_sum(const u_wait_hybrid &uwh)
+{
+	uint64_t sum = 0;
+	for (uint64_t bin : uwh.stats.bins) {
+		sum += bin;
+	}
+	return sum;
+}
+
+struct jitter
+{
+	std::vector<int64_t> errors_ns;
+
+	int64_t
+	percentile(double p)
+	{
+		std::sort(errors_ns.begin(), errors_ns.end());
+		size_t index = (size_t)(p * (double)(errors_ns.size() - 1));
+		return errors_ns[index];
+	}
+
+	void
+	print(const char *name)
+	{
+		std::cout << name << ": woke up late p50 " << percentile(0.50) / 1000.0 << "us, p99 "
+		          << percentile(0.99) / 1000.0 << "us, max " << percentile(1.0) / 1000.0 << "us" << std::endl;
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("u_wait_hybrid")
+{
+	u_wait_hybrid uwh;
+	u_wait_hybrid_init(&uwh);
+
+	SECTION("spinning is opt-in")
+	{
+		CHECK_FALSE(uwh.spin);
+		CHECK(uwh.max_margin_ns <= 200 * 1000);
+	}
+
+	SECTION("never early")
+	{
+		uwh.spin = true;
+
+		for (int i = 0; i < 20; i++) {
+			uint64_t until_ns = os_monotonic_get_ns() + U_TIME_1MS_IN_NS + 300 * 1000 + i * 50 * 1000;
+			int64_t error_ns = u_wait_hybrid_until(&uwh, until_ns);
+			CHECK(os_monotonic_get_ns() >= until_ns);
+			CHECK(error_ns >= 0);
+		}
+
+		CHECK(uwh.stats.count == 20);
+		CHECK(uwh.stats.missed_count == 0);
+		CHECK(bin_sum(uwh) == 20);
+		CHECK(uwh.margin_ns >= uwh.min_margin_ns);
+		CHECK(uwh.margin_ns <= uwh.max_margin_ns);
+	}
+
+	SECTION("deadline passed")
+	{
+		CHECK(u_wait_hybrid_until(&uwh, os_monotonic_get_ns() - 1) == 0);
+		CHECK(uwh.stats.missed_count == 1);
+		CHECK(uwh.stats.bins[0] == 1);
+	}
+
+	SECTION("less than 1ms away is skipped")
+	{
+		uwh.spin = true;
+
+		uint64_t start_ns = os_monotonic_get_ns();
+		CHECK(u_wait_hybrid_until(&uwh, start_ns + 500 * 1000) == 0);
+		CHECK(os_monotonic_get_ns() - start_ns < 500 * 1000);
+		CHECK(uwh.stats.missed_count == 1);
+	}
+
+	SECTION("margin stays capped")
+	{
+		uwh.spin = true;
+		uwh.max_margin_ns = 10 * U_TIME_1MS_IN_NS;
+
+		for (int i = 0; i < 5; i++) {
+			u_wait_hybrid_until(&uwh, os_monotonic_get_ns() + 2 * U_TIME_1MS_IN_NS);
+			CHECK(uwh.margin_ns <= 200 * 1000);
+		}
+	}
+
+	SECTION("sleep only")
+	{
+		uwh.spin = false;
+
+		// Allowed to wake up the scheduler latency early, like u_wait_until.
+		uint64_t until_ns = os_monotonic_get_ns() + 2 * U_TIME_1MS_IN_NS;
+		u_wait_hybrid_until(&uwh, until_ns);
+		CHECK(os_monotonic_get_ns() + U_WAIT_MEASURED_SCHEDULER_LATENCY_NS >= until_ns);
+		CHECK(uwh.stats.last_spin_ns == 0);
+		CHECK(bin_sum(uwh) == 1);
+	}
+
+	u_wait_hybrid_fini(&uwh);
+}
+
+TEST_CASE("u_wait_hybrid_benchmark", "[.][benchmark]")
+{
+	// Frame like waits, a few milliseconds out, run it while loading the
+	// machine to see the difference.
+	const int wait_count = 500;
+	const uint64_t period_ns = 4 * U_TIME_1MS_IN_NS;
+
+	struct os_precise_sleeper sleeper;
+	os_precise_sleeper_init(&sleeper);
+
+	jitter sleep;
+	for (int i = 0; i < wait_count; i++) {
+		uint64_t until_ns = os_monotonic_get_ns() + period_ns;
+		u_wait_until(&sleeper, until_ns);
+		sleep.errors_ns.push_back((int64_t)(os_monotonic_get_ns() - until_ns));
+	}
+
+	os_precise_sleeper_deinit(&sleeper);
+
+	u_wait_hybrid uwh;
+	u_wait_hybrid_init(&uwh);
+	uwh.spin = true;
+
+	jitter hybrid;
+	uint64_t spin_ns = 0;
+	for (int i = 0; i < wait_count; i++) {
+		uint64_t until_ns = os_monotonic_get_ns() + period_ns;
+		hybrid.errors_ns.push_back(u_wait_hybrid_until(&uwh, until_ns));
+		spin_ns += (uint64_t)uwh.stats.last_spin_ns;
+	}
+
+	sleep.print("u_wait_until");
+	hybrid.print("u_wait_hybrid");
+	std::cout << "u_wait_hybrid: spun " << spin_ns / wait_count / 1000.0 << "us per wait, margin "
+	          << uwh.margin_ns / 1000.0 << "us" << std::endl;
+
+	std::cout << "u_wait_hybrid histogram (log2 us):";
+	for (uint64_t bin : uwh.stats.bins) {
+		std::cout << " " << bin;
+	}
+	std::cout << std::endl;
+
+	u_wait_hybrid_fini(&uwh);
+}
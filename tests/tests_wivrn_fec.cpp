@@ -0,0 +1,255 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief WiVRn video shard forward error correction tests.
+ */
+
+#include "wivrn/video_fec.h"
+#include "wivrn/external/rs.h"
+
+#include "catch/catch.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <vector>
+
+using xrt::drivers::wivrn::video_fec;
+
+
+namespace {
+
+// Serialized data shards are at most a bit more than the 1400 byte payload.
+constexpr size_t max_shard_size = 1500;
+
+std::vector<std::vector<uint8_t>>
+make_shards(size_t count, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<std::vector<uint8_t>> shards(count);
+	for (auto &shard : shards) {
+		// Mostly full shards, the last one of a slice is shorter.
+		shard.resize(rng() % 4 == 0 ? 1 + rng() % max_shard_size : max_shard_size - rng() % 32);
+		for (auto &b : shard) {
+			b = (uint8_t)rng();
+		}
+	}
+	return shards;
+}
+
+// What VideoEncoder::Encode used to do: pad everything and encode once at the end.
+std::vector<std::vector<uint8_t>>
+legacy_parity(std::vector<std::vector<uint8_t>> data, size_t num_parity)
+{
+	static std::once_flag once;
+	std::call_once(once, reed_solomon_init);
+
+	size_t max_size = 0;
+	for (const auto &shard : data) {
+		max_size = std::max(max_size, shard.size());
+	}
+
+	std::vector<std::vector<uint8_t>> parity(num_parity);
+	std::vector<unsigned char *> pointers;
+	for (auto &shard : data) {
+		shard.resize(max_size, 0);
+		pointers.push_back(shard.data());
+	}
+	for (auto &shard : parity) {
+		shard.resize(max_size, 0);
+		pointers.push_back(shard.data());
+	}
+
+	reed_solomon *rs = reed_solomon_new(data.size(), num_parity);
+	REQUIRE(rs != nullptr);
+	reed_solomon_encode(rs, pointers.data(), pointers.size(), max_size);
+	reed_solomon_release(rs);
+
+	return parity;
+}
+
+size_t
+encode(video_fec &fec, const std::vector<std::vector<uint8_t>> &data, size_t expected)
+{
+	fec.begin(expected, max_shard_size);
+	for (const auto &shard : data) {
+		fec.add(shard.data(), shard.size());
+	}
+	return fec.end();
+}
+
+std::vector<video_fec::simd>
+kernels()
+{
+	std::vector<video_fec::simd> res;
+	for (auto kernel : {video_fec::simd::none, video_fec::simd::ssse3, video_fec::simd::avx2,
+	                    video_fec::simd::neon}) {
+		if (video_fec::supported(kernel)) {
+			res.push_back(kernel);
+		}
+	}
+	return res;
+}
+
+} // namespace
+
+
+TEST_CASE("video_fec_matches_rs")
+{
+	for (auto kernel : kernels()) {
+		CAPTURE(video_fec::simd_name(kernel));
+		video_fec fec(0.05, kernel);
+
+		for (size_t count : {1, 2, 10, 37, 100, 200, 243}) {
+			CAPTURE(count);
+			auto data = make_shards(count, count);
+
+			size_t num_parity = encode(fec, data, count);
+			CHECK(num_parity == video_fec::parity_for(count, 0.05));
+			REQUIRE(num_parity > 0);
+			CHECK(fec.data_count() == count);
+
+			auto expected = legacy_parity(data, num_parity);
+			REQUIRE(fec.shard_size() == expected[0].size());
+			for (size_t j = 0; j < num_parity; j++) {
+				CAPTURE(j);
+				CHECK(std::equal(expected[j].begin(), expected[j].end(), fec.parity(j)));
+			}
+		}
+	}
+}
+
+TEST_CASE("video_fec_parity_count")
+{
+	// Parity is sized from the expected count, the actual one may differ.
+	video_fec fec(0.1);
+	auto data = make_shards(30, 3);
+
+	size_t num_parity = encode(fec, data, 100);
+	CHECK(num_parity == 10);
+	auto expected = legacy_parity(data, num_parity);
+	for (size_t j = 0; j < num_parity; j++) {
+		CHECK(std::equal(expected[j].begin(), expected[j].end(), fec.parity(j)));
+	}
+
+	SECTION("ratio knob")
+	{
+		CHECK(video_fec::parity_for(10, 0.05) == 1);
+		CHECK(video_fec::parity_for(100, 0.05) == 5);
+		CHECK(video_fec::parity_for(100, 0.2) == 20);
+		CHECK(video_fec::parity_for(100, 0.0) == 1);
+		CHECK(video_fec::parity_for(400, 0.05) == 20);
+		CHECK(video_fec::parity_for(400, 1.0) == video_fec::max_shards - 1);
+	}
+
+	SECTION("too many shards")
+	{
+		// Like before, data and parity past what GF(2^8) allows get no parity.
+		auto big = make_shards(300, 4);
+		CHECK(encode(fec, big, 300) == 0);
+		CHECK(encode(fec, big, 200) == 0);
+		auto edge = make_shards(250, 4);
+		CHECK(encode(fec, edge, 250) == 0);
+		CHECK(encode(fec, edge, 200) == 0);
+	}
+}
+
+TEST_CASE("video_fec_recovers")
+{
+	static std::once_flag once;
+	std::call_once(once, reed_solomon_init);
+
+	std::mt19937 rng(11);
+	video_fec fec(0.1);
+
+	for (size_t count : {10, 60, 150}) {
+		CAPTURE(count);
+		auto data = make_shards(count, 100 + count);
+		size_t num_parity = encode(fec, data, count);
+		REQUIRE(num_parity > 0);
+		size_t size = fec.shard_size();
+
+		// Drop as many data shards as there is parity, like the headset sees them.
+		std::vector<std::vector<uint8_t>> shards;
+		for (const auto &shard : data) {
+			shards.emplace_back(shard).resize(size, 0);
+		}
+		for (size_t j = 0; j < num_parity; j++) {
+			shards.emplace_back(fec.parity(j), fec.parity(j) + size);
+		}
+
+		std::vector<unsigned char> marks(count + num_parity, 0);
+		for (size_t lost = 0; lost < num_parity;) {
+			size_t i = rng() % count;
+			if (!marks[i]) {
+				marks[i] = 1;
+				std::fill(shards[i].begin(), shards[i].end(), 0);
+				lost++;
+			}
+		}
+
+		std::vector<unsigned char *> pointers;
+		for (auto &shard : shards) {
+			pointers.push_back(shard.data());
+		}
+
+		reed_solomon *rs = reed_solomon_new(count, num_parity);
+		REQUIRE(reed_solomon_reconstruct(rs, pointers.data(), marks.data(), pointers.size(), size) == 0);
+		reed_solomon_release(rs);
+
+		for (size_t i = 0; i < count; i++) {
+			CAPTURE(i);
+			CHECK(std::equal(data[i].begin(), data[i].end(), shards[i].begin()));
+		}
+	}
+}
+
+TEST_CASE("video_fec_benchmark", "[.][benchmark]")
+{
+	const int rounds = 50;
+
+	for (size_t count : {10, 50, 100, 200, 240, 400}) {
+		auto data = make_shards(count, 7);
+		size_t num_parity = video_fec::parity_for(count, 0.05);
+		std::cout << count << " data shards, " << num_parity << " parity:";
+
+		if (count + num_parity > video_fec::max_shards) {
+			std::cout << " no GF(2^8) code" << std::endl;
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			legacy_parity(data, num_parity);
+		}
+		double legacy = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		std::cout << " rs.c " << legacy / rounds << "us";
+
+		for (auto kernel : kernels()) {
+			video_fec fec(0.05, kernel);
+			encode(fec, data, count);
+
+			start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++) {
+				encode(fec, data, count);
+			}
+			double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+			// Only the last shard is left to fold in once it has been produced.
+			fec.begin(count, max_shard_size);
+			for (size_t i = 0; i + 1 < count; i++) {
+				fec.add(data[i].data(), data[i].size());
+			}
+			start = std::chrono::steady_clock::now();
+			fec.add(data.back().data(), data.back().size());
+			fec.end();
+			double last = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << ", " << video_fec::simd_name(kernel) << " " << us / rounds << "us (" << last
+			          << "us after the last shard)";
+		}
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,286 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief WiVRn tracking sample history tests.
+ */
+
+#include "wivrn/history.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+struct sample
+{
+	float value;
+	float velocity;
+	// Checks readers never see half written samples.
+	float check;
+};
+
+sample
+make_sample(float value)
+{
+	return {value, 2 * value, -value};
+}
+
+sample
+interpolate(const sample &a, const sample &b, float t)
+{
+	return make_sample(a.value * t + b.value * (1 - t));
+}
+
+sample
+extrapolate(const sample &a, const sample &b, uint64_t ta, uint64_t tb, uint64_t t)
+{
+	if (t < ta) {
+		return a;
+	}
+	return make_sample(b.value + b.velocity * (t - tb) * 1e-9f);
+}
+
+// The mutex and vector based history this replaced, as a reference.
+template <typename Data, size_t MaxSamples = 10>
+class locked_history
+{
+	struct TimedData : public Data
+	{
+		TimedData(const Data &d, uint64_t t) : Data(d), at_timestamp_ns(t) {}
+		uint64_t at_timestamp_ns;
+	};
+
+	std::mutex mutex;
+	std::vector<TimedData> data;
+
+public:
+	void
+	add_sample(uint64_t t, const Data &sample)
+	{
+		std::lock_guard lock(mutex);
+
+		auto it = std::lower_bound(data.begin(), data.end(), t,
+		                           [](TimedData &sample, uint64_t t) { return sample.at_timestamp_ns < t; });
+
+		if (it == data.end())
+			data.emplace_back(sample, t);
+		else if (it->at_timestamp_ns == t)
+			*it = TimedData(sample, t);
+		else
+			data.emplace(it, sample, t);
+
+		if (data.size() > MaxSamples)
+			data.erase(data.begin());
+	}
+
+	Data
+	get_at(uint64_t at_timestamp_ns)
+	{
+		std::lock_guard lock(mutex);
+
+		if (data.empty())
+			return {};
+
+		if (data.size() == 1)
+			return data[0];
+
+		if (data.front().at_timestamp_ns > at_timestamp_ns)
+			return extrapolate(data[0], data[1], data[0].at_timestamp_ns, data[1].at_timestamp_ns,
+			                   at_timestamp_ns);
+
+		for (size_t i = 1; i < data.size(); ++i) {
+			if (data[i].at_timestamp_ns > at_timestamp_ns) {
+				float t = float(data[i].at_timestamp_ns - at_timestamp_ns) /
+				          (data[i].at_timestamp_ns - data[i - 1].at_timestamp_ns);
+				return interpolate(data[i - 1], data[i], t);
+			}
+		}
+
+		const auto &d0 = data[data.size() - 2];
+		const auto &d1 = data.back();
+
+		return extrapolate(d0, d1, d0.at_timestamp_ns, d1.at_timestamp_ns, at_timestamp_ns);
+	}
+};
+
+struct sample_history : public history<sample>
+{
+	using history::add_sample;
+};
+
+bool
+operator==(const sample &a, const sample &b)
+{
+	return a.value == b.value and a.velocity == b.velocity and a.check == b.check;
+}
+
+} // namespace
+
+
+TEST_CASE("wivrn_history")
+{
+	sample_history h;
+
+	CHECK(h.get_at(100).value == 0);
+
+	h.add_sample(1000, make_sample(1));
+	CHECK(h.get_at(0).value == 1);
+	CHECK(h.get_at(5000).value == 1);
+
+	h.add_sample(2000, make_sample(2));
+	CHECK(h.get_at(1500).value == Approx(1.5));
+
+	SECTION("same timestamp replaces")
+	{
+		h.add_sample(2000, make_sample(3));
+		CHECK(h.get_at(1500).value == Approx(2));
+	}
+
+	SECTION("late sample")
+	{
+		h.add_sample(1500, make_sample(7));
+		CHECK(h.get_at(1500).value == Approx(7));
+		CHECK(h.get_at(1750).value == Approx(4.5));
+	}
+
+	SECTION("bounded")
+	{
+		for (int i = 3; i < 30; i++) {
+			h.add_sample(i * 1000, make_sample(i));
+		}
+		// Only the last 10 samples are kept, older queries extrapolate from the oldest ones.
+		CHECK(h.get_at(25500).value == Approx(25.5));
+		CHECK(h.get_at(5000).value == Approx(20));
+
+		// Older than everything: dropped.
+		h.add_sample(100, make_sample(-1));
+		CHECK(h.get_at(5000).value == Approx(20));
+	}
+}
+
+TEST_CASE("wivrn_history_matches_locked")
+{
+	std::mt19937 rng(4);
+
+	sample_history h;
+	locked_history<sample> reference;
+
+	uint64_t t = 1'000'000;
+	for (int i = 0; i < 5000; i++) {
+		// Mostly in order, some late and duplicate samples.
+		uint64_t at = t;
+		switch (rng() % 8) {
+		case 0: at = t - rng() % 20'000'000; break;
+		case 1: at = t - 1'000'000; break;
+		default: t += 1'000'000;
+		}
+
+		sample s = make_sample(rng() % 1000);
+		h.add_sample(at, s);
+		reference.add_sample(at, s);
+
+		for (int j = 0; j < 4; j++) {
+			uint64_t query = t - 15'000'000 + rng() % 20'000'000;
+			CAPTURE(i, query);
+			REQUIRE(h.get_at(query) == reference.get_at(query));
+		}
+	}
+}
+
+TEST_CASE("wivrn_history_concurrent")
+{
+	sample_history h;
+	std::atomic<bool> done = false;
+	std::atomic<int> torn = 0;
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 3; i++) {
+		readers.emplace_back([&] {
+			while (not done) {
+				// Before every sample: a plain copy of the oldest one, which is
+				// the next to be overwritten.
+				sample s = h.get_at(0);
+				if (s.velocity != 2 * s.value or s.check != -s.value) {
+					torn++;
+				}
+			}
+		});
+	}
+
+	for (int i = 0; i < 1000000; i++) {
+		h.add_sample(1000 + i, make_sample(i));
+	}
+	done = true;
+	for (auto &reader : readers) {
+		reader.join();
+	}
+
+	CHECK(torn == 0);
+}
+
+namespace {
+
+template <typename History>
+void
+contention(const char *name, int num_readers)
+{
+	History h;
+	std::atomic<bool> done = false;
+	std::atomic<uint64_t> reads = 0;
+	std::atomic<uint64_t> latest = 0;
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < num_readers; i++) {
+		readers.emplace_back([&] {
+			uint64_t n = 0;
+			while (not done) {
+				h.get_at(latest.load(std::memory_order_relaxed) + 10'000'000);
+				n++;
+			}
+			reads += n;
+		});
+	}
+
+	// Tracking at 1 kHz, ten times faster so there is something to measure.
+	const int samples = 20000;
+	auto start = std::chrono::steady_clock::now();
+	double worst_add = 0;
+	for (int i = 0; i < samples; i++) {
+		auto before = std::chrono::steady_clock::now();
+		uint64_t t = 1'000'000 + i * 100'000;
+		h.add_sample(t, make_sample(i));
+		latest = t;
+		worst_add = std::max(
+		    worst_add, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - before).count());
+
+		std::this_thread::sleep_until(start + std::chrono::microseconds(100 * (i + 1)));
+	}
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	done = true;
+	for (auto &reader : readers) {
+		reader.join();
+	}
+
+	std::cout << name << ", " << num_readers << " readers: " << reads / duration / 1e6 << "M get_at/s, worst add "
+	          << worst_add << "us" << std::endl;
+}
+
+} // namespace
+
+TEST_CASE("wivrn_history_benchmark", "[.][benchmark]")
+{
+	for (int readers : {1, 2, 4, 8}) {
+		contention<locked_history<sample>>("mutex", readers);
+		contention<sample_history>("seqlock", readers);
+	}
+}
@@ -0,0 +1,223 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief WiVRn adaptive bitrate tests, against a simulated channel.
+ */
+
+#include "wivrn/rate_controller.h"
+
+#include "catch/catch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace xrt::drivers::wivrn;
+
+
+namespace {
+
+constexpr float fps = 90;
+constexpr double interval = 1e9 / fps;
+constexpr size_t shard_size = to_headset::video_stream_data_shard::max_payload_size;
+
+rate_controller::settings
+make_settings(uint64_t min_bitrate, uint64_t max_bitrate, double min_fec_parity_ratio, int update_interval = 10)
+{
+	rate_controller::settings settings{};
+	settings.min_bitrate = min_bitrate;
+	settings.max_bitrate = max_bitrate;
+	settings.min_fec_parity_ratio = min_fec_parity_ratio;
+	settings.max_fec_parity_ratio = 0.5;
+	settings.fps = fps;
+	settings.update_interval = update_interval;
+	return settings;
+}
+
+// A bottleneck link with a drop tail queue and random loss, shards of a frame
+// are sent back to back every frame interval.
+struct channel
+{
+	double capacity; // bit/s
+	double loss = 0;
+	double queue_limit = 256 * 1024; // bytes
+	double base_delay = 2'000'000;   // ns
+	double decode_time = 3'000'000;  // ns
+
+	double link_free = 0;
+	std::mt19937 rng{42};
+
+	from_headset::feedback
+	send(uint64_t frame_index, int data, int parity)
+	{
+		double t = frame_index * interval;
+		double shard_time = shard_size * 8 / capacity * 1e9;
+		std::uniform_real_distribution<double> uniform;
+
+		from_headset::feedback feedback{};
+		feedback.frame_index = frame_index;
+		feedback.data_packets = data;
+		feedback.parity_packets = parity;
+
+		for (int i = 0; i < data + parity; i++) {
+			double backlog = std::max(0., link_free - t) * capacity / 8e9;
+			if (backlog > queue_limit) {
+				continue;
+			}
+			link_free = std::max(t, link_free) + shard_time;
+			if (uniform(rng) < loss) {
+				continue;
+			}
+
+			uint64_t arrival = link_free + base_delay;
+			if (feedback.received_first_packet == 0) {
+				feedback.received_first_packet = arrival;
+			}
+			feedback.received_last_packet = arrival;
+			if (i < data) {
+				feedback.received_data_packets++;
+			} else {
+				feedback.received_parity_packets++;
+			}
+		}
+
+		if (feedback.received_data_packets + feedback.received_parity_packets >= data) {
+			feedback.reconstructed = feedback.received_last_packet;
+			feedback.sent_to_decoder = feedback.reconstructed;
+			feedback.received_from_decoder = feedback.sent_to_decoder + decode_time;
+		}
+		return feedback;
+	}
+};
+
+struct simulation
+{
+	static constexpr uint64_t max_bitrate = 100'000'000;
+
+	rate_controller controller{make_settings(5'000'000, max_bitrate, 0.02)};
+	channel link;
+	rate_controller::target target{max_bitrate, 0.02};
+	uint64_t frame_index = 0;
+	std::mt19937 rng{1};
+
+	int frames = 0;
+	int unrecoverable = 0;
+
+	simulation(double capacity) : link{capacity} {}
+
+	// One frame through the encoder, the channel and back as feedback.
+	void
+	step()
+	{
+		if (auto t = controller.poll()) {
+			target = *t;
+		}
+
+		// Encoders don't hit the target exactly.
+		std::uniform_real_distribution<double> noise(0.8, 1.2);
+		double bytes = target.bitrate / fps / 8 * noise(rng);
+		int data = std::ceil(bytes / shard_size);
+		int parity = std::ceil(data * target.fec_parity_ratio);
+
+		auto feedback = link.send(frame_index++, data, parity);
+		frames++;
+		if (feedback.received_data_packets + feedback.received_parity_packets < data) {
+			unrecoverable++;
+		}
+
+		controller.feedback(feedback);
+	}
+
+	void
+	run(double seconds)
+	{
+		for (int i = 0; i < seconds * fps; i++) {
+			step();
+		}
+	}
+
+	// Frame statistics from now on.
+	void
+	reset_stats()
+	{
+		frames = 0;
+		unrecoverable = 0;
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("rate_controller_poll")
+{
+	rate_controller controller(make_settings(1'000'000, 10'000'000, 0.05, 2));
+
+	CHECK(controller.get_target().bitrate == 10'000'000);
+	CHECK_FALSE(controller.poll());
+
+	// A frame that could not be reconstructed: the next update lowers the bitrate.
+	from_headset::feedback feedback{};
+	feedback.data_packets = 10;
+	feedback.received_data_packets = 5;
+	controller.feedback(feedback);
+	CHECK_FALSE(controller.poll());
+	controller.feedback(feedback);
+
+	auto target = controller.poll();
+	REQUIRE(target);
+	CHECK(target->bitrate < 10'000'000);
+	CHECK(target->fec_parity_ratio > 0.05);
+	CHECK_FALSE(controller.poll());
+}
+
+TEST_CASE("rate_controller_converges")
+{
+	const double capacity = 40e6;
+	simulation sim(capacity);
+
+	sim.run(20);
+	sim.reset_stats();
+	sim.run(10);
+
+	CAPTURE(sim.target.bitrate, sim.unrecoverable);
+	CHECK(sim.target.bitrate > 0.4 * capacity);
+	CHECK(sim.target.bitrate < 0.85 * capacity);
+	CHECK(sim.unrecoverable < 0.01 * sim.frames);
+}
+
+TEST_CASE("rate_controller_capacity_change")
+{
+	simulation sim(80e6);
+	sim.run(10);
+	CHECK(sim.target.bitrate > 0.4 * 80e6);
+
+	sim.link.capacity = 20e6;
+	sim.run(1);
+	CAPTURE(sim.target.bitrate);
+	CHECK(sim.target.bitrate <= 20e6);
+
+	sim.run(20);
+	CHECK(sim.target.bitrate > 0.4 * 20e6);
+	CHECK(sim.target.bitrate < 0.85 * 20e6);
+
+	sim.link.capacity = 80e6;
+	sim.run(20);
+	CHECK(sim.target.bitrate > 0.4 * 80e6);
+}
+
+TEST_CASE("rate_controller_random_loss")
+{
+	// Plenty of capacity, but 3% of the shards are lost: more parity, same bitrate.
+	simulation sim(1e9);
+	sim.link.loss = 0.03;
+
+	sim.run(20);
+	sim.reset_stats();
+	sim.run(10);
+
+	CAPTURE(sim.target.bitrate, sim.target.fec_parity_ratio, sim.unrecoverable);
+	CHECK(sim.target.fec_parity_ratio >= 0.06);
+	CHECK(sim.target.bitrate >= 0.8 * simulation::max_bitrate);
+	CHECK(sim.unrecoverable < 0.02 * sim.frames);
+}
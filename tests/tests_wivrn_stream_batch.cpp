@@ -0,0 +1,248 @@
+// Copyright 2022, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief WiVRn batched video shard sending tests.
+ */
+
+#include "wivrn/wivrn_stream_batch.h"
+
+#include "catch/catch.hpp"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <poll.h>
+#include <random>
+#include <thread>
+#include <time.h>
+
+using namespace xrt::drivers::wivrn;
+
+using data_shard = to_headset::video_stream_data_shard;
+using parity_shard = to_headset::video_stream_parity_shard;
+
+
+namespace {
+
+struct loopback
+{
+	UDP receiver;
+	typed_socket<UDP, from_headset::stream_packets, to_headset::stream_packets> sender;
+
+	loopback()
+	{
+		receiver.bind(0);
+		receiver.set_receive_buffer_size(4 * 1024 * 1024);
+
+		sockaddr_in6 addr{};
+		socklen_t len = sizeof(addr);
+		REQUIRE(getsockname(receiver.get_fd(), (sockaddr *)&addr, &len) == 0);
+		sender.connect(in6addr_loopback, ntohs(addr.sin6_port));
+	}
+
+	std::vector<uint8_t>
+	receive()
+	{
+		pollfd fds{};
+		fds.fd = receiver.get_fd();
+		fds.events = POLLIN;
+		if (poll(&fds, 1, 1000) != 1) {
+			return {};
+		}
+
+		deserialization_packet packet = receiver.receive_raw();
+		std::vector<uint8_t> bytes(packet.remaining());
+		packet.read(bytes.data(), bytes.size());
+		return bytes;
+	}
+};
+
+std::vector<uint8_t>
+serialize(const to_headset::stream_packets &packet)
+{
+	serialization_packet p;
+	p.serialize(packet);
+	return std::move(p);
+}
+
+// A frame the way VideoEncoder cuts it: full shards, the end of each slice is shorter.
+struct frame
+{
+	std::vector<uint8_t> bitstream;
+	std::vector<data_shard> shards;
+	std::vector<std::pair<size_t, size_t>> ranges;
+
+	frame(size_t num_shards, uint64_t frame_idx, uint32_t seed)
+	{
+		std::mt19937 rng(seed);
+		for (size_t i = 0; i < num_shards; i++) {
+			bool end_of_slice = i % 40 == 39 or i + 1 == num_shards;
+			size_t size = end_of_slice ? rng() % data_shard::max_payload_size : data_shard::max_payload_size;
+			ranges.emplace_back(bitstream.size(), size);
+			for (size_t j = 0; j < size; j++) {
+				bitstream.push_back(rng());
+			}
+
+			data_shard &shard = shards.emplace_back();
+			shard.stream_item_idx = 1;
+			shard.frame_idx = frame_idx;
+			shard.shard_idx = i;
+			shard.flags = end_of_slice ? data_shard::end_of_slice : 0;
+		}
+
+		data_shard::view_info_t view_info{};
+		view_info.display_time = 123456789;
+		view_info.pose[1].position.y = 1.5;
+		view_info.fov[0].angleLeft = -0.8;
+		shards.back().view_info = view_info;
+		shards.back().flags |= data_shard::end_of_frame;
+	}
+
+	void
+	add_to(stream_batch &batch) const
+	{
+		for (size_t i = 0; i < shards.size(); i++) {
+			batch.add(shards[i], bitstream.data() + ranges[i].first, ranges[i].second);
+		}
+	}
+
+	data_shard
+	with_payload(size_t i) const
+	{
+		data_shard shard = shards[i];
+		auto begin = bitstream.begin() + ranges[i].first;
+		shard.payload.assign(begin, begin + ranges[i].second);
+		return shard;
+	}
+};
+
+} // namespace
+
+
+TEST_CASE("stream_batch_wire_format")
+{
+	loopback net;
+	frame f(100, 42, 1);
+
+	std::vector<uint8_t> parity_payload(data_shard::max_payload_size + 30, 0xa5);
+	parity_shard parity{};
+	parity.stream_item_idx = 1;
+	parity.frame_idx = 42;
+	parity.data_shard_count = 100;
+	parity.num_parity_elements = 5;
+	parity.parity_element = 3;
+
+	stream_batch batch;
+	SECTION("segmented") {}
+	SECTION("one datagram per shard")
+	{
+		batch.disable_segmentation();
+	}
+
+	f.add_to(batch);
+	batch.add(parity, parity_payload.data(), parity_payload.size());
+	CHECK(batch.size() == 101);
+	batch.flush(net.sender);
+	CHECK(batch.size() == 0);
+
+	// Same bytes as typed_socket::send, one datagram per shard.
+	for (size_t i = 0; i < f.shards.size(); i++) {
+		CAPTURE(i);
+		CHECK(net.receive() == serialize(f.with_payload(i)));
+	}
+	parity.payload = parity_payload;
+	CHECK(net.receive() == serialize(parity));
+}
+
+TEST_CASE("stream_batch_fec_view")
+{
+	frame f(3, 7, 2);
+	stream_batch batch;
+
+	for (size_t i = 0; i < f.shards.size(); i++) {
+		batch.add(f.shards[i], f.bitstream.data() + f.ranges[i].first, f.ranges[i].second);
+
+		size_t count;
+		const iovec *parts = batch.last_shard(count);
+		std::vector<uint8_t> bytes;
+		for (size_t j = 0; j < count; j++) {
+			auto *begin = (const uint8_t *)parts[j].iov_base;
+			bytes.insert(bytes.end(), begin, begin + parts[j].iov_len);
+		}
+
+		// What the headset feeds to its decoder: the shard without the variant index.
+		serialization_packet expected;
+		expected.serialize(f.with_payload(i));
+		CHECK(bytes == std::vector<uint8_t>(expected.data(), expected.data() + expected.size()));
+	}
+}
+
+TEST_CASE("stream_batch_benchmark", "[.][benchmark]")
+{
+	const int frames = 200;
+	const size_t num_shards = 300;
+
+	loopback net;
+	frame f(num_shards, 0, 3);
+
+	std::atomic<bool> done = false;
+	std::atomic<size_t> received = 0;
+	std::thread drain([&] {
+		while (not done) {
+			if (not net.receive().empty()) {
+				received++;
+			}
+		}
+	});
+
+	auto run = [&](const char *name, auto &&send_frame) {
+		// Let the receiver catch up so drops don't skew the next run.
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		received = 0;
+
+		timespec cpu_start;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < frames; i++) {
+			send_frame();
+		}
+
+		double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		timespec cpu_end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+		double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) * 1e-9;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::cout << name << ": " << frames * num_shards / wall << " packets/s, " << cpu / frames * 1e6
+		          << "us CPU per frame, " << received << "/" << frames * num_shards << " received"
+		          << std::endl;
+	};
+
+	std::cout << num_shards << " shards per frame" << std::endl;
+
+	run("send per shard", [&] {
+		for (size_t i = 0; i < num_shards; i++) {
+			net.sender.send(to_headset::stream_packets(f.with_payload(i)));
+		}
+	});
+
+	stream_batch batch;
+	run("sendmmsg + UDP_SEGMENT", [&] {
+		f.add_to(batch);
+		batch.flush(net.sender);
+	});
+
+	batch.disable_segmentation();
+	run("sendmmsg", [&] {
+		f.add_to(batch);
+		batch.flush(net.sender);
+	});
+
+	done = true;
+	// Wake the receiver up.
+	net.sender.send(to_headset::stream_packets(f.with_payload(0)));
+	drain.join();
+}
@@ -0,0 +1,248 @@
+// Copyright 2023, Collabora, Ltd.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief WMR camera transfer unpacking tests.
+ */
+
+#include "os/os_time.h"
+#include "util/u_frame.h"
+#include "util/u_frame_pool.h"
+#include "util/u_debug.h"
+
+#include "wmr/wmr_camera_xfer.h"
+
+#include "catch/catch.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+
+DEBUG_GET_ONCE_OPTION(xfer_dump, "WMR_CAMERA_XFER_DUMP", nullptr)
+
+namespace {
+
+wmr_camera_xfer_layout
+make_layout(int cam_count)
+{
+	wmr_camera_config confs[WMR_MAX_CAMERAS] = {};
+	for (int i = 0; i < cam_count; i++) {
+		confs[i].roi = xrt_rect{{640 * i, 0}, {640, 480}};
+	}
+
+	wmr_camera_xfer_layout layout = {};
+	REQUIRE(wmr_camera_xfer_layout_compute(confs, cam_count, U_LOGGING_WARN, &layout));
+	return layout;
+}
+
+void
+write_le(uint8_t *dst, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		dst[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+//! Packs an image into a transfer like the headset does, the headers are junk.
+std::vector<uint8_t>
+pack(const wmr_camera_xfer_layout &layout, const std::vector<uint8_t> &image, uint64_t start_ts, uint16_t frametype)
+{
+	std::vector<uint8_t> xfer(layout.xfer_size, 0xaa);
+
+	size_t src = 0;
+	size_t dst = 0;
+	while (src < image.size()) {
+		dst += WMR_CAMERA_XFER_HEADER_SIZE;
+		size_t to_copy = std::min(image.size() - src, (size_t)WMR_CAMERA_XFER_CHUNK_SIZE);
+		memcpy(&xfer[dst], &image[src], to_copy);
+		src += to_copy;
+		dst += to_copy;
+	}
+
+	REQUIRE(xfer.size() - dst == WMR_CAMERA_XFER_FOOTER_SIZE);
+	uint8_t *footer = &xfer[dst];
+	write_le(footer + 0, start_ts / 100, 8);
+	write_le(footer + 8, (start_ts + 11100000) / 100, 8);
+	write_le(footer + 16, 88, 2);
+	write_le(footer + 18, 0, 2);
+	memcpy(footer + 20, "Dlo+", 4);
+	write_le(footer + 24, frametype, 2);
+
+	return xfer;
+}
+
+std::vector<uint8_t>
+make_image(const wmr_camera_xfer_layout &layout, uint8_t seed)
+{
+	std::vector<uint8_t> image(layout.image_size);
+	for (size_t i = 0; i < image.size(); i++) {
+		image[i] = (uint8_t)(i * 7 + seed + i / 4093);
+	}
+	return image;
+}
+
+} // namespace
+
+
+TEST_CASE("wmr_camera_xfer")
+{
+	SECTION("layout")
+	{
+		// Sizes seen from the headsets.
+		CHECK(make_layout(2).xfer_size == 616538);
+		CHECK(make_layout(4).xfer_size == 1233018);
+		CHECK(make_layout(4).image_size == 2560 * 481);
+	}
+
+	SECTION("unpack")
+	{
+		for (int cam_count : {2, 4}) {
+			wmr_camera_xfer_layout layout = make_layout(cam_count);
+			std::vector<uint8_t> image = make_image(layout, (uint8_t)cam_count);
+			std::vector<uint8_t> xfer = pack(layout, image, 123456700, 2);
+
+			std::vector<uint8_t> out(layout.image_size);
+			wmr_camera_xfer_footer footer = {};
+			REQUIRE(wmr_camera_xfer_unpack(&layout, xfer.data(), xfer.size(), out.data(), &footer));
+			CHECK(out == image);
+			CHECK(footer.start_ts == 123456700);
+			CHECK(footer.end_ts == 123456700 + 11100000);
+			CHECK(footer.ctr == 88);
+			CHECK(footer.frametype == 2);
+		}
+	}
+
+	SECTION("short or wrong transfers")
+	{
+		wmr_camera_xfer_layout layout = make_layout(2);
+		std::vector<uint8_t> xfer = pack(layout, make_image(layout, 0), 0, 0);
+		std::vector<uint8_t> out(layout.image_size);
+		wmr_camera_xfer_footer footer = {};
+
+		CHECK_FALSE(wmr_camera_xfer_unpack(&layout, xfer.data(), xfer.size() - 1, out.data(), &footer));
+
+		wmr_camera_xfer_layout bad = layout;
+		bad.image_size += WMR_CAMERA_XFER_CHUNK_SIZE;
+		CHECK_FALSE(wmr_camera_xfer_unpack(&bad, xfer.data(), xfer.size(), out.data(), &footer));
+	}
+
+	SECTION("camera frames are views into the pooled frame")
+	{
+		wmr_camera_xfer_layout layout = make_layout(4);
+		std::vector<uint8_t> image = make_image(layout, 3);
+		std::vector<uint8_t> xfer = pack(layout, image, 0, 0);
+
+		u_frame_pool *pool = u_frame_pool_create("Test WMR frames", 0);
+		xrt_frame *xf = nullptr;
+		u_frame_pool_create_frame(pool, XRT_FORMAT_L8, layout.frame_width, layout.frame_height + 1, &xf);
+		REQUIRE(xf->size == layout.image_size);
+
+		wmr_camera_xfer_footer footer = {};
+		REQUIRE(wmr_camera_xfer_unpack(&layout, xfer.data(), xfer.size(), xf->data, &footer));
+
+		for (int i = 0; i < 4; i++) {
+			xrt_frame *view = nullptr;
+			u_frame_create_roi(xf, xrt_rect{{640 * i, 1}, {640, 480}}, &view);
+			CHECK(view->data == xf->data + xf->stride + 640 * i);
+			CHECK(view->data[view->stride * 479 + 639] == image[xf->stride * 480 + 640 * i + 639]);
+			xrt_frame_reference(&view, nullptr);
+		}
+
+		xrt_frame_reference(&xf, nullptr);
+		u_frame_pool_destroy(&pool);
+	}
+
+	SECTION("dump round trip")
+	{
+		wmr_camera_xfer_layout layout = make_layout(2);
+		FILE *file = tmpfile();
+		REQUIRE(file != nullptr);
+
+		REQUIRE(wmr_camera_xfer_dump_write_header(file, &layout));
+		for (uint8_t i = 0; i < 3; i++) {
+			std::vector<uint8_t> xfer = pack(layout, make_image(layout, i), 1000 * i, 0);
+			REQUIRE(fwrite(xfer.data(), 1, xfer.size(), file) == xfer.size());
+		}
+		rewind(file);
+
+		wmr_camera_xfer_layout read = {};
+		REQUIRE(wmr_camera_xfer_dump_read_header(file, &read));
+		CHECK(read.frame_width == layout.frame_width);
+		CHECK(read.frame_height == layout.frame_height);
+		CHECK(read.image_size == layout.image_size);
+		CHECK(read.xfer_size == layout.xfer_size);
+
+		std::vector<uint8_t> xfer(read.xfer_size);
+		std::vector<uint8_t> out(read.image_size);
+		for (uint8_t i = 0; i < 3; i++) {
+			REQUIRE(fread(xfer.data(), 1, xfer.size(), file) == xfer.size());
+			wmr_camera_xfer_footer footer = {};
+			REQUIRE(wmr_camera_xfer_unpack(&read, xfer.data(), xfer.size(), out.data(), &footer));
+			CHECK(out == make_image(layout, i));
+			CHECK(footer.start_ts == 1000u * i);
+		}
+
+		fclose(file);
+	}
+}
+
+TEST_CASE("wmr_camera_xfer_dump", "[.][benchmark]")
+{
+	// Replays transfers recorded with WMR_CAMERA_XFER_DUMP set while running
+	// the headset, or synthetic HP G2 transfers without one.
+	const char *path = debug_get_option_xfer_dump();
+
+	wmr_camera_xfer_layout layout = {};
+	std::vector<std::vector<uint8_t>> xfers;
+
+	if (path != nullptr) {
+		FILE *file = fopen(path, "rb");
+		REQUIRE(file != nullptr);
+		REQUIRE(wmr_camera_xfer_dump_read_header(file, &layout));
+
+		std::vector<uint8_t> xfer(layout.xfer_size);
+		while (fread(xfer.data(), 1, xfer.size(), file) == xfer.size()) {
+			xfers.push_back(xfer);
+		}
+		fclose(file);
+	} else {
+		layout = make_layout(4);
+		for (uint8_t i = 0; i < 8; i++) {
+			xfers.push_back(pack(layout, make_image(layout, i), 11100000ull * i, i % 3 == 0 ? 0 : 2));
+		}
+	}
+	REQUIRE(!xfers.empty());
+
+	u_frame_pool *pool = u_frame_pool_create("Dump WMR frames", 0);
+
+	const int rounds = 100;
+	uint64_t frame_count = 0;
+	uint64_t last_start_ts = 0;
+	uint64_t start = os_monotonic_get_ns();
+	for (int r = 0; r < rounds; r++) {
+		for (const std::vector<uint8_t> &xfer : xfers) {
+			xrt_frame *xf = nullptr;
+			u_frame_pool_create_frame(pool, XRT_FORMAT_L8, layout.frame_width, layout.frame_height + 1, &xf);
+
+			wmr_camera_xfer_footer footer = {};
+			REQUIRE(wmr_camera_xfer_unpack(&layout, xfer.data(), xfer.size(), xf->data, &footer));
+			if (r == 0) {
+				CHECK(footer.start_ts >= last_start_ts);
+				last_start_ts = footer.start_ts;
+			}
+
+			xrt_frame_reference(&xf, nullptr);
+			frame_count++;
+		}
+	}
+	uint64_t elapsed_ns = os_monotonic_get_ns() - start;
+
+	u_frame_pool_stats stats;
+	u_frame_pool_get_stats(pool, &stats);
+	std::cout << xfers.size() << " transfers of " << layout.xfer_size << " bytes: " << elapsed_ns / frame_count
+	          << "ns per transfer, " << stats.misses << " frame allocations for " << frame_count << " transfers"
+	          << std::endl;
+
+	u_frame_pool_destroy(&pool);
+}
@@ -7,11 +7,14 @@
  */
 
 #include <util/u_worker.hpp>
+#include <util/u_worker_bands.h>
 
 #include "catch/catch.hpp"
 
+#include <atomic>
 #include <thread>
 #include <chrono>
+#include <vector>
 
 using namespace std::chrono_literals;
 
@@ -130,3 +133,88 @@ TEST_CASE("TaskCollection")
 		CHECK(calledA[2]);
 	}
 }
+
+namespace {
+
+struct band_rows
+{
+	std::vector<std::atomic<int>> visits;
+	std::atomic<uint32_t> band_count{0};
+
+	explicit band_rows(uint32_t h) : visits(h) {}
+
+	static void
+	func(void *ptr, uint32_t y, uint32_t h)
+	{
+		band_rows *r = static_cast<band_rows *>(ptr);
+		for (uint32_t i = y; i < y + h; i++) {
+			r->visits[i]++;
+		}
+		r->band_count++;
+	}
+
+	bool
+	each_row_once() const
+	{
+		for (const std::atomic<int> &v : visits) {
+			if (v != 1) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+} // namespace
+
+TEST_CASE("u_worker_bands")
+{
+	u_worker_bands a;
+	u_worker_bands b;
+	u_worker_bands_init(&a, 4);
+	u_worker_bands_init(&b, 100);
+	CHECK(b.band_count == U_WORKER_BANDS_MAX);
+
+	SECTION("small frames stay on the calling thread")
+	{
+		band_rows rows(2 * U_WORKER_BANDS_MIN_ROWS - 1);
+		u_worker_bands_run(&a, (uint32_t)rows.visits.size(), band_rows::func, &rows);
+		CHECK(rows.each_row_once());
+		CHECK(rows.band_count == 1);
+		CHECK(a.group == nullptr);
+	}
+
+	SECTION("every row once, left over rows in the last band")
+	{
+		band_rows rows(4 * U_WORKER_BANDS_MIN_ROWS + 3);
+		u_worker_bands_run(&a, (uint32_t)rows.visits.size(), band_rows::func, &rows);
+		CHECK(rows.each_row_once());
+		CHECK(rows.band_count == 4);
+	}
+
+	SECTION("instances share one pool")
+	{
+		band_rows rows_a(480);
+		band_rows rows_b(1080);
+		std::thread t([&] {
+			for (int i = 0; i < 50; i++) {
+				u_worker_bands_run(&a, 480, band_rows::func, &rows_a);
+			}
+		});
+		for (int i = 0; i < 50; i++) {
+			u_worker_bands_run(&b, 1080, band_rows::func, &rows_b);
+		}
+		t.join();
+
+		for (const std::atomic<int> &v : rows_b.visits) {
+			CHECK(v == 50);
+		}
+		CHECK(a.group != nullptr);
+		CHECK(b.group != nullptr);
+	}
+
+	u_worker_bands_fini(&a);
+	u_worker_bands_fini(&b);
+	CHECK(a.group == nullptr);
+	CHECK(b.group == nullptr);
+}